@@ -10,6 +10,9 @@ typedef row_major float4x4 XMMATRIX;
 typedef uint UINT;
 typedef uint2 XMUINT2;
 #else
+// Same typedef as windows.h, repeating it is legal, the headless tools build without it
+#include <DirectXMath.h>
+typedef unsigned int UINT;
 using namespace DirectX;
 #endif
 
@@ -68,6 +71,11 @@ struct MaterialData
     int albedoViewTextureIndex;
     int metallicViewTextureIndex;
     int normalViewTextureIndex;
+
+    XMFLOAT3 emissiveFactor;    // Emission strength included, CPU path tracer only for now
+    int emissiveTextureIndex;
+
+    int albedoVirtualTexture;   // VirtualTextureInfo index, -1 samples albedoViewTextureIndex only
 };
 
 struct MeshStructuredBuffer
@@ -96,6 +104,72 @@ struct MeshVertex
     XMFLOAT2 Uv;
 };
 
+// Virtual texture page ids (VirtualTexture.h)
+// Feedback entry: texture (10 bits) | mip (4 bits) | page x (9 bits) | page y (9 bits)
+#define VT_PAGE_SIZE 128            // texels per page side in virtual space
+#define VT_INVALID_PAGE 0xFFFFFFFF
+#define VT_TEXTURE_SHIFT 22
+#define VT_MIP_SHIFT 18
+#define VT_PAGE_X_SHIFT 9
+#define VT_PAGE_MASK 0x1FF
+#define VT_MIP_MASK 0xF
+#define VT_TEXTURE_MASK 0x3FF
+#define VT_PAGE_BORDER 4            // filtering border on each side in physical cache
+#define VT_FEEDBACK_SCALE 16        // feedback texture is render target size / scale
+
+// Bindless indices of one virtual texture (VirtualTexturing.h, virtualtexture.hlsli)
+struct VirtualTextureInfo
+{
+    UINT textureId;             // page id texture in feedback
+    UINT pageTableIndex;        // RGBA8 (slot x, slot y, resident mip, valid) per page, mipmapped
+    UINT physicalIndex;         // physical cache, one level
+    UINT numMips;               // page level mips
+    XMFLOAT2 sizeInPages;       // mip 0
+    XMFLOAT2 physicalSlots;
+};
+
+// HiZ occlusion test, bounds are projected on the CPU (see HiZ.h)
+#define HIZ_BUILD_GROUP_SIZE 8
+#define HIZ_CULL_GROUP_SIZE 64
+
+struct HiZTestEntry
+{
+    XMUINT2 rectMin;            // mip 0 pixels, inclusive
+    XMUINT2 rectMax;
+    float minZ;                 // nearest depth of the box
+    UINT instanceIndex;         // predicate at instanceIndex * 8 bytes
+    XMUINT2 pad;
+};
+
+// Indirect draws, records are compacted into arguments on the GPU (see IndirectDraw.h)
+#define INDIRECT_GROUP_SIZE 64
+#define INDIRECT_SCAN_GROUP_SIZE 1024
+
+struct DrawRecord
+{
+    XMFLOAT3 centerBound;       // World space
+    UINT indexCount;            // Current LOD
+    XMFLOAT3 extentsBound;
+    UINT startIndex;
+    int baseVertex;
+    UINT materialIndex;
+    UINT instanceIndex;         // Mesh structured buffer entry
+    UINT pad;
+};
+
+// Root constants (ModelConstants) then D3D12_DRAW_INDEXED_ARGUMENTS, command signature stride
+struct IndirectDrawArgs
+{
+    UINT drawId;                // ModelConstants.meshIndex
+    UINT materialIndex;
+    UINT indexCountPerInstance;
+    UINT instanceCount;
+    UINT startIndexLocation;
+    int baseVertexLocation;
+    UINT startInstanceLocation;
+    UINT pad;
+};
+
 struct RayPayload
 {
     XMFLOAT4 color;
@@ -38,6 +38,26 @@ StructuredBuffer<MaterialData> materialData : register(t1);
 
 SamplerState g_sampler : register(s0);
 
+// Virtual albedo, page requests go to the feedback texture (VirtualTexturing.h)
+StructuredBuffer<VirtualTextureInfo> virtualTextures : register(t2);
+RWTexture2D<uint> vtFeedback : register(u0);
+#include "virtualtexture.hlsli"
+
+// Resident virtual page when there is one, the streamed texture otherwise
+float4 SampleAlbedo(MaterialData material, float2 pixel, float2 uv)
+{
+    float4 albedo = materialTex[NonUniformResourceIndex(material.albedoViewTextureIndex)].Sample(g_sampler, uv);
+    if (material.albedoVirtualTexture >= 0)
+    {
+        float4 virtualAlbedo;
+        if (SampleVirtualTexture(virtualTextures[material.albedoVirtualTexture], g_sampler, pixel, uv, virtualAlbedo))
+        {
+            albedo = virtualAlbedo;
+        }
+    }
+    return albedo;
+}
+
 VSOutput VSMain(VSInput input)
 {
     VSOutput output;
@@ -125,7 +145,7 @@ PSOutput PSGBuffer(VSOutput input)
     }
     else if (material.albedoViewTextureIndex >= 0)
     {
-        albedo *= materialTex[NonUniformResourceIndex(material.albedoViewTextureIndex)].Sample(g_sampler, input.uv).rgb;
+        albedo *= SampleAlbedo(material, input.position.xy, input.uv).rgb;
     }
     
     //
@@ -163,7 +183,7 @@ PSOutput PSAlphaTest(VSOutput input)
     }
     else if (material.albedoViewTextureIndex >= 0)
     {
-        float4 albedoSample = materialTex[NonUniformResourceIndex(material.albedoViewTextureIndex)].Sample(g_sampler, input.uv);
+        float4 albedoSample = SampleAlbedo(material, input.position.xy, input.uv);
         if (albedoSample.a < material.alphaCutoff)
             discard;
         albedo.rgb *= albedoSample.rgb;
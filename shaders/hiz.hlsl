@@ -1,43 +1,100 @@
-// hiz.hlsl (generate hierarhical z)
+// hiz.hlsl (generate hierarhical z, occlusion test)
 /*
  Works under the assumption that it's likely that objects visible in the previous frame, will be visible this frame.
 
-    In Phase 1, we render all objects that were visible last frame by testing against the previous HZB.
-    Occluded objects are stored in a list, to be processed later.
-    The HZB is constructed from the current result.
-    Phase 2 tests all previously occluded objects against the new HZB and renders unoccluded.
-    The HZB is constructed again from this result to be used in the next frame.
+    In Phase 1, we render depth of all objects that were visible last frame (per instance bits kept on the CPU).
+    The HZB is constructed from that depth.
+    CullCS tests every frustum visible object against it and writes one predicate per instance.
+    Phase 2 renders the previously occluded objects, each draw predicated on its result.
+    Predicates are read back and become the visibility bits of the next frame.
+
+ HiZ.cpp is the CPU reference of both kernels, keep them in sync.
 */
-Texture2D<float> InputDepth : register(t0);
+#define HLSL
+#include "HLSLCompatible.h"
+
+Texture2D<float> InputDepth : register(t0);     // Build: depth or previous mip, Cull: full HZB chain
 RWTexture2D<float> OutputHiZ : register(u0);
+StructuredBuffer<HiZTestEntry> Tests : register(t1);
+RWByteAddressBuffer Predicates : register(u1);  // 8 bytes per instance, D3D12 predication
 
 cbuffer HiZConstantBuffer : register(b0)
 {
-    float2 OutDimensions;
-    uint MipLevel;
+    uint2 SrcSize;      // Build: previous mip, Cull: mip 0
+    uint2 OutDimensions;
+    uint MipLevel;      // Build: destination mip, Cull: number of mips
+    uint NumTests;
 };
 
-[numthreads(8, 8, 1)]
+// Max over the 2x2 footprint, the last texel of an odd sized source also covers the extra row/column
+float ReduceTexel(uint2 pixelPos)
+{
+    uint2 srcMin = min(pixelPos * 2, SrcSize - 1);
+    uint2 srcMax = pixelPos * 2 + 1;
+    if (pixelPos.x == OutDimensions.x - 1)
+        srcMax.x = SrcSize.x - 1;
+    if (pixelPos.y == OutDimensions.y - 1)
+        srcMax.y = SrcSize.y - 1;
+
+    float maxDepth = 0.0;
+    for (uint y = srcMin.y; y <= srcMax.y; ++y)
+    {
+        for (uint x = srcMin.x; x <= srcMax.x; ++x)
+        {
+            maxDepth = max(maxDepth, InputDepth[uint2(x, y)]);
+        }
+    }
+    return maxDepth;
+}
+
+[numthreads(HIZ_BUILD_GROUP_SIZE, HIZ_BUILD_GROUP_SIZE, 1)]
 void CSMain(uint3 DTid : SV_DispatchThreadID)
 {
     uint2 pixelPos = DTid.xy;
-    uint width, height, numMips;
-    //OutputHiZ.GetDimensions(0, width, height, numMips);
-    if (pixelPos.x >= OutDimensions.x|| pixelPos.y >= OutDimensions.y)
+    if (pixelPos.x >= OutDimensions.x || pixelPos.y >= OutDimensions.y)
         return;
-    
+
     if (MipLevel == 0)
     {
         OutputHiZ[pixelPos] = InputDepth[pixelPos];
     }
     else
     {
-        uint2 srcPos = pixelPos * 2;
-        float4 depths = float4(
-        InputDepth[srcPos + uint2(0, 0)],
-        InputDepth[srcPos + uint2(1, 0)],
-        InputDepth[srcPos + uint2(0, 1)],
-        InputDepth[srcPos + uint2(1, 1)]);
-        OutputHiZ[pixelPos] = max(max(depths.x, depths.y), max(depths.z, depths.w));
+        OutputHiZ[pixelPos] = ReduceTexel(pixelPos);
     }
-}
\ No newline at end of file
+}
+
+// Finest mip where the rect spans at most 2x2 texels
+uint SelectMip(HiZTestEntry test)
+{
+    uint mip = 0;
+    while (mip + 1 < MipLevel &&
+        ((test.rectMax.x >> mip) - (test.rectMin.x >> mip) > 1 ||
+         (test.rectMax.y >> mip) - (test.rectMin.y >> mip) > 1))
+    {
+        ++mip;
+    }
+    return mip;
+}
+
+[numthreads(HIZ_CULL_GROUP_SIZE, 1, 1)]
+void CullCS(uint3 DTid : SV_DispatchThreadID)
+{
+    if (DTid.x >= NumTests)
+        return;
+
+    HiZTestEntry test = Tests[DTid.x];
+    uint mip = SelectMip(test);
+
+    // Clamped texel of a pixel covers it at every mip
+    uint2 lastTexel = max(SrcSize >> mip, 1) - 1;
+    uint2 texelMin = min(test.rectMin >> mip, lastTexel);
+    uint2 texelMax = min(test.rectMax >> mip, lastTexel);
+
+    float maxDepth = max(
+        max(InputDepth.Load(int3(texelMin.x, texelMin.y, mip)), InputDepth.Load(int3(texelMax.x, texelMin.y, mip))),
+        max(InputDepth.Load(int3(texelMin.x, texelMax.y, mip)), InputDepth.Load(int3(texelMax.x, texelMax.y, mip))));
+
+    uint visible = (maxDepth >= test.minZ) ? 1 : 0;
+    Predicates.Store2(test.instanceIndex * 8, uint2(visible, 0));
+}
@@ -0,0 +1,138 @@
+// indirect.hlsl (GPU driven draw arguments)
+/*
+ Records are frustum culled and the visible ones compacted into draw arguments, in record order.
+ Every bucket (pipeline) is a contiguous range of records and writes the same range of arguments.
+
+    CountCS counts the visible records of every group.
+    ScanCS turns the counts into group offsets (exclusive scan) and writes the draw count of the bucket.
+    CompactCS tests again and writes each visible record at its group offset plus the visible threads before it.
+
+ No atomic decides where an argument goes, IndirectDraw.cpp is the CPU reference and emits the same stream.
+*/
+#define HLSL
+#include "HLSLCompatible.h"
+
+StructuredBuffer<DrawRecord> Records : register(t0);
+RWStructuredBuffer<IndirectDrawArgs> Args : register(u0);
+RWByteAddressBuffer GroupCounts : register(u1);    // Offsets after ScanCS
+RWByteAddressBuffer DrawCounts : register(u2);     // One uint per bucket
+
+cbuffer IndirectConstantBuffer : register(b0)
+{
+    uint FirstRecord;       // Bucket range, arguments use the same range
+    uint NumRecords;
+    uint FirstGroup;        // Bucket groups in GroupCounts
+    uint Bucket;
+    float4 Planes[6];       // Pointing out of the frustum
+};
+
+// Same operations in the same order as IsBoxOutside, precise keeps them from being fused
+bool IsVisible(DrawRecord record)
+{
+    for (uint i = 0; i < 6; ++i)
+    {
+        float4 plane = Planes[i];
+        precise float dist = plane.x * record.centerBound.x + plane.y * record.centerBound.y + plane.z * record.centerBound.z + plane.w;
+        precise float radius = abs(plane.x) * record.extentsBound.x + abs(plane.y) * record.extentsBound.y + abs(plane.z) * record.extentsBound.z;
+        if (dist > radius)
+            return false;
+    }
+    return true;
+}
+
+groupshared uint VisibleCount;
+
+[numthreads(INDIRECT_GROUP_SIZE, 1, 1)]
+void CountCS(uint3 Gid : SV_GroupID, uint GI : SV_GroupIndex)
+{
+    if (GI == 0)
+        VisibleCount = 0;
+    GroupMemoryBarrierWithGroupSync();
+
+    uint index = Gid.x * INDIRECT_GROUP_SIZE + GI;
+    if (index < NumRecords && IsVisible(Records[FirstRecord + index]))
+        InterlockedAdd(VisibleCount, 1);
+    GroupMemoryBarrierWithGroupSync();
+
+    if (GI == 0)
+        GroupCounts.Store((FirstGroup + Gid.x) * 4, VisibleCount);
+}
+
+groupshared uint ScanTotals[INDIRECT_SCAN_GROUP_SIZE];
+
+// Single group, every thread scans a contiguous run of group counts
+[numthreads(INDIRECT_SCAN_GROUP_SIZE, 1, 1)]
+void ScanCS(uint GI : SV_GroupIndex)
+{
+    uint numGroups = (NumRecords + INDIRECT_GROUP_SIZE - 1) / INDIRECT_GROUP_SIZE;
+    uint perThread = (numGroups + INDIRECT_SCAN_GROUP_SIZE - 1) / INDIRECT_SCAN_GROUP_SIZE;
+    uint begin = min(GI * perThread, numGroups);
+    uint end = min(begin + perThread, numGroups);
+
+    uint total = 0;
+    for (uint g = begin; g < end; ++g)
+    {
+        total += GroupCounts.Load((FirstGroup + g) * 4);
+    }
+    ScanTotals[GI] = total;
+    GroupMemoryBarrierWithGroupSync();
+
+    if (GI == 0)
+    {
+        uint offset = 0;
+        for (uint i = 0; i < INDIRECT_SCAN_GROUP_SIZE; ++i)
+        {
+            uint count = ScanTotals[i];
+            ScanTotals[i] = offset;
+            offset += count;
+        }
+        DrawCounts.Store(Bucket * 4, offset);
+    }
+    GroupMemoryBarrierWithGroupSync();
+
+    uint offset = ScanTotals[GI];
+    for (uint g = begin; g < end; ++g)
+    {
+        uint count = GroupCounts.Load((FirstGroup + g) * 4);
+        GroupCounts.Store((FirstGroup + g) * 4, offset);
+        offset += count;
+    }
+}
+
+groupshared uint VisibleFlags[INDIRECT_GROUP_SIZE];
+
+[numthreads(INDIRECT_GROUP_SIZE, 1, 1)]
+void CompactCS(uint3 Gid : SV_GroupID, uint GI : SV_GroupIndex)
+{
+    uint index = Gid.x * INDIRECT_GROUP_SIZE + GI;
+    DrawRecord record = (DrawRecord)0;
+    bool visible = false;
+    if (index < NumRecords)
+    {
+        record = Records[FirstRecord + index];
+        visible = IsVisible(record);
+    }
+    VisibleFlags[GI] = visible ? 1 : 0;
+    GroupMemoryBarrierWithGroupSync();
+
+    if (!visible)
+        return;
+
+    uint slot = GroupCounts.Load((FirstGroup + Gid.x) * 4);
+    for (uint i = 0; i < GI; ++i)
+    {
+        slot += VisibleFlags[i];
+    }
+
+    // MakeIndirectDrawArgs
+    IndirectDrawArgs args;
+    args.drawId = record.instanceIndex;
+    args.materialIndex = record.materialIndex;
+    args.indexCountPerInstance = record.indexCount;
+    args.instanceCount = 1;
+    args.startIndexLocation = record.startIndex;
+    args.baseVertexLocation = record.baseVertex;
+    args.startInstanceLocation = 0;
+    args.pad = 0;
+    Args[FirstRecord + slot] = args;
+}
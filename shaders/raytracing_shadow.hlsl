@@ -77,12 +77,12 @@ SamplerState g_sampler : register(s0);
         {
             if (query.CandidateType() == CANDIDATE_NON_OPAQUE_TRIANGLE)
             {
-                // Alpha test
+                // Alpha test, InstanceID is the scene instance, the shadow TLAS only holds casters
                 const MeshVertex hitSurface = GetHitSurface(
                     query.CandidateTriangleBarycentrics(),
-                    query.CandidateInstanceIndex(),
+                    query.CandidateInstanceID(),
                     query.CandidatePrimitiveIndex());
-                InstanceInfo instInfo = instanceData[query.CandidateInstanceIndex()];
+                InstanceInfo instInfo = instanceData[query.CandidateInstanceID()];
                 const MaterialData material = materialData[instInfo.MaterialIdx];
                 
                 float4 albedoSample = materialTex[NonUniformResourceIndex(material.albedoViewTextureIndex)].SampleLevel(g_sampler, hitSurface.Uv, 0);
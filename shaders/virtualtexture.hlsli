@@ -0,0 +1,77 @@
+#pragma once
+
+// Virtual texture sampling and feedback, CPU side is VirtualTexture.h / VirtualTexturing.h
+// Page table and physical cache live in the bindless materialTex[] array,
+// caller declares materialTex[] and the RWTexture2D<uint> vtFeedback
+#define HLSL
+#include "HLSLCompatible.h"
+
+// Page count at mip level, same as VirtualTextureCache::PagesX / PagesY
+uint2 VTPagesAtMip(VirtualTextureInfo vt, uint mip)
+{
+    return max(uint2(vt.sizeInPages) >> mip, 1);
+}
+
+// Same layout as PackPageId
+uint EncodeVTFeedback(uint textureId, uint mip, uint2 page)
+{
+    return ((textureId & VT_TEXTURE_MASK) << VT_TEXTURE_SHIFT) |
+        ((mip & VT_MIP_MASK) << VT_MIP_SHIFT) |
+        ((page.x & VT_PAGE_MASK) << VT_PAGE_X_SHIFT) |
+        (page.y & VT_PAGE_MASK);
+}
+
+// Page level mip from uv derivatives in virtual texel space
+uint ComputeVTMip(VirtualTextureInfo vt, float2 uv)
+{
+    float2 texels = uv * vt.sizeInPages * VT_PAGE_SIZE;
+    float2 dx = ddx(texels);
+    float2 dy = ddy(texels);
+    float maxSq = max(dot(dx, dx), dot(dy, dy));
+    return uint(clamp(0.5 * log2(max(maxSq, 1e-8)), 0.0, float(vt.numMips - 1)));
+}
+
+// uv wraps like the sampler of the streamed texture
+uint2 VTPageAtMip(VirtualTextureInfo vt, float2 uv, uint mip)
+{
+    uint2 pages = VTPagesAtMip(vt, mip);
+    return min(uint2(frac(uv) * pages), pages - 1);
+}
+
+// One request per VT_FEEDBACK_SCALE pixel block, the top left pixel writes it
+void WriteVTFeedback(VirtualTextureInfo vt, float2 pixel, float2 uv, uint mip)
+{
+    uint2 p = uint2(pixel);
+    if (all(p % VT_FEEDBACK_SCALE == 0))
+    {
+        vtFeedback[p / VT_FEEDBACK_SCALE] = EncodeVTFeedback(vt.textureId, mip, VTPageAtMip(vt, uv, mip));
+    }
+}
+
+// Translate through the page table, the entry holds the best resident page (requested or coarser ancestor)
+// Writes the feedback of the pixel, returns false if nothing is resident yet
+bool SampleVirtualTexture(VirtualTextureInfo vt, SamplerState samp, float2 pixel, float2 uv, out float4 color)
+{
+    color = 0;
+
+    uint mip = ComputeVTMip(vt, uv);
+    WriteVTFeedback(vt, pixel, uv, mip);
+
+    uint2 page = VTPageAtMip(vt, uv, mip);
+    uint4 entry = uint4(round(materialTex[NonUniformResourceIndex(vt.pageTableIndex)].Load(int3(page, mip)) * 255.0));
+    if (entry.w == 0)
+    {
+        return false;
+    }
+
+    // Position inside the page of the resident mip
+    uint residentMip = entry.z;
+    float2 local = frac(uv) * float2(VTPagesAtMip(vt, residentMip)) - float2(VTPageAtMip(vt, uv, residentMip));
+
+    // Physical cache has one level, the border keeps bilinear filtering inside the slot
+    const float slotSize = VT_PAGE_SIZE + 2 * VT_PAGE_BORDER;
+    float2 physicalSize = vt.physicalSlots * slotSize;
+    float2 texel = float2(entry.xy) * slotSize + VT_PAGE_BORDER + local * VT_PAGE_SIZE;
+    color = materialTex[NonUniformResourceIndex(vt.physicalIndex)].SampleLevel(samp, texel / physicalSize, 0);
+    return true;
+}
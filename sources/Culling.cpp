@@ -0,0 +1,261 @@
+#include "Culling.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+using namespace DirectX;
+
+//
+// Bounds
+//
+void BoundsSoA::Resize(uint32_t numBounds)
+{
+	count = numBounds;
+
+	// Padding is never reported visible, kernels mask the tail
+	const size_t padded = (static_cast<size_t>(numBounds) + 7) & ~size_t(7);
+	centerX.resize(padded, 0.f);
+	centerY.resize(padded, 0.f);
+	centerZ.resize(padded, 0.f);
+	extentX.resize(padded, 0.f);
+	extentY.resize(padded, 0.f);
+	extentZ.resize(padded, 0.f);
+}
+
+void BoundsSoA::Set(uint32_t index, const BoundingBox& box)
+{
+	assert(index < count);
+	centerX[index] = box.Center.x;
+	centerY[index] = box.Center.y;
+	centerZ[index] = box.Center.z;
+	extentX[index] = box.Extents.x;
+	extentY[index] = box.Extents.y;
+	extentZ[index] = box.Extents.z;
+}
+
+BoundingBox BoundsSoA::Get(uint32_t index) const
+{
+	assert(index < count);
+	return BoundingBox(
+		XMFLOAT3(centerX[index], centerY[index], centerZ[index]),
+		XMFLOAT3(extentX[index], extentY[index], extentZ[index]));
+}
+
+void GetFrustumPlanes(const BoundingFrustum& frustum, FrustumPlanes& outPlanes)
+{
+	XMVECTOR planes[6];
+	frustum.GetPlanes(&planes[0], &planes[1], &planes[2], &planes[3], &planes[4], &planes[5]);
+	for (int i = 0; i < 6; ++i)
+	{
+		XMStoreFloat4(&outPlanes.planes[i], planes[i]);
+	}
+}
+
+//
+// Scalar
+//
+bool IsBoxOutside(const FrustumPlanes& planes, const XMFLOAT3& center, const XMFLOAT3& extents)
+{
+	for (const XMFLOAT4& plane : planes.planes)
+	{
+		const float dist = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+		const float radius = fabsf(plane.x) * extents.x + fabsf(plane.y) * extents.y + fabsf(plane.z) * extents.z;
+		if (dist > radius)
+			return true;
+	}
+	return false;
+}
+
+float ProjectedPixelArea(const XMFLOAT3& center, const XMFLOAT3& extents, const XMFLOAT4X4& viewProj, float width, float height)
+{
+	const XMFLOAT4X4& m = viewProj;
+	float minX = 1.f, minY = 1.f, maxX = -1.f, maxY = -1.f;
+	for (int i = 0; i < 8; ++i)
+	{
+		const float x = center.x + ((i & 1) ? extents.x : -extents.x);
+		const float y = center.y + ((i & 2) ? extents.y : -extents.y);
+		const float z = center.z + ((i & 4) ? extents.z : -extents.z);
+		const float clipZ = x * m.m[0][2] + y * m.m[1][2] + z * m.m[2][2] + m.m[3][2];
+		if (clipZ < 0.f)
+			return width * height;
+
+		const float invW = 1.f / (x * m.m[0][3] + y * m.m[1][3] + z * m.m[2][3] + m.m[3][3]);
+		const float ndcX = (x * m.m[0][0] + y * m.m[1][0] + z * m.m[2][0] + m.m[3][0]) * invW;
+		const float ndcY = (x * m.m[0][1] + y * m.m[1][1] + z * m.m[2][1] + m.m[3][1]) * invW;
+		minX = std::min(minX, ndcX);
+		minY = std::min(minY, ndcY);
+		maxX = std::max(maxX, ndcX);
+		maxY = std::max(maxY, ndcY);
+	}
+
+	// NDC spans 2 units per axis
+	const float sizeX = std::max(std::min(maxX, 1.f) - std::max(minX, -1.f), 0.f) * 0.5f * width;
+	const float sizeY = std::max(std::min(maxY, 1.f) - std::max(minY, -1.f), 0.f) * 0.5f * height;
+	return sizeX * sizeY;
+}
+
+static uint32_t CullFrustumScalarRange(const BoundsSoA& bounds, const FrustumPlanes& planes, uint32_t begin, uint32_t end, uint32_t* outIndices)
+{
+	uint32_t numVisible = 0;
+	for (uint32_t i = begin; i < end; ++i)
+	{
+		const XMFLOAT3 center(bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]);
+		const XMFLOAT3 extents(bounds.extentX[i], bounds.extentY[i], bounds.extentZ[i]);
+		outIndices[numVisible] = i;
+		numVisible += IsBoxOutside(planes, center, extents) ? 0 : 1;
+	}
+	return numVisible;
+}
+
+uint32_t CullFrustumScalar(const BoundsSoA& bounds, const FrustumPlanes& planes, uint32_t* outIndices)
+{
+	return CullFrustumScalarRange(bounds, planes, 0, bounds.count, outIndices);
+}
+
+uint32_t CullFrustumList(const BoundsSoA& bounds, const FrustumPlanes& planes, const uint32_t* indices, uint32_t count, uint32_t* outIndices)
+{
+	uint32_t numVisible = 0;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		const uint32_t index = indices[i];
+		const XMFLOAT3 center(bounds.centerX[index], bounds.centerY[index], bounds.centerZ[index]);
+		const XMFLOAT3 extents(bounds.extentX[index], bounds.extentY[index], bounds.extentZ[index]);
+		outIndices[numVisible] = index;
+		numVisible += IsBoxOutside(planes, center, extents) ? 0 : 1;
+	}
+	return numVisible;
+}
+
+uint32_t UpdateVisibleIndices(const BoundsSoA& bounds, const FrustumPlanes& planes, const uint32_t* moved, uint32_t numMoved, const uint8_t* movedFlags, uint32_t* indices, uint32_t numVisible)
+{
+	uint32_t numKept = 0;
+	for (uint32_t i = 0; i < numVisible; ++i)
+	{
+		indices[numKept] = indices[i];
+		numKept += movedFlags[indices[i]] ? 0 : 1;
+	}
+	for (uint32_t i = 0; i < numMoved; ++i)
+	{
+		const uint32_t index = moved[i];
+		assert(index < bounds.count && movedFlags[index]);
+		const XMFLOAT3 center(bounds.centerX[index], bounds.centerY[index], bounds.centerZ[index]);
+		const XMFLOAT3 extents(bounds.extentX[index], bounds.extentY[index], bounds.extentZ[index]);
+		indices[numKept] = index;
+		numKept += IsBoxOutside(planes, center, extents) ? 0 : 1;
+	}
+	return numKept;
+}
+
+//
+// AVX2, 8 boxes per iteration
+// Same operation order as scalar (no FMA) so both paths agree exactly
+//
+TARGET_AVX2 static uint32_t CullFrustumAVX2Range(const BoundsSoA& bounds, const FrustumPlanes& planes, uint32_t begin, uint32_t end, uint32_t* outIndices)
+{
+	const __m256 signMask = _mm256_set1_ps(-0.f);
+
+	__m256 planeX[6], planeY[6], planeZ[6], planeW[6];
+	__m256 absX[6], absY[6], absZ[6];
+	for (int p = 0; p < 6; ++p)
+	{
+		planeX[p] = _mm256_set1_ps(planes.planes[p].x);
+		planeY[p] = _mm256_set1_ps(planes.planes[p].y);
+		planeZ[p] = _mm256_set1_ps(planes.planes[p].z);
+		planeW[p] = _mm256_set1_ps(planes.planes[p].w);
+		absX[p] = _mm256_andnot_ps(signMask, planeX[p]);
+		absY[p] = _mm256_andnot_ps(signMask, planeY[p]);
+		absZ[p] = _mm256_andnot_ps(signMask, planeZ[p]);
+	}
+
+	uint32_t numVisible = 0;
+	for (uint32_t i = begin; i < end; i += 8)
+	{
+		const __m256 cx = _mm256_loadu_ps(&bounds.centerX[i]);
+		const __m256 cy = _mm256_loadu_ps(&bounds.centerY[i]);
+		const __m256 cz = _mm256_loadu_ps(&bounds.centerZ[i]);
+		const __m256 ex = _mm256_loadu_ps(&bounds.extentX[i]);
+		const __m256 ey = _mm256_loadu_ps(&bounds.extentY[i]);
+		const __m256 ez = _mm256_loadu_ps(&bounds.extentZ[i]);
+
+		__m256 outside = _mm256_setzero_ps();
+		for (int p = 0; p < 6; ++p)
+		{
+			__m256 dist = _mm256_add_ps(_mm256_mul_ps(planeX[p], cx), _mm256_mul_ps(planeY[p], cy));
+			dist = _mm256_add_ps(_mm256_add_ps(dist, _mm256_mul_ps(planeZ[p], cz)), planeW[p]);
+
+			__m256 radius = _mm256_add_ps(_mm256_mul_ps(absX[p], ex), _mm256_mul_ps(absY[p], ey));
+			radius = _mm256_add_ps(radius, _mm256_mul_ps(absZ[p], ez));
+
+			outside = _mm256_or_ps(outside, _mm256_cmp_ps(dist, radius, _CMP_GT_OQ));
+		}
+
+		uint32_t visibleMask = ~static_cast<uint32_t>(_mm256_movemask_ps(outside)) & 0xFF;
+		if (i + 8 > end)
+		{
+			visibleMask &= (1u << (end - i)) - 1;
+		}
+
+		// Branchless compaction, always writes 8 slots
+		for (uint32_t lane = 0; lane < 8; ++lane)
+		{
+			outIndices[numVisible] = i + lane;
+			numVisible += (visibleMask >> lane) & 1;
+		}
+	}
+	return numVisible;
+}
+
+uint32_t CullFrustumAVX2(const BoundsSoA& bounds, const FrustumPlanes& planes, uint32_t* outIndices)
+{
+	return CullFrustumAVX2Range(bounds, planes, 0, bounds.count, outIndices);
+}
+
+bool CpuSupportsAVX2()
+{
+	static const bool supported = []()
+	{
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+			return false;
+
+		// AVX + OSXSAVE, then OS saves xmm/ymm state
+		__cpuid(info, 1);
+		if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+			return false;
+		if ((_xgetbv(0) & 0x6) != 0x6)
+			return false;
+
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		return __builtin_cpu_supports("avx2") != 0;
+#endif
+	}();
+	return supported;
+}
+
+uint32_t CullFrustum(const BoundsSoA& bounds, const FrustumPlanes& planes, uint32_t* outIndices, bool allowSimd)
+{
+	if (allowSimd && CpuSupportsAVX2())
+	{
+		return CullFrustumAVX2(bounds, planes, outIndices);
+	}
+	return CullFrustumScalar(bounds, planes, outIndices);
+}
+
+uint32_t CullFrustumRange(const BoundsSoA& bounds, const FrustumPlanes& planes, uint32_t begin, uint32_t end, uint32_t* outIndices, bool allowSimd)
+{
+	assert(begin % 8 == 0 && end <= bounds.count);
+	if (allowSimd && CpuSupportsAVX2())
+	{
+		return CullFrustumAVX2Range(bounds, planes, begin, end, outIndices);
+	}
+	return CullFrustumScalarRange(bounds, planes, begin, end, outIndices);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+
+// CPU frustum culling over instance world bounds (no D3D dependency)
+
+// World space AABBs as structure of arrays, padded to a multiple of 8 for the wide kernel
+struct BoundsSoA
+{
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> extentX, extentY, extentZ;
+	uint32_t count = 0;
+
+	void Resize(uint32_t numBounds);
+	void Set(uint32_t index, const DirectX::BoundingBox& box);
+	DirectX::BoundingBox Get(uint32_t index) const;
+};
+
+// Plane (normal, distance) pointing out of the frustum, point is inside when dot <= 0
+struct FrustumPlanes
+{
+	DirectX::XMFLOAT4 planes[6];
+};
+
+void GetFrustumPlanes(const DirectX::BoundingFrustum& frustum, FrustumPlanes& outPlanes);
+
+// Box is culled when fully outside any plane, same result as BoundingFrustum::Contains == DISJOINT
+bool IsBoxOutside(const FrustumPlanes& planes, const DirectX::XMFLOAT3& center, const DirectX::XMFLOAT3& extents);
+
+// Row vector point times matrix, clip space position through a viewProj
+inline DirectX::XMFLOAT4 TransformPoint(const DirectX::XMFLOAT3& p, const DirectX::XMFLOAT4X4& m)
+{
+	return DirectX::XMFLOAT4(
+		p.x * m.m[0][0] + p.y * m.m[1][0] + p.z * m.m[2][0] + m.m[3][0],
+		p.x * m.m[0][1] + p.y * m.m[1][1] + p.z * m.m[2][1] + m.m[3][1],
+		p.x * m.m[0][2] + p.y * m.m[1][2] + p.z * m.m[2][2] + m.m[3][2],
+		p.x * m.m[0][3] + p.y * m.m[1][3] + p.z * m.m[2][3] + m.m[3][3]);
+}
+
+// Pixels covered by the screen rect of the projected box, clipped to the screen
+// viewProj is row vector convention (world * view * proj), a box crossing the near plane covers the screen
+float ProjectedPixelArea(const DirectX::XMFLOAT3& center, const DirectX::XMFLOAT3& extents, const DirectX::XMFLOAT4X4& viewProj, float width, float height);
+
+// Write indices of visible bounds in ascending order, returns count
+// outIndices needs room for bounds.centerX.size() entries (padded count)
+uint32_t CullFrustumScalar(const BoundsSoA& bounds, const FrustumPlanes& planes, uint32_t* outIndices);
+uint32_t CullFrustumAVX2(const BoundsSoA& bounds, const FrustumPlanes& planes, uint32_t* outIndices);
+
+// Only the listed bounds, order kept, outIndices may alias indices. Returns count
+uint32_t CullFrustumList(const BoundsSoA& bounds, const FrustumPlanes& planes, const uint32_t* indices, uint32_t count, uint32_t* outIndices);
+
+// Visible list of the same planes after some bounds changed, moved holds every changed index once
+// and movedFlags is nonzero at those indices. Order of the other entries is kept, the moved ones
+// inside the frustum go to the end. Returns the new count, indices needs room for bounds.count entries
+uint32_t UpdateVisibleIndices(const BoundsSoA& bounds, const FrustumPlanes& planes, const uint32_t* moved, uint32_t numMoved, const uint8_t* movedFlags, uint32_t* indices, uint32_t numVisible);
+
+// Runtime check (cpuid + OS support for ymm state)
+bool CpuSupportsAVX2();
+
+// AVX2 code paths behind CpuSupportsAVX2. MSVC emits AVX2 intrinsics without /arch, gcc/clang need
+// the function target. Flatten also compiles the templates inlined into the function for AVX2
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX2_FLATTEN __attribute__((target("avx2"), flatten))
+#else
+#define TARGET_AVX2
+#define TARGET_AVX2_FLATTEN
+#endif
+
+// AVX2 when allowed and supported, scalar otherwise
+uint32_t CullFrustum(const BoundsSoA& bounds, const FrustumPlanes& planes, uint32_t* outIndices, bool allowSimd = true);
+
+// Bounds [begin, end) only, for splitting across threads. begin is a multiple of 8,
+// outIndices needs room for the range rounded up to a multiple of 8
+uint32_t CullFrustumRange(const BoundsSoA& bounds, const FrustumPlanes& planes, uint32_t begin, uint32_t end, uint32_t* outIndices, bool allowSimd = true);
@@ -6,6 +6,7 @@ Microsoft::WRL::ComPtr<ID3D12Device5> d3dDevice = nullptr;
 Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList4> commandList = nullptr;
 Microsoft::WRL::ComPtr<ID3D12CommandAllocator> commandAllocator = nullptr;
 Microsoft::WRL::ComPtr<ID3D12CommandQueue> commandQueue = nullptr;
+bool gpuIdle = true;
 
 Microsoft::WRL::ComPtr<IDxcUtils> dxcUtils = nullptr;
 Microsoft::WRL::ComPtr<IDxcCompiler3> dxcCompiler = nullptr;
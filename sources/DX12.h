@@ -6,6 +6,10 @@ extern Microsoft::WRL::ComPtr<ID3D12Device5> d3dDevice;
 extern Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList4> commandList;
 extern Microsoft::WRL::ComPtr<ID3D12CommandAllocator> commandAllocator;
 extern Microsoft::WRL::ComPtr<ID3D12CommandQueue> commandQueue;
+// One frame in flight: MoveToNextFrame returns once the GPU finished the frame it submitted, so CPU
+// visible buffers (uploads, instance descs, draw records) are rewritten in place while recording.
+// False from ExecuteCommandLists until that wait, assert it before reusing such a buffer
+extern bool gpuIdle;
 // Shaders
 extern Microsoft::WRL::ComPtr<IDxcUtils> dxcUtils;
 extern Microsoft::WRL::ComPtr<IDxcCompiler3> dxcCompiler;
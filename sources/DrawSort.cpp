@@ -0,0 +1,97 @@
+#include "DrawSort.h"
+#include "RadixSort.h"
+#include "Utility.h"
+
+#include <assert.h>
+#include <float.h>
+#include <random>
+#include <string.h>
+
+uint32_t QuantizeDrawDepth(float viewDepth)
+{
+	// Positive floats order like their bit patterns, drop the sign and the low mantissa bits
+	viewDepth = std::max(viewDepth, 0.f);
+	uint32_t bits;
+	memcpy(&bits, &viewDepth, sizeof(bits));
+	return bits >> 7;
+}
+
+void RadixSortDrawPackets(JobSystem& jobs, std::vector<DrawPacket>& packets, std::vector<DrawPacket>& scratch)
+{
+	RadixSort(jobs, packets, scratch, [](const DrawPacket& packet) { return packet.key; });
+}
+
+DrawStateChanges CountDrawStateChanges(const DrawPacket* packets, uint32_t count)
+{
+	DrawStateChanges changes;
+	uint32_t pso = uint32_t(-1);
+	uint32_t material = uint32_t(-1);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		// Root constants survive a pipeline change, material is only rebound when it differs
+		const uint32_t packetPSO = DrawKeyPSO(packets[i].key);
+		if (i == 0 || packetPSO != pso)
+		{
+			++changes.psoChanges;
+			pso = packetPSO;
+		}
+		if (i == 0 || packets[i].materialIndex != material)
+		{
+			++changes.materialChanges;
+			material = packets[i].materialIndex;
+		}
+	}
+	return changes;
+}
+
+void RunDrawSortBenchmark(JobSystem& jobs, uint32_t numDraws, uint32_t numMaterials, DrawSortBenchmarkResult& outResult)
+{
+	outResult = {};
+	outResult.numDraws = numDraws;
+	outResult.numMaterials = numMaterials;
+
+	// Scene order, every 4th material is alpha tested
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> distance(0.5f, 500.f);
+	std::vector<DrawPacket> input(numDraws);
+	for (uint32_t i = 0; i < numDraws; ++i)
+	{
+		const uint32_t material = rng() % std::max(numMaterials, 1u);
+		input[i].instanceIndex = i;
+		input[i].materialIndex = material;
+		input[i].key = MakeDrawKey(0, (material % 4 == 3) ? 1 : 0, material, QuantizeDrawDepth(distance(rng)));
+	}
+	outResult.unsorted = CountDrawStateChanges(input.data(), numDraws);
+
+	// Best of a few runs, first run warms caches
+	const int numRuns = 3;
+	std::vector<DrawPacket> packets;
+	std::vector<DrawPacket> scratch;
+	std::vector<DrawPacket> reference;
+	outResult.radixMs = outResult.stdSortMs = outResult.emitMs = DBL_MAX;
+	for (int run = 0; run < numRuns; ++run)
+	{
+		packets = input;
+		auto start = TimerClock::now();
+		RadixSortDrawPackets(jobs, packets, scratch);
+		outResult.radixMs = std::min(outResult.radixMs, ElapsedMs(start));
+
+		reference = input;
+		start = TimerClock::now();
+		std::stable_sort(reference.begin(), reference.end(), [](const DrawPacket& a, const DrawPacket& b) { return a.key < b.key; });
+		outResult.stdSortMs = std::min(outResult.stdSortMs, ElapsedMs(start));
+
+		start = TimerClock::now();
+		outResult.sorted = CountDrawStateChanges(packets.data(), numDraws);
+		outResult.emitMs = std::min(outResult.emitMs, ElapsedMs(start));
+	}
+
+	// Both sorts are stable, same order down to the payload
+	for (uint32_t i = 0; i < numDraws; ++i)
+	{
+		assert(packets[i].key == reference[i].key && packets[i].instanceIndex == reference[i].instanceIndex);
+	}
+
+	const double totalMs = outResult.radixMs + outResult.emitMs;
+	outResult.drawsPerSecond = (totalMs > 0.0) ? numDraws / (totalMs / 1000.0) : 0.0;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "JobSystem.h"
+
+#include <algorithm>
+
+// Draw packets and 64 bit sort keys (no D3D dependency)
+// Key, most significant first: phase (2) | pso (4) | material (16) | depth (24) | flags (18)
+// Sorting groups draws by submission phase, then pipeline state, then material, front to back inside
+// a material, so emission only touches state when the matching key bits change.
+
+static const uint32_t DrawKeyPhaseShift = 62;
+static const uint32_t DrawKeyPSOShift = 58;
+static const uint32_t DrawKeyMaterialShift = 42;
+static const uint32_t DrawKeyDepthShift = 18;
+
+static const uint32_t DrawKeyPSOMask = 0xF;
+static const uint32_t DrawKeyMaterialMask = 0xFFFF;
+static const uint32_t DrawKeyDepthMask = 0xFFFFFF;
+
+// Flags sit below every sort field, OR them into the key
+static const uint64_t DrawKeyNoDepthPass = 1ull << 0;	// Too small to be a useful occluder, G-buffer only
+
+// Material index -1 (default material) sorts last
+inline uint64_t MakeDrawKey(uint32_t phase, uint32_t pso, uint32_t material, uint32_t depth)
+{
+	return (static_cast<uint64_t>(phase & 0x3) << DrawKeyPhaseShift) |
+		(static_cast<uint64_t>(pso & DrawKeyPSOMask) << DrawKeyPSOShift) |
+		(static_cast<uint64_t>(std::min(material, DrawKeyMaterialMask)) << DrawKeyMaterialShift) |
+		(static_cast<uint64_t>(depth & DrawKeyDepthMask) << DrawKeyDepthShift);
+}
+
+inline uint32_t DrawKeyPhase(uint64_t key) { return static_cast<uint32_t>(key >> DrawKeyPhaseShift); }
+inline uint32_t DrawKeyPSO(uint64_t key) { return static_cast<uint32_t>(key >> DrawKeyPSOShift) & DrawKeyPSOMask; }
+inline uint32_t DrawKeyMaterial(uint64_t key) { return static_cast<uint32_t>(key >> DrawKeyMaterialShift) & DrawKeyMaterialMask; }
+
+// Monotonic for non negative distances, top bits of the float
+uint32_t QuantizeDrawDepth(float viewDepth);
+
+struct DrawPacket
+{
+	uint64_t key = 0;
+	uint32_t instanceIndex = 0;
+	uint32_t materialIndex = 0;	// Full index for the shader, key only holds 16 bits
+};
+
+// Stable RadixSort on the key, scratch is resized to packets.size(), result ends in packets
+void RadixSortDrawPackets(JobSystem& jobs, std::vector<DrawPacket>& packets, std::vector<DrawPacket>& scratch);
+
+// State changes a command list would see emitting packets in order
+struct DrawStateChanges
+{
+	uint32_t psoChanges = 0;
+	uint32_t materialChanges = 0;
+};
+
+DrawStateChanges CountDrawStateChanges(const DrawPacket* packets, uint32_t count);
+
+struct DrawSortBenchmarkResult
+{
+	uint32_t numDraws = 0;
+	uint32_t numMaterials = 0;
+	double radixMs = 0.0;
+	double stdSortMs = 0.0;
+	double emitMs = 0.0;			// Walking the sorted list, state tracking only
+	double drawsPerSecond = 0.0;	// Sort + emit
+	DrawStateChanges unsorted;
+	DrawStateChanges sorted;
+};
+
+// Random scene order packets over numMaterials materials and 2 PSOs, fixed seed
+void RunDrawSortBenchmark(JobSystem& jobs, uint32_t numDraws, uint32_t numMaterials, DrawSortBenchmarkResult& outResult);
@@ -0,0 +1,279 @@
+// Single tinygltf implementation, stb decodes images and writes the reference renderer output
+#define TINYGLTF_IMPLEMENTATION
+#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "GltfScene.h"
+
+#include <float.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+using namespace DirectX;
+
+// DDS (magic, header, DX10 header) and KTX2 headers fit
+static const size_t ContainerHeaderBytes = 148;
+
+static bool IsContainerMagic(const unsigned char* bytes, size_t size)
+{
+	static const unsigned char ddsMagic[4] = { 'D', 'D', 'S', ' ' };
+	static const unsigned char ktx2Identifier[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+	return (size >= sizeof(ddsMagic) && memcmp(bytes, ddsMagic, sizeof(ddsMagic)) == 0) ||
+		(size >= sizeof(ktx2Identifier) && memcmp(bytes, ktx2Identifier, sizeof(ktx2Identifier)) == 0);
+}
+
+// External DDS / KTX2 images are read up to their header, enough for the image loader to recognize
+// them. The renderer maps the file itself, the payload is never read twice
+static bool ReadFileOrContainerHeader(std::vector<unsigned char>* out, std::string* err, const std::string& filePath, void*)
+{
+	std::ifstream file(std::filesystem::u8path(filePath), std::ios::binary | std::ios::ate);
+	if (!file)
+	{
+		if (err) { *err += "File open error: " + filePath + "\n"; }
+		return false;
+	}
+
+	const size_t size = static_cast<size_t>(file.tellg());
+	file.seekg(0);
+	out->resize(std::min(size, ContainerHeaderBytes));
+	file.read(reinterpret_cast<char*>(out->data()), out->size());
+	if (!IsContainerMagic(out->data(), out->size()) && size > out->size())
+	{
+		const size_t headerSize = out->size();
+		out->resize(size);
+		file.read(reinterpret_cast<char*>(out->data() + headerSize), size - headerSize);
+	}
+	if (!file)
+	{
+		if (err) { *err += "File read error: " + filePath + "\n"; }
+		return false;
+	}
+	return true;
+}
+
+bool LoadGltfFile(const std::string& filePath, tinygltf::LoadImageDataFunction imageLoader, void* imageLoaderData, tinygltf::Model& outModel)
+{
+	tinygltf::TinyGLTF loader;
+	std::string err, warn;
+	tinygltf::FsCallbacks fs = {};
+	fs.FileExists = tinygltf::FileExists;
+	fs.ExpandFilePath = tinygltf::ExpandFilePath;
+	fs.ReadWholeFile = ReadFileOrContainerHeader;
+	fs.WriteWholeFile = tinygltf::WriteWholeFile;
+	fs.GetFileSizeInBytes = tinygltf::GetFileSizeInBytes;
+	loader.SetFsCallbacks(fs);
+	loader.SetImageLoader(imageLoader, imageLoaderData);
+	const bool binary = std::filesystem::u8path(filePath).extension() == ".glb";
+	const bool ret = binary ?
+		loader.LoadBinaryFromFile(&outModel, &err, &warn, filePath) :
+		loader.LoadASCIIFromFile(&outModel, &err, &warn, filePath);
+	if (!warn.empty()) { printf("Warning: %s\n", warn.c_str()); }
+	if (!err.empty()) { printf("Error: %s\n", err.c_str()); }
+	return ret && !outModel.scenes.empty();
+}
+
+XMMATRIX GetNodeTransform(const tinygltf::Node& node)
+{
+	if (node.matrix.size() == 16)
+	{
+		XMFLOAT4X4 mat;
+		for (int i = 0; i < 16; ++i)
+		{
+			reinterpret_cast<float*>(&mat)[i] = static_cast<float>(node.matrix[i]);
+		}
+		return XMLoadFloat4x4(&mat);
+	}
+
+	XMVECTOR translation = XMVectorSet(0.f, 0.f, 0.f, 0.f);
+	XMVECTOR rotation = XMVectorSet(0.f, 0.f, 0.f, 1.f);	// Quaternion x, y, z, w
+	XMVECTOR scale = XMVectorSet(1.f, 1.f, 1.f, 0.f);
+	if (node.translation.size() == 3)
+	{
+		translation = XMVectorSet(static_cast<float>(node.translation[0]), static_cast<float>(node.translation[1]), static_cast<float>(node.translation[2]), 0.f);
+	}
+	if (node.rotation.size() == 4)
+	{
+		rotation = XMVectorSet(static_cast<float>(node.rotation[0]), static_cast<float>(node.rotation[1]), static_cast<float>(node.rotation[2]), static_cast<float>(node.rotation[3]));
+	}
+	if (node.scale.size() == 3)
+	{
+		scale = XMVectorSet(static_cast<float>(node.scale[0]), static_cast<float>(node.scale[1]), static_cast<float>(node.scale[2]), 0.f);
+	}
+	return XMMatrixScalingFromVector(scale) * XMMatrixRotationQuaternion(rotation) * XMMatrixTranslationFromVector(translation);
+}
+
+static void AddMeshNodes(const tinygltf::Model& model, int nodeIndex, FXMMATRIX parentTransform, std::vector<GltfMeshNode>& outNodes)
+{
+	const tinygltf::Node& node = model.nodes[nodeIndex];
+	const XMMATRIX transform = XMMatrixMultiply(GetNodeTransform(node), parentTransform);
+	if (node.mesh >= 0)
+	{
+		GltfMeshNode meshNode;
+		meshNode.nodeIndex = nodeIndex;
+		meshNode.meshIndex = node.mesh;
+		XMStoreFloat4x4(&meshNode.transform, transform);
+		outNodes.push_back(meshNode);
+	}
+
+	for (int childIndex : node.children)
+	{
+		AddMeshNodes(model, childIndex, transform, outNodes);
+	}
+}
+
+void GetGltfMeshNodes(const tinygltf::Model& model, std::vector<GltfMeshNode>& outNodes)
+{
+	outNodes.clear();
+	if (model.scenes.empty())
+		return;
+
+	const tinygltf::Scene& scene = model.scenes[model.defaultScene >= 0 ? model.defaultScene : 0];
+	for (int nodeIndex : scene.nodes)
+	{
+		AddMeshNodes(model, nodeIndex, XMMatrixIdentity(), outNodes);
+	}
+}
+
+// Float attribute of every vertex into a MeshVertex member, interleaved or not
+static bool ReadAttribute(const tinygltf::Model& model, const tinygltf::Primitive& primitive, const char* name, uint32_t numComponents,
+	size_t memberOffset, std::vector<MeshVertex>& vertices)
+{
+	auto attribute = primitive.attributes.find(name);
+	if (attribute == primitive.attributes.end())
+		return false;
+
+	const tinygltf::Accessor& accessor = model.accessors[attribute->second];
+	if (accessor.bufferView < 0 || accessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT)
+	{
+		printf("Warning: attribute %s is not float, ignored\n", name);
+		return false;
+	}
+
+	const tinygltf::BufferView& view = model.bufferViews[accessor.bufferView];
+	const unsigned char* data = &model.buffers[view.buffer].data[view.byteOffset + accessor.byteOffset];
+	const uint32_t numRead = std::min(numComponents, static_cast<uint32_t>(tinygltf::GetNumComponentsInType(accessor.type)));
+	const size_t stride = view.byteStride ? view.byteStride : sizeof(float) * numRead;
+	vertices.resize(std::max(vertices.size(), accessor.count));
+	for (size_t i = 0; i < accessor.count; ++i)
+	{
+		memcpy(reinterpret_cast<uint8_t*>(&vertices[i]) + memberOffset, data + i * stride, sizeof(float) * numRead);
+	}
+	return true;
+}
+
+bool LoadGltfPrimitive(const tinygltf::Model& model, const tinygltf::Primitive& primitive, GltfPrimitive& outPrimitive)
+{
+	outPrimitive = GltfPrimitive();
+	outPrimitive.materialIndex = primitive.material;
+	if (!ReadAttribute(model, primitive, "POSITION", 3, offsetof(MeshVertex, Position), outPrimitive.vertices))
+		return false;
+
+	ReadAttribute(model, primitive, "NORMAL", 3, offsetof(MeshVertex, Normal), outPrimitive.vertices);
+	ReadAttribute(model, primitive, "TEXCOORD_0", 2, offsetof(MeshVertex, Uv), outPrimitive.vertices);
+	outPrimitive.hasTangent = ReadAttribute(model, primitive, "TANGENT", 4, offsetof(MeshVertex, Tangent), outPrimitive.vertices);
+	outPrimitive.hasVertexColor = ReadAttribute(model, primitive, "COLOR_0", 4, offsetof(MeshVertex, Color), outPrimitive.vertices);
+	if (outPrimitive.hasVertexColor && tinygltf::GetNumComponentsInType(model.accessors[primitive.attributes.at("COLOR_0")].type) == 3)
+	{
+		for (MeshVertex& vertex : outPrimitive.vertices)
+		{
+			vertex.Color.w = 1.f;
+		}
+	}
+
+	if (primitive.indices >= 0)
+	{
+		const tinygltf::Accessor& indexAccessor = model.accessors[primitive.indices];
+		const tinygltf::BufferView& indexView = model.bufferViews[indexAccessor.bufferView];
+		const unsigned char* indexData = &model.buffers[indexView.buffer].data[indexView.byteOffset + indexAccessor.byteOffset];
+		outPrimitive.indices.resize(indexAccessor.count);
+		for (size_t i = 0; i < indexAccessor.count; ++i)
+		{
+			switch (indexAccessor.componentType)
+			{
+			case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: outPrimitive.indices[i] = indexData[i]; break;
+			case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: outPrimitive.indices[i] = reinterpret_cast<const uint16_t*>(indexData)[i]; break;
+			default: outPrimitive.indices[i] = reinterpret_cast<const uint32_t*>(indexData)[i]; break;
+			}
+		}
+	}
+	else
+	{
+		outPrimitive.indices.resize(outPrimitive.vertices.size());
+		for (uint32_t i = 0; i < outPrimitive.indices.size(); ++i)
+		{
+			outPrimitive.indices[i] = i;
+		}
+	}
+	outPrimitive.indices.resize(outPrimitive.indices.size() / 3 * 3);
+	outPrimitive.isTriangleList = (primitive.mode == TINYGLTF_MODE_TRIANGLES || primitive.mode == -1);
+
+	// Accessor min / max are required for positions, fall back to the vertices
+	const tinygltf::Accessor& posAccessor = model.accessors[primitive.attributes.at("POSITION")];
+	XMVECTOR boundsMin = XMVectorReplicate(FLT_MAX);
+	XMVECTOR boundsMax = XMVectorReplicate(-FLT_MAX);
+	if (posAccessor.minValues.size() == 3 && posAccessor.maxValues.size() == 3)
+	{
+		boundsMin = XMVectorSet(static_cast<float>(posAccessor.minValues[0]), static_cast<float>(posAccessor.minValues[1]), static_cast<float>(posAccessor.minValues[2]), 0.f);
+		boundsMax = XMVectorSet(static_cast<float>(posAccessor.maxValues[0]), static_cast<float>(posAccessor.maxValues[1]), static_cast<float>(posAccessor.maxValues[2]), 0.f);
+	}
+	else
+	{
+		for (const MeshVertex& vertex : outPrimitive.vertices)
+		{
+			boundsMin = XMVectorMin(boundsMin, XMLoadFloat3(&vertex.Position));
+			boundsMax = XMVectorMax(boundsMax, XMLoadFloat3(&vertex.Position));
+		}
+	}
+	BoundingBox::CreateFromPoints(outPrimitive.boundingBox, boundsMin, boundsMax);
+	return true;
+}
+
+void LoadGltfMaterial(const tinygltf::Material& material, MaterialData& outMaterial)
+{
+	const tinygltf::PbrMetallicRoughness& pbr = material.pbrMetallicRoughness;
+
+	outMaterial = {};
+	outMaterial.baseColorFactor = XMFLOAT4(1.f, 1.f, 1.f, 1.f);
+	if (pbr.baseColorFactor.size() == 4)
+	{
+		outMaterial.baseColorFactor = XMFLOAT4(
+			static_cast<float>(pbr.baseColorFactor[0]),
+			static_cast<float>(pbr.baseColorFactor[1]),
+			static_cast<float>(pbr.baseColorFactor[2]),
+			static_cast<float>(pbr.baseColorFactor[3]));
+	}
+	outMaterial.metallicFactor = static_cast<float>(pbr.metallicFactor);
+	outMaterial.roughnessFactor = static_cast<float>(pbr.roughnessFactor);
+	outMaterial.alphaCutoff = (material.alphaMode.compare("OPAQUE") == 0) ? 1.f : static_cast<float>(material.alphaCutoff);
+	outMaterial.albedoTextureIndex = pbr.baseColorTexture.index;
+	outMaterial.metallicTextureIndex = pbr.metallicRoughnessTexture.index;
+	outMaterial.normalTextureIndex = material.normalTexture.index;
+	outMaterial.albedoViewTextureIndex = outMaterial.metallicViewTextureIndex = outMaterial.normalViewTextureIndex = -1;
+	outMaterial.albedoVirtualTexture = -1;
+
+	// KHR_materials_emissive_strength scales the factor
+	float emissiveStrength = 1.f;
+	auto strength = material.extensions.find("KHR_materials_emissive_strength");
+	if (strength != material.extensions.end() && strength->second.Has("emissiveStrength"))
+	{
+		emissiveStrength = static_cast<float>(strength->second.Get("emissiveStrength").GetNumberAsDouble());
+	}
+	outMaterial.emissiveFactor = XMFLOAT3(0.f, 0.f, 0.f);
+	if (material.emissiveFactor.size() == 3)
+	{
+		outMaterial.emissiveFactor = XMFLOAT3(
+			static_cast<float>(material.emissiveFactor[0]) * emissiveStrength,
+			static_cast<float>(material.emissiveFactor[1]) * emissiveStrength,
+			static_cast<float>(material.emissiveFactor[2]) * emissiveStrength);
+	}
+	outMaterial.emissiveTextureIndex = material.emissiveTexture.index;
+}
+
+bool IsGltfMaterialTransparent(const tinygltf::Model& model, int materialIndex)
+{
+	if (materialIndex < 0 || materialIndex >= static_cast<int>(model.materials.size()))
+		return false;
+	return model.materials[materialIndex].alphaMode.compare("OPAQUE") != 0;
+}
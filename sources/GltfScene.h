@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+#include "tiny_gltf.h"
+#include "../shaders/HLSLCompatible.h"
+
+// glTF scene reading shared by the renderer and the headless tools (no D3D dependency)
+// GltfScene.cpp holds the tinygltf and stb implementation for every target.
+// Instances are numbered the same everywhere: nodes with a mesh depth first in scene order, then primitives.
+
+// .glb by extension, .gltf otherwise. Warnings and errors are printed, imageLoader decodes or skips images
+// and gets imageLoaderData as its user data. External DDS / KTX2 images only get their header
+bool LoadGltfFile(const std::string& filePath, tinygltf::LoadImageDataFunction imageLoader, void* imageLoaderData, tinygltf::Model& outModel);
+
+// Local transform, node matrix or scale * rotation * translation
+DirectX::XMMATRIX GetNodeTransform(const tinygltf::Node& node);
+
+struct GltfMeshNode
+{
+	int nodeIndex = -1;
+	int meshIndex = -1;
+	DirectX::XMFLOAT4X4 transform;	// Object to world, row vector
+};
+
+// Nodes with a mesh of the default scene, in instance order
+void GetGltfMeshNodes(const tinygltf::Model& model, std::vector<GltfMeshNode>& outNodes);
+
+struct GltfPrimitive
+{
+	std::vector<MeshVertex> vertices;
+	std::vector<uint32_t> indices;		// Whole triangles, 0 .. n-1 when the primitive has no indices
+	DirectX::BoundingBox boundingBox;	// Object space
+	int materialIndex = -1;
+	bool hasTangent = false;
+	bool hasVertexColor = false;
+	bool isTriangleList = false;		// Other modes are read as is, the tools skip them
+};
+
+// Float attributes, COLOR_0 may be vec3 (alpha 1). False without positions
+bool LoadGltfPrimitive(const tinygltf::Model& model, const tinygltf::Primitive& primitive, GltfPrimitive& outPrimitive);
+
+// Factors and glTF texture indices, view indices are -1
+void LoadGltfMaterial(const tinygltf::Material& material, MaterialData& outMaterial);
+
+// Alpha mask or blend, lets light and sight through some texels
+bool IsGltfMaterialTransparent(const tinygltf::Model& model, int materialIndex);
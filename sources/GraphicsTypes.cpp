@@ -3,6 +3,7 @@
 #include "Utility.h"
 #include "DX12.h"
 #include "Helper.h"
+#include "TextureLoader.h"
 
 //
 // Descriptor  Heap
@@ -415,9 +416,12 @@ void RawBuffer::Shutdown()
 //
 void Texture::Initialize(const TextureInit& init)
 {
+	assert(init.numMips > 0);
+	assert(init.initData || init.mipData);
+
 	D3D12_RESOURCE_DESC textureDesc = {};
-	textureDesc.MipLevels = 1;
-	textureDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	textureDesc.MipLevels = init.numMips;
+	textureDesc.Format = init.format;
 	textureDesc.Width = init.width;
 	textureDesc.Height = init.height;
 	textureDesc.Flags = D3D12_RESOURCE_FLAG_NONE;
@@ -436,21 +440,54 @@ void Texture::Initialize(const TextureInit& init)
 		nullptr,
 		IID_PPV_ARGS(&resource)));
 
-	const uint64_t uploadBufferSize = GetRequiredIntermediateSize(resource.Get(), 0, 1);
-	CheckHRESULT(d3dDevice->CreateCommittedResource(
-		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
-		D3D12_HEAP_FLAG_NONE,
-		&CD3DX12_RESOURCE_DESC::Buffer(uploadBufferSize),
-		D3D12_RESOURCE_STATE_GENERIC_READ,
-		nullptr,
-		IID_PPV_ARGS(&upload)));
+	const uint32_t numUploadMips = init.copySource ? init.numUploadMips : init.numMips;
+	assert(numUploadMips <= init.numMips);
+	if (numUploadMips > 0)
+	{
+		const uint64_t uploadBufferSize = GetRequiredIntermediateSize(resource.Get(), 0, numUploadMips);
+		CheckHRESULT(d3dDevice->CreateCommittedResource(
+			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+			D3D12_HEAP_FLAG_NONE,
+			&CD3DX12_RESOURCE_DESC::Buffer(uploadBufferSize),
+			D3D12_RESOURCE_STATE_GENERIC_READ,
+			nullptr,
+			IID_PPV_ARGS(&upload)));
+	}
 
+	// Pre-built mips (container) are copied as is, source may be mapped file pages
 	D3D12_SUBRESOURCE_DATA textureResourceData = {};
-	textureResourceData.pData = init.initData;
-	textureResourceData.RowPitch = init.width * sizeof(float);
-	textureResourceData.SlicePitch = textureResourceData.RowPitch * init.height;
+	const D3D12_SUBRESOURCE_DATA* subresources = init.mipData;
+	if (subresources == nullptr)
+	{
+		assert(init.numMips == 1);
+
+		uint64_t rowPitch = 0, slicePitch = 0;
+		GetSurfaceInfo(init.width, init.height, init.format, &rowPitch, &slicePitch, nullptr);
 
-	UpdateSubresources(commandList.Get(), resource.Get(), upload.Get(), 0, 0, 1, &textureResourceData);
+		textureResourceData.pData = init.initData;
+		textureResourceData.RowPitch = static_cast<LONG_PTR>(rowPitch);
+		textureResourceData.SlicePitch = static_cast<LONG_PTR>(slicePitch);
+		subresources = &textureResourceData;
+	}
+
+	if (numUploadMips > 0)
+	{
+		UpdateSubresources(commandList.Get(), resource.Get(), upload.Get(), 0, 0, numUploadMips, subresources);
+	}
+
+	// Levels already resident in the previous resource of a streamed texture, no upload
+	if (numUploadMips < init.numMips)
+	{
+		D3D12_RESOURCE_BARRIER sourceBarrier = CD3DX12_RESOURCE_BARRIER::Transition(init.copySource,
+			D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_SOURCE);
+		commandList->ResourceBarrier(1, &sourceBarrier);
+		for (uint32_t mip = numUploadMips; mip < init.numMips; ++mip)
+		{
+			CD3DX12_TEXTURE_COPY_LOCATION dst(resource.Get(), mip);
+			CD3DX12_TEXTURE_COPY_LOCATION src(init.copySource, init.copySourceMip + mip - numUploadMips);
+			commandList->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+		}
+	}
 
 	D3D12_RESOURCE_BARRIER barrier = {};
 	barrier.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
@@ -461,15 +498,33 @@ void Texture::Initialize(const TextureInit& init)
 	barrier.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
 	commandList->ResourceBarrier(1, &barrier);
 
-	DescriptorAlloc srvAlloc = srvDescriptorHeap.Allocate();
-	SRV = srvAlloc.descriptorIndex;
+	width = init.width;
+	height = init.height;
+	depth = 1;
+	numMips = init.numMips;
+	arraySize = 1;
+	format = init.format;
+
+	// Reused slot keeps bindless index stable, descriptor is overwritten in place
+	D3D12_CPU_DESCRIPTOR_HANDLE srvCpuHandle;
+	if (init.SRV != uint32_t(-1))
+	{
+		SRV = init.SRV;
+		srvCpuHandle = srvDescriptorHeap.CPUHandleFromIndex(SRV);
+	}
+	else
+	{
+		DescriptorAlloc srvAlloc = srvDescriptorHeap.Allocate();
+		SRV = srvAlloc.descriptorIndex;
+		srvCpuHandle = srvAlloc.cpuHandle;
+	}
 
 	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
 	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-	srvDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	srvDesc.Format = init.format;
 	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-	srvDesc.Texture2D.MipLevels = 1;
-	d3dDevice->CreateShaderResourceView(resource.Get(), &srvDesc, srvAlloc.cpuHandle);
+	srvDesc.Texture2D.MipLevels = init.numMips;
+	d3dDevice->CreateShaderResourceView(resource.Get(), &srvDesc, srvCpuHandle);
 }
 
 void Texture::Shutdown()
@@ -163,7 +163,17 @@ struct TextureInit
 {
 	uint32_t width = 0;
 	uint32_t height = 0;
-	const void* initData = nullptr;
+	uint32_t numMips = 1;
+	DXGI_FORMAT format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	const void* initData = nullptr;						// Single level, tightly packed
+	const D3D12_SUBRESOURCE_DATA* mipData = nullptr;	// numMips levels, used instead of initData
+	uint32_t SRV = uint32_t(-1);						// Reuse descriptor slot (texture streaming), allocate when -1
+
+	// Texture streaming: only the top numUploadMips levels come from mipData, the rest are copied on
+	// the GPU from copySource, starting at its copySourceMip. Source must be in the pixel shader state
+	ID3D12Resource* copySource = nullptr;
+	uint32_t copySourceMip = 0;
+	uint32_t numUploadMips = 0;
 };
 
 struct Texture
@@ -200,6 +200,24 @@ void CreateRootSignature(Microsoft::WRL::ComPtr<ID3D12RootSignature>& rootSignat
 	CheckHRESULT(d3dDevice->CreateRootSignature(0, signature->GetBufferPointer(), signature->GetBufferSize(), IID_PPV_ARGS(rootSignature.GetAddressOf())));
 }
 
+void* CreateReadbackBuffer(Microsoft::WRL::ComPtr<ID3D12Resource>& resource, uint64_t size, const wchar_t* name)
+{
+	CheckHRESULT(d3dDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(size),
+		D3D12_RESOURCE_STATE_COPY_DEST,
+		nullptr,
+		IID_PPV_ARGS(&resource)));
+	resource->SetName(name);
+
+	// Stays mapped, only read after the frame that wrote it completed
+	void* mappedData = nullptr;
+	D3D12_RANGE readRange = { 0, static_cast<SIZE_T>(size) };
+	CheckHRESULT(resource->Map(0, &readRange, &mappedData));
+	return mappedData;
+}
+
 void CompileShaderFromFile(
 	const std::wstring& filePath, 
 	const std::wstring& includePath,
@@ -4,6 +4,23 @@
 #include "GraphicsTypes.h"
 #include <cassert>
 
+inline void CheckHRESULT(HRESULT hr = S_OK)
+{
+    if (FAILED(hr))
+    {
+        std::string fullMessage = "(HRESULT: 0x" + std::to_string(hr) + ")";
+        assert(false && fullMessage.c_str());
+    }
+}
+
+inline std::string WStringToString(const std::wstring& wstr)
+{
+    int size_needed = WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), static_cast<int>(wstr.size()), nullptr, 0, nullptr, nullptr);
+    std::string str(size_needed, 0);
+    WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), static_cast<int>(wstr.size()), &str[0], size_needed, nullptr, nullptr);
+    return str;
+}
+
 enum class RasterizerState
 {
     NoCull = 0,
@@ -62,6 +79,9 @@ void SrvSetAsComputeRootParameter(ID3D12GraphicsCommandList* cmdList, uint32_t r
 void CreateRootSignature(Microsoft::WRL::ComPtr<ID3D12RootSignature>& rootSignature, const D3D12_ROOT_SIGNATURE_DESC1& desc);
 void CompileShaderFromFile(const std::wstring& filePath, const std::wstring& includePath, const std::wstring& functionName, Microsoft::WRL::ComPtr<IDxcBlob>& shaderBlob, ShaderType type);
 
+// Readback heap buffer in COPY_DEST, returns the persistently mapped pointer
+void* CreateReadbackBuffer(Microsoft::WRL::ComPtr<ID3D12Resource>& resource, uint64_t size, const wchar_t* name);
+
 struct DescriptorHeapAllocator
 {
     Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> Heap = nullptr;
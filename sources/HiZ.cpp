@@ -0,0 +1,226 @@
+#include "HiZ.h"
+#include "Culling.h"
+#include "Utility.h"
+
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <random>
+
+using namespace DirectX;
+
+uint32_t HiZNumMips(uint32_t width, uint32_t height)
+{
+	uint32_t size = std::max(width, height);
+	uint32_t numMips = 1;
+	while (size > 1)
+	{
+		size >>= 1;
+		++numMips;
+	}
+	return numMips;
+}
+
+float HiZReduceTexel(const float* src, uint32_t srcWidth, uint32_t srcHeight, uint32_t dstWidth, uint32_t dstHeight, uint32_t x, uint32_t y)
+{
+	const uint32_t x0 = std::min(x * 2, srcWidth - 1);
+	const uint32_t y0 = std::min(y * 2, srcHeight - 1);
+	const uint32_t x1 = (x == dstWidth - 1) ? srcWidth - 1 : x * 2 + 1;
+	const uint32_t y1 = (y == dstHeight - 1) ? srcHeight - 1 : y * 2 + 1;
+
+	float maxDepth = 0.f;
+	for (uint32_t sy = y0; sy <= y1; ++sy)
+	{
+		for (uint32_t sx = x0; sx <= x1; ++sx)
+		{
+			maxDepth = std::max(maxDepth, src[static_cast<size_t>(sy) * srcWidth + sx]);
+		}
+	}
+	return maxDepth;
+}
+
+void HiZPyramid::Build(const float* depth, uint32_t width, uint32_t height)
+{
+	assert(width > 0 && height > 0);
+
+	m_width = width;
+	m_height = height;
+	m_mips.resize(HiZNumMips(width, height));
+	m_mips[0].assign(depth, depth + static_cast<size_t>(width) * height);
+
+	for (uint32_t mip = 1; mip < NumMips(); ++mip)
+	{
+		const uint32_t srcWidth = Width(mip - 1);
+		const uint32_t srcHeight = Height(mip - 1);
+		const uint32_t dstWidth = Width(mip);
+		const uint32_t dstHeight = Height(mip);
+		const float* src = m_mips[mip - 1].data();
+
+		std::vector<float>& dst = m_mips[mip];
+		dst.resize(static_cast<size_t>(dstWidth) * dstHeight);
+		for (uint32_t y = 0; y < dstHeight; ++y)
+		{
+			for (uint32_t x = 0; x < dstWidth; ++x)
+			{
+				dst[static_cast<size_t>(y) * dstWidth + x] = HiZReduceTexel(src, srcWidth, srcHeight, dstWidth, dstHeight, x, y);
+			}
+		}
+	}
+}
+
+bool ProjectHiZTest(
+	const XMFLOAT3& center,
+	const XMFLOAT3& extents,
+	const XMFLOAT4X4& viewProj,
+	uint32_t width,
+	uint32_t height,
+	uint32_t instanceIndex,
+	HiZTestEntry& outEntry)
+{
+	float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, minZ = FLT_MAX;
+	for (int i = 0; i < 8; ++i)
+	{
+		const XMFLOAT3 corner(
+			center.x + ((i & 1) ? extents.x : -extents.x),
+			center.y + ((i & 2) ? extents.y : -extents.y),
+			center.z + ((i & 4) ? extents.z : -extents.z));
+		const XMFLOAT4 clip = TransformPoint(corner, viewProj);
+		if (clip.z < 0.f)
+			return false;
+
+		const float invW = 1.f / clip.w;
+		const float x = (clip.x * invW * 0.5f + 0.5f) * static_cast<float>(width);
+		const float y = (0.5f - clip.y * invW * 0.5f) * static_cast<float>(height);
+		minX = std::min(minX, x);
+		minY = std::min(minY, y);
+		maxX = std::max(maxX, x);
+		maxY = std::max(maxY, y);
+		minZ = std::min(minZ, clip.z * invW);
+	}
+
+	// Every pixel the screen rect touches
+	const float pixelMinX = std::max(floorf(minX), 0.f);
+	const float pixelMinY = std::max(floorf(minY), 0.f);
+	const float pixelMaxX = std::min(floorf(maxX), static_cast<float>(width - 1));
+	const float pixelMaxY = std::min(floorf(maxY), static_cast<float>(height - 1));
+	if (pixelMinX > pixelMaxX || pixelMinY > pixelMaxY)
+		return false;
+
+	outEntry.rectMin = XMUINT2(static_cast<uint32_t>(pixelMinX), static_cast<uint32_t>(pixelMinY));
+	outEntry.rectMax = XMUINT2(static_cast<uint32_t>(pixelMaxX), static_cast<uint32_t>(pixelMaxY));
+	outEntry.minZ = std::max(minZ, 0.f);
+	outEntry.instanceIndex = instanceIndex;
+	outEntry.pad = XMUINT2(0, 0);
+	return true;
+}
+
+uint32_t SelectHiZMip(const HiZTestEntry& entry, uint32_t numMips)
+{
+	uint32_t mip = 0;
+	while (mip + 1 < numMips &&
+		((entry.rectMax.x >> mip) - (entry.rectMin.x >> mip) > 1 ||
+		 (entry.rectMax.y >> mip) - (entry.rectMin.y >> mip) > 1))
+	{
+		++mip;
+	}
+	return mip;
+}
+
+bool TestHiZ(const HiZPyramid& pyramid, const HiZTestEntry& entry)
+{
+	// Clamped texel of a pixel covers it at every mip, see HiZReduceTexel
+	const uint32_t mip = SelectHiZMip(entry, pyramid.NumMips());
+	const uint32_t lastX = pyramid.Width(mip) - 1;
+	const uint32_t lastY = pyramid.Height(mip) - 1;
+	const uint32_t x0 = std::min(entry.rectMin.x >> mip, lastX);
+	const uint32_t y0 = std::min(entry.rectMin.y >> mip, lastY);
+	const uint32_t x1 = std::min(entry.rectMax.x >> mip, lastX);
+	const uint32_t y1 = std::min(entry.rectMax.y >> mip, lastY);
+
+	const float maxDepth = std::max(
+		std::max(pyramid.Fetch(mip, x0, y0), pyramid.Fetch(mip, x1, y0)),
+		std::max(pyramid.Fetch(mip, x0, y1), pyramid.Fetch(mip, x1, y1)));
+	return maxDepth >= entry.minZ;
+}
+
+void RunHiZBenchmark(uint32_t width, uint32_t height, uint32_t numTests, HiZBenchmarkResult& outResult)
+{
+	outResult = {};
+	outResult.width = width;
+	outResult.height = height;
+	outResult.numTests = numTests;
+
+	// Far plane with overlapping occluder rects in front
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+	std::vector<float> depth(static_cast<size_t>(width) * height, 1.f);
+	for (int i = 0; i < 64; ++i)
+	{
+		const uint32_t rectWidth = 1 + static_cast<uint32_t>(unit(rng) * width * 0.5f);
+		const uint32_t rectHeight = 1 + static_cast<uint32_t>(unit(rng) * height * 0.5f);
+		const uint32_t x0 = static_cast<uint32_t>(unit(rng) * (width - 1));
+		const uint32_t y0 = static_cast<uint32_t>(unit(rng) * (height - 1));
+		const float z = unit(rng);
+		for (uint32_t y = y0; y < std::min(y0 + rectHeight, height); ++y)
+		{
+			for (uint32_t x = x0; x < std::min(x0 + rectWidth, width); ++x)
+			{
+				float& d = depth[static_cast<size_t>(y) * width + x];
+				d = std::min(d, z);
+			}
+		}
+	}
+
+	// Mostly small rects, a few covering large parts of the screen
+	std::vector<HiZTestEntry> tests(numTests);
+	for (uint32_t i = 0; i < numTests; ++i)
+	{
+		const float scale = powf(unit(rng), 3.f);
+		const uint32_t rectWidth = static_cast<uint32_t>(scale * (width - 1));
+		const uint32_t rectHeight = static_cast<uint32_t>(scale * (height - 1));
+		HiZTestEntry& entry = tests[i];
+		entry.rectMin = XMUINT2(
+			static_cast<uint32_t>(unit(rng) * (width - rectWidth - 1)),
+			static_cast<uint32_t>(unit(rng) * (height - rectHeight - 1)));
+		entry.rectMax = XMUINT2(entry.rectMin.x + rectWidth, entry.rectMin.y + rectHeight);
+		entry.minZ = unit(rng);
+		entry.instanceIndex = i;
+		entry.pad = XMUINT2(0, 0);
+	}
+
+	HiZPyramid pyramid;
+	auto start = TimerClock::now();
+	pyramid.Build(depth.data(), width, height);
+	outResult.buildMs = ElapsedMs(start);
+
+	std::vector<uint8_t> visible(numTests);
+	start = TimerClock::now();
+	for (uint32_t i = 0; i < numTests; ++i)
+	{
+		visible[i] = TestHiZ(pyramid, tests[i]) ? 1 : 0;
+	}
+	outResult.testMs = ElapsedMs(start);
+
+	start = TimerClock::now();
+	for (uint32_t i = 0; i < numTests; ++i)
+	{
+		const HiZTestEntry& entry = tests[i];
+		bool pixelVisible = false;
+		for (uint32_t y = entry.rectMin.y; y <= entry.rectMax.y && !pixelVisible; ++y)
+		{
+			for (uint32_t x = entry.rectMin.x; x <= entry.rectMax.x; ++x)
+			{
+				if (depth[static_cast<size_t>(y) * width + x] >= entry.minZ)
+				{
+					pixelVisible = true;
+					break;
+				}
+			}
+		}
+
+		outResult.numOccluded += visible[i] ? 0 : 1;
+		outResult.numFalseOccluded += (!visible[i] && pixelVisible) ? 1 : 0;
+		outResult.numFalseVisible += (visible[i] && !pixelVisible) ? 1 : 0;
+	}
+	outResult.bruteForceMs = ElapsedMs(start);
+}
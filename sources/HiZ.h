@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+#include <DirectXMath.h>
+#include "../shaders/HLSLCompatible.h"
+
+// Hierarchical Z occlusion culling, CPU reference of hiz.hlsl (no D3D dependency)
+// The pyramid is a max reduction of the depth buffer and the test only compares fetched texels
+// against the entry depth. Bounds are projected on the CPU (ProjectHiZTest), the GPU never divides,
+// so for the same depth buffer both sides produce bit identical pyramids and results.
+// Depth is D3D convention, 0 near, 1 far.
+
+// floor(log2(max(width, height))) + 1, down to a 1x1 mip
+uint32_t HiZNumMips(uint32_t width, uint32_t height);
+
+inline uint32_t HiZMipSize(uint32_t size, uint32_t mip)
+{
+	return std::max(size >> mip, 1u);
+}
+
+// Max over the 2x2 source footprint of dst texel (x, y), the last texel of an odd sized source
+// also covers the extra row/column so no source texel is dropped
+float HiZReduceTexel(const float* src, uint32_t srcWidth, uint32_t srcHeight, uint32_t dstWidth, uint32_t dstHeight, uint32_t x, uint32_t y);
+
+class HiZPyramid
+{
+public:
+	// Mip 0 is a copy of depth, row major
+	void Build(const float* depth, uint32_t width, uint32_t height);
+
+	uint32_t NumMips() const { return static_cast<uint32_t>(m_mips.size()); }
+	uint32_t Width(uint32_t mip) const { return HiZMipSize(m_width, mip); }
+	uint32_t Height(uint32_t mip) const { return HiZMipSize(m_height, mip); }
+	const std::vector<float>& Mip(uint32_t mip) const { return m_mips[mip]; }
+
+	float Fetch(uint32_t mip, uint32_t x, uint32_t y) const { return m_mips[mip][static_cast<size_t>(y) * Width(mip) + x]; }
+
+private:
+	uint32_t m_width = 0;
+	uint32_t m_height = 0;
+	std::vector<std::vector<float>> m_mips;
+};
+
+// viewProj is row vector convention (world * view * proj), width / height are the mip 0 size
+// Returns false when the box crosses the near plane or misses the screen, it can't be tested and is visible
+bool ProjectHiZTest(
+	const DirectX::XMFLOAT3& center,
+	const DirectX::XMFLOAT3& extents,
+	const DirectX::XMFLOAT4X4& viewProj,
+	uint32_t width,
+	uint32_t height,
+	uint32_t instanceIndex,
+	HiZTestEntry& outEntry);
+
+// Finest mip where the rect spans at most 2x2 texels
+uint32_t SelectHiZMip(const HiZTestEntry& entry, uint32_t numMips);
+
+// True when any texel under the rect is as far or farther than the box front
+bool TestHiZ(const HiZPyramid& pyramid, const HiZTestEntry& entry);
+
+struct HiZBenchmarkResult
+{
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t numTests = 0;
+	uint32_t numOccluded = 0;
+	uint32_t numFalseOccluded = 0;	// Occluded by HiZ but visible per pixel, must be 0
+	uint32_t numFalseVisible = 0;	// Visible by HiZ but occluded per pixel, conservative loss
+	double buildMs = 0.0;
+	double testMs = 0.0;
+	double bruteForceMs = 0.0;
+};
+
+// Synthetic depth buffer (random occluder rects) and random screen rects, fixed seed
+// Checks every HiZ result against a per pixel test over the same rect
+void RunHiZBenchmark(uint32_t width, uint32_t height, uint32_t numTests, HiZBenchmarkResult& outResult);
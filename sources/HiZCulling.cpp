@@ -0,0 +1,437 @@
+#include "HiZCulling.h"
+#include "Utility.h"
+#include "DX12.h"
+#include "Helper.h"
+
+#include <assert.h>
+
+using Microsoft::WRL::ComPtr;
+
+// Mirrors HiZConstantBuffer in hiz.hlsl
+struct HiZConstants
+{
+	XMUINT2 srcSize;
+	XMUINT2 dstSize;
+	uint32_t mipLevel;
+	uint32_t numTests;
+};
+
+void HiZCulling::Initialize(const HiZCullingInit& init)
+{
+	assert(init.width > 0 && init.height > 0);
+
+	m_init = init;
+	m_numMips = HiZNumMips(init.width, init.height);
+
+	// Pyramid
+	{
+		D3D12_RESOURCE_DESC hizDesc = CD3DX12_RESOURCE_DESC::Tex2D(
+			DXGI_FORMAT_R32_FLOAT,
+			init.width,
+			init.height,
+			1, static_cast<UINT16>(m_numMips), 1, 0,
+			D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+
+		CheckHRESULT(d3dDevice->CreateCommittedResource(
+			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+			D3D12_HEAP_FLAG_NONE,
+			&hizDesc,
+			D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE,
+			nullptr,
+			IID_PPV_ARGS(&m_hiZBuffer)));
+		m_hiZBuffer->SetName(L"HiZBuffer");
+
+		D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+		srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+		srvDesc.Format = DXGI_FORMAT_R32_FLOAT;
+		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+
+		D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+		uavDesc.Format = DXGI_FORMAT_R32_FLOAT;
+		uavDesc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D;
+
+		// Build reads the previous mip alone and writes the next one
+		m_mipSRVs.resize(m_numMips);
+		m_mipUAVs.resize(m_numMips);
+		for (uint32_t mip = 0; mip < m_numMips; ++mip)
+		{
+			m_mipSRVs[mip] = srvDescriptorHeap.Allocate();
+			srvDesc.Texture2D.MostDetailedMip = mip;
+			srvDesc.Texture2D.MipLevels = 1;
+			d3dDevice->CreateShaderResourceView(m_hiZBuffer.Get(), &srvDesc, m_mipSRVs[mip].cpuHandle);
+
+			m_mipUAVs[mip] = srvDescriptorHeap.Allocate();
+			uavDesc.Texture2D.MipSlice = mip;
+			d3dDevice->CreateUnorderedAccessView(m_hiZBuffer.Get(), nullptr, &uavDesc, m_mipUAVs[mip].cpuHandle);
+		}
+
+		m_hiZSRV = srvDescriptorHeap.Allocate();
+		srvDesc.Texture2D.MostDetailedMip = 0;
+		srvDesc.Texture2D.MipLevels = m_numMips;
+		d3dDevice->CreateShaderResourceView(m_hiZBuffer.Get(), &srvDesc, m_hiZSRV.cpuHandle);
+
+		// Cull reads the whole chain as SRV, u0 must not alias it
+		m_nullUAV = srvDescriptorHeap.Allocate();
+		uavDesc.Texture2D.MipSlice = 0;
+		d3dDevice->CreateUnorderedAccessView(nullptr, nullptr, &uavDesc, m_nullUAV.cpuHandle);
+	}
+
+	const uint32_t maxInstances = std::max(init.maxInstances, 1u);
+
+	StructuredBufferInit sbi;
+	sbi.cpuAccessible = true;
+	sbi.stride = sizeof(HiZTestEntry);
+	sbi.numElements = maxInstances;
+	sbi.name = L"HiZTests";
+	m_testBuffer.Initialize(sbi);
+
+	RawBufferInit rbi;
+	rbi.numElements = maxInstances * 2;	// 64 bit predicate per instance
+	rbi.allowUAV = true;
+	rbi.initState = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
+	rbi.name = L"HiZPredicates";
+	m_predicates.Initialize(rbi);
+
+	m_predicateData = static_cast<const uint32_t*>(CreateReadbackBuffer(
+		m_predicateReadback,
+		m_predicates.NumElements * RawBuffer::Stride,
+		L"HiZPredicatesReadback"));
+
+	// Depth then HZB mips, one readback buffer
+	{
+		D3D12_RESOURCE_DESC depthDesc = CD3DX12_RESOURCE_DESC::Tex2D(
+			DXGI_FORMAT_D32_FLOAT, init.width, init.height, 1, 1, 1, 0, D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL);
+		const D3D12_RESOURCE_DESC hizDesc = m_hiZBuffer->GetDesc();
+
+		m_validationFootprints.resize(1 + m_numMips);
+		UINT64 depthBytes = 0;
+		d3dDevice->GetCopyableFootprints(&depthDesc, 0, 1, 0, &m_validationFootprints[0], nullptr, nullptr, &depthBytes);
+
+		const UINT64 hizOffset = AlignTo(depthBytes, D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT);
+		UINT64 hizBytes = 0;
+		d3dDevice->GetCopyableFootprints(&hizDesc, 0, m_numMips, hizOffset, &m_validationFootprints[1], nullptr, nullptr, &hizBytes);
+
+		m_validationData = static_cast<const uint8_t*>(CreateReadbackBuffer(
+			m_validationReadback,
+			hizOffset + hizBytes,
+			L"HiZValidationReadback"));
+	}
+
+	CreatePSO();
+
+	m_resultsPending = false;
+	m_validationPending = false;
+	m_stats = {};
+}
+
+void HiZCulling::Shutdown()
+{
+	m_buildPSO = nullptr;
+	m_cullPSO = nullptr;
+	m_rootSignature = nullptr;
+
+	for (uint32_t mip = 0; mip < m_numMips; ++mip)
+	{
+		srvDescriptorHeap.Free(m_mipSRVs[mip].descriptorIndex);
+		srvDescriptorHeap.Free(m_mipUAVs[mip].descriptorIndex);
+	}
+	srvDescriptorHeap.Free(m_hiZSRV.descriptorIndex);
+	srvDescriptorHeap.Free(m_nullUAV.descriptorIndex);
+	m_mipSRVs.clear();
+	m_mipUAVs.clear();
+	m_hiZBuffer = nullptr;
+
+	m_testBuffer.Shutdown();
+	m_predicates.Shutdown();
+
+	m_predicateReadback = nullptr;
+	m_predicateData = nullptr;
+	m_validationReadback = nullptr;
+	m_validationData = nullptr;
+}
+
+void HiZCulling::CreatePSO()
+{
+	const std::wstring includePath = std::filesystem::absolute(m_init.shaderPath).wstring();
+	const std::wstring hizShader = std::filesystem::absolute(m_init.shaderPath / "hiz.hlsl").wstring();
+	CompileShaderFromFile(hizShader, includePath, L"CSMain", m_buildCS, ShaderType::Compute);
+	CompileShaderFromFile(hizShader, includePath, L"CullCS", m_cullCS, ShaderType::Compute);
+
+	D3D12_ROOT_PARAMETER1 rootParameters[5] = {};
+
+	// HiZConstantBuffer
+	rootParameters[0].ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
+	rootParameters[0].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+	rootParameters[0].Constants.Num32BitValues = sizeof(HiZConstants) / 4;
+	rootParameters[0].Constants.ShaderRegister = 0;
+	rootParameters[0].Constants.RegisterSpace = 0;
+
+	// Input depth / HZB (t0)
+	D3D12_DESCRIPTOR_RANGE1 srvRanges[1] = {};
+	srvRanges[0].RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SRV;
+	srvRanges[0].NumDescriptors = 1;
+	srvRanges[0].BaseShaderRegister = 0;
+	srvRanges[0].RegisterSpace = 0;
+	srvRanges[0].Flags = D3D12_DESCRIPTOR_RANGE_FLAG_DESCRIPTORS_VOLATILE;
+	srvRanges[0].OffsetInDescriptorsFromTableStart = 0;
+	rootParameters[1].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
+	rootParameters[1].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+	rootParameters[1].DescriptorTable.pDescriptorRanges = srvRanges;
+	rootParameters[1].DescriptorTable.NumDescriptorRanges = _countof(srvRanges);
+
+	// Output mip (u0)
+	D3D12_DESCRIPTOR_RANGE1 uavRanges[1] = {};
+	uavRanges[0].RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_UAV;
+	uavRanges[0].NumDescriptors = 1;
+	uavRanges[0].BaseShaderRegister = 0;
+	uavRanges[0].RegisterSpace = 0;
+	uavRanges[0].Flags = D3D12_DESCRIPTOR_RANGE_FLAG_DESCRIPTORS_VOLATILE;
+	uavRanges[0].OffsetInDescriptorsFromTableStart = 0;
+	rootParameters[2].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
+	rootParameters[2].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+	rootParameters[2].DescriptorTable.pDescriptorRanges = uavRanges;
+	rootParameters[2].DescriptorTable.NumDescriptorRanges = _countof(uavRanges);
+
+	// Tests (t1)
+	rootParameters[3].ParameterType = D3D12_ROOT_PARAMETER_TYPE_SRV;
+	rootParameters[3].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+	rootParameters[3].Descriptor.ShaderRegister = 1;
+	rootParameters[3].Descriptor.RegisterSpace = 0;
+
+	// Predicates (u1)
+	rootParameters[4].ParameterType = D3D12_ROOT_PARAMETER_TYPE_UAV;
+	rootParameters[4].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+	rootParameters[4].Descriptor.ShaderRegister = 1;
+	rootParameters[4].Descriptor.RegisterSpace = 0;
+
+	D3D12_ROOT_SIGNATURE_DESC1 rootSignatureDesc = {};
+	rootSignatureDesc.NumParameters = _countof(rootParameters);
+	rootSignatureDesc.pParameters = rootParameters;
+
+	CreateRootSignature(m_rootSignature, rootSignatureDesc);
+
+	D3D12_COMPUTE_PIPELINE_STATE_DESC psoDesc = {};
+	psoDesc.pRootSignature = m_rootSignature.Get();
+	psoDesc.CS = { m_buildCS->GetBufferPointer(), m_buildCS->GetBufferSize() };
+	CheckHRESULT(d3dDevice->CreateComputePipelineState(&psoDesc, IID_PPV_ARGS(&m_buildPSO)));
+
+	psoDesc.CS = { m_cullCS->GetBufferPointer(), m_cullCS->GetBufferSize() };
+	CheckHRESULT(d3dDevice->CreateComputePipelineState(&psoDesc, IID_PPV_ARGS(&m_cullPSO)));
+}
+
+void HiZCulling::BuildAndCull(DepthBuffer& depth, const std::vector<HiZTestEntry>& tests)
+{
+	assert(tests.size() <= m_testBuffer.NumElements);
+
+	const bool validate = m_validate;
+	if (validate)
+	{
+		D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(
+			depth.Resource(),
+			D3D12_RESOURCE_STATE_DEPTH_WRITE,
+			D3D12_RESOURCE_STATE_COPY_SOURCE);
+		commandList->ResourceBarrier(1, &barrier);
+
+		CD3DX12_TEXTURE_COPY_LOCATION dst(m_validationReadback.Get(), m_validationFootprints[0]);
+		CD3DX12_TEXTURE_COPY_LOCATION src(depth.Resource(), 0);
+		commandList->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+	}
+
+	{
+		D3D12_RESOURCE_BARRIER barriers[2] = {};
+		barriers[0] = CD3DX12_RESOURCE_BARRIER::Transition(
+			depth.Resource(),
+			validate ? D3D12_RESOURCE_STATE_COPY_SOURCE : D3D12_RESOURCE_STATE_DEPTH_WRITE,
+			D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		barriers[1] = CD3DX12_RESOURCE_BARRIER::Transition(
+			m_hiZBuffer.Get(),
+			D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE,
+			D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+		commandList->ResourceBarrier(_countof(barriers), barriers);
+	}
+
+	commandList->SetComputeRootSignature(m_rootSignature.Get());
+
+	ID3D12DescriptorHeap* ppDescHeaps[] = { srvDescriptorHeap.heap.Get() };
+	commandList->SetDescriptorHeaps(_countof(ppDescHeaps), ppDescHeaps);
+	commandList->SetComputeRootShaderResourceView(3, m_testBuffer.internalBuffer.gpuAddress);
+	commandList->SetComputeRootUnorderedAccessView(4, m_predicates.internalBuffer.gpuAddress);
+
+	// Mip 0 copies depth, each next mip reduces the previous one
+	commandList->SetPipelineState(m_buildPSO.Get());
+	for (uint32_t mip = 0; mip < m_numMips; ++mip)
+	{
+		HiZConstants constants = {};
+		constants.srcSize = (mip == 0) ?
+			XMUINT2(m_init.width, m_init.height) :
+			XMUINT2(HiZMipSize(m_init.width, mip - 1), HiZMipSize(m_init.height, mip - 1));
+		constants.dstSize = XMUINT2(HiZMipSize(m_init.width, mip), HiZMipSize(m_init.height, mip));
+		constants.mipLevel = mip;
+
+		commandList->SetComputeRoot32BitConstants(0, sizeof(HiZConstants) / 4, &constants, 0);
+		commandList->SetComputeRootDescriptorTable(1, (mip == 0) ? depth.srv : m_mipSRVs[mip - 1].gpuHandle);
+		commandList->SetComputeRootDescriptorTable(2, m_mipUAVs[mip].gpuHandle);
+		commandList->Dispatch(
+			(constants.dstSize.x + HIZ_BUILD_GROUP_SIZE - 1) / HIZ_BUILD_GROUP_SIZE,
+			(constants.dstSize.y + HIZ_BUILD_GROUP_SIZE - 1) / HIZ_BUILD_GROUP_SIZE,
+			1);
+
+		// Written mip is the input of the next one
+		D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(
+			m_hiZBuffer.Get(),
+			D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+			D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE,
+			mip);
+		commandList->ResourceBarrier(1, &barrier);
+	}
+
+	// Test every entry against the full chain
+	const uint32_t numTests = static_cast<uint32_t>(tests.size());
+	if (numTests > 0)
+	{
+		memcpy(m_testBuffer.internalBuffer.cpuAddress, tests.data(), tests.size() * sizeof(HiZTestEntry));
+
+		HiZConstants constants = {};
+		constants.srcSize = XMUINT2(m_init.width, m_init.height);
+		constants.mipLevel = m_numMips;
+		constants.numTests = numTests;
+
+		commandList->SetPipelineState(m_cullPSO.Get());
+		commandList->SetComputeRoot32BitConstants(0, sizeof(HiZConstants) / 4, &constants, 0);
+		commandList->SetComputeRootDescriptorTable(1, m_hiZSRV.gpuHandle);
+		commandList->SetComputeRootDescriptorTable(2, m_nullUAV.gpuHandle);
+		commandList->Dispatch((numTests + HIZ_CULL_GROUP_SIZE - 1) / HIZ_CULL_GROUP_SIZE, 1, 1);
+	}
+
+	{
+		D3D12_RESOURCE_BARRIER barriers[3] = {};
+		barriers[0] = CD3DX12_RESOURCE_BARRIER::Transition(
+			m_predicates.internalBuffer.resource.Get(),
+			D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+			D3D12_RESOURCE_STATE_PREDICATION);
+		barriers[1] = CD3DX12_RESOURCE_BARRIER::Transition(
+			depth.Resource(),
+			D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE,
+			D3D12_RESOURCE_STATE_DEPTH_WRITE);
+		barriers[2] = CD3DX12_RESOURCE_BARRIER::Transition(
+			m_hiZBuffer.Get(),
+			D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE,
+			D3D12_RESOURCE_STATE_COPY_SOURCE);
+		commandList->ResourceBarrier(validate ? 3 : 2, barriers);
+	}
+
+	if (validate)
+	{
+		for (uint32_t mip = 0; mip < m_numMips; ++mip)
+		{
+			CD3DX12_TEXTURE_COPY_LOCATION dst(m_validationReadback.Get(), m_validationFootprints[1 + mip]);
+			CD3DX12_TEXTURE_COPY_LOCATION src(m_hiZBuffer.Get(), mip);
+			commandList->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+		}
+
+		D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(
+			m_hiZBuffer.Get(),
+			D3D12_RESOURCE_STATE_COPY_SOURCE,
+			D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		commandList->ResourceBarrier(1, &barrier);
+
+		m_validationTests = tests;
+	}
+	m_validationPending = validate;
+}
+
+void HiZCulling::EndFrame()
+{
+	ID3D12Resource* predicates = m_predicates.internalBuffer.resource.Get();
+
+	D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(
+		predicates,
+		D3D12_RESOURCE_STATE_PREDICATION,
+		D3D12_RESOURCE_STATE_COPY_SOURCE);
+	commandList->ResourceBarrier(1, &barrier);
+
+	commandList->CopyBufferRegion(m_predicateReadback.Get(), 0, predicates, 0, m_predicates.NumElements * RawBuffer::Stride);
+
+	barrier = CD3DX12_RESOURCE_BARRIER::Transition(
+		predicates,
+		D3D12_RESOURCE_STATE_COPY_SOURCE,
+		D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	commandList->ResourceBarrier(1, &barrier);
+
+	m_resultsPending = true;
+}
+
+const uint32_t* HiZCulling::ResolveResults()
+{
+	if (!m_resultsPending)
+	{
+		return nullptr;
+	}
+	m_resultsPending = false;
+
+	if (m_validationPending)
+	{
+		ValidateResults(m_predicateData);
+		m_validationPending = false;
+	}
+	return m_predicateData;
+}
+
+void HiZCulling::ValidateResults(const uint32_t* predicates)
+{
+	// Same depth the GPU built from
+	const D3D12_PLACED_SUBRESOURCE_FOOTPRINT& depthFootprint = m_validationFootprints[0];
+	m_validationDepth.resize(static_cast<size_t>(m_init.width) * m_init.height);
+	for (uint32_t y = 0; y < m_init.height; ++y)
+	{
+		memcpy(
+			&m_validationDepth[static_cast<size_t>(y) * m_init.width],
+			m_validationData + depthFootprint.Offset + static_cast<size_t>(y) * depthFootprint.Footprint.RowPitch,
+			m_init.width * sizeof(float));
+	}
+
+	auto start = TimerClock::now();
+	m_referencePyramid.Build(m_validationDepth.data(), m_init.width, m_init.height);
+	m_stats.cpuBuildMs = ElapsedMs(start);
+
+	// Bitwise, the reduction is exact
+	m_stats.pyramidMismatches = 0;
+	for (uint32_t mip = 0; mip < m_numMips; ++mip)
+	{
+		const D3D12_PLACED_SUBRESOURCE_FOOTPRINT& footprint = m_validationFootprints[1 + mip];
+		const uint32_t width = m_referencePyramid.Width(mip);
+		const std::vector<float>& reference = m_referencePyramid.Mip(mip);
+		for (uint32_t y = 0; y < m_referencePyramid.Height(mip); ++y)
+		{
+			const uint8_t* gpuRow = m_validationData + footprint.Offset + static_cast<size_t>(y) * footprint.Footprint.RowPitch;
+			for (uint32_t x = 0; x < width; ++x)
+			{
+				if (memcmp(gpuRow + x * sizeof(float), &reference[static_cast<size_t>(y) * width + x], sizeof(float)) != 0)
+				{
+					++m_stats.pyramidMismatches;
+				}
+			}
+		}
+	}
+
+	start = TimerClock::now();
+	m_stats.testMismatches = 0;
+	for (const HiZTestEntry& test : m_validationTests)
+	{
+		const bool gpuVisible = predicates[test.instanceIndex * 2] != 0;
+		if (TestHiZ(m_referencePyramid, test) != gpuVisible)
+		{
+			++m_stats.testMismatches;
+		}
+	}
+	m_stats.cpuTestMs = ElapsedMs(start);
+
+	m_stats.numTests = static_cast<uint32_t>(m_validationTests.size());
+	m_stats.validated = true;
+
+	if (m_stats.pyramidMismatches > 0 || m_stats.testMismatches > 0)
+	{
+		printf("HiZ validation: %u pyramid texels and %u / %u tests differ from the CPU reference\n",
+			m_stats.pyramidMismatches, m_stats.testMismatches, m_stats.numTests);
+	}
+}
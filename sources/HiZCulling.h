@@ -0,0 +1,88 @@
+#pragma once
+
+#include "PCH.h"
+#include "GraphicsTypes.h"
+#include "HiZ.h"
+
+// Two phase HiZ occlusion culling on the GPU (hiz.hlsl), HiZ.h is the CPU reference
+// BuildAndCull runs between the two depth phases. Predicates drive D3D12 predication of the
+// phase 2 draws and are read back to become the visibility bits of the next frame.
+
+struct HiZCullingInit
+{
+	uint32_t width = 0;			// Depth buffer size
+	uint32_t height = 0;
+	uint32_t maxInstances = 0;
+	std::filesystem::path shaderPath;
+};
+
+// Validation, GPU results of the last completed frame against the CPU reference
+struct HiZCullingStats
+{
+	bool validated = false;
+	uint32_t numTests = 0;
+	uint32_t pyramidMismatches = 0;	// Texels over every mip
+	uint32_t testMismatches = 0;
+	double cpuBuildMs = 0.0;
+	double cpuTestMs = 0.0;
+};
+
+class HiZCulling
+{
+public:
+	void Initialize(const HiZCullingInit& init);
+	void Shutdown();
+
+	// Results of the last recorded frame, call once it completed, nullptr when none was recorded
+	// 2 uints per instance, the first is 1 when visible, only instances tested that frame are valid
+	const uint32_t* ResolveResults();
+
+	// Depth is in DEPTH_WRITE and returned to it, predicates are left in PREDICATION state
+	void BuildAndCull(DepthBuffer& depth, const std::vector<HiZTestEntry>& tests);
+
+	// After the last predicated draw, copies results for ResolveResults
+	void EndFrame();
+
+	ID3D12Resource* Predicates() const { return m_predicates.internalBuffer.resource.Get(); }
+	uint32_t NumMips() const { return m_numMips; }
+	bool& Validate() { return m_validate; }
+	const HiZCullingStats& Stats() const { return m_stats; }
+
+private:
+	void CreatePSO();
+	void ValidateResults(const uint32_t* predicates);
+
+	HiZCullingInit m_init;
+	uint32_t m_numMips = 0;
+
+	// R32 pyramid, mip 0 is a copy of depth
+	Microsoft::WRL::ComPtr<ID3D12Resource> m_hiZBuffer;
+	std::vector<DescriptorAlloc> m_mipSRVs;
+	std::vector<DescriptorAlloc> m_mipUAVs;
+	DescriptorAlloc m_hiZSRV;	// Full chain
+	DescriptorAlloc m_nullUAV;	// u0 of the cull pass, CullCS doesn't write the pyramid
+
+	Microsoft::WRL::ComPtr<ID3D12RootSignature> m_rootSignature;	// Shared by build and cull
+	Microsoft::WRL::ComPtr<IDxcBlob> m_buildCS;
+	Microsoft::WRL::ComPtr<IDxcBlob> m_cullCS;
+	Microsoft::WRL::ComPtr<ID3D12PipelineState> m_buildPSO;
+	Microsoft::WRL::ComPtr<ID3D12PipelineState> m_cullPSO;
+
+	StructuredBuffer m_testBuffer;	// Upload heap, rewritten every frame
+	RawBuffer m_predicates;
+	Microsoft::WRL::ComPtr<ID3D12Resource> m_predicateReadback;
+	const uint32_t* m_predicateData = nullptr;
+	bool m_resultsPending = false;
+
+	// Depth then every HZB mip of the validated frame
+	Microsoft::WRL::ComPtr<ID3D12Resource> m_validationReadback;
+	std::vector<D3D12_PLACED_SUBRESOURCE_FOOTPRINT> m_validationFootprints;
+	const uint8_t* m_validationData = nullptr;
+	std::vector<HiZTestEntry> m_validationTests;
+	std::vector<float> m_validationDepth;
+	HiZPyramid m_referencePyramid;
+	bool m_validate = false;
+	bool m_validationPending = false;
+
+	HiZCullingStats m_stats;
+};
@@ -0,0 +1,371 @@
+#include "IndirectCulling.h"
+#include "Utility.h"
+#include "DX12.h"
+#include "Helper.h"
+
+#include <assert.h>
+
+using Microsoft::WRL::ComPtr;
+
+// Mirrors IndirectConstantBuffer in indirect.hlsl
+struct IndirectConstants
+{
+	uint32_t firstRecord;
+	uint32_t numRecords;
+	uint32_t firstGroup;
+	uint32_t bucket;
+	XMFLOAT4 planes[6];
+};
+
+static const uint32_t ArgsStride = sizeof(IndirectDrawArgs);
+
+void IndirectCulling::Initialize(const IndirectCullingInit& init)
+{
+	assert(init.drawRootSignature != nullptr);
+
+	m_init = init;
+	m_init.maxRecords = std::max(init.maxRecords, 1u);
+
+	// Every bucket can end with a partial group
+	m_maxGroups = (m_init.maxRecords + INDIRECT_GROUP_SIZE - 1) / INDIRECT_GROUP_SIZE + MaxIndirectBuckets;
+
+	StructuredBufferInit sbi;
+	sbi.cpuAccessible = true;
+	sbi.stride = sizeof(DrawRecord);
+	sbi.numElements = m_init.maxRecords;
+	sbi.name = L"IndirectDrawRecords";
+	m_recordBuffer.Initialize(sbi);
+
+	RawBufferInit rbi;
+	rbi.numElements = m_init.maxRecords * (ArgsStride / RawBuffer::Stride);
+	rbi.allowUAV = true;
+	rbi.initState = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
+	rbi.name = L"IndirectArgs";
+	m_args.Initialize(rbi);
+
+	rbi.numElements = MaxIndirectBuckets;
+	rbi.name = L"IndirectCounts";
+	m_counts.Initialize(rbi);
+
+	rbi.numElements = m_maxGroups;
+	rbi.name = L"IndirectGroupCounts";
+	m_groupCounts.Initialize(rbi);
+
+	rbi = RawBufferInit();
+	rbi.cpuAccessible = true;
+	rbi.numElements = m_init.maxRecords * (ArgsStride / RawBuffer::Stride);
+	rbi.name = L"IndirectArgsCPU";
+	m_cpuArgs.Initialize(rbi);
+
+	rbi.numElements = MaxIndirectBuckets;
+	rbi.name = L"IndirectCountsCPU";
+	m_cpuCounts.Initialize(rbi);
+
+	m_readbackData = static_cast<const uint8_t*>(CreateReadbackBuffer(
+		m_readback,
+		MaxIndirectBuckets * sizeof(uint32_t) + static_cast<uint64_t>(m_init.maxRecords) * ArgsStride,
+		L"IndirectReadback"));
+
+	CreatePSO();
+
+	m_records.clear();
+	m_numBuckets = 0;
+	m_argsReadable = false;
+	m_resultsPending = false;
+	m_visibleDrawIds.clear();
+	m_stats = {};
+}
+
+void IndirectCulling::Shutdown()
+{
+	m_countPSO = nullptr;
+	m_scanPSO = nullptr;
+	m_compactPSO = nullptr;
+	m_rootSignature = nullptr;
+	m_commandSignature = nullptr;
+
+	m_recordBuffer.Shutdown();
+	m_args.Shutdown();
+	m_counts.Shutdown();
+	m_groupCounts.Shutdown();
+	m_cpuArgs.Shutdown();
+	m_cpuCounts.Shutdown();
+
+	m_readback = nullptr;
+	m_readbackData = nullptr;
+}
+
+void IndirectCulling::CreatePSO()
+{
+	const std::wstring includePath = std::filesystem::absolute(m_init.shaderPath).wstring();
+	const std::wstring indirectShader = std::filesystem::absolute(m_init.shaderPath / "indirect.hlsl").wstring();
+	CompileShaderFromFile(indirectShader, includePath, L"CountCS", m_countCS, ShaderType::Compute);
+	CompileShaderFromFile(indirectShader, includePath, L"ScanCS", m_scanCS, ShaderType::Compute);
+	CompileShaderFromFile(indirectShader, includePath, L"CompactCS", m_compactCS, ShaderType::Compute);
+
+	D3D12_ROOT_PARAMETER1 rootParameters[5] = {};
+
+	// IndirectConstantBuffer
+	rootParameters[0].ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
+	rootParameters[0].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+	rootParameters[0].Constants.Num32BitValues = sizeof(IndirectConstants) / 4;
+	rootParameters[0].Constants.ShaderRegister = 0;
+	rootParameters[0].Constants.RegisterSpace = 0;
+
+	// Records (t0)
+	rootParameters[1].ParameterType = D3D12_ROOT_PARAMETER_TYPE_SRV;
+	rootParameters[1].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+	rootParameters[1].Descriptor.ShaderRegister = 0;
+	rootParameters[1].Descriptor.RegisterSpace = 0;
+
+	// Args, group counts, draw counts (u0 - u2)
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		rootParameters[2 + i].ParameterType = D3D12_ROOT_PARAMETER_TYPE_UAV;
+		rootParameters[2 + i].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+		rootParameters[2 + i].Descriptor.ShaderRegister = i;
+		rootParameters[2 + i].Descriptor.RegisterSpace = 0;
+	}
+
+	D3D12_ROOT_SIGNATURE_DESC1 rootSignatureDesc = {};
+	rootSignatureDesc.NumParameters = _countof(rootParameters);
+	rootSignatureDesc.pParameters = rootParameters;
+
+	CreateRootSignature(m_rootSignature, rootSignatureDesc);
+
+	D3D12_COMPUTE_PIPELINE_STATE_DESC psoDesc = {};
+	psoDesc.pRootSignature = m_rootSignature.Get();
+	psoDesc.CS = { m_countCS->GetBufferPointer(), m_countCS->GetBufferSize() };
+	CheckHRESULT(d3dDevice->CreateComputePipelineState(&psoDesc, IID_PPV_ARGS(&m_countPSO)));
+
+	psoDesc.CS = { m_scanCS->GetBufferPointer(), m_scanCS->GetBufferSize() };
+	CheckHRESULT(d3dDevice->CreateComputePipelineState(&psoDesc, IID_PPV_ARGS(&m_scanPSO)));
+
+	psoDesc.CS = { m_compactCS->GetBufferPointer(), m_compactCS->GetBufferSize() };
+	CheckHRESULT(d3dDevice->CreateComputePipelineState(&psoDesc, IID_PPV_ARGS(&m_compactPSO)));
+
+	// drawId and materialIndex, then the draw, same layout as IndirectDrawArgs
+	D3D12_INDIRECT_ARGUMENT_DESC argumentDescs[2] = {};
+	argumentDescs[0].Type = D3D12_INDIRECT_ARGUMENT_TYPE_CONSTANT;
+	argumentDescs[0].Constant.RootParameterIndex = m_init.drawConstantsParameter;
+	argumentDescs[0].Constant.DestOffsetIn32BitValues = 0;
+	argumentDescs[0].Constant.Num32BitValuesToSet = 2;
+	argumentDescs[1].Type = D3D12_INDIRECT_ARGUMENT_TYPE_DRAW_INDEXED;
+
+	D3D12_COMMAND_SIGNATURE_DESC signatureDesc = {};
+	signatureDesc.ByteStride = ArgsStride;
+	signatureDesc.NumArgumentDescs = _countof(argumentDescs);
+	signatureDesc.pArgumentDescs = argumentDescs;
+	CheckHRESULT(d3dDevice->CreateCommandSignature(&signatureDesc, m_init.drawRootSignature, IID_PPV_ARGS(&m_commandSignature)));
+}
+
+void IndirectCulling::SetRecords(const std::vector<DrawRecord>& records, const uint32_t* bucketBegin, uint32_t numBuckets)
+{
+	assert(records.size() <= m_recordBuffer.NumElements);
+	assert(numBuckets <= MaxIndirectBuckets && bucketBegin[numBuckets] == records.size());
+
+	assert(gpuIdle);
+	m_records = records;
+	memcpy(m_recordBuffer.internalBuffer.cpuAddress, records.data(), records.size() * sizeof(DrawRecord));
+
+	m_numBuckets = numBuckets;
+	for (uint32_t bucket = 0; bucket <= numBuckets; ++bucket)
+	{
+		m_bucketBegin[bucket] = bucketBegin[bucket];
+	}
+	m_stats.numRecords = static_cast<uint32_t>(records.size());
+}
+
+void IndirectCulling::Cull(const FrustumPlanes& planes, bool useGpu)
+{
+	m_useGpu = useGpu;
+	m_stats.gpu = useGpu;
+
+	if (m_records.empty())
+	{
+		m_visibleDrawIds.clear();
+		return;
+	}
+
+	if (!useGpu)
+	{
+		auto start = TimerClock::now();
+
+		uint32_t* counts = reinterpret_cast<uint32_t*>(m_cpuCounts.internalBuffer.cpuAddress);
+		IndirectDrawArgs* args = reinterpret_cast<IndirectDrawArgs*>(m_cpuArgs.internalBuffer.cpuAddress);
+		m_visibleDrawIds.clear();
+		for (uint32_t bucket = 0; bucket < m_numBuckets; ++bucket)
+		{
+			const uint32_t first = m_bucketBegin[bucket];
+			counts[bucket] = BuildIndirectArgs(m_records.data() + first, m_bucketBegin[bucket + 1] - first, planes, args + first);
+			m_stats.numDraws[bucket] = counts[bucket];
+			for (uint32_t i = 0; i < counts[bucket]; ++i)
+			{
+				m_visibleDrawIds.push_back(args[first + i].drawId);
+			}
+		}
+
+		m_stats.cpuMs = ElapsedMs(start);
+		return;
+	}
+
+	ID3D12Resource* args = m_args.internalBuffer.resource.Get();
+	ID3D12Resource* counts = m_counts.internalBuffer.resource.Get();
+	if (m_argsReadable)
+	{
+		D3D12_RESOURCE_BARRIER barriers[2] = {};
+		barriers[0] = CD3DX12_RESOURCE_BARRIER::Transition(args, D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+		barriers[1] = CD3DX12_RESOURCE_BARRIER::Transition(counts, D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+		commandList->ResourceBarrier(_countof(barriers), barriers);
+	}
+
+	commandList->SetComputeRootSignature(m_rootSignature.Get());
+	commandList->SetComputeRootShaderResourceView(1, m_recordBuffer.internalBuffer.gpuAddress);
+	commandList->SetComputeRootUnorderedAccessView(2, m_args.internalBuffer.gpuAddress);
+	commandList->SetComputeRootUnorderedAccessView(3, m_groupCounts.internalBuffer.gpuAddress);
+	commandList->SetComputeRootUnorderedAccessView(4, m_counts.internalBuffer.gpuAddress);
+
+	// Buckets use their own group counts, every pass covers all of them before the barrier
+	IndirectConstants constants[MaxIndirectBuckets] = {};
+	uint32_t numGroups[MaxIndirectBuckets] = {};
+	uint32_t firstGroup = 0;
+	for (uint32_t bucket = 0; bucket < m_numBuckets; ++bucket)
+	{
+		constants[bucket].firstRecord = m_bucketBegin[bucket];
+		constants[bucket].numRecords = m_bucketBegin[bucket + 1] - m_bucketBegin[bucket];
+		constants[bucket].firstGroup = firstGroup;
+		constants[bucket].bucket = bucket;
+		memcpy(constants[bucket].planes, planes.planes, sizeof(planes.planes));
+
+		numGroups[bucket] = (constants[bucket].numRecords + INDIRECT_GROUP_SIZE - 1) / INDIRECT_GROUP_SIZE;
+		firstGroup += numGroups[bucket];
+	}
+	assert(firstGroup <= m_maxGroups);
+
+	ID3D12PipelineState* passes[] = { m_countPSO.Get(), m_scanPSO.Get(), m_compactPSO.Get() };
+	for (ID3D12PipelineState* pass : passes)
+	{
+		commandList->SetPipelineState(pass);
+		for (uint32_t bucket = 0; bucket < m_numBuckets; ++bucket)
+		{
+			// The scan also writes the count of an empty bucket
+			const uint32_t numDispatchGroups = (pass == m_scanPSO.Get()) ? 1 : numGroups[bucket];
+			if (numDispatchGroups == 0)
+				continue;
+
+			commandList->SetComputeRoot32BitConstants(0, sizeof(IndirectConstants) / 4, &constants[bucket], 0);
+			commandList->Dispatch(numDispatchGroups, 1, 1);
+		}
+
+		D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::UAV(m_groupCounts.internalBuffer.resource.Get());
+		commandList->ResourceBarrier(1, &barrier);
+	}
+
+	// Counts then arguments, read back for validation and streaming
+	{
+		D3D12_RESOURCE_BARRIER barriers[2] = {};
+		barriers[0] = CD3DX12_RESOURCE_BARRIER::Transition(args, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE);
+		barriers[1] = CD3DX12_RESOURCE_BARRIER::Transition(counts, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE);
+		commandList->ResourceBarrier(_countof(barriers), barriers);
+
+		const uint64_t countBytes = MaxIndirectBuckets * sizeof(uint32_t);
+		commandList->CopyBufferRegion(m_readback.Get(), 0, counts, 0, countBytes);
+		commandList->CopyBufferRegion(m_readback.Get(), countBytes, args, 0, static_cast<uint64_t>(m_records.size()) * ArgsStride);
+
+		barriers[0] = CD3DX12_RESOURCE_BARRIER::Transition(args, D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT);
+		barriers[1] = CD3DX12_RESOURCE_BARRIER::Transition(counts, D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT);
+		commandList->ResourceBarrier(_countof(barriers), barriers);
+	}
+	m_argsReadable = true;
+
+	m_pendingPlanes = planes;
+	m_resultsPending = true;
+}
+
+void IndirectCulling::Draw(uint32_t bucket)
+{
+	assert(bucket < m_numBuckets);
+
+	const uint32_t maxDraws = m_bucketBegin[bucket + 1] - m_bucketBegin[bucket];
+	if (maxDraws == 0)
+	{
+		return;
+	}
+
+	// Only the count buffer entry of the bucket is read
+	ID3D12Resource* args = m_useGpu ? m_args.internalBuffer.resource.Get() : m_cpuArgs.internalBuffer.resource.Get();
+	ID3D12Resource* counts = m_useGpu ? m_counts.internalBuffer.resource.Get() : m_cpuCounts.internalBuffer.resource.Get();
+	commandList->ExecuteIndirect(
+		m_commandSignature.Get(),
+		maxDraws,
+		args,
+		static_cast<uint64_t>(m_bucketBegin[bucket]) * ArgsStride,
+		counts,
+		bucket * sizeof(uint32_t));
+}
+
+void IndirectCulling::ResolveResults()
+{
+	if (!m_resultsPending)
+	{
+		return;
+	}
+	m_resultsPending = false;
+
+	const uint32_t* counts = reinterpret_cast<const uint32_t*>(m_readbackData);
+	const IndirectDrawArgs* args = reinterpret_cast<const IndirectDrawArgs*>(m_readbackData + MaxIndirectBuckets * sizeof(uint32_t));
+
+	m_visibleDrawIds.clear();
+	for (uint32_t bucket = 0; bucket < m_numBuckets; ++bucket)
+	{
+		const uint32_t first = m_bucketBegin[bucket];
+		const uint32_t count = std::min(counts[bucket], m_bucketBegin[bucket + 1] - first);
+		m_stats.numDraws[bucket] = count;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			m_visibleDrawIds.push_back(args[first + i].drawId);
+		}
+	}
+
+	if (m_validate)
+	{
+		ValidateResults(counts, args);
+	}
+}
+
+void IndirectCulling::ValidateResults(const uint32_t* counts, const IndirectDrawArgs* args)
+{
+	auto start = TimerClock::now();
+
+	// Same records and planes the GPU culled
+	m_referenceArgs.resize(m_records.size());
+	m_stats.countMismatches = 0;
+	m_stats.argMismatches = 0;
+	for (uint32_t bucket = 0; bucket < m_numBuckets; ++bucket)
+	{
+		const uint32_t first = m_bucketBegin[bucket];
+		const uint32_t count = BuildIndirectArgs(m_records.data() + first, m_bucketBegin[bucket + 1] - first, m_pendingPlanes, m_referenceArgs.data() + first);
+		if (counts[bucket] != count)
+		{
+			++m_stats.countMismatches;
+		}
+
+		// Bytewise, the stream ExecuteIndirect reads
+		for (uint32_t i = 0; i < std::min(count, counts[bucket]); ++i)
+		{
+			if (memcmp(&args[first + i], &m_referenceArgs[first + i], sizeof(IndirectDrawArgs)) != 0)
+			{
+				++m_stats.argMismatches;
+			}
+		}
+	}
+
+	m_stats.cpuMs = ElapsedMs(start);
+	m_stats.validated = true;
+
+	if (m_stats.countMismatches > 0 || m_stats.argMismatches > 0)
+	{
+		printf("Indirect validation: %u bucket counts and %u / %u arguments differ from the CPU reference\n",
+			m_stats.countMismatches, m_stats.argMismatches, static_cast<uint32_t>(m_visibleDrawIds.size()));
+	}
+}
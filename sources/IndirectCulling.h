@@ -0,0 +1,103 @@
+#pragma once
+
+#include "PCH.h"
+#include "GraphicsTypes.h"
+#include "IndirectDraw.h"
+
+// GPU driven draw arguments (indirect.hlsl), IndirectDraw.h is the CPU reference
+// Records are frustum culled and compacted into IndirectDrawArgs, bucket by bucket (one per pipeline),
+// with the number of arguments of every bucket in the count buffer. ExecuteIndirect sets the draw id
+// and material root constants then draws every argument. The CPU fallback writes the same stream
+// to upload buffers and draws through the same command signature.
+
+static const uint32_t MaxIndirectBuckets = 2;
+
+struct IndirectCullingInit
+{
+	uint32_t maxRecords = 0;
+	ID3D12RootSignature* drawRootSignature = nullptr;	// Graphics root signature the draws use
+	uint32_t drawConstantsParameter = 0;				// 2 root constants, ModelConstants
+	std::filesystem::path shaderPath;
+};
+
+struct IndirectCullingStats
+{
+	bool gpu = false;
+	uint32_t numRecords = 0;
+	uint32_t numDraws[MaxIndirectBuckets] = {};	// GPU: last completed frame
+	double cpuMs = 0.0;		// Fallback build or validation reference
+
+	// Validation, GPU stream of the last completed frame against the CPU reference
+	bool validated = false;
+	uint32_t countMismatches = 0;	// Buckets
+	uint32_t argMismatches = 0;
+};
+
+class IndirectCulling
+{
+public:
+	void Initialize(const IndirectCullingInit& init);
+	void Shutdown();
+
+	// Bucket b covers records [bucketBegin[b], bucketBegin[b + 1]), its arguments the same range
+	// Copied to the upload buffer, only call when a record changed
+	void SetRecords(const std::vector<DrawRecord>& records, const uint32_t* bucketBegin, uint32_t numBuckets);
+
+	// Counts and draw ids of the last GPU culled frame, call once it completed
+	void ResolveResults();
+
+	// GPU records the compute passes (arguments are left in INDIRECT_ARGUMENT state),
+	// otherwise BuildIndirectArgs writes the fallback upload buffers
+	void Cull(const FrustumPlanes& planes, bool useGpu);
+
+	// Pipeline and the draw root parameters are bound by the caller
+	void Draw(uint32_t bucket);
+
+	// Visible instances, GPU: last completed frame, CPU: this frame
+	const std::vector<uint32_t>& VisibleDrawIds() const { return m_visibleDrawIds; }
+	bool& Validate() { return m_validate; }
+	const IndirectCullingStats& Stats() const { return m_stats; }
+
+private:
+	void CreatePSO();
+	void ValidateResults(const uint32_t* counts, const IndirectDrawArgs* args);
+
+	IndirectCullingInit m_init;
+	uint32_t m_numBuckets = 0;
+	uint32_t m_bucketBegin[MaxIndirectBuckets + 1] = {};
+	uint32_t m_maxGroups = 0;
+
+	Microsoft::WRL::ComPtr<ID3D12RootSignature> m_rootSignature;
+	Microsoft::WRL::ComPtr<IDxcBlob> m_countCS;
+	Microsoft::WRL::ComPtr<IDxcBlob> m_scanCS;
+	Microsoft::WRL::ComPtr<IDxcBlob> m_compactCS;
+	Microsoft::WRL::ComPtr<ID3D12PipelineState> m_countPSO;
+	Microsoft::WRL::ComPtr<ID3D12PipelineState> m_scanPSO;
+	Microsoft::WRL::ComPtr<ID3D12PipelineState> m_compactPSO;
+	Microsoft::WRL::ComPtr<ID3D12CommandSignature> m_commandSignature;
+
+	std::vector<DrawRecord> m_records;
+	StructuredBuffer m_recordBuffer;	// Upload heap
+
+	// GPU output, UAV while culling
+	RawBuffer m_args;
+	RawBuffer m_counts;
+	RawBuffer m_groupCounts;
+	bool m_argsReadable = false;	// INDIRECT_ARGUMENT state
+
+	// CPU fallback, upload heap
+	RawBuffer m_cpuArgs;
+	RawBuffer m_cpuCounts;
+	bool m_useGpu = true;	// Of the last Cull
+
+	// Counts then arguments
+	Microsoft::WRL::ComPtr<ID3D12Resource> m_readback;
+	const uint8_t* m_readbackData = nullptr;
+	bool m_resultsPending = false;
+	FrustumPlanes m_pendingPlanes = {};
+	std::vector<IndirectDrawArgs> m_referenceArgs;
+	bool m_validate = false;
+
+	std::vector<uint32_t> m_visibleDrawIds;
+	IndirectCullingStats m_stats;
+};
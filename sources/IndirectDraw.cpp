@@ -0,0 +1,133 @@
+#include "IndirectDraw.h"
+#include "Utility.h"
+#include "RenderList.h"
+
+#include <assert.h>
+#include <float.h>
+#include <random>
+#include <string.h>
+
+using namespace DirectX;
+
+IndirectDrawArgs MakeIndirectDrawArgs(const DrawRecord& record)
+{
+	IndirectDrawArgs args;
+	args.drawId = record.instanceIndex;
+	args.materialIndex = record.materialIndex;
+	args.indexCountPerInstance = record.indexCount;
+	args.instanceCount = 1;
+	args.startIndexLocation = record.startIndex;
+	args.baseVertexLocation = record.baseVertex;
+	args.startInstanceLocation = 0;
+	args.pad = 0;
+	return args;
+}
+
+uint32_t BuildIndirectArgs(const DrawRecord* records, uint32_t count, const FrustumPlanes& planes, IndirectDrawArgs* outArgs)
+{
+	uint32_t numArgs = 0;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		if (!IsBoxOutside(planes, records[i].centerBound, records[i].extentsBound))
+		{
+			outArgs[numArgs++] = MakeIndirectDrawArgs(records[i]);
+		}
+	}
+	return numArgs;
+}
+
+uint32_t IndirectArgsBuilder::Build(JobSystem& jobs, const DrawRecord* records, uint32_t count, const FrustumPlanes& planes, IndirectDrawArgs* outArgs)
+{
+	if (count == 0)
+	{
+		return 0;
+	}
+
+	const uint32_t chunkSize = RenderListChunkSize(count, jobs.NumThreads());
+	const uint32_t numChunks = (count + chunkSize - 1) / chunkSize;
+	m_chunkOffsets.resize(numChunks);
+
+	// CountCS
+	jobs.ParallelFor(numChunks, 1, [&](uint32_t begin, uint32_t end, uint32_t)
+	{
+		for (uint32_t chunk = begin; chunk < end; ++chunk)
+		{
+			const uint32_t last = std::min((chunk + 1) * chunkSize, count);
+			uint32_t numVisible = 0;
+			for (uint32_t i = chunk * chunkSize; i < last; ++i)
+			{
+				numVisible += IsBoxOutside(planes, records[i].centerBound, records[i].extentsBound) ? 0 : 1;
+			}
+			m_chunkOffsets[chunk] = numVisible;
+		}
+	});
+
+	// ScanCS
+	uint32_t numArgs = 0;
+	for (uint32_t chunk = 0; chunk < numChunks; ++chunk)
+	{
+		const uint32_t chunkCount = m_chunkOffsets[chunk];
+		m_chunkOffsets[chunk] = numArgs;
+		numArgs += chunkCount;
+	}
+
+	// CompactCS
+	jobs.ParallelFor(numChunks, 1, [&](uint32_t begin, uint32_t end, uint32_t)
+	{
+		for (uint32_t chunk = begin; chunk < end; ++chunk)
+		{
+			const uint32_t first = chunk * chunkSize;
+			const uint32_t last = std::min(first + chunkSize, count);
+			BuildIndirectArgs(records + first, last - first, planes, outArgs + m_chunkOffsets[chunk]);
+		}
+	});
+	return numArgs;
+}
+
+//
+// Benchmark
+//
+void RunIndirectBenchmark(JobSystem& jobs, uint32_t numRecords, IndirectBenchmarkResult& outResult)
+{
+	outResult = {};
+	outResult.numRecords = numRecords;
+	outResult.numThreads = jobs.NumThreads();
+
+	// Constant density, camera at origin inside the scene
+	std::mt19937 rng(1234);
+	const float side = 20.f * cbrtf(static_cast<float>(numRecords));
+	std::uniform_real_distribution<float> position(-side * 0.5f, side * 0.5f);
+	std::uniform_real_distribution<float> extent(0.5f, 2.f);
+
+	std::vector<DrawRecord> records(numRecords);
+	for (uint32_t i = 0; i < numRecords; ++i)
+	{
+		DrawRecord& record = records[i];
+		record.centerBound = XMFLOAT3(position(rng), position(rng), position(rng));
+		record.extentsBound = XMFLOAT3(extent(rng), extent(rng), extent(rng));
+		record.indexCount = 3 * (1 + rng() % 4096);
+		record.startIndex = rng() % (1 << 24);
+		record.baseVertex = static_cast<int>(rng() % (1 << 20));
+		record.materialIndex = rng() % 256;
+		record.instanceIndex = i;
+		record.pad = 0;
+	}
+
+	BoundingFrustum frustum(XMMatrixPerspectiveFovLH(XM_PI / 3, 16.f / 9.f, 0.1f, 1000.f));
+	FrustumPlanes planes;
+	GetFrustumPlanes(frustum, planes);
+
+	std::vector<IndirectDrawArgs> serialArgs(numRecords);
+	std::vector<IndirectDrawArgs> parallelArgs(numRecords);
+	IndirectArgsBuilder builder;
+	uint32_t numParallel = 0;
+	outResult.serialMs = BestOfMs([&] { outResult.numDraws = BuildIndirectArgs(records.data(), numRecords, planes, serialArgs.data()); });
+	outResult.parallelMs = BestOfMs([&] { numParallel = builder.Build(jobs, records.data(), numRecords, planes, parallelArgs.data()); });
+
+	// The stream ExecuteIndirect reads, compared as bytes
+	assert(numParallel == outResult.numDraws);
+	assert(memcmp(serialArgs.data(), parallelArgs.data(), outResult.numDraws * sizeof(IndirectDrawArgs)) == 0);
+	(void)numParallel;
+
+	outResult.argsPerSecond = (outResult.parallelMs > 0.0) ? outResult.numDraws / (outResult.parallelMs / 1000.0) : 0.0;
+}
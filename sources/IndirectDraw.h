@@ -0,0 +1,39 @@
+#pragma once
+
+#include "Culling.h"
+#include "JobSystem.h"
+#include "../shaders/HLSLCompatible.h"
+
+// Indirect draw argument generation, CPU reference of indirect.hlsl (no D3D dependency)
+// A record is kept when its bounds are not outside the frustum (IsBoxOutside) and its argument
+// goes after the arguments of every kept record before it. The GPU gets the same positions from
+// per group counts and an exclusive scan, so both sides emit an identical argument stream.
+
+// Argument of a kept record, same fields as CompactCS
+IndirectDrawArgs MakeIndirectDrawArgs(const DrawRecord& record);
+
+// Records [0, count) into outArgs, returns the number of arguments written
+uint32_t BuildIndirectArgs(const DrawRecord* records, uint32_t count, const FrustumPlanes& planes, IndirectDrawArgs* outArgs);
+
+// Same output split across jobs, chunks are counted, scanned then written like the GPU groups
+class IndirectArgsBuilder
+{
+public:
+	uint32_t Build(JobSystem& jobs, const DrawRecord* records, uint32_t count, const FrustumPlanes& planes, IndirectDrawArgs* outArgs);
+
+private:
+	std::vector<uint32_t> m_chunkOffsets;
+};
+
+struct IndirectBenchmarkResult
+{
+	uint32_t numRecords = 0;
+	uint32_t numDraws = 0;
+	uint32_t numThreads = 0;
+	double serialMs = 0.0;		// BuildIndirectArgs
+	double parallelMs = 0.0;	// IndirectArgsBuilder
+	double argsPerSecond = 0.0;	// Parallel
+};
+
+// Random scene seen from its center, both builders checked against each other down to the bytes
+void RunIndirectBenchmark(JobSystem& jobs, uint32_t numRecords, IndirectBenchmarkResult& outResult);
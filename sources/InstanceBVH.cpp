@@ -0,0 +1,447 @@
+#include "InstanceBVH.h"
+#include "Utility.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <random>
+
+using namespace DirectX;
+
+static float HalfArea(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax)
+{
+	const float dx = boundsMax.x - boundsMin.x;
+	const float dy = boundsMax.y - boundsMin.y;
+	const float dz = boundsMax.z - boundsMin.z;
+	return dx * dy + dy * dz + dz * dx;
+}
+
+static void GrowBounds(XMFLOAT3& boundsMin, XMFLOAT3& boundsMax, const XMFLOAT3& pointMin, const XMFLOAT3& pointMax)
+{
+	boundsMin.x = std::min(boundsMin.x, pointMin.x);
+	boundsMin.y = std::min(boundsMin.y, pointMin.y);
+	boundsMin.z = std::min(boundsMin.z, pointMin.z);
+	boundsMax.x = std::max(boundsMax.x, pointMax.x);
+	boundsMax.y = std::max(boundsMax.y, pointMax.y);
+	boundsMax.z = std::max(boundsMax.z, pointMax.z);
+}
+
+static float GetAxis(const XMFLOAT3& v, int axis)
+{
+	return (axis == 0) ? v.x : (axis == 1) ? v.y : v.z;
+}
+
+//
+// Build
+//
+void InstanceBVH::UpdateNodeBounds(InstanceBVHNode& node, const BoundsSoA& bounds) const
+{
+	node.boundsMin = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+	node.boundsMax = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (uint32_t i = node.firstPrim; i < node.firstPrim + node.numPrims; ++i)
+	{
+		const uint32_t prim = m_primIndices[i];
+		const XMFLOAT3 primMin(
+			bounds.centerX[prim] - bounds.extentX[prim],
+			bounds.centerY[prim] - bounds.extentY[prim],
+			bounds.centerZ[prim] - bounds.extentZ[prim]);
+		const XMFLOAT3 primMax(
+			bounds.centerX[prim] + bounds.extentX[prim],
+			bounds.centerY[prim] + bounds.extentY[prim],
+			bounds.centerZ[prim] + bounds.extentZ[prim]);
+		GrowBounds(node.boundsMin, node.boundsMax, primMin, primMax);
+	}
+}
+
+static XMFLOAT3 Centroid(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax)
+{
+	return XMFLOAT3(
+		(boundsMin.x + boundsMax.x) * 0.5f,
+		(boundsMin.y + boundsMax.y) * 0.5f,
+		(boundsMin.z + boundsMax.z) * 0.5f);
+}
+
+// Build only, node and centroid bounds from cached primitive boxes
+void InstanceBVH::ComputeRangeBounds(InstanceBVHNode& node, BuildTask& task) const
+{
+	node.boundsMin = task.centroidMin = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+	node.boundsMax = task.centroidMax = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (uint32_t i = node.firstPrim; i < node.firstPrim + node.numPrims; ++i)
+	{
+		const PrimBounds& primBounds = m_primBounds[i];
+		const XMFLOAT3 centroid = Centroid(primBounds.boundsMin, primBounds.boundsMax);
+		GrowBounds(node.boundsMin, node.boundsMax, primBounds.boundsMin, primBounds.boundsMax);
+		GrowBounds(task.centroidMin, task.centroidMax, centroid, centroid);
+	}
+}
+
+void InstanceBVH::Build(const BoundsSoA& bounds)
+{
+	m_nodes.clear();
+	m_primIndices.clear();
+
+	const uint32_t numPrims = bounds.count;
+	if (numPrims == 0)
+	{
+		return;
+	}
+
+	// Primitive boxes are partitioned in place so every pass reads memory sequentially
+	m_primIndices.resize(numPrims);
+	m_primBounds.resize(numPrims);
+	for (uint32_t i = 0; i < numPrims; ++i)
+	{
+		PrimBounds& primBounds = m_primBounds[i];
+		primBounds.index = i;
+		primBounds.boundsMin = XMFLOAT3(
+			bounds.centerX[i] - bounds.extentX[i],
+			bounds.centerY[i] - bounds.extentY[i],
+			bounds.centerZ[i] - bounds.extentZ[i]);
+		primBounds.boundsMax = XMFLOAT3(
+			bounds.centerX[i] + bounds.extentX[i],
+			bounds.centerY[i] + bounds.extentY[i],
+			bounds.centerZ[i] + bounds.extentZ[i]);
+	}
+
+	// At most 2n - 1 nodes, no reallocation while subdividing
+	m_nodes.reserve(2 * static_cast<size_t>(numPrims));
+
+	InstanceBVHNode root;
+	root.firstPrim = 0;
+	root.numPrims = numPrims;
+	BuildTask rootTask;
+	rootTask.nodeIndex = 0;
+	ComputeRangeBounds(root, rootTask);
+	m_nodes.push_back(root);
+
+	std::vector<BuildTask> stack = { rootTask };
+	while (!stack.empty())
+	{
+		const BuildTask task = stack.back();
+		stack.pop_back();
+		Subdivide(task, stack);
+	}
+
+	for (uint32_t i = 0; i < numPrims; ++i)
+	{
+		m_primIndices[i] = m_primBounds[i].index;
+	}
+	m_primBounds.clear();
+	m_primBounds.shrink_to_fit();
+}
+
+void InstanceBVH::Subdivide(const BuildTask& task, std::vector<BuildTask>& stack)
+{
+	InstanceBVHNode& node = m_nodes[task.nodeIndex];
+	if (node.numPrims <= MaxLeafSize)
+	{
+		return;
+	}
+
+	const uint32_t first = node.firstPrim;
+	const uint32_t last = node.firstPrim + node.numPrims;
+
+	// Bin all three axes in one pass over the range
+	float axisMin[3], scale[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		axisMin[axis] = GetAxis(task.centroidMin, axis);
+		const float extent = GetAxis(task.centroidMax, axis) - axisMin[axis];
+		scale[axis] = (extent > 0.f) ? NumBins / extent : 0.f;
+	}
+
+	uint32_t binCount[3][NumBins] = {};
+	XMFLOAT3 binMin[3][NumBins], binMax[3][NumBins];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		for (uint32_t b = 0; b < NumBins; ++b)
+		{
+			binMin[axis][b] = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+			binMax[axis][b] = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		}
+	}
+
+	for (uint32_t i = first; i < last; ++i)
+	{
+		const PrimBounds& primBounds = m_primBounds[i];
+		const XMFLOAT3 centroid = Centroid(primBounds.boundsMin, primBounds.boundsMax);
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			const uint32_t b = std::min(static_cast<uint32_t>((GetAxis(centroid, axis) - axisMin[axis]) * scale[axis]), NumBins - 1);
+			++binCount[axis][b];
+			GrowBounds(binMin[axis][b], binMax[axis][b], primBounds.boundsMin, primBounds.boundsMax);
+		}
+	}
+
+	int bestAxis = -1;
+	uint32_t bestSplit = 0;
+	float bestCost = FLT_MAX;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (scale[axis] == 0.f)
+			continue;
+
+		// Sweep from both sides, split s puts bins [0, s] on the left
+		float leftArea[NumBins - 1], rightArea[NumBins - 1];
+		uint32_t leftCount[NumBins - 1], rightCount[NumBins - 1];
+		XMFLOAT3 sweepMin(FLT_MAX, FLT_MAX, FLT_MAX), sweepMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		uint32_t sum = 0;
+		for (uint32_t s = 0; s < NumBins - 1; ++s)
+		{
+			sum += binCount[axis][s];
+			if (binCount[axis][s] > 0)
+				GrowBounds(sweepMin, sweepMax, binMin[axis][s], binMax[axis][s]);
+			leftCount[s] = sum;
+			leftArea[s] = (sum > 0) ? HalfArea(sweepMin, sweepMax) : 0.f;
+		}
+		sweepMin = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+		sweepMax = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		sum = 0;
+		for (uint32_t s = NumBins - 1; s > 0; --s)
+		{
+			sum += binCount[axis][s];
+			if (binCount[axis][s] > 0)
+				GrowBounds(sweepMin, sweepMax, binMin[axis][s], binMax[axis][s]);
+			rightCount[s - 1] = sum;
+			rightArea[s - 1] = (sum > 0) ? HalfArea(sweepMin, sweepMax) : 0.f;
+		}
+
+		for (uint32_t s = 0; s < NumBins - 1; ++s)
+		{
+			if (leftCount[s] == 0 || rightCount[s] == 0)
+				continue;
+
+			const float cost = leftCount[s] * leftArea[s] + rightCount[s] * rightArea[s];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = s;
+			}
+		}
+	}
+
+	InstanceBVHNode left, right;
+	BuildTask leftTask, rightTask;
+	left.boundsMin = right.boundsMin = leftTask.centroidMin = rightTask.centroidMin = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+	left.boundsMax = right.boundsMax = leftTask.centroidMax = rightTask.centroidMax = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+	// Partition in place, children bounds are grown while elements are visited
+	uint32_t mid = first;
+	if (bestAxis >= 0)
+	{
+		uint32_t end = last;
+		while (mid < end)
+		{
+			const PrimBounds& primBounds = m_primBounds[mid];
+			const XMFLOAT3 centroid = Centroid(primBounds.boundsMin, primBounds.boundsMax);
+			const uint32_t b = std::min(static_cast<uint32_t>((GetAxis(centroid, bestAxis) - axisMin[bestAxis]) * scale[bestAxis]), NumBins - 1);
+			if (b <= bestSplit)
+			{
+				GrowBounds(left.boundsMin, left.boundsMax, primBounds.boundsMin, primBounds.boundsMax);
+				GrowBounds(leftTask.centroidMin, leftTask.centroidMax, centroid, centroid);
+				++mid;
+			}
+			else
+			{
+				GrowBounds(right.boundsMin, right.boundsMax, primBounds.boundsMin, primBounds.boundsMax);
+				GrowBounds(rightTask.centroidMin, rightTask.centroidMax, centroid, centroid);
+				std::swap(m_primBounds[mid], m_primBounds[--end]);
+			}
+		}
+	}
+
+	left.firstPrim = first;
+	right.firstPrim = mid;
+	left.numPrims = mid - first;
+	right.numPrims = last - mid;
+
+	// Coincident centroids, any split is as good as another
+	if (mid == first || mid == last)
+	{
+		mid = first + node.numPrims / 2;
+		left.numPrims = mid - first;
+		right.firstPrim = mid;
+		right.numPrims = last - mid;
+		ComputeRangeBounds(left, leftTask);
+		ComputeRangeBounds(right, rightTask);
+	}
+
+	const uint32_t leftChild = static_cast<uint32_t>(m_nodes.size());
+	node.leftChild = leftChild;
+	leftTask.nodeIndex = leftChild;
+	rightTask.nodeIndex = leftChild + 1;
+
+	m_nodes.push_back(left);
+	m_nodes.push_back(right);
+	stack.push_back(leftTask);
+	stack.push_back(rightTask);
+}
+
+void InstanceBVH::Refit(const BoundsSoA& bounds)
+{
+	// Children are always stored after their parent
+	for (size_t i = m_nodes.size(); i-- > 0; )
+	{
+		InstanceBVHNode& node = m_nodes[i];
+		if (node.leftChild == 0)
+		{
+			UpdateNodeBounds(node, bounds);
+		}
+		else
+		{
+			const InstanceBVHNode& left = m_nodes[node.leftChild];
+			const InstanceBVHNode& right = m_nodes[node.leftChild + 1];
+			node.boundsMin = left.boundsMin;
+			node.boundsMax = left.boundsMax;
+			GrowBounds(node.boundsMin, node.boundsMax, right.boundsMin, right.boundsMax);
+		}
+	}
+}
+
+//
+// Traversal
+// Plane mask tracks planes the node still straddles, children skip planes the parent is fully inside
+//
+uint32_t InstanceBVH::CullFrustum(const BoundsSoA& bounds, const FrustumPlanes& planes, uint32_t* outIndices) const
+{
+	m_stats = {};
+	if (m_nodes.empty())
+	{
+		return 0;
+	}
+
+	XMFLOAT3 absNormal[6];
+	for (int p = 0; p < 6; ++p)
+	{
+		absNormal[p] = XMFLOAT3(fabsf(planes.planes[p].x), fabsf(planes.planes[p].y), fabsf(planes.planes[p].z));
+	}
+
+	struct StackEntry
+	{
+		uint32_t nodeIndex;
+		uint32_t planeMask;
+	};
+	std::vector<StackEntry> stack;
+	stack.reserve(64);
+	stack.push_back({ 0, 0x3F });
+
+	uint32_t numVisible = 0;
+	while (!stack.empty())
+	{
+		const StackEntry entry = stack.back();
+		stack.pop_back();
+
+		const InstanceBVHNode& node = m_nodes[entry.nodeIndex];
+		++m_stats.nodesVisited;
+
+		const XMFLOAT3 center(
+			(node.boundsMin.x + node.boundsMax.x) * 0.5f,
+			(node.boundsMin.y + node.boundsMax.y) * 0.5f,
+			(node.boundsMin.z + node.boundsMax.z) * 0.5f);
+		const XMFLOAT3 extents(
+			(node.boundsMax.x - node.boundsMin.x) * 0.5f,
+			(node.boundsMax.y - node.boundsMin.y) * 0.5f,
+			(node.boundsMax.z - node.boundsMin.z) * 0.5f);
+
+		uint32_t planeMask = entry.planeMask;
+		bool outside = false;
+		for (int p = 0; p < 6; ++p)
+		{
+			if ((planeMask & (1u << p)) == 0)
+				continue;
+
+			const XMFLOAT4& plane = planes.planes[p];
+			const float dist = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+			const float radius = absNormal[p].x * extents.x + absNormal[p].y * extents.y + absNormal[p].z * extents.z;
+			if (dist > radius)
+			{
+				outside = true;
+				break;
+			}
+			if (dist <= -radius)
+			{
+				planeMask &= ~(1u << p);
+			}
+		}
+		if (outside)
+			continue;
+
+		// Fully inside, accept whole subtree range
+		if (planeMask == 0)
+		{
+			for (uint32_t i = node.firstPrim; i < node.firstPrim + node.numPrims; ++i)
+			{
+				outIndices[numVisible++] = m_primIndices[i];
+			}
+			m_stats.primsAccepted += node.numPrims;
+			continue;
+		}
+
+		if (node.leftChild == 0)
+		{
+			for (uint32_t i = node.firstPrim; i < node.firstPrim + node.numPrims; ++i)
+			{
+				const uint32_t prim = m_primIndices[i];
+				const XMFLOAT3 primCenter(bounds.centerX[prim], bounds.centerY[prim], bounds.centerZ[prim]);
+				const XMFLOAT3 primExtents(bounds.extentX[prim], bounds.extentY[prim], bounds.extentZ[prim]);
+				outIndices[numVisible] = prim;
+				numVisible += IsBoxOutside(planes, primCenter, primExtents) ? 0 : 1;
+			}
+			m_stats.primsTested += node.numPrims;
+			continue;
+		}
+
+		stack.push_back({ node.leftChild + 1, planeMask });
+		stack.push_back({ node.leftChild, planeMask });
+	}
+	return numVisible;
+}
+
+//
+// Benchmark
+//
+void RunCullingBenchmark(uint32_t numInstances, CullingBenchmarkResult& outResult)
+{
+	outResult = {};
+	outResult.numInstances = numInstances;
+
+	// Constant density, camera at origin inside the scene
+	std::mt19937 rng(1234);
+	const float side = 20.f * cbrtf(static_cast<float>(numInstances));
+	std::uniform_real_distribution<float> position(-side * 0.5f, side * 0.5f);
+	std::uniform_real_distribution<float> extent(0.5f, 2.f);
+
+	BoundsSoA bounds;
+	bounds.Resize(numInstances);
+	for (uint32_t i = 0; i < numInstances; ++i)
+	{
+		const XMFLOAT3 center(position(rng), position(rng), position(rng));
+		const XMFLOAT3 extents(extent(rng), extent(rng), extent(rng));
+		bounds.Set(i, BoundingBox(center, extents));
+	}
+
+	BoundingFrustum frustum(XMMatrixPerspectiveFovLH(XM_PI / 3, 16.f / 9.f, 0.1f, 1000.f));
+	FrustumPlanes planes;
+	GetFrustumPlanes(frustum, planes);
+
+	std::vector<uint32_t> visible(bounds.centerX.size());
+
+	uint32_t numScalar = 0;
+	outResult.linearScalarMs = BestOfMs([&] { numScalar = CullFrustumScalar(bounds, planes, visible.data()); });
+	outResult.linearSimdMs = BestOfMs([&] { outResult.numVisible = CullFrustum(bounds, planes, visible.data()); });
+	assert(numScalar == outResult.numVisible);
+	(void)numScalar;
+
+	InstanceBVH bvh;
+	auto start = TimerClock::now();
+	bvh.Build(bounds);
+	outResult.bvhBuildMs = ElapsedMs(start);
+
+	uint32_t numBVH = 0;
+	outResult.bvhRefitMs = BestOfMs([&] { bvh.Refit(bounds); });
+	outResult.bvhCullMs = BestOfMs([&] { numBVH = bvh.CullFrustum(bounds, planes, visible.data()); });
+	assert(numBVH == outResult.numVisible);
+	(void)numBVH;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "Culling.h"
+
+// Bounding volume hierarchy over instance world bounds (no D3D dependency)
+// Binned SAH build, refit when bounds move, top-down frustum traversal.
+// Every node covers a contiguous range of primitive indices, fully inside subtrees are accepted
+// without visiting children.
+
+struct InstanceBVHNode
+{
+	DirectX::XMFLOAT3 boundsMin;
+	uint32_t firstPrim = 0;		// Range in primitive indices, also for inner nodes
+	DirectX::XMFLOAT3 boundsMax;
+	uint32_t numPrims = 0;
+	uint32_t leftChild = 0;		// Right is leftChild + 1, 0 for leaf (root is never a child)
+};
+
+struct InstanceBVHStats
+{
+	uint32_t nodesVisited = 0;
+	uint32_t primsTested = 0;
+	uint32_t primsAccepted = 0;	// Early accept without test
+};
+
+class InstanceBVH
+{
+public:
+	static const uint32_t MaxLeafSize = 4;
+	static const uint32_t NumBins = 16;
+
+	void Build(const BoundsSoA& bounds);
+
+	// Bounds moved, topology kept (quality degrades with large motion, rebuild then)
+	void Refit(const BoundsSoA& bounds);
+
+	// Same contract as CullFrustum, indices are not sorted
+	uint32_t CullFrustum(const BoundsSoA& bounds, const FrustumPlanes& planes, uint32_t* outIndices) const;
+
+	uint32_t NumNodes() const { return static_cast<uint32_t>(m_nodes.size()); }
+	bool IsEmpty() const { return m_nodes.empty(); }
+	const InstanceBVHStats& Stats() const { return m_stats; }
+
+private:
+	// Build scratch
+	struct PrimBounds
+	{
+		DirectX::XMFLOAT3 boundsMin;
+		DirectX::XMFLOAT3 boundsMax;
+		uint32_t index;
+	};
+	struct BuildTask
+	{
+		uint32_t nodeIndex;
+		DirectX::XMFLOAT3 centroidMin;
+		DirectX::XMFLOAT3 centroidMax;
+	};
+
+	void UpdateNodeBounds(InstanceBVHNode& node, const BoundsSoA& bounds) const;
+	void ComputeRangeBounds(InstanceBVHNode& node, BuildTask& task) const;
+	void Subdivide(const BuildTask& task, std::vector<BuildTask>& stack);
+
+	std::vector<PrimBounds> m_primBounds;
+
+	std::vector<InstanceBVHNode> m_nodes;
+	std::vector<uint32_t> m_primIndices;
+	mutable InstanceBVHStats m_stats;
+};
+
+struct CullingBenchmarkResult
+{
+	uint32_t numInstances = 0;
+	uint32_t numVisible = 0;
+	double linearScalarMs = 0.0;
+	double linearSimdMs = 0.0;
+	double bvhBuildMs = 0.0;
+	double bvhRefitMs = 0.0;
+	double bvhCullMs = 0.0;
+};
+
+// Synthetic scene of numInstances boxes at constant density around a camera at origin, fixed seed
+void RunCullingBenchmark(uint32_t numInstances, CullingBenchmarkResult& outResult);
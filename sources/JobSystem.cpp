@@ -0,0 +1,115 @@
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <assert.h>
+
+JobSystem jobSystem;
+
+void JobSystem::Initialize(const JobSystemInit& init)
+{
+	assert(m_workers.empty());
+
+	uint32_t numThreads = init.numThreads;
+	if (numThreads == 0)
+	{
+		numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+
+	m_exit = false;
+	for (uint32_t i = 1; i < numThreads; ++i)
+	{
+		m_workers.emplace_back(&JobSystem::WorkerLoop, this, i);
+	}
+}
+
+void JobSystem::Shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_exit = true;
+	}
+	m_wakeCondition.notify_all();
+
+	for (std::thread& worker : m_workers)
+	{
+		worker.join();
+	}
+	m_workers.clear();
+}
+
+void JobSystem::RunChunks(uint32_t threadIndex)
+{
+	for (;;)
+	{
+		const uint32_t chunk = m_nextChunk.fetch_add(1);
+		if (chunk >= m_numChunks)
+			break;
+
+		const uint32_t begin = chunk * m_chunkSize;
+		const uint32_t end = std::min(begin + m_chunkSize, m_count);
+		(*m_func)(begin, end, threadIndex);
+	}
+}
+
+void JobSystem::WorkerLoop(uint32_t threadIndex)
+{
+	uint64_t lastGeneration = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wakeCondition.wait(lock, [&]() { return m_exit || m_generation != lastGeneration; });
+			if (m_exit)
+				return;
+
+			lastGeneration = m_generation;
+			++m_numBusyWorkers;
+		}
+
+		RunChunks(threadIndex);
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			--m_numBusyWorkers;
+		}
+		m_doneCondition.notify_one();
+	}
+}
+
+void JobSystem::ParallelFor(uint32_t count, uint32_t chunkSize, const ParallelForFunc& func)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	chunkSize = std::max(chunkSize, 1u);
+
+	// Not worth waking anyone
+	if (m_workers.empty() || count <= chunkSize)
+	{
+		func(0, count, 0);
+		return;
+	}
+
+	{
+		// A worker woken late for the previous job may still be reading its state
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_doneCondition.wait(lock, [&]() { return m_numBusyWorkers == 0; });
+		assert(m_func == nullptr && "ParallelFor is not reentrant");
+		m_func = &func;
+		m_count = count;
+		m_chunkSize = chunkSize;
+		m_numChunks = (count + chunkSize - 1) / chunkSize;
+		m_nextChunk = 0;
+		++m_generation;
+	}
+	m_wakeCondition.notify_all();
+
+	RunChunks(0);
+
+	// Workers still inside func hold a reference to it
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_doneCondition.wait(lock, [&]() { return m_numBusyWorkers == 0; });
+	m_func = nullptr;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Worker pool for data parallel CPU work (no D3D dependency)
+// One ParallelFor in flight at a time, the calling thread works on chunks too.
+
+struct JobSystemInit
+{
+	uint32_t numThreads = 0;	// Including the calling thread, 0 = hardware concurrency
+};
+
+// Called with [begin, end) and the index of the executing thread, 0 is the caller
+using ParallelForFunc = std::function<void(uint32_t begin, uint32_t end, uint32_t threadIndex)>;
+
+class JobSystem
+{
+public:
+	void Initialize(const JobSystemInit& init);
+	void Shutdown();
+
+	// Blocks until every chunk of [0, count) completed
+	void ParallelFor(uint32_t count, uint32_t chunkSize, const ParallelForFunc& func);
+
+	// Size per thread scratch by this, works before Initialize (single threaded)
+	uint32_t NumThreads() const { return static_cast<uint32_t>(m_workers.size()) + 1; }
+
+private:
+	void WorkerLoop(uint32_t threadIndex);
+	void RunChunks(uint32_t threadIndex);
+
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_wakeCondition;
+	std::condition_variable m_doneCondition;
+	bool m_exit = false;
+
+	// Current job, published under the mutex
+	const ParallelForFunc* m_func = nullptr;
+	uint32_t m_count = 0;
+	uint32_t m_chunkSize = 1;
+	uint32_t m_numChunks = 0;
+	uint64_t m_generation = 0;
+	uint32_t m_numBusyWorkers = 0;
+	std::atomic<uint32_t> m_nextChunk{ 0 };
+};
+
+// Shared by every CPU system, initialized by the application
+extern JobSystem jobSystem;
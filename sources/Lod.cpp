@@ -0,0 +1,182 @@
+#include "Lod.h"
+
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <unordered_map>
+#include <immintrin.h>
+
+using namespace DirectX;
+
+//
+// Generation
+//
+float SimplifyByClustering(const std::vector<MeshVertex>& vertices, const std::vector<uint32_t>& indices, float cellSize, std::vector<uint32_t>& outIndices)
+{
+	outIndices.clear();
+	if (vertices.empty() || cellSize <= 0.f)
+	{
+		outIndices = indices;
+		return 0.f;
+	}
+
+	XMFLOAT3 boundsMin(FLT_MAX, FLT_MAX, FLT_MAX);
+	for (const MeshVertex& vertex : vertices)
+	{
+		boundsMin.x = std::min(boundsMin.x, vertex.Position.x);
+		boundsMin.y = std::min(boundsMin.y, vertex.Position.y);
+		boundsMin.z = std::min(boundsMin.z, vertex.Position.z);
+	}
+
+	// 21 bits per axis, first vertex of a cell represents it
+	const float invCellSize = 1.f / cellSize;
+	std::unordered_map<uint64_t, uint32_t> cells;
+	std::vector<uint32_t> remap(vertices.size());
+	for (uint32_t i = 0; i < vertices.size(); ++i)
+	{
+		const XMFLOAT3& p = vertices[i].Position;
+		const uint64_t x = std::min(static_cast<uint64_t>((p.x - boundsMin.x) * invCellSize), uint64_t(0x1FFFFF));
+		const uint64_t y = std::min(static_cast<uint64_t>((p.y - boundsMin.y) * invCellSize), uint64_t(0x1FFFFF));
+		const uint64_t z = std::min(static_cast<uint64_t>((p.z - boundsMin.z) * invCellSize), uint64_t(0x1FFFFF));
+		remap[i] = cells.emplace((x << 42) | (y << 21) | z, i).first->second;
+	}
+
+	outIndices.reserve(indices.size());
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		const uint32_t a = remap[indices[i]];
+		const uint32_t b = remap[indices[i + 1]];
+		const uint32_t c = remap[indices[i + 2]];
+		if (a != b && b != c && a != c)
+		{
+			outIndices.push_back(a);
+			outIndices.push_back(b);
+			outIndices.push_back(c);
+		}
+	}
+	return cellSize * sqrtf(3.f) * 0.5f;
+}
+
+//
+// Errors
+//
+void LodErrorsSoA::Resize(uint32_t numSlots)
+{
+	count = numSlots;
+
+	const size_t padded = (static_cast<size_t>(numSlots) + 7) & ~size_t(7);
+	errors[0].assign(padded, 0.f);
+	for (uint32_t lod = 1; lod < MaxLods; ++lod)
+	{
+		errors[lod].assign(padded, FLT_MAX);
+	}
+}
+
+void LodErrorsSoA::Set(uint32_t slot, const float* lodErrors, uint32_t numLods)
+{
+	for (uint32_t lod = 0; lod < MaxLods; ++lod)
+	{
+		errors[lod][slot] = (lod == 0) ? 0.f : (lod < numLods) ? lodErrors[lod] : FLT_MAX;
+	}
+}
+
+//
+// Selection
+//
+static float PixelScale(const LodSelectionParams& params)
+{
+	// Pixels per world unit at distance 1
+	return params.screenHeight / (2.f * tanf(params.fovY * 0.5f));
+}
+
+uint32_t SelectLodsScalar(const BoundsSoA& bounds, const LodErrorsSoA& errors, const LodSelectionParams& params, uint8_t* lods)
+{
+	const float pixelScale = PixelScale(params);
+	const float budgetCoarser = params.maxPixelError * (1.f - params.hysteresis);
+	const float budgetKeep = params.maxPixelError * (1.f + params.hysteresis);
+
+	uint32_t numChanged = 0;
+	for (uint32_t i = 0; i < bounds.count; ++i)
+	{
+		// Closest point of the box
+		const float dx = std::max(fabsf(bounds.centerX[i] - params.cameraPosition.x) - bounds.extentX[i], 0.f);
+		const float dy = std::max(fabsf(bounds.centerY[i] - params.cameraPosition.y) - bounds.extentY[i], 0.f);
+		const float dz = std::max(fabsf(bounds.centerZ[i] - params.cameraPosition.z) - bounds.extentZ[i], 0.f);
+		const float distance = std::max(sqrtf(dx * dx + dy * dy + dz * dz), params.nearDistance);
+
+		// Errors grow with the LOD, the accepted LODs are a prefix
+		const uint32_t current = lods[i];
+		uint32_t lod = 0;
+		for (uint32_t l = 1; l < MaxLods; ++l)
+		{
+			const float budget = (l <= current) ? budgetKeep : budgetCoarser;
+			lod += (errors.errors[l][i] * pixelScale <= budget * distance) ? 1 : 0;
+		}
+
+		numChanged += (lod != current) ? 1 : 0;
+		lods[i] = static_cast<uint8_t>(lod);
+	}
+	return numChanged;
+}
+
+TARGET_AVX2 uint32_t SelectLodsAVX2(const BoundsSoA& bounds, const LodErrorsSoA& errors, const LodSelectionParams& params, uint8_t* lods)
+{
+	const __m256 signMask = _mm256_set1_ps(-0.f);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 camX = _mm256_set1_ps(params.cameraPosition.x);
+	const __m256 camY = _mm256_set1_ps(params.cameraPosition.y);
+	const __m256 camZ = _mm256_set1_ps(params.cameraPosition.z);
+	const __m256 nearDistance = _mm256_set1_ps(params.nearDistance);
+	const __m256 pixelScale = _mm256_set1_ps(PixelScale(params));
+	const __m256 budgetCoarser = _mm256_set1_ps(params.maxPixelError * (1.f - params.hysteresis));
+	const __m256 budgetKeep = _mm256_set1_ps(params.maxPixelError * (1.f + params.hysteresis));
+
+	uint32_t numChanged = 0;
+	for (uint32_t i = 0; i < bounds.count; i += 8)
+	{
+		__m256 dx = _mm256_andnot_ps(signMask, _mm256_sub_ps(_mm256_loadu_ps(&bounds.centerX[i]), camX));
+		__m256 dy = _mm256_andnot_ps(signMask, _mm256_sub_ps(_mm256_loadu_ps(&bounds.centerY[i]), camY));
+		__m256 dz = _mm256_andnot_ps(signMask, _mm256_sub_ps(_mm256_loadu_ps(&bounds.centerZ[i]), camZ));
+		dx = _mm256_max_ps(_mm256_sub_ps(dx, _mm256_loadu_ps(&bounds.extentX[i])), zero);
+		dy = _mm256_max_ps(_mm256_sub_ps(dy, _mm256_loadu_ps(&bounds.extentY[i])), zero);
+		dz = _mm256_max_ps(_mm256_sub_ps(dz, _mm256_loadu_ps(&bounds.extentZ[i])), zero);
+		const __m256 distSq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+		const __m256 distance = _mm256_max_ps(_mm256_sqrt_ps(distSq), nearDistance);
+
+		// Accepted LODs count up from 0, compare masks are -1
+		const __m256i current = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(lods + i)));
+		__m256i lod = _mm256_setzero_si256();
+		for (uint32_t l = 1; l < MaxLods; ++l)
+		{
+			const __m256 keep = _mm256_castsi256_ps(_mm256_cmpgt_epi32(current, _mm256_set1_epi32(static_cast<int>(l) - 1)));
+			const __m256 budget = _mm256_blendv_ps(budgetCoarser, budgetKeep, keep);
+			const __m256 error = _mm256_mul_ps(_mm256_loadu_ps(&errors.errors[l][i]), pixelScale);
+			const __m256 accepted = _mm256_cmp_ps(error, _mm256_mul_ps(budget, distance), _CMP_LE_OQ);
+			lod = _mm256_sub_epi32(lod, _mm256_castps_si256(accepted));
+		}
+
+		uint32_t changedMask = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(lod, current)))) ^ 0xFF;
+		if (i + 8 > bounds.count)
+		{
+			changedMask &= (1u << (bounds.count - i)) - 1;
+		}
+		for (uint32_t lane = 0; lane < 8; ++lane)
+		{
+			numChanged += (changedMask >> lane) & 1;
+		}
+
+		// Values fit a byte, pack 32 -> 16 -> 8 bits within each 128 bit lane
+		const __m128i packed16 = _mm_packus_epi32(_mm256_castsi256_si128(lod), _mm256_extracti128_si256(lod, 1));
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(lods + i), _mm_packus_epi16(packed16, packed16));
+	}
+	return numChanged;
+}
+
+uint32_t SelectLods(const BoundsSoA& bounds, const LodErrorsSoA& errors, const LodSelectionParams& params, uint8_t* lods, bool allowSimd)
+{
+	if (allowSimd && CpuSupportsAVX2())
+	{
+		return SelectLodsAVX2(bounds, errors, params, lods);
+	}
+	return SelectLodsScalar(bounds, errors, params, lods);
+}
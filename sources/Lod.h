@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <DirectXMath.h>
+#include "Culling.h"
+#include "../shaders/HLSLCompatible.h"
+
+// Level of detail generation and screen space error selection (no D3D dependency)
+// LODs only carry indices into the vertices of the full mesh, so every LOD of a primitive shares
+// its vertex buffer range. The geometric error of a LOD is a world space distance, projected to
+// pixels at the instance's closest distance to the camera.
+
+static const uint32_t MaxLods = 4;
+
+// Vertex clustering, vertices in the same grid cell collapse to the first one of the cell and
+// triangles that degenerate are dropped. Returns the geometric error, half the cell diagonal.
+float SimplifyByClustering(const std::vector<MeshVertex>& vertices, const std::vector<uint32_t>& indices, float cellSize, std::vector<uint32_t>& outIndices);
+
+// World space error of every LOD per cull slot, padded like BoundsSoA
+// LOD 0 is the full mesh and always 0, missing LODs are FLT_MAX so they are never picked
+struct LodErrorsSoA
+{
+	std::vector<float> errors[MaxLods];
+	uint32_t count = 0;
+
+	void Resize(uint32_t numSlots);
+	void Set(uint32_t slot, const float* lodErrors, uint32_t numLods);
+};
+
+struct LodSelectionParams
+{
+	DirectX::XMFLOAT3 cameraPosition = {};
+	float fovY = DirectX::XM_PI / 3;	// Same as GetProjectionMatrix
+	float screenHeight = 1.f;
+	float maxPixelError = 1.f;
+	float hysteresis = 0.25f;	// Going coarser needs error below budget * (1 - h), staying needs budget * (1 + h)
+	float nearDistance = 0.1f;	// Closest distance, inside the box uses this
+};
+
+// The coarsest LOD whose projected error fits the budget, lods holds the current LOD of every slot
+// (room for the padded count) and receives the new one. Returns how many slots changed LOD.
+uint32_t SelectLodsScalar(const BoundsSoA& bounds, const LodErrorsSoA& errors, const LodSelectionParams& params, uint8_t* lods);
+uint32_t SelectLodsAVX2(const BoundsSoA& bounds, const LodErrorsSoA& errors, const LodSelectionParams& params, uint8_t* lods);
+
+// AVX2 when allowed and supported, scalar otherwise
+uint32_t SelectLods(const BoundsSoA& bounds, const LodErrorsSoA& errors, const LodSelectionParams& params, uint8_t* lods, bool allowSimd = true);
@@ -2,11 +2,13 @@
 
 using namespace DirectX;
 
-// Tinygltf
-#include <tiny_gltf.h>
+#include "GltfScene.h"
 #include "Utility.h"
 #include "DX12.h"
 
+// Largest dimension of the first resident mip, streaming brings in the rest
+static const uint32_t StreamingInitialSize = 64;
+
 enum ModelRootParams
 {
     Model_GlobalSRV,
@@ -36,6 +38,17 @@ void Model::Shutdown()
 
     meshResource.vertexBuffer.Shutdown();
     meshResource.indexBuffer.Shutdown();
+
+    for (TextureResource& texResource : m_model.images)
+    {
+        texResource.texture.Shutdown();
+        texResource.container.Close();
+    }
+    retiredTextures.clear();
+    textureStreamer.Shutdown();
+    m_occlusionCuller.Shutdown();
+    m_indirectCulling.Shutdown();
+    m_virtualTexturing.Shutdown();
 }
 
 //
@@ -73,309 +86,480 @@ D3D12_TEXTURE_ADDRESS_MODE Model::GetD3D12AddressMode(int wrapMode)
 //
 // Helper
 //
-XMMATRIX GetNodeTransform(const tinygltf::Node& node)
+// Mesh nodes in instance order, transforms include the hierarchy
+void ProcessNodes(const tinygltf::Model& model, ModelData& modelData)
+{
+    std::vector<GltfMeshNode> meshNodes;
+    GetGltfMeshNodes(model, meshNodes);
+    for (const GltfMeshNode& meshNode : meshNodes)
+    {
+        NodeData nodeData;
+        nodeData.meshIndex = meshNode.meshIndex;
+        nodeData.transform = XMLoadFloat4x4(&meshNode.transform);
+
+        modelData.numInstances += static_cast<uint32_t>(model.meshes[meshNode.meshIndex].primitives.size());
+        modelData.nodes.push_back(std::move(nodeData));
+    }
+}
+
+// Texel density for streaming, ratio of uv area to object space area over all triangles
+static float ComputeUVDensity(const std::vector<MeshVertex>& vertices, const std::vector<uint32_t>& indices)
+{
+    double uvArea = 0.0;
+    double objectArea = 0.0;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+    {
+        const MeshVertex& v0 = vertices[indices[i]];
+        const MeshVertex& v1 = vertices[indices[i + 1]];
+        const MeshVertex& v2 = vertices[indices[i + 2]];
+
+        XMVECTOR p0 = XMLoadFloat3(&v0.Position);
+        XMVECTOR edge1 = XMVectorSubtract(XMLoadFloat3(&v1.Position), p0);
+        XMVECTOR edge2 = XMVectorSubtract(XMLoadFloat3(&v2.Position), p0);
+        objectArea += 0.5 * XMVectorGetX(XMVector3Length(XMVector3Cross(edge1, edge2)));
+
+        const float du1 = v1.Uv.x - v0.Uv.x, dv1 = v1.Uv.y - v0.Uv.y;
+        const float du2 = v2.Uv.x - v0.Uv.x, dv2 = v2.Uv.y - v0.Uv.y;
+        uvArea += 0.5 * fabs(du1 * dv2 - du2 * dv1);
+    }
+    return (objectArea > 0.0) ? static_cast<float>(sqrt(uvArea / objectArea)) : 0.f;
+}
+
+// Coarser LODs by vertex clustering, the cell doubles until a LOD drops a quarter of the triangles
+static void BuildPrimitiveLods(PrimitiveData& primitive)
 {
-    XMMATRIX transform = XMMatrixIdentity();
+    const XMFLOAT3& extents = primitive.boundingBox.Extents;
+    float cellSize = 2.f * sqrtf(extents.x * extents.x + extents.y * extents.y + extents.z * extents.z) / 64.f;
+
+    size_t previousCount = primitive.indices.size();
+    for (int attempt = 0; attempt < 6 && primitive.NumLods() < MaxLods; ++attempt, cellSize *= 2.f)
+    {
+        PrimitiveLod lod;
+        lod.error = SimplifyByClustering(primitive.vertices, primitive.indices, cellSize, lod.indices);
+        if (lod.indices.empty() || lod.indices.size() * 4 > previousCount * 3)
+            continue;
+
+        previousCount = lod.indices.size();
+        primitive.lods.push_back(std::move(lod));
+    }
+}
 
-    // Matrix
-    if (node.matrix.size() == 16)
+void ProcessMesh(const tinygltf::Model& model, ModelData& modelData)
+{
+    for (auto& mesh : model.meshes)
     {
-        XMFLOAT4X4 mat;
-        for (int i = 0; i < 16; ++i)
+        MeshData meshData;
+        for (const auto& primitive : mesh.primitives)
         {
-            reinterpret_cast<float*>(&mat)[i] = static_cast<float>(node.matrix[i]);
+            // Primitive without positions stays empty, instance numbering is kept
+            GltfPrimitive gltfPrimitive;
+            LoadGltfPrimitive(model, primitive, gltfPrimitive);
+
+            PrimitiveData primitiveData;
+            primitiveData.vertices = std::move(gltfPrimitive.vertices);
+            primitiveData.indices = std::move(gltfPrimitive.indices);
+            primitiveData.boundingBox = gltfPrimitive.boundingBox;
+            primitiveData.hasTangent = gltfPrimitive.hasTangent;
+            primitiveData.hasVertexColor = gltfPrimitive.hasVertexColor;
+
+            primitiveData.uvDensity = ComputeUVDensity(primitiveData.vertices, primitiveData.indices);
+            BuildPrimitiveLods(primitiveData);
+
+            // Get material index
+            modelData.numPrimitives += 1;
+            primitiveData.materialIndex = gltfPrimitive.materialIndex;
+            meshData.primitives.push_back(std::move(primitiveData));
         }
-        transform = XMLoadFloat4x4(&mat);
+        modelData.meshes.push_back(std::move(meshData));
     }
-    else
+}
+
+// Containers embedded in the glTF (glb buffer view or data uri), per image index
+using EmbeddedContainers = std::vector<std::vector<uint8_t>>;
+
+// Image loader callback
+// Pre-compressed containers skip decoding. External ones arrive as their header only (LoadGltfFile),
+// ProcessMaterial maps the file. Embedded ones have no uri, their bytes are kept since the glTF
+// buffers don't outlive the load
+bool LoadImageDataCallback(
+    tinygltf::Image* image,
+    const int imageIndex,
+    std::string* err,
+    std::string* warn,
+    int reqWidth,
+    int reqHeight,
+    const unsigned char* bytes,
+    int size,
+    void* userData)
+{
+    if (IsTextureContainer(bytes, static_cast<size_t>(size)))
     {
-        XMVECTOR translation = XMVectorSet(0.f, 0.f, 0.f, 0.f);
-        XMVECTOR rotation = XMVectorSet(0.f, 0.f, 0.f, 1.f);
-        XMVECTOR scale = XMVectorSet(1.f, 1.f, 1.f, 0.f);
+        if (image->uri.empty() && userData)
+        {
+            EmbeddedContainers& embedded = *static_cast<EmbeddedContainers*>(userData);
+            embedded.resize(std::max(embedded.size(), static_cast<size_t>(imageIndex) + 1));
+            embedded[imageIndex].assign(bytes, bytes + size);
+        }
+        return true;
+    }
+    return tinygltf::LoadImageData(image, imageIndex, err, warn, reqWidth, reqHeight, bytes, size, userData);
+}
 
-        // Translation
-        if (!node.translation.empty())
+// Texture source, prefer the DDS container (MSFT_texture_dds) over the fallback image when it loaded
+// KHR_texture_basisu is BasisLZ / UASTC, there is no transcoder so its fallback image is used
+int GetTextureSource(const tinygltf::Texture& tex, const std::vector<uint8_t>& imageLoaded)
+{
+    auto it = tex.extensions.find("MSFT_texture_dds");
+    if (it != tex.extensions.end() && it->second.Has("source"))
+    {
+        const int source = it->second.Get("source").GetNumberAsInt();
+        const bool loaded = source >= 0 && source < static_cast<int>(imageLoaded.size()) && imageLoaded[source];
+        if (loaded || tex.source < 0)
         {
-            translation = XMVectorSet(
-                static_cast<float>(node.translation[0]),
-                static_cast<float>(node.translation[1]),
-                static_cast<float>(node.translation[2]),
-                0.f);
+            return source;
         }
+    }
+    return tex.source;
+}
+
+void ProcessMaterial(const tinygltf::Model& model, const std::filesystem::path& baseDir, const EmbeddedContainers& embedded, ModelData& modelData)
+{
+    // 1st Load all TextureResource (tinygltf::image)
+    std::vector<uint8_t> imageLoaded(model.images.size(), 1);
+    for (size_t imageIndex = 0; imageIndex < model.images.size(); ++imageIndex)
+    {
+        const tinygltf::Image& image = model.images[imageIndex];
+        TextureResource texResource;
 
-        // Rotation (quaternion: x, y, z, 0
-        if (!node.rotation.empty())
+        // Embedded container (DDS/KTX2) was not decoded, parse the bytes kept by the callback
+        if (image.image.empty() && image.uri.empty() && imageIndex < embedded.size() && !embedded[imageIndex].empty())
+        {
+            HRESULT hr = LoadTextureContainerFromMemory(embedded[imageIndex].data(), embedded[imageIndex].size(), texResource.container);
+            if (SUCCEEDED(hr))
+            {
+                texResource.width = texResource.container.width;
+                texResource.height = texResource.container.height;
+            }
+            else
+            {
+                printf("Warning: failed to load embedded texture container %zu (0x%08X)\n", imageIndex, static_cast<unsigned int>(hr));
+            }
+        }
+        // Container (DDS/KTX2) was not decoded, map it from file
+        else if (image.image.empty() && !image.uri.empty())
+        {
+            std::filesystem::path imagePath = baseDir / std::filesystem::u8path(image.uri);
+            HRESULT hr = LoadTextureContainer(imagePath.wstring(), texResource.container);
+            if (SUCCEEDED(hr))
+            {
+                texResource.width = texResource.container.width;
+                texResource.height = texResource.container.height;
+            }
+            else
+            {
+                printf("Warning: failed to load texture container %s (0x%08X)\n", image.uri.c_str(), static_cast<unsigned int>(hr));
+            }
+        }
+        else
         {
-            rotation = XMVectorSet(
-                static_cast<float>(node.rotation[0]),
-                static_cast<float>(node.rotation[1]),
-                static_cast<float>(node.rotation[2]),
-                static_cast<float>(node.rotation[3]));
+            texResource.pixels = image.image;
+            texResource.width = image.width;
+            texResource.height = image.height;
+            texResource.channels = image.component;
         }
 
-        // Scale
-        if (!node.scale.empty())
+        // Keep index valid with 1x1 white texture
+        if (!texResource.container.IsValid() && texResource.pixels.empty())
         {
-            scale = XMVectorSet(
-                static_cast<float>(node.scale[0]),
-                static_cast<float>(node.scale[1]),
-                static_cast<float>(node.scale[2]),
-                0.f);
+            imageLoaded[imageIndex] = 0;
+            printf("Error: image %zu '%s' has no texel data, white unless a texture has a fallback image\n", imageIndex, image.name.empty() ? image.uri.c_str() : image.name.c_str());
+            texResource.pixels = { 255, 255, 255, 255 };
+            texResource.width = 1;
+            texResource.height = 1;
+            texResource.channels = 4;
         }
 
-        // Compute TRS
-        XMMATRIX tMatrix = XMMatrixTranslationFromVector(translation);
-        XMMATRIX rMatrix = XMMatrixRotationQuaternion(rotation);
-        XMMATRIX sMatrix = XMMatrixScalingFromVector(scale);
-        transform = sMatrix * rMatrix * tMatrix;
+        modelData.images.push_back(std::move(texResource));
+    }
+
+    // Load all Texture Views (tinygltf::textures)
+    for (const tinygltf::Texture& tex : model.textures)
+    {
+        TextureView texView;
+        texView.resourceIndex = GetTextureSource(tex, imageLoaded);
+
+        modelData.textures.push_back(std::move(texView));
     }
 
-    return transform;
+    // Load all Material (point to texture view)
+    for (const tinygltf::Material& mat : model.materials)
+    {
+        MaterialData material;
+        LoadGltfMaterial(mat, material);
+        modelData.materials.push_back(std::move(material));
+    }
 }
 
-void ProcessNode(const tinygltf::Model& model, int nodeIndex, const XMMATRIX& parentTransform, ModelData& modelData)
+// Texel payload of an image, used for content hash and compare
+struct ImagePayload
 {
-    const tinygltf::Node& node = model.nodes[nodeIndex];
-    XMMATRIX nodeTransform = XMMatrixMultiply(GetNodeTransform(node), parentTransform);
-
-    // Interleaved vs non interleaved
-    /* Typical buffer view for box.gltf (one per attribute)*/
-   /*
-   * buffer: 0, byteoffset: 0, bytelength: 96      // Positions -> 8 vert * 3 floats * 4 bytes = 96 bytes
-   * buffer: 0, byteoffset: 96, bytelength: 96     // Normals
-   * buffer: 0, byteoffset: 192, bytelength: 64    // Texcoord
-   */
-
-   /* Typical buffer view for boxinterleaved.gltf (single buffer view, all attribute interleaved)*/
-   /*
-   * buffer: 0, byteoffset: 0, bytelength: 256, bytestride: 32
-   */
-    // Only store transform if nodes has meshes, otherwise just pass through
-    if (node.mesh >= 0)
-    {
-        NodeData nodeData;
-        nodeData.meshIndex = node.mesh;
-        nodeData.transform = nodeTransform;
+    const uint8_t* data = nullptr;
+    uint64_t size = 0;
+};
 
-        modelData.numInstances += model.meshes[node.mesh].primitives.size();
-        modelData.nodes.push_back(std::move(nodeData));
+static void GetImagePayloads(const TextureResource& texResource, std::vector<ImagePayload>& payloads)
+{
+    payloads.clear();
+    if (texResource.container.IsValid())
+    {
+        for (const D3D12_SUBRESOURCE_DATA& mip : texResource.container.mips)
+        {
+            payloads.push_back({ static_cast<const uint8_t*>(mip.pData), static_cast<uint64_t>(mip.SlicePitch) });
+        }
     }
-
-    // Recursive process children
-    for (int childIndex : node.children)
+    else
     {
-        ProcessNode(model, childIndex, nodeTransform, modelData);
+        payloads.push_back({ texResource.pixels.data(), texResource.pixels.size() });
     }
 }
 
-void ProcessMesh(const tinygltf::Model& model, ModelData& modelData)
+static bool IsSameImage(const TextureResource& a, const TextureResource& b)
 {
-    for (auto& mesh : model.meshes)
+    if (a.width != b.width || a.height != b.height || a.channels != b.channels ||
+        a.container.IsValid() != b.container.IsValid() ||
+        a.container.format != b.container.format || a.container.numMips != b.container.numMips)
     {
-        MeshData meshData;
-        for (const auto& primitive : mesh.primitives)
+        return false;
+    }
+
+    std::vector<ImagePayload> payloadA, payloadB;
+    GetImagePayloads(a, payloadA);
+    GetImagePayloads(b, payloadB);
+    for (size_t i = 0; i < payloadA.size(); ++i)
+    {
+        if (payloadA[i].size != payloadB[i].size ||
+            memcmp(payloadA[i].data, payloadB[i].data, payloadA[i].size) != 0)
         {
-            PrimitiveData primitiveData;
-            // Get Position
-            if (primitive.attributes.find("POSITION") != primitive.attributes.end())
-            {
-                const tinygltf::Accessor& posAccessor = model.accessors[primitive.attributes.at("POSITION")];
-                const tinygltf::BufferView& posView = model.bufferViews[posAccessor.bufferView];
-                const tinygltf::Buffer& posBuffer = model.buffers[posView.buffer];
-
-                const unsigned char* bufferData = &posBuffer.data[posView.byteOffset + posAccessor.byteOffset];
-                size_t byteStride = posView.byteStride ? posView.byteStride : sizeof(float) * 3;    // Handle interleaved or non-interleaved
-                primitiveData.vertices.resize(posAccessor.count);
-                for (size_t i = 0; i < posAccessor.count; ++i)
-                {
-                    const float* postData = reinterpret_cast<const float*>(bufferData + i * byteStride);
-                    primitiveData.vertices[i].Position = XMFLOAT3(postData[0], postData[1], postData[2]);
-                }
+            return false;
+        }
+    }
+    return true;
+}
 
-                // AABB
-                XMFLOAT3 min = XMFLOAT3(
-                    static_cast<float>(posAccessor.minValues[0]),
-                    static_cast<float>(posAccessor.minValues[1]),
-                    static_cast<float>(posAccessor.minValues[2]));
+// Only authored parameters, view indices are filled at upload
+static bool IsSameMaterial(const MaterialData& a, const MaterialData& b)
+{
+    return memcmp(&a.baseColorFactor, &b.baseColorFactor, sizeof(XMFLOAT4)) == 0 &&
+        a.metallicFactor == b.metallicFactor &&
+        a.roughnessFactor == b.roughnessFactor &&
+        a.alphaCutoff == b.alphaCutoff &&
+        a.albedoTextureIndex == b.albedoTextureIndex &&
+        a.metallicTextureIndex == b.metallicTextureIndex &&
+        a.normalTextureIndex == b.normalTextureIndex &&
+        memcmp(&a.emissiveFactor, &b.emissiveFactor, sizeof(XMFLOAT3)) == 0 &&
+        a.emissiveTextureIndex == b.emissiveTextureIndex;
+}
 
-                XMFLOAT3 max = XMFLOAT3(
-                    static_cast<float>(posAccessor.maxValues[0]),
-                    static_cast<float>(posAccessor.maxValues[1]),
-                    static_cast<float>(posAccessor.maxValues[2]));
+static uint64_t HashMaterial(const MaterialData& mat)
+{
+    uint64_t hash = HashBytes(&mat.baseColorFactor, sizeof(XMFLOAT4));
+    hash = HashBytes(&mat.metallicFactor, sizeof(float), hash);
+    hash = HashBytes(&mat.roughnessFactor, sizeof(float), hash);
+    hash = HashBytes(&mat.alphaCutoff, sizeof(float), hash);
+    hash = HashBytes(&mat.albedoTextureIndex, sizeof(int), hash);
+    hash = HashBytes(&mat.metallicTextureIndex, sizeof(int), hash);
+    hash = HashBytes(&mat.normalTextureIndex, sizeof(int), hash);
+    hash = HashBytes(&mat.emissiveFactor, sizeof(XMFLOAT3), hash);
+    hash = HashBytes(&mat.emissiveTextureIndex, sizeof(int), hash);
+    return hash;
+}
 
-                BoundingBox::CreateFromPoints(primitiveData.boundingBox, XMLoadFloat3(&min), XMLoadFloat3(&max));
-            }
+static int RemapIndex(const std::vector<int>& remap, int index)
+{
+    return (index >= 0 && index < static_cast<int>(remap.size())) ? remap[index] : index;
+}
 
-            // Get Normal
-            if (primitive.attributes.find("NORMAL") != primitive.attributes.end())
-            {
-                const tinygltf::Accessor& normAccessor = model.accessors[primitive.attributes.at("NORMAL")];
-                const tinygltf::BufferView& normView = model.bufferViews[normAccessor.bufferView];
-                const tinygltf::Buffer& normBuffer = model.buffers[normView.buffer];
+// Collapse images, texture views and materials with identical content
+// Exported glTF often repeats the same texel data under different uris and duplicates materials per mesh
+void DeduplicateResources(ModelData& modelData)
+{
+    const size_t numImages = modelData.images.size();
+    const size_t numTextures = modelData.textures.size();
+    const size_t numMaterials = modelData.materials.size();
+
+    uint64_t savedTexelBytes = 0;
+
+    // Images, hash texel payload (all mips for containers)
+    std::vector<int> imageRemap(numImages);
+    {
+        std::unordered_multimap<uint64_t, int> uniqueImages;
+        std::vector<TextureResource> images;
+        std::vector<ImagePayload> payloads;
+
+        for (size_t i = 0; i < numImages; ++i)
+        {
+            TextureResource& texResource = modelData.images[i];
 
-                const unsigned char* bufferData = &normBuffer.data[normView.byteOffset + normAccessor.byteOffset];
-                size_t byteStride = normView.byteStride ? normView.byteStride : sizeof(float) * 3;
+            GetImagePayloads(texResource, payloads);
+            uint64_t hash = HashBytes(&texResource.container.format, sizeof(DXGI_FORMAT));
+            for (const ImagePayload& payload : payloads)
+            {
+                hash = HashBytes(payload.data, payload.size, hash);
+            }
 
-                assert(normAccessor.count == primitiveData.vertices.size());
-                for (size_t i = 0; i < normAccessor.count; ++i)
+            int found = -1;
+            auto range = uniqueImages.equal_range(hash);
+            for (auto it = range.first; it != range.second; ++it)
+            {
+                if (IsSameImage(images[it->second], texResource))
                 {
-                    const float* normData = reinterpret_cast<const float*>(bufferData + i * byteStride);
-                    primitiveData.vertices[i].Normal = XMFLOAT3(normData[0], normData[1], normData[2]);
+                    found = it->second;
+                    break;
                 }
             }
 
-            // Get texture coordinates
-            if (primitive.attributes.find("TEXCOORD_0") != primitive.attributes.end())
+            if (found >= 0)
             {
-                const tinygltf::Accessor& uvAccessor = model.accessors[primitive.attributes.at("TEXCOORD_0")];
-                const tinygltf::BufferView& uvView = model.bufferViews[uvAccessor.bufferView];
-                const tinygltf::Buffer& uvBuffer = model.buffers[uvView.buffer];
-
-                const unsigned char* bufferData = &uvBuffer.data[uvView.byteOffset + uvAccessor.byteOffset];
-                size_t byteStride = uvView.byteStride ? uvView.byteStride : sizeof(float) * 2;
-
-                assert(uvAccessor.count == primitiveData.vertices.size());
-                for (size_t i = 0; i < uvAccessor.count; ++i)
+                for (const ImagePayload& payload : payloads)
                 {
-                    const float* uvData = reinterpret_cast<const float*>(bufferData + i * byteStride);
-                    primitiveData.vertices[i].Uv = XMFLOAT2(uvData[0], uvData[1]);
+                    savedTexelBytes += payload.size;
                 }
+                texResource.container.Close();
+                imageRemap[i] = found;
             }
-            // Get tangent
-            if (primitive.attributes.find("TANGENT") != primitive.attributes.end())
+            else
             {
-                primitiveData.hasTangent = true;
+                imageRemap[i] = static_cast<int>(images.size());
+                uniqueImages.emplace(hash, imageRemap[i]);
+                images.push_back(std::move(texResource));
+            }
+        }
+        modelData.images = std::move(images);
+    }
 
-                const tinygltf::Accessor& tangentAccessor = model.accessors[primitive.attributes.at("TANGENT")];
-                const tinygltf::BufferView& tangentView = model.bufferViews[tangentAccessor.bufferView];
-                const tinygltf::Buffer& tangentBuffer = model.buffers[tangentView.buffer];
+    // Texture views, identical once they point to the same image
+    std::vector<int> textureRemap(numTextures);
+    {
+        std::unordered_map<int, int> uniqueTextures;
+        std::vector<TextureView> textures;
 
-                const unsigned char* bufferData = &tangentBuffer.data[tangentView.byteOffset + tangentAccessor.byteOffset];
-                size_t byteStride = tangentView.byteStride ? tangentView.byteStride : sizeof(float) * 4;
+        for (size_t i = 0; i < numTextures; ++i)
+        {
+            TextureView texView = modelData.textures[i];
+            texView.resourceIndex = RemapIndex(imageRemap, texView.resourceIndex);
 
-                assert(tangentAccessor.count == primitiveData.vertices.size());
-                for (size_t i = 0; i < tangentAccessor.count; ++i)
-                {
-                    const float* tangentData = reinterpret_cast<const float*>(bufferData + i * byteStride);
-                    primitiveData.vertices[i].Tangent = XMFLOAT4(tangentData[0], tangentData[1], tangentData[2], tangentData[3]);
-                }
+            auto it = uniqueTextures.find(texView.resourceIndex);
+            if (it != uniqueTextures.end())
+            {
+                textureRemap[i] = it->second;
             }
-
-            // Get vertex color
-            if (primitive.attributes.find("COLOR_0") != primitive.attributes.end())
+            else
             {
-                primitiveData.hasVertexColor = true;
+                textureRemap[i] = static_cast<int>(textures.size());
+                uniqueTextures.emplace(texView.resourceIndex, textureRemap[i]);
+                textures.push_back(texView);
+            }
+        }
+        modelData.textures = std::move(textures);
+    }
 
-                const tinygltf::Accessor& colorAccessor = model.accessors[primitive.attributes.at("COLOR_0")];
-                const tinygltf::BufferView& colorView = model.bufferViews[colorAccessor.bufferView];
-                const tinygltf::Buffer& colorBuffer = model.buffers[colorView.buffer];
+    // Materials, compare after texture indices are remapped
+    std::vector<int> materialRemap(numMaterials);
+    {
+        std::unordered_multimap<uint64_t, int> uniqueMaterials;
+        std::vector<MaterialData> materials;
 
-                const unsigned char* bufferData = &colorBuffer.data[colorView.byteOffset + colorAccessor.byteOffset];
-                size_t byteStride = colorView.byteStride ? colorView.byteStride : sizeof(float) * 4;
+        for (size_t i = 0; i < numMaterials; ++i)
+        {
+            MaterialData material = modelData.materials[i];
+            material.albedoTextureIndex = RemapIndex(textureRemap, material.albedoTextureIndex);
+            material.metallicTextureIndex = RemapIndex(textureRemap, material.metallicTextureIndex);
+            material.normalTextureIndex = RemapIndex(textureRemap, material.normalTextureIndex);
+            material.emissiveTextureIndex = RemapIndex(textureRemap, material.emissiveTextureIndex);
 
-                assert(colorAccessor.count == primitiveData.vertices.size());
-                for (size_t i = 0; i < colorAccessor.count; ++i)
-                {
-                    const float* colorData = reinterpret_cast<const float*>(bufferData + i * byteStride);
-                    primitiveData.vertices[i].Color = XMFLOAT4(colorData[0], colorData[1], colorData[2], colorData[3]);
-                }
-            }
+            const uint64_t hash = HashMaterial(material);
 
-            // Get indices
-            if (primitive.indices >= 0)
+            int found = -1;
+            auto range = uniqueMaterials.equal_range(hash);
+            for (auto it = range.first; it != range.second; ++it)
             {
-                const tinygltf::Accessor& indexAccessor = model.accessors[primitive.indices];
-                const tinygltf::BufferView& indexView = model.bufferViews[indexAccessor.bufferView];
-                const tinygltf::Buffer& indexBuffer = model.buffers[indexView.buffer];
-
-                const unsigned char* bufferData = &indexBuffer.data[indexView.byteOffset + indexAccessor.byteOffset];
-                primitiveData.indices.resize(indexAccessor.count);
-
-                if (indexAccessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT)
-                {
-                    const uint16_t* indexData = reinterpret_cast<const uint16_t*>(bufferData);
-                    for (size_t i = 0; i < indexAccessor.count; ++i) {
-                        primitiveData.indices[i] = static_cast<uint32_t>(indexData[i]);
-                    }
-                }
-                else if (indexAccessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT)
+                if (IsSameMaterial(materials[it->second], material))
                 {
-                    const uint32_t* indexData = reinterpret_cast<const uint32_t*>(bufferData);
-                    for (size_t i = 0; i < indexAccessor.count; ++i) {
-                        primitiveData.indices[i] = indexData[i];
-                    }
+                    found = it->second;
+                    break;
                 }
             }
 
-            // Get material index
-            modelData.numPrimitives += 1;
-            primitiveData.materialIndex = primitive.material;
-            meshData.primitives.push_back(std::move(primitiveData));
+            if (found >= 0)
+            {
+                materialRemap[i] = found;
+            }
+            else
+            {
+                materialRemap[i] = static_cast<int>(materials.size());
+                uniqueMaterials.emplace(hash, materialRemap[i]);
+                materials.push_back(material);
+            }
         }
-        modelData.meshes.push_back(std::move(meshData));
+        modelData.materials = std::move(materials);
     }
-}
 
-void ProcessMaterial(const tinygltf::Model& model, ModelData& modelData)
-{
-    // 1st Load all TextureResource (tinygltf::image)
-    for (const tinygltf::Image& image : model.images)
+    for (MeshData& mesh : modelData.meshes)
     {
-        TextureResource texResource;
-
-        texResource.pixels = image.image;
-        texResource.width = image.width;
-        texResource.height = image.height;
-        texResource.channels = image.component;
-
-        modelData.images.push_back(std::move(texResource));
+        for (PrimitiveData& primitive : mesh.primitives)
+        {
+            primitive.materialIndex = RemapIndex(materialRemap, primitive.materialIndex);
+        }
     }
 
-    // Load all Texture Views (tinygltf::textures)
-    for (const tinygltf::Texture& tex : model.textures)
+    // Report, one SRV descriptor per image
+    const size_t removedImages = numImages - modelData.images.size();
+    const size_t removedMaterials = numMaterials - modelData.materials.size();
+    if (removedImages > 0 || removedMaterials > 0 || numTextures != modelData.textures.size())
     {
-        TextureView texView;
-        texView.resourceIndex = tex.source;
-
-        modelData.textures.push_back(std::move(texView));
+        printf("Dedup: images %zu -> %zu, texture views %zu -> %zu, materials %zu -> %zu\n",
+            numImages, modelData.images.size(),
+            numTextures, modelData.textures.size(),
+            numMaterials, modelData.materials.size());
+        printf("Dedup: saved %.2f MB texel data, %zu SRV descriptors, %zu bytes material buffer\n",
+            static_cast<double>(savedTexelBytes) / (1024.0 * 1024.0),
+            removedImages,
+            removedMaterials * sizeof(MaterialData));
     }
+}
 
-    // Load all Material (point to texture view)
-    for (const tinygltf::Material& mat : model.materials)
+// Full mip chain per image, containers already store theirs
+// Decoded images get a box filtered chain so streaming can drop top mips
+void BuildMipChains(ModelData& modelData)
+{
+    for (TextureResource& texResource : modelData.images)
     {
-        const auto& pbr = mat.pbrMetallicRoughness;
-
-        MaterialData material;
-        if (!pbr.baseColorFactor.empty())
+        if (texResource.container.IsValid())
         {
-            material.baseColorFactor = XMFLOAT4(
-                static_cast<float>(pbr.baseColorFactor[0]),
-                static_cast<float>(pbr.baseColorFactor[1]),
-                static_cast<float>(pbr.baseColorFactor[2]),
-                static_cast<float>(pbr.baseColorFactor[3]));
+            texResource.format = texResource.container.format;
+            texResource.mips = texResource.container.mips;
+        }
+        else
+        {
+            // Level 0 first, replaces decoded pixels
+            std::vector<uint8_t> chain;
+            GenerateMipChainRGBA8(
+                texResource.pixels.data(),
+                static_cast<uint32_t>(texResource.width),
+                static_cast<uint32_t>(texResource.height),
+                chain,
+                texResource.mips);
+            texResource.format = DXGI_FORMAT_R8G8B8A8_UNORM;
+            texResource.pixels = std::move(chain);
         }
-        material.metallicFactor = static_cast<float>(pbr.metallicFactor);
-        material.roughnessFactor = static_cast<float>(pbr.roughnessFactor);
-        material.alphaCutoff = (mat.alphaMode.compare("OPAQUE") == 0) ? 1.f : mat.alphaCutoff;
-        material.albedoTextureIndex = pbr.baseColorTexture.index;
-        material.metallicTextureIndex = pbr.metallicRoughnessTexture.index;
-        material.normalTextureIndex = mat.normalTexture.index;
-
-        modelData.materials.push_back(std::move(material));
     }
 }
 
 HRESULT Model::LoadFromFile(const std::string& filePath)
 {
     tinygltf::Model model;
-    tinygltf::TinyGLTF loader;
-    std::string err, warn;
-
-    // Load .glb file (binary glTF)
-    bool ret = loader.LoadASCIIFromFile(&model, &err, &warn, filePath);
-    if (!warn.empty()) { printf("Warning: %s\n", warn.c_str()); }
-    if (!err.empty()) { printf("Error: %s\n", err.c_str()); }
-    if (!ret) { return E_FAIL; }
+    EmbeddedContainers embedded;
+    if (!LoadGltfFile(filePath, LoadImageDataCallback, &embedded, model)) { return E_FAIL; }
 
     // Clear data
     m_model.numPrimitives = 0;
@@ -384,22 +568,19 @@ HRESULT Model::LoadFromFile(const std::string& filePath)
     m_model.meshes.clear();
     //m_model.textures.clear();
 
-    // start with scene root nodes
-    const auto& scene = model.scenes[model.defaultScene >= 0 ? model.defaultScene : 0];
-    XMMATRIX identity = XMMatrixIdentity();
-    for (int nodeIndex : scene.nodes)
-    {
-        ProcessNode(model, nodeIndex, identity, m_model);
-    }
-
+    ProcessNodes(model, m_model);
     ProcessMesh(model, m_model);
-    ProcessMaterial(model, m_model);
+    ProcessMaterial(model, std::filesystem::u8path(filePath).parent_path(), embedded, m_model);
+    DeduplicateResources(m_model);
+    BuildMipChains(m_model);
 
 	return S_OK;
 }
 
 void Model::LoadShader(const std::filesystem::path& shaderPath )
 {
+    m_shaderPath = shaderPath;
+
     // Load shaders
     std::filesystem::path mainShader = shaderPath / "basic_color.hlsl";
     std::filesystem::path depthShader = shaderPath / "basic.hlsl";
@@ -509,7 +690,7 @@ void Model::LoadShader(const std::filesystem::path& shaderPath )
  
     // Root Signature (depth pre-pass + gbuffer)
     {
-        D3D12_ROOT_PARAMETER1 rootParameters[5] = {};
+        D3D12_ROOT_PARAMETER1 rootParameters[7] = {};
 
         // Bindless texture
         rootParameters[0].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
@@ -544,6 +725,25 @@ void Model::LoadShader(const std::filesystem::path& shaderPath )
         rootParameters[4].Descriptor.ShaderRegister = 1;
         rootParameters[4].Descriptor.Flags = D3D12_ROOT_DESCRIPTOR_FLAG_DATA_STATIC;
 
+        // Virtual texture info (t2) + feedback (u0), G-buffer only
+        rootParameters[5].ParameterType = D3D12_ROOT_PARAMETER_TYPE_SRV;
+        rootParameters[5].ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
+        rootParameters[5].Descriptor.RegisterSpace = 0;
+        rootParameters[5].Descriptor.ShaderRegister = 2;
+        rootParameters[5].Descriptor.Flags = D3D12_ROOT_DESCRIPTOR_FLAG_DATA_STATIC;
+
+        D3D12_DESCRIPTOR_RANGE1 feedbackRange[1] = {};
+        feedbackRange[0].RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_UAV;
+        feedbackRange[0].NumDescriptors = 1;
+        feedbackRange[0].BaseShaderRegister = 0;
+        feedbackRange[0].RegisterSpace = 0;
+        feedbackRange[0].Flags = D3D12_DESCRIPTOR_RANGE_FLAG_DESCRIPTORS_VOLATILE;
+        feedbackRange[0].OffsetInDescriptorsFromTableStart = 0;
+        rootParameters[6].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
+        rootParameters[6].ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
+        rootParameters[6].DescriptorTable.pDescriptorRanges = feedbackRange;
+        rootParameters[6].DescriptorTable.NumDescriptorRanges = _countof(feedbackRange);
+
         // Static sampler
         D3D12_STATIC_SAMPLER_DESC staticSampler[1] = {};
         staticSampler[0] = GetStaticSamplerState(SamplerState::Linear, 0, 0);
@@ -656,6 +856,11 @@ HRESULT Model::UploadGpuResources()
         {
             numVertices += primitive.vertices.size();
             numIndices += primitive.indices.size();
+            for (const PrimitiveLod& lod : primitive.lods)
+            {
+                numIndices += lod.indices.size();
+            }
+            m_numLodPrimitives += (primitive.NumLods() > 1) ? 1 : 0;
         }
     }
 
@@ -682,6 +887,14 @@ HRESULT Model::UploadGpuResources()
             // Advance it
             vtxOffset += primitive.vertices.size();
             idxOffset += primitive.indices.size();
+
+            // LODs index the same vertices, base vertex is shared
+            for (PrimitiveLod& lod : primitive.lods)
+            {
+                memcpy(meshResource.indices.data() + idxOffset, lod.indices.data(), lod.indices.size() * sizeof(uint32_t));
+                lod.indexOffset = idxOffset;
+                idxOffset += lod.indices.size();
+            }
         }
     }
 
@@ -703,15 +916,41 @@ HRESULT Model::UploadGpuResources()
     // Create texture
     if (!m_model.images.empty())
     {
-        // Texture resources
+        TextureStreamingInit tsi;
+        textureStreamer.Initialize(tsi);
+
+        // Texture resources, start at low mip and let streaming bring in detail
+        std::vector<uint64_t> mipBytes;
         for (TextureResource& texResource : m_model.images)
         {
-            TextureInit ti;
-            ti.width = texResource.width;
-            ti.height = texResource.height;
-            ti.initData = texResource.pixels.data();
-            
-            texResource.texture.Initialize(ti);
+            const uint32_t numMips = static_cast<uint32_t>(texResource.mips.size());
+            const bool blockCompressed = IsBlockCompressed(texResource.format);
+
+            StreamingTextureDesc desc;
+            desc.numMips = numMips;
+            desc.tailMip = 0;
+            desc.initialMip = 0;
+
+            mipBytes.resize(numMips);
+            for (uint32_t mip = 0; mip < numMips; ++mip)
+            {
+                const uint32_t mipWidth = std::max(static_cast<uint32_t>(texResource.width) >> mip, 1u);
+                const uint32_t mipHeight = std::max(static_cast<uint32_t>(texResource.height) >> mip, 1u);
+                mipBytes[mip] = static_cast<uint64_t>(texResource.mips[mip].SlicePitch);
+
+                // BC top level must be whole 4x4 blocks
+                if (blockCompressed && (mipWidth % 4 != 0 || mipHeight % 4 != 0))
+                    break;
+
+                desc.tailMip = mip;
+                if (std::max(mipWidth, mipHeight) > StreamingInitialSize)
+                    desc.initialMip = mip + 1;
+            }
+            desc.initialMip = std::min(desc.initialMip, desc.tailMip);
+            desc.mipBytes = mipBytes.data();
+
+            texResource.streamingIndex = textureStreamer.AddTexture(desc);
+            CreateTexture(texResource, textureStreamer.ResidentMip(texResource.streamingIndex));
         }
 
         // Texture views (load from Materials)
@@ -722,28 +961,15 @@ HRESULT Model::UploadGpuResources()
         }
     }
 
+    // Flatten node x primitive, cached world bounds for culling
+    BuildInstances();
+
     // Create mesh structured buffer
     std::vector<MeshStructuredBuffer> meshes;
     {
-        for (const NodeData& node : m_model.nodes)
+        for (uint32_t i = 0; i < m_instances.size(); ++i)
         {
-            const MeshData& mesh = m_model.meshes[node.meshIndex];
-            for (const PrimitiveData& primitive : mesh.primitives)
-            {
-                MeshStructuredBuffer meshSB;
-                DirectX::BoundingBox boundingBox;
-
-                // Transform bounding box to world space
-                BoundingBox worldBox;
-                primitive.boundingBox.Transform(worldBox, node.transform);
-
-                meshSB.meshTransform = node.transform;
-                meshSB.centerBound = worldBox.Center;
-                meshSB.extentsBound = worldBox.Extents;
-                meshSB.useVertexColor = primitive.hasVertexColor ? 1 : 0;
-                meshSB.useTangent = primitive.hasTangent ? 1 : 0;
-                meshes.push_back(std::move(meshSB));
-            }
+            meshes.push_back(GetMeshEntry(i));
         }
 
         StructuredBufferInit sbi;
@@ -757,12 +983,34 @@ HRESULT Model::UploadGpuResources()
 
     // Create material structured buffer
     {
+        VirtualTexturingInit vti;
+        vti.maxTextures = static_cast<uint32_t>(m_model.images.size());
+        m_virtualTexturing.Initialize(vti);
+        std::vector<int> imageVirtualTextures(m_model.images.size(), -1);
+
         // Repeated information on material
         for (MaterialData& mat : m_model.materials)
         {
             mat.albedoViewTextureIndex = (mat.albedoTextureIndex >= 0) ? m_model.textures[mat.albedoTextureIndex].viewIndex : -1;
             mat.metallicViewTextureIndex = (mat.metallicTextureIndex >= 0) ? m_model.textures[mat.metallicTextureIndex].viewIndex : -1;
             mat.normalViewTextureIndex = (mat.normalTextureIndex >= 0) ? m_model.textures[mat.normalTextureIndex].viewIndex : -1;            
+
+            // Albedo pages come from the CPU mip chain
+            mat.albedoVirtualTexture = -1;
+            if (mat.albedoTextureIndex >= 0)
+            {
+                const int imageIndex = m_model.textures[mat.albedoTextureIndex].resourceIndex;
+                const TextureResource& texResource = m_model.images[imageIndex];
+                if (imageVirtualTextures[imageIndex] < 0 && VirtualTexturing::CanVirtualize(
+                    texResource.width, texResource.height, static_cast<uint32_t>(texResource.mips.size()), texResource.format))
+                {
+                    VirtualTextureSource source;
+                    source.size = texResource.width;
+                    source.mips = texResource.mips.data();
+                    imageVirtualTextures[imageIndex] = m_virtualTexturing.AddTexture(source);
+                }
+                mat.albedoVirtualTexture = imageVirtualTextures[imageIndex];
+            }
         }
 
         StructuredBufferInit sbi;
@@ -774,6 +1022,16 @@ HRESULT Model::UploadGpuResources()
         materialSB.Initialize(sbi);
     }
 
+    // Indirect draws set ModelConstants (root parameter 2) per argument
+    {
+        IndirectCullingInit ici;
+        ici.maxRecords = m_model.numInstances;
+        ici.drawRootSignature = mainRootSignature.Get();
+        ici.drawConstantsParameter = 2;
+        ici.shaderPath = m_shaderPath;
+        m_indirectCulling.Initialize(ici);
+    }
+
     // Create sampler (create dummy if it's empty)
     if (m_model.samplers.empty())
     {
@@ -813,40 +1071,47 @@ void Model::BuildAccelerationStructure()
 
     D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildFlags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
 
-    std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> geometryDescs(numPrimitives);
-    uint32_t primitiveIdx = 0;
-    for (const MeshData& mesh : m_model.meshes)
+    // One blas per LOD of every primitive
+    std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> geometryDescs;
+    std::vector<RawBuffer*> blasBuffers;
+    geometryDescs.reserve(numPrimitives);
+    blasBuffers.reserve(numPrimitives);
+    for (MeshData& mesh : m_model.meshes)
     {
-        for (const PrimitiveData& primitive : mesh.primitives)
+        for (PrimitiveData& primitive : mesh.primitives)
         {
             const MaterialData& material = m_model.materials[primitive.materialIndex];
             const bool nonOpaque = (material.alphaCutoff < 1.f) ? true : false;
 
-            D3D12_RAYTRACING_GEOMETRY_DESC& geomDesc = geometryDescs[primitiveIdx];
-            geomDesc = {};
-            geomDesc.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
-            geomDesc.Triangles.IndexBuffer = meshResource.indexBuffer.internalBuffer.gpuAddress + primitive.indexOffset * meshResource.indexBuffer.Stride;
-            geomDesc.Triangles.IndexCount = primitive.indices.size();
-            geomDesc.Triangles.IndexFormat = meshResource.indexBuffer.format;
-            geomDesc.Triangles.Transform3x4 = 0;
-            geomDesc.Triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
-            geomDesc.Triangles.VertexCount = primitive.vertices.size();
-            geomDesc.Triangles.VertexBuffer.StartAddress = meshResource.vertexBuffer.internalBuffer.gpuAddress + primitive.vertexOffset * meshResource.vertexBuffer.Stride;
-            geomDesc.Triangles.VertexBuffer.StrideInBytes = meshResource.vertexBuffer.Stride;
-            geomDesc.Flags = nonOpaque ? D3D12_RAYTRACING_GEOMETRY_FLAG_NONE : D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE;
-            
-            D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS input = {};
-            input.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
-            input.Flags = buildFlags;
-            input.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
-            input.pGeometryDescs = &geomDesc;
-            input.NumDescs = 1;
-
-            D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO prebuildInfo = {};
-            d3dDevice->GetRaytracingAccelerationStructurePrebuildInfo(&input, &prebuildInfo);
-            assert(prebuildInfo.ResultDataMaxSizeInBytes > 0);
-            ResultDataMaxSizeInBytes = std::max(ResultDataMaxSizeInBytes, prebuildInfo.ResultDataMaxSizeInBytes);
-            primitiveIdx++;
+            for (uint32_t lod = 0; lod < primitive.NumLods(); ++lod)
+            {
+                D3D12_RAYTRACING_GEOMETRY_DESC geomDesc = {};
+                geomDesc.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
+                geomDesc.Triangles.IndexBuffer = meshResource.indexBuffer.internalBuffer.gpuAddress + primitive.LodIndexOffset(lod) * meshResource.indexBuffer.Stride;
+                geomDesc.Triangles.IndexCount = primitive.LodIndexCount(lod);
+                geomDesc.Triangles.IndexFormat = meshResource.indexBuffer.format;
+                geomDesc.Triangles.Transform3x4 = 0;
+                geomDesc.Triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
+                geomDesc.Triangles.VertexCount = primitive.vertices.size();
+                geomDesc.Triangles.VertexBuffer.StartAddress = meshResource.vertexBuffer.internalBuffer.gpuAddress + primitive.vertexOffset * meshResource.vertexBuffer.Stride;
+                geomDesc.Triangles.VertexBuffer.StrideInBytes = meshResource.vertexBuffer.Stride;
+                geomDesc.Flags = nonOpaque ? D3D12_RAYTRACING_GEOMETRY_FLAG_NONE : D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE;
+
+                D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS input = {};
+                input.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+                input.Flags = buildFlags;
+                input.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+                input.pGeometryDescs = &geomDesc;
+                input.NumDescs = 1;
+
+                D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO prebuildInfo = {};
+                d3dDevice->GetRaytracingAccelerationStructurePrebuildInfo(&input, &prebuildInfo);
+                assert(prebuildInfo.ResultDataMaxSizeInBytes > 0);
+                ResultDataMaxSizeInBytes = std::max(ResultDataMaxSizeInBytes, prebuildInfo.ResultDataMaxSizeInBytes);
+
+                geometryDescs.push_back(geomDesc);
+                blasBuffers.push_back(&primitive.LodBlas(lod));
+            }
         }
     }
 
@@ -861,43 +1126,39 @@ void Model::BuildAccelerationStructure()
     }
 
     // Build blas
-    primitiveIdx = 0;
-    for (MeshData& mesh : m_model.meshes)
+    for (size_t i = 0; i < geometryDescs.size(); ++i)
     {
-        for (PrimitiveData& primitive : mesh.primitives)
-        {
-            D3D12_RAYTRACING_GEOMETRY_DESC& geomDesc = geometryDescs[primitiveIdx];
-
-            D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS input = {};
-            input.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
-            input.Flags = buildFlags;
-            input.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
-            input.pGeometryDescs = &geomDesc;
-            input.NumDescs = 1;
-
-            D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO prebuildInfo = {};
-            d3dDevice->GetRaytracingAccelerationStructurePrebuildInfo(&input, &prebuildInfo);
-            assert(prebuildInfo.ResultDataMaxSizeInBytes > 0);
-
-            RawBufferInit rbi;
-            rbi.numElements = prebuildInfo.ResultDataMaxSizeInBytes / RawBuffer::Stride;
-            rbi.allowUAV = true;
-            rbi.initState = D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE;
-            rbi.name = L"RT Bot Level Acceleration Structure";
-            primitive.blasBuffer.Initialize(rbi);
-
-            D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC blasDesc = {};
-            blasDesc.Inputs = input;
-            blasDesc.ScratchAccelerationStructureData = meshResource.blasScratchBuffer.internalBuffer.gpuAddress;
-            blasDesc.DestAccelerationStructureData = primitive.blasBuffer.internalBuffer.gpuAddress;
-
-            commandList->BuildRaytracingAccelerationStructure(&blasDesc, 0, nullptr);
-            primitive.blasBuffer.internalBuffer.UAVBarrier(commandList.Get());
-            primitiveIdx++;
-        }
+        D3D12_RAYTRACING_GEOMETRY_DESC& geomDesc = geometryDescs[i];
+        RawBuffer& blasBuffer = *blasBuffers[i];
+
+        D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS input = {};
+        input.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+        input.Flags = buildFlags;
+        input.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+        input.pGeometryDescs = &geomDesc;
+        input.NumDescs = 1;
+
+        D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO prebuildInfo = {};
+        d3dDevice->GetRaytracingAccelerationStructurePrebuildInfo(&input, &prebuildInfo);
+        assert(prebuildInfo.ResultDataMaxSizeInBytes > 0);
+
+        RawBufferInit rbi;
+        rbi.numElements = prebuildInfo.ResultDataMaxSizeInBytes / RawBuffer::Stride;
+        rbi.allowUAV = true;
+        rbi.initState = D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE;
+        rbi.name = L"RT Bot Level Acceleration Structure";
+        blasBuffer.Initialize(rbi);
+
+        D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC blasDesc = {};
+        blasDesc.Inputs = input;
+        blasDesc.ScratchAccelerationStructureData = meshResource.blasScratchBuffer.internalBuffer.gpuAddress;
+        blasDesc.DestAccelerationStructureData = blasBuffer.internalBuffer.gpuAddress;
+
+        commandList->BuildRaytracingAccelerationStructure(&blasDesc, 0, nullptr);
+        blasBuffer.internalBuffer.UAVBarrier(commandList.Get());
     }
 
-    // Build tlas instancing
+    // Build tlas instancing, at the currently selected LOD
     std::vector<D3D12_RAYTRACING_INSTANCE_DESC> instanceDescs(numInstances);
     uint32_t instanceIndex = 0;
     for (const NodeData& node : m_model.nodes)
@@ -909,7 +1170,7 @@ void Model::BuildAccelerationStructure()
             instanceDesc = {};
             instanceDesc.InstanceID = instanceIndex;
             instanceDesc.InstanceMask = 0xFF;
-            instanceDesc.AccelerationStructure = primitive.blasBuffer.internalBuffer.gpuAddress;
+            instanceDesc.AccelerationStructure = primitive.LodBlas(m_instanceLods[m_instanceToSlot[instanceIndex]]).internalBuffer.gpuAddress;
             XMStoreFloat3x4(reinterpret_cast<XMFLOAT3X4*>(instanceDesc.Transform), node.transform);
             instanceIndex++;
         }
@@ -950,15 +1211,34 @@ void Model::BuildAccelerationStructure()
         rbi.name = L"RT Top Level Acceleration Structure";
         meshResource.tlasBuffer.Initialize(rbi);
     }
-    
-    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC buildDesc = {};
-    buildDesc.Inputs = input;
-    buildDesc.ScratchAccelerationStructureData = meshResource.tlasScratchBuffer.internalBuffer.gpuAddress;
-    buildDesc.DestAccelerationStructureData = meshResource.tlasBuffer.internalBuffer.gpuAddress;
-    commandList->BuildRaytracingAccelerationStructure(&buildDesc, 0, nullptr);
-    meshResource.tlasBuffer.internalBuffer.UAVBarrier(commandList.Get());
 
-    // Build instance info buffer
+    // Shadow tlas, any caster subset fits the full prebuild sizes
+    {
+        RawBufferInit rbi;
+        rbi.numElements = (instanceDescs.size() * sizeof(D3D12_RAYTRACING_INSTANCE_DESC)) / RawBuffer::Stride;
+        rbi.cpuAccessible = true;
+        rbi.initData = instanceDescs.data();
+        rbi.name = L"RT Shadow InstanceDesc";
+        meshResource.shadowInstanceBuffer.Initialize(rbi);
+
+        rbi = {};
+        rbi.numElements = prebuildInfo.ScratchDataSizeInBytes / RawBuffer::Stride;
+        rbi.allowUAV = true;
+        rbi.initState = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
+        rbi.name = L"RT Shadow Tlas ScratchBuffer";
+        meshResource.shadowTlasScratchBuffer.Initialize(rbi);
+
+        rbi = {};
+        rbi.numElements = prebuildInfo.ResultDataMaxSizeInBytes / RawBuffer::Stride;
+        rbi.allowUAV = true;
+        rbi.initState = D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE;
+        rbi.name = L"RT Shadow Top Level Acceleration Structure";
+        meshResource.shadowTlasBuffer.Initialize(rbi);
+    }
+
+    RecordTopLevelBuild();
+
+    // Build instance info buffer, rewritten with the instance descs when LODs change
     std::vector<InstanceInfo> instanceInfo(numInstances);
     instanceIndex = 0;
     for (const NodeData& node : m_model.nodes)
@@ -969,7 +1249,7 @@ void Model::BuildAccelerationStructure()
             InstanceInfo& instInfo = instanceInfo[instanceIndex];
             instInfo = {};
             instInfo.VtxOffset = primitive.vertexOffset;
-            instInfo.IdxOffsetByBytes = primitive.indexOffset * sizeof(uint32_t);
+            instInfo.IdxOffsetByBytes = primitive.LodIndexOffset(m_instanceLods[m_instanceToSlot[instanceIndex]]) * sizeof(uint32_t);
             instInfo.MaterialIdx = primitive.materialIndex;
             instInfo.UseTangent = primitive.hasTangent ? 1 : 0;
             instInfo.UseVertexColor = primitive.hasVertexColor ? 1 : 0;
@@ -978,63 +1258,1037 @@ void Model::BuildAccelerationStructure()
     }
 
     StructuredBufferInit sbi;
+    sbi.cpuAccessible = true;
     sbi.stride = sizeof(InstanceInfo);
     sbi.numElements = instanceInfo.size();
     sbi.initData = instanceInfo.data();
     sbi.name = L"Instance info buffer";
     meshResource.instanceInfoBuffer.Initialize(sbi);
+
+    m_raytracingLods = true;
 }
 
-void Model::RenderModel(const BoundingFrustum& frustum, bool AlphaFilter)
+void Model::BuildTriangleBVHs()
 {
-    UINT constantIndex = 0;
-    for (const NodeData& node : m_model.nodes)
+    // Triangle count weighted SAH cost, comparable across scenes
+    m_triangleBVHStats = {};
+    double weightedCost = 0.0;
+    uint64_t numTriangles = 0;
+    for (MeshData& mesh : m_model.meshes)
     {
-        const MeshData& mesh = m_model.meshes[node.meshIndex];
-        for (const PrimitiveData& primitive : mesh.primitives)
+        for (PrimitiveData& primitive : mesh.primitives)
         {
-            const MaterialData& material = m_model.materials[primitive.materialIndex];
-            const bool nonOpaque = (material.alphaCutoff < 1.f) ? true : false;
-
-            if (AlphaFilter)
+            TriangleMesh triangles;
+            triangles.positions = meshResource.vertices.data() + primitive.vertexOffset;    // Position is the first member
+            triangles.positionStride = sizeof(MeshVertex);
+            triangles.indices = meshResource.indices.data() + primitive.indexOffset;
+            triangles.numTriangles = static_cast<uint32_t>(primitive.indices.size() / 3);
+            primitive.bvh.BuildSAH(jobSystem, triangles);
+
+            const TriangleBVHStats& stats = primitive.bvh.Stats();
+            m_triangleBVHStats.numNodes += stats.numNodes;
+            m_triangleBVHStats.numLeaves += stats.numLeaves;
+            m_triangleBVHStats.maxDepth = std::max(m_triangleBVHStats.maxDepth, stats.maxDepth);
+            m_triangleBVHStats.buildMs += stats.buildMs;
+            weightedCost += static_cast<double>(stats.sahCost) * triangles.numTriangles;
+            numTriangles += triangles.numTriangles;
+        }
+    }
+    m_triangleBVHStats.sahCost = (numTriangles > 0) ? static_cast<float>(weightedCost / numTriangles) : 0.f;
+
+    printf("Triangle BVH: %llu triangles, %u nodes, depth %u, SAH cost %.2f, %.1f ms\n",
+        static_cast<unsigned long long>(numTriangles), m_triangleBVHStats.numNodes, m_triangleBVHStats.maxDepth,
+        m_triangleBVHStats.sahCost, m_triangleBVHStats.buildMs);
+
+    // Same order and IDs as the tlas instance descs, CPU BLAS are always LOD 0
+    std::vector<BVHInstance> instances(m_instances.size());
+    for (uint32_t i = 0; i < m_instances.size(); ++i)
+    {
+        XMStoreFloat3x4(&instances[i].transform, m_model.nodes[m_instances[i].nodeIndex].transform);
+        instances[i].instanceID = i;
+        instances[i].blas = &GetInstancePrimitive(i).bvh;
+    }
+    m_topLevelBVH.Build(instances);
+
+    const TopLevelBVHStats& tlasStats = m_topLevelBVH.Stats();
+    printf("Top level BVH: %u instances, %u nodes, depth %u, SAH cost %.2f, %.2f ms\n",
+        tlasStats.numInstances, tlasStats.numNodes, tlasStats.maxDepth, tlasStats.sahCost, tlasStats.buildMs);
+}
+
+// Instance descs are read from the upload heap, the scratch and result buffers fit any rebuild of the same instances
+void Model::RecordTopLevelBuild()
+{
+    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC buildDesc = {};
+    buildDesc.Inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
+    buildDesc.Inputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
+    buildDesc.Inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+    buildDesc.Inputs.NumDescs = m_model.numInstances;
+    buildDesc.Inputs.InstanceDescs = meshResource.instanceBuffer.internalBuffer.gpuAddress;
+    buildDesc.ScratchAccelerationStructureData = meshResource.tlasScratchBuffer.internalBuffer.gpuAddress;
+    buildDesc.DestAccelerationStructureData = meshResource.tlasBuffer.internalBuffer.gpuAddress;
+    commandList->BuildRaytracingAccelerationStructure(&buildDesc, 0, nullptr);
+    meshResource.tlasBuffer.internalBuffer.UAVBarrier(commandList.Get());
+}
+
+// Ray traced passes see the LOD the raster passes draw
+void Model::UpdateRaytracingLods()
+{
+    assert(gpuIdle);
+    D3D12_RAYTRACING_INSTANCE_DESC* instanceDescs = reinterpret_cast<D3D12_RAYTRACING_INSTANCE_DESC*>(meshResource.instanceBuffer.internalBuffer.cpuAddress);
+    InstanceInfo* instanceInfo = reinterpret_cast<InstanceInfo*>(meshResource.instanceInfoBuffer.internalBuffer.cpuAddress);
+    for (uint32_t i = 0; i < m_instances.size(); ++i)
+    {
+        const PrimitiveData& primitive = GetInstancePrimitive(i);
+        const uint32_t lod = m_instanceLods[m_instanceToSlot[i]];
+        instanceDescs[i].AccelerationStructure = primitive.LodBlas(lod).internalBuffer.gpuAddress;
+        instanceInfo[i].IdxOffsetByBytes = static_cast<UINT>(primitive.LodIndexOffset(lod) * sizeof(uint32_t));
+    }
+
+    RecordTopLevelBuild();
+}
+
+void Model::RecordShadowTopLevelBuild(uint32_t numCasters)
+{
+    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC buildDesc = {};
+    buildDesc.Inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
+    buildDesc.Inputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_BUILD;
+    buildDesc.Inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+    buildDesc.Inputs.NumDescs = numCasters;
+    buildDesc.Inputs.InstanceDescs = meshResource.shadowInstanceBuffer.internalBuffer.gpuAddress;
+    buildDesc.ScratchAccelerationStructureData = meshResource.shadowTlasScratchBuffer.internalBuffer.gpuAddress;
+    buildDesc.DestAccelerationStructureData = meshResource.shadowTlasBuffer.internalBuffer.gpuAddress;
+    commandList->BuildRaytracingAccelerationStructure(&buildDesc, 0, nullptr);
+    meshResource.shadowTlasBuffer.internalBuffer.UAVBarrier(commandList.Get());
+}
+
+// Rebuilt every frame, the caster set follows the camera and the light
+// Copied descs keep InstanceID, the shadow shader indexes instance info with it
+void Model::CullShadowCasters(const BoundingFrustum& frustum, const XMFLOAT3& lightDirection)
+{
+    m_cullingStats.shadowCasters = m_useShadowCasterCulling && m_raytracingLods;
+    m_cullingStats.shadowCastersReused = false;
+    if (!m_cullingStats.shadowCasters)
+    {
+        m_shadowCasters.clear();
+        m_shadowCastersValid = false;
+        m_cullingStats.numShadowCasters = m_model.numInstances;
+        m_cullingStats.shadowCullMs = 0.0;
+        return;
+    }
+
+    // Instance descs and bounds are those of the current shadow TLAS
+    if (m_shadowCastersValid && m_viewUnchanged && memcmp(&lightDirection, &m_shadowLightDirection, sizeof(XMFLOAT3)) == 0)
+    {
+        m_cullingStats.shadowCastersReused = true;
+        m_cullingStats.shadowCullMs = 0.0;
+        return;
+    }
+    m_shadowLightDirection = lightDirection;
+    m_shadowCastersValid = true;
+
+    auto start = TimerClock::now();
+
+    FrustumPlanes planes;
+    GetFrustumPlanes(frustum, planes);
+    ShadowCasterVolume volume;
+    BuildShadowCasterVolume(planes, ComputeSceneBounds(m_worldBounds), lightDirection, volume);
+
+    m_shadowCasterSlots.resize(m_worldBounds.count);
+    const uint32_t numCasters = ::CullShadowCasters(m_worldBounds, volume, m_shadowCasterSlots.data());
+    m_shadowCasters.resize(numCasters);
+    for (uint32_t i = 0; i < numCasters; ++i)
+    {
+        m_shadowCasters[i] = m_slotToInstance[m_shadowCasterSlots[i]];
+    }
+    std::sort(m_shadowCasters.begin(), m_shadowCasters.end());
+
+    assert(gpuIdle);
+    const D3D12_RAYTRACING_INSTANCE_DESC* instanceDescs = reinterpret_cast<const D3D12_RAYTRACING_INSTANCE_DESC*>(meshResource.instanceBuffer.internalBuffer.cpuAddress);
+    D3D12_RAYTRACING_INSTANCE_DESC* casterDescs = reinterpret_cast<D3D12_RAYTRACING_INSTANCE_DESC*>(meshResource.shadowInstanceBuffer.internalBuffer.cpuAddress);
+    for (uint32_t i = 0; i < numCasters; ++i)
+    {
+        casterDescs[i] = instanceDescs[m_shadowCasters[i]];
+    }
+
+    RecordShadowTopLevelBuild(numCasters);
+
+    m_cullingStats.numShadowCasters = numCasters;
+    m_cullingStats.shadowCullMs = ElapsedMs(start);
+}
+
+// Pre-compressed mips go straight from mapped file into upload memory
+// Recreating a streamed texture keeps its SRV slot, material view indices stay valid
+void Model::CreateTexture(TextureResource& texResource, uint32_t topMip)
+{
+    assert(topMip < texResource.mips.size());
+
+    TextureInit ti;
+    ti.width = std::max(static_cast<uint32_t>(texResource.width) >> topMip, 1u);
+    ti.height = std::max(static_cast<uint32_t>(texResource.height) >> topMip, 1u);
+    ti.numMips = static_cast<uint32_t>(texResource.mips.size()) - topMip;
+    ti.format = texResource.format;
+    ti.mipData = &texResource.mips[topMip];
+
+    // Streaming change, levels the old resource holds are copied on the GPU and only new ones uploaded,
+    // so the upload is the bytes TextureStreamer charged. Retired resources live until the next frame
+    Texture& texture = texResource.texture;
+    ti.SRV = texture.SRV;
+    if (texture.resource)
+    {
+        const uint32_t previousTopMip = static_cast<uint32_t>(texResource.mips.size()) - texture.numMips;
+        ti.copySource = texture.resource.Get();
+        ti.numUploadMips = (previousTopMip > topMip) ? previousTopMip - topMip : 0;
+        ti.copySourceMip = topMip + ti.numUploadMips - previousTopMip;
+
+        retiredTextures.push_back(std::move(texture.resource));
+        retiredTextures.push_back(std::move(texture.upload));
+    }
+
+    texture.Initialize(ti);
+}
+
+void Model::UpdateTextureStreaming(
+    FXMVECTOR cameraPosition,
+    float fovY,
+    float screenHeight)
+{
+    assert(gpuIdle);
+    retiredTextures.clear();
+
+    if (textureStreamer.NumTextures() == 0)
+    {
+        return;
+    }
+
+    // Screen pixels per world unit at distance 1
+    const float pixelScale = screenHeight / (2.f * tanf(fovY * 0.5f));
+
+    // Indirect draws only know the visible instances of the last GPU culled frame
+    const bool indirect = m_cullingStats.indirect;
+    const std::vector<uint32_t>& drawIds = m_indirectCulling.VisibleDrawIds();
+    const size_t numVisible = indirect ? drawIds.size() : m_renderList.packets.size();
+
+    textureStreamer.BeginFrame();
+    for (size_t i = 0; i < numVisible; ++i)
+    {
+        const uint32_t instanceIndex = indirect ? drawIds[i] : m_renderList.packets[i].instanceIndex;
+        const NodeData& node = m_model.nodes[m_instances[instanceIndex].nodeIndex];
+        const PrimitiveData& primitive = GetInstancePrimitive(instanceIndex);
+
+        // Largest axis scale, uv density is in object space
+        const float nodeScale = sqrtf(std::max({
+            XMVectorGetX(XMVector3LengthSq(node.transform.r[0])),
+            XMVectorGetX(XMVector3LengthSq(node.transform.r[1])),
+            XMVectorGetX(XMVector3LengthSq(node.transform.r[2])) }));
+
+        if (primitive.materialIndex < 0 || primitive.uvDensity <= 0.f || nodeScale <= 0.f)
+            continue;
+
+        const BoundingBox worldBox = m_worldBounds.Get(m_instanceToSlot[instanceIndex]);
+
+        // Closest point on box, inside box use near distance
+        XMVECTOR center = XMLoadFloat3(&worldBox.Center);
+        XMVECTOR extents = XMLoadFloat3(&worldBox.Extents);
+        XMVECTOR closest = XMVectorClamp(cameraPosition, XMVectorSubtract(center, extents), XMVectorAdd(center, extents));
+        const float distance = std::max(XMVectorGetX(XMVector3Length(XMVectorSubtract(closest, cameraPosition))), 0.1f);
+
+        // Texels per pixel for a 1 texel texture, log2 of it times texture size is the mip
+        const float texelsPerPixel = primitive.uvDensity * distance / (nodeScale * pixelScale);
+
+        const MaterialData& material = m_model.materials[primitive.materialIndex];
+        const int textureIndices[] = { material.albedoTextureIndex, material.metallicTextureIndex, material.normalTextureIndex };
+        for (int textureIndex : textureIndices)
+        {
+            if (textureIndex < 0)
+                continue;
+
+            const int resourceIndex = m_model.textures[textureIndex].resourceIndex;
+            if (resourceIndex < 0)
+                continue;
+
+            const TextureResource& texResource = m_model.images[resourceIndex];
+            const float texSize = static_cast<float>(std::max(texResource.width, texResource.height));
+            textureStreamer.RequestMip(texResource.streamingIndex, log2f(std::max(texSize * texelsPerPixel, 1e-6f)));
+        }
+    }
+
+    textureStreamer.Update(streamingChanges);
+    for (const StreamingChange& change : streamingChanges)
+    {
+        // Registered in image order
+        TextureResource& texResource = m_model.images[change.textureIndex];
+        assert(texResource.streamingIndex == change.textureIndex);
+        CreateTexture(texResource, change.toMip);
+    }
+}
+
+void Model::UpdateVirtualTextures()
+{
+    // Same condition as RenderGBuffer, which ends the feedback
+    if (m_model.nodes.empty())
+    {
+        return;
+    }
+    m_virtualTexturing.Update();
+}
+
+//
+// Instances and culling
+//
+const PrimitiveData& Model::GetInstancePrimitive(uint32_t instanceIndex) const
+{
+    const DrawInstance& instance = m_instances[instanceIndex];
+    return m_model.meshes[instance.meshIndex].primitives[instance.primitiveIndex];
+}
+
+MeshStructuredBuffer Model::GetMeshEntry(uint32_t instanceIndex) const
+{
+    const NodeData& node = m_model.nodes[m_instances[instanceIndex].nodeIndex];
+    const PrimitiveData& primitive = GetInstancePrimitive(instanceIndex);
+    const BoundingBox worldBox = m_worldBounds.Get(m_instanceToSlot[instanceIndex]);
+
+    MeshStructuredBuffer entry;
+    entry.meshTransform = node.transform;
+    entry.centerBound = worldBox.Center;
+    entry.extentsBound = worldBox.Extents;
+    entry.useVertexColor = primitive.hasVertexColor ? 1 : 0;
+    entry.useTangent = primitive.hasTangent ? 1 : 0;
+    return entry;
+}
+
+void Model::BuildInstances()
+{
+    m_instances.clear();
+    m_nodeFirstInstance.clear();
+    for (uint32_t nodeIndex = 0; nodeIndex < m_model.nodes.size(); ++nodeIndex)
+    {
+        const NodeData& node = m_model.nodes[nodeIndex];
+        const MeshData& mesh = m_model.meshes[node.meshIndex];
+
+        m_nodeFirstInstance.push_back(static_cast<uint32_t>(m_instances.size()));
+        for (uint32_t primitiveIndex = 0; primitiveIndex < mesh.primitives.size(); ++primitiveIndex)
+        {
+            const PrimitiveData& primitive = mesh.primitives[primitiveIndex];
+
+            DrawInstance instance;
+            instance.nodeIndex = nodeIndex;
+            instance.meshIndex = static_cast<uint32_t>(node.meshIndex);
+            instance.primitiveIndex = primitiveIndex;
+            instance.alphaTest = primitive.materialIndex >= 0 && m_model.materials[primitive.materialIndex].alphaCutoff < 1.f;
+            m_instances.push_back(instance);
+        }
+    }
+    m_nodeFirstInstance.push_back(static_cast<uint32_t>(m_instances.size()));
+
+    // Opaque slots first, culling output splits into both lists without another pass
+    const uint32_t numInstances = static_cast<uint32_t>(m_instances.size());
+    m_slotToInstance.clear();
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        for (uint32_t i = 0; i < numInstances; ++i)
+        {
+            if (m_instances[i].alphaTest == (pass == 1))
+                m_slotToInstance.push_back(i);
+        }
+    }
+    m_instanceToSlot.resize(numInstances);
+    for (uint32_t slot = 0; slot < numInstances; ++slot)
+    {
+        m_instanceToSlot[m_slotToInstance[slot]] = slot;
+    }
+    m_numOpaqueInstances = 0;
+    for (const DrawInstance& instance : m_instances)
+    {
+        m_numOpaqueInstances += instance.alphaTest ? 0 : 1;
+    }
+
+    m_worldBounds.Resize(numInstances);
+    m_lodErrors.Resize(numInstances);
+    m_instanceLods.assign(m_worldBounds.centerX.size(), 0);
+    for (uint32_t i = 0; i < numInstances; ++i)
+    {
+        UpdateWorldBounds(i);
+    }
+    m_instanceBVH.Build(m_worldBounds);
+    m_occlusionCuller.Initialize(OcclusionCullingInit());
+
+    m_visibleSlots.resize(m_worldBounds.centerX.size());
+    m_numVisibleSlots = 0;
+    m_renderList = RenderList();
+    m_dirtyInstances.clear();
+    m_drawRecordsDirty = true;
+    m_movedSlotFlags.assign(numInstances, 0);
+    m_dynamicSlotFlags.assign(numInstances, 0);
+    m_pvsCandidates.clear();
+    m_pvsCell = PvsNoSet;
+    m_visibilityCacheValid = false;
+    m_shadowCastersValid = false;
+
+    // Everything is drawn in the first phase until tested
+    m_hiZVisibleBits.assign((numInstances + 31) / 32, ~0u);
+}
+
+void Model::UpdateWorldBounds(uint32_t instanceIndex)
+{
+    const NodeData& node = m_model.nodes[m_instances[instanceIndex].nodeIndex];
+
+    const PrimitiveData& primitive = GetInstancePrimitive(instanceIndex);
+    const uint32_t slot = m_instanceToSlot[instanceIndex];
+
+    BoundingBox worldBox;
+    primitive.boundingBox.Transform(worldBox, node.transform);
+    m_worldBounds.Set(slot, worldBox);
+
+    // Largest axis scale, LOD errors are in object space
+    const float nodeScale = sqrtf(std::max({
+        XMVectorGetX(XMVector3LengthSq(node.transform.r[0])),
+        XMVectorGetX(XMVector3LengthSq(node.transform.r[1])),
+        XMVectorGetX(XMVector3LengthSq(node.transform.r[2])) }));
+
+    float lodErrors[MaxLods] = {};
+    for (uint32_t lod = 1; lod < primitive.NumLods(); ++lod)
+    {
+        lodErrors[lod] = primitive.lods[lod - 1].error * nodeScale;
+    }
+    m_lodErrors.Set(slot, lodErrors, primitive.NumLods());
+}
+
+void Model::SetNodeTransform(uint32_t nodeIndex, FXMMATRIX transform)
+{
+    assert(nodeIndex < m_model.nodes.size());
+    m_model.nodes[nodeIndex].transform = transform;
+
+    XMFLOAT3X4 transform3x4;
+    XMStoreFloat3x4(&transform3x4, transform);
+    for (uint32_t i = m_nodeFirstInstance[nodeIndex]; i < m_nodeFirstInstance[nodeIndex + 1]; ++i)
+    {
+        UpdateWorldBounds(i);
+        m_dirtyInstances.push_back(i);
+        if (!m_topLevelBVH.IsEmpty())
+        {
+            m_topLevelBVH.SetTransform(i, transform3x4);
+        }
+
+        // Baked sets only hold it where it was, it's a candidate from every cell now
+        const uint32_t slot = m_instanceToSlot[i];
+        if (!m_dynamicSlotFlags[slot])
+        {
+            m_dynamicSlotFlags[slot] = 1;
+            m_pvsCell = PvsNoSet;
+        }
+    }
+}
+
+bool Model::LoadPvs(const std::string& filePath)
+{
+    m_pvsCandidates.clear();
+    m_pvsCell = PvsNoSet;
+    m_visibilityCacheValid = false;
+    if (!m_pvs.Load(filePath, m_model.numInstances))
+    {
+        return false;
+    }
+
+    printf("PVS: %u cells, %u sets\n", m_pvs.NumCells(), m_pvs.NumSets());
+    return true;
+}
+
+// Copy changed entries through the retained upload buffer of mesh structured buffer
+void Model::FlushInstanceUpdates()
+{
+    if (m_dirtyInstances.empty())
+    {
+        return;
+    }
+
+    std::sort(m_dirtyInstances.begin(), m_dirtyInstances.end());
+    m_dirtyInstances.erase(std::unique(m_dirtyInstances.begin(), m_dirtyInstances.end()), m_dirtyInstances.end());
+
+    ID3D12Resource* upload = meshSB.internalBuffer.upload.Get();
+    ID3D12Resource* resource = meshSB.internalBuffer.resource.Get();
+
+    assert(gpuIdle);
+    uint8_t* mapped = nullptr;
+    CheckHRESULT(upload->Map(0, nullptr, reinterpret_cast<void**>(&mapped)));
+
+    D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(
+        resource,
+        D3D12_RESOURCE_STATE_GENERIC_READ,
+        D3D12_RESOURCE_STATE_COPY_DEST);
+    commandList->ResourceBarrier(1, &barrier);
+
+    for (uint32_t instanceIndex : m_dirtyInstances)
+    {
+        const uint64_t offset = uint64_t(instanceIndex) * sizeof(MeshStructuredBuffer);
+        const MeshStructuredBuffer entry = GetMeshEntry(instanceIndex);
+        memcpy(mapped + offset, &entry, sizeof(MeshStructuredBuffer));
+        commandList->CopyBufferRegion(resource, offset, upload, offset, sizeof(MeshStructuredBuffer));
+    }
+    upload->Unmap(0, nullptr);
+
+    barrier = CD3DX12_RESOURCE_BARRIER::Transition(
+        resource,
+        D3D12_RESOURCE_STATE_COPY_DEST,
+        D3D12_RESOURCE_STATE_GENERIC_READ);
+    commandList->ResourceBarrier(1, &barrier);
+
+    // Topology is kept, moved instances only stretch their ancestors
+    m_instanceBVH.Refit(m_worldBounds);
+
+    m_dirtyInstances.clear();
+    m_drawRecordsDirty = true;
+}
+
+// Instances smaller than this (bounds radius / distance) are not worth rasterizing as occluders
+static const float OccluderMinSize = 0.1f;
+
+// Visible slots are frustum culled, opaque first
+uint32_t Model::CullOccluded(uint32_t numVisible, const XMFLOAT3& cameraPosition, FXMMATRIX viewProj)
+{
+    m_occlusionCuller.BeginFrame(viewProj);
+
+    // Largest on screen first, alpha tested never occludes
+    m_occluderCandidates.clear();
+    for (uint32_t i = 0; i < numVisible; ++i)
+    {
+        const uint32_t slot = m_visibleSlots[i];
+        if (slot >= m_numOpaqueInstances)
+            continue;
+
+        const XMFLOAT3 offset(
+            m_worldBounds.centerX[slot] - cameraPosition.x,
+            m_worldBounds.centerY[slot] - cameraPosition.y,
+            m_worldBounds.centerZ[slot] - cameraPosition.z);
+        const float distanceSq = std::max(offset.x * offset.x + offset.y * offset.y + offset.z * offset.z, 1e-4f);
+        const float radiusSq =
+            m_worldBounds.extentX[slot] * m_worldBounds.extentX[slot] +
+            m_worldBounds.extentY[slot] * m_worldBounds.extentY[slot] +
+            m_worldBounds.extentZ[slot] * m_worldBounds.extentZ[slot];
+        if (radiusSq < distanceSq * OccluderMinSize * OccluderMinSize)
+            continue;
+
+        m_occluderCandidates.push_back({ radiusSq / distanceSq, slot });
+    }
+    std::sort(m_occluderCandidates.begin(), m_occluderCandidates.end(), [](const auto& a, const auto& b)
+    {
+        return a.first > b.first;
+    });
+
+    // Skip over budget primitives, smaller ones may still fit
+    for (const auto& candidate : m_occluderCandidates)
+    {
+        const uint32_t instanceIndex = m_slotToInstance[candidate.second];
+        const PrimitiveData& primitive = GetInstancePrimitive(instanceIndex);
+        if (primitive.vertices.empty())
+            continue;
+
+        m_occlusionCuller.AddOccluder(
+            &primitive.vertices[0].Position,
+            sizeof(MeshVertex),
+            primitive.indices.data(),
+            static_cast<uint32_t>(primitive.indices.size()),
+            m_model.nodes[m_instances[instanceIndex].nodeIndex].transform);
+        if (m_occlusionCuller.RemainingTriangleBudget() == 0)
+            break;
+    }
+
+    m_occlusionCuller.RasterizeOccluders(jobSystem);
+    return m_occlusionCuller.CullBounds(jobSystem, m_worldBounds, m_visibleSlots.data(), numVisible, m_visibleSlots.data());
+}
+
+// Culling flags of the key, the cull result changes with any of them
+enum VisibilityCacheFlags : uint32_t
+{
+    VisibilityCacheFlag_Occlusion = 1 << 0,
+    VisibilityCacheFlag_HiZ = 1 << 1,
+    VisibilityCacheFlag_Contribution = 1 << 2,
+    VisibilityCacheFlag_Lod = 1 << 3,
+    VisibilityCacheFlag_Sorting = 1 << 4,
+    VisibilityCacheFlag_Pvs = 1 << 5,
+};
+
+VisibilityCacheKey Model::MakeVisibilityCacheKey(const BoundingFrustum& frustum, FXMMATRIX viewProj, float fovY) const
+{
+    VisibilityCacheKey key = {};
+    XMStoreFloat4x4(&key.viewProj, viewProj);
+    key.cameraPosition = frustum.Origin;
+    key.fovY = fovY;
+    key.screenWidth = m_screenWidth;
+    key.screenHeight = m_screenHeight;
+    key.flags =
+        (m_useOcclusionCulling ? VisibilityCacheFlag_Occlusion : 0) |
+        ((m_useHiZCulling && m_hiZPredicates != nullptr) ? VisibilityCacheFlag_HiZ : 0) |
+        (m_useContributionCulling ? VisibilityCacheFlag_Contribution : 0) |
+        (m_useLodSelection ? VisibilityCacheFlag_Lod : 0) |
+        (m_useDrawSorting ? VisibilityCacheFlag_Sorting : 0) |
+        ((m_usePvs && !m_pvs.IsEmpty()) ? VisibilityCacheFlag_Pvs : 0);
+    key.minDepthPassPixels = m_minDepthPassPixels;
+    key.minGBufferPixels = m_minGBufferPixels;
+    key.lodPixelError = m_lodParams.maxPixelError;
+    key.lodHysteresis = m_lodParams.hysteresis;
+    return key;
+}
+
+void Model::Cull(const BoundingFrustum& frustum, FXMMATRIX viewProj, float fovY)
+{
+    // Moved since the last cull, the flush clears the dirty list
+    m_movedSlots.clear();
+    for (uint32_t instanceIndex : m_dirtyInstances)
+    {
+        const uint32_t slot = m_instanceToSlot[instanceIndex];
+        if (!m_movedSlotFlags[slot])
+        {
+            m_movedSlotFlags[slot] = 1;
+            m_movedSlots.push_back(slot);
+        }
+    }
+    FlushInstanceUpdates();
+    m_topLevelBVH.Refit();
+
+    // Previous LOD selection must have settled, with the same inputs it selects nothing new
+    const VisibilityCacheKey cacheKey = MakeVisibilityCacheKey(frustum, viewProj, fovY);
+    const bool sameView = m_useVisibilityCache && m_visibilityCacheValid && !m_useIndirectDraws && cacheKey == m_visibilityCacheKey;
+    const bool hiZBitsChanged = m_hiZBitsChanged;
+    m_hiZBitsChanged = false;
+    if (sameView && m_movedSlots.empty() && !hiZBitsChanged && m_cullingStats.numLodChanges == 0)
+    {
+        m_viewUnchanged = true;
+        m_cullingStats.visibilityCache = VisibilityCacheState::Reused;
+        m_cullingStats.numCacheRetested = 0;
+        m_cullingStats.numCacheReusedFrames++;
+        m_cullingStats.cullMs = 0.0;
+        m_cullingStats.lodMs = 0.0;
+        m_cullingStats.occlusionMs = 0.0;
+        m_drawStats.buildMs = m_drawStats.extractMs = 0.0;
+        return;
+    }
+    m_visibilityCacheKey = cacheKey;
+    m_visibilityCacheValid = !m_useIndirectDraws;
+
+    // Every instance, ray tracing sees the ones outside the frustum too
+    auto lodStart = TimerClock::now();
+    uint32_t numLodChanges = 0;
+    if (m_useLodSelection && m_screenHeight > 0)
+    {
+        m_lodParams.cameraPosition = frustum.Origin;
+        m_lodParams.fovY = fovY;
+        m_lodParams.screenHeight = static_cast<float>(m_screenHeight);
+        numLodChanges = SelectLods(m_worldBounds, m_lodErrors, m_lodParams, m_instanceLods.data(), m_useSimdCulling);
+    }
+    else if (std::any_of(m_instanceLods.begin(), m_instanceLods.end(), [](uint8_t lod) { return lod != 0; }))
+    {
+        std::fill(m_instanceLods.begin(), m_instanceLods.end(), 0);
+        numLodChanges = m_model.numInstances;
+    }
+
+    if (numLodChanges > 0 && m_raytracingLods)
+    {
+        UpdateRaytracingLods();
+    }
+    m_drawRecordsDirty |= (numLodChanges > 0);
+
+    m_cullingStats.numLodChanges = numLodChanges;
+    m_cullingStats.lodMs = ElapsedMs(lodStart);
+    m_viewUnchanged = sameView && m_movedSlots.empty() && numLodChanges == 0;
+
+    auto start = TimerClock::now();
+
+    FrustumPlanes planes;
+    GetFrustumPlanes(frustum, planes);
+
+    if (m_useIndirectDraws)
+    {
+        for (uint32_t slot : m_movedSlots)
+        {
+            m_movedSlotFlags[slot] = 0;
+        }
+        m_cullingStats.visibilityCache = VisibilityCacheState::Culled;
+        m_cullingStats.numCacheReusedFrames = 0;
+        CullIndirect(planes);
+        return;
+    }
+
+    // Occluders may have moved, then everything behind them needs a new test
+    const bool patch = sameView && (m_movedSlots.empty() || !m_useOcclusionCulling);
+    bool useBVH = m_useBVHCulling && !m_instanceBVH.IsEmpty();
+    bool usePvs = false;
+    uint32_t numVisible = 0;
+    double occlusionMs = 0.0;
+    if (patch)
+    {
+        numVisible = UpdateVisibleIndices(m_worldBounds, planes,
+            m_movedSlots.data(), static_cast<uint32_t>(m_movedSlots.size()), m_movedSlotFlags.data(),
+            m_visibleSlots.data(), m_numVisibleSlots);
+    }
+    else
+    {
+        uint32_t numFrustumVisible = 0;
+        usePvs = m_usePvs && CullPvsCandidates(frustum.Origin, planes, numFrustumVisible);
+        useBVH = useBVH && !usePvs;
+        if (!usePvs)
+        {
+            numFrustumVisible = useBVH ?
+                m_instanceBVH.CullFrustum(m_worldBounds, planes, m_visibleSlots.data()) :
+                m_renderListBuilder.CullFrustum(jobSystem, m_worldBounds, planes, m_visibleSlots.data(), m_useSimdCulling);
+        }
+
+        numVisible = numFrustumVisible;
+        if (m_useOcclusionCulling)
+        {
+            auto occlusionStart = TimerClock::now();
+            numVisible = CullOccluded(numFrustumVisible, frustum.Origin, viewProj);
+            occlusionMs = ElapsedMs(occlusionStart);
+        }
+        m_cullingStats.numOccluded = numFrustumVisible - numVisible;
+    }
+    m_numVisibleSlots = numVisible;
+    for (uint32_t slot : m_movedSlots)
+    {
+        m_movedSlotFlags[slot] = 0;
+    }
+
+    const double cullMs = ElapsedMs(start);
+
+    // HiZ needs a target, the predicates are only valid after HiZCulling::BuildAndCull
+    const bool useHiZ = m_useHiZCulling && m_hiZPredicates != nullptr;
+    if (!useHiZ)
+    {
+        std::fill(m_hiZVisibleBits.begin(), m_hiZVisibleBits.end(), ~0u);
+    }
+
+    BuildRenderList(numVisible, frustum.Origin, viewProj);
+
+    m_cullingStats.numInstances = static_cast<uint32_t>(m_instances.size());
+    m_cullingStats.numVisibleOpaque = static_cast<uint32_t>(m_renderList.packets.size()) - m_renderList.numAlpha;
+    m_cullingStats.numVisibleAlpha = m_renderList.numAlpha;
+    m_cullingStats.cullMs = cullMs;
+    m_cullingStats.simd = !patch && !useBVH && !usePvs && m_useSimdCulling && CpuSupportsAVX2();
+    m_cullingStats.bvh = !patch && useBVH;
+    m_cullingStats.bvhNodes = m_instanceBVH.NumNodes();
+    m_cullingStats.bvhNodesVisited = m_cullingStats.bvh ? m_instanceBVH.Stats().nodesVisited : 0;
+    m_cullingStats.occlusion = m_useOcclusionCulling;
+    m_cullingStats.occlusionMs = occlusionMs;
+    m_cullingStats.hiZ = useHiZ;
+    m_cullingStats.numHiZTests = static_cast<uint32_t>(m_renderList.hiZTests.size());
+    m_cullingStats.numHiZUntestable = static_cast<uint32_t>(m_renderList.hiZUntestable.size());
+    m_cullingStats.numHiZSecondPhase = static_cast<uint32_t>(m_renderList.packets.size()) - m_renderList.secondPhaseBegin;
+    m_cullingStats.contribution = m_useContributionCulling;
+    m_cullingStats.numContributionCulled = m_renderList.numContributionCulled;
+    m_cullingStats.numDepthPassCulled = m_renderList.numDepthPassCulled;
+    m_cullingStats.indirect = false;
+    m_cullingStats.visibilityCache = patch ? VisibilityCacheState::Patched : VisibilityCacheState::Culled;
+    m_cullingStats.numCacheRetested = patch ? static_cast<uint32_t>(m_movedSlots.size()) : 0;
+    m_cullingStats.numCacheReusedFrames = 0;
+    m_cullingStats.pvs = usePvs;
+    m_cullingStats.numPvsCandidates = usePvs ? static_cast<uint32_t>(m_pvsCandidates.size()) : 0;
+}
+
+// Cell sets are over instances, candidates are cull slots so the output splits like CullFrustum's
+bool Model::CullPvsCandidates(const XMFLOAT3& cameraPosition, const FrustumPlanes& planes, uint32_t& outNumVisible)
+{
+    const uint32_t cell = m_pvs.FindCell(cameraPosition);
+    const uint32_t* set = (cell != PvsNoSet) ? m_pvs.CellSet(cell) : nullptr;
+    if (set == nullptr)
+    {
+        return false;
+    }
+
+    if (cell != m_pvsCell)
+    {
+        const uint32_t numInstances = static_cast<uint32_t>(m_instances.size());
+        m_pvsCandidates.clear();
+        for (uint32_t slot = 0; slot < numInstances; ++slot)
+        {
+            const uint32_t instanceIndex = m_slotToInstance[slot];
+            if (m_dynamicSlotFlags[slot] || (set[instanceIndex / 32] >> (instanceIndex % 32)) & 1)
+                m_pvsCandidates.push_back(slot);
+        }
+        m_pvsCell = cell;
+    }
+
+    outNumVisible = CullFrustumList(m_worldBounds, planes, m_pvsCandidates.data(), static_cast<uint32_t>(m_pvsCandidates.size()), m_visibleSlots.data());
+    return true;
+}
+
+void Model::CullIndirect(const FrustumPlanes& planes)
+{
+    auto start = TimerClock::now();
+
+    // Last frame completed, its GPU counts and draw ids are the visible instances
+    m_indirectCulling.ResolveResults();
+
+    // Cull slot order, bucket DrawPSO_Opaque then DrawPSO_AlphaTest
+    if (m_drawRecordsDirty)
+    {
+        const uint32_t numInstances = static_cast<uint32_t>(m_instances.size());
+        m_drawRecords.resize(numInstances);
+        for (uint32_t slot = 0; slot < numInstances; ++slot)
+        {
+            const uint32_t instanceIndex = m_slotToInstance[slot];
+            const PrimitiveData& primitive = GetInstancePrimitive(instanceIndex);
+            const uint32_t lod = m_instanceLods[slot];
+
+            DrawRecord& record = m_drawRecords[slot];
+            record.centerBound = XMFLOAT3(m_worldBounds.centerX[slot], m_worldBounds.centerY[slot], m_worldBounds.centerZ[slot]);
+            record.extentsBound = XMFLOAT3(m_worldBounds.extentX[slot], m_worldBounds.extentY[slot], m_worldBounds.extentZ[slot]);
+            record.indexCount = primitive.LodIndexCount(lod);
+            record.startIndex = static_cast<uint32_t>(primitive.LodIndexOffset(lod));
+            record.baseVertex = static_cast<int>(primitive.vertexOffset);
+            record.materialIndex = static_cast<uint32_t>(primitive.materialIndex);
+            record.instanceIndex = instanceIndex;
+            record.pad = 0;
+        }
+
+        const uint32_t bucketBegin[] = { 0, m_numOpaqueInstances, numInstances };
+        m_indirectCulling.SetRecords(m_drawRecords, bucketBegin, 2);
+        m_drawRecordsDirty = false;
+    }
+
+    m_indirectCulling.Cull(planes, m_useGpuIndirect);
+
+    const double cullMs = ElapsedMs(start);
+
+    // Nothing is HiZ tested, everything starts in the first phase when going back to the render list
+    std::fill(m_hiZVisibleBits.begin(), m_hiZVisibleBits.end(), ~0u);
+    m_renderList = RenderList();
+
+    const IndirectCullingStats& indirectStats = m_indirectCulling.Stats();
+    m_cullingStats.numInstances = static_cast<uint32_t>(m_instances.size());
+    m_cullingStats.numVisibleOpaque = indirectStats.numDraws[DrawPSO_Opaque];
+    m_cullingStats.numVisibleAlpha = indirectStats.numDraws[DrawPSO_AlphaTest];
+    m_cullingStats.cullMs = cullMs;
+    m_cullingStats.simd = false;
+    m_cullingStats.bvh = false;
+    m_cullingStats.bvhNodesVisited = 0;
+    m_cullingStats.occlusion = false;
+    m_cullingStats.numOccluded = 0;
+    m_cullingStats.occlusionMs = 0.0;
+    m_cullingStats.hiZ = false;
+    m_cullingStats.numHiZTests = 0;
+    m_cullingStats.numHiZUntestable = 0;
+    m_cullingStats.numHiZSecondPhase = 0;
+    m_cullingStats.contribution = false;
+    m_cullingStats.numContributionCulled = 0;
+    m_cullingStats.numDepthPassCulled = 0;
+    m_cullingStats.indirect = true;
+
+    // One ExecuteIndirect per pipeline, every argument sets the material constant
+    m_drawStats.numDraws = m_cullingStats.numVisibleOpaque + m_cullingStats.numVisibleAlpha;
+    m_drawStats.psoChanges = 2;
+    m_drawStats.materialChanges = m_drawStats.numDraws;
+    m_drawStats.buildMs = 0.0;
+    m_drawStats.extractMs = 0.0;
+    m_drawStats.numChunks = 0;
+    m_drawStats.sorted = false;
+}
+
+void Model::BuildRenderList(uint32_t numVisible, const XMFLOAT3& cameraPosition, FXMMATRIX viewProj)
+{
+    auto start = TimerClock::now();
+
+    const bool useHiZ = m_useHiZCulling && m_hiZPredicates != nullptr;
+    XMFLOAT4X4 hiZViewProj;
+    XMStoreFloat4x4(&hiZViewProj, viewProj);
+
+    // Same matrix as SceneConstantBuffer::WorldViewProj, world is identity
+    const bool useContribution = m_useContributionCulling && m_screenWidth > 0 && m_screenHeight > 0;
+    const float screenWidth = static_cast<float>(m_screenWidth);
+    const float screenHeight = static_cast<float>(m_screenHeight);
+
+    // Extract, visible slots are split over the job system, everything touched here is read only
+    // Every visible instance is tested, the ones occluded last frame wait for the result (second phase)
+    m_renderListBuilder.Build(jobSystem, numVisible, [&](uint32_t begin, uint32_t end, RenderListChunk& chunk)
+    {
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            const uint32_t slot = m_visibleSlots[i];
+            const uint32_t instanceIndex = m_slotToInstance[slot];
+            const XMFLOAT3 center(m_worldBounds.centerX[slot], m_worldBounds.centerY[slot], m_worldBounds.centerZ[slot]);
+            const XMFLOAT3 extents(m_worldBounds.extentX[slot], m_worldBounds.extentY[slot], m_worldBounds.extentZ[slot]);
+
+            // Below the G-buffer threshold nothing is drawn, it isn't HiZ tested either
+            uint64_t flags = 0;
+            if (useContribution)
             {
-                if (!nonOpaque)
+                const float pixelArea = ProjectedPixelArea(center, extents, hiZViewProj, screenWidth, screenHeight);
+                if (pixelArea < m_minGBufferPixels)
                 {
-                    constantIndex++;
+                    ++chunk.numContributionCulled;
                     continue;
                 }
-            }
-            else
-            {
-                if (nonOpaque)
+                if (pixelArea < m_minDepthPassPixels)
                 {
-                    constantIndex++;
-                    continue;
+                    flags |= DrawKeyNoDepthPass;
+                    ++chunk.numDepthPassCulled;
                 }
             }
 
-            // transform bounding box to world space
-            BoundingBox worldBox;
-            primitive.boundingBox.Transform(worldBox, node.transform);
-            if (frustum.Contains(worldBox) == DISJOINT)
+            uint32_t phase = 0;
+            if (useHiZ)
             {
-                constantIndex++;
-                continue;
+                HiZTestEntry test;
+                if (ProjectHiZTest(center, extents, hiZViewProj, m_hiZWidth, m_hiZHeight, instanceIndex, test))
+                {
+                    chunk.hiZTests.push_back(test);
+                    phase = ((m_hiZVisibleBits[instanceIndex / 32] >> (instanceIndex % 32)) & 1) ? 0 : 1;
+                }
+                else
+                {
+                    chunk.hiZUntestable.push_back(instanceIndex);
+                }
             }
 
-            // constant
-            ModelConstants constant = { static_cast<UINT>(constantIndex), static_cast<UINT>(primitive.materialIndex) };
-            commandList->SetGraphicsRoot32BitConstants(2, 2, &constant, 0);
+            // Opaque slots come first
+            const uint32_t pso = (slot < m_numOpaqueInstances) ? DrawPSO_Opaque : DrawPSO_AlphaTest;
+            chunk.numAlpha += (pso == DrawPSO_AlphaTest) ? 1 : 0;
+
+            const float dx = center.x - cameraPosition.x;
+            const float dy = center.y - cameraPosition.y;
+            const float dz = center.z - cameraPosition.z;
 
-            // Set vertex and index buffers
-            commandList->DrawIndexedInstanced(primitive.indices.size(), 1, primitive.indexOffset, primitive.vertexOffset, 0);
-            constantIndex++;
+            DrawPacket packet;
+            packet.instanceIndex = instanceIndex;
+            packet.materialIndex = static_cast<uint32_t>(GetInstancePrimitive(instanceIndex).materialIndex);
+            packet.key = MakeDrawKey(phase, pso, packet.materialIndex, QuantizeDrawDepth(sqrtf(dx * dx + dy * dy + dz * dz))) | flags;
+            chunk.packets[phase].push_back(packet);
         }
+    }, m_renderList);
+
+    const double extractMs = ElapsedMs(start);
+
+    // Phase is the top key field, the second phase range is unchanged
+    if (m_useDrawSorting)
+    {
+        RadixSortDrawPackets(jobSystem, m_renderList.packets, m_drawPacketScratch);
     }
+
+    const double buildMs = ElapsedMs(start);
+
+    const std::vector<DrawPacket>& packets = m_renderList.packets;
+    const uint32_t secondPhaseBegin = m_renderList.secondPhaseBegin;
+    const DrawStateChanges firstPhase = CountDrawStateChanges(packets.data(), secondPhaseBegin);
+    const DrawStateChanges secondPhase = CountDrawStateChanges(
+        packets.data() + secondPhaseBegin,
+        static_cast<uint32_t>(packets.size()) - secondPhaseBegin);
+
+    m_drawStats.numDraws = static_cast<uint32_t>(packets.size());
+    m_drawStats.psoChanges = firstPhase.psoChanges + secondPhase.psoChanges;
+    m_drawStats.materialChanges = firstPhase.materialChanges + secondPhase.materialChanges;
+    m_drawStats.buildMs = buildMs;
+    m_drawStats.extractMs = extractMs;
+    m_drawStats.numChunks = m_renderListBuilder.NumChunks();
+    m_drawStats.sorted = m_useDrawSorting;
 }
-HRESULT Model::RenderDepthOnly(
-    const ConstantBuffer* sceneCB,
-    const BoundingFrustum& frustum)
+
+void Model::SetScreenSize(uint32_t width, uint32_t height)
+{
+    m_screenWidth = width;
+    m_screenHeight = height;
+    m_virtualTexturing.SetScreenSize(width, height);
+}
+
+void Model::SetHiZTarget(ID3D12Resource* predicates, uint32_t width, uint32_t height)
+{
+    m_hiZPredicates = predicates;
+    m_hiZWidth = width;
+    m_hiZHeight = height;
+}
+
+void Model::ApplyHiZResults(const uint32_t* predicates)
+{
+    // Phases of the render list change with the bits, a still camera settles on the same ones
+    m_hiZPreviousBits.assign(m_hiZVisibleBits.begin(), m_hiZVisibleBits.end());
+
+    // Not visible last frame means occluded or outside the frustum, both start in the second phase
+    std::fill(m_hiZVisibleBits.begin(), m_hiZVisibleBits.end(), 0u);
+
+    uint32_t numOccluded = 0;
+    for (const HiZTestEntry& test : m_renderList.hiZTests)
+    {
+        if (predicates[test.instanceIndex * 2] != 0)
+        {
+            m_hiZVisibleBits[test.instanceIndex / 32] |= 1u << (test.instanceIndex % 32);
+        }
+        else
+        {
+            ++numOccluded;
+        }
+    }
+    for (uint32_t instanceIndex : m_renderList.hiZUntestable)
+    {
+        m_hiZVisibleBits[instanceIndex / 32] |= 1u << (instanceIndex % 32);
+    }
+    m_cullingStats.numHiZOccluded = numOccluded;
+    m_hiZBitsChanged |= (m_hiZPreviousBits != m_hiZVisibleBits);
+}
+
+void Model::RenderPackets(CullPhase phase, ID3D12PipelineState* opaquePSO, ID3D12PipelineState* alphaPSO, uint64_t skipFlags)
+{
+    // Arguments are compacted per pipeline, all in the first phase
+    if (m_cullingStats.indirect)
+    {
+        if (phase == CullPhase::First)
+        {
+            commandList->SetPipelineState(opaquePSO);
+            m_indirectCulling.Draw(DrawPSO_Opaque);
+            commandList->SetPipelineState(alphaPSO);
+            m_indirectCulling.Draw(DrawPSO_AlphaTest);
+        }
+        return;
+    }
+
+    const bool predicated = (phase == CullPhase::Second);
+    const uint32_t begin = predicated ? m_renderList.secondPhaseBegin : 0;
+    const uint32_t end = predicated ? static_cast<uint32_t>(m_renderList.packets.size()) : m_renderList.secondPhaseBegin;
+    if (begin == end)
+    {
+        return;
+    }
+
+    // Pipeline and material constant are only set when they change, root constants survive a pipeline change
+    uint32_t pso = uint32_t(-1);
+    uint32_t materialIndex = uint32_t(-1);
+    bool first = true;
+    for (uint32_t i = begin; i < end; ++i)
+    {
+        const DrawPacket& packet = m_renderList.packets[i];
+        if (packet.key & skipFlags)
+            continue;
+
+        const PrimitiveData& primitive = GetInstancePrimitive(packet.instanceIndex);
+        const uint32_t lod = m_instanceLods[m_instanceToSlot[packet.instanceIndex]];
+
+        const uint32_t packetPSO = DrawKeyPSO(packet.key);
+        if (first || packetPSO != pso)
+        {
+            commandList->SetPipelineState(packetPSO == DrawPSO_AlphaTest ? alphaPSO : opaquePSO);
+            pso = packetPSO;
+        }
+
+        // ModelConstants, instance index matches mesh structured buffer
+        if (first || packet.materialIndex != materialIndex)
+        {
+            commandList->SetGraphicsRoot32BitConstant(2, packet.materialIndex, 1);
+            materialIndex = packet.materialIndex;
+        }
+        first = false;
+        commandList->SetGraphicsRoot32BitConstant(2, packet.instanceIndex, 0);
+
+        // Skipped by the GPU when the HiZ test wrote 0
+        if (predicated)
+        {
+            commandList->SetPredication(m_hiZPredicates, packet.instanceIndex * 8ull, D3D12_PREDICATION_OP_EQUAL_ZERO);
+        }
+
+        commandList->DrawIndexedInstanced(primitive.LodIndexCount(lod), 1, primitive.LodIndexOffset(lod), primitive.vertexOffset, 0);
+    }
+
+    if (predicated)
+    {
+        commandList->SetPredication(nullptr, 0, D3D12_PREDICATION_OP_EQUAL_ZERO);
+    }
+}
+HRESULT Model::RenderDepthOnly(const ConstantBuffer* sceneCB, CullPhase phase)
 {
     if (m_model.nodes.empty())
     {
@@ -1054,13 +2308,7 @@ HRESULT Model::RenderDepthOnly(
     commandList->IASetIndexBuffer(&meshResource.indexBuffer.IBView());
     commandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
-    // Render opaque first
-    commandList->SetPipelineState(depthPSO.Get());
-    RenderModel(frustum, false);
-
-    // Render alpha test
-    commandList->SetPipelineState(depthAlphaPSO.Get());
-    RenderModel(frustum, true);
+    RenderPackets(phase, depthPSO.Get(), depthAlphaPSO.Get(), DrawKeyNoDepthPass);
     return S_OK;
 }
 
@@ -1121,7 +2369,7 @@ HRESULT Model::RenderBasePass(
     return S_OK;
 }
 
-void Model::RenderGBuffer(const ConstantBuffer* sceneCB, const DirectX::BoundingFrustum& frustum)
+void Model::RenderGBuffer(const ConstantBuffer* sceneCB)
 {
     if (m_model.nodes.empty())
     {
@@ -1138,15 +2386,19 @@ void Model::RenderGBuffer(const ConstantBuffer* sceneCB, const DirectX::Bounding
     commandList->SetGraphicsRootShaderResourceView(3, meshSB.internalBuffer.gpuAddress);
     commandList->SetGraphicsRootShaderResourceView(4, materialSB.internalBuffer.gpuAddress);
 
+    // Feedback texture is created by SetScreenSize
+    assert(m_virtualTexturing.FeedbackUAV().ptr != 0);
+    commandList->SetGraphicsRootShaderResourceView(5, m_virtualTexturing.InfoBuffer());
+    commandList->SetGraphicsRootDescriptorTable(6, m_virtualTexturing.FeedbackUAV());
+
     commandList->IASetVertexBuffers(0, 1, &meshResource.vertexBuffer.VBView());
     commandList->IASetIndexBuffer(&meshResource.indexBuffer.IBView());
     commandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
     // Render opaque first
-    commandList->SetPipelineState(gbufferPSO.Get());
-    RenderModel(frustum, false);
+    // Second phase reuses the predicates of the depth pass
+    RenderPackets(CullPhase::First, gbufferPSO.Get(), gbufferAlphaPSO.Get(), 0);
+    RenderPackets(CullPhase::Second, gbufferPSO.Get(), gbufferAlphaPSO.Get(), 0);
 
-    // Render alpha test
-    commandList->SetPipelineState(gbufferAlphaPSO.Get());
-    RenderModel(frustum, true);
+    m_virtualTexturing.EndFrame();
 }
\ No newline at end of file
@@ -3,7 +3,22 @@
 #include "PCH.h"
 #include "Helper.h"
 #include "GraphicsTypes.h"
-#include "../Shaders/HLSLCompatible.h"
+#include "TextureLoader.h"
+#include "TextureStreaming.h"
+#include "VirtualTexturing.h"
+#include "Culling.h"
+#include "InstanceBVH.h"
+#include "OcclusionCulling.h"
+#include "HiZ.h"
+#include "DrawSort.h"
+#include "RenderList.h"
+#include "Lod.h"
+#include "IndirectCulling.h"
+#include "ShadowCulling.h"
+#include "Pvs.h"
+#include "TriangleBVH.h"
+#include "TopLevelBVH.h"
+#include "../shaders/HLSLCompatible.h"
 
 using Microsoft::WRL::ComPtr;
 
@@ -24,6 +39,13 @@ struct TextureResource
 	int height = 0;
 	int channels = 0;	// for RGBA is 4
 
+	TextureContainer container;	// DDS/KTX2 payload, pixels is empty when valid
+
+	// Full mip chain, points into container file or pixels (generated chain)
+	DXGI_FORMAT format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	std::vector<D3D12_SUBRESOURCE_DATA> mips;
+	uint32_t streamingIndex = uint32_t(-1);
+
 	Texture texture;
 };
 
@@ -45,6 +67,15 @@ struct SamplerData
 	D3D12_GPU_DESCRIPTOR_HANDLE samplerGpuHandle;
 };
 
+// Coarser index list over the vertices of the full mesh
+struct PrimitiveLod
+{
+	std::vector<uint32_t> indices;
+	uint64_t indexOffset = 0;
+	float error = 0.f;	// Object space
+	RawBuffer blasBuffer;
+};
+
 struct PrimitiveData
 {
 	std::vector<MeshVertex> vertices;
@@ -54,8 +85,17 @@ struct PrimitiveData
 	bool hasVertexColor = false;
 	bool hasTangent = false;
 	int materialIndex = -1;
+	float uvDensity = 0.f;	// sqrt(uv area / object space area), texture streaming
 	DirectX::BoundingBox boundingBox;
 	RawBuffer blasBuffer;
+	std::vector<PrimitiveLod> lods;	// lods[i] is LOD i + 1, LOD 0 is the primitive itself
+	TriangleBVH bvh;				// CPU ray queries, LOD 0 in object space
+
+	uint32_t NumLods() const { return 1 + static_cast<uint32_t>(lods.size()); }
+	uint64_t LodIndexOffset(uint32_t lod) const { return (lod == 0) ? indexOffset : lods[lod - 1].indexOffset; }
+	uint32_t LodIndexCount(uint32_t lod) const { return static_cast<uint32_t>((lod == 0) ? indices.size() : lods[lod - 1].indices.size()); }
+	RawBuffer& LodBlas(uint32_t lod) { return (lod == 0) ? blasBuffer : lods[lod - 1].blasBuffer; }
+	const RawBuffer& LodBlas(uint32_t lod) const { return (lod == 0) ? blasBuffer : lods[lod - 1].blasBuffer; }
 };
 
 struct MeshData
@@ -82,6 +122,101 @@ struct ModelData
 	uint32_t numInstances;
 };
 
+// Flattened node x primitive, same order as mesh structured buffer
+struct DrawInstance
+{
+	uint32_t nodeIndex = 0;
+	uint32_t meshIndex = 0;
+	uint32_t primitiveIndex = 0;
+	bool alphaTest = false;
+};
+
+// What Cull did with the previous frame's results
+enum class VisibilityCacheState
+{
+	Culled,		// Full cull
+	Patched,	// Same view, moved instances retested and render list rebuilt
+	Reused,		// Nothing relevant changed, last render list is drawn again
+};
+
+struct CullingStats
+{
+	uint32_t numInstances = 0;
+	uint32_t numVisibleOpaque = 0;
+	uint32_t numVisibleAlpha = 0;
+	double cullMs = 0.0;
+	bool simd = false;
+	bool bvh = false;
+	uint32_t bvhNodes = 0;
+	uint32_t bvhNodesVisited = 0;
+	bool occlusion = false;
+	uint32_t numOccluded = 0;
+	double occlusionMs = 0.0;	// Occluder selection, raster and test
+	bool hiZ = false;
+	uint32_t numHiZTests = 0;
+	uint32_t numHiZUntestable = 0;	// Crossing the near plane, drawn in the first phase
+	uint32_t numHiZSecondPhase = 0;	// Occluded last frame, predicated
+	uint32_t numHiZOccluded = 0;	// Last completed frame
+	bool contribution = false;
+	uint32_t numContributionCulled = 0;	// Below the G-buffer threshold, not drawn
+	uint32_t numDepthPassCulled = 0;	// Below the depth pass threshold, G-buffer only
+	uint32_t numLodChanges = 0;		// Every instance, not only visible ones
+	double lodMs = 0.0;
+	bool indirect = false;	// Culled by IndirectCulling, visible counts are its last results
+	bool shadowCasters = false;
+	uint32_t numShadowCasters = 0;	// Instances in the shadow TLAS
+	double shadowCullMs = 0.0;		// Caster culling and instance desc copy
+	bool shadowCastersReused = false;	// Same view, light and scene, shadow TLAS kept
+	VisibilityCacheState visibilityCache = VisibilityCacheState::Culled;
+	uint32_t numCacheRetested = 0;	// Moved instances, patched frames
+	uint32_t numCacheReusedFrames = 0;	// In a row
+	bool pvs = false;				// Camera cell had a set, only its instances were frustum culled
+	uint32_t numPvsCandidates = 0;	// Including moved instances
+};
+
+// Everything the culling result depends on besides instance bounds and HiZ bits, compared as bytes
+struct VisibilityCacheKey
+{
+	DirectX::XMFLOAT4X4 viewProj;
+	DirectX::XMFLOAT3 cameraPosition;
+	float fovY;
+	uint32_t screenWidth;
+	uint32_t screenHeight;
+	uint32_t flags;
+	float minDepthPassPixels;
+	float minGBufferPixels;
+	float lodPixelError;
+	float lodHysteresis;
+
+	bool operator==(const VisibilityCacheKey& other) const { return memcmp(this, &other, sizeof(VisibilityCacheKey)) == 0; }
+};
+
+// Per pass, built after culling
+struct DrawStats
+{
+	uint32_t numDraws = 0;
+	uint32_t psoChanges = 0;
+	uint32_t materialChanges = 0;
+	double buildMs = 0.0;	// Packet generation and sort
+	double extractMs = 0.0;	// Parallel extract and merge, part of buildMs
+	uint32_t numChunks = 0;
+	bool sorted = false;
+};
+
+// Draw key pso field
+enum DrawPSO
+{
+	DrawPSO_Opaque = 0,
+	DrawPSO_AlphaTest = 1,
+};
+
+// Two phase HiZ culling, see hiz.hlsl
+enum class CullPhase
+{
+	First,	// Visible last frame or can't be tested
+	Second,	// Occluded last frame, draws are predicated on this frame's test
+};
+
 // Constant must be aligned to 256 bytes
 struct ModelConstants
 {
@@ -102,6 +237,11 @@ struct MeshResources
 	RawBuffer blasScratchBuffer;
 	RawBuffer tlasBuffer;
 	RawBuffer instanceBuffer;
+
+	// Shadow casters of the directional light only, sized for every instance
+	RawBuffer shadowTlasScratchBuffer;
+	RawBuffer shadowTlasBuffer;
+	RawBuffer shadowInstanceBuffer;
 };
 
 class Model
@@ -117,16 +257,53 @@ public:
 	HRESULT UploadGpuResources();
 	void BuildAccelerationStructure();
 
-	HRESULT RenderDepthOnly(
-		const ConstantBuffer* sceneCB,
-		const DirectX::BoundingFrustum& frustum);
+	// CPU BVH of every primitive over the combined vertices and indices, after UploadGpuResources
+	// Then the CPU TLAS over instances, numbered like the DXR instance descs
+	void BuildTriangleBVHs();
+
+	// Cull once per frame, every pass draws the same visible lists
+	// LODs are selected for every instance first, fovY is the one given to GetProjectionMatrix
+	// Records the TLAS rebuild when any LOD changed
+	void Cull(const DirectX::BoundingFrustum& frustum, DirectX::FXMMATRIX viewProj, float fovY);
+
+	// Rebuilds the shadow TLAS from instances that can shadow the view, after Cull (instance descs are at the selected LOD)
+	// lightDirection is LightData::direction
+	void CullShadowCasters(const DirectX::BoundingFrustum& frustum, const DirectX::XMFLOAT3& lightDirection);
+
+	// Render target size, contribution culling thresholds are in pixels
+	void SetScreenSize(uint32_t width, uint32_t height);
+
+	// HiZ results are 2 uints per instance (see HiZCulling), size is the HZB mip 0
+	void SetHiZTarget(ID3D12Resource* predicates, uint32_t width, uint32_t height);
+
+	// Last frame's GPU results become the visibility bits, call before Cull
+	void ApplyHiZResults(const uint32_t* predicates);
+
+	// Baked potentially visible sets (PvsBaker), false when missing or of another scene
+	// Call after LoadFromFile, instances moved by SetNodeTransform are never filtered
+	bool LoadPvs(const std::string& filePath);
+
+	// Updates cached world bounds, mesh structured buffer entry and CPU TLAS (on next Cull)
+	void SetNodeTransform(uint32_t nodeIndex, DirectX::FXMMATRIX transform);
+
+	HRESULT RenderDepthOnly(const ConstantBuffer* sceneCB, CullPhase phase);
 
 	HRESULT RenderBasePass(
 		const ConstantBuffer* sceneCB,
 		const ConstantBuffer* lightCB,
 		const DirectX::BoundingFrustum& frustum);
 
-	void RenderGBuffer(const ConstantBuffer* sceneCB, const DirectX::BoundingFrustum& frustum);
+	void RenderGBuffer(const ConstantBuffer* sceneCB);
+
+	// Request mips of visible textures (after Cull) and stream in/out within budget
+	// Must be called after the command list is reset, before any pass samples material textures
+	void UpdateTextureStreaming(
+		DirectX::FXMVECTOR cameraPosition,
+		float fovY,
+		float screenHeight);
+
+	// Pages requested by the last frame's G-buffer pass, same call order as UpdateTextureStreaming
+	void UpdateVirtualTextures();
 
 	// Accessor
 	const StructuredBuffer& GetVertexBuffer() const { return meshResource.vertexBuffer; }
@@ -141,18 +318,161 @@ public:
 	const StructuredBuffer& MeshBuffer() const { return meshSB; }
 	const StructuredBuffer& MaterialBuffer() const { return materialSB; }
 	const MeshResources& MeshResource() const { return meshResource; }
+	TextureStreamer& Streamer() { return textureStreamer; }
+	const VirtualTexturing& VirtualTextures() const { return m_virtualTexturing; }
+	const CullingStats& GetCullingStats() const { return m_cullingStats; }
+	const DrawStats& GetDrawStats() const { return m_drawStats; }
+	const TriangleBVHStats& GetTriangleBVHStats() const { return m_triangleBVHStats; }	// Summed over primitives, SAH cost triangle weighted
+	const TopLevelBVH& GetTopLevelBVH() const { return m_topLevelBVH; }	// Refit by Cull after SetNodeTransform
+	bool& UseDrawSorting() { return m_useDrawSorting; }
+	bool& UseSimdCulling() { return m_useSimdCulling; }
+	bool& UseBVHCulling() { return m_useBVHCulling; }
+	bool& UseOcclusionCulling() { return m_useOcclusionCulling; }
+	const OcclusionCuller& Occlusion() const { return m_occlusionCuller; }
+	bool& UseHiZCulling() { return m_useHiZCulling; }
+	bool& UseContributionCulling() { return m_useContributionCulling; }
+	float& MinDepthPassPixels() { return m_minDepthPassPixels; }
+	float& MinGBufferPixels() { return m_minGBufferPixels; }
+	bool& UseLodSelection() { return m_useLodSelection; }
+	float& LodPixelError() { return m_lodParams.maxPixelError; }
+	float& LodHysteresis() { return m_lodParams.hysteresis; }
+	uint32_t NumLodPrimitives() const { return m_numLodPrimitives; }
+	bool& UseIndirectDraws() { return m_useIndirectDraws; }
+	bool& UseGpuIndirect() { return m_useGpuIndirect; }
+	IndirectCulling& Indirect() { return m_indirectCulling; }
+	bool& UseVisibilityCache() { return m_useVisibilityCache; }
+	bool& UsePvs() { return m_usePvs; }
+	const PvsData& Pvs() const { return m_pvs; }
+	bool& UseShadowCasterCulling() { return m_useShadowCasterCulling; }
+	const std::vector<uint32_t>& ShadowCasters() const { return m_shadowCasters; }	// Instance indices, ascending
+	const RawBuffer& ShadowTlas() const { return m_cullingStats.shadowCasters ? meshResource.shadowTlasBuffer : meshResource.tlasBuffer; }
+	const std::vector<HiZTestEntry>& HiZTests() const { return m_renderList.hiZTests; }
 private:
 	// Helper
 	D3D12_FILTER GetD3D12Filter(int magFilter, int minFilter);
 	D3D12_TEXTURE_ADDRESS_MODE GetD3D12AddressMode(int wrapMode);
 
-	void RenderModel(const BoundingFrustum& frustum, bool AlphaFilter);
+	// Packets with any of skipFlags in their key are not drawn
+	void RenderPackets(CullPhase phase, ID3D12PipelineState* opaquePSO, ID3D12PipelineState* alphaPSO, uint64_t skipFlags);
+	void BuildRenderList(uint32_t numVisible, const DirectX::XMFLOAT3& cameraPosition, DirectX::FXMMATRIX viewProj);
+	void CreateTexture(TextureResource& texResource, uint32_t topMip);
+
+	void RecordTopLevelBuild();
+	void RecordShadowTopLevelBuild(uint32_t numCasters);
+	void UpdateRaytracingLods();
+
+	void BuildInstances();
+	void UpdateWorldBounds(uint32_t instanceIndex);
+	void FlushInstanceUpdates();
+	uint32_t CullOccluded(uint32_t numVisible, const DirectX::XMFLOAT3& cameraPosition, DirectX::FXMMATRIX viewProj);
+	void CullIndirect(const FrustumPlanes& planes);
+	bool CullPvsCandidates(const DirectX::XMFLOAT3& cameraPosition, const FrustumPlanes& planes, uint32_t& outNumVisible);
+	VisibilityCacheKey MakeVisibilityCacheKey(const DirectX::BoundingFrustum& frustum, DirectX::FXMMATRIX viewProj, float fovY) const;
+	const PrimitiveData& GetInstancePrimitive(uint32_t instanceIndex) const;
+	MeshStructuredBuffer GetMeshEntry(uint32_t instanceIndex) const;
 
 	// 
 	ModelData m_model;
 
 	MeshResources meshResource;
 
+	// Instances, world bounds are kept in cull slot order (opaque first, then alpha test)
+	std::vector<DrawInstance> m_instances;
+	std::vector<uint32_t> m_nodeFirstInstance;	// numNodes + 1 entries
+	std::vector<uint32_t> m_slotToInstance;
+	std::vector<uint32_t> m_instanceToSlot;
+	uint32_t m_numOpaqueInstances = 0;
+	BoundsSoA m_worldBounds;
+	std::vector<uint32_t> m_dirtyInstances;
+	InstanceBVH m_instanceBVH;	// Over cull slots, refit when transforms change
+
+	// Per frame visibility, cull slots
+	std::vector<uint32_t> m_visibleSlots;
+	uint32_t m_numVisibleSlots = 0;	// After occlusion culling, kept for the visibility cache
+	CullingStats m_cullingStats;
+	bool m_useSimdCulling = true;
+	bool m_useBVHCulling = false;
+
+	// Software occlusion, largest visible opaque instances are the occluders
+	OcclusionCuller m_occlusionCuller;
+	std::vector<std::pair<float, uint32_t>> m_occluderCandidates;	// Screen size score, slot
+	bool m_useOcclusionCulling = false;
+
+	// Two phase HiZ, visibility bits per instance persist across frames
+	// Tests and untestable instances of the frame are in m_renderList
+	std::vector<uint32_t> m_hiZVisibleBits;
+	ID3D12Resource* m_hiZPredicates = nullptr;
+	uint32_t m_hiZWidth = 0;
+	uint32_t m_hiZHeight = 0;
+	bool m_useHiZCulling = false;
+
+	// Contribution culling, projected bounds area in pixels, the depth pass only keeps good occluders
+	uint32_t m_screenWidth = 0;
+	uint32_t m_screenHeight = 0;
+	float m_minDepthPassPixels = 64.f;
+	float m_minGBufferPixels = 1.f;
+	bool m_useContributionCulling = true;
+
+	// Screen space error LOD selection, per cull slot, the current LOD feeds the next selection
+	LodErrorsSoA m_lodErrors;		// World space
+	std::vector<uint8_t> m_instanceLods;
+	LodSelectionParams m_lodParams;
+	uint32_t m_numLodPrimitives = 0;	// With more than one LOD
+	bool m_useLodSelection = true;
+	bool m_raytracingLods = false;	// TLAS built, instances follow the selected LOD
+
+	// Draw packets of both phases, key order when sorting, built in parallel every Cull
+	RenderListBuilder m_renderListBuilder;
+	RenderList m_renderList;
+	std::vector<DrawPacket> m_drawPacketScratch;
+	DrawStats m_drawStats;
+	TriangleBVHStats m_triangleBVHStats;
+	TopLevelBVH m_topLevelBVH;
+	bool m_useDrawSorting = true;
+
+	// Indirect draws replace the render list, one record per cull slot, opaque and alpha test slots
+	// are the two buckets. Only frustum culling, HiZ and contribution culling don't apply.
+	IndirectCulling m_indirectCulling;
+	std::vector<DrawRecord> m_drawRecords;
+	bool m_drawRecordsDirty = true;	// Bounds or LOD changed
+	bool m_useIndirectDraws = false;
+	bool m_useGpuIndirect = true;	// Otherwise the CPU reference writes the arguments
+	std::filesystem::path m_shaderPath;
+
+	// Temporal visibility cache, a still camera reuses the last cull
+	// Moved instances are retested alone unless occlusion culling depends on them
+	VisibilityCacheKey m_visibilityCacheKey = {};
+	bool m_visibilityCacheValid = false;
+	bool m_hiZBitsChanged = false;		// By ApplyHiZResults since the last Cull
+	std::vector<uint32_t> m_hiZPreviousBits;
+	bool m_viewUnchanged = false;		// This frame, same key, bounds and LODs as the last one
+	std::vector<uint32_t> m_movedSlots;
+	std::vector<uint8_t> m_movedSlotFlags;
+	bool m_useVisibilityCache = true;
+
+	// Potentially visible sets, candidates are the cull slots of the camera cell's set and every
+	// moved instance, rebuilt when the cell changes
+	PvsData m_pvs;
+	std::vector<uint32_t> m_pvsCandidates;
+	uint32_t m_pvsCell = PvsNoSet;		// Of m_pvsCandidates
+	std::vector<uint8_t> m_dynamicSlotFlags;	// Per cull slot, moved at least once
+	bool m_usePvs = true;
+
+	// Directional light shadow casters, the shadow TLAS holds copies of their instance descs
+	std::vector<uint32_t> m_shadowCasterSlots;
+	std::vector<uint32_t> m_shadowCasters;
+	DirectX::XMFLOAT3 m_shadowLightDirection = {};	// Of the current shadow TLAS
+	bool m_shadowCastersValid = false;
+	bool m_useShadowCasterCulling = true;
+
+	// Texture streaming
+	TextureStreamer textureStreamer;
+	std::vector<StreamingChange> streamingChanges;
+	std::vector<ComPtr<ID3D12Resource>> retiredTextures;	// Released once the frame using them completed
+
+	// Virtual albedo of square RGBA8 textures, the streamed texture is sampled until a page is resident
+	VirtualTexturing m_virtualTexturing;
+
 	StructuredBuffer meshSB;
 	StructuredBuffer materialSB;
 	D3D12_CPU_DESCRIPTOR_HANDLE m_materialCpuHandle;
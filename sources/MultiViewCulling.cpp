@@ -0,0 +1,216 @@
+#include "MultiViewCulling.h"
+#include "Utility.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <random>
+#include <string.h>
+#include <immintrin.h>
+
+using namespace DirectX;
+
+//
+// Scalar
+//
+static void CullMultiViewScalarRange(const BoundsSoA& bounds, const FrustumPlanes* views, uint32_t numViews, uint32_t begin, uint32_t end, ViewMask* outMasks)
+{
+	for (uint32_t i = begin; i < end; ++i)
+	{
+		const XMFLOAT3 center(bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]);
+		const XMFLOAT3 extents(bounds.extentX[i], bounds.extentY[i], bounds.extentZ[i]);
+		ViewMask mask = 0;
+		for (uint32_t view = 0; view < numViews; ++view)
+		{
+			mask |= IsBoxOutside(views[view], center, extents) ? 0 : static_cast<ViewMask>(1u << view);
+		}
+		outMasks[i] = mask;
+	}
+}
+
+void CullMultiViewScalar(const BoundsSoA& bounds, const FrustumPlanes* views, uint32_t numViews, ViewMask* outMasks)
+{
+	assert(numViews <= MaxCullViews);
+	CullMultiViewScalarRange(bounds, views, numViews, 0, bounds.count, outMasks);
+	std::fill(outMasks + bounds.count, outMasks + bounds.centerX.size(), ViewMask(0));
+}
+
+//
+// AVX2, 8 boxes per iteration against every plane of every view
+// Same operation order as scalar (no FMA) so both paths agree exactly
+//
+struct WidePlane
+{
+	float x, y, z, w;
+	float absX, absY, absZ;
+};
+
+TARGET_AVX2 static void CullMultiViewAVX2Range(const BoundsSoA& bounds, const FrustumPlanes* views, uint32_t numViews, uint32_t begin, uint32_t end, ViewMask* outMasks)
+{
+	// Broadcast from memory in the loop, 16 views of planes don't fit in registers
+	WidePlane planes[MaxCullViews * 6];
+	for (uint32_t view = 0; view < numViews; ++view)
+	{
+		for (int p = 0; p < 6; ++p)
+		{
+			const XMFLOAT4& plane = views[view].planes[p];
+			planes[view * 6 + p] = { plane.x, plane.y, plane.z, plane.w, fabsf(plane.x), fabsf(plane.y), fabsf(plane.z) };
+		}
+	}
+
+	const __m256i laneIndex = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	for (uint32_t i = begin; i < end; i += 8)
+	{
+		const __m256 cx = _mm256_loadu_ps(&bounds.centerX[i]);
+		const __m256 cy = _mm256_loadu_ps(&bounds.centerY[i]);
+		const __m256 cz = _mm256_loadu_ps(&bounds.centerZ[i]);
+		const __m256 ex = _mm256_loadu_ps(&bounds.extentX[i]);
+		const __m256 ey = _mm256_loadu_ps(&bounds.extentY[i]);
+		const __m256 ez = _mm256_loadu_ps(&bounds.extentZ[i]);
+
+		__m256i masks = _mm256_setzero_si256();
+		for (uint32_t view = 0; view < numViews; ++view)
+		{
+			__m256 outside = _mm256_setzero_ps();
+			for (int p = 0; p < 6; ++p)
+			{
+				const WidePlane& plane = planes[view * 6 + p];
+				__m256 dist = _mm256_add_ps(_mm256_mul_ps(_mm256_broadcast_ss(&plane.x), cx), _mm256_mul_ps(_mm256_broadcast_ss(&plane.y), cy));
+				dist = _mm256_add_ps(_mm256_add_ps(dist, _mm256_mul_ps(_mm256_broadcast_ss(&plane.z), cz)), _mm256_broadcast_ss(&plane.w));
+
+				__m256 radius = _mm256_add_ps(_mm256_mul_ps(_mm256_broadcast_ss(&plane.absX), ex), _mm256_mul_ps(_mm256_broadcast_ss(&plane.absY), ey));
+				radius = _mm256_add_ps(radius, _mm256_mul_ps(_mm256_broadcast_ss(&plane.absZ), ez));
+
+				outside = _mm256_or_ps(outside, _mm256_cmp_ps(dist, radius, _CMP_GT_OQ));
+			}
+			masks = _mm256_or_si256(masks, _mm256_andnot_si256(_mm256_castps_si256(outside), _mm256_set1_epi32(1 << view)));
+		}
+
+		if (i + 8 > end)
+		{
+			masks = _mm256_and_si256(masks, _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(end - i)), laneIndex));
+		}
+
+		// 32 to 16 bit per lane, pack works within 128 bit halves
+		__m256i packed = _mm256_packus_epi32(masks, masks);
+		packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(0, 0, 2, 0));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(outMasks + i), _mm256_castsi256_si128(packed));
+	}
+}
+
+void CullMultiViewAVX2(const BoundsSoA& bounds, const FrustumPlanes* views, uint32_t numViews, ViewMask* outMasks)
+{
+	assert(numViews <= MaxCullViews);
+	CullMultiViewAVX2Range(bounds, views, numViews, 0, bounds.count, outMasks);
+	std::fill(outMasks + ((bounds.count + 7) & ~7u), outMasks + bounds.centerX.size(), ViewMask(0));
+}
+
+void CullMultiView(const BoundsSoA& bounds, const FrustumPlanes* views, uint32_t numViews, ViewMask* outMasks, bool allowSimd)
+{
+	if (allowSimd && CpuSupportsAVX2())
+	{
+		CullMultiViewAVX2(bounds, views, numViews, outMasks);
+		return;
+	}
+	CullMultiViewScalar(bounds, views, numViews, outMasks);
+}
+
+void CullMultiViewRange(const BoundsSoA& bounds, const FrustumPlanes* views, uint32_t numViews, uint32_t begin, uint32_t end, ViewMask* outMasks, bool allowSimd)
+{
+	// Groups of 8 are written whole, a range may only end mid group at the last bound
+	assert(numViews <= MaxCullViews);
+	assert(begin % 8 == 0 && end <= bounds.count && (end % 8 == 0 || end == bounds.count));
+	if (allowSimd && CpuSupportsAVX2())
+	{
+		CullMultiViewAVX2Range(bounds, views, numViews, begin, end, outMasks);
+		return;
+	}
+	CullMultiViewScalarRange(bounds, views, numViews, begin, end, outMasks);
+}
+
+uint32_t ExtractViewIndices(const ViewMask* masks, uint32_t count, uint32_t view, uint32_t* outIndices)
+{
+	uint32_t numVisible = 0;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		outIndices[numVisible] = i;
+		numVisible += (masks[i] >> view) & 1;
+	}
+	return numVisible;
+}
+
+//
+// Benchmark
+//
+void RunMultiViewBenchmark(uint32_t numInstances, uint32_t numViews, MultiViewBenchmarkResult& outResult)
+{
+	numViews = std::min(numViews, MaxCullViews);
+	outResult = {};
+	outResult.numInstances = numInstances;
+	outResult.numViews = numViews;
+
+	// Constant density, camera at origin inside the scene
+	std::mt19937 rng(1234);
+	const float side = 20.f * cbrtf(static_cast<float>(numInstances));
+	std::uniform_real_distribution<float> position(-side * 0.5f, side * 0.5f);
+	std::uniform_real_distribution<float> extent(0.5f, 2.f);
+
+	BoundsSoA bounds;
+	bounds.Resize(numInstances);
+	for (uint32_t i = 0; i < numInstances; ++i)
+	{
+		const XMFLOAT3 center(position(rng), position(rng), position(rng));
+		const XMFLOAT3 extents(extent(rng), extent(rng), extent(rng));
+		bounds.Set(i, BoundingBox(center, extents));
+	}
+
+	// Views turn around the y axis, planes through the origin keep their distance
+	BoundingFrustum frustum(XMMatrixPerspectiveFovLH(XM_PI / 3, 16.f / 9.f, 0.1f, 1000.f));
+	FrustumPlanes basePlanes;
+	GetFrustumPlanes(frustum, basePlanes);
+	FrustumPlanes views[MaxCullViews];
+	for (uint32_t view = 0; view < numViews; ++view)
+	{
+		const float angle = XM_PI * 2.f * view / numViews;
+		const float c = cosf(angle), s = sinf(angle);
+		for (int p = 0; p < 6; ++p)
+		{
+			const XMFLOAT4& plane = basePlanes.planes[p];
+			views[view].planes[p] = XMFLOAT4(c * plane.x + s * plane.z, plane.y, -s * plane.x + c * plane.z, plane.w);
+		}
+	}
+
+	std::vector<uint32_t> separate[MaxCullViews];
+	uint32_t numSeparate[MaxCullViews] = {};
+	for (uint32_t view = 0; view < numViews; ++view)
+	{
+		separate[view].resize(bounds.centerX.size());
+	}
+	std::vector<ViewMask> scalarMasks(bounds.centerX.size());
+	std::vector<ViewMask> simdMasks(bounds.centerX.size());
+
+	outResult.separateMs = BestOfMs([&]
+	{
+		for (uint32_t view = 0; view < numViews; ++view)
+		{
+			numSeparate[view] = CullFrustum(bounds, views[view], separate[view].data());
+		}
+	});
+	outResult.multiViewScalarMs = BestOfMs([&] { CullMultiViewScalar(bounds, views, numViews, scalarMasks.data()); });
+	outResult.multiViewSimdMs = BestOfMs([&] { CullMultiView(bounds, views, numViews, simdMasks.data()); });
+
+	// Every view's list from the masks matches its separate pass
+	assert(memcmp(scalarMasks.data(), simdMasks.data(), scalarMasks.size() * sizeof(ViewMask)) == 0);
+	std::vector<uint32_t> extracted(bounds.centerX.size());
+	for (uint32_t view = 0; view < numViews; ++view)
+	{
+		const uint32_t numExtracted = ExtractViewIndices(simdMasks.data(), numInstances, view, extracted.data());
+		assert(numExtracted == numSeparate[view]);
+		assert(memcmp(extracted.data(), separate[view].data(), numExtracted * sizeof(uint32_t)) == 0);
+		(void)numExtracted;
+		outResult.numVisible += numSeparate[view];
+	}
+
+	outResult.speedup = (outResult.multiViewSimdMs > 0.0) ? outResult.separateMs / outResult.multiViewSimdMs : 0.0;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "Culling.h"
+
+// Frustum culling of several views in one pass over the bounds (no D3D dependency)
+// Bounds are read once per group of 8 and tested against every view, bit v of an instance
+// mask is set when it is visible in view v. Same plane test as IsBoxOutside.
+
+static const uint32_t MaxCullViews = 16;
+
+typedef uint16_t ViewMask;
+
+// outMasks needs room for bounds.centerX.size() entries (padded count), padding masks are 0
+void CullMultiViewScalar(const BoundsSoA& bounds, const FrustumPlanes* views, uint32_t numViews, ViewMask* outMasks);
+void CullMultiViewAVX2(const BoundsSoA& bounds, const FrustumPlanes* views, uint32_t numViews, ViewMask* outMasks);
+
+// AVX2 when allowed and supported, scalar otherwise
+void CullMultiView(const BoundsSoA& bounds, const FrustumPlanes* views, uint32_t numViews, ViewMask* outMasks, bool allowSimd = true);
+
+// Bounds [begin, end) only, for splitting across threads. begin is a multiple of 8
+void CullMultiViewRange(const BoundsSoA& bounds, const FrustumPlanes* views, uint32_t numViews, uint32_t begin, uint32_t end, ViewMask* outMasks, bool allowSimd = true);
+
+// Instances with bit view set, ascending, returns count
+uint32_t ExtractViewIndices(const ViewMask* masks, uint32_t count, uint32_t view, uint32_t* outIndices);
+
+struct MultiViewBenchmarkResult
+{
+	uint32_t numInstances = 0;
+	uint32_t numViews = 0;
+	uint64_t numVisible = 0;	// Summed over views
+	double separateMs = 0.0;	// CullFrustum once per view
+	double multiViewScalarMs = 0.0;
+	double multiViewSimdMs = 0.0;
+	double speedup = 0.0;		// Separate over multi view SIMD
+};
+
+// Synthetic scene of RunCullingBenchmark, views share the origin and turn around it, fixed seed
+// Masks are checked against the separate passes
+void RunMultiViewBenchmark(uint32_t numInstances, uint32_t numViews, MultiViewBenchmarkResult& outResult);
@@ -0,0 +1,457 @@
+#include "OcclusionCulling.h"
+#include "Utility.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <emmintrin.h>
+
+using namespace DirectX;
+
+void OcclusionCuller::Initialize(const OcclusionCullingInit& init)
+{
+	assert(init.width > 0 && init.width % TileWidth == 0);
+	assert(init.height > 0 && init.height % TileHeight == 0);
+
+	m_init = init;
+	m_tilesX = init.width / TileWidth;
+	m_tilesY = init.height / TileHeight;
+	m_depth.assign(init.width * init.height, 1.f);
+	m_tileMaxDepth.assign(m_tilesX * m_tilesY, 1.f);
+	m_occluders.clear();
+	m_numTriangles = 0;
+	m_stats = {};
+}
+
+void OcclusionCuller::Shutdown()
+{
+	m_occluders.clear();
+	m_threadBins.clear();
+	m_depth.clear();
+	m_tileMaxDepth.clear();
+	m_visible.clear();
+}
+
+void OcclusionCuller::BeginFrame(FXMMATRIX viewProj)
+{
+	XMStoreFloat4x4(&m_viewProj, viewProj);
+	m_occluders.clear();
+	m_numTriangles = 0;
+	m_stats = {};
+
+	std::fill(m_depth.begin(), m_depth.end(), 1.f);
+	std::fill(m_tileMaxDepth.begin(), m_tileMaxDepth.end(), 1.f);
+}
+
+bool OcclusionCuller::AddOccluder(
+	const XMFLOAT3* positions,
+	uint32_t positionStride,
+	const uint32_t* indices,
+	uint32_t numIndices,
+	FXMMATRIX world)
+{
+	const uint32_t numTriangles = numIndices / 3;
+	if (numTriangles == 0 || numTriangles > RemainingTriangleBudget())
+	{
+		return false;
+	}
+
+	Occluder occluder;
+	XMStoreFloat4x4(&occluder.worldViewProj, XMMatrixMultiply(world, XMLoadFloat4x4(&m_viewProj)));
+	occluder.positions = reinterpret_cast<const uint8_t*>(positions);
+	occluder.positionStride = positionStride;
+	occluder.indices = indices;
+	occluder.firstTriangle = m_numTriangles;
+	m_occluders.push_back(occluder);
+
+	m_numTriangles += numTriangles;
+	++m_stats.numOccluders;
+	m_stats.numOccluderTriangles += numTriangles;
+	return true;
+}
+
+//
+// Setup, transform + clip + bin, any thread
+//
+static XMFLOAT4 LerpClip(const XMFLOAT4& a, const XMFLOAT4& b, float t)
+{
+	return XMFLOAT4(a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t, a.w + (b.w - a.w) * t);
+}
+
+// Inside when dot(plane, v) >= 0: near (z >= 0), then a guard band of |x|, |y| <= GuardBand * w.
+// Triangles reaching past the band are clipped, not clamped, so screen coordinates stay within a few
+// screen sizes, far from the int range and small enough for exact edge functions
+static const float GuardBand = 4.f;
+static const XMFLOAT4 ClipPlanes[] =
+{
+	XMFLOAT4(0.f, 0.f, 1.f, 0.f),
+	XMFLOAT4(1.f, 0.f, 0.f, GuardBand),
+	XMFLOAT4(-1.f, 0.f, 0.f, GuardBand),
+	XMFLOAT4(0.f, 1.f, 0.f, GuardBand),
+	XMFLOAT4(0.f, -1.f, 0.f, GuardBand),
+};
+static const int NumClipPlanes = sizeof(ClipPlanes) / sizeof(ClipPlanes[0]);
+static const int MaxClipVertices = 3 + NumClipPlanes;
+
+static float ClipDistance(const XMFLOAT4& plane, const XMFLOAT4& v)
+{
+	return plane.x * v.x + plane.y * v.y + plane.z * v.z + plane.w * v.w;
+}
+
+void OcclusionCuller::SetupTriangles(uint32_t firstTriangle, uint32_t lastTriangle, ThreadBins& bins) const
+{
+	// Occluder owning firstTriangle
+	auto it = std::upper_bound(m_occluders.begin(), m_occluders.end(), firstTriangle,
+		[](uint32_t triangle, const Occluder& occluder) { return triangle < occluder.firstTriangle; });
+	size_t occluderIndex = static_cast<size_t>(it - m_occluders.begin()) - 1;
+
+	for (uint32_t triangle = firstTriangle; triangle < lastTriangle; ++triangle)
+	{
+		while (occluderIndex + 1 < m_occluders.size() && triangle >= m_occluders[occluderIndex + 1].firstTriangle)
+		{
+			++occluderIndex;
+		}
+		const Occluder& occluder = m_occluders[occluderIndex];
+		const uint32_t* tri = occluder.indices + (triangle - occluder.firstTriangle) * 3;
+
+		XMFLOAT4 clip[3];
+		for (int i = 0; i < 3; ++i)
+		{
+			const XMFLOAT3& p = *reinterpret_cast<const XMFLOAT3*>(occluder.positions + size_t(tri[i]) * occluder.positionStride);
+			clip[i] = TransformPoint(p, occluder.worldViewProj);
+		}
+
+		// Trivial reject, all vertices outside the same plane
+		if ((clip[0].x > clip[0].w && clip[1].x > clip[1].w && clip[2].x > clip[2].w) ||
+			(clip[0].x < -clip[0].w && clip[1].x < -clip[1].w && clip[2].x < -clip[2].w) ||
+			(clip[0].y > clip[0].w && clip[1].y > clip[1].w && clip[2].y > clip[2].w) ||
+			(clip[0].y < -clip[0].w && clip[1].y < -clip[1].w && clip[2].y < -clip[2].w) ||
+			(clip[0].z > clip[0].w && clip[1].z > clip[1].w && clip[2].z > clip[2].w) ||
+			(clip[0].z < 0.f && clip[1].z < 0.f && clip[2].z < 0.f))
+			continue;
+
+		uint32_t outsidePlanes = 0;
+		for (int plane = 0; plane < NumClipPlanes; ++plane)
+		{
+			for (int i = 0; i < 3; ++i)
+			{
+				outsidePlanes |= (ClipDistance(ClipPlanes[plane], clip[i]) < 0.f) ? (1u << plane) : 0u;
+			}
+		}
+		if (outsidePlanes == 0)
+		{
+			EmitTriangle(clip, bins);
+			continue;
+		}
+
+		// Clip against the crossed planes only, every plane adds at most one vertex
+		XMFLOAT4 poly[2][MaxClipVertices];
+		int numPoly = 3;
+		int src = 0;
+		std::copy(clip, clip + 3, poly[src]);
+		for (int plane = 0; plane < NumClipPlanes && numPoly >= 3; ++plane)
+		{
+			if ((outsidePlanes & (1u << plane)) == 0)
+				continue;
+
+			int numOut = 0;
+			for (int i = 0; i < numPoly; ++i)
+			{
+				const XMFLOAT4& a = poly[src][i];
+				const XMFLOAT4& b = poly[src][(i + 1) % numPoly];
+				const float da = ClipDistance(ClipPlanes[plane], a);
+				const float db = ClipDistance(ClipPlanes[plane], b);
+				if (da >= 0.f)
+					poly[src ^ 1][numOut++] = a;
+				if ((da >= 0.f) != (db >= 0.f))
+					poly[src ^ 1][numOut++] = LerpClip(a, b, da / (da - db));
+			}
+			src ^= 1;
+			numPoly = numOut;
+		}
+		for (int i = 1; i + 1 < numPoly; ++i)
+		{
+			const XMFLOAT4 fan[3] = { poly[src][0], poly[src][i], poly[src][i + 1] };
+			EmitTriangle(fan, bins);
+		}
+	}
+}
+
+void OcclusionCuller::EmitTriangle(const XMFLOAT4* clip, ThreadBins& bins) const
+{
+	const float width = static_cast<float>(m_init.width);
+	const float height = static_cast<float>(m_init.height);
+
+	ScreenTriangle tri;
+	float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+	for (int i = 0; i < 3; ++i)
+	{
+		const float invW = 1.f / clip[i].w;
+		tri.v[i].x = (clip[i].x * invW * 0.5f + 0.5f) * width;
+		tri.v[i].y = (0.5f - clip[i].y * invW * 0.5f) * height;
+		tri.v[i].z = std::min(std::max(clip[i].z * invW, 0.f), 1.f);
+		minX = std::min(minX, tri.v[i].x);
+		minY = std::min(minY, tri.v[i].y);
+		maxX = std::max(maxX, tri.v[i].x);
+		maxY = std::max(maxY, tri.v[i].y);
+	}
+
+	const float area = (tri.v[1].x - tri.v[0].x) * (tri.v[2].y - tri.v[0].y) - (tri.v[2].x - tri.v[0].x) * (tri.v[1].y - tri.v[0].y);
+	if (fabsf(area) < 1e-6f)
+		return;
+
+	const int pixelMinX = std::max(static_cast<int>(floorf(minX)), 0);
+	const int pixelMinY = std::max(static_cast<int>(floorf(minY)), 0);
+	const int pixelMaxX = std::min(static_cast<int>(ceilf(maxX)), static_cast<int>(m_init.width)) - 1;
+	const int pixelMaxY = std::min(static_cast<int>(ceilf(maxY)), static_cast<int>(m_init.height)) - 1;
+	if (pixelMinX > pixelMaxX || pixelMinY > pixelMaxY)
+		return;
+
+	const uint32_t triangleIndex = static_cast<uint32_t>(bins.triangles.size());
+	bins.triangles.push_back(tri);
+	for (uint32_t tileY = pixelMinY / TileHeight; tileY <= pixelMaxY / TileHeight; ++tileY)
+	{
+		for (uint32_t tileX = pixelMinX / TileWidth; tileX <= pixelMaxX / TileWidth; ++tileX)
+		{
+			bins.tiles[tileY * m_tilesX + tileX].push_back(triangleIndex);
+		}
+	}
+}
+
+//
+// Raster, one job per tile, no shared writes
+//
+void OcclusionCuller::RasterizeTriangle(const ScreenTriangle& tri, uint32_t tileX, uint32_t tileY)
+{
+	XMFLOAT3 v0 = tri.v[0], v1 = tri.v[1], v2 = tri.v[2];
+	float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+
+	// No backface culling, both windings rasterize the same
+	if (area < 0.f)
+	{
+		std::swap(v1, v2);
+		area = -area;
+	}
+
+	// Edge function a -> b, inside is >= 0, as A * x + B * y + C
+	// Pixel centers like the GPU, testing whole pixels would crack along shared edges
+	auto setupEdge = [](const XMFLOAT3& a, const XMFLOAT3& b, float& A, float& B, float& C)
+	{
+		A = a.y - b.y;
+		B = b.x - a.x;
+		C = -(A * a.x + B * a.y);
+	};
+	float A0, B0, C0, A1, B1, C1, A2, B2, C2;
+	setupEdge(v1, v2, A0, B0, C0);
+	setupEdge(v2, v0, A1, B1, C1);
+	setupEdge(v0, v1, A2, B2, C2);
+
+	// Depth plane, farthest value over the pixel footprint
+	const float invArea = 1.f / area;
+	const float dzdx = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) * invArea;
+	const float dzdy = ((v1.x - v0.x) * (v2.z - v0.z) - (v2.x - v0.x) * (v1.z - v0.z)) * invArea;
+	const float Cz = v0.z - dzdx * v0.x - dzdy * v0.y + 0.5f * (fabsf(dzdx) + fabsf(dzdy));
+	const float maxZ = std::max(v0.z, std::max(v1.z, v2.z));
+
+	// Tile rect intersected with triangle bounds, x aligned to 4 (tile width is a multiple of 4)
+	const int tileMinX = static_cast<int>(tileX * TileWidth);
+	const int tileMinY = static_cast<int>(tileY * TileHeight);
+	int minX = std::max(static_cast<int>(floorf(std::min(v0.x, std::min(v1.x, v2.x)))), tileMinX) & ~3;
+	int minY = std::max(static_cast<int>(floorf(std::min(v0.y, std::min(v1.y, v2.y)))), tileMinY);
+	int maxX = std::min(static_cast<int>(ceilf(std::max(v0.x, std::max(v1.x, v2.x)))), tileMinX + static_cast<int>(TileWidth));
+	int maxY = std::min(static_cast<int>(ceilf(std::max(v0.y, std::max(v1.y, v2.y)))), tileMinY + static_cast<int>(TileHeight));
+	minX = std::max(minX, tileMinX);
+
+	const __m128 laneOffset = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 maxZ4 = _mm_set1_ps(maxZ);
+	const __m128 A0v = _mm_set1_ps(A0), A1v = _mm_set1_ps(A1), A2v = _mm_set1_ps(A2), Azv = _mm_set1_ps(dzdx);
+
+	for (int y = minY; y < maxY; ++y)
+	{
+		const float fy = static_cast<float>(y) + 0.5f;
+		const __m128 row0 = _mm_set1_ps(B0 * fy + C0);
+		const __m128 row1 = _mm_set1_ps(B1 * fy + C1);
+		const __m128 row2 = _mm_set1_ps(B2 * fy + C2);
+		const __m128 rowZ = _mm_set1_ps(dzdy * fy + Cz);
+
+		float* depthRow = &m_depth[static_cast<size_t>(y) * m_init.width];
+		for (int x = minX; x < maxX; x += 4)
+		{
+			const __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), laneOffset);
+			const __m128 e0 = _mm_add_ps(_mm_mul_ps(A0v, px), row0);
+			const __m128 e1 = _mm_add_ps(_mm_mul_ps(A1v, px), row1);
+			const __m128 e2 = _mm_add_ps(_mm_mul_ps(A2v, px), row2);
+			const __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+			if (_mm_movemask_ps(inside) == 0)
+				continue;
+
+			const __m128 z = _mm_min_ps(_mm_add_ps(_mm_mul_ps(Azv, px), rowZ), maxZ4);
+			const __m128 depth = _mm_loadu_ps(depthRow + x);
+			const __m128 closer = _mm_min_ps(depth, z);
+			_mm_storeu_ps(depthRow + x, _mm_or_ps(_mm_and_ps(inside, closer), _mm_andnot_ps(inside, depth)));
+		}
+	}
+}
+
+void OcclusionCuller::RasterizeTile(uint32_t tileIndex)
+{
+	const uint32_t tileX = tileIndex % m_tilesX;
+	const uint32_t tileY = tileIndex / m_tilesX;
+
+	for (const ThreadBins& bins : m_threadBins)
+	{
+		for (uint32_t triangleIndex : bins.tiles[tileIndex])
+		{
+			RasterizeTriangle(bins.triangles[triangleIndex], tileX, tileY);
+		}
+	}
+
+	float maxDepth = 0.f;
+	for (uint32_t y = 0; y < TileHeight; ++y)
+	{
+		const float* depthRow = &m_depth[static_cast<size_t>(tileY * TileHeight + y) * m_init.width + tileX * TileWidth];
+		for (uint32_t x = 0; x < TileWidth; ++x)
+		{
+			maxDepth = std::max(maxDepth, depthRow[x]);
+		}
+	}
+	m_tileMaxDepth[tileIndex] = maxDepth;
+}
+
+void OcclusionCuller::RasterizeOccluders(JobSystem& jobs)
+{
+	auto start = TimerClock::now();
+
+	const uint32_t numTiles = m_tilesX * m_tilesY;
+	m_threadBins.resize(jobs.NumThreads());
+	for (ThreadBins& bins : m_threadBins)
+	{
+		bins.triangles.clear();
+		bins.tiles.resize(numTiles);
+		for (std::vector<uint32_t>& tile : bins.tiles)
+		{
+			tile.clear();
+		}
+	}
+
+	jobs.ParallelFor(m_numTriangles, 1024, [&](uint32_t begin, uint32_t end, uint32_t threadIndex)
+	{
+		SetupTriangles(begin, end, m_threadBins[threadIndex]);
+	});
+
+	m_stats.numRasterTriangles = 0;
+	for (const ThreadBins& bins : m_threadBins)
+	{
+		m_stats.numRasterTriangles += static_cast<uint32_t>(bins.triangles.size());
+	}
+
+	jobs.ParallelFor(numTiles, 1, [&](uint32_t begin, uint32_t end, uint32_t)
+	{
+		for (uint32_t tileIndex = begin; tileIndex < end; ++tileIndex)
+		{
+			RasterizeTile(tileIndex);
+		}
+	});
+
+	m_stats.rasterMs = ElapsedMs(start);
+}
+
+//
+// Test
+//
+bool OcclusionCuller::IsVisible(const XMFLOAT3& center, const XMFLOAT3& extents) const
+{
+	const float width = static_cast<float>(m_init.width);
+	const float height = static_cast<float>(m_init.height);
+
+	float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, minZ = FLT_MAX;
+	for (int i = 0; i < 8; ++i)
+	{
+		const XMFLOAT3 corner(
+			center.x + ((i & 1) ? extents.x : -extents.x),
+			center.y + ((i & 2) ? extents.y : -extents.y),
+			center.z + ((i & 4) ? extents.z : -extents.z));
+		const XMFLOAT4 clip = TransformPoint(corner, m_viewProj);
+		if (clip.z < 0.f)
+			return true;
+
+		const float invW = 1.f / clip.w;
+		const float x = (clip.x * invW * 0.5f + 0.5f) * width;
+		const float y = (0.5f - clip.y * invW * 0.5f) * height;
+		minX = std::min(minX, x);
+		minY = std::min(minY, y);
+		maxX = std::max(maxX, x);
+		maxY = std::max(maxY, y);
+		minZ = std::min(minZ, clip.z * invW);
+	}
+
+	// Every pixel the screen rect touches, clamped first since corners near w = 0 project anywhere
+	minX = std::min(std::max(minX, -1.f), width);
+	minY = std::min(std::max(minY, -1.f), height);
+	maxX = std::min(std::max(maxX, -1.f), width);
+	maxY = std::min(std::max(maxY, -1.f), height);
+	const int pixelMinX = std::max(static_cast<int>(floorf(minX)), 0);
+	const int pixelMinY = std::max(static_cast<int>(floorf(minY)), 0);
+	const int pixelMaxX = std::min(static_cast<int>(floorf(maxX)), static_cast<int>(m_init.width) - 1);
+	const int pixelMaxY = std::min(static_cast<int>(floorf(maxY)), static_cast<int>(m_init.height) - 1);
+	if (pixelMinX > pixelMaxX || pixelMinY > pixelMaxY)
+		return true;
+
+	// Whole rect behind the farthest occluder depth of its tiles
+	bool tilesOccluded = true;
+	for (int tileY = pixelMinY / static_cast<int>(TileHeight); tileY <= pixelMaxY / static_cast<int>(TileHeight) && tilesOccluded; ++tileY)
+	{
+		for (int tileX = pixelMinX / static_cast<int>(TileWidth); tileX <= pixelMaxX / static_cast<int>(TileWidth); ++tileX)
+		{
+			if (m_tileMaxDepth[tileY * m_tilesX + tileX] >= minZ)
+			{
+				tilesOccluded = false;
+				break;
+			}
+		}
+	}
+	if (tilesOccluded)
+		return false;
+
+	for (int y = pixelMinY; y <= pixelMaxY; ++y)
+	{
+		const float* depthRow = &m_depth[static_cast<size_t>(y) * m_init.width];
+		for (int x = pixelMinX; x <= pixelMaxX; ++x)
+		{
+			if (depthRow[x] >= minZ)
+				return true;
+		}
+	}
+	return false;
+}
+
+uint32_t OcclusionCuller::CullBounds(JobSystem& jobs, const BoundsSoA& bounds, const uint32_t* indices, uint32_t count, uint32_t* outIndices)
+{
+	auto start = TimerClock::now();
+
+	m_visible.resize(count);
+	jobs.ParallelFor(count, 256, [&](uint32_t begin, uint32_t end, uint32_t)
+	{
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			const uint32_t index = indices[i];
+			const XMFLOAT3 center(bounds.centerX[index], bounds.centerY[index], bounds.centerZ[index]);
+			const XMFLOAT3 extents(bounds.extentX[index], bounds.extentY[index], bounds.extentZ[index]);
+			m_visible[i] = IsVisible(center, extents) ? 1 : 0;
+		}
+	});
+
+	uint32_t numVisible = 0;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		if (m_visible[i])
+			outIndices[numVisible++] = indices[i];
+	}
+
+	m_stats.testMs += ElapsedMs(start);
+	m_stats.numTested += count;
+	m_stats.numOccluded += count - numVisible;
+	return numVisible;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "Culling.h"
+#include "JobSystem.h"
+
+// Software occlusion culling (no D3D dependency)
+// Occluder triangles are rasterized into a small depth buffer split in tiles, one job per tile,
+// then instance bounds are tested against it. Depth is D3D convention, 0 near, 1 far.
+
+struct OcclusionCullingInit
+{
+	uint32_t width = 256;	// Multiple of TileWidth
+	uint32_t height = 128;	// Multiple of TileHeight
+	uint32_t maxOccluderTriangles = 64 * 1024;
+};
+
+struct OcclusionCullingStats
+{
+	uint32_t numOccluders = 0;
+	uint32_t numOccluderTriangles = 0;	// Submitted
+	uint32_t numRasterTriangles = 0;	// After clipping and trivial reject
+	uint32_t numTested = 0;
+	uint32_t numOccluded = 0;
+	double rasterMs = 0.0;
+	double testMs = 0.0;
+};
+
+class OcclusionCuller
+{
+public:
+	static const uint32_t TileWidth = 32;
+	static const uint32_t TileHeight = 16;
+
+	void Initialize(const OcclusionCullingInit& init);
+	void Shutdown();
+
+	// Clears occluders and depth, viewProj is row vector convention (world * view * proj)
+	void BeginFrame(DirectX::FXMMATRIX viewProj);
+
+	// Positions are read with a byte stride until RasterizeOccluders, returns false over budget
+	bool AddOccluder(
+		const DirectX::XMFLOAT3* positions,
+		uint32_t positionStride,
+		const uint32_t* indices,
+		uint32_t numIndices,
+		DirectX::FXMMATRIX world);
+
+	uint32_t RemainingTriangleBudget() const { return m_init.maxOccluderTriangles - m_numTriangles; }
+
+	void RasterizeOccluders(JobSystem& jobs);
+
+	// Box crossing the near plane is always visible
+	bool IsVisible(const DirectX::XMFLOAT3& center, const DirectX::XMFLOAT3& extents) const;
+
+	// Keep visible entries of indices (into bounds), order preserved, outIndices may alias indices
+	uint32_t CullBounds(JobSystem& jobs, const BoundsSoA& bounds, const uint32_t* indices, uint32_t count, uint32_t* outIndices);
+
+	uint32_t Width() const { return m_init.width; }
+	uint32_t Height() const { return m_init.height; }
+	const std::vector<float>& Depth() const { return m_depth; }
+	const OcclusionCullingStats& Stats() const { return m_stats; }
+
+private:
+	struct Occluder
+	{
+		DirectX::XMFLOAT4X4 worldViewProj;
+		const uint8_t* positions;
+		uint32_t positionStride;
+		const uint32_t* indices;
+		uint32_t firstTriangle;	// Prefix over occluders
+	};
+
+	// Screen space, x and y in pixels, z in [0, 1]
+	struct ScreenTriangle
+	{
+		DirectX::XMFLOAT3 v[3];
+	};
+
+	// Per thread setup output, bins hold indices into triangles
+	struct ThreadBins
+	{
+		std::vector<ScreenTriangle> triangles;
+		std::vector<std::vector<uint32_t>> tiles;
+	};
+
+	void SetupTriangles(uint32_t firstTriangle, uint32_t lastTriangle, ThreadBins& bins) const;
+	void EmitTriangle(const DirectX::XMFLOAT4* clip, ThreadBins& bins) const;
+	void RasterizeTile(uint32_t tileIndex);
+	void RasterizeTriangle(const ScreenTriangle& tri, uint32_t tileX, uint32_t tileY);
+
+	OcclusionCullingInit m_init;
+	DirectX::XMFLOAT4X4 m_viewProj;
+	uint32_t m_tilesX = 0;
+	uint32_t m_tilesY = 0;
+
+	std::vector<Occluder> m_occluders;
+	uint32_t m_numTriangles = 0;
+	std::vector<ThreadBins> m_threadBins;
+
+	std::vector<float> m_depth;			// Row major, width x height
+	std::vector<float> m_tileMaxDepth;	// Farthest depth per tile, quick reject
+	std::vector<uint8_t> m_visible;		// CullBounds scratch
+
+	OcclusionCullingStats m_stats;
+};
@@ -37,6 +37,8 @@
 #include <iostream>
 #include <filesystem>
 #include <algorithm>
+#include <unordered_map>
+#include <chrono>
 
 // SDL
 #include <SDL.h>
@@ -0,0 +1,1249 @@
+#include "PathTracer.h"
+#include "Utility.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+
+using namespace DirectX;
+
+namespace
+{
+	const float Pi = 3.14159265f;
+	const uint32_t MaxCutOutSkips = 16;		// Alpha tested surfaces a ray passes through, then it stops
+	const uint32_t WavefrontChunkSize = 64;		// Paths per job of a wavefront stage
+	const uint32_t SortChunkSize = 4096;		// Queue entries counted per job
+	const uint32_t MaxShadowRays = 3;			// Sun, sky and an emissive triangle per hit
+
+	// Tile range of a worker, begin in the low half. The owner takes from the front, thieves from the
+	// back, both with compare exchange so a tile is rendered once
+	struct alignas(64) TileQueue
+	{
+		std::atomic<uint64_t> range{ 0 };
+	};
+
+	// Directional light and sky, from LightData
+	struct Lighting
+	{
+		XMFLOAT3 toSun;
+		XMFLOAT3 sunIrradiance;
+		float sunCosRadius;		// 1 for a delta light
+		float sunSolidAngle;	// 0 for a delta light
+		XMFLOAT3 sky;
+	};
+
+	// Shading point in world space, normals face the incoming ray
+	struct Surface
+	{
+		XMFLOAT3 position;
+		XMFLOAT3 geometricNormal;
+		XMFLOAT3 normal;
+		XMFLOAT3 baseColor;
+		float metallic;
+		float roughness;
+		XMFLOAT3 emission;
+	};
+
+	// PCG32, one sequence per pixel sample
+	struct Random
+	{
+		uint64_t state;
+
+		uint32_t NextUint()
+		{
+			const uint64_t old = state;
+			state = old * 6364136223846793005ull + 1442695040888963407ull;
+			const uint32_t xorShifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+			const uint32_t rotation = static_cast<uint32_t>(old >> 59);
+			return (xorShifted >> rotation) | (xorShifted << ((32 - rotation) & 31));
+		}
+
+		// [0, 1)
+		float Next() { return (NextUint() >> 8) * (1.f / 16777216.f); }
+	};
+
+	// Camera path between bounces
+	struct PathState
+	{
+		BVHRay ray;
+		XMFLOAT3 throughput;
+		XMFLOAT3 radiance;
+		Random random;
+		float bsdfPdf;			// Of ray's direction for MIS, 0 from the camera
+		XMFLOAT3 bsdfNormal;	// Shading normal ray left from
+	};
+
+	// Light samples of a shaded hit, each added to the path's radiance when unoccluded
+	struct ShadowRays
+	{
+		BVHRay rays[MaxShadowRays];
+		XMFLOAT3 contributions[MaxShadowRays];
+		uint32_t count;
+	};
+
+	// sRGB to linear of every 8 bit value
+	struct SrgbTable
+	{
+		float linear[256];
+
+		SrgbTable()
+		{
+			for (int i = 0; i < 256; ++i)
+			{
+				const float c = i / 255.f;
+				linear[i] = (c <= 0.04045f) ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+			}
+		}
+	};
+}
+
+static XMFLOAT3 Add(const XMFLOAT3& a, const XMFLOAT3& b) { return XMFLOAT3(a.x + b.x, a.y + b.y, a.z + b.z); }
+static XMFLOAT3 Sub(const XMFLOAT3& a, const XMFLOAT3& b) { return XMFLOAT3(a.x - b.x, a.y - b.y, a.z - b.z); }
+static XMFLOAT3 Mul(const XMFLOAT3& a, const XMFLOAT3& b) { return XMFLOAT3(a.x * b.x, a.y * b.y, a.z * b.z); }
+static XMFLOAT3 Scale(const XMFLOAT3& a, float s) { return XMFLOAT3(a.x * s, a.y * s, a.z * s); }
+static float Dot(const XMFLOAT3& a, const XMFLOAT3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+static XMFLOAT3 Cross(const XMFLOAT3& a, const XMFLOAT3& b) { return XMFLOAT3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x); }
+static float Luminance(const XMFLOAT3& c) { return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z; }
+
+// Zero stays zero
+static XMFLOAT3 Normalize(const XMFLOAT3& v)
+{
+	const float length = sqrtf(Dot(v, v));
+	return (length > 0.f) ? Scale(v, 1.f / length) : v;
+}
+
+// Rows of a 3x4, column vectors
+static XMFLOAT3 TransformVector(const XMFLOAT3X4& m, const XMFLOAT3& v)
+{
+	return XMFLOAT3(
+		m.m[0][0] * v.x + m.m[0][1] * v.y + m.m[0][2] * v.z,
+		m.m[1][0] * v.x + m.m[1][1] * v.y + m.m[1][2] * v.z,
+		m.m[2][0] * v.x + m.m[2][1] * v.y + m.m[2][2] * v.z);
+}
+
+static XMFLOAT3 TransformPoint(const XMFLOAT3X4& m, const XMFLOAT3& p)
+{
+	return Add(TransformVector(m, p), XMFLOAT3(m.m[0][3], m.m[1][3], m.m[2][3]));
+}
+
+// det * inverse transpose, cross products of transformed edges are the cofactor times the object
+// space cross product, so shading and geometric normals stay on the same side under mirroring
+static XMFLOAT3X4 CofactorTransform(const XMFLOAT3X4& m)
+{
+	XMFLOAT3X4 c;
+	c.m[0][0] = m.m[1][1] * m.m[2][2] - m.m[1][2] * m.m[2][1];
+	c.m[0][1] = m.m[1][2] * m.m[2][0] - m.m[1][0] * m.m[2][2];
+	c.m[0][2] = m.m[1][0] * m.m[2][1] - m.m[1][1] * m.m[2][0];
+	c.m[1][0] = m.m[0][2] * m.m[2][1] - m.m[0][1] * m.m[2][2];
+	c.m[1][1] = m.m[0][0] * m.m[2][2] - m.m[0][2] * m.m[2][0];
+	c.m[1][2] = m.m[0][1] * m.m[2][0] - m.m[0][0] * m.m[2][1];
+	c.m[2][0] = m.m[0][1] * m.m[1][2] - m.m[0][2] * m.m[1][1];
+	c.m[2][1] = m.m[0][2] * m.m[1][0] - m.m[0][0] * m.m[1][2];
+	c.m[2][2] = m.m[0][0] * m.m[1][1] - m.m[0][1] * m.m[1][0];
+	c.m[0][3] = c.m[1][3] = c.m[2][3] = 0.f;
+	return c;
+}
+
+//
+// Scene
+//
+
+void PathTracerScene::Build(JobSystem& jobs)
+{
+	for (PathTracerMesh& mesh : meshes)
+	{
+		TriangleMesh triangles;
+		triangles.positions = mesh.vertices.data();	// Position is the first member
+		triangles.positionStride = sizeof(MeshVertex);
+		triangles.indices = mesh.indices.data();
+		triangles.numTriangles = static_cast<uint32_t>(mesh.indices.size() / 3);
+		mesh.bvh.BuildSAH(jobs, triangles);
+	}
+
+	// Instances of empty meshes are left out, hits are numbered in the TLAS
+	std::vector<BVHInstance> tlasInstances;
+	normalTransforms.clear();
+	XMFLOAT3 sceneMin(FLT_MAX, FLT_MAX, FLT_MAX), sceneMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (BVHInstance& instance : instances)
+	{
+		instance.blas = &meshes[instance.instanceID].bvh;
+		if (instance.blas->IsEmpty())
+			continue;
+
+		tlasInstances.push_back(instance);
+		normalTransforms.push_back(CofactorTransform(instance.transform));
+
+		const TriangleBVHNode& root = instance.blas->Nodes()[0];
+		for (int corner = 0; corner < 8; ++corner)
+		{
+			const XMFLOAT3 p(
+				(corner & 1) ? root.boundsMax.x : root.boundsMin.x,
+				(corner & 2) ? root.boundsMax.y : root.boundsMin.y,
+				(corner & 4) ? root.boundsMax.z : root.boundsMin.z);
+			const XMFLOAT3 world = TransformPoint(instance.transform, p);
+			sceneMin = XMFLOAT3(std::min(sceneMin.x, world.x), std::min(sceneMin.y, world.y), std::min(sceneMin.z, world.z));
+			sceneMax = XMFLOAT3(std::max(sceneMax.x, world.x), std::max(sceneMax.y, world.y), std::max(sceneMax.z, world.z));
+		}
+	}
+	tlas.Build(tlasInstances);
+
+	// Emissive triangles of every instance, texture emission isn't part of the power
+	emitters.clear();
+	emitterCdf.clear();
+	emitterPower = 0.f;
+	for (uint32_t instanceIndex = 0; instanceIndex < tlasInstances.size(); ++instanceIndex)
+	{
+		const BVHInstance& instance = tlasInstances[instanceIndex];
+		const PathTracerMesh& mesh = meshes[instance.instanceID];
+		if (mesh.materialIndex < 0 || mesh.materialIndex >= static_cast<int>(materials.size()))
+			continue;
+		const float luminance = Luminance(materials[mesh.materialIndex].emissiveFactor);
+		if (luminance <= 0.f)
+			continue;
+
+		for (uint32_t triangle = 0; triangle < mesh.indices.size() / 3; ++triangle)
+		{
+			Emitter emitter;
+			emitter.p0 = TransformPoint(instance.transform, mesh.vertices[mesh.indices[triangle * 3 + 0]].Position);
+			emitter.e1 = Sub(TransformPoint(instance.transform, mesh.vertices[mesh.indices[triangle * 3 + 1]].Position), emitter.p0);
+			emitter.e2 = Sub(TransformPoint(instance.transform, mesh.vertices[mesh.indices[triangle * 3 + 2]].Position), emitter.p0);
+			emitter.instance = instanceIndex;
+			emitter.triangle = triangle;
+			const XMFLOAT3 normal = Cross(emitter.e1, emitter.e2);
+			const float area = 0.5f * sqrtf(Dot(normal, normal));
+			if (area <= 0.f)
+				continue;
+
+			emitterPower += luminance * area;
+			emitters.push_back(emitter);
+			emitterCdf.push_back(emitterPower);
+		}
+	}
+	for (float& cdf : emitterCdf)
+	{
+		cdf /= emitterPower;
+	}
+
+	const XMFLOAT3 size = tlasInstances.empty() ? XMFLOAT3(1.f, 1.f, 1.f) : Sub(sceneMax, sceneMin);
+	rayOffset = 1e-5f * std::max(sqrtf(Dot(size, size)), 1e-3f);
+}
+
+//
+// Materials
+//
+
+static const PathTracerImage* TextureImage(const PathTracerScene& scene, int textureIndex)
+{
+	if (textureIndex < 0 || textureIndex >= static_cast<int>(scene.textures.size()))
+		return nullptr;
+	const int imageIndex = scene.textures[textureIndex];
+	if (imageIndex < 0 || imageIndex >= static_cast<int>(scene.images.size()) || scene.images[imageIndex].texels.empty())
+		return nullptr;
+	return &scene.images[imageIndex];
+}
+
+// Bilinear, wrap. srgb decodes rgb before filtering, alpha is always linear
+static XMFLOAT4 SampleImage(const PathTracerImage& image, const XMFLOAT2& uv, bool srgb)
+{
+	static const SrgbTable table;
+	const float x = uv.x * image.width - 0.5f;
+	const float y = uv.y * image.height - 0.5f;
+	const float x0 = floorf(x), y0 = floorf(y);
+	const float fx = x - x0, fy = y - y0;
+	auto wrap = [](float i, uint32_t size)
+	{
+		const int64_t n = static_cast<int64_t>(i) % static_cast<int64_t>(size);
+		return static_cast<uint32_t>(n < 0 ? n + size : n);
+	};
+	const uint32_t xs[2] = { wrap(x0, image.width), wrap(x0 + 1.f, image.width) };
+	const uint32_t ys[2] = { wrap(y0, image.height), wrap(y0 + 1.f, image.height) };
+
+	float result[4] = {};
+	for (int j = 0; j < 2; ++j)
+	{
+		for (int i = 0; i < 2; ++i)
+		{
+			const float weight = (i ? fx : 1.f - fx) * (j ? fy : 1.f - fy);
+			const uint8_t* texel = &image.texels[(static_cast<size_t>(ys[j]) * image.width + xs[i]) * 4];
+			for (int c = 0; c < 4; ++c)
+			{
+				const float value = (srgb && c < 3) ? table.linear[texel[c]] : texel[c] / 255.f;
+				result[c] += weight * value;
+			}
+		}
+	}
+	return XMFLOAT4(result[0], result[1], result[2], result[3]);
+}
+
+static const MaterialData& GetMaterial(const PathTracerScene& scene, const PathTracerMesh& mesh)
+{
+	static const MaterialData defaultMaterial = { XMFLOAT4(1.f, 1.f, 1.f, 1.f), 0.f, 1.f, -1, -1, -1, 1.f, -1, -1, -1, XMFLOAT3(0.f, 0.f, 0.f), -1 };
+	return (mesh.materialIndex >= 0 && mesh.materialIndex < static_cast<int>(scene.materials.size())) ? scene.materials[mesh.materialIndex] : defaultMaterial;
+}
+
+// Emissive factor times the sRGB emissive texture
+static XMFLOAT3 GetEmission(const PathTracerScene& scene, const MaterialData& material, const XMFLOAT2& uv)
+{
+	XMFLOAT3 emission = material.emissiveFactor;
+	if (Luminance(emission) > 0.f)
+	{
+		if (const PathTracerImage* image = TextureImage(scene, material.emissiveTextureIndex))
+		{
+			const XMFLOAT4 texel = SampleImage(*image, uv, true);
+			emission = Mul(emission, XMFLOAT3(texel.x, texel.y, texel.z));
+		}
+	}
+	return emission;
+}
+
+// Area density of picking a point of this material's triangles by power, see PathTracerScene::Build
+static float EmitterAreaPdf(const PathTracerScene& scene, const MaterialData& material)
+{
+	return (scene.emitterPower > 0.f) ? Luminance(material.emissiveFactor) / scene.emitterPower : 0.f;
+}
+
+static XMFLOAT2 HitUV(const PathTracerMesh& mesh, const BVHHit& hit)
+{
+	const uint32_t* triangle = &mesh.indices[hit.triangle * 3];
+	const XMFLOAT2& a = mesh.vertices[triangle[0]].Uv;
+	const XMFLOAT2& b = mesh.vertices[triangle[1]].Uv;
+	const XMFLOAT2& c = mesh.vertices[triangle[2]].Uv;
+	const float w = 1.f - hit.u - hit.v;
+	return XMFLOAT2(a.x * w + b.x * hit.u + c.x * hit.v, a.y * w + b.y * hit.u + c.y * hit.v);
+}
+
+// Alpha below the cutoff of an alpha tested material
+static bool IsCutOut(const PathTracerScene& scene, const BVHHit& hit)
+{
+	const PathTracerMesh& mesh = scene.meshes[scene.tlas.Instance(hit.instance).instanceID];
+	const MaterialData& material = GetMaterial(scene, mesh);
+	if (material.alphaCutoff >= 1.f)
+		return false;
+
+	float alpha = material.baseColorFactor.w;
+	if (const PathTracerImage* image = TextureImage(scene, material.albedoTextureIndex))
+	{
+		alpha *= SampleImage(*image, HitUV(mesh, hit), false).w;
+	}
+	return alpha < material.alphaCutoff;
+}
+
+static void GetSurface(const PathTracerScene& scene, const BVHRay& ray, const BVHHit& hit, Surface& surface)
+{
+	const BVHInstance& instance = scene.tlas.Instance(hit.instance);
+	const XMFLOAT3X4& normalTransform = scene.normalTransforms[hit.instance];
+	const PathTracerMesh& mesh = scene.meshes[instance.instanceID];
+	const MaterialData& material = GetMaterial(scene, mesh);
+	const uint32_t* triangle = &mesh.indices[hit.triangle * 3];
+	const MeshVertex& a = mesh.vertices[triangle[0]];
+	const MeshVertex& b = mesh.vertices[triangle[1]];
+	const MeshVertex& c = mesh.vertices[triangle[2]];
+	const float w = 1.f - hit.u - hit.v;
+
+	surface.position = Add(ray.origin, Scale(ray.direction, hit.t));
+	const XMFLOAT3 e1 = Sub(b.Position, a.Position);
+	const XMFLOAT3 e2 = Sub(c.Position, a.Position);
+	XMFLOAT3 geometricNormal = Normalize(TransformVector(normalTransform, Cross(e1, e2)));
+	const XMFLOAT3 objectNormal = Add(Add(Scale(a.Normal, w), Scale(b.Normal, hit.u)), Scale(c.Normal, hit.v));
+	XMFLOAT3 normal = Normalize(TransformVector(normalTransform, objectNormal));
+	if (Dot(normal, normal) == 0.f)
+	{
+		normal = geometricNormal;
+	}
+
+	const XMFLOAT2 uv = HitUV(mesh, hit);
+	if (const PathTracerImage* image = TextureImage(scene, material.normalTextureIndex))
+	{
+		// Tangent frame of the vertices, or of the triangle's UV gradient (no Mikktspace on the CPU)
+		XMFLOAT3 tangent, bitangent;
+		float handedness = 1.f;
+		if (mesh.hasTangent)
+		{
+			tangent = XMFLOAT3(
+				a.Tangent.x * w + b.Tangent.x * hit.u + c.Tangent.x * hit.v,
+				a.Tangent.y * w + b.Tangent.y * hit.u + c.Tangent.y * hit.v,
+				a.Tangent.z * w + b.Tangent.z * hit.u + c.Tangent.z * hit.v);
+			handedness = (a.Tangent.w < 0.f) ? -1.f : 1.f;
+		}
+		else
+		{
+			const XMFLOAT2 duv1(b.Uv.x - a.Uv.x, b.Uv.y - a.Uv.y);
+			const XMFLOAT2 duv2(c.Uv.x - a.Uv.x, c.Uv.y - a.Uv.y);
+			tangent = Sub(Scale(e1, duv2.y), Scale(e2, duv1.y));
+			bitangent = Sub(Scale(e2, duv1.x), Scale(e1, duv2.x));
+			const float det = duv1.x * duv2.y - duv1.y * duv2.x;
+			handedness = (det < 0.f) ? -1.f : 1.f;
+		}
+		tangent = TransformVector(instance.transform, tangent);
+		tangent = Normalize(Sub(tangent, Scale(normal, Dot(tangent, normal))));
+		if (Dot(tangent, tangent) > 0.f)
+		{
+			bitangent = Scale(Cross(normal, tangent), handedness);
+			const XMFLOAT4 texel = SampleImage(*image, uv, false);
+			const XMFLOAT3 tangentNormal(texel.x * 2.f - 1.f, texel.y * 2.f - 1.f, texel.z * 2.f - 1.f);
+			const XMFLOAT3 mapped = Normalize(Add(Add(Scale(tangent, tangentNormal.x), Scale(bitangent, tangentNormal.y)), Scale(normal, tangentNormal.z)));
+			if (Dot(mapped, mapped) > 0.f)
+			{
+				normal = mapped;
+			}
+		}
+	}
+
+	// Two sided, then the shading normal may not turn away from the viewer
+	if (Dot(geometricNormal, ray.direction) > 0.f)
+	{
+		geometricNormal = Scale(geometricNormal, -1.f);
+		normal = Scale(normal, -1.f);
+	}
+	if (Dot(normal, ray.direction) >= 0.f)
+	{
+		normal = geometricNormal;
+	}
+	surface.geometricNormal = geometricNormal;
+	surface.normal = normal;
+
+	XMFLOAT3 baseColor(material.baseColorFactor.x, material.baseColorFactor.y, material.baseColorFactor.z);
+	if (mesh.hasVertexColor)
+	{
+		baseColor = XMFLOAT3(
+			a.Color.x * w + b.Color.x * hit.u + c.Color.x * hit.v,
+			a.Color.y * w + b.Color.y * hit.u + c.Color.y * hit.v,
+			a.Color.z * w + b.Color.z * hit.u + c.Color.z * hit.v);
+	}
+	else if (const PathTracerImage* image = TextureImage(scene, material.albedoTextureIndex))
+	{
+		const XMFLOAT4 texel = SampleImage(*image, uv, true);
+		baseColor = Mul(baseColor, XMFLOAT3(texel.x, texel.y, texel.z));
+	}
+	surface.baseColor = baseColor;
+
+	// glTF: roughness in green, metallic in blue, scaled by the factors
+	surface.metallic = material.metallicFactor;
+	surface.roughness = material.roughnessFactor;
+	if (const PathTracerImage* image = TextureImage(scene, material.metallicTextureIndex))
+	{
+		const XMFLOAT4 texel = SampleImage(*image, uv, false);
+		surface.roughness *= texel.y;
+		surface.metallic *= texel.z;
+	}
+	surface.metallic = std::min(std::max(surface.metallic, 0.f), 1.f);
+	surface.roughness = std::min(std::max(surface.roughness, 0.f), 1.f);
+	surface.emission = GetEmission(scene, material, uv);
+}
+
+//
+// BRDF, glTF metallic roughness: Lambert weighted by 1 - F plus GGX with separable Smith shadowing
+//
+
+static float SpecularAlpha(const Surface& surface)
+{
+	return std::max(surface.roughness * surface.roughness, 2e-3f);
+}
+
+static float DistributionGGX(float NoH, float alpha2)
+{
+	const float d = NoH * NoH * (alpha2 - 1.f) + 1.f;
+	return alpha2 / (Pi * d * d);
+}
+
+static float SmithG1(float NoX, float alpha2)
+{
+	return 2.f * NoX / (NoX + sqrtf(alpha2 + (1.f - alpha2) * NoX * NoX));
+}
+
+static XMFLOAT3 SpecularF0(const Surface& surface)
+{
+	const float dielectric = 0.04f * (1.f - surface.metallic);
+	return Add(XMFLOAT3(dielectric, dielectric, dielectric), Scale(surface.baseColor, surface.metallic));
+}
+
+static XMFLOAT3 FresnelSchlick(const XMFLOAT3& f0, float cosTheta)
+{
+	const float m = 1.f - std::min(std::max(cosTheta, 0.f), 1.f);
+	const float m5 = m * m * m * m * m;
+	return Add(f0, Scale(Sub(XMFLOAT3(1.f, 1.f, 1.f), f0), m5));
+}
+
+// Chance of sampling the GGX lobe, from the view Fresnel against the diffuse albedo
+static float SpecularProbability(const Surface& surface, float NoV)
+{
+	const float specular = Luminance(FresnelSchlick(SpecularF0(surface), NoV));
+	const float diffuse = Luminance(surface.baseColor) * (1.f - surface.metallic) * (1.f - specular);
+	const float total = specular + diffuse;
+	return (total > 0.f) ? std::min(std::max(specular / total, 0.1f), 0.9f) : 0.5f;
+}
+
+// BRDF times NoL, and the pdf of SampleBRDF picking wi
+static XMFLOAT3 EvaluateBRDF(const Surface& surface, const XMFLOAT3& wo, const XMFLOAT3& wi, float& pdf)
+{
+	pdf = 0.f;
+	const float NoV = Dot(surface.normal, wo);
+	const float NoL = Dot(surface.normal, wi);
+	if (NoV <= 0.f || NoL <= 0.f)
+		return XMFLOAT3(0.f, 0.f, 0.f);
+
+	const XMFLOAT3 h = Normalize(Add(wo, wi));
+	const float NoH = std::max(Dot(surface.normal, h), 0.f);
+	const float VoH = std::max(Dot(wo, h), 0.f);
+	const float alpha = SpecularAlpha(surface);
+	const float alpha2 = alpha * alpha;
+	const float D = DistributionGGX(NoH, alpha2);
+	const float G1V = SmithG1(NoV, alpha2);
+	const XMFLOAT3 F = FresnelSchlick(SpecularF0(surface), VoH);
+
+	const XMFLOAT3 specular = Scale(F, D * G1V * SmithG1(NoL, alpha2) / (4.f * NoV * NoL));
+	const XMFLOAT3 diffuse = Mul(Sub(XMFLOAT3(1.f, 1.f, 1.f), F), Scale(surface.baseColor, (1.f - surface.metallic) / Pi));
+
+	// Visible normal pdf, the Jacobian of the reflection cancels VoH
+	const float specularProbability = SpecularProbability(surface, NoV);
+	pdf = specularProbability * G1V * D / (4.f * NoV) + (1.f - specularProbability) * NoL / Pi;
+	return Scale(Add(specular, diffuse), NoL);
+}
+
+// Duff et al., "Building an Orthonormal Basis, Revisited"
+static void OrthonormalBasis(const XMFLOAT3& n, XMFLOAT3& t, XMFLOAT3& b)
+{
+	const float sign = copysignf(1.f, n.z);
+	const float a = -1.f / (sign + n.z);
+	const float c = n.x * n.y * a;
+	t = XMFLOAT3(1.f + sign * n.x * n.x * a, sign * c, -sign * n.x);
+	b = XMFLOAT3(c, sign + n.y * n.y * a, -n.y);
+}
+
+// pdf is cos / pi
+static XMFLOAT3 SampleCosine(const XMFLOAT3& normal, float u1, float u2)
+{
+	XMFLOAT3 t, b;
+	OrthonormalBasis(normal, t, b);
+	const float r = sqrtf(u1);
+	const float phi = 2.f * Pi * u2;
+	const float z = sqrtf(std::max(1.f - u1, 0.f));
+	return Add(Add(Scale(t, r * cosf(phi)), Scale(b, r * sinf(phi))), Scale(normal, z));
+}
+
+// Picks a lobe, samples it (GGX visible normals, Heitz 2018, or cosine) and weights by the pdf of
+// both, false when the direction is below the surface. pdf is kept for MIS
+static bool SampleBRDF(const Surface& surface, const XMFLOAT3& wo, Random& random, XMFLOAT3& wi, XMFLOAT3& weight, float& pdf)
+{
+	XMFLOAT3 t, b;
+	OrthonormalBasis(surface.normal, t, b);
+	const XMFLOAT3 v(Dot(wo, t), Dot(wo, b), Dot(wo, surface.normal));
+	if (v.z <= 0.f)
+		return false;
+
+	const float u1 = random.Next();
+	const float u2 = random.Next();
+	if (random.Next() < SpecularProbability(surface, v.z))
+	{
+		const float alpha = SpecularAlpha(surface);
+		const XMFLOAT3 vh = Normalize(XMFLOAT3(alpha * v.x, alpha * v.y, v.z));
+		const float lengthSq = vh.x * vh.x + vh.y * vh.y;
+		const XMFLOAT3 t1 = (lengthSq > 0.f) ? Scale(XMFLOAT3(-vh.y, vh.x, 0.f), 1.f / sqrtf(lengthSq)) : XMFLOAT3(1.f, 0.f, 0.f);
+		const XMFLOAT3 t2 = Cross(vh, t1);
+		const float r = sqrtf(u1);
+		const float phi = 2.f * Pi * u2;
+		const float p1 = r * cosf(phi);
+		const float s = 0.5f * (1.f + vh.z);
+		const float p2 = (1.f - s) * sqrtf(std::max(1.f - p1 * p1, 0.f)) + s * r * sinf(phi);
+		const XMFLOAT3 nh = Add(Add(Scale(t1, p1), Scale(t2, p2)), Scale(vh, sqrtf(std::max(1.f - p1 * p1 - p2 * p2, 0.f))));
+		const XMFLOAT3 hLocal = Normalize(XMFLOAT3(alpha * nh.x, alpha * nh.y, std::max(nh.z, 0.f)));
+		const XMFLOAT3 h = Add(Add(Scale(t, hLocal.x), Scale(b, hLocal.y)), Scale(surface.normal, hLocal.z));
+		wi = Sub(Scale(h, 2.f * Dot(wo, h)), wo);
+	}
+	else
+	{
+		wi = SampleCosine(surface.normal, u1, u2);
+	}
+
+	// Shading normals can send the sample through the surface
+	if (Dot(wi, surface.geometricNormal) <= 0.f)
+		return false;
+
+	const XMFLOAT3 f = EvaluateBRDF(surface, wo, wi, pdf);
+	if (!(pdf > 0.f))
+		return false;
+	weight = Scale(f, 1.f / pdf);
+	return std::isfinite(weight.x) && std::isfinite(weight.y) && std::isfinite(weight.z);
+}
+
+//
+// Integrator, one bounce at a time so both modes share it
+//
+
+// Closest hit, passing through cut out texels
+static bool TraceClosest(const PathTracerScene& scene, BVHRay ray, BVHHit& hit, uint64_t& numRays)
+{
+	for (uint32_t skip = 0; skip <= MaxCutOutSkips; ++skip)
+	{
+		hit = BVHHit();
+		++numRays;
+		if (!scene.tlas.Intersect(ray, hit))
+			return false;
+		if (!IsCutOut(scene, hit))
+			return true;
+		ray.tMin = hit.t + scene.rayOffset;
+	}
+	return true;
+}
+
+// Any hit only when nothing is alpha tested, closest hits through the cut outs otherwise
+static bool IsVisible(const PathTracerScene& scene, const BVHRay& ray, bool hasCutOut, uint64_t& numRays)
+{
+	if (!hasCutOut)
+	{
+		++numRays;
+		return !scene.tlas.Occluded(ray);
+	}
+	BVHHit hit;
+	return !TraceClosest(scene, ray, hit, numRays);
+}
+
+static BVHRay SpawnRay(const Surface& surface, const XMFLOAT3& direction, float offset)
+{
+	BVHRay ray;
+	ray.origin = Add(surface.position, Scale(surface.geometricNormal, offset));
+	ray.direction = direction;
+	return ray;
+}
+
+static BVHRay CameraRay(const PathTracerSettings& settings, float pixelX, float pixelY)
+{
+	const XMFLOAT4X4& m = settings.invViewProj;
+	const float x = pixelX / settings.width * 2.f - 1.f;
+	const float y = 1.f - pixelY / settings.height * 2.f;
+	const float z = 0.5f;
+	const float w = x * m.m[0][3] + y * m.m[1][3] + z * m.m[2][3] + m.m[3][3];
+	const XMFLOAT3 target(
+		(x * m.m[0][0] + y * m.m[1][0] + z * m.m[2][0] + m.m[3][0]) / w,
+		(x * m.m[0][1] + y * m.m[1][1] + z * m.m[2][1] + m.m[3][1]) / w,
+		(x * m.m[0][2] + y * m.m[1][2] + z * m.m[2][2] + m.m[3][2]) / w);
+
+	BVHRay ray;
+	ray.origin = settings.cameraPosition;
+	ray.direction = Normalize(Sub(target, settings.cameraPosition));
+	return ray;
+}
+
+// SplitMix64 of the sample's coordinates
+static uint64_t SampleSeed(uint32_t seed, uint32_t pixel, uint32_t sample)
+{
+	uint64_t z = (static_cast<uint64_t>(seed) << 56) ^ (static_cast<uint64_t>(sample) << 32) ^ pixel;
+	z += 0x9E3779B97F4A7C15ull;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+static void StartPath(const PathTracerSettings& settings, uint32_t pixel, uint32_t sample, PathState& path)
+{
+	path.random = { SampleSeed(settings.seed, pixel, sample) };
+	const float jitterX = path.random.Next(), jitterY = path.random.Next();
+	path.ray = CameraRay(settings, pixel % settings.width + jitterX, pixel / settings.width + jitterY);
+	path.throughput = XMFLOAT3(1.f, 1.f, 1.f);
+	path.radiance = XMFLOAT3(0.f, 0.f, 0.f);
+	path.bsdfPdf = 0.f;
+	path.bsdfNormal = XMFLOAT3(0.f, 0.f, 0.f);
+}
+
+// Veach's power heuristic (beta 2), one sample of each technique
+static float PowerHeuristic(float pdf, float otherPdf)
+{
+	const float a = pdf * pdf;
+	const float b = otherPdf * otherPdf;
+	return (a + b > 0.f) ? a / (a + b) : 0.f;
+}
+
+// Uniform in the cone around axis, pdf is 1 / (2 pi (1 - cosRadius))
+static XMFLOAT3 SampleCone(const XMFLOAT3& axis, float cosRadius, float u1, float u2)
+{
+	XMFLOAT3 t, b;
+	OrthonormalBasis(axis, t, b);
+	const float cosTheta = 1.f - u1 * (1.f - cosRadius);
+	const float sinTheta = sqrtf(std::max(1.f - cosTheta * cosTheta, 0.f));
+	const float phi = 2.f * Pi * u2;
+	return Add(Add(Scale(t, sinTheta * cosf(phi)), Scale(b, sinTheta * sinf(phi))), Scale(axis, cosTheta));
+}
+
+// Escaped rays see the sky and the sun disk, weighted against having sampled them at the last hit
+static void MissPath(const PathTracerSettings& settings, const Lighting& lighting, PathState& path)
+{
+	const bool weighted = settings.nextEventEstimation && path.bsdfPdf > 0.f;
+	const XMFLOAT3& direction = path.ray.direction;
+	const float skyPdf = std::max(Dot(direction, path.bsdfNormal), 0.f) / Pi;
+	const float skyWeight = weighted ? PowerHeuristic(path.bsdfPdf, skyPdf) : 1.f;
+	path.radiance = Add(path.radiance, Mul(path.throughput, Scale(lighting.sky, skyWeight)));
+
+	if (lighting.sunSolidAngle > 0.f && Dot(direction, lighting.toSun) >= lighting.sunCosRadius)
+	{
+		const float sunWeight = weighted ? PowerHeuristic(path.bsdfPdf, 1.f / lighting.sunSolidAngle) : 1.f;
+		path.radiance = Add(path.radiance, Mul(path.throughput, Scale(lighting.sunIrradiance, sunWeight / lighting.sunSolidAngle)));
+	}
+}
+
+// A shadow ray to the sun, the sky and an emissive triangle picked by power. Each is weighted
+// against the BSDF sampling the same direction, the sun without a radius isn't
+static void SampleLights(const PathTracerScene& scene, const Lighting& lighting, const Surface& surface, const XMFLOAT3& wo, PathState& path,
+	ShadowRays& shadows)
+{
+	// radianceOverPdf is the light's radiance over lightPdf, 0 for a delta light
+	auto connect = [&](const XMFLOAT3& wi, const XMFLOAT3& radianceOverPdf, float lightPdf, float tMax)
+	{
+		if (Dot(surface.geometricNormal, wi) <= 0.f)
+			return;
+		float bsdfPdf;
+		const XMFLOAT3 f = EvaluateBRDF(surface, wo, wi, bsdfPdf);
+		if (Luminance(f) <= 0.f)
+			return;
+
+		const float weight = (lightPdf > 0.f) ? PowerHeuristic(lightPdf, bsdfPdf) : 1.f;
+		shadows.rays[shadows.count] = SpawnRay(surface, wi, scene.rayOffset);
+		shadows.rays[shadows.count].tMax = tMax;
+		shadows.contributions[shadows.count] = Mul(path.throughput, Scale(Mul(f, radianceOverPdf), weight));
+		++shadows.count;
+	};
+
+	if (Luminance(lighting.sunIrradiance) > 0.f)
+	{
+		if (lighting.sunSolidAngle > 0.f)
+		{
+			const float u1 = path.random.Next(), u2 = path.random.Next();
+			connect(SampleCone(lighting.toSun, lighting.sunCosRadius, u1, u2), lighting.sunIrradiance, 1.f / lighting.sunSolidAngle, FLT_MAX);
+		}
+		else
+		{
+			connect(lighting.toSun, lighting.sunIrradiance, 0.f, FLT_MAX);
+		}
+	}
+
+	// Cosine around the shading normal, as MissPath weighs it
+	if (Luminance(lighting.sky) > 0.f)
+	{
+		const float u1 = path.random.Next(), u2 = path.random.Next();
+		const XMFLOAT3 wi = SampleCosine(surface.normal, u1, u2);
+		const float skyPdf = Dot(wi, surface.normal) / Pi;
+		if (skyPdf > 0.f)
+		{
+			connect(wi, Scale(lighting.sky, 1.f / skyPdf), skyPdf, FLT_MAX);
+		}
+	}
+
+	if (!scene.emitters.empty())
+	{
+		const float u0 = path.random.Next(), u1 = path.random.Next(), u2 = path.random.Next();
+		const size_t index = std::min(static_cast<size_t>(std::upper_bound(scene.emitterCdf.begin(), scene.emitterCdf.end(), u0) - scene.emitterCdf.begin()),
+			scene.emitters.size() - 1);
+		const PathTracerScene::Emitter& emitter = scene.emitters[index];
+
+		BVHHit lightHit;
+		const float su = sqrtf(u1);
+		lightHit.u = su * (1.f - u2);
+		lightHit.v = su * u2;
+		lightHit.triangle = emitter.triangle;
+		const XMFLOAT3 toLight = Sub(Add(emitter.p0, Add(Scale(emitter.e1, lightHit.u), Scale(emitter.e2, lightHit.v))), surface.position);
+		const float distanceSq = Dot(toLight, toLight);
+		const float distance = sqrtf(distanceSq);
+		const XMFLOAT3 wi = Scale(toLight, 1.f / distance);
+		const float cosLight = fabsf(Dot(Normalize(Cross(emitter.e1, emitter.e2)), wi));
+		if (distance > 0.f && cosLight > 0.f)
+		{
+			const PathTracerMesh& mesh = scene.meshes[scene.tlas.Instance(emitter.instance).instanceID];
+			const MaterialData& material = GetMaterial(scene, mesh);
+			const float lightPdf = EmitterAreaPdf(scene, material) * distanceSq / cosLight;
+			const XMFLOAT3 emission = GetEmission(scene, material, HitUV(mesh, lightHit));
+			connect(wi, Scale(emission, 1.f / lightPdf), lightPdf, distance * (1.f - 1e-4f));
+		}
+	}
+}
+
+// Emission, light samples and next direction of a hit. False when the path ends
+static bool ShadePath(const PathTracerScene& scene, const PathTracerSettings& settings, const Lighting& lighting, const BVHHit& hit, uint32_t bounce,
+	PathState& path, ShadowRays& shadows)
+{
+	Surface surface;
+	GetSurface(scene, path.ray, hit, surface);
+	const XMFLOAT3 wo = Scale(path.ray.direction, -1.f);
+
+	// Emissive triangles two sided, weighted against having sampled this one at the last hit
+	if (Luminance(surface.emission) > 0.f)
+	{
+		float weight = 1.f;
+		if (settings.nextEventEstimation && path.bsdfPdf > 0.f)
+		{
+			const MaterialData& material = GetMaterial(scene, scene.meshes[scene.tlas.Instance(hit.instance).instanceID]);
+			const float cosLight = fabsf(Dot(surface.geometricNormal, wo));
+			const float lightPdf = (cosLight > 0.f) ? EmitterAreaPdf(scene, material) * hit.t * hit.t / cosLight : 0.f;
+			weight = PowerHeuristic(path.bsdfPdf, lightPdf);
+		}
+		path.radiance = Add(path.radiance, Mul(path.throughput, Scale(surface.emission, weight)));
+	}
+
+	shadows.count = 0;
+	if (settings.nextEventEstimation)
+	{
+		SampleLights(scene, lighting, surface, wo, path, shadows);
+	}
+
+	if (bounce == settings.maxBounces)
+		return false;
+
+	XMFLOAT3 wi, weight;
+	float pdf;
+	if (!SampleBRDF(surface, wo, path.random, wi, weight, pdf))
+		return false;
+	path.throughput = Mul(path.throughput, weight);
+
+	// Russian roulette on the throughput, survivors are scaled up so the estimate stays unbiased
+	if (bounce + 1 >= settings.russianRouletteBounce)
+	{
+		const float survival = std::min(std::max(std::max(path.throughput.x, path.throughput.y), path.throughput.z), 0.95f);
+		if (path.random.Next() >= survival)
+			return false;
+		path.throughput = Scale(path.throughput, 1.f / survival);
+	}
+
+	path.bsdfPdf = pdf;
+	path.bsdfNormal = surface.normal;
+	path.ray = SpawnRay(surface, wi, scene.rayOffset);
+	return true;
+}
+
+static void ConnectShadows(const PathTracerScene& scene, const ShadowRays& shadows, bool hasCutOut, PathState& path, uint64_t& numRays)
+{
+	for (uint32_t i = 0; i < shadows.count; ++i)
+	{
+		if (IsVisible(scene, shadows.rays[i], hasCutOut, numRays))
+		{
+			path.radiance = Add(path.radiance, shadows.contributions[i]);
+		}
+	}
+}
+
+static void TracePath(const PathTracerScene& scene, const PathTracerSettings& settings, const Lighting& lighting, bool hasCutOut,
+	PathState& path, uint64_t& numRays)
+{
+	for (uint32_t bounce = 0; ; ++bounce)
+	{
+		BVHHit hit;
+		if (!TraceClosest(scene, path.ray, hit, numRays))
+		{
+			MissPath(settings, lighting, path);
+			break;
+		}
+
+		ShadowRays shadows;
+		const bool next = ShadePath(scene, settings, lighting, hit, bounce, path, shadows);
+		ConnectShadows(scene, shadows, hasCutOut, path, numRays);
+		if (!next)
+			break;
+	}
+}
+
+//
+// Megakernel, tiles with work stealing
+//
+
+static bool PopFront(TileQueue& queue, uint32_t& tile)
+{
+	uint64_t range = queue.range.load();
+	for (;;)
+	{
+		const uint32_t begin = static_cast<uint32_t>(range);
+		const uint32_t end = static_cast<uint32_t>(range >> 32);
+		if (begin >= end)
+			return false;
+		if (queue.range.compare_exchange_weak(range, (static_cast<uint64_t>(end) << 32) | (begin + 1)))
+		{
+			tile = begin;
+			return true;
+		}
+	}
+}
+
+static bool PopBack(TileQueue& queue, uint32_t& tile)
+{
+	uint64_t range = queue.range.load();
+	for (;;)
+	{
+		const uint32_t begin = static_cast<uint32_t>(range);
+		const uint32_t end = static_cast<uint32_t>(range >> 32);
+		if (begin >= end)
+			return false;
+		if (queue.range.compare_exchange_weak(range, (static_cast<uint64_t>(end - 1) << 32) | begin))
+		{
+			tile = end - 1;
+			return true;
+		}
+	}
+}
+
+static void RenderMegakernel(JobSystem& jobs, const PathTracerScene& scene, const PathTracerSettings& settings, const Lighting& lighting, bool hasCutOut,
+	std::vector<float>& outRgb, PathTracerStats& outStats)
+{
+	// Scanline order, every worker starts on its own band
+	const uint32_t tileSize = std::max(settings.tileSize, 1u);
+	const uint32_t tilesX = (settings.width + tileSize - 1) / tileSize;
+	const uint32_t tilesY = (settings.height + tileSize - 1) / tileSize;
+	const uint32_t numTiles = tilesX * tilesY;
+	const uint32_t numWorkers = jobs.NumThreads();
+	std::unique_ptr<TileQueue[]> queues(new TileQueue[numWorkers]);
+	for (uint32_t worker = 0; worker < numWorkers; ++worker)
+	{
+		const uint64_t begin = static_cast<uint64_t>(numTiles) * worker / numWorkers;
+		const uint64_t end = static_cast<uint64_t>(numTiles) * (worker + 1) / numWorkers;
+		queues[worker].range = (end << 32) | begin;
+	}
+
+	std::atomic<uint64_t> numRays{ 0 };
+	std::atomic<uint32_t> numStolen{ 0 };
+	jobs.ParallelFor(numWorkers, 1, [&](uint32_t begin, uint32_t end, uint32_t)
+	{
+		for (uint32_t worker = begin; worker < end; ++worker)
+		{
+			uint64_t workerRays = 0;
+			uint32_t workerStolen = 0;
+			uint32_t tile;
+			for (;;)
+			{
+				if (!PopFront(queues[worker], tile))
+				{
+					bool stolen = false;
+					for (uint32_t i = 1; i < numWorkers && !stolen; ++i)
+					{
+						stolen = PopBack(queues[(worker + i) % numWorkers], tile);
+					}
+					if (!stolen)
+						break;
+					++workerStolen;
+				}
+
+				const uint32_t x0 = (tile % tilesX) * tileSize;
+				const uint32_t y0 = (tile / tilesX) * tileSize;
+				for (uint32_t y = y0; y < std::min(y0 + tileSize, settings.height); ++y)
+				{
+					for (uint32_t x = x0; x < std::min(x0 + tileSize, settings.width); ++x)
+					{
+						const uint32_t pixel = y * settings.width + x;
+						XMFLOAT3 sum(0.f, 0.f, 0.f);
+						for (uint32_t sample = 0; sample < settings.samplesPerPixel; ++sample)
+						{
+							PathState path;
+							StartPath(settings, pixel, sample, path);
+							TracePath(scene, settings, lighting, hasCutOut, path, workerRays);
+							sum = Add(sum, path.radiance);
+						}
+						outRgb[pixel * 3 + 0] = sum.x;
+						outRgb[pixel * 3 + 1] = sum.y;
+						outRgb[pixel * 3 + 2] = sum.z;
+					}
+				}
+			}
+			numRays += workerRays;
+			numStolen += workerStolen;
+		}
+	});
+
+	outStats.numTiles = numTiles;
+	outStats.numStolenTiles = numStolen;
+	outStats.numRays = numRays;
+}
+
+//
+// Wavefront, stages over queues of path indices
+//
+
+// Stable counting sort of queue by keys (one per queue entry, below numKeys), chunks are counted and
+// scattered in parallel. Compaction is a sort by keep (0) or drop (1). Returns the entries with key 0
+static uint32_t SortQueue(JobSystem& jobs, const std::vector<uint32_t>& queue, const std::vector<uint32_t>& keys, uint32_t numKeys,
+	std::vector<uint32_t>& counts, std::vector<uint32_t>& outQueue)
+{
+	const uint32_t count = static_cast<uint32_t>(queue.size());
+	const uint32_t numChunks = (count + SortChunkSize - 1) / SortChunkSize;
+	counts.assign(static_cast<size_t>(numChunks) * numKeys, 0);
+	outQueue.resize(count);
+	if (count == 0)
+	{
+		return 0;
+	}
+
+	jobs.ParallelFor(numChunks, 1, [&](uint32_t begin, uint32_t end, uint32_t)
+	{
+		for (uint32_t chunk = begin; chunk < end; ++chunk)
+		{
+			uint32_t* chunkCounts = &counts[static_cast<size_t>(chunk) * numKeys];
+			for (uint32_t i = chunk * SortChunkSize; i < std::min((chunk + 1) * SortChunkSize, count); ++i)
+			{
+				++chunkCounts[keys[i]];
+			}
+		}
+	});
+
+	// Key major offsets, so each key keeps the queue order
+	uint32_t offset = 0, numFirstKey = 0;
+	for (uint32_t key = 0; key < numKeys; ++key)
+	{
+		for (uint32_t chunk = 0; chunk < numChunks; ++chunk)
+		{
+			const uint32_t keyCount = counts[static_cast<size_t>(chunk) * numKeys + key];
+			counts[static_cast<size_t>(chunk) * numKeys + key] = offset;
+			offset += keyCount;
+		}
+		if (key == 0)
+			numFirstKey = offset;
+	}
+
+	jobs.ParallelFor(numChunks, 1, [&](uint32_t begin, uint32_t end, uint32_t)
+	{
+		for (uint32_t chunk = begin; chunk < end; ++chunk)
+		{
+			uint32_t* chunkOffsets = &counts[static_cast<size_t>(chunk) * numKeys];
+			for (uint32_t i = chunk * SortChunkSize; i < std::min((chunk + 1) * SortChunkSize, count); ++i)
+			{
+				outQueue[chunkOffsets[keys[i]]++] = queue[i];
+			}
+		}
+	});
+	return numFirstKey;
+}
+
+// Misses first, then materials in order, meshes without one last
+static uint32_t MaterialKey(const PathTracerScene& scene, const BVHHit& hit)
+{
+	if (!hit.IsHit())
+		return 0;
+	const int materialIndex = scene.meshes[scene.tlas.Instance(hit.instance).instanceID].materialIndex;
+	return (materialIndex >= 0 && materialIndex < static_cast<int>(scene.materials.size())) ? materialIndex + 1 : static_cast<uint32_t>(scene.materials.size()) + 1;
+}
+
+static void RenderWavefront(JobSystem& jobs, const PathTracerScene& scene, const PathTracerSettings& settings, const Lighting& lighting, bool hasCutOut,
+	std::vector<float>& outRgb, PathTracerStats& outStats)
+{
+	// Paths are numbered pixel major, a wave is a contiguous range so samples accumulate in order
+	const uint32_t spp = settings.samplesPerPixel;
+	const uint64_t numPaths = static_cast<uint64_t>(settings.width) * settings.height * spp;
+	const uint32_t waveSize = static_cast<uint32_t>(std::min<uint64_t>(std::max(settings.wavefrontPaths, 1u), numPaths));
+	const uint32_t numMaterialKeys = static_cast<uint32_t>(scene.materials.size()) + 2;
+	std::vector<PathState> paths(waveSize);
+	std::vector<BVHHit> hits(waveSize);
+	std::vector<ShadowRays> shadows(waveSize);
+	std::vector<uint32_t> queue, sorted, shadowQueue, counts;
+	std::vector<uint32_t> materialKeys(waveSize), nextKeys(waveSize), shadowKeys(waveSize);
+
+	std::atomic<uint64_t> numRays{ 0 };
+	for (uint64_t first = 0; first < numPaths; first += waveSize)
+	{
+		const uint32_t count = static_cast<uint32_t>(std::min<uint64_t>(waveSize, numPaths - first));
+		auto start = TimerClock::now();
+		jobs.ParallelFor(count, WavefrontChunkSize, [&](uint32_t begin, uint32_t end, uint32_t)
+		{
+			for (uint32_t i = begin; i < end; ++i)
+			{
+				const uint64_t path = first + i;
+				StartPath(settings, static_cast<uint32_t>(path / spp), static_cast<uint32_t>(path % spp), paths[i]);
+			}
+		});
+		queue.resize(count);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			queue[i] = i;
+		}
+		outStats.generateMs += ElapsedMs(start);
+
+		for (uint32_t bounce = 0; !queue.empty(); ++bounce)
+		{
+			start = TimerClock::now();
+			jobs.ParallelFor(static_cast<uint32_t>(queue.size()), WavefrontChunkSize, [&](uint32_t begin, uint32_t end, uint32_t)
+			{
+				uint64_t chunkRays = 0;
+				for (uint32_t i = begin; i < end; ++i)
+				{
+					const uint32_t path = queue[i];
+					TraceClosest(scene, paths[path].ray, hits[path], chunkRays);
+					materialKeys[i] = MaterialKey(scene, hits[path]);
+				}
+				numRays += chunkRays;
+			});
+			outStats.extendMs += ElapsedMs(start);
+
+			start = TimerClock::now();
+			SortQueue(jobs, queue, materialKeys, numMaterialKeys, counts, sorted);
+			outStats.sortMs += ElapsedMs(start);
+
+			start = TimerClock::now();
+			jobs.ParallelFor(static_cast<uint32_t>(sorted.size()), WavefrontChunkSize, [&](uint32_t begin, uint32_t end, uint32_t)
+			{
+				for (uint32_t i = begin; i < end; ++i)
+				{
+					const uint32_t path = sorted[i];
+					bool next = false;
+					shadows[path].count = 0;
+					if (hits[path].IsHit())
+						next = ShadePath(scene, settings, lighting, hits[path], bounce, paths[path], shadows[path]);
+					else
+						MissPath(settings, lighting, paths[path]);
+					nextKeys[i] = next ? 0 : 1;
+					shadowKeys[i] = (shadows[path].count > 0) ? 0 : 1;
+				}
+			});
+			outStats.shadeMs += ElapsedMs(start);
+
+			start = TimerClock::now();
+			const uint32_t numShadows = SortQueue(jobs, sorted, shadowKeys, 2, counts, shadowQueue);
+			shadowQueue.resize(numShadows);
+			outStats.sortMs += ElapsedMs(start);
+
+			start = TimerClock::now();
+			jobs.ParallelFor(numShadows, WavefrontChunkSize, [&](uint32_t begin, uint32_t end, uint32_t)
+			{
+				uint64_t chunkRays = 0;
+				for (uint32_t i = begin; i < end; ++i)
+				{
+					ConnectShadows(scene, shadows[shadowQueue[i]], hasCutOut, paths[shadowQueue[i]], chunkRays);
+				}
+				numRays += chunkRays;
+			});
+			outStats.connectMs += ElapsedMs(start);
+
+			start = TimerClock::now();
+			const uint32_t numNext = SortQueue(jobs, sorted, nextKeys, 2, counts, queue);
+			queue.resize(numNext);
+			outStats.sortMs += ElapsedMs(start);
+		}
+
+		// Pixels of the wave, the first and last may be shared with the neighboring waves
+		start = TimerClock::now();
+		const uint32_t firstPixel = static_cast<uint32_t>(first / spp);
+		const uint32_t lastPixel = static_cast<uint32_t>((first + count - 1) / spp);
+		jobs.ParallelFor(lastPixel - firstPixel + 1, WavefrontChunkSize, [&](uint32_t begin, uint32_t end, uint32_t)
+		{
+			for (uint32_t pixel = firstPixel + begin; pixel < firstPixel + end; ++pixel)
+			{
+				const uint64_t pixelBegin = std::max<uint64_t>(static_cast<uint64_t>(pixel) * spp, first);
+				const uint64_t pixelEnd = std::min<uint64_t>(static_cast<uint64_t>(pixel + 1) * spp, first + count);
+				XMFLOAT3 sum(outRgb[pixel * 3 + 0], outRgb[pixel * 3 + 1], outRgb[pixel * 3 + 2]);
+				for (uint64_t path = pixelBegin; path < pixelEnd; ++path)
+				{
+					sum = Add(sum, paths[path - first].radiance);
+				}
+				outRgb[pixel * 3 + 0] = sum.x;
+				outRgb[pixel * 3 + 1] = sum.y;
+				outRgb[pixel * 3 + 2] = sum.z;
+			}
+		});
+		outStats.generateMs += ElapsedMs(start);
+		++outStats.numWaves;
+	}
+	outStats.numRays = numRays;
+}
+
+void RenderPathTraced(JobSystem& jobs, const PathTracerScene& scene, const PathTracerSettings& settings, std::vector<float>& outRgb, PathTracerStats& outStats)
+{
+	const auto start = TimerClock::now();
+
+	outStats = {};
+	outRgb.assign(static_cast<size_t>(settings.width) * settings.height * 3, 0.f);
+	if (settings.width == 0 || settings.height == 0 || settings.samplesPerPixel == 0)
+	{
+		return;
+	}
+
+	Lighting lighting;
+	lighting.toSun = Normalize(Scale(scene.light.direction, -1.f));
+	lighting.sunIrradiance = Scale(XMFLOAT3(XMVectorGetX(scene.light.color), XMVectorGetY(scene.light.color), XMVectorGetZ(scene.light.color)), scene.light.intensity);
+	lighting.sky = XMFLOAT3(XMVectorGetX(scene.light.ambient), XMVectorGetY(scene.light.ambient), XMVectorGetZ(scene.light.ambient));
+	lighting.sunCosRadius = (scene.sunAngularRadius > 0.f) ? cosf(scene.sunAngularRadius) : 1.f;
+	lighting.sunSolidAngle = 2.f * Pi * (1.f - lighting.sunCosRadius);
+	bool hasCutOut = false;
+	for (const MaterialData& material : scene.materials)
+	{
+		hasCutOut = hasCutOut || material.alphaCutoff < 1.f;
+	}
+
+	// Both sum the samples of a pixel in order, then average
+	if (settings.mode == PathTracerMode_Wavefront)
+		RenderWavefront(jobs, scene, settings, lighting, hasCutOut, outRgb, outStats);
+	else
+		RenderMegakernel(jobs, scene, settings, lighting, hasCutOut, outRgb, outStats);
+	const float invSamples = 1.f / settings.samplesPerPixel;
+	for (float& value : outRgb)
+	{
+		value *= invSamples;
+	}
+
+	outStats.numThreads = jobs.NumThreads();
+	outStats.numSamples = static_cast<uint64_t>(settings.width) * settings.height * settings.samplesPerPixel;
+	outStats.renderMs = ElapsedMs(start);
+	outStats.samplesPerSecond = (outStats.renderMs > 0.0) ? outStats.numSamples / (outStats.renderMs * 1e-3) : 0.0;
+	outStats.raysPerSecond = (outStats.renderMs > 0.0) ? outStats.numRays / (outStats.renderMs * 1e-3) : 0.0;
+}
+
+void EncodePathTracedImage(const std::vector<float>& rgb, float exposure, std::vector<uint8_t>& outRgba)
+{
+	const size_t numPixels = rgb.size() / 3;
+	outRgba.resize(numPixels * 4);
+	for (size_t i = 0; i < numPixels; ++i)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			const float linear = std::min(std::max(rgb[i * 3 + c] * exposure, 0.f), 1.f);
+			const float encoded = (linear <= 0.0031308f) ? linear * 12.92f : 1.055f * powf(linear, 1.f / 2.4f) - 0.055f;
+			outRgba[i * 4 + c] = static_cast<uint8_t>(encoded * 255.f + 0.5f);
+		}
+		outRgba[i * 4 + 3] = 255;
+	}
+}
+
+static double RootMeanSquareError(const std::vector<float>& rgb, const std::vector<float>& reference)
+{
+	double sum = 0.0;
+	for (size_t i = 0; i < rgb.size(); ++i)
+	{
+		const double difference = static_cast<double>(rgb[i]) - reference[i];
+		sum += difference * difference;
+	}
+	return rgb.empty() ? 0.0 : sqrt(sum / rgb.size());
+}
+
+void RunPathTracerConvergence(JobSystem& jobs, const PathTracerScene& scene, const PathTracerSettings& settings, uint32_t referenceSamples,
+	uint32_t maxSamples, PathTracerConvergenceResult& outResult)
+{
+	outResult = {};
+	std::vector<float>& reference = outResult.referenceRgb;
+	std::vector<float> rgb;
+	PathTracerStats stats;
+
+	PathTracerSettings referenceSettings = settings;
+	referenceSettings.samplesPerPixel = referenceSamples;
+	referenceSettings.nextEventEstimation = true;
+	referenceSettings.seed = settings.seed + 1;
+	RenderPathTraced(jobs, scene, referenceSettings, reference, stats);
+	outResult.referenceSamples = referenceSamples;
+	outResult.referenceMs = stats.renderMs;
+
+	for (int nextEvent = 0; nextEvent < 2; ++nextEvent)
+	{
+		std::vector<PathTracerConvergencePoint>& points = nextEvent ? outResult.nextEvent : outResult.bsdfSampling;
+		PathTracerSettings pointSettings = settings;
+		pointSettings.nextEventEstimation = nextEvent != 0;
+		for (uint32_t samples = 1; samples <= maxSamples; samples *= 2)
+		{
+			pointSettings.samplesPerPixel = samples;
+			RenderPathTraced(jobs, scene, pointSettings, rgb, stats);
+
+			PathTracerConvergencePoint point;
+			point.samplesPerPixel = samples;
+			point.renderMs = stats.renderMs;
+			point.rmse = RootMeanSquareError(rgb, reference);
+			points.push_back(point);
+		}
+	}
+
+	// Error squared falls as 1 / time, so the ratio of RMSE^2 * time is the time ratio at equal error
+	if (!outResult.bsdfSampling.empty() && !outResult.nextEvent.empty())
+	{
+		const PathTracerConvergencePoint& bsdf = outResult.bsdfSampling.back();
+		const PathTracerConvergencePoint& nee = outResult.nextEvent.back();
+		const double neeCost = nee.rmse * nee.rmse * nee.renderMs;
+		outResult.speedup = (neeCost > 0.0) ? bsdf.rmse * bsdf.rmse * bsdf.renderMs / neeCost : 0.0;
+	}
+}
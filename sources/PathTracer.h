@@ -0,0 +1,144 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <DirectXMath.h>
+#include "JobSystem.h"
+#include "TriangleBVH.h"
+#include "TopLevelBVH.h"
+#include "../shaders/HLSLCompatible.h"
+
+// Reference path tracer on the CPU (no D3D dependency), ground truth for the raster and DXR paths
+// Meshes are instanced through TopLevelBVH and shaded with MaterialData as glTF metallic roughness
+// (Lambert plus GGX, base color, metallic roughness, normal and emissive textures, alpha test).
+// Lights are the directional LightData as a small sun disk, a uniform sky of LightData::ambient and
+// emissive triangles. Every hit samples each of them with a shadow ray (next event estimation) and
+// weights it against the BSDF sample reaching the same light (multiple importance sampling, power
+// heuristic). Paths past a few bounces end by Russian roulette.
+// Megakernel mode splits the image into tiles, every worker owns a contiguous range and steals
+// from the back of the others once it runs dry, each path runs all its bounces at once.
+// Wavefront mode runs a large batch of paths one stage at a time: generate camera rays, extend
+// (closest hits), sort by material and shade, connect (shadow rays). Queues are compacted between
+// stages, so every stage is a dense parallel loop and shading walks one material at a time.
+// Every sample has its own random sequence and both modes consume it in the same order, so the image
+// doesn't depend on the mode, the thread count or the stealing order.
+
+// RGBA8 texels, bilinear with wrap. Base color is decoded from sRGB, the others are linear
+struct PathTracerImage
+{
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<uint8_t> texels;
+};
+
+struct PathTracerMesh
+{
+	std::vector<MeshVertex> vertices;
+	std::vector<uint32_t> indices;
+	int materialIndex = -1;		// -1 is white dielectric
+	bool hasVertexColor = false;	// Replaces base color, as the raster path
+	bool hasTangent = false;		// Normal maps use UV derived tangents otherwise
+	TriangleBVH bvh;				// Object space, built by PathTracerScene::Build
+};
+
+struct PathTracerScene
+{
+	std::vector<PathTracerMesh> meshes;
+	std::vector<MaterialData> materials;
+	std::vector<int> textures;				// Texture to image, MaterialData indices are textures
+	std::vector<PathTracerImage> images;
+	std::vector<BVHInstance> instances;		// instanceID is the mesh, blas is set by Build
+	LightData light;						// direction, color * intensity is the sun irradiance
+	float sunAngularRadius = 0.00465f;		// Radians, the sun's. 0 is a point in the sky only shadow rays reach
+
+	// BLAS of every mesh across the job system, then the TLAS over instances
+	void Build(JobSystem& jobs);
+
+	TopLevelBVH tlas;
+	std::vector<DirectX::XMFLOAT3X4> normalTransforms;	// Cofactor of every instance's 3x3, normals and edges agree
+	float rayOffset = 0.f;								// Secondary ray origins, relative to the scene size
+
+	// Emissive triangles in world space, picked by power (emissive factor luminance * area)
+	struct Emitter
+	{
+		DirectX::XMFLOAT3 p0;
+		DirectX::XMFLOAT3 e1;
+		DirectX::XMFLOAT3 e2;
+		uint32_t instance;		// TLAS instance
+		uint32_t triangle;
+	};
+	std::vector<Emitter> emitters;
+	std::vector<float> emitterCdf;		// Inclusive, normalized
+	float emitterPower = 0.f;
+};
+
+enum PathTracerMode
+{
+	PathTracerMode_Megakernel,	// Per path loop over tiles
+	PathTracerMode_Wavefront,	// Per stage loop over batches of paths
+	PathTracerMode_Count,
+};
+
+struct PathTracerSettings
+{
+	PathTracerMode mode = PathTracerMode_Megakernel;
+	uint32_t width = 1280;
+	uint32_t height = 720;
+	uint32_t samplesPerPixel = 16;
+	uint32_t maxBounces = 8;		// Indirect bounces after the camera hit
+	uint32_t russianRouletteBounce = 3;	// First bounce that may end by Russian roulette
+	bool nextEventEstimation = true;	// Off, lights are only found by BSDF samples (the sun needs a radius)
+	uint32_t tileSize = 16;
+	uint32_t wavefrontPaths = 1 << 17;	// Paths in flight per wave, about 300 bytes each
+	uint32_t seed = 0;
+	DirectX::XMFLOAT4X4 invViewProj;	// NDC to world, row vectors
+	DirectX::XMFLOAT3 cameraPosition;
+};
+
+struct PathTracerStats
+{
+	uint32_t numThreads = 0;
+	uint32_t numTiles = 0;			// Megakernel
+	uint32_t numStolenTiles = 0;
+	uint32_t numWaves = 0;			// Wavefront
+	uint64_t numSamples = 0;
+	uint64_t numRays = 0;			// Closest hit and shadow
+	double renderMs = 0.0;
+	double samplesPerSecond = 0.0;
+	double raysPerSecond = 0.0;
+
+	// Wavefront stages, summed over waves and bounces
+	double generateMs = 0.0;		// Camera rays and accumulation
+	double extendMs = 0.0;
+	double sortMs = 0.0;			// Material sort and queue compaction
+	double shadeMs = 0.0;
+	double connectMs = 0.0;
+};
+
+// Linear radiance, 3 floats per pixel, rows top to bottom. scene must be built
+void RenderPathTraced(JobSystem& jobs, const PathTracerScene& scene, const PathTracerSettings& settings, std::vector<float>& outRgb, PathTracerStats& outStats);
+
+// Exposure, clamp and sRGB encode, alpha 255
+void EncodePathTracedImage(const std::vector<float>& rgb, float exposure, std::vector<uint8_t>& outRgba);
+
+struct PathTracerConvergencePoint
+{
+	uint32_t samplesPerPixel = 0;
+	double renderMs = 0.0;
+	double rmse = 0.0;		// Linear radiance against the reference, all channels
+};
+
+struct PathTracerConvergenceResult
+{
+	uint32_t referenceSamples = 0;
+	double referenceMs = 0.0;
+	std::vector<float> referenceRgb;	// Same layout as RenderPathTraced
+	std::vector<PathTracerConvergencePoint> bsdfSampling;	// nextEventEstimation off
+	std::vector<PathTracerConvergencePoint> nextEvent;
+	double speedup = 0.0;	// Time to the same RMSE, from RMSE^2 * time at the last point of both
+};
+
+// Reference with next event estimation at referenceSamples (its own seed), then both estimators at
+// 1, 2, 4 ... maxSamples samples per pixel. Other settings are used as given
+void RunPathTracerConvergence(JobSystem& jobs, const PathTracerScene& scene, const PathTracerSettings& settings, uint32_t referenceSamples,
+	uint32_t maxSamples, PathTracerConvergenceResult& outResult);
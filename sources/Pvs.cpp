@@ -0,0 +1,558 @@
+#include "Pvs.h"
+#include "Utility.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <string.h>
+#include <unordered_map>
+
+using namespace DirectX;
+
+static const uint32_t PvsFileMagic = 0x31535650;	// "PVS1"
+static const uint32_t PvsFileVersion = 1;
+
+struct PvsFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t dims[3];
+	uint32_t numInstances;
+	uint32_t wordsPerSet;
+	uint32_t numSets;
+	float boundsMin[3];
+	float cellSize;
+};
+
+//
+// Data
+//
+uint32_t PvsData::FindCell(const XMFLOAT3& position) const
+{
+	if (IsEmpty())
+	{
+		return PvsNoSet;
+	}
+
+	const float local[3] = { position.x - boundsMin.x, position.y - boundsMin.y, position.z - boundsMin.z };
+	uint32_t coord[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const float cell = floorf(local[axis] / cellSize);
+		if (cell < 0.f || cell >= static_cast<float>(dims[axis]))
+			return PvsNoSet;
+		coord[axis] = static_cast<uint32_t>(cell);
+	}
+	return (coord[2] * dims[1] + coord[1]) * dims[0] + coord[0];
+}
+
+const uint32_t* PvsData::CellSet(uint32_t cell) const
+{
+	if (cell >= cellSets.size() || cellSets[cell] == PvsNoSet)
+	{
+		return nullptr;
+	}
+	return &setWords[static_cast<size_t>(cellSets[cell]) * wordsPerSet];
+}
+
+bool PvsData::Save(const std::string& filePath) const
+{
+	FILE* file = fopen(filePath.c_str(), "wb");
+	if (!file)
+	{
+		printf("PVS: can't write %s\n", filePath.c_str());
+		return false;
+	}
+
+	PvsFileHeader header = {};
+	header.magic = PvsFileMagic;
+	header.version = PvsFileVersion;
+	memcpy(header.dims, dims, sizeof(dims));
+	header.numInstances = numInstances;
+	header.wordsPerSet = wordsPerSet;
+	header.numSets = NumSets();
+	header.boundsMin[0] = boundsMin.x;
+	header.boundsMin[1] = boundsMin.y;
+	header.boundsMin[2] = boundsMin.z;
+	header.cellSize = cellSize;
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	ok = ok && fwrite(cellSets.data(), sizeof(uint32_t), cellSets.size(), file) == cellSets.size();
+	ok = ok && fwrite(setWords.data(), sizeof(uint32_t), setWords.size(), file) == setWords.size();
+	fclose(file);
+	return ok;
+}
+
+bool PvsData::Load(const std::string& filePath, uint32_t expectedInstances)
+{
+	*this = PvsData();
+
+	FILE* file = fopen(filePath.c_str(), "rb");
+	if (!file)
+	{
+		return false;
+	}
+
+	PvsFileHeader header = {};
+	bool ok = fread(&header, sizeof(header), 1, file) == 1;
+	ok = ok && header.magic == PvsFileMagic && header.version == PvsFileVersion;
+	ok = ok && header.numInstances == expectedInstances && header.wordsPerSet == (expectedInstances + 31) / 32;
+	if (ok)
+	{
+		memcpy(dims, header.dims, sizeof(dims));
+		numInstances = header.numInstances;
+		wordsPerSet = header.wordsPerSet;
+		boundsMin = XMFLOAT3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+		cellSize = header.cellSize;
+		cellSets.resize(NumCells());
+		setWords.resize(static_cast<size_t>(header.numSets) * wordsPerSet);
+		ok = fread(cellSets.data(), sizeof(uint32_t), cellSets.size(), file) == cellSets.size();
+		ok = ok && fread(setWords.data(), sizeof(uint32_t), setWords.size(), file) == setWords.size();
+		ok = ok && std::all_of(cellSets.begin(), cellSets.end(), [&](uint32_t set) { return set == PvsNoSet || set < header.numSets; });
+	}
+	fclose(file);
+
+	if (!ok)
+	{
+		printf("PVS: %s is not a PVS of this scene\n", filePath.c_str());
+		*this = PvsData();
+	}
+	return ok;
+}
+
+//
+// Ray casting, uniform grid over the triangles, cells list every triangle their box overlaps
+//
+namespace
+{
+	struct RayHit
+	{
+		float t = FLT_MAX;
+		uint32_t triangle = ~0u;
+		bool backFace = false;
+	};
+
+	class TriangleGrid
+	{
+	public:
+		void Build(const PvsScene& scene);
+		bool Trace(const XMFLOAT3& origin, const XMFLOAT3& direction, RayHit& outHit) const;
+		uint32_t NumCells() const { return m_dims[0] * m_dims[1] * m_dims[2]; }
+
+	private:
+		bool IntersectTriangle(uint32_t triangle, const float* origin, const float* direction, RayHit& hit) const;
+
+		const PvsScene* m_scene = nullptr;
+		float m_min[3] = {};
+		float m_max[3] = {};
+		float m_cellSize[3] = {};
+		int m_dims[3] = {};
+		std::vector<uint32_t> m_cellBegin;	// NumCells + 1
+		std::vector<uint32_t> m_cellTriangles;
+	};
+
+	void TriangleGrid::Build(const PvsScene& scene)
+	{
+		m_scene = &scene;
+		const uint32_t numTriangles = static_cast<uint32_t>(scene.indices.size() / 3);
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			m_min[axis] = FLT_MAX;
+			m_max[axis] = -FLT_MAX;
+		}
+		for (const XMFLOAT3& p : scene.positions)
+		{
+			const float v[3] = { p.x, p.y, p.z };
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				m_min[axis] = std::min(m_min[axis], v[axis]);
+				m_max[axis] = std::max(m_max[axis], v[axis]);
+			}
+		}
+
+		// About 2 triangles per cell, cells as cubic as the bounds allow
+		float extent[3];
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			m_min[axis] -= 1e-3f;
+			m_max[axis] += 1e-3f;
+			extent[axis] = m_max[axis] - m_min[axis];
+		}
+		const float volume = extent[0] * extent[1] * extent[2];
+		const float cellEdge = cbrtf(volume * 2.f / std::max(numTriangles, 1u));
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			m_dims[axis] = std::min(std::max(static_cast<int>(extent[axis] / cellEdge), 1), 256);
+			m_cellSize[axis] = extent[axis] / m_dims[axis];
+		}
+
+		// Count then fill, triangle box against cells
+		auto cellRange = [&](uint32_t triangle, int* lo, int* hi)
+		{
+			float triMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+			float triMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+			for (int corner = 0; corner < 3; ++corner)
+			{
+				const XMFLOAT3& p = scene.positions[scene.indices[triangle * 3 + corner]];
+				const float v[3] = { p.x, p.y, p.z };
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					triMin[axis] = std::min(triMin[axis], v[axis]);
+					triMax[axis] = std::max(triMax[axis], v[axis]);
+				}
+			}
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				lo[axis] = std::min(std::max(static_cast<int>((triMin[axis] - m_min[axis]) / m_cellSize[axis]), 0), m_dims[axis] - 1);
+				hi[axis] = std::min(std::max(static_cast<int>((triMax[axis] - m_min[axis]) / m_cellSize[axis]), 0), m_dims[axis] - 1);
+			}
+		};
+
+		m_cellBegin.assign(NumCells() + 1, 0);
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			if (pass == 1)
+			{
+				for (uint32_t cell = 0; cell < NumCells(); ++cell)
+				{
+					m_cellBegin[cell + 1] += m_cellBegin[cell];
+				}
+				m_cellTriangles.resize(m_cellBegin[NumCells()]);
+			}
+
+			std::vector<uint32_t> cursor(m_cellBegin.begin(), m_cellBegin.end() - 1);
+			for (uint32_t triangle = 0; triangle < numTriangles; ++triangle)
+			{
+				int lo[3], hi[3];
+				cellRange(triangle, lo, hi);
+				for (int z = lo[2]; z <= hi[2]; ++z)
+				{
+					for (int y = lo[1]; y <= hi[1]; ++y)
+					{
+						for (int x = lo[0]; x <= hi[0]; ++x)
+						{
+							const uint32_t cell = (z * m_dims[1] + y) * m_dims[0] + x;
+							if (pass == 0)
+								++m_cellBegin[cell + 1];
+							else
+								m_cellTriangles[cursor[cell]++] = triangle;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// Moller-Trumbore, counter clockwise triangles face the viewer (glTF)
+	bool TriangleGrid::IntersectTriangle(uint32_t triangle, const float* o, const float* d, RayHit& hit) const
+	{
+		const XMFLOAT3& p0 = m_scene->positions[m_scene->indices[triangle * 3 + 0]];
+		const XMFLOAT3& p1 = m_scene->positions[m_scene->indices[triangle * 3 + 1]];
+		const XMFLOAT3& p2 = m_scene->positions[m_scene->indices[triangle * 3 + 2]];
+		const float e1[3] = { p1.x - p0.x, p1.y - p0.y, p1.z - p0.z };
+		const float e2[3] = { p2.x - p0.x, p2.y - p0.y, p2.z - p0.z };
+		const float p[3] = { d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0] };
+		const float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+		if (fabsf(det) < 1e-12f)
+			return false;
+
+		const float invDet = 1.f / det;
+		const float s[3] = { o[0] - p0.x, o[1] - p0.y, o[2] - p0.z };
+		const float u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * invDet;
+		if (u < 0.f || u > 1.f)
+			return false;
+
+		const float q[3] = { s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0] };
+		const float v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * invDet;
+		if (v < 0.f || u + v > 1.f)
+			return false;
+
+		const float t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * invDet;
+		if (t <= 1e-4f || t >= hit.t)
+			return false;
+
+		// det = -dot(direction, normal)
+		hit.t = t;
+		hit.triangle = triangle;
+		hit.backFace = det < 0.f;
+		return true;
+	}
+
+	// Cells in ray order (3D DDA), the closest hit inside the current cell ends the walk
+	bool TriangleGrid::Trace(const XMFLOAT3& origin, const XMFLOAT3& direction, RayHit& outHit) const
+	{
+		outHit = RayHit();
+		if (m_cellTriangles.empty())
+			return false;
+
+		const float o[3] = { origin.x, origin.y, origin.z };
+		const float d[3] = { direction.x, direction.y, direction.z };
+
+		float tEnter = 0.f, tExit = FLT_MAX;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			if (fabsf(d[axis]) < 1e-12f)
+			{
+				if (o[axis] < m_min[axis] || o[axis] > m_max[axis])
+					return false;
+				continue;
+			}
+			float t0 = (m_min[axis] - o[axis]) / d[axis];
+			float t1 = (m_max[axis] - o[axis]) / d[axis];
+			if (t0 > t1)
+				std::swap(t0, t1);
+			tEnter = std::max(tEnter, t0);
+			tExit = std::min(tExit, t1);
+		}
+		if (tEnter > tExit)
+			return false;
+
+		int cell[3], step[3];
+		float tNext[3], tDelta[3];
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			const float p = o[axis] + d[axis] * tEnter;
+			cell[axis] = std::min(std::max(static_cast<int>((p - m_min[axis]) / m_cellSize[axis]), 0), m_dims[axis] - 1);
+			if (d[axis] > 0.f)
+			{
+				step[axis] = 1;
+				tDelta[axis] = m_cellSize[axis] / d[axis];
+				tNext[axis] = (m_min[axis] + (cell[axis] + 1) * m_cellSize[axis] - o[axis]) / d[axis];
+			}
+			else if (d[axis] < 0.f)
+			{
+				step[axis] = -1;
+				tDelta[axis] = -m_cellSize[axis] / d[axis];
+				tNext[axis] = (m_min[axis] + cell[axis] * m_cellSize[axis] - o[axis]) / d[axis];
+			}
+			else
+			{
+				step[axis] = 0;
+				tDelta[axis] = FLT_MAX;
+				tNext[axis] = FLT_MAX;
+			}
+		}
+
+		for (;;)
+		{
+			const uint32_t cellIndex = (cell[2] * m_dims[1] + cell[1]) * m_dims[0] + cell[0];
+			for (uint32_t i = m_cellBegin[cellIndex]; i < m_cellBegin[cellIndex + 1]; ++i)
+			{
+				IntersectTriangle(m_cellTriangles[i], o, d, outHit);
+			}
+
+			const int axis = (tNext[0] < tNext[1]) ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+			if (outHit.t <= tNext[axis])
+				return true;
+
+			cell[axis] += step[axis];
+			if (cell[axis] < 0 || cell[axis] >= m_dims[axis])
+				return outHit.triangle != ~0u;
+			tNext[axis] += tDelta[axis];
+		}
+	}
+
+	uint32_t CountBits(uint32_t word)
+	{
+		word = word - ((word >> 1) & 0x55555555u);
+		word = (word & 0x33333333u) + ((word >> 2) & 0x33333333u);
+		return (((word + (word >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24;
+	}
+}
+
+//
+// Bake
+//
+void BakePvs(JobSystem& jobs, const PvsScene& scene, const PvsBakeSettings& settings, PvsData& outPvs, PvsBakeStats& outStats)
+{
+	auto start = TimerClock::now();
+
+	outPvs = PvsData();
+	outStats = {};
+	if (scene.indices.empty() || scene.numInstances == 0)
+	{
+		return;
+	}
+	assert(scene.triangleInstances.size() == scene.indices.size() / 3);
+	assert(scene.instanceTransparent.empty() || scene.instanceTransparent.size() == scene.numInstances);
+
+	TriangleGrid grid;
+	grid.Build(scene);
+	outStats.numGridCells = grid.NumCells();
+
+	// Cells cover the triangle bounds
+	XMFLOAT3 boundsMin(FLT_MAX, FLT_MAX, FLT_MAX), boundsMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (const XMFLOAT3& p : scene.positions)
+	{
+		boundsMin = XMFLOAT3(std::min(boundsMin.x, p.x), std::min(boundsMin.y, p.y), std::min(boundsMin.z, p.z));
+		boundsMax = XMFLOAT3(std::max(boundsMax.x, p.x), std::max(boundsMax.y, p.y), std::max(boundsMax.z, p.z));
+	}
+	const float extent[3] = { boundsMax.x - boundsMin.x, boundsMax.y - boundsMin.y, boundsMax.z - boundsMin.z };
+	float cellSize = std::max(settings.cellSize, 1e-3f);
+	for (;;)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			outPvs.dims[axis] = std::max(static_cast<uint32_t>(ceilf(extent[axis] / cellSize)), 1u);
+		}
+		const double numCells = double(outPvs.dims[0]) * outPvs.dims[1] * outPvs.dims[2];
+		if (numCells <= settings.maxCells)
+			break;
+		cellSize *= 1.01f * static_cast<float>(cbrt(numCells / settings.maxCells));
+	}
+	outPvs.boundsMin = boundsMin;
+	outPvs.cellSize = cellSize;
+	outPvs.numInstances = scene.numInstances;
+	outPvs.wordsPerSet = (scene.numInstances + 31) / 32;
+
+	const uint32_t numCells = outPvs.NumCells();
+	const uint32_t words = outPvs.wordsPerSet;
+	std::vector<uint32_t> cellWords(static_cast<size_t>(numCells) * words, 0);
+	std::vector<uint8_t> navigable(numCells, 0);
+
+	// Instances hit from the current sample, per thread
+	std::vector<std::vector<uint32_t>> sampleHits(jobs.NumThreads());
+
+	jobs.ParallelFor(numCells, 16, [&](uint32_t begin, uint32_t end, uint32_t threadIndex)
+	{
+		std::vector<uint32_t>& hits = sampleHits[threadIndex];
+		std::uniform_real_distribution<float> unit(0.f, 1.f);
+		for (uint32_t cell = begin; cell < end; ++cell)
+		{
+			const uint32_t x = cell % outPvs.dims[0];
+			const uint32_t y = (cell / outPvs.dims[0]) % outPvs.dims[1];
+			const uint32_t z = cell / (outPvs.dims[0] * outPvs.dims[1]);
+			std::mt19937 rng(settings.seed ^ (cell * 0x9E3779B9u));
+			uint32_t* bits = &cellWords[static_cast<size_t>(cell) * words];
+
+			for (uint32_t sample = 0; sample < settings.samplesPerCell; ++sample)
+			{
+				const XMFLOAT3 origin(
+					boundsMin.x + (x + unit(rng)) * cellSize,
+					boundsMin.y + (y + unit(rng)) * cellSize,
+					boundsMin.z + (z + unit(rng)) * cellSize);
+
+				hits.clear();
+				uint32_t numBackFaces = 0;
+				for (uint32_t ray = 0; ray < settings.raysPerSample; ++ray)
+				{
+					// Uniform on the sphere
+					const float cosTheta = 1.f - 2.f * unit(rng);
+					const float sinTheta = sqrtf(std::max(1.f - cosTheta * cosTheta, 0.f));
+					const float phi = XM_PI * 2.f * unit(rng);
+					const XMFLOAT3 direction(sinTheta * cosf(phi), sinTheta * sinf(phi), cosTheta);
+
+					// Transparent hits are seen, the ray continues past them
+					XMFLOAT3 rayOrigin = origin;
+					RayHit hit;
+					for (uint32_t transparentHits = 0; grid.Trace(rayOrigin, direction, hit); ++transparentHits)
+					{
+						const uint32_t instanceIndex = scene.triangleInstances[hit.triangle];
+						hits.push_back(instanceIndex);
+						if (!scene.IsTransparent(instanceIndex) || transparentHits == settings.maxTransparentHits)
+						{
+							numBackFaces += (hit.backFace && !scene.IsTransparent(instanceIndex)) ? 1 : 0;
+							break;
+						}
+						rayOrigin = XMFLOAT3(rayOrigin.x + direction.x * hit.t, rayOrigin.y + direction.y * hit.t, rayOrigin.z + direction.z * hit.t);
+					}
+				}
+
+				if (numBackFaces > settings.solidThreshold * settings.raysPerSample)
+					continue;
+
+				navigable[cell] = 1;
+				for (uint32_t instanceIndex : hits)
+				{
+					bits[instanceIndex / 32] |= 1u << (instanceIndex % 32);
+				}
+			}
+		}
+	});
+	outStats.numRays = uint64_t(numCells) * settings.samplesPerCell * settings.raysPerSample;
+
+	// Neighbours fill in what the samples missed near cell borders
+	std::vector<uint32_t> dilatedWords;
+	if (settings.dilation > 0)
+	{
+		dilatedWords.assign(cellWords.size(), 0);
+		const int radius = static_cast<int>(settings.dilation);
+		jobs.ParallelFor(numCells, 64, [&](uint32_t begin, uint32_t end, uint32_t)
+		{
+			for (uint32_t cell = begin; cell < end; ++cell)
+			{
+				if (!navigable[cell])
+					continue;
+
+				const int x = cell % outPvs.dims[0];
+				const int y = (cell / outPvs.dims[0]) % outPvs.dims[1];
+				const int z = cell / (outPvs.dims[0] * outPvs.dims[1]);
+				uint32_t* bits = &dilatedWords[static_cast<size_t>(cell) * words];
+				for (int nz = std::max(z - radius, 0); nz <= std::min(z + radius, static_cast<int>(outPvs.dims[2]) - 1); ++nz)
+				{
+					for (int ny = std::max(y - radius, 0); ny <= std::min(y + radius, static_cast<int>(outPvs.dims[1]) - 1); ++ny)
+					{
+						for (int nx = std::max(x - radius, 0); nx <= std::min(x + radius, static_cast<int>(outPvs.dims[0]) - 1); ++nx)
+						{
+							const uint32_t neighbour = (nz * outPvs.dims[1] + ny) * outPvs.dims[0] + nx;
+							if (!navigable[neighbour])
+								continue;
+							const uint32_t* neighbourBits = &cellWords[static_cast<size_t>(neighbour) * words];
+							for (uint32_t w = 0; w < words; ++w)
+							{
+								bits[w] |= neighbourBits[w];
+							}
+						}
+					}
+				}
+			}
+		});
+		cellWords.swap(dilatedWords);
+	}
+
+	// Deduplicate, neighbouring cells mostly see the same instances
+	std::unordered_map<uint64_t, std::vector<uint32_t>> setsByHash;
+	outPvs.cellSets.assign(numCells, PvsNoSet);
+	uint64_t numVisible = 0;
+	for (uint32_t cell = 0; cell < numCells; ++cell)
+	{
+		if (!navigable[cell])
+			continue;
+
+		const uint32_t* bits = &cellWords[static_cast<size_t>(cell) * words];
+		uint64_t hash = 14695981039346656037ull;
+		for (uint32_t w = 0; w < words; ++w)
+		{
+			hash = (hash ^ bits[w]) * 1099511628211ull;
+			numVisible += CountBits(bits[w]);
+		}
+
+		std::vector<uint32_t>& candidates = setsByHash[hash];
+		for (uint32_t set : candidates)
+		{
+			if (memcmp(&outPvs.setWords[static_cast<size_t>(set) * words], bits, words * sizeof(uint32_t)) == 0)
+			{
+				outPvs.cellSets[cell] = set;
+				break;
+			}
+		}
+		if (outPvs.cellSets[cell] == PvsNoSet)
+		{
+			const uint32_t set = outPvs.NumSets();
+			outPvs.setWords.insert(outPvs.setWords.end(), bits, bits + words);
+			candidates.push_back(set);
+			outPvs.cellSets[cell] = set;
+		}
+		++outStats.numNavigable;
+	}
+
+	outStats.numCells = numCells;
+	outStats.numSets = outPvs.NumSets();
+	outStats.averageVisible = outStats.numNavigable > 0 ? double(numVisible) / outStats.numNavigable : 0.0;
+	outStats.bakeMs = ElapsedMs(start);
+	outStats.fileBytes = sizeof(PvsFileHeader) + (outPvs.cellSets.size() + outPvs.setWords.size()) * sizeof(uint32_t);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+#include "JobSystem.h"
+
+// Potentially visible sets of static instances (no D3D dependency, the baker runs headless)
+// The scene bounds are split into a grid of cubic cells. Rays cast from random points of a cell
+// find the instances seen from it, a point where most rays hit back faces is inside geometry.
+// Cells without a free point aren't navigable and have no set, nothing is filtered there.
+// Transparent instances (alpha mask or blend) are seen but don't stop rays, the sets stay conservative.
+// Sets are instance bitsets, identical ones are stored once.
+
+static const uint32_t PvsNoSet = ~0u;
+
+struct PvsData
+{
+	DirectX::XMFLOAT3 boundsMin = {};
+	float cellSize = 1.f;
+	uint32_t dims[3] = {};
+	uint32_t numInstances = 0;
+	uint32_t wordsPerSet = 0;
+	std::vector<uint32_t> cellSets;		// Per cell, x fastest, index of its set or PvsNoSet
+	std::vector<uint32_t> setWords;		// wordsPerSet per set
+
+	bool IsEmpty() const { return cellSets.empty(); }
+	uint32_t NumCells() const { return dims[0] * dims[1] * dims[2]; }
+	uint32_t NumSets() const { return wordsPerSet > 0 ? static_cast<uint32_t>(setWords.size() / wordsPerSet) : 0; }
+
+	// Cell containing position, PvsNoSet outside the grid
+	uint32_t FindCell(const DirectX::XMFLOAT3& position) const;
+
+	// Bitset of the cell, nullptr when it has none
+	const uint32_t* CellSet(uint32_t cell) const;
+
+	// Cooked file, little endian, rejected when the version or instance count differ
+	bool Save(const std::string& filePath) const;
+	bool Load(const std::string& filePath, uint32_t expectedInstances);
+};
+
+// World space triangles, triangleInstances holds the instance of every triangle
+struct PvsScene
+{
+	std::vector<DirectX::XMFLOAT3> positions;
+	std::vector<uint32_t> indices;
+	std::vector<uint32_t> triangleInstances;
+	std::vector<uint8_t> instanceTransparent;	// Per instance, empty when everything is opaque
+	uint32_t numInstances = 0;
+
+	bool IsTransparent(uint32_t instance) const { return instance < instanceTransparent.size() && instanceTransparent[instance] != 0; }
+};
+
+struct PvsBakeSettings
+{
+	float cellSize = 2.f;
+	uint32_t samplesPerCell = 8;
+	uint32_t raysPerSample = 256;
+	float solidThreshold = 0.5f;	// Opaque back face hit fraction above which a sample is inside geometry
+	uint32_t maxTransparentHits = 16;	// Per ray, the ray stops at the next one
+	uint32_t dilation = 1;			// Sets include navigable neighbours this many cells away, hides sampling gaps
+	uint32_t maxCells = 1 << 20;	// Cell size grows until the grid fits
+	uint32_t seed = 1234;			// Per cell streams, the bake doesn't depend on the thread count
+};
+
+struct PvsBakeStats
+{
+	uint32_t numCells = 0;
+	uint32_t numNavigable = 0;
+	uint32_t numSets = 0;			// After deduplication
+	double averageVisible = 0.0;	// Instances per navigable cell
+	uint64_t numRays = 0;
+	uint32_t numGridCells = 0;		// Triangle grid used for ray casting
+	double bakeMs = 0.0;
+	uint64_t fileBytes = 0;			// Cell table and sets
+};
+
+void BakePvs(JobSystem& jobs, const PvsScene& scene, const PvsBakeSettings& settings, PvsData& outPvs, PvsBakeStats& outStats);
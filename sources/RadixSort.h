@@ -0,0 +1,125 @@
+#pragma once
+
+#include "JobSystem.h"
+
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+// Parallel LSD radix sort on 64 bit keys (no D3D dependency)
+// Contiguous blocks, counted and scattered by one thread each, keep the sort stable. The histograms of
+// every digit come from one read, passes where every key has the same digit are skipped.
+
+static const uint32_t RadixSortBuckets = 256;
+static const uint32_t RadixSortMinBlockSize = 16 * 1024;
+
+// keyOf(item) returns the uint64_t key, bits [firstBit, lastBit) are sorted 8 per pass (whole bytes)
+// scratch is resized to items.size(), result ends in items
+template <typename T, typename KeyFunc>
+void RadixSort(JobSystem& jobs, std::vector<T>& items, std::vector<T>& scratch, KeyFunc keyOf, uint32_t firstBit = 0, uint32_t lastBit = 64)
+{
+	const uint32_t count = static_cast<uint32_t>(items.size());
+	const uint32_t numPasses = (lastBit - firstBit + 7) / 8;
+	if (count < 2 || numPasses == 0)
+	{
+		return;
+	}
+	scratch.resize(count);
+
+	const uint32_t numBlocks = std::max(1u, std::min(jobs.NumThreads(), count / RadixSortMinBlockSize));
+	const uint32_t blockSize = (count + numBlocks - 1) / numBlocks;
+
+	// Per block and digit
+	std::vector<uint32_t> histograms(static_cast<size_t>(numBlocks) * numPasses * RadixSortBuckets, 0);
+	auto countBlock = [&](uint32_t block, const T* src, uint32_t firstPass, uint32_t lastPass)
+	{
+		const uint32_t begin = block * blockSize;
+		const uint32_t end = std::min(begin + blockSize, count);
+		for (uint32_t pass = firstPass; pass < lastPass; ++pass)
+		{
+			uint32_t* histogram = &histograms[(block * numPasses + pass) * RadixSortBuckets];
+			memset(histogram, 0, RadixSortBuckets * sizeof(uint32_t));
+			const uint32_t shift = firstBit + pass * 8;
+			for (uint32_t i = begin; i < end; ++i)
+			{
+				++histogram[(keyOf(src[i]) >> shift) & 0xFF];
+			}
+		}
+	};
+
+	jobs.ParallelFor(numBlocks, 1, [&](uint32_t begin, uint32_t end, uint32_t)
+	{
+		for (uint32_t block = begin; block < end; ++block)
+		{
+			countBlock(block, items.data(), 0, numPasses);
+		}
+	});
+
+	T* src = items.data();
+	T* dst = scratch.data();
+	std::vector<uint32_t> offsets(numBlocks * RadixSortBuckets);
+	bool countsValid = true;	// Per block counts go stale once items move between blocks
+	for (uint32_t pass = 0; pass < numPasses; ++pass)
+	{
+		// Block totals are still valid, every key in one bucket means nothing to do
+		bool singleBucket = false;
+		for (uint32_t bucket = 0; bucket < RadixSortBuckets && !singleBucket; ++bucket)
+		{
+			uint32_t total = 0;
+			for (uint32_t block = 0; block < numBlocks; ++block)
+			{
+				total += histograms[(block * numPasses + pass) * RadixSortBuckets + bucket];
+			}
+			singleBucket = (total == count);
+		}
+		if (singleBucket)
+		{
+			continue;
+		}
+
+		if (!countsValid)
+		{
+			jobs.ParallelFor(numBlocks, 1, [&](uint32_t begin, uint32_t end, uint32_t)
+			{
+				for (uint32_t block = begin; block < end; ++block)
+				{
+					countBlock(block, src, pass, pass + 1);
+				}
+			});
+		}
+
+		// Bucket major, block minor
+		uint32_t offset = 0;
+		for (uint32_t bucket = 0; bucket < RadixSortBuckets; ++bucket)
+		{
+			for (uint32_t block = 0; block < numBlocks; ++block)
+			{
+				offsets[block * RadixSortBuckets + bucket] = offset;
+				offset += histograms[(block * numPasses + pass) * RadixSortBuckets + bucket];
+			}
+		}
+
+		const uint32_t shift = firstBit + pass * 8;
+		jobs.ParallelFor(numBlocks, 1, [&](uint32_t begin, uint32_t end, uint32_t)
+		{
+			for (uint32_t block = begin; block < end; ++block)
+			{
+				uint32_t* blockOffsets = &offsets[block * RadixSortBuckets];
+				const uint32_t first = block * blockSize;
+				const uint32_t last = std::min(first + blockSize, count);
+				for (uint32_t i = first; i < last; ++i)
+				{
+					dst[blockOffsets[(keyOf(src[i]) >> shift) & 0xFF]++] = src[i];
+				}
+			}
+		});
+
+		std::swap(src, dst);
+		countsValid = false;
+	}
+
+	if (src != items.data())
+	{
+		items.swap(scratch);
+	}
+}
@@ -0,0 +1,694 @@
+#include "RayPacket.h"
+#include "Utility.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+#include <emmintrin.h>
+
+using namespace DirectX;
+
+namespace
+{
+	const uint32_t NoRay = ~0u;
+	const float StreamCoherence = 0.9f;	// Length of the mean ray direction
+
+	// Structure of arrays, 4 lane groups. Inactive lanes (padding, occluded) have tMin above tMax
+	struct alignas(16) Packet
+	{
+		float origin[3][MaxRayPacketSize];
+		float direction[3][MaxRayPacketSize];
+		float invDir[3][MaxRayPacketSize];	// Zero components replaced by a tiny value, the frustum stays finite
+		float tMin[MaxRayPacketSize];
+		float tMax[MaxRayPacketSize];		// Closest hit so far
+		uint32_t numRays;
+		uint32_t numGroups;
+
+		// Interval arithmetic frustum, only when every ray has the same direction signs
+		bool coherent;
+		bool negative[3];
+		float originMin[3];
+		float originMax[3];
+		float invDirMin[3];
+		float invDirMax[3];
+		float tMinAll;			// Smallest tMin
+		float tMaxAll;			// Largest tMax, shrinks as hits are found
+		float meanDirection[3];	// Near child first
+	};
+
+	struct StackEntry
+	{
+		uint32_t nodeIndex;
+		uint32_t firstActive;	// Rays before it missed an ancestor
+	};
+}
+
+static float SafeInverse(float d)
+{
+	return (fabsf(d) > 1e-20f) ? 1.f / d : copysignf(1e20f, d);
+}
+
+static void SetInactive(Packet& packet, uint32_t lane)
+{
+	packet.tMin[lane] = FLT_MAX;
+	packet.tMax[lane] = 0.f;
+}
+
+// hits gives the starting tMax of closest hit queries, nullptr for any hit queries
+static void SetupPacket(const BVHRay* rays, uint32_t numRays, const BVHHit* hits, Packet& packet)
+{
+	packet.numRays = numRays;
+	packet.numGroups = (numRays + 3) / 4;
+	for (uint32_t lane = 0; lane < packet.numGroups * 4; ++lane)
+	{
+		const BVHRay& ray = rays[lane < numRays ? lane : 0];
+		const float origin[3] = { ray.origin.x, ray.origin.y, ray.origin.z };
+		const float direction[3] = { ray.direction.x, ray.direction.y, ray.direction.z };
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			packet.origin[axis][lane] = origin[axis];
+			packet.direction[axis][lane] = direction[axis];
+			packet.invDir[axis][lane] = SafeInverse(direction[axis]);
+		}
+		packet.tMin[lane] = ray.tMin;
+		packet.tMax[lane] = hits ? std::min(ray.tMax, hits[lane < numRays ? lane : 0].t) : ray.tMax;
+		if (lane >= numRays)
+		{
+			SetInactive(packet, lane);
+		}
+	}
+
+	packet.coherent = true;
+	packet.tMinAll = FLT_MAX;
+	packet.tMaxAll = -FLT_MAX;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		packet.originMin[axis] = packet.invDirMin[axis] = FLT_MAX;
+		packet.originMax[axis] = packet.invDirMax[axis] = -FLT_MAX;
+		packet.meanDirection[axis] = 0.f;
+		for (uint32_t lane = 0; lane < numRays; ++lane)
+		{
+			packet.originMin[axis] = std::min(packet.originMin[axis], packet.origin[axis][lane]);
+			packet.originMax[axis] = std::max(packet.originMax[axis], packet.origin[axis][lane]);
+			packet.invDirMin[axis] = std::min(packet.invDirMin[axis], packet.invDir[axis][lane]);
+			packet.invDirMax[axis] = std::max(packet.invDirMax[axis], packet.invDir[axis][lane]);
+			packet.meanDirection[axis] += packet.direction[axis][lane];
+		}
+		packet.negative[axis] = packet.invDirMax[axis] < 0.f;
+		packet.coherent = packet.coherent && (packet.negative[axis] || packet.invDirMin[axis] > 0.f);
+	}
+	for (uint32_t lane = 0; lane < numRays; ++lane)
+	{
+		packet.tMinAll = std::min(packet.tMinAll, packet.tMin[lane]);
+		packet.tMaxAll = std::max(packet.tMaxAll, packet.tMax[lane]);
+	}
+}
+
+static void UpdatePacketTMax(Packet& packet)
+{
+	packet.tMaxAll = -FLT_MAX;
+	for (uint32_t lane = 0; lane < packet.numRays; ++lane)
+	{
+		packet.tMaxAll = std::max(packet.tMaxAll, packet.tMax[lane]);
+	}
+}
+
+//
+// Node tests
+//
+
+// Same slab test as IntersectBVHNode
+static bool LaneHitsNode(const Packet& packet, uint32_t lane, const TriangleBVHNode& node)
+{
+	const float tx0 = (node.boundsMin.x - packet.origin[0][lane]) * packet.invDir[0][lane], tx1 = (node.boundsMax.x - packet.origin[0][lane]) * packet.invDir[0][lane];
+	const float ty0 = (node.boundsMin.y - packet.origin[1][lane]) * packet.invDir[1][lane], ty1 = (node.boundsMax.y - packet.origin[1][lane]) * packet.invDir[1][lane];
+	const float tz0 = (node.boundsMin.z - packet.origin[2][lane]) * packet.invDir[2][lane], tz1 = (node.boundsMax.z - packet.origin[2][lane]) * packet.invDir[2][lane];
+
+	float tNear = packet.tMin[lane], tFar = packet.tMax[lane];
+	tNear = std::max(tNear, std::min(tx0, tx1));
+	tFar = std::min(tFar, std::max(tx0, tx1));
+	tNear = std::max(tNear, std::min(ty0, ty1));
+	tFar = std::min(tFar, std::max(ty0, ty1));
+	tNear = std::max(tNear, std::min(tz0, tz1));
+	tFar = std::min(tFar, std::max(tz0, tz1));
+	return tNear <= tFar;
+}
+
+// Mask of the 4 lanes of group hitting the node
+static int GroupHitsNode(const Packet& packet, uint32_t group, const TriangleBVHNode& node)
+{
+	const uint32_t lane = group * 4;
+	__m128 tNear = _mm_load_ps(packet.tMin + lane);
+	__m128 tFar = _mm_load_ps(packet.tMax + lane);
+	const float boundsMin[3] = { node.boundsMin.x, node.boundsMin.y, node.boundsMin.z };
+	const float boundsMax[3] = { node.boundsMax.x, node.boundsMax.y, node.boundsMax.z };
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const __m128 origin = _mm_load_ps(packet.origin[axis] + lane);
+		const __m128 invDir = _mm_load_ps(packet.invDir[axis] + lane);
+		const __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boundsMin[axis]), origin), invDir);
+		const __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boundsMax[axis]), origin), invDir);
+		tNear = _mm_max_ps(tNear, _mm_min_ps(t0, t1));
+		tFar = _mm_min_ps(tFar, _mm_max_ps(t0, t1));
+	}
+	return _mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+}
+
+// Slab distances of every ray lie between the corner products of the origin and inverse direction
+// intervals (rounding is monotonic), so a box entered after it is left by all of them is missed by all
+static bool FrustumMissesNode(const Packet& packet, const TriangleBVHNode& node)
+{
+	const float boundsMin[3] = { node.boundsMin.x, node.boundsMin.y, node.boundsMin.z };
+	const float boundsMax[3] = { node.boundsMax.x, node.boundsMax.y, node.boundsMax.z };
+	float entry = packet.tMinAll, exit = packet.tMaxAll;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float tMin[2], tMax[2];
+		const float planes[2] = { boundsMin[axis], boundsMax[axis] };
+		for (int side = 0; side < 2; ++side)
+		{
+			const float a = (planes[side] - packet.originMax[axis]) * packet.invDirMin[axis];
+			const float b = (planes[side] - packet.originMax[axis]) * packet.invDirMax[axis];
+			const float c = (planes[side] - packet.originMin[axis]) * packet.invDirMin[axis];
+			const float d = (planes[side] - packet.originMin[axis]) * packet.invDirMax[axis];
+			tMin[side] = std::min(std::min(a, b), std::min(c, d));
+			tMax[side] = std::max(std::max(a, b), std::max(c, d));
+		}
+		const int enter = packet.negative[axis] ? 1 : 0;
+		entry = std::max(entry, tMin[enter]);
+		exit = std::min(exit, tMax[1 - enter]);
+	}
+	return entry > exit;
+}
+
+// First ray from firstActive on hitting the node, NoRay when culled. The first active ray is tried
+// alone, then the frustum, then the other rays a group at a time
+static uint32_t FirstHitRay(const Packet& packet, const TriangleBVHNode& node, uint32_t firstActive)
+{
+	if (LaneHitsNode(packet, firstActive, node))
+		return firstActive;
+	if (packet.coherent && FrustumMissesNode(packet, node))
+		return NoRay;
+
+	for (uint32_t group = firstActive / 4; group < packet.numGroups; ++group)
+	{
+		int mask = GroupHitsNode(packet, group, node);
+		if (group == firstActive / 4)
+		{
+			mask &= ~((2 << (firstActive % 4)) - 1);
+		}
+		for (uint32_t bit = 0; bit < 4; ++bit)
+		{
+			if (mask & (1 << bit))
+				return group * 4 + bit;
+		}
+	}
+	return NoRay;
+}
+
+//
+// Leaf tests
+//
+
+// Groups with a ray hitting the leaf box, divergent packets skip the others
+static uint32_t ActiveGroups(const Packet& packet, const TriangleBVHNode& node, uint32_t firstActive)
+{
+	uint32_t groups = 1u << (firstActive / 4);
+	for (uint32_t group = firstActive / 4 + 1; group < packet.numGroups; ++group)
+	{
+		groups |= (GroupHitsNode(packet, group, node) != 0) ? 1u << group : 0u;
+	}
+	return groups;
+}
+
+// Möller-Trumbore of IntersectTriangle on 4 rays, same operations in the same order. Mask of hits
+// in [tMin, tMax), t, u, v and back faces of all lanes
+static int IntersectTriangleGroup(const Packet& packet, uint32_t group, const TriangleBVH::Triangle& triangle, __m128& t, __m128& u, __m128& v, int& backFaces)
+{
+	const uint32_t lane = group * 4;
+	const __m128 dx = _mm_load_ps(packet.direction[0] + lane);
+	const __m128 dy = _mm_load_ps(packet.direction[1] + lane);
+	const __m128 dz = _mm_load_ps(packet.direction[2] + lane);
+	const __m128 e1x = _mm_set1_ps(triangle.e1.x), e1y = _mm_set1_ps(triangle.e1.y), e1z = _mm_set1_ps(triangle.e1.z);
+	const __m128 e2x = _mm_set1_ps(triangle.e2.x), e2y = _mm_set1_ps(triangle.e2.y), e2z = _mm_set1_ps(triangle.e2.z);
+
+	const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+	const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+	const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+	const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+	const __m128 absDet = _mm_andnot_ps(_mm_set1_ps(-0.f), det);
+	__m128 reject = _mm_cmplt_ps(absDet, _mm_set1_ps(1e-12f));
+
+	const __m128 invDet = _mm_div_ps(_mm_set1_ps(1.f), det);
+	const __m128 sx = _mm_sub_ps(_mm_load_ps(packet.origin[0] + lane), _mm_set1_ps(triangle.v0.x));
+	const __m128 sy = _mm_sub_ps(_mm_load_ps(packet.origin[1] + lane), _mm_set1_ps(triangle.v0.y));
+	const __m128 sz = _mm_sub_ps(_mm_load_ps(packet.origin[2] + lane), _mm_set1_ps(triangle.v0.z));
+	u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+	reject = _mm_or_ps(reject, _mm_or_ps(_mm_cmplt_ps(u, _mm_setzero_ps()), _mm_cmpgt_ps(u, _mm_set1_ps(1.f))));
+
+	const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+	const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+	const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+	v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+	reject = _mm_or_ps(reject, _mm_or_ps(_mm_cmplt_ps(v, _mm_setzero_ps()), _mm_cmpgt_ps(_mm_add_ps(u, v), _mm_set1_ps(1.f))));
+
+	t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+	reject = _mm_or_ps(reject, _mm_cmplt_ps(t, _mm_load_ps(packet.tMin + lane)));
+	reject = _mm_or_ps(reject, _mm_cmpge_ps(t, _mm_load_ps(packet.tMax + lane)));
+
+	backFaces = _mm_movemask_ps(_mm_cmplt_ps(det, _mm_setzero_ps()));
+	return ~_mm_movemask_ps(reject) & 0xF;
+}
+
+//
+// Traversal
+//
+
+void IntersectPacket(const TriangleBVH& bvh, const BVHRay* rays, uint32_t numRays, BVHHit* hits)
+{
+	assert(numRays <= MaxRayPacketSize);
+	if (bvh.IsEmpty() || numRays == 0)
+	{
+		return;
+	}
+
+	Packet packet;
+	SetupPacket(rays, numRays, hits, packet);
+	const TriangleBVHNode* nodes = bvh.Nodes().data();
+	const TriangleBVH::Triangle* triangles = bvh.Triangles().data();
+	const uint32_t* triIndices = bvh.TriangleIndices().data();
+
+	StackEntry stack[TriangleBVH::MaxDepth + 1];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = { 0, 0 };
+	while (stackSize > 0)
+	{
+		const StackEntry entry = stack[--stackSize];
+		const TriangleBVHNode& node = nodes[entry.nodeIndex];
+		const uint32_t firstActive = FirstHitRay(packet, node, entry.firstActive);
+		if (firstActive == NoRay)
+			continue;
+
+		if (node.IsLeaf())
+		{
+			bool found = false;
+			const uint32_t groups = ActiveGroups(packet, node, firstActive);
+			for (uint32_t i = node.leftFirst; i < node.leftFirst + node.numTriangles; ++i)
+			{
+				for (uint32_t group = firstActive / 4; group < packet.numGroups; ++group)
+				{
+					if (!(groups & (1 << group)))
+						continue;
+					__m128 t, u, v;
+					int backFaces;
+					const int mask = IntersectTriangleGroup(packet, group, triangles[i], t, u, v, backFaces);
+					if (mask == 0)
+						continue;
+
+					alignas(16) float laneT[4], laneU[4], laneV[4];
+					_mm_store_ps(laneT, t);
+					_mm_store_ps(laneU, u);
+					_mm_store_ps(laneV, v);
+					for (uint32_t bit = 0; bit < 4; ++bit)
+					{
+						if (!(mask & (1 << bit)))
+							continue;
+						const uint32_t lane = group * 4 + bit;
+						packet.tMax[lane] = laneT[bit];
+						BVHHit& hit = hits[lane];
+						hit.t = laneT[bit];
+						hit.u = laneU[bit];
+						hit.v = laneV[bit];
+						hit.triangle = triIndices[i];
+						hit.backFace = (backFaces & (1 << bit)) != 0;
+					}
+					found = true;
+				}
+			}
+			if (found)
+			{
+				UpdatePacketTMax(packet);
+			}
+			continue;
+		}
+
+		// Near child first along the packet's mean direction
+		const TriangleBVHNode& left = nodes[node.leftFirst];
+		const TriangleBVHNode& right = nodes[node.leftFirst + 1];
+		const float toRight =
+			packet.meanDirection[0] * ((right.boundsMin.x + right.boundsMax.x) - (left.boundsMin.x + left.boundsMax.x)) +
+			packet.meanDirection[1] * ((right.boundsMin.y + right.boundsMax.y) - (left.boundsMin.y + left.boundsMax.y)) +
+			packet.meanDirection[2] * ((right.boundsMin.z + right.boundsMax.z) - (left.boundsMin.z + left.boundsMax.z));
+		const uint32_t nearChild = (toRight >= 0.f) ? node.leftFirst : node.leftFirst + 1;
+		const uint32_t farChild = (toRight >= 0.f) ? node.leftFirst + 1 : node.leftFirst;
+		assert(stackSize + 2 <= TriangleBVH::MaxDepth + 1);
+		stack[stackSize++] = { farChild, firstActive };
+		stack[stackSize++] = { nearChild, firstActive };
+	}
+}
+
+uint32_t OccludedPacket(const TriangleBVH& bvh, const BVHRay* rays, uint32_t numRays)
+{
+	assert(numRays <= MaxRayPacketSize);
+	if (bvh.IsEmpty() || numRays == 0)
+	{
+		return 0;
+	}
+
+	Packet packet;
+	SetupPacket(rays, numRays, nullptr, packet);
+	const TriangleBVHNode* nodes = bvh.Nodes().data();
+	const TriangleBVH::Triangle* triangles = bvh.Triangles().data();
+
+	const uint32_t allRays = (1u << numRays) - 1;
+	uint32_t occluded = 0;
+	StackEntry stack[TriangleBVH::MaxDepth + 1];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = { 0, 0 };
+	while (stackSize > 0)
+	{
+		const StackEntry entry = stack[--stackSize];
+		const TriangleBVHNode& node = nodes[entry.nodeIndex];
+		const uint32_t firstActive = FirstHitRay(packet, node, entry.firstActive);
+		if (firstActive == NoRay)
+			continue;
+
+		if (node.IsLeaf())
+		{
+			const uint32_t groups = ActiveGroups(packet, node, firstActive);
+			for (uint32_t i = node.leftFirst; i < node.leftFirst + node.numTriangles; ++i)
+			{
+				for (uint32_t group = firstActive / 4; group < packet.numGroups; ++group)
+				{
+					if (!(groups & (1 << group)))
+						continue;
+					__m128 t, u, v;
+					int backFaces;
+					const int mask = IntersectTriangleGroup(packet, group, triangles[i], t, u, v, backFaces);
+					for (uint32_t bit = 0; bit < 4; ++bit)
+					{
+						if (mask & (1 << bit))
+						{
+							occluded |= 1u << (group * 4 + bit);
+							SetInactive(packet, group * 4 + bit);
+						}
+					}
+				}
+			}
+			if (occluded == allRays)
+				break;
+			continue;
+		}
+
+		assert(stackSize + 2 <= TriangleBVH::MaxDepth + 1);
+		stack[stackSize++] = { node.leftFirst + 1, firstActive };
+		stack[stackSize++] = { node.leftFirst, firstActive };
+	}
+	return occluded;
+}
+
+//
+// Streams
+//
+
+// 10 bit value to every third bit, as the LBVH Morton codes
+static uint32_t ExpandBits(uint32_t v)
+{
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+static uint32_t Quantize(float value, float scale, uint32_t maxValue)
+{
+	return static_cast<uint32_t>(std::min(std::max(value * scale, 0.f), static_cast<float>(maxValue)));
+}
+
+// Sorted packets of divergent rays are slower than single rays, traced one by one when the
+// directions spread over more than a cone of about 25 degrees
+static bool IsCoherent(const BVHRay* rays, uint32_t numRays)
+{
+	float sum[3] = {};
+	for (uint32_t i = 0; i < numRays; ++i)
+	{
+		const XMFLOAT3& d = rays[i].direction;
+		const float length = sqrtf(d.x * d.x + d.y * d.y + d.z * d.z);
+		const float invLength = (length > 0.f) ? 1.f / length : 0.f;
+		sum[0] += d.x * invLength;
+		sum[1] += d.y * invLength;
+		sum[2] += d.z * invLength;
+	}
+	return sqrtf(sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]) >= StreamCoherence * numRays;
+}
+
+void RayStream::Sort(JobSystem& jobs, const TriangleBVH& bvh, const BVHRay* rays, uint32_t numRays)
+{
+	const TriangleBVHNode& root = bvh.Nodes()[0];
+	const float extent[3] = { root.boundsMax.x - root.boundsMin.x, root.boundsMax.y - root.boundsMin.y, root.boundsMax.z - root.boundsMin.z };
+	float scale[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		scale[axis] = (extent[axis] > 0.f) ? 1024.f / extent[axis] : 0.f;
+	}
+
+	// 10 bits of origin then 4 bits of direction per axis. The top direction bit is the sign, rays
+	// with the same origin cell and octant end up in the same packets
+	m_order.resize(numRays);
+	jobs.ParallelFor(numRays, 4096, [&](uint32_t begin, uint32_t end, uint32_t)
+	{
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			const BVHRay& ray = rays[i];
+			const float length = sqrtf(ray.direction.x * ray.direction.x + ray.direction.y * ray.direction.y + ray.direction.z * ray.direction.z);
+			const float invLength = (length > 0.f) ? 1.f / length : 0.f;
+			const uint64_t directionCode =
+				(ExpandBits(Quantize(ray.direction.x * invLength + 1.f, 8.f, 15)) << 2) |
+				(ExpandBits(Quantize(ray.direction.y * invLength + 1.f, 8.f, 15)) << 1) |
+				ExpandBits(Quantize(ray.direction.z * invLength + 1.f, 8.f, 15));
+			const uint64_t originCode =
+				(ExpandBits(Quantize(ray.origin.x - root.boundsMin.x, scale[0], 1023)) << 2) |
+				(ExpandBits(Quantize(ray.origin.y - root.boundsMin.y, scale[1], 1023)) << 1) |
+				ExpandBits(Quantize(ray.origin.z - root.boundsMin.z, scale[2], 1023));
+			m_order[i].key = (originCode << 12) | directionCode;
+			m_order[i].index = i;
+		}
+	});
+
+	std::sort(m_order.begin(), m_order.end(), [](const SortEntry& a, const SortEntry& b)
+	{
+		return (a.key != b.key) ? a.key < b.key : a.index < b.index;
+	});
+}
+
+void RayStream::Intersect(JobSystem& jobs, const TriangleBVH& bvh, const BVHRay* rays, uint32_t numRays, BVHHit* hits, uint32_t packetSize)
+{
+	assert(packetSize > 0 && packetSize <= MaxRayPacketSize);
+	m_stats = {};
+	if (bvh.IsEmpty() || numRays == 0)
+	{
+		return;
+	}
+
+	auto start = TimerClock::now();
+	Sort(jobs, bvh, rays, numRays);
+	m_stats.sortMs = ElapsedMs(start);
+	start = TimerClock::now();
+
+	const uint32_t numPackets = (numRays + packetSize - 1) / packetSize;
+	jobs.ParallelFor(numPackets, 64, [&](uint32_t begin, uint32_t end, uint32_t)
+	{
+		BVHRay packetRays[MaxRayPacketSize];
+		BVHHit packetHits[MaxRayPacketSize];
+		for (uint32_t p = begin; p < end; ++p)
+		{
+			const uint32_t first = p * packetSize;
+			const uint32_t count = std::min(packetSize, numRays - first);
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				packetRays[i] = rays[m_order[first + i].index];
+				packetHits[i] = hits[m_order[first + i].index];
+			}
+			if (IsCoherent(packetRays, count))
+			{
+				IntersectPacket(bvh, packetRays, count, packetHits);
+			}
+			else
+			{
+				for (uint32_t i = 0; i < count; ++i)
+				{
+					bvh.Intersect(packetRays[i], packetHits[i]);
+				}
+			}
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				hits[m_order[first + i].index] = packetHits[i];
+			}
+		}
+	});
+
+	m_stats.numRays = numRays;
+	m_stats.numPackets = numPackets;
+	m_stats.traceMs = ElapsedMs(start);
+}
+
+void RayStream::Occluded(JobSystem& jobs, const TriangleBVH& bvh, const BVHRay* rays, uint32_t numRays, uint8_t* outOccluded, uint32_t packetSize)
+{
+	assert(packetSize > 0 && packetSize <= MaxRayPacketSize);
+	m_stats = {};
+	if (bvh.IsEmpty() || numRays == 0)
+	{
+		std::fill(outOccluded, outOccluded + numRays, uint8_t(0));
+		return;
+	}
+
+	auto start = TimerClock::now();
+	Sort(jobs, bvh, rays, numRays);
+	m_stats.sortMs = ElapsedMs(start);
+	start = TimerClock::now();
+
+	const uint32_t numPackets = (numRays + packetSize - 1) / packetSize;
+	jobs.ParallelFor(numPackets, 64, [&](uint32_t begin, uint32_t end, uint32_t)
+	{
+		BVHRay packetRays[MaxRayPacketSize];
+		for (uint32_t p = begin; p < end; ++p)
+		{
+			const uint32_t first = p * packetSize;
+			const uint32_t count = std::min(packetSize, numRays - first);
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				packetRays[i] = rays[m_order[first + i].index];
+			}
+			uint32_t occluded = 0;
+			if (IsCoherent(packetRays, count))
+			{
+				occluded = OccludedPacket(bvh, packetRays, count);
+			}
+			else
+			{
+				for (uint32_t i = 0; i < count; ++i)
+				{
+					occluded |= bvh.Occluded(packetRays[i]) ? 1u << i : 0u;
+				}
+			}
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				outOccluded[m_order[first + i].index] = (occluded >> i) & 1;
+			}
+		}
+	});
+
+	m_stats.numRays = numRays;
+	m_stats.numPackets = numPackets;
+	m_stats.traceMs = ElapsedMs(start);
+}
+
+//
+// Benchmark
+//
+void RunRayPacketBenchmark(JobSystem& jobs, const TriangleMesh& mesh, const RayBenchmarkView& view, RayPacketBenchmarkResult& outResult)
+{
+	outResult = {};
+	outResult.numTriangles = mesh.numTriangles;
+	outResult.numThreads = jobs.NumThreads();
+
+	TriangleBVH bvh;
+	bvh.BuildSAH(jobs, mesh);
+	if (bvh.IsEmpty())
+	{
+		return;
+	}
+
+	std::vector<BVHRay> rays[RayBenchmarkKind_Count];
+	MakeViewBenchmarkRays(jobs, bvh, mesh, view, rays);
+
+	// Single rays are the reference. Packets visit every box one of their rays hits, so they can find a
+	// hit a rounding error in front of a box the single ray rejected
+	RayStream stream;
+	std::vector<BVHHit> reference, hits;
+	std::vector<uint8_t> referenceOccluded, occluded;
+	const int numRuns = 3;
+	for (uint32_t kind = 0; kind < RayBenchmarkKind_Count; ++kind)
+	{
+		const BVHRay* kindRays = rays[kind].data();
+		const uint32_t numRays = static_cast<uint32_t>(rays[kind].size());
+		const bool shadow = (kind == RayBenchmarkKind_Shadow);
+		outResult.numRays[kind] = numRays;
+		outResult.streamSortMs[kind] = DBL_MAX;
+
+		for (uint32_t mode = 0; mode < RayPacketMode_Count; ++mode)
+		{
+			const uint32_t packetSize = (mode == RayPacketMode_Packet8) ? 8 : MaxRayPacketSize;
+			const uint32_t numPackets = (numRays + packetSize - 1) / packetSize;
+			double bestMs = DBL_MAX;
+			for (int run = 0; run < numRuns; ++run)
+			{
+				hits.assign(numRays, BVHHit());
+				occluded.assign(numRays, 0);
+				auto start = TimerClock::now();
+				if (mode == RayPacketMode_Single)
+				{
+					jobs.ParallelFor(numRays, 1024, [&](uint32_t begin, uint32_t end, uint32_t)
+					{
+						for (uint32_t i = begin; i < end; ++i)
+						{
+							if (shadow)
+								occluded[i] = bvh.Occluded(kindRays[i]) ? 1 : 0;
+							else
+								bvh.Intersect(kindRays[i], hits[i]);
+						}
+					});
+				}
+				else if (mode == RayPacketMode_Stream)
+				{
+					if (shadow)
+						stream.Occluded(jobs, bvh, kindRays, numRays, occluded.data());
+					else
+						stream.Intersect(jobs, bvh, kindRays, numRays, hits.data());
+					outResult.streamSortMs[kind] = std::min(outResult.streamSortMs[kind], stream.Stats().sortMs);
+				}
+				else
+				{
+					jobs.ParallelFor(numPackets, 64, [&](uint32_t begin, uint32_t end, uint32_t)
+					{
+						for (uint32_t p = begin; p < end; ++p)
+						{
+							const uint32_t first = p * packetSize;
+							const uint32_t count = std::min(packetSize, numRays - first);
+							if (!shadow)
+							{
+								IntersectPacket(bvh, kindRays + first, count, hits.data() + first);
+								continue;
+							}
+							const uint32_t mask = OccludedPacket(bvh, kindRays + first, count);
+							for (uint32_t i = 0; i < count; ++i)
+							{
+								occluded[first + i] = (mask >> i) & 1;
+							}
+						}
+					});
+				}
+				bestMs = std::min(bestMs, ElapsedMs(start));
+			}
+			outResult.raysPerSecond[mode][kind] = (bestMs > 0.0) ? numRays / (bestMs * 1e-3) : 0.0;
+
+			if (mode == RayPacketMode_Single)
+			{
+				reference = hits;
+				referenceOccluded = occluded;
+				continue;
+			}
+			for (uint32_t i = 0; i < numRays; ++i)
+			{
+				const bool same = shadow ? (occluded[i] == referenceOccluded[i]) :
+					(hits[i].IsHit() == reference[i].IsHit() && fabsf(hits[i].t - reference[i].t) <= 1e-4f * std::max(1.f, reference[i].t));
+				outResult.numMismatches += same ? 0 : 1;
+			}
+		}
+		if (outResult.streamSortMs[kind] == DBL_MAX)
+		{
+			outResult.streamSortMs[kind] = 0.0;
+		}
+	}
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "TriangleBVH.h"
+#include "WideBVH.h"
+
+// Rays traced together through a TriangleBVH (no D3D dependency)
+// Packets of up to 16 rays walk the tree once. A node is entered as soon as the first active ray
+// hits it, culled when the interval arithmetic frustum of the packet misses it (rays with the same
+// direction signs), otherwise the remaining rays are tested 4 at a time with SSE. Leaves test the
+// rays 4 at a time with the Möller-Trumbore arithmetic of TriangleBVH.
+// Streams sort large batches by origin then direction and trace consecutive rays as packets, or one
+// by one where the sorted rays still diverge (diffuse bounces).
+
+static const uint32_t MaxRayPacketSize = 16;
+
+// Closest hit of every ray, same contract as TriangleBVH::Intersect. numRays up to MaxRayPacketSize
+void IntersectPacket(const TriangleBVH& bvh, const BVHRay* rays, uint32_t numRays, BVHHit* hits);
+
+// Bit i set when ray i is occluded, same contract as TriangleBVH::Occluded
+uint32_t OccludedPacket(const TriangleBVH& bvh, const BVHRay* rays, uint32_t numRays);
+
+struct RayStreamStats
+{
+	uint32_t numRays = 0;
+	uint32_t numPackets = 0;
+	double sortMs = 0.0;	// Keys and sort
+	double traceMs = 0.0;	// Gather, packets and scatter
+};
+
+// Sorting scratch is kept across calls
+class RayStream
+{
+public:
+	// Any number of rays, in and out in the caller's order. packetSize is 8 or 16 (up to MaxRayPacketSize)
+	void Intersect(JobSystem& jobs, const TriangleBVH& bvh, const BVHRay* rays, uint32_t numRays, BVHHit* hits, uint32_t packetSize = MaxRayPacketSize);
+	void Occluded(JobSystem& jobs, const TriangleBVH& bvh, const BVHRay* rays, uint32_t numRays, uint8_t* outOccluded, uint32_t packetSize = MaxRayPacketSize);	// 1 when occluded
+
+	const RayStreamStats& Stats() const { return m_stats; }
+
+private:
+	// Origin then coarse direction Morton codes, most significant first
+	void Sort(JobSystem& jobs, const TriangleBVH& bvh, const BVHRay* rays, uint32_t numRays);
+
+	struct SortEntry
+	{
+		uint64_t key;
+		uint32_t index;
+	};
+	std::vector<SortEntry> m_order;
+	RayStreamStats m_stats;
+};
+
+enum RayPacketMode
+{
+	RayPacketMode_Single,	// TriangleBVH::Intersect per ray
+	RayPacketMode_Packet8,	// Consecutive rays, 8 per packet
+	RayPacketMode_Packet16,
+	RayPacketMode_Stream,	// RayStream, 16 per packet, sort time included
+	RayPacketMode_Count,
+};
+
+struct RayPacketBenchmarkResult
+{
+	uint32_t numTriangles = 0;
+	uint32_t numThreads = 0;
+	uint32_t numRays[RayBenchmarkKind_Count] = {};
+	double raysPerSecond[RayPacketMode_Count][RayBenchmarkKind_Count] = {};
+	double streamSortMs[RayBenchmarkKind_Count] = {};
+	uint32_t numMismatches = 0;		// Against single rays, hit or miss and distance within tolerance, or occlusion
+};
+
+// Primary and shadow rays are the coherent batches (tile order), incoherent rays the divergent one
+void RunRayPacketBenchmark(JobSystem& jobs, const TriangleMesh& mesh, const RayBenchmarkView& view, RayPacketBenchmarkResult& outResult);
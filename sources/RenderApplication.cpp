@@ -91,6 +91,9 @@ void RenderApplication::OnInit(SDL_Window* window)
     XMFLOAT4 lightDiffuseColor = XMFLOAT4(0.5f, 0.0f, 0.0f, 1.0f);
     m_directionalLight.color = XMLoadFloat4(&lightDiffuseColor);
 
+    // CPU culling jobs
+    jobSystem.Initialize(JobSystemInit());
+
     LoadPipeline();
     LoadAsset(window);
 }
@@ -370,6 +373,7 @@ void RenderApplication::CreateRTShadowPSO()
 void RenderApplication::CreateRTAccelerationStructure()
 {
     m_model.BuildAccelerationStructure();
+    m_model.BuildTriangleBVHs();
 }
 
 void RenderApplication::LoadPipeline()
@@ -587,72 +591,6 @@ void RenderApplication::LoadAsset(SDL_Window* window)
         CheckHRESULT(d3dDevice->CreateGraphicsPipelineState(&psoDesc, IID_PPV_ARGS(&deferredPSO)));
     }
 
-    // Root signature & Pipeline state (for HiZ)
-    {
-        //D3D12_RASTERIZER_DESC rasterizerDesc = {};
-        //rasterizerDesc.FillMode = D3D12_FILL_MODE_SOLID;
-        //rasterizerDesc.CullMode = D3D12_CULL_MODE_BACK;
-        //rasterizerDesc.FrontCounterClockwise = TRUE; // Matches glTF CCW convention
-        //rasterizerDesc.DepthBias = D3D12_DEFAULT_DEPTH_BIAS;
-        //rasterizerDesc.DepthBiasClamp = D3D12_DEFAULT_DEPTH_BIAS_CLAMP;
-        //rasterizerDesc.SlopeScaledDepthBias = D3D12_DEFAULT_SLOPE_SCALED_DEPTH_BIAS;
-        //rasterizerDesc.DepthClipEnable = TRUE;
-        //rasterizerDesc.MultisampleEnable = FALSE;
-        //rasterizerDesc.AntialiasedLineEnable = FALSE;
-        //rasterizerDesc.ForcedSampleCount = 0;
-        //rasterizerDesc.ConservativeRaster = D3D12_CONSERVATIVE_RASTERIZATION_MODE_OFF;
-        //CD3DX12_DESCRIPTOR_RANGE1 ranges[2];
-        //ranges[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0, 0, D3D12_DESCRIPTOR_RANGE_FLAG_DATA_STATIC);  // Input depth (t0)
-        //ranges[1].Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, 0, 0, D3D12_DESCRIPTOR_RANGE_FLAG_DESCRIPTORS_VOLATILE);  // Output depth (u0)
-
-        //CD3DX12_ROOT_PARAMETER1 rootParameters[3];
-        //rootParameters[0].InitAsDescriptorTable(1, &ranges[0], D3D12_SHADER_VISIBILITY_ALL);
-        //rootParameters[1].InitAsDescriptorTable(1, &ranges[1], D3D12_SHADER_VISIBILITY_ALL);
-        //rootParameters[2].InitAsConstants(3, 0, 0, D3D12_SHADER_VISIBILITY_ALL);  //3x 32 bit HiZ Constant Buffer
-
-        //CD3DX12_VERSIONED_ROOT_SIGNATURE_DESC rootSignatureDesc;
-        //rootSignatureDesc.Init_1_1(_countof(rootParameters), rootParameters, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_NONE);
-
-        //ComPtr<ID3DBlob> signature;
-        //ComPtr<ID3DBlob> error;
-        //CheckHRESULT(D3DX12SerializeVersionedRootSignature(&rootSignatureDesc, D3D_ROOT_SIGNATURE_VERSION_1_1, &signature, &error));
-        //CheckHRESULT(d3dDevice->CreateRootSignature(0, signature->GetBufferPointer(), signature->GetBufferSize(), IID_PPV_ARGS(&m_hiZRootSignature)));
-
-        /*ComPtr<IDxcBlob> computeShader;
-        CompileShaderFromFile(GetAssetFullPath("shaders/hiz.hlsl"), includePath, computeShader, ShaderType::Compute);*/
-        //// Load shader source
-        //ComPtr<IDxcBlobEncoding> sourceBlob;
-        //dxcUtils->LoadFile(GetAssetFullPath("shaders/hiz.hlsl").c_str(), nullptr, &sourceBlob);
-
-        //// Compile
-        //DxcBuffer sourceBuffer = { sourceBlob->GetBufferPointer(), sourceBlob->GetBufferSize(), 0 };
-
-        //// Compile arguments
-        //arguments[1] = L"CSMain";
-        //arguments[3] = L"cs_6_0";
-
-        //ComPtr<IDxcResult> compileResult;
-        //dxcCompiler->Compile(&sourceBuffer, arguments, _countof(arguments), includeHandler.Get(), IID_PPV_ARGS(&compileResult));
-        //HRESULT status;
-        //compileResult->GetStatus(&status);
-        //if (FAILED(status))
-        //{
-        //    ComPtr<IDxcBlobEncoding> errorBlob;
-        //    compileResult->GetErrorBuffer(&errorBlob);
-        //    std::string errorMsg = std::string(static_cast<const char*>(errorBlob->GetBufferPointer()), errorBlob->GetBufferSize());
-        //    assert(false && errorMsg.c_str());
-        //}
-        //else
-        //{
-        //    compileResult->GetResult(&computeShader);
-        //}
-
-        /*D3D12_COMPUTE_PIPELINE_STATE_DESC psoDesc = {};
-        psoDesc.pRootSignature = m_hiZRootSignature.Get();
-        psoDesc.CS = { computeShader->GetBufferPointer(), computeShader->GetBufferSize() };
-        CheckHRESULT(d3dDevice->CreateComputePipelineState(&psoDesc, IID_PPV_ARGS(&m_hiZPipelineState)));*/
-    }
-
     // Create command list
     CheckHRESULT(d3dDevice->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, commandAllocator.Get(), nullptr, IID_PPV_ARGS(&commandList)));
 
@@ -664,58 +602,6 @@ void RenderApplication::LoadAsset(SDL_Window* window)
     // prematurely destroyed.
     ComPtr<ID3D12Resource> textureUploadHeap;
 
-    // Create hiz pass
-    {
-        //D3D12_RESOURCE_DESC hizDesc = CD3DX12_RESOURCE_DESC::Tex2D(
-        //    DXGI_FORMAT_R32_FLOAT,
-        //    m_width,
-        //    m_height,
-        //    1, 0, 1, 0,
-        //    D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
-        //hizDesc.MipLevels = static_cast<UINT>(floor(log2(max(m_width, m_height))) + 1);
-
-        //CheckHRESULT(m_d3dDevice->CreateCommittedResource(
-        //    &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
-        //    D3D12_HEAP_FLAG_NONE,
-        //    &hizDesc,
-        //    D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE,
-        //    nullptr,
-        //    IID_PPV_ARGS(&m_hiZBuffer)));
-
-        //// Views
-        //// SRV for depth
-        //D3D12_SHADER_RESOURCE_VIEW_DESC depthSrvDesc = {};
-        //depthSrvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-        //depthSrvDesc.Format = DXGI_FORMAT_R32_FLOAT;
-        //depthSrvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-        //depthSrvDesc.Texture2D.MipLevels = 1;
-        //m_d3dDevice->CreateShaderResourceView(m_depth.Get(), &depthSrvDesc, m_hiZDepthSrvCpuHandle);
-
-        //// SRV
-        //D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
-        //srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-        //srvDesc.Format = DXGI_FORMAT_R32_FLOAT;
-        //srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-        //srvDesc.Texture2D.MipLevels = hizDesc.MipLevels;
-        //g_descHeapAllocator.Alloc(&m_hiZCpuHandle, &m_hiZGpuHandle);
-        //m_d3dDevice->CreateShaderResourceView(m_hiZBuffer.Get(), &srvDesc, m_hiZCpuHandle);
-        //m_hiZDescriptorSize = m_d3dDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
-
-        //// UAV
-        //// UAV CpuHandle is start from SRV + DescriptorSize * (MipIndex + 1)
-        //D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
-        //uavDesc.Format = DXGI_FORMAT_R32_FLOAT;
-        //uavDesc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D;
-        //for (UINT i = 0; i < hizDesc.MipLevels; ++i)
-        //{
-        //    uavDesc.Texture2D.MipSlice = i;
-        //    D3D12_CPU_DESCRIPTOR_HANDLE cpuHandle;
-        //    D3D12_GPU_DESCRIPTOR_HANDLE gpuHandle;
-        //    g_descHeapAllocator.Alloc(&cpuHandle, &gpuHandle);
-        //    m_d3dDevice->CreateUnorderedAccessView(m_hiZBuffer.Get(), nullptr, &uavDesc, cpuHandle);
-        //}
-    }
-
     // Create constant buffer for scene
     {
         const UINT constantBufferSize = sizeof(SceneConstantBuffer);
@@ -753,6 +639,20 @@ void RenderApplication::LoadAsset(SDL_Window* window)
     m_model.LoadShader(shaderPath);
     m_model.CreatePSO();
     m_model.UploadGpuResources();
+
+    // Baked by PvsBaker next to the model, optional
+    m_model.LoadPvs(WStringToString(std::filesystem::path(gltfPath).replace_extension(L".pvs").wstring()));
+
+    // Two phase occlusion culling, HZB matches the depth buffer
+    HiZCullingInit hiZInit;
+    hiZInit.width = m_width;
+    hiZInit.height = m_height;
+    hiZInit.maxInstances = m_model.NumInstances();
+    hiZInit.shaderPath = shaderPath;
+    m_hiZCulling.Initialize(hiZInit);
+    m_model.SetHiZTarget(m_hiZCulling.Predicates(), m_width, m_height);
+    m_model.SetScreenSize(m_width, m_height);
+
     CreateRT();
     CreateRTShadowPSO();
     CreateRTPipelineStateObject();
@@ -777,6 +677,7 @@ void RenderApplication::LoadAsset(SDL_Window* window)
     CheckHRESULT(commandList->Close());
     ID3D12CommandList* ppCommandList[] = { commandList.Get() };
     commandQueue->ExecuteCommandLists(_countof(ppCommandList), ppCommandList);
+    gpuIdle = false;
     
     // Create synchronization object
     CheckHRESULT(d3dDevice->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&m_fence)));
@@ -842,6 +743,7 @@ void RenderApplication::OnRender()
 
     ID3D12CommandList* ppCommandLists[] = { commandList.Get() };
     commandQueue->ExecuteCommandLists(_countof(ppCommandLists), ppCommandLists);
+    gpuIdle = false;
 
     CheckHRESULT(m_swapChain->Present(0, 0));
 
@@ -855,7 +757,9 @@ void RenderApplication::OnDestroy()
 
     CloseHandle(m_fenceEvent);
 
+    m_hiZCulling.Shutdown();
     m_model.Shutdown();
+    jobSystem.Shutdown();
     for (uint32_t i = 0; i < FrameCount; ++i)
     {
         backBuffer[i].Shutdown();
@@ -934,7 +838,7 @@ void RenderApplication::CreateRenderTargets()
     }
 }
 
-void RenderApplication::RenderGBuffer(const DirectX::BoundingFrustum& frustum)
+void RenderApplication::RenderGBuffer()
 { 
     // Transition gbuffer targets to writeable state
     {
@@ -973,7 +877,7 @@ void RenderApplication::RenderGBuffer(const DirectX::BoundingFrustum& frustum)
     commandList->RSSetViewports(1, &m_viewport);
     commandList->RSSetScissorRects(1, &m_scissorRect);
 
-    m_model.RenderGBuffer(&m_sceneCB, frustum);
+    m_model.RenderGBuffer(&m_sceneCB);
 
     // Transition gbuffer targets to read state
     {
@@ -1047,7 +951,7 @@ void RenderApplication::DispatchRaytracing()
     ID3D12DescriptorHeap* ppDescHeaps[] = { srvDescriptorHeap.heap.Get() };
     commandList->SetDescriptorHeaps(_countof(ppDescHeaps), ppDescHeaps);
     
-    commandList->SetComputeRootShaderResourceView(0, meshResource.tlasBuffer.internalBuffer.gpuAddress);
+    commandList->SetComputeRootShaderResourceView(0, m_model.ShadowTlas().internalBuffer.gpuAddress);
     commandList->SetComputeRootShaderResourceView(1, meshResource.indexBuffer.internalBuffer.gpuAddress);
     commandList->SetComputeRootShaderResourceView(2, meshResource.vertexBuffer.internalBuffer.gpuAddress);
     commandList->SetComputeRootShaderResourceView(3, meshResource.instanceInfoBuffer.internalBuffer.gpuAddress);
@@ -1175,6 +1079,166 @@ void RenderApplication::PopulateCommandList()
         ImGui::SameLine();
         ImGui::Text("counter = %d", counter);*/
 
+        ImGui::Text("Culling");
+        {
+            const CullingStats& cullStats = m_model.GetCullingStats();
+            ImGui::Checkbox("SIMD culling (AVX2)", &m_model.UseSimdCulling());
+            ImGui::Checkbox("BVH culling", &m_model.UseBVHCulling());
+            ImGui::Text("Visible opaque %u, alpha %u / %u instances",
+                cullStats.numVisibleOpaque, cullStats.numVisibleAlpha, cullStats.numInstances);
+            // Scaled from the live instance count, CpuBenchmarks culling measures 100k instances
+            ImGui::Text("Cull %.3f ms (%s), %.3f ms per 100k (extrapolated)",
+                cullStats.cullMs,
+                cullStats.pvs ? "PVS" : cullStats.bvh ? "BVH" : cullStats.simd ? "AVX2" : "scalar",
+                cullStats.numInstances > 0 ? cullStats.cullMs * 100000.0 / cullStats.numInstances : 0.0);
+            if (cullStats.bvh)
+            {
+                ImGui::Text("BVH nodes visited %u / %u", cullStats.bvhNodesVisited, cullStats.bvhNodes);
+            }
+
+            if (!m_model.Pvs().IsEmpty())
+            {
+                ImGui::Checkbox("PVS pre-filter (baked)", &m_model.UsePvs());
+                if (cullStats.pvs)
+                {
+                    ImGui::Text("PVS candidates %u / %u", cullStats.numPvsCandidates, cullStats.numInstances);
+                }
+                else if (m_model.UsePvs())
+                {
+                    ImGui::Text("Camera cell has no set, not filtered");
+                }
+            }
+
+            ImGui::Checkbox("Visibility cache (still camera)", &m_model.UseVisibilityCache());
+            switch (cullStats.visibilityCache)
+            {
+            case VisibilityCacheState::Reused:
+                ImGui::Text("Last cull reused, %u frames in a row", cullStats.numCacheReusedFrames);
+                break;
+            case VisibilityCacheState::Patched:
+                ImGui::Text("Same view, %u moved instances retested", cullStats.numCacheRetested);
+                break;
+            default:
+                ImGui::Text("Full cull");
+                break;
+            }
+
+            ImGui::Checkbox("Occlusion culling (CPU raster)", &m_model.UseOcclusionCulling());
+            if (cullStats.occlusion)
+            {
+                const OcclusionCullingStats& occlusionStats = m_model.Occlusion().Stats();
+                ImGui::Text("Occluded %u / %u tested, %.3f ms", cullStats.numOccluded, occlusionStats.numTested, cullStats.occlusionMs);
+                ImGui::Text("Occluders %u, triangles %u (%u rasterized)",
+                    occlusionStats.numOccluders, occlusionStats.numOccluderTriangles, occlusionStats.numRasterTriangles);
+                ImGui::Text("Raster %.3f ms, test %.3f ms, %u threads",
+                    occlusionStats.rasterMs, occlusionStats.testMs, jobSystem.NumThreads());
+            }
+
+            ImGui::Checkbox("HiZ culling (two phase GPU)", &m_model.UseHiZCulling());
+            if (cullStats.hiZ)
+            {
+                ImGui::Text("HiZ tests %u (%u untestable), second phase %u, occluded %u last frame",
+                    cullStats.numHiZTests, cullStats.numHiZUntestable, cullStats.numHiZSecondPhase, cullStats.numHiZOccluded);
+                ImGui::Checkbox("Validate HiZ (CPU reference)", &m_hiZCulling.Validate());
+                const HiZCullingStats& hiZStats = m_hiZCulling.Stats();
+                if (m_hiZCulling.Validate() && hiZStats.validated)
+                {
+                    ImGui::Text("Mismatches: pyramid %u texels, tests %u / %u",
+                        hiZStats.pyramidMismatches, hiZStats.testMismatches, hiZStats.numTests);
+                    ImGui::Text("CPU build %.3f ms, test %.3f ms, %u mips",
+                        hiZStats.cpuBuildMs, hiZStats.cpuTestMs, m_hiZCulling.NumMips());
+                }
+            }
+
+            ImGui::Checkbox("LOD selection (screen space error)", &m_model.UseLodSelection());
+            ImGui::SliderFloat("LOD pixel error", &m_model.LodPixelError(), 0.25f, 16.f, "%.2f");
+            ImGui::SliderFloat("LOD hysteresis", &m_model.LodHysteresis(), 0.f, 0.9f, "%.2f");
+            ImGui::Text("Primitives with LODs %u, LOD changes %u, %.3f ms",
+                m_model.NumLodPrimitives(), cullStats.numLodChanges, cullStats.lodMs);
+
+            ImGui::Checkbox("Contribution culling", &m_model.UseContributionCulling());
+            if (cullStats.contribution)
+            {
+                ImGui::SliderFloat("Min pixels, depth pass", &m_model.MinDepthPassPixels(), 0.f, 1024.f, "%.1f");
+                ImGui::SliderFloat("Min pixels, G-buffer", &m_model.MinGBufferPixels(), 0.f, 64.f, "%.2f");
+                ImGui::Text("Culled %u, G-buffer only %u", cullStats.numContributionCulled, cullStats.numDepthPassCulled);
+            }
+
+            ImGui::Checkbox("Shadow caster culling (directional light)", &m_model.UseShadowCasterCulling());
+            if (cullStats.shadowCasters)
+            {
+                ImGui::Text("Shadow TLAS casters %u / %u, %.3f ms%s", cullStats.numShadowCasters, cullStats.numInstances, cullStats.shadowCullMs,
+                    cullStats.shadowCastersReused ? " (reused)" : "");
+            }
+        }
+
+        ImGui::Text("Draw submission");
+        {
+            const DrawStats& drawStats = m_model.GetDrawStats();
+            ImGui::Checkbox("Sort draws (radix)", &m_model.UseDrawSorting());
+            ImGui::Text("Draws %u, PSO changes %u, material changes %u",
+                drawStats.numDraws, drawStats.psoChanges, drawStats.materialChanges);
+            ImGui::Text("Packets %.3f ms (%s)", drawStats.buildMs, drawStats.sorted ? "sorted" : "scene order");
+            ImGui::Text("Extract %.3f ms, %u chunks, %u threads", drawStats.extractMs, drawStats.numChunks, jobSystem.NumThreads());
+
+            ImGui::Checkbox("Indirect draws (ExecuteIndirect)", &m_model.UseIndirectDraws());
+            if (m_model.GetCullingStats().indirect)
+            {
+                IndirectCulling& indirect = m_model.Indirect();
+                const IndirectCullingStats& indirectStats = indirect.Stats();
+                ImGui::Checkbox("GPU compaction (off: CPU reference)", &m_model.UseGpuIndirect());
+                ImGui::Text("Records %u, draws opaque %u, alpha %u",
+                    indirectStats.numRecords, indirectStats.numDraws[DrawPSO_Opaque], indirectStats.numDraws[DrawPSO_AlphaTest]);
+                if (!indirectStats.gpu)
+                {
+                    ImGui::Text("CPU arguments %.3f ms", indirectStats.cpuMs);
+                }
+                ImGui::Checkbox("Validate indirect (CPU reference)", &indirect.Validate());
+                if (indirectStats.gpu && indirect.Validate() && indirectStats.validated)
+                {
+                    ImGui::Text("Mismatches: counts %u, arguments %u, reference %.3f ms",
+                        indirectStats.countMismatches, indirectStats.argMismatches, indirectStats.cpuMs);
+                }
+            }
+        }
+
+        ImGui::Text("CPU ray tracing");
+        {
+            const TriangleBVHStats& bvhStats = m_model.GetTriangleBVHStats();
+            ImGui::Text("Triangle BVH nodes %u, depth %u, SAH cost %.2f, build %.1f ms",
+                bvhStats.numNodes, bvhStats.maxDepth, bvhStats.sahCost, bvhStats.buildMs);
+
+            const TopLevelBVHStats& tlasStats = m_model.GetTopLevelBVH().Stats();
+            ImGui::Text("Top level BVH instances %u, nodes %u, SAH cost %.2f, build %.2f ms, refit %.3f ms",
+                tlasStats.numInstances, tlasStats.numNodes, tlasStats.sahCost, tlasStats.buildMs, tlasStats.refitMs);
+        }
+
+        ImGui::Text("Texture Streaming");
+        {
+            TextureStreamer& streamer = m_model.Streamer();
+            const TextureStreamingStats& streamStats = streamer.Stats();
+
+            int budgetMB = static_cast<int>(streamer.Budget() / (1024 * 1024));
+            if (ImGui::SliderInt("Budget (MB)", &budgetMB, 16, 4096))
+            {
+                streamer.SetBudget(static_cast<uint64_t>(budgetMB) * 1024 * 1024);
+            }
+            ImGui::Text("Resident %.1f MB, wanted %.1f MB",
+                static_cast<double>(streamStats.residentBytes) / (1024.0 * 1024.0),
+                static_cast<double>(streamStats.wantedBytes) / (1024.0 * 1024.0));
+            ImGui::Text("Requested %u, pending %u, mips in %u / out %u",
+                streamStats.numRequested, streamStats.numPending, streamStats.mipsLoaded, streamStats.mipsEvicted);
+        }
+
+        ImGui::Text("Virtual Texturing");
+        {
+            const VirtualTexturing& virtualTextures = m_model.VirtualTextures();
+            const VirtualTextureStats& vtStats = virtualTextures.Stats();
+            ImGui::Text("Textures %u, pages requested %u, resident %u, missing %u",
+                virtualTextures.NumTextures(), vtStats.numUnique, vtStats.numResident, vtStats.numMissing);
+            ImGui::Text("Loads %u, evictions %u, analysis %.3f ms", vtStats.numLoads, vtStats.numEvictions, vtStats.analyzeMs);
+        }
+
         ImGuiIO& io = ImGui::GetIO(); (void)io;
         ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.f / io.Framerate, io.Framerate);
         ImGui::End();
@@ -1195,6 +1259,25 @@ void RenderApplication::PopulateCommandList()
     CheckHRESULT(commandList->Reset(commandAllocator.Get(), nullptr));
 
     BoundingFrustum frustum = m_camera.GetFrustum(XM_PI / 3, m_aspectRatio);
+    XMMATRIX viewProj = m_camera.GetViewMatrix() * m_camera.GetProjectionMatrix(XM_PI / 3, m_aspectRatio);
+
+    // Last frame completed, its HiZ results are the visibility bits of this frame
+    if (const uint32_t* hiZResults = m_hiZCulling.ResolveResults())
+    {
+        m_model.ApplyHiZResults(hiZResults);
+    }
+
+    // One visibility list for every pass this frame
+    m_model.Cull(frustum, viewProj, XM_PI / 3);
+
+    // Shadow rays only need instances that can shadow the view
+    m_model.CullShadowCasters(frustum, m_directionalLight.direction);
+
+    // Stream texture mips for this view, before any pass samples them
+    m_model.UpdateTextureStreaming(m_camera.GetPosition(), XM_PI / 3, static_cast<float>(m_height));
+
+    // Virtual pages requested by the last G-buffer pass, before this one samples them
+    m_model.UpdateVirtualTextures();
 
     commandList->RSSetViewports(1, &m_viewport);
     commandList->RSSetScissorRects(1, &m_scissorRect);
@@ -1204,85 +1287,27 @@ void RenderApplication::PopulateCommandList()
         commandList->OMSetRenderTargets(0, nullptr, FALSE, &depthBuffer.dsv);
         commandList->ClearDepthStencilView(depthBuffer.dsv, D3D12_CLEAR_FLAG_DEPTH, 1.f, 0, 0, nullptr);
 
-        m_model.RenderDepthOnly(
-            &m_sceneCB,
-            frustum);
-
-        // Temporary
-        /*D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(
-            m_depth.Get(),
-            D3D12_RESOURCE_STATE_DEPTH_WRITE,
-            D3D12_RESOURCE_STATE_DEPTH_READ);
-        commandList->ResourceBarrier(1, &barrier);*/
+        m_model.RenderDepthOnly(&m_sceneCB, CullPhase::First);
     }
 
-    // HiZ pass
+    // HiZ pass, test against the first phase depth then draw what was occluded last frame
+    const bool hiZ = m_model.GetCullingStats().hiZ;
+    if (hiZ)
     {
-        //D3D12_RESOURCE_BARRIER barriers[2];
-
-        //barriers[0] = CD3DX12_RESOURCE_BARRIER::Transition(
-        //    m_hiZBuffer.Get(),
-        //    D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE,
-        //    D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
-
-        //barriers[1] = CD3DX12_RESOURCE_BARRIER::Transition(
-        //    m_depth.Get(),
-        //    D3D12_RESOURCE_STATE_DEPTH_WRITE,
-        //    D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
-        //m_commandList->ResourceBarrier(2, barriers);
-
-        //m_commandList->SetPipelineState(m_hiZPipelineState.Get());
-        //m_commandList->SetComputeRootSignature(m_hiZRootSignature.Get());
-        //// Bind CBV descriptor heap for constant buffer view
-        //ID3D12DescriptorHeap* ppDescHeaps[] = { m_srvDescHeap.Get() };
-        //m_commandList->SetDescriptorHeaps(_countof(ppDescHeaps), ppDescHeaps);
-
-        //struct HiZConstantBuffer
-        //{
-        //    XMFLOAT2 InvTextureSize;
-        //    XMFLOAT2 OutDimensions;
-        //    UINT MipLevel;
-        //    XMFLOAT3 Padding;
-        //} hiZCB = { {1.f / static_cast<float>(m_width), 1.f / static_cast<float>(m_height)}, 
-        //    {static_cast<float>(m_width), static_cast<float>(m_height)}, 0 };
-
-        //// Copy depth to HiZ level 0
-        //m_commandList->SetComputeRootDescriptorTable(0, m_hiZDepthSrvGpuHandle);    // srv
-        //m_commandList->SetComputeRootDescriptorTable(1, CD3DX12_GPU_DESCRIPTOR_HANDLE(m_hiZGpuHandle).Offset(1, m_hiZDescriptorSize));    // uav
-        //m_commandList->SetComputeRoot32BitConstants(2, 5, &hiZCB, 0);
-        //m_commandList->Dispatch((m_width + 7) / 8, (m_height + 7) / 8, 1);
-
-        //UINT width = m_width, height = m_height;
-        //for (UINT mip = 1; mip < m_hiZBuffer->GetDesc().MipLevels; ++mip)
-        //{
-        //    width = max(width / 2, 1u);
-        //    height = max(height / 2, 1u);
-        //    hiZCB.MipLevel = mip;
-        //    // In: mip - 1 * increment size
-        //    // Out: mip * increment size
-        //    m_commandList->SetComputeRootDescriptorTable(0, CD3DX12_GPU_DESCRIPTOR_HANDLE(m_hiZGpuHandle).Offset(mip, m_hiZDescriptorSize));  // srv
-        //    m_commandList->SetComputeRootDescriptorTable(1, CD3DX12_GPU_DESCRIPTOR_HANDLE(m_hiZGpuHandle).Offset(mip + 1, m_hiZDescriptorSize));  // uav
-        //    m_commandList->SetComputeRoot32BitConstants(2, 5, &hiZCB, 0);
-        //    m_commandList->Dispatch((width + 7) / 8, (height + 7) / 8, 1);
-        //    m_commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::UAV(m_hiZBuffer.Get()));
-        //}
-
-        //barriers[0] = CD3DX12_RESOURCE_BARRIER::Transition(
-        //    m_hiZBuffer.Get(),
-        //    D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
-        //    D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
-
-        //barriers[1] = CD3DX12_RESOURCE_BARRIER::Transition(
-        //    m_depth.Get(),
-        //    D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE,
-        //    D3D12_RESOURCE_STATE_DEPTH_READ);
-
-        //m_commandList->ResourceBarrier(2, barriers);
+        m_hiZCulling.BuildAndCull(depthBuffer, m_model.HiZTests());
+
+        commandList->OMSetRenderTargets(0, nullptr, FALSE, &depthBuffer.dsv);
+        m_model.RenderDepthOnly(&m_sceneCB, CullPhase::Second);
     }
-    
+
     // Main pass
     {
-        RenderGBuffer(frustum);
+        RenderGBuffer();
+        if (hiZ)
+        {
+            m_hiZCulling.EndFrame();
+        }
+
         // Raytrace shadow
         DispatchRaytracing();
 
@@ -1344,9 +1369,10 @@ void RenderApplication::WaitForGpu()
 
     // Increment fence value for current frame
     m_fenceValue++;
+    gpuIdle = true;
 }
 
-// Prepare to render next frame
+// Prepare to render next frame, waits for the frame just submitted (gpuIdle)
 void RenderApplication::MoveToNextFrame()
 {
     // Schedule signal command in queue (Increment fence value for next frame)
@@ -1360,6 +1386,7 @@ void RenderApplication::MoveToNextFrame()
         CheckHRESULT(m_fence->SetEventOnCompletion(fence, m_fenceEvent));
         WaitForSingleObject(m_fenceEvent, INFINITE);
     }
+    gpuIdle = true;
 
     // Update frame index
     m_frameIndex = m_swapChain->GetCurrentBackBufferIndex();
@@ -4,10 +4,11 @@
 
 #include "StepTimer.h"
 #include "Model.h"
+#include "HiZCulling.h"
 #include "SimpleCamera.h"
 #include "DX12.h"
 #include "GraphicsTypes.h"
-#include "../Shaders/HLSLCompatible.h"
+#include "../shaders/HLSLCompatible.h"
 
 using Microsoft::WRL::ComPtr;
 
@@ -36,7 +37,7 @@ public:
     UINT GetHeight() { return m_height; }
 
     void CreateRenderTargets();
-    void RenderGBuffer(const DirectX::BoundingFrustum& frustum);
+    void RenderGBuffer();
     void RenderDeferred(const ConstantBuffer* lightCB);
     void DispatchRaytracing();
     void RenderRaytracing();
@@ -75,14 +76,7 @@ private:
     ComPtr<ID3D12PipelineState> rtShadowPSO;
 
     // HiZ Passes resource
-    ComPtr<ID3D12Resource> m_hiZBuffer;
-    ComPtr<ID3D12RootSignature> m_hiZRootSignature;
-    ComPtr<ID3D12PipelineState> m_hiZPipelineState;
-    D3D12_CPU_DESCRIPTOR_HANDLE m_hiZCpuHandle;
-    D3D12_GPU_DESCRIPTOR_HANDLE m_hiZGpuHandle;
-    D3D12_CPU_DESCRIPTOR_HANDLE m_hiZDepthSrvCpuHandle;
-    D3D12_GPU_DESCRIPTOR_HANDLE m_hiZDepthSrvGpuHandle;
-    UINT m_hiZDescriptorSize;
+    HiZCulling m_hiZCulling;
 
     // Testing ray tracing
     ComPtr<IDxcBlob> raytraceLib;
@@ -0,0 +1,263 @@
+#include "RenderList.h"
+#include "Utility.h"
+#include "HiZ.h"
+
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <random>
+
+using namespace DirectX;
+
+static const uint32_t ChunksPerThread = 4;
+static const uint32_t MinItemsPerChunk = 1024;
+
+uint32_t RenderListChunkSize(uint32_t count, uint32_t numThreads)
+{
+	const uint32_t numChunks = std::max(numThreads, 1u) * ChunksPerThread;
+	const uint32_t chunkSize = std::max((count + numChunks - 1) / numChunks, MinItemsPerChunk);
+	return (chunkSize + 7) & ~7u;
+}
+
+uint32_t RenderListBuilder::CullFrustum(JobSystem& jobs, const BoundsSoA& bounds, const FrustumPlanes& planes, uint32_t* outIndices, bool allowSimd)
+{
+	const uint32_t count = bounds.count;
+	if (count == 0)
+	{
+		return 0;
+	}
+
+	const uint32_t chunkSize = RenderListChunkSize(count, jobs.NumThreads());
+	const uint32_t numChunks = (count + chunkSize - 1) / chunkSize;
+	m_chunkSlots.resize(bounds.centerX.size());
+	m_chunkCounts.resize(numChunks);
+
+	// AVX2 writes 8 indices at a time, chunk ranges are 8 aligned so it stays inside its own range
+	jobs.ParallelFor(numChunks, 1, [&](uint32_t begin, uint32_t end, uint32_t)
+	{
+		for (uint32_t chunk = begin; chunk < end; ++chunk)
+		{
+			const uint32_t first = chunk * chunkSize;
+			const uint32_t last = std::min(first + chunkSize, count);
+			m_chunkCounts[chunk] = CullFrustumRange(bounds, planes, first, last, &m_chunkSlots[first], allowSimd);
+		}
+	});
+
+	// Exclusive prefix sum, counts become output offsets
+	uint32_t numVisible = 0;
+	for (uint32_t chunk = 0; chunk < numChunks; ++chunk)
+	{
+		const uint32_t chunkCount = m_chunkCounts[chunk];
+		m_chunkCounts[chunk] = numVisible;
+		numVisible += chunkCount;
+	}
+
+	jobs.ParallelFor(numChunks, 1, [&](uint32_t begin, uint32_t end, uint32_t)
+	{
+		for (uint32_t chunk = begin; chunk < end; ++chunk)
+		{
+			const uint32_t offset = m_chunkCounts[chunk];
+			const uint32_t chunkCount = ((chunk + 1 < numChunks) ? m_chunkCounts[chunk + 1] : numVisible) - offset;
+			const uint32_t* src = &m_chunkSlots[chunk * chunkSize];
+			std::copy(src, src + chunkCount, outIndices + offset);
+		}
+	});
+	return numVisible;
+}
+
+void RenderListBuilder::Build(JobSystem& jobs, uint32_t count, const RenderListExtractFunc& extract, RenderList& outList)
+{
+	const uint32_t chunkSize = RenderListChunkSize(count, jobs.NumThreads());
+	m_numChunks = (count + chunkSize - 1) / chunkSize;
+	if (m_chunks.size() < m_numChunks)
+	{
+		m_chunks.resize(m_numChunks);
+	}
+	m_offsets.resize(m_numChunks);
+
+	jobs.ParallelFor(m_numChunks, 1, [&](uint32_t begin, uint32_t end, uint32_t)
+	{
+		for (uint32_t chunkIndex = begin; chunkIndex < end; ++chunkIndex)
+		{
+			RenderListChunk& chunk = m_chunks[chunkIndex];
+			chunk.packets[0].clear();
+			chunk.packets[1].clear();
+			chunk.hiZTests.clear();
+			chunk.hiZUntestable.clear();
+			chunk.numAlpha = 0;
+			chunk.numContributionCulled = 0;
+			chunk.numDepthPassCulled = 0;
+
+			const uint32_t first = chunkIndex * chunkSize;
+			extract(first, std::min(first + chunkSize, count), chunk);
+		}
+	});
+
+	// Chunk order keeps the serial order, the second phase goes after every first phase packet
+	uint32_t numPackets[2] = {};
+	uint32_t numHiZTests = 0;
+	uint32_t numHiZUntestable = 0;
+	outList.numAlpha = 0;
+	outList.numContributionCulled = 0;
+	outList.numDepthPassCulled = 0;
+	for (uint32_t chunkIndex = 0; chunkIndex < m_numChunks; ++chunkIndex)
+	{
+		const RenderListChunk& chunk = m_chunks[chunkIndex];
+		ChunkOffsets& offsets = m_offsets[chunkIndex];
+		for (uint32_t phase = 0; phase < 2; ++phase)
+		{
+			offsets.packets[phase] = numPackets[phase];
+			numPackets[phase] += static_cast<uint32_t>(chunk.packets[phase].size());
+		}
+		offsets.hiZTests = numHiZTests;
+		offsets.hiZUntestable = numHiZUntestable;
+		numHiZTests += static_cast<uint32_t>(chunk.hiZTests.size());
+		numHiZUntestable += static_cast<uint32_t>(chunk.hiZUntestable.size());
+		outList.numAlpha += chunk.numAlpha;
+		outList.numContributionCulled += chunk.numContributionCulled;
+		outList.numDepthPassCulled += chunk.numDepthPassCulled;
+	}
+
+	outList.secondPhaseBegin = numPackets[0];
+	outList.packets.resize(numPackets[0] + numPackets[1]);
+	outList.hiZTests.resize(numHiZTests);
+	outList.hiZUntestable.resize(numHiZUntestable);
+
+	jobs.ParallelFor(m_numChunks, 1, [&](uint32_t begin, uint32_t end, uint32_t)
+	{
+		for (uint32_t chunkIndex = begin; chunkIndex < end; ++chunkIndex)
+		{
+			const RenderListChunk& chunk = m_chunks[chunkIndex];
+			const ChunkOffsets& offsets = m_offsets[chunkIndex];
+			std::copy(chunk.packets[0].begin(), chunk.packets[0].end(), outList.packets.begin() + offsets.packets[0]);
+			std::copy(chunk.packets[1].begin(), chunk.packets[1].end(), outList.packets.begin() + outList.secondPhaseBegin + offsets.packets[1]);
+			std::copy(chunk.hiZTests.begin(), chunk.hiZTests.end(), outList.hiZTests.begin() + offsets.hiZTests);
+			std::copy(chunk.hiZUntestable.begin(), chunk.hiZUntestable.end(), outList.hiZUntestable.begin() + offsets.hiZUntestable);
+		}
+	});
+}
+
+//
+// Benchmark
+//
+void RunRenderListBenchmark(uint32_t numInstances, std::vector<RenderListBenchmarkResult>& outResults)
+{
+	outResults.clear();
+
+	// Constant density, camera at origin inside the scene, every 4th instance alpha tested
+	std::mt19937 rng(1234);
+	const float side = 20.f * cbrtf(static_cast<float>(numInstances));
+	std::uniform_real_distribution<float> position(-side * 0.5f, side * 0.5f);
+	std::uniform_real_distribution<float> extent(0.5f, 2.f);
+
+	BoundsSoA bounds;
+	bounds.Resize(numInstances);
+	for (uint32_t i = 0; i < numInstances; ++i)
+	{
+		const XMFLOAT3 center(position(rng), position(rng), position(rng));
+		const XMFLOAT3 extents(extent(rng), extent(rng), extent(rng));
+		bounds.Set(i, BoundingBox(center, extents));
+	}
+
+	const XMMATRIX proj = XMMatrixPerspectiveFovLH(XM_PI / 3, 16.f / 9.f, 0.1f, 1000.f);
+	BoundingFrustum frustum(proj);
+	FrustumPlanes planes;
+	GetFrustumPlanes(frustum, planes);
+	XMFLOAT4X4 viewProj;
+	XMStoreFloat4x4(&viewProj, proj);
+	const uint32_t width = 1920;
+	const uint32_t height = 1080;
+
+	// Same work per instance as Model::Cull, every 8th instance was occluded last frame
+	auto extractRange = [&](const uint32_t* visible, uint32_t begin, uint32_t end, RenderListChunk& chunk)
+	{
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			const uint32_t slot = visible[i];
+			const XMFLOAT3 center(bounds.centerX[slot], bounds.centerY[slot], bounds.centerZ[slot]);
+			const XMFLOAT3 extents(bounds.extentX[slot], bounds.extentY[slot], bounds.extentZ[slot]);
+
+			uint32_t phase = 0;
+			HiZTestEntry test;
+			if (ProjectHiZTest(center, extents, viewProj, width, height, slot, test))
+			{
+				chunk.hiZTests.push_back(test);
+				phase = (slot % 8 == 0) ? 1 : 0;
+			}
+			else
+			{
+				chunk.hiZUntestable.push_back(slot);
+			}
+
+			const uint32_t pso = (slot % 4 == 3) ? 1 : 0;
+			chunk.numAlpha += pso;
+
+			DrawPacket packet;
+			packet.instanceIndex = slot;
+			packet.materialIndex = slot % 256;
+			packet.key = MakeDrawKey(phase, pso, packet.materialIndex,
+				QuantizeDrawDepth(sqrtf(center.x * center.x + center.y * center.y + center.z * center.z)));
+			chunk.packets[phase].push_back(packet);
+		}
+	};
+
+	// Serial reference, one chunk holds everything
+	std::vector<uint32_t> visible(bounds.centerX.size());
+	RenderListChunk serialChunk;
+	RenderList serialList;
+	uint32_t numVisible = 0;
+	const double serialMs = BestOfMs([&]
+	{
+		serialChunk = {};
+		numVisible = ::CullFrustum(bounds, planes, visible.data());
+		extractRange(visible.data(), 0, numVisible, serialChunk);
+		serialList.packets = serialChunk.packets[0];
+		serialList.secondPhaseBegin = static_cast<uint32_t>(serialList.packets.size());
+		serialList.packets.insert(serialList.packets.end(), serialChunk.packets[1].begin(), serialChunk.packets[1].end());
+	});
+
+	const uint32_t maxThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	for (uint32_t numThreads = 1; ; numThreads = std::min(numThreads * 2, maxThreads))
+	{
+		JobSystem jobs;
+		JobSystemInit jobsInit;
+		jobsInit.numThreads = numThreads;
+		jobs.Initialize(jobsInit);
+
+		RenderListBuilder builder;
+		RenderList list;
+		std::vector<uint32_t> parallelVisible(bounds.centerX.size());
+		RenderListBenchmarkResult result;
+		result.numInstances = numInstances;
+		result.numThreads = numThreads;
+		result.serialMs = serialMs;
+		result.parallelMs = BestOfMs([&]
+		{
+			result.numVisible = builder.CullFrustum(jobs, bounds, planes, parallelVisible.data());
+			builder.Build(jobs, result.numVisible, [&](uint32_t begin, uint32_t end, RenderListChunk& chunk)
+			{
+				extractRange(parallelVisible.data(), begin, end, chunk);
+			}, list);
+		});
+		jobs.Shutdown();
+
+		// Chunk order merge, same list down to the order
+		assert(result.numVisible == numVisible);
+		assert(list.secondPhaseBegin == serialList.secondPhaseBegin && list.packets.size() == serialList.packets.size());
+		assert(list.hiZTests.size() == serialChunk.hiZTests.size() && list.hiZUntestable.size() == serialChunk.hiZUntestable.size());
+		assert(list.numAlpha == serialChunk.numAlpha);
+		for (size_t i = 0; i < list.packets.size(); ++i)
+		{
+			assert(list.packets[i].key == serialList.packets[i].key && list.packets[i].instanceIndex == serialList.packets[i].instanceIndex);
+		}
+
+		result.numChunks = builder.NumChunks();
+		result.speedup = (result.parallelMs > 0.0) ? serialMs / result.parallelMs : 0.0;
+		outResults.push_back(result);
+
+		if (numThreads == maxThreads)
+		{
+			break;
+		}
+	}
+}
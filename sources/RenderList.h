@@ -0,0 +1,83 @@
+#pragma once
+
+#include "Culling.h"
+#include "DrawSort.h"
+#include "JobSystem.h"
+#include "../shaders/HLSLCompatible.h"
+
+// Multithreaded render list construction (no D3D dependency)
+// Items are split into contiguous chunks, one thread extracts a chunk into the chunk's own buffers,
+// then the buffers are concatenated in chunk order at prefix sum offsets. No locks or atomics, and
+// the merged list is the one a serial loop would build, whatever the thread count.
+
+// Output of one chunk, filled by the extract callback
+struct RenderListChunk
+{
+	std::vector<DrawPacket> packets[2];	// Per cull phase
+	std::vector<HiZTestEntry> hiZTests;
+	std::vector<uint32_t> hiZUntestable;	// Instance indices
+	uint32_t numAlpha = 0;
+	uint32_t numContributionCulled = 0;	// Dropped from every pass
+	uint32_t numDepthPassCulled = 0;	// G-buffer only
+};
+
+// What command recording consumes
+struct RenderList
+{
+	std::vector<DrawPacket> packets;	// First phase, second phase starts at secondPhaseBegin
+	uint32_t secondPhaseBegin = 0;
+	std::vector<HiZTestEntry> hiZTests;
+	std::vector<uint32_t> hiZUntestable;
+	uint32_t numAlpha = 0;
+	uint32_t numContributionCulled = 0;
+	uint32_t numDepthPassCulled = 0;
+};
+
+// Extract items [begin, end), runs on any thread, must only write to chunk
+using RenderListExtractFunc = std::function<void(uint32_t begin, uint32_t end, RenderListChunk& chunk)>;
+
+// A few chunks per thread for balance, multiple of 8 so chunks are valid CullFrustumRange ranges
+uint32_t RenderListChunkSize(uint32_t count, uint32_t numThreads);
+
+class RenderListBuilder
+{
+public:
+	// CullFrustum split across jobs, same ascending output, outIndices needs room for bounds.centerX.size()
+	uint32_t CullFrustum(JobSystem& jobs, const BoundsSoA& bounds, const FrustumPlanes& planes, uint32_t* outIndices, bool allowSimd = true);
+
+	// Extract [0, count) chunk by chunk and merge into outList, chunk buffers keep their capacity
+	void Build(JobSystem& jobs, uint32_t count, const RenderListExtractFunc& extract, RenderList& outList);
+
+	uint32_t NumChunks() const { return m_numChunks; }
+
+private:
+	struct ChunkOffsets
+	{
+		uint32_t packets[2];
+		uint32_t hiZTests;
+		uint32_t hiZUntestable;
+	};
+
+	uint32_t m_numChunks = 0;
+	std::vector<RenderListChunk> m_chunks;
+	std::vector<ChunkOffsets> m_offsets;
+
+	// Frustum culling, every chunk compacts in place inside its own range
+	std::vector<uint32_t> m_chunkSlots;
+	std::vector<uint32_t> m_chunkCounts;
+};
+
+struct RenderListBenchmarkResult
+{
+	uint32_t numInstances = 0;
+	uint32_t numThreads = 0;
+	uint32_t numVisible = 0;
+	uint32_t numChunks = 0;
+	double serialMs = 0.0;		// Frustum cull and extract in one loop each
+	double parallelMs = 0.0;	// Same work through RenderListBuilder
+	double speedup = 0.0;
+};
+
+// Random scene, frustum cull then HiZ projection and packet extract, one result per thread count
+// (1, 2, 4 ... up to hardware concurrency), each checked against the serial list
+void RunRenderListBenchmark(uint32_t numInstances, std::vector<RenderListBenchmarkResult>& outResults);
@@ -0,0 +1,92 @@
+#include "ShadowCulling.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+
+using namespace DirectX;
+
+BoundingBox ComputeSceneBounds(const BoundsSoA& bounds)
+{
+	if (bounds.count == 0)
+	{
+		return BoundingBox(XMFLOAT3(0.f, 0.f, 0.f), XMFLOAT3(0.f, 0.f, 0.f));
+	}
+
+	XMFLOAT3 minBound(FLT_MAX, FLT_MAX, FLT_MAX);
+	XMFLOAT3 maxBound(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (uint32_t i = 0; i < bounds.count; ++i)
+	{
+		minBound.x = std::min(minBound.x, bounds.centerX[i] - bounds.extentX[i]);
+		minBound.y = std::min(minBound.y, bounds.centerY[i] - bounds.extentY[i]);
+		minBound.z = std::min(minBound.z, bounds.centerZ[i] - bounds.extentZ[i]);
+		maxBound.x = std::max(maxBound.x, bounds.centerX[i] + bounds.extentX[i]);
+		maxBound.y = std::max(maxBound.y, bounds.centerY[i] + bounds.extentY[i]);
+		maxBound.z = std::max(maxBound.z, bounds.centerZ[i] + bounds.extentZ[i]);
+	}
+	return BoundingBox(
+		XMFLOAT3((minBound.x + maxBound.x) * 0.5f, (minBound.y + maxBound.y) * 0.5f, (minBound.z + maxBound.z) * 0.5f),
+		XMFLOAT3((maxBound.x - minBound.x) * 0.5f, (maxBound.y - minBound.y) * 0.5f, (maxBound.z - minBound.z) * 0.5f));
+}
+
+void BuildShadowCasterVolume(const FrustumPlanes& viewPlanes, const BoundingBox& sceneBounds, const XMFLOAT3& lightDirection, ShadowCasterVolume& outVolume)
+{
+	outVolume = {};
+	for (const XMFLOAT4& plane : viewPlanes.planes)
+	{
+		outVolume.planes[outVolume.numPlanes++] = plane;
+	}
+
+	// Receivers outside the scene have nothing to receive
+	const XMFLOAT3& c = sceneBounds.Center;
+	const XMFLOAT3& e = sceneBounds.Extents;
+	outVolume.planes[outVolume.numPlanes++] = XMFLOAT4(1.f, 0.f, 0.f, -(c.x + e.x));
+	outVolume.planes[outVolume.numPlanes++] = XMFLOAT4(-1.f, 0.f, 0.f, c.x - e.x);
+	outVolume.planes[outVolume.numPlanes++] = XMFLOAT4(0.f, 1.f, 0.f, -(c.y + e.y));
+	outVolume.planes[outVolume.numPlanes++] = XMFLOAT4(0.f, -1.f, 0.f, c.y - e.y);
+	outVolume.planes[outVolume.numPlanes++] = XMFLOAT4(0.f, 0.f, 1.f, -(c.z + e.z));
+	outVolume.planes[outVolume.numPlanes++] = XMFLOAT4(0.f, 0.f, -1.f, c.z - e.z);
+	assert(outVolume.numPlanes <= MaxShadowPlanes);
+
+	const float length = sqrtf(lightDirection.x * lightDirection.x + lightDirection.y * lightDirection.y + lightDirection.z * lightDirection.z);
+	if (length > 0.f)
+	{
+		const XMFLOAT3 d(lightDirection.x / length, lightDirection.y / length, lightDirection.z / length);
+		outVolume.direction = d;
+		outVolume.sceneExit = d.x * c.x + d.y * c.y + d.z * c.z + fabsf(d.x) * e.x + fabsf(d.y) * e.y + fabsf(d.z) * e.z;
+	}
+}
+
+bool IsShadowCasterOutside(const ShadowCasterVolume& volume, const XMFLOAT3& center, const XMFLOAT3& extents)
+{
+	// Sweep until the back of the box leaves the scene
+	const XMFLOAT3& d = volume.direction;
+	const float back = d.x * center.x + d.y * center.y + d.z * center.z - (fabsf(d.x) * extents.x + fabsf(d.y) * extents.y + fabsf(d.z) * extents.z);
+	const float sweep = std::max(volume.sceneExit - back, 0.f);
+
+	for (uint32_t i = 0; i < volume.numPlanes; ++i)
+	{
+		// Closest point of the swept box is the closest box point, moved to the end of the sweep if it gets closer
+		const XMFLOAT4& plane = volume.planes[i];
+		const float dist = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+		const float radius = fabsf(plane.x) * extents.x + fabsf(plane.y) * extents.y + fabsf(plane.z) * extents.z;
+		const float toward = std::min(sweep * (plane.x * d.x + plane.y * d.y + plane.z * d.z), 0.f);
+		if (dist + toward > radius)
+			return true;
+	}
+	return false;
+}
+
+uint32_t CullShadowCasters(const BoundsSoA& bounds, const ShadowCasterVolume& volume, uint32_t* outIndices)
+{
+	uint32_t numCasters = 0;
+	for (uint32_t i = 0; i < bounds.count; ++i)
+	{
+		const XMFLOAT3 center(bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]);
+		const XMFLOAT3 extents(bounds.extentX[i], bounds.extentY[i], bounds.extentZ[i]);
+		outIndices[numCasters] = i;
+		numCasters += IsShadowCasterOutside(volume, center, extents) ? 0 : 1;
+	}
+	return numCasters;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+#include "Culling.h"
+
+// Directional light shadow caster culling (no D3D dependency)
+// Receivers are inside the view frustum and the scene bounds. An instance casts into them only when
+// its bounds swept along the light direction, up to where the sweep leaves the scene, intersect that
+// region. Each receiver plane tests the swept box exactly, so like frustum culling the result is
+// conservative: no caster is dropped, a few boxes near frustum corners are kept.
+
+static const uint32_t MaxShadowPlanes = 12;
+
+struct ShadowCasterVolume
+{
+	DirectX::XMFLOAT4 planes[MaxShadowPlanes];	// View frustum then scene bounds, pointing out
+	uint32_t numPlanes = 0;
+	DirectX::XMFLOAT3 direction = {};		// Normalized, from the light into the scene, 0 disables the sweep
+	float sceneExit = 0.f;					// Furthest dot(direction, x) over the scene bounds
+};
+
+// Union of every box, empty bounds give a zero box at the origin
+DirectX::BoundingBox ComputeSceneBounds(const BoundsSoA& bounds);
+
+// lightDirection is LightData::direction, light travels along it
+void BuildShadowCasterVolume(const FrustumPlanes& viewPlanes, const DirectX::BoundingBox& sceneBounds, const DirectX::XMFLOAT3& lightDirection, ShadowCasterVolume& outVolume);
+
+bool IsShadowCasterOutside(const ShadowCasterVolume& volume, const DirectX::XMFLOAT3& center, const DirectX::XMFLOAT3& extents);
+
+// Write indices of possible casters in ascending order, returns count
+// outIndices needs room for bounds.count entries
+uint32_t CullShadowCasters(const BoundsSoA& bounds, const ShadowCasterVolume& volume, uint32_t* outIndices);
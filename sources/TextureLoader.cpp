@@ -0,0 +1,638 @@
+#include "TextureLoader.h"
+
+//
+// DDS layout
+// https://learn.microsoft.com/en-us/windows/win32/direct3ddds/dds-header
+//
+static const uint32_t DDS_MAGIC = 0x20534444;	// "DDS "
+
+#define DDS_FOURCC(a, b, c, d) (uint32_t(uint8_t(a)) | (uint32_t(uint8_t(b)) << 8) | (uint32_t(uint8_t(c)) << 16) | (uint32_t(uint8_t(d)) << 24))
+
+static const uint32_t DDS_PF_FOURCC = 0x4;
+static const uint32_t DDS_PF_RGB = 0x40;
+static const uint32_t DDS_CAPS2_CUBEMAP = 0x200;
+static const uint32_t DDS_CAPS2_VOLUME = 0x200000;
+static const uint32_t DDS_DIMENSION_TEXTURE2D = 3;
+
+#pragma pack(push, 1)
+struct DDSPixelFormat
+{
+	uint32_t size;
+	uint32_t flags;
+	uint32_t fourCC;
+	uint32_t RGBBitCount;
+	uint32_t RBitMask;
+	uint32_t GBitMask;
+	uint32_t BBitMask;
+	uint32_t ABitMask;
+};
+
+struct DDSHeader
+{
+	uint32_t size;
+	uint32_t flags;
+	uint32_t height;
+	uint32_t width;
+	uint32_t pitchOrLinearSize;
+	uint32_t depth;
+	uint32_t mipMapCount;
+	uint32_t reserved1[11];
+	DDSPixelFormat ddspf;
+	uint32_t caps;
+	uint32_t caps2;
+	uint32_t caps3;
+	uint32_t caps4;
+	uint32_t reserved2;
+};
+
+struct DDSHeaderDXT10
+{
+	uint32_t dxgiFormat;
+	uint32_t resourceDimension;
+	uint32_t miscFlag;
+	uint32_t arraySize;
+	uint32_t miscFlags2;
+};
+#pragma pack(pop)
+
+//
+// KTX2 layout
+// https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html
+//
+static const uint8_t KTX2_IDENTIFIER[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+#pragma pack(push, 1)
+struct KTX2Header
+{
+	uint8_t identifier[12];
+	uint32_t vkFormat;
+	uint32_t typeSize;
+	uint32_t pixelWidth;
+	uint32_t pixelHeight;
+	uint32_t pixelDepth;
+	uint32_t layerCount;
+	uint32_t faceCount;
+	uint32_t levelCount;
+	uint32_t supercompressionScheme;
+
+	// Index
+	uint32_t dfdByteOffset;
+	uint32_t dfdByteLength;
+	uint32_t kvdByteOffset;
+	uint32_t kvdByteLength;
+	uint64_t sgdByteOffset;
+	uint64_t sgdByteLength;
+};
+
+struct KTX2LevelIndex
+{
+	uint64_t byteOffset;
+	uint64_t byteLength;
+	uint64_t uncompressedByteLength;
+};
+#pragma pack(pop)
+
+//
+// Mapped file
+//
+HRESULT MappedFile::Open(const std::wstring& filePath)
+{
+	Close();
+
+	// Sequential hint, texel data is read once front to back during upload
+	file = CreateFileW(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	LARGE_INTEGER fileSize = {};
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		Close();
+		return E_FAIL;
+	}
+	size = static_cast<uint64_t>(fileSize.QuadPart);
+
+	mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr)
+	{
+		HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+		Close();
+		return hr;
+	}
+
+	data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (data == nullptr)
+	{
+		HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+		Close();
+		return hr;
+	}
+	return S_OK;
+}
+
+void MappedFile::Close()
+{
+	if (data)
+	{
+		UnmapViewOfFile(data);
+		data = nullptr;
+	}
+	if (mapping)
+	{
+		CloseHandle(mapping);
+		mapping = nullptr;
+	}
+	if (file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(file);
+		file = INVALID_HANDLE_VALUE;
+	}
+	size = 0;
+}
+
+void TextureContainer::Close()
+{
+	mips.clear();
+	numMips = 0;
+	file.Close();
+	memory.clear();
+	memory.shrink_to_fit();
+}
+
+//
+// Format helper
+//
+static uint32_t BlockSizeInBytes(DXGI_FORMAT format)
+{
+	switch (format)
+	{
+	case DXGI_FORMAT_BC1_TYPELESS:
+	case DXGI_FORMAT_BC1_UNORM:
+	case DXGI_FORMAT_BC1_UNORM_SRGB:
+	case DXGI_FORMAT_BC4_TYPELESS:
+	case DXGI_FORMAT_BC4_UNORM:
+	case DXGI_FORMAT_BC4_SNORM:
+		return 8;
+
+	case DXGI_FORMAT_BC2_TYPELESS:
+	case DXGI_FORMAT_BC2_UNORM:
+	case DXGI_FORMAT_BC2_UNORM_SRGB:
+	case DXGI_FORMAT_BC3_TYPELESS:
+	case DXGI_FORMAT_BC3_UNORM:
+	case DXGI_FORMAT_BC3_UNORM_SRGB:
+	case DXGI_FORMAT_BC5_TYPELESS:
+	case DXGI_FORMAT_BC5_UNORM:
+	case DXGI_FORMAT_BC5_SNORM:
+	case DXGI_FORMAT_BC6H_TYPELESS:
+	case DXGI_FORMAT_BC6H_UF16:
+	case DXGI_FORMAT_BC6H_SF16:
+	case DXGI_FORMAT_BC7_TYPELESS:
+	case DXGI_FORMAT_BC7_UNORM:
+	case DXGI_FORMAT_BC7_UNORM_SRGB:
+		return 16;
+
+	default:
+		return 0;	// Not block compressed
+	}
+}
+
+static uint32_t BitsPerPixel(DXGI_FORMAT format)
+{
+	switch (format)
+	{
+	case DXGI_FORMAT_R32G32B32A32_FLOAT:
+		return 128;
+	case DXGI_FORMAT_R16G16B16A16_FLOAT:
+	case DXGI_FORMAT_R16G16B16A16_UNORM:
+		return 64;
+	case DXGI_FORMAT_R8G8B8A8_UNORM:
+	case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+	case DXGI_FORMAT_B8G8R8A8_UNORM:
+	case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+	case DXGI_FORMAT_B8G8R8X8_UNORM:
+	case DXGI_FORMAT_R10G10B10A2_UNORM:
+	case DXGI_FORMAT_R32_FLOAT:
+		return 32;
+	case DXGI_FORMAT_R8G8_UNORM:
+	case DXGI_FORMAT_R16_FLOAT:
+		return 16;
+	case DXGI_FORMAT_R8_UNORM:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+void GetSurfaceInfo(
+	uint32_t width,
+	uint32_t height,
+	DXGI_FORMAT format,
+	uint64_t* outRowPitch,
+	uint64_t* outSlicePitch,
+	uint32_t* outNumRows)
+{
+	uint64_t rowPitch = 0;
+	uint32_t numRows = 0;
+
+	const uint32_t blockSize = BlockSizeInBytes(format);
+	if (blockSize > 0)
+	{
+		// 4x4 blocks, partial block still take a full block
+		const uint64_t numBlocksWide = std::max<uint64_t>(1, (uint64_t(width) + 3) / 4);
+		const uint64_t numBlocksHigh = std::max<uint64_t>(1, (uint64_t(height) + 3) / 4);
+		rowPitch = numBlocksWide * blockSize;
+		numRows = static_cast<uint32_t>(numBlocksHigh);
+	}
+	else
+	{
+		const uint32_t bpp = BitsPerPixel(format);
+		assert(bpp > 0 && "Unsupported texture format");
+		rowPitch = (uint64_t(width) * bpp + 7) / 8;
+		numRows = height;
+	}
+
+	if (outRowPitch)
+		*outRowPitch = rowPitch;
+	if (outSlicePitch)
+		*outSlicePitch = rowPitch * numRows;
+	if (outNumRows)
+		*outNumRows = numRows;
+}
+
+bool IsBlockCompressed(DXGI_FORMAT format)
+{
+	return BlockSizeInBytes(format) > 0;
+}
+
+bool IsTextureContainer(const unsigned char* bytes, size_t size)
+{
+	if (bytes == nullptr)
+		return false;
+
+	if (size >= sizeof(uint32_t) + sizeof(DDSHeader))
+	{
+		uint32_t magic = 0;
+		memcpy(&magic, bytes, sizeof(magic));
+		if (magic == DDS_MAGIC)
+			return true;
+	}
+
+	if (size >= sizeof(KTX2Header))
+	{
+		if (memcmp(bytes, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) == 0)
+			return true;
+	}
+	return false;
+}
+
+// Malformed headers would read past the payload or create an invalid resource
+// The chain can't be longer than the full one, BC top level must be whole blocks
+static bool IsValidChain(uint32_t width, uint32_t height, uint32_t numMips, DXGI_FORMAT format)
+{
+	if (width == 0 || height == 0)
+		return false;
+
+	uint32_t maxMips = 1;
+	for (uint32_t extent = std::max(width, height); extent > 1; extent /= 2)
+	{
+		++maxMips;
+	}
+	if (numMips > maxMips)
+		return false;
+	return !IsBlockCompressed(format) || (width % 4 == 0 && height % 4 == 0);
+}
+
+// Fill mip chain from a tightly packed payload (mip 0 first)
+static HRESULT FillPackedMips(const uint8_t* payload, uint64_t payloadSize, TextureContainer& container)
+{
+	container.mips.resize(container.numMips);
+
+	uint64_t offset = 0;
+	uint32_t width = container.width;
+	uint32_t height = container.height;
+	for (uint32_t mip = 0; mip < container.numMips; ++mip)
+	{
+		uint64_t rowPitch = 0, slicePitch = 0;
+		GetSurfaceInfo(width, height, container.format, &rowPitch, &slicePitch, nullptr);
+		if (offset > payloadSize || payloadSize - offset < slicePitch)
+		{
+			return E_FAIL;	// Truncated file
+		}
+
+		D3D12_SUBRESOURCE_DATA& mipData = container.mips[mip];
+		mipData.pData = payload + offset;
+		mipData.RowPitch = static_cast<LONG_PTR>(rowPitch);
+		mipData.SlicePitch = static_cast<LONG_PTR>(slicePitch);
+
+		offset += slicePitch;
+		width = std::max(width / 2, 1u);
+		height = std::max(height / 2, 1u);
+	}
+	return S_OK;
+}
+
+static DXGI_FORMAT GetDXGIFormatFromLegacyDDS(const DDSPixelFormat& ddpf)
+{
+	if (ddpf.flags & DDS_PF_FOURCC)
+	{
+		switch (ddpf.fourCC)
+		{
+		case DDS_FOURCC('D', 'X', 'T', '1'): return DXGI_FORMAT_BC1_UNORM;
+		case DDS_FOURCC('D', 'X', 'T', '2'):
+		case DDS_FOURCC('D', 'X', 'T', '3'): return DXGI_FORMAT_BC2_UNORM;
+		case DDS_FOURCC('D', 'X', 'T', '4'):
+		case DDS_FOURCC('D', 'X', 'T', '5'): return DXGI_FORMAT_BC3_UNORM;
+		case DDS_FOURCC('A', 'T', 'I', '1'):
+		case DDS_FOURCC('B', 'C', '4', 'U'): return DXGI_FORMAT_BC4_UNORM;
+		case DDS_FOURCC('B', 'C', '4', 'S'): return DXGI_FORMAT_BC4_SNORM;
+		case DDS_FOURCC('A', 'T', 'I', '2'):
+		case DDS_FOURCC('B', 'C', '5', 'U'): return DXGI_FORMAT_BC5_UNORM;
+		case DDS_FOURCC('B', 'C', '5', 'S'): return DXGI_FORMAT_BC5_SNORM;
+		case 113: return DXGI_FORMAT_R16G16B16A16_FLOAT;	// D3DFMT_A16B16G16R16F
+		case 116: return DXGI_FORMAT_R32G32B32A32_FLOAT;	// D3DFMT_A32B32G32R32F
+		default: return DXGI_FORMAT_UNKNOWN;
+		}
+	}
+
+	if ((ddpf.flags & DDS_PF_RGB) && ddpf.RGBBitCount == 32)
+	{
+		if (ddpf.RBitMask == 0x000000ff && ddpf.GBitMask == 0x0000ff00 && ddpf.BBitMask == 0x00ff0000)
+			return DXGI_FORMAT_R8G8B8A8_UNORM;
+		if (ddpf.RBitMask == 0x00ff0000 && ddpf.GBitMask == 0x0000ff00 && ddpf.BBitMask == 0x000000ff)
+			return ddpf.ABitMask ? DXGI_FORMAT_B8G8R8A8_UNORM : DXGI_FORMAT_B8G8R8X8_UNORM;
+	}
+	return DXGI_FORMAT_UNKNOWN;
+}
+
+HRESULT LoadDDSFromMemory(const uint8_t* bytes, uint64_t size, TextureContainer& container)
+{
+	if (size < sizeof(uint32_t) + sizeof(DDSHeader))
+	{
+		return E_FAIL;
+	}
+
+	uint32_t magic = 0;
+	memcpy(&magic, bytes, sizeof(magic));
+	if (magic != DDS_MAGIC)
+	{
+		return E_FAIL;
+	}
+
+	DDSHeader header;
+	memcpy(&header, bytes + sizeof(uint32_t), sizeof(DDSHeader));
+	if (header.size != sizeof(DDSHeader) || header.ddspf.size != sizeof(DDSPixelFormat))
+	{
+		return E_FAIL;
+	}
+
+	uint64_t payloadOffset = sizeof(uint32_t) + sizeof(DDSHeader);
+	DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN;
+
+	if ((header.ddspf.flags & DDS_PF_FOURCC) && header.ddspf.fourCC == DDS_FOURCC('D', 'X', '1', '0'))
+	{
+		if (size < payloadOffset + sizeof(DDSHeaderDXT10))
+		{
+			return E_FAIL;
+		}
+
+		DDSHeaderDXT10 dx10;
+		memcpy(&dx10, bytes + payloadOffset, sizeof(DDSHeaderDXT10));
+		payloadOffset += sizeof(DDSHeaderDXT10);
+
+		// Only plain 2D material texture for now
+		if (dx10.resourceDimension != DDS_DIMENSION_TEXTURE2D || dx10.arraySize > 1)
+		{
+			return E_NOTIMPL;
+		}
+		format = static_cast<DXGI_FORMAT>(dx10.dxgiFormat);
+	}
+	else
+	{
+		if (header.caps2 & (DDS_CAPS2_CUBEMAP | DDS_CAPS2_VOLUME))
+		{
+			return E_NOTIMPL;
+		}
+		format = GetDXGIFormatFromLegacyDDS(header.ddspf);
+	}
+
+	if (format == DXGI_FORMAT_UNKNOWN || (BlockSizeInBytes(format) == 0 && BitsPerPixel(format) == 0))
+	{
+		return E_NOTIMPL;
+	}
+
+	if (!IsValidChain(header.width, header.height, std::max(header.mipMapCount, 1u), format))
+	{
+		return E_FAIL;
+	}
+
+	container.width = header.width;
+	container.height = header.height;
+	container.numMips = std::max(header.mipMapCount, 1u);
+	container.format = format;
+
+	return FillPackedMips(bytes + payloadOffset, size - payloadOffset, container);
+}
+
+static DXGI_FORMAT GetDXGIFormatFromVkFormat(uint32_t vkFormat)
+{
+	switch (vkFormat)
+	{
+	case 37: return DXGI_FORMAT_R8G8B8A8_UNORM;			// VK_FORMAT_R8G8B8A8_UNORM
+	case 43: return DXGI_FORMAT_R8G8B8A8_UNORM_SRGB;	// VK_FORMAT_R8G8B8A8_SRGB
+	case 44: return DXGI_FORMAT_B8G8R8A8_UNORM;			// VK_FORMAT_B8G8R8A8_UNORM
+	case 50: return DXGI_FORMAT_B8G8R8A8_UNORM_SRGB;	// VK_FORMAT_B8G8R8A8_SRGB
+	case 97: return DXGI_FORMAT_R16G16B16A16_FLOAT;		// VK_FORMAT_R16G16B16A16_SFLOAT
+	case 109: return DXGI_FORMAT_R32G32B32A32_FLOAT;	// VK_FORMAT_R32G32B32A32_SFLOAT
+	case 131:											// VK_FORMAT_BC1_RGB_UNORM_BLOCK
+	case 133: return DXGI_FORMAT_BC1_UNORM;				// VK_FORMAT_BC1_RGBA_UNORM_BLOCK
+	case 132:											// VK_FORMAT_BC1_RGB_SRGB_BLOCK
+	case 134: return DXGI_FORMAT_BC1_UNORM_SRGB;		// VK_FORMAT_BC1_RGBA_SRGB_BLOCK
+	case 135: return DXGI_FORMAT_BC2_UNORM;
+	case 136: return DXGI_FORMAT_BC2_UNORM_SRGB;
+	case 137: return DXGI_FORMAT_BC3_UNORM;
+	case 138: return DXGI_FORMAT_BC3_UNORM_SRGB;
+	case 139: return DXGI_FORMAT_BC4_UNORM;
+	case 140: return DXGI_FORMAT_BC4_SNORM;
+	case 141: return DXGI_FORMAT_BC5_UNORM;
+	case 142: return DXGI_FORMAT_BC5_SNORM;
+	case 143: return DXGI_FORMAT_BC6H_UF16;
+	case 144: return DXGI_FORMAT_BC6H_SF16;
+	case 145: return DXGI_FORMAT_BC7_UNORM;
+	case 146: return DXGI_FORMAT_BC7_UNORM_SRGB;
+	default: return DXGI_FORMAT_UNKNOWN;
+	}
+}
+
+HRESULT LoadKTX2FromMemory(const uint8_t* bytes, uint64_t size, TextureContainer& container)
+{
+	if (size < sizeof(KTX2Header))
+	{
+		return E_FAIL;
+	}
+
+	KTX2Header header;
+	memcpy(&header, bytes, sizeof(KTX2Header));
+	if (memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+	{
+		return E_FAIL;
+	}
+
+	// Supercompressed payload (BasisLZ, zstd) need a decode step, not supported
+	if (header.supercompressionScheme != 0)
+	{
+		return E_NOTIMPL;
+	}
+	// Only plain 2D material texture for now
+	if (header.pixelDepth > 1 || header.layerCount > 1 || header.faceCount > 1)
+	{
+		return E_NOTIMPL;
+	}
+
+	const DXGI_FORMAT format = GetDXGIFormatFromVkFormat(header.vkFormat);
+	if (format == DXGI_FORMAT_UNKNOWN)
+	{
+		return E_NOTIMPL;
+	}
+
+	// levelCount 0 ask loader to generate mips, we just take the base level
+	const uint32_t numMips = std::max(header.levelCount, 1u);
+	const uint64_t levelIndexOffset = sizeof(KTX2Header);
+	if (!IsValidChain(header.pixelWidth, header.pixelHeight, numMips, format) ||
+		size < levelIndexOffset + numMips * sizeof(KTX2LevelIndex))
+	{
+		return E_FAIL;
+	}
+
+	container.width = header.pixelWidth;
+	container.height = header.pixelHeight;
+	container.numMips = numMips;
+	container.format = format;
+	container.mips.resize(numMips);
+
+	// Level index is ordered from base level, while data is stored smallest mip first
+	uint32_t width = container.width;
+	uint32_t height = container.height;
+	for (uint32_t mip = 0; mip < numMips; ++mip)
+	{
+		KTX2LevelIndex level;
+		memcpy(&level, bytes + levelIndexOffset + mip * sizeof(KTX2LevelIndex), sizeof(KTX2LevelIndex));
+
+		uint64_t rowPitch = 0, slicePitch = 0;
+		GetSurfaceInfo(width, height, format, &rowPitch, &slicePitch, nullptr);
+		if (level.byteLength < slicePitch || level.byteOffset > size || size - level.byteOffset < slicePitch)
+		{
+			return E_FAIL;
+		}
+
+		D3D12_SUBRESOURCE_DATA& mipData = container.mips[mip];
+		mipData.pData = bytes + level.byteOffset;
+		mipData.RowPitch = static_cast<LONG_PTR>(rowPitch);
+		mipData.SlicePitch = static_cast<LONG_PTR>(slicePitch);
+
+		width = std::max(width / 2, 1u);
+		height = std::max(height / 2, 1u);
+	}
+	return S_OK;
+}
+
+static HRESULT ParseTextureContainer(const uint8_t* bytes, uint64_t size, TextureContainer& container)
+{
+	uint32_t magic = 0;
+	if (size >= sizeof(magic))
+	{
+		memcpy(&magic, bytes, sizeof(magic));
+	}
+
+	HRESULT hr = (magic == DDS_MAGIC) ? LoadDDSFromMemory(bytes, size, container) : LoadKTX2FromMemory(bytes, size, container);
+	if (FAILED(hr))
+	{
+		container.Close();
+	}
+	return hr;
+}
+
+HRESULT LoadTextureContainer(const std::wstring& filePath, TextureContainer& container)
+{
+	HRESULT hr = container.file.Open(filePath);
+	if (FAILED(hr))
+	{
+		return hr;
+	}
+	return ParseTextureContainer(container.file.data, container.file.size, container);
+}
+
+HRESULT LoadTextureContainerFromMemory(const uint8_t* bytes, uint64_t size, TextureContainer& container)
+{
+	container.memory.assign(bytes, bytes + size);
+	return ParseTextureContainer(container.memory.data(), container.memory.size(), container);
+}
+
+void GenerateMipChainRGBA8(
+	const uint8_t* pixels,
+	uint32_t width,
+	uint32_t height,
+	std::vector<uint8_t>& outChain,
+	std::vector<D3D12_SUBRESOURCE_DATA>& outMips)
+{
+	assert(pixels && width > 0 && height > 0);
+
+	// Size whole chain first, mips point into it
+	uint32_t numMips = 1;
+	uint64_t totalSize = 0;
+	for (uint32_t w = width, h = height; ; ++numMips)
+	{
+		totalSize += uint64_t(w) * h * 4;
+		if (w == 1 && h == 1)
+			break;
+		w = std::max(w / 2, 1u);
+		h = std::max(h / 2, 1u);
+	}
+
+	outChain.resize(totalSize);
+	outMips.resize(numMips);
+	memcpy(outChain.data(), pixels, uint64_t(width) * height * 4);
+
+	uint64_t offset = 0;
+	uint32_t srcWidth = width, srcHeight = height;
+	for (uint32_t mip = 0; mip < numMips; ++mip)
+	{
+		const uint32_t mipWidth = std::max(width >> mip, 1u);
+		const uint32_t mipHeight = std::max(height >> mip, 1u);
+		uint8_t* dst = outChain.data() + offset;
+
+		// 2x2 box filter from previous level, edge texel repeats on odd sizes
+		if (mip > 0)
+		{
+			const uint8_t* src = dst - uint64_t(srcWidth) * srcHeight * 4;
+			for (uint32_t y = 0; y < mipHeight; ++y)
+			{
+				const uint32_t y0 = std::min(y * 2, srcHeight - 1);
+				const uint32_t y1 = std::min(y * 2 + 1, srcHeight - 1);
+				for (uint32_t x = 0; x < mipWidth; ++x)
+				{
+					const uint32_t x0 = std::min(x * 2, srcWidth - 1);
+					const uint32_t x1 = std::min(x * 2 + 1, srcWidth - 1);
+					for (uint32_t c = 0; c < 4; ++c)
+					{
+						const uint32_t sum =
+							src[(uint64_t(y0) * srcWidth + x0) * 4 + c] +
+							src[(uint64_t(y0) * srcWidth + x1) * 4 + c] +
+							src[(uint64_t(y1) * srcWidth + x0) * 4 + c] +
+							src[(uint64_t(y1) * srcWidth + x1) * 4 + c];
+						dst[(uint64_t(y) * mipWidth + x) * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+					}
+				}
+			}
+		}
+
+		outMips[mip].pData = dst;
+		outMips[mip].RowPitch = static_cast<LONG_PTR>(mipWidth) * 4;
+		outMips[mip].SlicePitch = outMips[mip].RowPitch * mipHeight;
+
+		offset += uint64_t(mipWidth) * mipHeight * 4;
+		srcWidth = mipWidth;
+		srcHeight = mipHeight;
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "PCH.h"
+
+// Read-only memory mapped file
+// Texel data is copied straight from file pages into upload memory, no intermediate buffer
+struct MappedFile
+{
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+	const uint8_t* data = nullptr;
+	uint64_t size = 0;
+
+	HRESULT Open(const std::wstring& filePath);
+	void Close();
+};
+
+// Pre-compressed, pre-mipped texture container (DDS / KTX2)
+// Mips point into the mapped file, must stay open until the texture upload is recorded
+struct TextureContainer
+{
+	MappedFile file;
+	std::vector<uint8_t> memory;	// Copy of an embedded container (glb buffer, data uri), file isn't open
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t numMips = 0;
+	DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN;
+	std::vector<D3D12_SUBRESOURCE_DATA> mips;
+
+	bool IsValid() const { return numMips > 0; }
+	void Close();
+};
+
+// Byte size of one mip level (rows are tightly packed, as stored in DDS/KTX2)
+void GetSurfaceInfo(
+	uint32_t width,
+	uint32_t height,
+	DXGI_FORMAT format,
+	uint64_t* outRowPitch,
+	uint64_t* outSlicePitch,
+	uint32_t* outNumRows);
+
+// BC formats, top level of a resource must be a multiple of 4x4 blocks
+bool IsBlockCompressed(DXGI_FORMAT format);
+
+// Check file magic, used to skip image decode on container payload
+bool IsTextureContainer(const unsigned char* bytes, size_t size);
+
+HRESULT LoadDDSFromMemory(const uint8_t* bytes, uint64_t size, TextureContainer& container);
+HRESULT LoadKTX2FromMemory(const uint8_t* bytes, uint64_t size, TextureContainer& container);
+
+// Map file and parse either DDS or KTX2 based on magic
+HRESULT LoadTextureContainer(const std::wstring& filePath, TextureContainer& container);
+
+// Same for a container embedded in the glTF, bytes are copied and mips point into the copy
+HRESULT LoadTextureContainerFromMemory(const uint8_t* bytes, uint64_t size, TextureContainer& container);
+
+// Box filtered mip chain for 8 bit RGBA, level 0 is copied as is
+// Mips point into outChain, rows are tightly packed
+void GenerateMipChainRGBA8(
+	const uint8_t* pixels,
+	uint32_t width,
+	uint32_t height,
+	std::vector<uint8_t>& outChain,
+	std::vector<D3D12_SUBRESOURCE_DATA>& outMips);
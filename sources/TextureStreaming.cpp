@@ -0,0 +1,242 @@
+#include "TextureStreaming.h"
+
+#include <algorithm>
+#include <assert.h>
+
+void TextureStreamer::Initialize(const TextureStreamingInit& init)
+{
+	m_init = init;
+	m_stats = {};
+	m_textures.clear();
+	m_mipBytes.clear();
+	m_frameIndex = 0;
+	m_residentBytes = 0;
+}
+
+void TextureStreamer::Shutdown()
+{
+	m_textures.clear();
+	m_mipBytes.clear();
+	m_residentBytes = 0;
+}
+
+uint32_t TextureStreamer::AddTexture(const StreamingTextureDesc& desc)
+{
+	assert(desc.numMips > 0 && desc.mipBytes);
+
+	StreamingTexture tex;
+	tex.numMips = desc.numMips;
+	tex.tailMip = std::min(desc.tailMip, desc.numMips - 1);
+	tex.residentMip = std::min(desc.initialMip, tex.tailMip);
+	tex.desiredMip = tex.residentMip;
+	tex.startMip = tex.residentMip;
+	tex.firstMipByte = static_cast<uint32_t>(m_mipBytes.size());
+	m_mipBytes.insert(m_mipBytes.end(), desc.mipBytes, desc.mipBytes + desc.numMips);
+
+	m_residentBytes += BytesFromMip(tex, tex.residentMip);
+	m_textures.push_back(tex);
+	return static_cast<uint32_t>(m_textures.size() - 1);
+}
+
+void TextureStreamer::BeginFrame()
+{
+	++m_frameIndex;
+	for (StreamingTexture& tex : m_textures)
+	{
+		tex.requested = false;
+	}
+}
+
+void TextureStreamer::RequestMip(uint32_t textureIndex, float mip)
+{
+	assert(textureIndex < m_textures.size());
+
+	StreamingTexture& tex = m_textures[textureIndex];
+	if (!tex.requested || mip < tex.requestedMip)
+	{
+		tex.requestedMip = mip;
+		tex.requested = true;
+	}
+}
+
+uint64_t TextureStreamer::ResidentBytes(uint32_t textureIndex) const
+{
+	const StreamingTexture& tex = m_textures[textureIndex];
+	return BytesFromMip(tex, tex.residentMip);
+}
+
+uint64_t TextureStreamer::BytesFromMip(const StreamingTexture& tex, uint32_t mip) const
+{
+	uint64_t bytes = 0;
+	for (uint32_t m = mip; m < tex.numMips; ++m)
+	{
+		bytes += MipBytes(tex, m);
+	}
+	return bytes;
+}
+
+// Not used this frame, or holding more detail than requested
+bool TextureStreamer::IsEvictable(const StreamingTexture& tex) const
+{
+	return tex.residentMip < tex.tailMip &&
+		(tex.lastUsedFrame < m_frameIndex || tex.residentMip < tex.desiredMip);
+}
+
+void TextureStreamer::Update(std::vector<StreamingChange>& outChanges)
+{
+	outChanges.clear();
+
+	m_stats.numRequested = 0;
+	m_stats.numPending = 0;
+	m_stats.mipsLoaded = 0;
+	m_stats.mipsEvicted = 0;
+	m_stats.wantedBytes = 0;
+
+	// Desired mip from requests, textures not seen this frame only need the tail
+	for (StreamingTexture& tex : m_textures)
+	{
+		tex.startMip = tex.residentMip;
+		if (tex.requested)
+		{
+			const float mip = std::max(tex.requestedMip + m_init.mipBias, 0.f);
+			tex.desiredMip = std::min(static_cast<uint32_t>(mip), tex.tailMip);
+			tex.lastUsedFrame = m_frameIndex;
+
+			++m_stats.numRequested;
+			m_stats.wantedBytes += BytesFromMip(tex, tex.desiredMip);
+		}
+		else
+		{
+			tex.desiredMip = tex.tailMip;
+		}
+	}
+
+	// Load priority: largest mip deficit first, index breaks ties
+	auto lowerPriority = [this](uint32_t a, uint32_t b)
+	{
+		const uint32_t deficitA = m_textures[a].residentMip - m_textures[a].desiredMip;
+		const uint32_t deficitB = m_textures[b].residentMip - m_textures[b].desiredMip;
+		if (deficitA != deficitB)
+			return deficitA < deficitB;
+		return a > b;
+	};
+
+	std::vector<uint32_t> loads;
+	std::vector<uint32_t> victims;
+	for (uint32_t i = 0; i < m_textures.size(); ++i)
+	{
+		const StreamingTexture& tex = m_textures[i];
+		if (tex.desiredMip < tex.residentMip)
+		{
+			loads.push_back(i);
+		}
+		else if (IsEvictable(tex))
+		{
+			victims.push_back(i);
+		}
+	}
+	std::make_heap(loads.begin(), loads.end(), lowerPriority);
+
+	// Eviction order: least recently used first, then most over resident
+	std::sort(victims.begin(), victims.end(), [this](uint32_t a, uint32_t b)
+	{
+		const StreamingTexture& texA = m_textures[a];
+		const StreamingTexture& texB = m_textures[b];
+		if (texA.lastUsedFrame != texB.lastUsedFrame)
+			return texA.lastUsedFrame < texB.lastUsedFrame;
+
+		const uint32_t excessA = texA.desiredMip - texA.residentMip;
+		const uint32_t excessB = texB.desiredMip - texB.residentMip;
+		if (excessA != excessB)
+			return excessA > excessB;
+		return a < b;
+	});
+
+	size_t victimCursor = 0;
+	uint32_t numUploads = 0;
+	uint64_t uploadBytes = 0;
+
+	// Budget lowered below the resident size, trim the victims then the most detailed visible textures
+	while (m_residentBytes > m_init.budgetBytes)
+	{
+		while (victimCursor < victims.size() && !IsEvictable(m_textures[victims[victimCursor]]))
+			++victimCursor;
+
+		StreamingTexture* victim = (victimCursor < victims.size()) ? &m_textures[victims[victimCursor]] : nullptr;
+		if (!victim)
+		{
+			for (StreamingTexture& tex : m_textures)
+			{
+				if (tex.residentMip < tex.tailMip && (!victim || tex.residentMip < victim->residentMip))
+					victim = &tex;
+			}
+		}
+		if (!victim)
+			break;
+
+		m_residentBytes -= MipBytes(*victim, victim->residentMip);
+		++victim->residentMip;
+		++m_stats.mipsEvicted;
+	}
+
+	while (!loads.empty() && numUploads < m_init.maxUploadsPerFrame)
+	{
+		std::pop_heap(loads.begin(), loads.end(), lowerPriority);
+		const uint32_t index = loads.back();
+		loads.pop_back();
+
+		StreamingTexture& tex = m_textures[index];
+		const uint32_t nextMip = tex.residentMip - 1;
+		const uint64_t bytes = MipBytes(tex, nextMip);
+
+		// Always allow one upload, a single mip may exceed the per frame limit
+		if (numUploads > 0 && uploadBytes + bytes > m_init.maxUploadBytesPerFrame)
+			break;
+
+		// Make room one mip at a time
+		while (m_residentBytes + bytes > m_init.budgetBytes && victimCursor < victims.size())
+		{
+			StreamingTexture& victim = m_textures[victims[victimCursor]];
+			if (!IsEvictable(victim))
+			{
+				++victimCursor;
+				continue;
+			}
+
+			m_residentBytes -= MipBytes(victim, victim.residentMip);
+			++victim.residentMip;
+			++m_stats.mipsEvicted;
+		}
+
+		// Budget full, a smaller mip further down the queue may still fit
+		if (m_residentBytes + bytes > m_init.budgetBytes)
+			continue;
+
+		tex.residentMip = nextMip;
+		m_residentBytes += bytes;
+		uploadBytes += bytes;
+		++numUploads;
+		++m_stats.mipsLoaded;
+
+		if (tex.desiredMip < tex.residentMip)
+		{
+			loads.push_back(index);
+			std::push_heap(loads.begin(), loads.end(), lowerPriority);
+		}
+	}
+
+	for (uint32_t i = 0; i < m_textures.size(); ++i)
+	{
+		const StreamingTexture& tex = m_textures[i];
+		if (tex.desiredMip < tex.residentMip)
+		{
+			++m_stats.numPending;
+		}
+		if (tex.residentMip != tex.startMip)
+		{
+			outChanges.push_back({ i, tex.startMip, tex.residentMip });
+		}
+	}
+
+	m_stats.residentBytes = m_residentBytes;
+}
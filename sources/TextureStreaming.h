@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// Mip streaming policy, CPU only (no D3D dependency)
+// Each texture has a resident top mip, everything from that mip down to the tail is in memory.
+// Visible draws request a mip every frame, Update() streams one level at a time within the byte budget
+// and evicts least recently used / over resident textures first.
+// Time is the frame counter, same request sequence always gives the same result.
+
+struct TextureStreamingInit
+{
+	uint64_t budgetBytes = 256ull * 1024 * 1024;
+	uint32_t maxUploadsPerFrame = 16;					// Mip levels streamed in per Update
+	uint64_t maxUploadBytesPerFrame = 32ull * 1024 * 1024;	// Newly resident mips, the owner copies the rest on the GPU
+	float mipBias = 0.f;								// Added to requested mip, positive is lower detail
+};
+
+struct StreamingTextureDesc
+{
+	uint32_t numMips = 1;
+	uint32_t tailMip = 0;			// Lowest detail top mip, always resident
+	uint32_t initialMip = 0;		// Top mip at creation
+	const uint64_t* mipBytes = nullptr;	// numMips entries
+};
+
+// Resident top mip change of one texture, applied by the owner (reallocate resource)
+// Only mips above fromMip are new, levels both chains share are copied from the old resource
+struct StreamingChange
+{
+	uint32_t textureIndex = 0;
+	uint32_t fromMip = 0;
+	uint32_t toMip = 0;
+};
+
+struct TextureStreamingStats
+{
+	uint64_t residentBytes = 0;
+	uint64_t wantedBytes = 0;		// Memory needed to satisfy every request of the frame
+	uint32_t numRequested = 0;		// Textures requested this frame
+	uint32_t numPending = 0;		// Textures below their desired mip after Update
+	uint32_t mipsLoaded = 0;		// Last Update
+	uint32_t mipsEvicted = 0;
+};
+
+class TextureStreamer
+{
+public:
+	void Initialize(const TextureStreamingInit& init);
+	void Shutdown();
+
+	uint32_t AddTexture(const StreamingTextureDesc& desc);
+
+	// Start a new frame, clear requests
+	void BeginFrame();
+
+	// Request mip level for this frame, keeps the most detailed request
+	void RequestMip(uint32_t textureIndex, float mip);
+
+	// Decide loads and evictions, one entry per texture whose resident mip changed
+	void Update(std::vector<StreamingChange>& outChanges);
+
+	// A lower budget is enforced by the next Update, visible textures lose detail last
+	void SetBudget(uint64_t budgetBytes) { m_init.budgetBytes = budgetBytes; }
+	uint64_t Budget() const { return m_init.budgetBytes; }
+
+	uint32_t NumTextures() const { return static_cast<uint32_t>(m_textures.size()); }
+	uint32_t ResidentMip(uint32_t textureIndex) const { return m_textures[textureIndex].residentMip; }
+	uint32_t DesiredMip(uint32_t textureIndex) const { return m_textures[textureIndex].desiredMip; }
+	uint64_t ResidentBytes(uint32_t textureIndex) const;
+
+	const TextureStreamingStats& Stats() const { return m_stats; }
+
+private:
+	struct StreamingTexture
+	{
+		uint32_t numMips = 1;
+		uint32_t tailMip = 0;
+		uint32_t residentMip = 0;
+		uint32_t desiredMip = 0;
+		uint32_t startMip = 0;			// Resident mip at the start of Update
+		uint64_t lastUsedFrame = 0;
+		float requestedMip = 0.f;
+		bool requested = false;
+		uint32_t firstMipByte = 0;		// Offset into m_mipBytes
+	};
+
+	uint64_t MipBytes(const StreamingTexture& tex, uint32_t mip) const { return m_mipBytes[tex.firstMipByte + mip]; }
+	uint64_t BytesFromMip(const StreamingTexture& tex, uint32_t mip) const;
+	bool IsEvictable(const StreamingTexture& tex) const;
+
+	TextureStreamingInit m_init;
+	TextureStreamingStats m_stats;
+
+	std::vector<StreamingTexture> m_textures;
+	std::vector<uint64_t> m_mipBytes;
+	uint64_t m_frameIndex = 0;
+	uint64_t m_residentBytes = 0;
+};
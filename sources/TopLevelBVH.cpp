@@ -0,0 +1,657 @@
+#include "TopLevelBVH.h"
+#include "Utility.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+#include <numeric>
+#include <random>
+
+using namespace DirectX;
+
+static float HalfArea(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax)
+{
+	const float dx = boundsMax.x - boundsMin.x;
+	const float dy = boundsMax.y - boundsMin.y;
+	const float dz = boundsMax.z - boundsMin.z;
+	return dx * dy + dy * dz + dz * dx;
+}
+
+static void GrowBounds(TriangleBVHNode& bounds, const TriangleBVHNode& other)
+{
+	bounds.boundsMin.x = std::min(bounds.boundsMin.x, other.boundsMin.x);
+	bounds.boundsMin.y = std::min(bounds.boundsMin.y, other.boundsMin.y);
+	bounds.boundsMin.z = std::min(bounds.boundsMin.z, other.boundsMin.z);
+	bounds.boundsMax.x = std::max(bounds.boundsMax.x, other.boundsMax.x);
+	bounds.boundsMax.y = std::max(bounds.boundsMax.y, other.boundsMax.y);
+	bounds.boundsMax.z = std::max(bounds.boundsMax.z, other.boundsMax.z);
+}
+
+static void EmptyBounds(TriangleBVHNode& bounds)
+{
+	bounds.boundsMin = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+	bounds.boundsMax = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+}
+
+static float Centroid(const TriangleBVHNode& bounds, int axis)
+{
+	const float* boundsMin = &bounds.boundsMin.x;
+	const float* boundsMax = &bounds.boundsMax.x;
+	return (boundsMin[axis] + boundsMax[axis]) * 0.5f;
+}
+
+// Affine inverse of a row major 3x4, false when the 3x3 part is singular
+static bool InverseTransform(const XMFLOAT3X4& m, XMFLOAT3X4& inverse)
+{
+	const float c00 = m.m[1][1] * m.m[2][2] - m.m[1][2] * m.m[2][1];
+	const float c01 = m.m[1][2] * m.m[2][0] - m.m[1][0] * m.m[2][2];
+	const float c02 = m.m[1][0] * m.m[2][1] - m.m[1][1] * m.m[2][0];
+	const float det = m.m[0][0] * c00 + m.m[0][1] * c01 + m.m[0][2] * c02;
+	if (fabsf(det) < 1e-20f)
+	{
+		return false;
+	}
+
+	const float invDet = 1.f / det;
+	inverse.m[0][0] = c00 * invDet;
+	inverse.m[0][1] = (m.m[0][2] * m.m[2][1] - m.m[0][1] * m.m[2][2]) * invDet;
+	inverse.m[0][2] = (m.m[0][1] * m.m[1][2] - m.m[0][2] * m.m[1][1]) * invDet;
+	inverse.m[1][0] = c01 * invDet;
+	inverse.m[1][1] = (m.m[0][0] * m.m[2][2] - m.m[0][2] * m.m[2][0]) * invDet;
+	inverse.m[1][2] = (m.m[0][2] * m.m[1][0] - m.m[0][0] * m.m[1][2]) * invDet;
+	inverse.m[2][0] = c02 * invDet;
+	inverse.m[2][1] = (m.m[0][1] * m.m[2][0] - m.m[0][0] * m.m[2][1]) * invDet;
+	inverse.m[2][2] = (m.m[0][0] * m.m[1][1] - m.m[0][1] * m.m[1][0]) * invDet;
+	for (int r = 0; r < 3; ++r)
+	{
+		inverse.m[r][3] = -(inverse.m[r][0] * m.m[0][3] + inverse.m[r][1] * m.m[1][3] + inverse.m[r][2] * m.m[2][3]);
+	}
+	return true;
+}
+
+static BVHRay TransformRay(const BVHRay& ray, const XMFLOAT3X4& m)
+{
+	// Direction is not renormalized so t is the same in both spaces
+	const XMFLOAT3& o = ray.origin;
+	const XMFLOAT3& d = ray.direction;
+	BVHRay local = ray;
+	local.origin = XMFLOAT3(
+		m.m[0][0] * o.x + m.m[0][1] * o.y + m.m[0][2] * o.z + m.m[0][3],
+		m.m[1][0] * o.x + m.m[1][1] * o.y + m.m[1][2] * o.z + m.m[1][3],
+		m.m[2][0] * o.x + m.m[2][1] * o.y + m.m[2][2] * o.z + m.m[2][3]);
+	local.direction = XMFLOAT3(
+		m.m[0][0] * d.x + m.m[0][1] * d.y + m.m[0][2] * d.z,
+		m.m[1][0] * d.x + m.m[1][1] * d.y + m.m[1][2] * d.z,
+		m.m[2][0] * d.x + m.m[2][1] * d.y + m.m[2][2] * d.z);
+	return local;
+}
+
+static XMFLOAT3 InverseDirection(const XMFLOAT3& direction)
+{
+	return XMFLOAT3(1.f / direction.x, 1.f / direction.y, 1.f / direction.z);
+}
+
+//
+// Build
+//
+void TopLevelBVH::Clear()
+{
+	m_instances.clear();
+	m_worldToObject.clear();
+	m_instanceBounds.clear();
+	m_nodes.clear();
+	m_instanceOrder.clear();
+	m_movedInstances.clear();
+	m_movedFlags.clear();
+	m_stats = {};
+}
+
+// World box of the BLAS root box, inverse for rays. Singular or empty instances are never hit
+void TopLevelBVH::UpdateInstance(uint32_t instanceIndex)
+{
+	const BVHInstance& instance = m_instances[instanceIndex];
+	TriangleBVHNode& bounds = m_instanceBounds[instanceIndex];
+	EmptyBounds(bounds);
+	if (!instance.blas || instance.blas->IsEmpty() || !InverseTransform(instance.transform, m_worldToObject[instanceIndex]))
+	{
+		return;
+	}
+
+	// Per row, the smaller and larger product of every column (Arvo)
+	const TriangleBVHNode& root = instance.blas->Nodes()[0];
+	const float* localMin = &root.boundsMin.x;
+	const float* localMax = &root.boundsMax.x;
+	float* worldMin = &bounds.boundsMin.x;
+	float* worldMax = &bounds.boundsMax.x;
+	for (int r = 0; r < 3; ++r)
+	{
+		worldMin[r] = worldMax[r] = instance.transform.m[r][3];
+		for (int c = 0; c < 3; ++c)
+		{
+			const float a = instance.transform.m[r][c] * localMin[c];
+			const float b = instance.transform.m[r][c] * localMax[c];
+			worldMin[r] += std::min(a, b);
+			worldMax[r] += std::max(a, b);
+		}
+	}
+}
+
+void TopLevelBVH::Build(const std::vector<BVHInstance>& instances)
+{
+	auto start = TimerClock::now();
+	Clear();
+
+	const uint32_t numInstances = static_cast<uint32_t>(instances.size());
+	if (numInstances == 0)
+	{
+		return;
+	}
+
+	m_instances = instances;
+	m_worldToObject.resize(numInstances);
+	m_instanceBounds.resize(numInstances);
+	m_movedFlags.assign(numInstances, 0);
+	m_instanceOrder.resize(numInstances);
+	std::iota(m_instanceOrder.begin(), m_instanceOrder.end(), 0u);
+
+	TriangleBVHNode root;
+	EmptyBounds(root);
+	for (uint32_t i = 0; i < numInstances; ++i)
+	{
+		UpdateInstance(i);
+		GrowBounds(root, m_instanceBounds[i]);
+		m_stats.numTriangles += instances[i].blas ? instances[i].blas->NumTriangles() : 0;
+	}
+	root.leftFirst = 0;
+	root.numTriangles = numInstances;
+
+	// Children after their parent, Refit relies on it
+	m_nodes.reserve(2 * static_cast<size_t>(numInstances));
+	m_nodes.push_back(root);
+	std::vector<std::pair<uint32_t, uint32_t>> stack = { { 0u, 0u } };
+	while (!stack.empty())
+	{
+		const uint32_t nodeIndex = stack.back().first;
+		const uint32_t depth = stack.back().second;
+		stack.pop_back();
+		m_stats.maxDepth = std::max(m_stats.maxDepth, depth);
+
+		const uint32_t first = m_nodes[nodeIndex].leftFirst;
+		const uint32_t count = m_nodes[nodeIndex].numTriangles;
+		if (count <= MaxLeafSize)
+			continue;
+
+		TriangleBVHNode centroidBounds;
+		EmptyBounds(centroidBounds);
+		for (uint32_t i = first; i < first + count; ++i)
+		{
+			const TriangleBVHNode& bounds = m_instanceBounds[m_instanceOrder[i]];
+			const XMFLOAT3 centroid(Centroid(bounds, 0), Centroid(bounds, 1), Centroid(bounds, 2));
+			TriangleBVHNode point;
+			point.boundsMin = point.boundsMax = centroid;
+			GrowBounds(centroidBounds, point);
+		}
+
+		// Binned SAH on every axis, always split (instance leaves mean a BLAS traversal each)
+		int bestAxis = -1;
+		uint32_t bestBin = 0;
+		float bestCost = FLT_MAX;
+		float binScale[3] = {};
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			const float axisMin = (&centroidBounds.boundsMin.x)[axis];
+			const float extent = (&centroidBounds.boundsMax.x)[axis] - axisMin;
+			if (!(extent > 0.f) || depth >= MaxDepth / 2)
+				continue;
+
+			binScale[axis] = NumBins / extent;
+			uint32_t binCounts[NumBins] = {};
+			TriangleBVHNode binBounds[NumBins];
+			for (TriangleBVHNode& bounds : binBounds)
+			{
+				EmptyBounds(bounds);
+			}
+			for (uint32_t i = first; i < first + count; ++i)
+			{
+				const TriangleBVHNode& bounds = m_instanceBounds[m_instanceOrder[i]];
+				const uint32_t bin = std::min(static_cast<uint32_t>((Centroid(bounds, axis) - axisMin) * binScale[axis]), NumBins - 1);
+				++binCounts[bin];
+				GrowBounds(binBounds[bin], bounds);
+			}
+
+			// Right side swept first, cost of splitting after bin b
+			float rightCosts[NumBins] = {};
+			TriangleBVHNode right;
+			EmptyBounds(right);
+			uint32_t rightCount = 0;
+			for (uint32_t b = NumBins - 1; b > 0; --b)
+			{
+				GrowBounds(right, binBounds[b]);
+				rightCount += binCounts[b];
+				rightCosts[b - 1] = rightCount ? HalfArea(right.boundsMin, right.boundsMax) * rightCount : 0.f;
+			}
+			TriangleBVHNode left;
+			EmptyBounds(left);
+			uint32_t leftCount = 0;
+			for (uint32_t b = 0; b + 1 < NumBins; ++b)
+			{
+				GrowBounds(left, binBounds[b]);
+				leftCount += binCounts[b];
+				if (leftCount == 0 || leftCount == count)
+					continue;
+				const float cost = HalfArea(left.boundsMin, left.boundsMax) * leftCount + rightCosts[b];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestBin = b;
+				}
+			}
+		}
+
+		uint32_t* order = m_instanceOrder.data();
+		uint32_t mid = first + count / 2;
+		if (bestAxis >= 0)
+		{
+			const float axisMin = (&centroidBounds.boundsMin.x)[bestAxis];
+			mid = static_cast<uint32_t>(std::partition(order + first, order + first + count, [&](uint32_t instanceIndex)
+			{
+				const uint32_t bin = std::min(static_cast<uint32_t>((Centroid(m_instanceBounds[instanceIndex], bestAxis) - axisMin) * binScale[bestAxis]), NumBins - 1);
+				return bin <= bestBin;
+			}) - order);
+		}
+		else
+		{
+			// Coincident centroids or too deep, median on the widest axis
+			const TriangleBVHNode& bounds = m_nodes[nodeIndex];
+			const XMFLOAT3 size(bounds.boundsMax.x - bounds.boundsMin.x, bounds.boundsMax.y - bounds.boundsMin.y, bounds.boundsMax.z - bounds.boundsMin.z);
+			const int axis = (size.x >= size.y && size.x >= size.z) ? 0 : (size.y >= size.z) ? 1 : 2;
+			std::nth_element(order + first, order + mid, order + first + count, [&](uint32_t a, uint32_t b)
+			{
+				return Centroid(m_instanceBounds[a], axis) < Centroid(m_instanceBounds[b], axis);
+			});
+		}
+
+		TriangleBVHNode left, right;
+		EmptyBounds(left);
+		EmptyBounds(right);
+		for (uint32_t i = first; i < first + count; ++i)
+		{
+			GrowBounds(i < mid ? left : right, m_instanceBounds[order[i]]);
+		}
+		left.leftFirst = first;
+		left.numTriangles = mid - first;
+		right.leftFirst = mid;
+		right.numTriangles = first + count - mid;
+
+		const uint32_t leftChild = static_cast<uint32_t>(m_nodes.size());
+		m_nodes[nodeIndex].leftFirst = leftChild;
+		m_nodes[nodeIndex].numTriangles = 0;
+		m_nodes.push_back(left);
+		m_nodes.push_back(right);
+		stack.push_back({ leftChild + 1, depth + 1 });
+		stack.push_back({ leftChild, depth + 1 });
+	}
+
+	m_stats.numInstances = numInstances;
+	m_stats.numNodes = static_cast<uint32_t>(m_nodes.size());
+	m_stats.sahCost = ComputeSAHCost();
+	m_stats.buildMs = ElapsedMs(start);
+}
+
+void TopLevelBVH::SetTransform(uint32_t instanceIndex, const XMFLOAT3X4& transform)
+{
+	assert(instanceIndex < m_instances.size());
+	m_instances[instanceIndex].transform = transform;
+	if (!m_movedFlags[instanceIndex])
+	{
+		m_movedFlags[instanceIndex] = 1;
+		m_movedInstances.push_back(instanceIndex);
+	}
+}
+
+void TopLevelBVH::Refit()
+{
+	if (m_movedInstances.empty())
+	{
+		return;
+	}
+
+	auto start = TimerClock::now();
+	for (uint32_t instanceIndex : m_movedInstances)
+	{
+		UpdateInstance(instanceIndex);
+		m_movedFlags[instanceIndex] = 0;
+	}
+	m_movedInstances.clear();
+
+	for (size_t n = m_nodes.size(); n-- > 0; )
+	{
+		TriangleBVHNode& node = m_nodes[n];
+		const uint32_t leftFirst = node.leftFirst;
+		const uint32_t numInstances = node.numTriangles;
+		EmptyBounds(node);
+		if (numInstances > 0)
+		{
+			for (uint32_t i = leftFirst; i < leftFirst + numInstances; ++i)
+			{
+				GrowBounds(node, m_instanceBounds[m_instanceOrder[i]]);
+			}
+		}
+		else
+		{
+			GrowBounds(node, m_nodes[leftFirst]);
+			GrowBounds(node, m_nodes[leftFirst + 1]);
+		}
+	}
+
+	m_stats.sahCost = ComputeSAHCost();
+	m_stats.refitMs = ElapsedMs(start);
+}
+
+// Same cost model as TriangleBVH, an instance costs one
+float TopLevelBVH::ComputeSAHCost() const
+{
+	if (m_nodes.empty())
+	{
+		return 0.f;
+	}
+
+	const float rootArea = HalfArea(m_nodes[0].boundsMin, m_nodes[0].boundsMax);
+	if (rootArea <= 0.f)
+	{
+		return static_cast<float>(m_instances.size());
+	}
+
+	double cost = 0.0;
+	for (const TriangleBVHNode& node : m_nodes)
+	{
+		const double area = HalfArea(node.boundsMin, node.boundsMax);
+		cost += area * (node.IsLeaf() ? node.numTriangles : 1u);
+	}
+	return static_cast<float>(cost / rootArea);
+}
+
+//
+// Traversal
+//
+bool TopLevelBVH::Intersect(const BVHRay& ray, BVHHit& hit, uint32_t inclusionMask) const
+{
+	if (m_nodes.empty())
+	{
+		return false;
+	}
+
+	const XMFLOAT3 invDir = InverseDirection(ray.direction);
+	float tMax = std::min(ray.tMax, hit.t);
+	if (IntersectBVHNode(ray, invDir, m_nodes[0], tMax) == FLT_MAX)
+	{
+		return false;
+	}
+
+	// Near child first, far child skipped once a closer hit is found
+	struct StackEntry
+	{
+		uint32_t nodeIndex;
+		float tEntry;
+	};
+	StackEntry stack[MaxDepth];
+	uint32_t stackSize = 0;
+	uint32_t nodeIndex = 0;
+	bool found = false;
+	while (true)
+	{
+		const TriangleBVHNode& node = m_nodes[nodeIndex];
+		if (node.IsLeaf())
+		{
+			for (uint32_t i = node.leftFirst; i < node.leftFirst + node.numTriangles; ++i)
+			{
+				const uint32_t instanceIndex = m_instanceOrder[i];
+				const BVHInstance& instance = m_instances[instanceIndex];
+				if (!(instance.instanceMask & inclusionMask) || m_instanceBounds[instanceIndex].boundsMin.x > m_instanceBounds[instanceIndex].boundsMax.x)
+					continue;
+
+				BVHRay localRay = TransformRay(ray, m_worldToObject[instanceIndex]);
+				localRay.tMax = tMax;
+				if (instance.blas->Intersect(localRay, hit))
+				{
+					tMax = hit.t;
+					hit.instance = instanceIndex;
+					found = true;
+				}
+			}
+		}
+		else
+		{
+			uint32_t nearChild = node.leftFirst;
+			uint32_t farChild = node.leftFirst + 1;
+			float tNear = IntersectBVHNode(ray, invDir, m_nodes[nearChild], tMax);
+			float tFar = IntersectBVHNode(ray, invDir, m_nodes[farChild], tMax);
+			if (tFar < tNear)
+			{
+				std::swap(nearChild, farChild);
+				std::swap(tNear, tFar);
+			}
+			if (tNear != FLT_MAX)
+			{
+				if (tFar != FLT_MAX)
+				{
+					assert(stackSize < MaxDepth);
+					stack[stackSize++] = { farChild, tFar };
+				}
+				nodeIndex = nearChild;
+				continue;
+			}
+		}
+
+		while (stackSize > 0 && stack[stackSize - 1].tEntry >= tMax)
+		{
+			--stackSize;
+		}
+		if (stackSize == 0)
+			break;
+		nodeIndex = stack[--stackSize].nodeIndex;
+	}
+	return found;
+}
+
+bool TopLevelBVH::Occluded(const BVHRay& ray, uint32_t inclusionMask) const
+{
+	if (m_nodes.empty())
+	{
+		return false;
+	}
+
+	const XMFLOAT3 invDir = InverseDirection(ray.direction);
+	uint32_t stack[MaxDepth];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		const TriangleBVHNode& node = m_nodes[stack[--stackSize]];
+		if (IntersectBVHNode(ray, invDir, node, ray.tMax) == FLT_MAX)
+			continue;
+
+		if (node.IsLeaf())
+		{
+			for (uint32_t i = node.leftFirst; i < node.leftFirst + node.numTriangles; ++i)
+			{
+				const uint32_t instanceIndex = m_instanceOrder[i];
+				const BVHInstance& instance = m_instances[instanceIndex];
+				if (!(instance.instanceMask & inclusionMask) || m_instanceBounds[instanceIndex].boundsMin.x > m_instanceBounds[instanceIndex].boundsMax.x)
+					continue;
+				if (instance.blas->Occluded(TransformRay(ray, m_worldToObject[instanceIndex])))
+					return true;
+			}
+			continue;
+		}
+
+		assert(stackSize + 2 <= MaxDepth);
+		stack[stackSize++] = node.leftFirst + 1;
+		stack[stackSize++] = node.leftFirst;
+	}
+	return false;
+}
+
+//
+// Benchmark
+//
+static XMFLOAT3X4 MakeInstanceTransform(float scale, float yaw, const XMFLOAT3& position)
+{
+	XMFLOAT3X4 m;
+	const float c = cosf(yaw) * scale;
+	const float s = sinf(yaw) * scale;
+	m.m[0][0] = c;   m.m[0][1] = 0.f;   m.m[0][2] = s;   m.m[0][3] = position.x;
+	m.m[1][0] = 0.f; m.m[1][1] = scale; m.m[1][2] = 0.f; m.m[1][3] = position.y;
+	m.m[2][0] = -s;  m.m[2][1] = 0.f;   m.m[2][2] = c;   m.m[2][3] = position.z;
+	return m;
+}
+
+void RunTopLevelBVHBenchmark(JobSystem& jobs, uint32_t numInstances, TopLevelBVHBenchmarkResult& outResult)
+{
+	outResult = {};
+	outResult.numInstances = numInstances;
+	outResult.numThreads = jobs.NumThreads();
+
+	// A few BLAS shared by every instance, the benchmark mesh spans about 200 units
+	const uint32_t blasSizes[] = { 2000, 8000, 20000 };
+	const uint32_t numBlas = 3;
+	std::vector<XMFLOAT3> blasPositions[numBlas];
+	std::vector<uint32_t> blasIndices[numBlas];
+	TriangleBVH blas[numBlas];
+	for (uint32_t b = 0; b < numBlas; ++b)
+	{
+		MakeBenchmarkMesh(blasSizes[b], blasPositions[b], blasIndices[b]);
+		TriangleMesh mesh;
+		mesh.positions = blasPositions[b].data();
+		mesh.indices = blasIndices[b].data();
+		mesh.numTriangles = blasSizes[b];
+		blas[b].BuildSAH(jobs, mesh);
+		outResult.numBlasTriangles += blasSizes[b];
+	}
+
+	// Square grid over the same area as the other benchmarks
+	std::mt19937 rng(2468);
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+	const uint32_t gridSize = std::max(1u, static_cast<uint32_t>(ceilf(sqrtf(static_cast<float>(numInstances)))));
+	const float spacing = 200.f / gridSize;
+	std::vector<BVHInstance> instances(numInstances);
+	for (uint32_t i = 0; i < numInstances; ++i)
+	{
+		const XMFLOAT3 position(spacing * (i % gridSize + 0.5f) - 100.f, 10.f * unit(rng), spacing * (i / gridSize + 0.5f) - 100.f);
+		instances[i].transform = MakeInstanceTransform(spacing * (0.002f + 0.002f * unit(rng)), XM_2PI * unit(rng), position);
+		instances[i].instanceID = i;
+		instances[i].blas = &blas[i % numBlas];
+	}
+
+	TopLevelBVH tlas;
+	auto start = TimerClock::now();
+	tlas.Build(instances);
+	outResult.buildMs = ElapsedMs(start);
+	outResult.numTriangles = tlas.Stats().numTriangles;
+	outResult.builtSahCost = tlas.Stats().sahCost;
+
+	// Every instance bobs and turns a little, as animated props would
+	for (uint32_t i = 0; i < numInstances; ++i)
+	{
+		XMFLOAT3X4 transform = instances[i].transform;
+		transform.m[1][3] += 2.f * (unit(rng) - 0.5f);
+		const float yaw = 0.2f * (unit(rng) - 0.5f);
+		for (int r = 0; r < 3; r += 2)
+		{
+			const float x = transform.m[r][0], z = transform.m[r][2];
+			transform.m[r][0] = x * cosf(yaw) + z * sinf(yaw);
+			transform.m[r][2] = z * cosf(yaw) - x * sinf(yaw);
+		}
+		instances[i].transform = transform;
+		tlas.SetTransform(i, transform);
+	}
+	tlas.Refit();
+	outResult.refitMs = tlas.Stats().refitMs;
+	outResult.refitSahCost = tlas.Stats().sahCost;
+
+	// Same scene flattened to world space
+	std::vector<XMFLOAT3> positions;
+	std::vector<uint32_t> indices;
+	std::vector<uint32_t> triangleInstances;
+	for (uint32_t i = 0; i < numInstances; ++i)
+	{
+		const uint32_t b = i % numBlas;
+		const XMFLOAT3X4& m = instances[i].transform;
+		const uint32_t firstVertex = static_cast<uint32_t>(positions.size());
+		for (const XMFLOAT3& p : blasPositions[b])
+		{
+			positions.push_back(XMFLOAT3(
+				m.m[0][0] * p.x + m.m[0][1] * p.y + m.m[0][2] * p.z + m.m[0][3],
+				m.m[1][0] * p.x + m.m[1][1] * p.y + m.m[1][2] * p.z + m.m[1][3],
+				m.m[2][0] * p.x + m.m[2][1] * p.y + m.m[2][2] * p.z + m.m[2][3]));
+		}
+		for (uint32_t index : blasIndices[b])
+		{
+			indices.push_back(firstVertex + index);
+		}
+		triangleInstances.resize(indices.size() / 3, i);
+	}
+	TriangleMesh flattenedMesh;
+	flattenedMesh.positions = positions.data();
+	flattenedMesh.indices = indices.data();
+	flattenedMesh.numTriangles = static_cast<uint32_t>(indices.size() / 3);
+	TriangleBVH flattened;
+	start = TimerClock::now();
+	flattened.BuildSAH(jobs, flattenedMesh);
+	outResult.flattenedBuildMs = ElapsedMs(start);
+
+	// Rays from above the instances in every direction
+	const uint32_t numRays = 1 << 18;
+	std::vector<BVHRay> rays(numRays);
+	for (BVHRay& ray : rays)
+	{
+		ray.origin = XMFLOAT3(180.f * (unit(rng) - 0.5f), 5.f + 20.f * unit(rng), 180.f * (unit(rng) - 0.5f));
+		const float z = 2.f * unit(rng) - 1.f;
+		const float phi = XM_2PI * unit(rng);
+		const float r = sqrtf(std::max(0.f, 1.f - z * z));
+		ray.direction = XMFLOAT3(r * cosf(phi), z, r * sinf(phi));
+	}
+
+	std::vector<BVHHit> instancedHits(numRays), flattenedHits(numRays);
+	start = TimerClock::now();
+	jobs.ParallelFor(numRays, 1024, [&](uint32_t begin, uint32_t end, uint32_t)
+	{
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			tlas.Intersect(rays[i], instancedHits[i]);
+		}
+	});
+	const double instancedMs = ElapsedMs(start);
+	start = TimerClock::now();
+	jobs.ParallelFor(numRays, 1024, [&](uint32_t begin, uint32_t end, uint32_t)
+	{
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			flattened.Intersect(rays[i], flattenedHits[i]);
+		}
+	});
+	const double flattenedMs = ElapsedMs(start);
+	outResult.instancedRaysPerSecond = (instancedMs > 0.0) ? numRays / (instancedMs * 1e-3) : 0.0;
+	outResult.flattenedRaysPerSecond = (flattenedMs > 0.0) ? numRays / (flattenedMs * 1e-3) : 0.0;
+
+	// Rays are transformed instead of vertices, distances only agree to rounding and rays grazing an
+	// edge can miss on one side. Instances don't overlap, the hit one has to match
+	for (uint32_t i = 0; i < numRays; ++i)
+	{
+		const BVHHit& a = instancedHits[i];
+		const BVHHit& b = flattenedHits[i];
+		if (a.IsHit() != b.IsHit())
+		{
+			++outResult.numMismatches;
+		}
+		else if (a.IsHit() && (fabsf(a.t - b.t) > 1e-3f * std::max(1.f, b.t) || a.instance != triangleInstances[b.triangle]))
+		{
+			++outResult.numMismatches;
+		}
+		if (a.IsHit() != tlas.Occluded(rays[i]))
+		{
+			++outResult.numMismatches;
+		}
+	}
+}
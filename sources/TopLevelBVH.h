@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <DirectXMath.h>
+#include "TriangleBVH.h"
+
+// CPU top level BVH over instances of triangle BVHs, the CPU side of the DXR TLAS/BLAS split
+// Instances keep their transform, rays are moved into instance space so geometry is never flattened.
+// Moving instances refits the tree in O(n), changing the set of instances rebuilds it.
+
+// Same fields as D3D12_RAYTRACING_INSTANCE_DESC, BLAS address replaced by a pointer
+struct BVHInstance
+{
+	DirectX::XMFLOAT3X4 transform;		// Object to world, row major 3x4 like the instance desc
+	uint32_t instanceID = 0;			// InstanceID(), free for the caller
+	uint32_t instanceMask = 0xFF;		// ANDed with the ray's inclusion mask
+	const TriangleBVH* blas = nullptr;	// Must outlive the TLAS, refit or rebuild after it changes
+};
+
+struct TopLevelBVHStats
+{
+	uint32_t numInstances = 0;
+	uint32_t numNodes = 0;
+	uint32_t maxDepth = 0;
+	uint64_t numTriangles = 0;	// Summed over instances
+	double buildMs = 0.0;
+	double refitMs = 0.0;		// Last refit
+	float sahCost = 0.f;		// Over the instance boxes
+};
+
+class TopLevelBVH
+{
+public:
+	static const uint32_t NumBins = 16;
+	static const uint32_t MaxLeafSize = 2;
+	static const uint32_t MaxDepth = 64;
+
+	// Instance set changed, serial binned SAH over the world boxes (instance counts are small)
+	void Build(const std::vector<BVHInstance>& instances);
+	void Clear();
+
+	// Only marks the instance, bounds are refit together by Refit
+	void SetTransform(uint32_t instanceIndex, const DirectX::XMFLOAT3X4& transform);
+
+	// World boxes of moved instances then every node bottom up, nothing to do when none moved
+	// Tree topology is kept, call Build when instances moved far enough to hurt traversal
+	void Refit();
+
+	// Closest hit over instances with (instanceMask & inclusionMask) != 0, hit.instance is the index in the
+	// instance array. Barycentrics, triangle and facing are those of the BLAS (facing in object space)
+	bool Intersect(const BVHRay& ray, BVHHit& hit, uint32_t inclusionMask = 0xFF) const;
+	bool Occluded(const BVHRay& ray, uint32_t inclusionMask = 0xFF) const;
+
+	bool IsEmpty() const { return m_nodes.empty(); }
+	bool NeedsRefit() const { return !m_movedInstances.empty(); }
+	uint32_t NumInstances() const { return static_cast<uint32_t>(m_instances.size()); }
+	const BVHInstance& Instance(uint32_t instanceIndex) const { return m_instances[instanceIndex]; }
+	const TopLevelBVHStats& Stats() const { return m_stats; }
+
+private:
+	void UpdateInstance(uint32_t instanceIndex);
+	float ComputeSAHCost() const;
+
+	std::vector<BVHInstance> m_instances;
+	std::vector<DirectX::XMFLOAT3X4> m_worldToObject;
+	std::vector<TriangleBVHNode> m_instanceBounds;	// World box, only bounds are used
+	std::vector<TriangleBVHNode> m_nodes;			// numTriangles counts instances in leaves
+	std::vector<uint32_t> m_instanceOrder;			// Instance of every leaf slot
+	std::vector<uint32_t> m_movedInstances;
+	std::vector<uint8_t> m_movedFlags;
+	TopLevelBVHStats m_stats;
+};
+
+struct TopLevelBVHBenchmarkResult
+{
+	uint32_t numInstances = 0;
+	uint32_t numThreads = 0;
+	uint64_t numTriangles = 0;		// Instanced, the flattened mesh has as many
+	uint32_t numBlasTriangles = 0;	// Stored once per BLAS
+	double buildMs = 0.0;
+	double refitMs = 0.0;			// Every instance moved
+	double flattenedBuildMs = 0.0;	// SAH over all the triangles in world space
+	double instancedRaysPerSecond = 0.0;
+	double flattenedRaysPerSecond = 0.0;
+	float builtSahCost = 0.f;		// TLAS
+	float refitSahCost = 0.f;
+	uint32_t numMismatches = 0;		// Instanced closest hits against flattened, relative tolerance
+};
+
+// Grid of rotated and scaled instances of a few benchmark meshes, refit after moving all of them,
+// then the same rays through the TLAS and a flattened triangle BVH of the whole scene
+void RunTopLevelBVHBenchmark(JobSystem& jobs, uint32_t numInstances, TopLevelBVHBenchmarkResult& outResult);
@@ -0,0 +1,1166 @@
+#include "TriangleBVH.h"
+#include "RadixSort.h"
+#include "Utility.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+#include <random>
+
+using namespace DirectX;
+
+namespace
+{
+	struct PrimRef
+	{
+		XMFLOAT3 boundsMin;
+		uint32_t index;
+		XMFLOAT3 boundsMax;
+		uint32_t pad;
+	};
+
+	struct BuildTask
+	{
+		uint32_t nodeIndex;
+		uint32_t depth;
+		XMFLOAT3 centroidMin;
+		XMFLOAT3 centroidMax;
+	};
+
+	const uint32_t NumBins = TriangleBVH::NumBins;
+
+	// All three axes binned at once, merged across threads
+	struct SahBins
+	{
+		uint32_t count[3][NumBins];
+		XMFLOAT3 boundsMin[3][NumBins];
+		XMFLOAT3 boundsMax[3][NumBins];
+	};
+}
+
+static float HalfArea(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax)
+{
+	const float dx = boundsMax.x - boundsMin.x;
+	const float dy = boundsMax.y - boundsMin.y;
+	const float dz = boundsMax.z - boundsMin.z;
+	return dx * dy + dy * dz + dz * dx;
+}
+
+static void GrowBounds(XMFLOAT3& boundsMin, XMFLOAT3& boundsMax, const XMFLOAT3& pointMin, const XMFLOAT3& pointMax)
+{
+	boundsMin.x = std::min(boundsMin.x, pointMin.x);
+	boundsMin.y = std::min(boundsMin.y, pointMin.y);
+	boundsMin.z = std::min(boundsMin.z, pointMin.z);
+	boundsMax.x = std::max(boundsMax.x, pointMax.x);
+	boundsMax.y = std::max(boundsMax.y, pointMax.y);
+	boundsMax.z = std::max(boundsMax.z, pointMax.z);
+}
+
+static void EmptyBounds(XMFLOAT3& boundsMin, XMFLOAT3& boundsMax)
+{
+	boundsMin = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+	boundsMax = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+}
+
+static float GetAxis(const XMFLOAT3& v, int axis)
+{
+	return (axis == 0) ? v.x : (axis == 1) ? v.y : v.z;
+}
+
+static XMFLOAT3 Centroid(const PrimRef& prim)
+{
+	return XMFLOAT3(
+		(prim.boundsMin.x + prim.boundsMax.x) * 0.5f,
+		(prim.boundsMin.y + prim.boundsMax.y) * 0.5f,
+		(prim.boundsMin.z + prim.boundsMax.z) * 0.5f);
+}
+
+static XMFLOAT3 Sub(const XMFLOAT3& a, const XMFLOAT3& b) { return XMFLOAT3(a.x - b.x, a.y - b.y, a.z - b.z); }
+static XMFLOAT3 Cross(const XMFLOAT3& a, const XMFLOAT3& b) { return XMFLOAT3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x); }
+static float Dot(const XMFLOAT3& a, const XMFLOAT3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+//
+// Build
+//
+static void ResetBins(SahBins& bins)
+{
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		for (uint32_t b = 0; b < NumBins; ++b)
+		{
+			bins.count[axis][b] = 0;
+			EmptyBounds(bins.boundsMin[axis][b], bins.boundsMax[axis][b]);
+		}
+	}
+}
+
+static void BinRange(const PrimRef* prims, uint32_t first, uint32_t last, const float* axisMin, const float* scale, SahBins& bins)
+{
+	for (uint32_t i = first; i < last; ++i)
+	{
+		const PrimRef& prim = prims[i];
+		const XMFLOAT3 centroid = Centroid(prim);
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			const uint32_t b = std::min(static_cast<uint32_t>((GetAxis(centroid, axis) - axisMin[axis]) * scale[axis]), NumBins - 1);
+			++bins.count[axis][b];
+			GrowBounds(bins.boundsMin[axis][b], bins.boundsMax[axis][b], prim.boundsMin, prim.boundsMax);
+		}
+	}
+}
+
+// Min and max are exact, parallel binning finds the same split as serial
+static void MergeBins(SahBins& bins, const SahBins& other)
+{
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		for (uint32_t b = 0; b < NumBins; ++b)
+		{
+			bins.count[axis][b] += other.count[axis][b];
+			GrowBounds(bins.boundsMin[axis][b], bins.boundsMax[axis][b], other.boundsMin[axis][b], other.boundsMax[axis][b]);
+		}
+	}
+}
+
+// Subdivides the node in place, false when it stays a leaf. jobs bins large ranges in parallel
+static bool SplitNode(JobSystem* jobs, PrimRef* prims, const BuildTask& task, TriangleBVHNode& node,
+	TriangleBVHNode& left, TriangleBVHNode& right, BuildTask& leftTask, BuildTask& rightTask)
+{
+	const uint32_t first = node.leftFirst;
+	const uint32_t count = node.numTriangles;
+	const uint32_t last = first + count;
+	if (count <= 1)
+	{
+		return false;
+	}
+
+	float axisMin[3], scale[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		axisMin[axis] = GetAxis(task.centroidMin, axis);
+		const float extent = GetAxis(task.centroidMax, axis) - axisMin[axis];
+		scale[axis] = (extent > 0.f) ? NumBins / extent : 0.f;
+	}
+
+	// Deep nodes split at the median, bounds the traversal stack
+	int bestAxis = -1;
+	uint32_t bestSplit = 0;
+	float bestCost = FLT_MAX;
+	if (task.depth + 1 < TriangleBVH::MaxDepth / 2)
+	{
+		SahBins bins;
+		ResetBins(bins);
+		if (jobs != nullptr && count >= TriangleBVH::ParallelBuildThreshold && jobs->NumThreads() > 1)
+		{
+			std::vector<SahBins> threadBins(jobs->NumThreads());
+			for (SahBins& threadBin : threadBins)
+			{
+				ResetBins(threadBin);
+			}
+			jobs->ParallelFor(count, 4096, [&](uint32_t begin, uint32_t end, uint32_t threadIndex)
+			{
+				BinRange(prims, first + begin, first + end, axisMin, scale, threadBins[threadIndex]);
+			});
+			for (const SahBins& threadBin : threadBins)
+			{
+				MergeBins(bins, threadBin);
+			}
+		}
+		else
+		{
+			BinRange(prims, first, last, axisMin, scale, bins);
+		}
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			if (scale[axis] == 0.f)
+				continue;
+
+			// Sweep from both sides, split s puts bins [0, s] on the left
+			float leftArea[NumBins - 1], rightArea[NumBins - 1];
+			uint32_t leftCount[NumBins - 1], rightCount[NumBins - 1];
+			XMFLOAT3 sweepMin, sweepMax;
+			EmptyBounds(sweepMin, sweepMax);
+			uint32_t sum = 0;
+			for (uint32_t s = 0; s < NumBins - 1; ++s)
+			{
+				sum += bins.count[axis][s];
+				if (bins.count[axis][s] > 0)
+					GrowBounds(sweepMin, sweepMax, bins.boundsMin[axis][s], bins.boundsMax[axis][s]);
+				leftCount[s] = sum;
+				leftArea[s] = (sum > 0) ? HalfArea(sweepMin, sweepMax) : 0.f;
+			}
+			EmptyBounds(sweepMin, sweepMax);
+			sum = 0;
+			for (uint32_t s = NumBins - 1; s > 0; --s)
+			{
+				sum += bins.count[axis][s];
+				if (bins.count[axis][s] > 0)
+					GrowBounds(sweepMin, sweepMax, bins.boundsMin[axis][s], bins.boundsMax[axis][s]);
+				rightCount[s - 1] = sum;
+				rightArea[s - 1] = (sum > 0) ? HalfArea(sweepMin, sweepMax) : 0.f;
+			}
+
+			for (uint32_t s = 0; s < NumBins - 1; ++s)
+			{
+				if (leftCount[s] == 0 || rightCount[s] == 0)
+					continue;
+
+				const float cost = leftCount[s] * leftArea[s] + rightCount[s] * rightArea[s];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = s;
+				}
+			}
+		}
+
+		// Leaf cost count, split cost one step plus children weighted by area
+		const float nodeArea = HalfArea(node.boundsMin, node.boundsMax);
+		const float splitCost = (nodeArea > 0.f) ? 1.f + bestCost / nodeArea : FLT_MAX;
+		if (count <= TriangleBVH::MaxLeafSize && (bestAxis < 0 || splitCost >= static_cast<float>(count)))
+		{
+			return false;
+		}
+	}
+	else if (count <= TriangleBVH::MaxLeafSize)
+	{
+		return false;
+	}
+
+	EmptyBounds(left.boundsMin, left.boundsMax);
+	EmptyBounds(right.boundsMin, right.boundsMax);
+	EmptyBounds(leftTask.centroidMin, leftTask.centroidMax);
+	EmptyBounds(rightTask.centroidMin, rightTask.centroidMax);
+
+	// Partition in place, children bounds are grown while elements are visited
+	uint32_t mid = first;
+	if (bestAxis >= 0)
+	{
+		uint32_t end = last;
+		while (mid < end)
+		{
+			const PrimRef& prim = prims[mid];
+			const XMFLOAT3 centroid = Centroid(prim);
+			const uint32_t b = std::min(static_cast<uint32_t>((GetAxis(centroid, bestAxis) - axisMin[bestAxis]) * scale[bestAxis]), NumBins - 1);
+			if (b <= bestSplit)
+			{
+				GrowBounds(left.boundsMin, left.boundsMax, prim.boundsMin, prim.boundsMax);
+				GrowBounds(leftTask.centroidMin, leftTask.centroidMax, centroid, centroid);
+				++mid;
+			}
+			else
+			{
+				GrowBounds(right.boundsMin, right.boundsMax, prim.boundsMin, prim.boundsMax);
+				GrowBounds(rightTask.centroidMin, rightTask.centroidMax, centroid, centroid);
+				std::swap(prims[mid], prims[--end]);
+			}
+		}
+	}
+
+	// Coincident centroids or too deep, halves by index
+	if (mid == first || mid == last)
+	{
+		mid = first + count / 2;
+		EmptyBounds(left.boundsMin, left.boundsMax);
+		EmptyBounds(right.boundsMin, right.boundsMax);
+		EmptyBounds(leftTask.centroidMin, leftTask.centroidMax);
+		EmptyBounds(rightTask.centroidMin, rightTask.centroidMax);
+		for (uint32_t i = first; i < last; ++i)
+		{
+			const XMFLOAT3 centroid = Centroid(prims[i]);
+			TriangleBVHNode& child = (i < mid) ? left : right;
+			BuildTask& childTask = (i < mid) ? leftTask : rightTask;
+			GrowBounds(child.boundsMin, child.boundsMax, prims[i].boundsMin, prims[i].boundsMax);
+			GrowBounds(childTask.centroidMin, childTask.centroidMax, centroid, centroid);
+		}
+	}
+
+	left.leftFirst = first;
+	left.numTriangles = mid - first;
+	right.leftFirst = mid;
+	right.numTriangles = last - mid;
+	leftTask.depth = rightTask.depth = task.depth + 1;
+	return true;
+}
+
+// Subdivides the node, false when it stays a leaf. jobs is only given to splits on the calling thread
+using SplitFunc = bool(*)(void* context, JobSystem* jobs, const BuildTask& task, TriangleBVHNode& node,
+	TriangleBVHNode& left, TriangleBVHNode& right, BuildTask& leftTask, BuildTask& rightTask);
+
+// Serial, nodes[0] is the subtree root, children are appended
+static void BuildSubtree(SplitFunc split, void* context, const BuildTask& rootTask, std::vector<TriangleBVHNode>& nodes)
+{
+	std::vector<BuildTask> stack;
+	BuildTask task = rootTask;
+	task.nodeIndex = 0;
+	stack.push_back(task);
+	while (!stack.empty())
+	{
+		task = stack.back();
+		stack.pop_back();
+
+		TriangleBVHNode left, right;
+		BuildTask leftTask, rightTask;
+		if (!split(context, nullptr, task, nodes[task.nodeIndex], left, right, leftTask, rightTask))
+			continue;
+
+		const uint32_t leftChild = static_cast<uint32_t>(nodes.size());
+		nodes[task.nodeIndex].leftFirst = leftChild;
+		nodes[task.nodeIndex].numTriangles = 0;
+		leftTask.nodeIndex = leftChild;
+		rightTask.nodeIndex = leftChild + 1;
+		nodes.push_back(left);
+		nodes.push_back(right);
+		stack.push_back(rightTask);
+		stack.push_back(leftTask);
+	}
+}
+
+// Nodes above ParallelBuildThreshold triangles split on the calling thread, the subtrees below it are
+// built in parallel and appended. Done at any thread count so the tree doesn't depend on it
+static void BuildTopDown(JobSystem& jobs, SplitFunc split, void* context, const TriangleBVHNode& root, const BuildTask& rootTask, std::vector<TriangleBVHNode>& nodes)
+{
+	// At most 2n - 1 nodes
+	nodes.clear();
+	nodes.reserve(2 * static_cast<size_t>(root.numTriangles));
+	nodes.push_back(root);
+
+	std::vector<BuildTask> subtrees;
+	std::vector<BuildTask> stack = { rootTask };
+	while (!stack.empty())
+	{
+		const BuildTask task = stack.back();
+		stack.pop_back();
+		if (nodes[task.nodeIndex].numTriangles < TriangleBVH::ParallelBuildThreshold)
+		{
+			subtrees.push_back(task);
+			continue;
+		}
+
+		TriangleBVHNode left, right;
+		BuildTask leftTask, rightTask;
+		if (!split(context, &jobs, task, nodes[task.nodeIndex], left, right, leftTask, rightTask))
+			continue;
+
+		const uint32_t leftChild = static_cast<uint32_t>(nodes.size());
+		nodes[task.nodeIndex].leftFirst = leftChild;
+		nodes[task.nodeIndex].numTriangles = 0;
+		leftTask.nodeIndex = leftChild;
+		rightTask.nodeIndex = leftChild + 1;
+		nodes.push_back(left);
+		nodes.push_back(right);
+		stack.push_back(rightTask);
+		stack.push_back(leftTask);
+	}
+
+	// Subtrees own disjoint triangle ranges, largest first for balance
+	std::stable_sort(subtrees.begin(), subtrees.end(), [&](const BuildTask& a, const BuildTask& b)
+	{
+		return nodes[a.nodeIndex].numTriangles > nodes[b.nodeIndex].numTriangles;
+	});
+	std::vector<std::vector<TriangleBVHNode>> subtreeNodes(subtrees.size());
+	jobs.ParallelFor(static_cast<uint32_t>(subtrees.size()), 1, [&](uint32_t begin, uint32_t end, uint32_t)
+	{
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			std::vector<TriangleBVHNode>& local = subtreeNodes[i];
+			local.reserve(2 * static_cast<size_t>(nodes[subtrees[i].nodeIndex].numTriangles));
+			local.push_back(nodes[subtrees[i].nodeIndex]);
+			BuildSubtree(split, context, subtrees[i], local);
+		}
+	});
+
+	// Append in task order, local node i > 0 moves to base + i - 1, children stay after parents
+	for (size_t i = 0; i < subtrees.size(); ++i)
+	{
+		const std::vector<TriangleBVHNode>& local = subtreeNodes[i];
+		const uint32_t base = static_cast<uint32_t>(nodes.size());
+		auto remap = [base](TriangleBVHNode node)
+		{
+			if (!node.IsLeaf())
+				node.leftFirst = base + node.leftFirst - 1;
+			return node;
+		};
+		nodes[subtrees[i].nodeIndex] = remap(local[0]);
+		for (size_t n = 1; n < local.size(); ++n)
+		{
+			nodes.push_back(remap(local[n]));
+		}
+	}
+}
+
+void TriangleBVH::Clear()
+{
+	m_nodes.clear();
+	m_triangles.clear();
+	m_triIndices.clear();
+	m_stats = {};
+}
+
+void TriangleBVH::Build(JobSystem& jobs, const TriangleMesh& mesh, TriangleBVHBuilder builder)
+{
+	if (builder == TriangleBVHBuilder::LBVH)
+	{
+		BuildLBVH(jobs, mesh);
+		return;
+	}
+	BuildSAH(jobs, mesh);
+}
+
+void TriangleBVH::BuildSAH(JobSystem& jobs, const TriangleMesh& mesh)
+{
+	auto start = TimerClock::now();
+	Clear();
+	m_builder = TriangleBVHBuilder::SAH;
+
+	const uint32_t numTriangles = mesh.numTriangles;
+	if (numTriangles == 0)
+	{
+		return;
+	}
+
+	// Triangle boxes, root bounds reduced per thread
+	std::vector<PrimRef> prims(numTriangles);
+	const uint32_t numThreads = jobs.NumThreads();
+	std::vector<TriangleBVHNode> threadBounds(numThreads);
+	std::vector<BuildTask> threadCentroids(numThreads);
+	for (uint32_t t = 0; t < numThreads; ++t)
+	{
+		EmptyBounds(threadBounds[t].boundsMin, threadBounds[t].boundsMax);
+		EmptyBounds(threadCentroids[t].centroidMin, threadCentroids[t].centroidMax);
+	}
+	jobs.ParallelFor(numTriangles, 4096, [&](uint32_t begin, uint32_t end, uint32_t threadIndex)
+	{
+		TriangleBVHNode& bounds = threadBounds[threadIndex];
+		BuildTask& centroids = threadCentroids[threadIndex];
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			const XMFLOAT3& v0 = mesh.Vertex(mesh.indices[i * 3 + 0]);
+			const XMFLOAT3& v1 = mesh.Vertex(mesh.indices[i * 3 + 1]);
+			const XMFLOAT3& v2 = mesh.Vertex(mesh.indices[i * 3 + 2]);
+
+			PrimRef& prim = prims[i];
+			prim.index = i;
+			prim.pad = 0;
+			prim.boundsMin = prim.boundsMax = v0;
+			GrowBounds(prim.boundsMin, prim.boundsMax, v1, v1);
+			GrowBounds(prim.boundsMin, prim.boundsMax, v2, v2);
+
+			const XMFLOAT3 centroid = Centroid(prim);
+			GrowBounds(bounds.boundsMin, bounds.boundsMax, prim.boundsMin, prim.boundsMax);
+			GrowBounds(centroids.centroidMin, centroids.centroidMax, centroid, centroid);
+		}
+	});
+
+	TriangleBVHNode root;
+	BuildTask rootTask = {};
+	EmptyBounds(root.boundsMin, root.boundsMax);
+	EmptyBounds(rootTask.centroidMin, rootTask.centroidMax);
+	for (uint32_t t = 0; t < numThreads; ++t)
+	{
+		GrowBounds(root.boundsMin, root.boundsMax, threadBounds[t].boundsMin, threadBounds[t].boundsMax);
+		GrowBounds(rootTask.centroidMin, rootTask.centroidMax, threadCentroids[t].centroidMin, threadCentroids[t].centroidMax);
+	}
+	root.leftFirst = 0;
+	root.numTriangles = numTriangles;
+
+	auto split = [](void* context, JobSystem* splitJobs, const BuildTask& task, TriangleBVHNode& node,
+		TriangleBVHNode& left, TriangleBVHNode& right, BuildTask& leftTask, BuildTask& rightTask)
+	{
+		return SplitNode(splitJobs, static_cast<PrimRef*>(context), task, node, left, right, leftTask, rightTask);
+	};
+	BuildTopDown(jobs, split, prims.data(), root, rootTask, m_nodes);
+
+	m_triIndices.resize(numTriangles);
+	for (uint32_t i = 0; i < numTriangles; ++i)
+	{
+		m_triIndices[i] = prims[i].index;
+	}
+	GatherTriangles(jobs, mesh);
+
+	UpdateStats();
+	m_stats.buildMs = ElapsedMs(start);
+}
+
+//
+// LBVH
+//
+
+// 10 bits per axis interleaved, x highest
+static uint32_t ExpandBits(uint32_t v)
+{
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+static uint32_t MortonCode(const XMFLOAT3& position, const XMFLOAT3& boundsMin, const XMFLOAT3& scale)
+{
+	const uint32_t x = static_cast<uint32_t>(std::min(std::max((position.x - boundsMin.x) * scale.x, 0.f), 1023.f));
+	const uint32_t y = static_cast<uint32_t>(std::min(std::max((position.y - boundsMin.y) * scale.y, 0.f), 1023.f));
+	const uint32_t z = static_cast<uint32_t>(std::min(std::max((position.z - boundsMin.z) * scale.z, 0.f), 1023.f));
+	return (ExpandBits(x) << 2) | (ExpandBits(y) << 1) | ExpandBits(z);
+}
+
+// Codes sorted, the range splits where its highest differing bit flips. Bounds come from the refit
+static bool SplitMorton(void* context, JobSystem*, const BuildTask& task, TriangleBVHNode& node,
+	TriangleBVHNode& left, TriangleBVHNode& right, BuildTask& leftTask, BuildTask& rightTask)
+{
+	const uint64_t* keys = static_cast<const uint64_t*>(context);
+	const uint32_t first = node.leftFirst;
+	const uint32_t count = node.numTriangles;
+	if (count <= TriangleBVH::LBVHLeafSize)
+	{
+		return false;
+	}
+
+	const uint32_t firstCode = static_cast<uint32_t>(keys[first] >> 32);
+	const uint32_t lastCode = static_cast<uint32_t>(keys[first + count - 1] >> 32);
+	uint32_t mid = first + count / 2;
+	if (firstCode != lastCode)
+	{
+		uint32_t highestBit = firstCode ^ lastCode;
+		while (highestBit & (highestBit - 1))
+		{
+			highestBit &= highestBit - 1;
+		}
+		mid = static_cast<uint32_t>(std::partition_point(keys + first, keys + first + count, [highestBit](uint64_t key)
+		{
+			return ((key >> 32) & highestBit) == 0;
+		}) - keys);
+	}
+
+	left.leftFirst = first;
+	left.numTriangles = mid - first;
+	right.leftFirst = mid;
+	right.numTriangles = first + count - mid;
+	leftTask.depth = rightTask.depth = task.depth + 1;
+	return true;
+}
+
+void TriangleBVH::BuildLBVH(JobSystem& jobs, const TriangleMesh& mesh)
+{
+	auto start = TimerClock::now();
+	Clear();
+	m_builder = TriangleBVHBuilder::LBVH;
+
+	const uint32_t numTriangles = mesh.numTriangles;
+	if (numTriangles == 0)
+	{
+		return;
+	}
+
+	// Centroid bounds reduced per thread
+	auto triangleCentroid = [&mesh](uint32_t triangle)
+	{
+		const XMFLOAT3& v0 = mesh.Vertex(mesh.indices[triangle * 3 + 0]);
+		const XMFLOAT3& v1 = mesh.Vertex(mesh.indices[triangle * 3 + 1]);
+		const XMFLOAT3& v2 = mesh.Vertex(mesh.indices[triangle * 3 + 2]);
+		return XMFLOAT3(
+			(std::min({ v0.x, v1.x, v2.x }) + std::max({ v0.x, v1.x, v2.x })) * 0.5f,
+			(std::min({ v0.y, v1.y, v2.y }) + std::max({ v0.y, v1.y, v2.y })) * 0.5f,
+			(std::min({ v0.z, v1.z, v2.z }) + std::max({ v0.z, v1.z, v2.z })) * 0.5f);
+	};
+	const uint32_t numThreads = jobs.NumThreads();
+	std::vector<BuildTask> threadCentroids(numThreads);
+	for (BuildTask& centroids : threadCentroids)
+	{
+		EmptyBounds(centroids.centroidMin, centroids.centroidMax);
+	}
+	jobs.ParallelFor(numTriangles, 8192, [&](uint32_t begin, uint32_t end, uint32_t threadIndex)
+	{
+		BuildTask& centroids = threadCentroids[threadIndex];
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			const XMFLOAT3 centroid = triangleCentroid(i);
+			GrowBounds(centroids.centroidMin, centroids.centroidMax, centroid, centroid);
+		}
+	});
+	XMFLOAT3 centroidMin, centroidMax;
+	EmptyBounds(centroidMin, centroidMax);
+	for (const BuildTask& centroids : threadCentroids)
+	{
+		GrowBounds(centroidMin, centroidMax, centroids.centroidMin, centroids.centroidMax);
+	}
+
+	// Code above, triangle below, equal codes keep triangle order
+	const XMFLOAT3 scale(
+		(centroidMax.x > centroidMin.x) ? 1024.f / (centroidMax.x - centroidMin.x) : 0.f,
+		(centroidMax.y > centroidMin.y) ? 1024.f / (centroidMax.y - centroidMin.y) : 0.f,
+		(centroidMax.z > centroidMin.z) ? 1024.f / (centroidMax.z - centroidMin.z) : 0.f);
+	std::vector<uint64_t> keys(numTriangles);
+	jobs.ParallelFor(numTriangles, 8192, [&](uint32_t begin, uint32_t end, uint32_t)
+	{
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			keys[i] = (static_cast<uint64_t>(MortonCode(triangleCentroid(i), centroidMin, scale)) << 32) | i;
+		}
+	});
+	std::vector<uint64_t> scratch;
+	RadixSort(jobs, keys, scratch, [](uint64_t key) { return key; }, 32, 64);
+
+	TriangleBVHNode root;
+	root.leftFirst = 0;
+	root.numTriangles = numTriangles;
+	BuildTask rootTask = {};
+	BuildTopDown(jobs, SplitMorton, keys.data(), root, rootTask, m_nodes);
+
+	m_triIndices.resize(numTriangles);
+	for (uint32_t i = 0; i < numTriangles; ++i)
+	{
+		m_triIndices[i] = static_cast<uint32_t>(keys[i]);
+	}
+	GatherTriangles(jobs, mesh);
+	RefitNodes(jobs, mesh);
+
+	UpdateStats();
+	m_stats.buildMs = ElapsedMs(start);
+}
+
+//
+// Refit
+//
+void TriangleBVH::GatherTriangles(JobSystem& jobs, const TriangleMesh& mesh)
+{
+	m_triangles.resize(m_triIndices.size());
+	jobs.ParallelFor(static_cast<uint32_t>(m_triIndices.size()), 8192, [&](uint32_t begin, uint32_t end, uint32_t)
+	{
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			const uint32_t triangle = m_triIndices[i];
+			const XMFLOAT3& v0 = mesh.Vertex(mesh.indices[triangle * 3 + 0]);
+			const XMFLOAT3& v1 = mesh.Vertex(mesh.indices[triangle * 3 + 1]);
+			const XMFLOAT3& v2 = mesh.Vertex(mesh.indices[triangle * 3 + 2]);
+			m_triangles[i] = { v0, Sub(v1, v0), Sub(v2, v0) };
+		}
+	});
+}
+
+// Leaves in parallel from the mesh, inner nodes bottom up (children follow their parent)
+void TriangleBVH::RefitNodes(JobSystem& jobs, const TriangleMesh& mesh)
+{
+	jobs.ParallelFor(NumNodes(), 8192, [&](uint32_t begin, uint32_t end, uint32_t)
+	{
+		for (uint32_t n = begin; n < end; ++n)
+		{
+			TriangleBVHNode& node = m_nodes[n];
+			if (!node.IsLeaf())
+				continue;
+
+			EmptyBounds(node.boundsMin, node.boundsMax);
+			for (uint32_t i = node.leftFirst; i < node.leftFirst + node.numTriangles; ++i)
+			{
+				const uint32_t triangle = m_triIndices[i];
+				for (int v = 0; v < 3; ++v)
+				{
+					const XMFLOAT3& position = mesh.Vertex(mesh.indices[triangle * 3 + v]);
+					GrowBounds(node.boundsMin, node.boundsMax, position, position);
+				}
+			}
+		}
+	});
+
+	for (size_t n = m_nodes.size(); n-- > 0; )
+	{
+		TriangleBVHNode& node = m_nodes[n];
+		if (node.IsLeaf())
+			continue;
+
+		const TriangleBVHNode& left = m_nodes[node.leftFirst];
+		const TriangleBVHNode& right = m_nodes[node.leftFirst + 1];
+		node.boundsMin = left.boundsMin;
+		node.boundsMax = left.boundsMax;
+		GrowBounds(node.boundsMin, node.boundsMax, right.boundsMin, right.boundsMax);
+	}
+}
+
+void TriangleBVH::Refit(JobSystem& jobs, const TriangleMesh& mesh)
+{
+	assert(mesh.numTriangles == NumTriangles());
+	auto start = TimerClock::now();
+	GatherTriangles(jobs, mesh);
+	RefitNodes(jobs, mesh);
+	m_stats.sahCost = ComputeSAHCost();
+	m_stats.refitMs = ElapsedMs(start);
+}
+
+bool TriangleBVH::Update(JobSystem& jobs, const TriangleMesh& mesh, float rebuildCostRatio)
+{
+	if (IsEmpty() || mesh.numTriangles != NumTriangles())
+	{
+		Build(jobs, mesh, m_builder);
+		return true;
+	}
+
+	// Refit is O(n) and a fraction of any build, cheap enough to find out
+	Refit(jobs, mesh);
+	if (m_stats.sahCost > rebuildCostRatio * m_stats.builtSahCost)
+	{
+		Build(jobs, mesh, m_builder);
+		return true;
+	}
+	return false;
+}
+
+void TriangleBVH::UpdateStats()
+{
+	m_stats.numNodes = NumNodes();
+	m_stats.numLeaves = 0;
+	m_stats.maxDepth = 0;
+	if (m_nodes.empty())
+	{
+		return;
+	}
+
+	std::vector<std::pair<uint32_t, uint32_t>> stack = { { 0u, 0u } };
+	while (!stack.empty())
+	{
+		const auto entry = stack.back();
+		stack.pop_back();
+		const TriangleBVHNode& node = m_nodes[entry.first];
+		m_stats.maxDepth = std::max(m_stats.maxDepth, entry.second);
+		if (node.IsLeaf())
+		{
+			++m_stats.numLeaves;
+			continue;
+		}
+		stack.push_back({ node.leftFirst, entry.second + 1 });
+		stack.push_back({ node.leftFirst + 1, entry.second + 1 });
+	}
+	m_stats.sahCost = m_stats.builtSahCost = ComputeSAHCost();
+}
+
+float TriangleBVH::ComputeSAHCost() const
+{
+	if (m_nodes.empty())
+	{
+		return 0.f;
+	}
+
+	const float rootArea = HalfArea(m_nodes[0].boundsMin, m_nodes[0].boundsMax);
+	if (rootArea <= 0.f)
+	{
+		return static_cast<float>(m_triIndices.size());
+	}
+
+	double cost = 0.0;
+	for (const TriangleBVHNode& node : m_nodes)
+	{
+		const double area = HalfArea(node.boundsMin, node.boundsMax);
+		cost += area * (node.IsLeaf() ? node.numTriangles : 1u);
+	}
+	return static_cast<float>(cost / rootArea);
+}
+
+//
+// Traversal
+//
+
+float IntersectBVHNode(const BVHRay& ray, const XMFLOAT3& invDir, const TriangleBVHNode& node, float tMax)
+{
+	const float tx0 = (node.boundsMin.x - ray.origin.x) * invDir.x, tx1 = (node.boundsMax.x - ray.origin.x) * invDir.x;
+	const float ty0 = (node.boundsMin.y - ray.origin.y) * invDir.y, ty1 = (node.boundsMax.y - ray.origin.y) * invDir.y;
+	const float tz0 = (node.boundsMin.z - ray.origin.z) * invDir.z, tz1 = (node.boundsMax.z - ray.origin.z) * invDir.z;
+
+	// Accumulator first, NaN from 0 * inf is ignored
+	float tNear = ray.tMin, tFar = tMax;
+	tNear = std::max(tNear, std::min(tx0, tx1));
+	tFar = std::min(tFar, std::max(tx0, tx1));
+	tNear = std::max(tNear, std::min(ty0, ty1));
+	tFar = std::min(tFar, std::max(ty0, ty1));
+	tNear = std::max(tNear, std::min(tz0, tz1));
+	tFar = std::min(tFar, std::max(tz0, tz1));
+	return (tNear <= tFar) ? tNear : FLT_MAX;
+}
+
+// Möller-Trumbore, hit in [tMin, tMax)
+static bool IntersectTriangle(const BVHRay& ray, const TriangleBVH::Triangle& triangle, float tMax, float& t, float& u, float& v, bool& backFace)
+{
+	const XMFLOAT3 p = Cross(ray.direction, triangle.e2);
+	const float det = Dot(triangle.e1, p);
+	if (fabsf(det) < 1e-12f)
+		return false;
+
+	const float invDet = 1.f / det;
+	const XMFLOAT3 s = Sub(ray.origin, triangle.v0);
+	u = Dot(s, p) * invDet;
+	if (u < 0.f || u > 1.f)
+		return false;
+
+	const XMFLOAT3 q = Cross(s, triangle.e1);
+	v = Dot(ray.direction, q) * invDet;
+	if (v < 0.f || u + v > 1.f)
+		return false;
+
+	t = Dot(triangle.e2, q) * invDet;
+	if (t < ray.tMin || t >= tMax)
+		return false;
+
+	// det = -dot(direction, normal)
+	backFace = det < 0.f;
+	return true;
+}
+
+static XMFLOAT3 InverseDirection(const XMFLOAT3& direction)
+{
+	return XMFLOAT3(1.f / direction.x, 1.f / direction.y, 1.f / direction.z);
+}
+
+bool TriangleBVH::Intersect(const BVHRay& ray, BVHHit& hit) const
+{
+	if (m_nodes.empty())
+	{
+		return false;
+	}
+
+	const XMFLOAT3 invDir = InverseDirection(ray.direction);
+	float tMax = std::min(ray.tMax, hit.t);
+	if (IntersectBVHNode(ray, invDir, m_nodes[0], tMax) == FLT_MAX)
+	{
+		return false;
+	}
+
+	// Far child is pushed with its entry distance, skipped when a closer hit was found meanwhile
+	struct StackEntry
+	{
+		uint32_t nodeIndex;
+		float tEntry;
+	};
+	StackEntry stack[MaxDepth];
+	uint32_t stackSize = 0;
+	uint32_t nodeIndex = 0;
+	bool found = false;
+	while (true)
+	{
+		const TriangleBVHNode& node = m_nodes[nodeIndex];
+		if (node.IsLeaf())
+		{
+			for (uint32_t i = node.leftFirst; i < node.leftFirst + node.numTriangles; ++i)
+			{
+				float t, u, v;
+				bool backFace;
+				if (IntersectTriangle(ray, m_triangles[i], tMax, t, u, v, backFace))
+				{
+					tMax = t;
+					hit.t = t;
+					hit.u = u;
+					hit.v = v;
+					hit.triangle = m_triIndices[i];
+					hit.backFace = backFace;
+					found = true;
+				}
+			}
+		}
+		else
+		{
+			uint32_t nearChild = node.leftFirst;
+			uint32_t farChild = node.leftFirst + 1;
+			float tNear = IntersectBVHNode(ray, invDir, m_nodes[nearChild], tMax);
+			float tFar = IntersectBVHNode(ray, invDir, m_nodes[farChild], tMax);
+			if (tFar < tNear)
+			{
+				std::swap(nearChild, farChild);
+				std::swap(tNear, tFar);
+			}
+			if (tNear != FLT_MAX)
+			{
+				if (tFar != FLT_MAX)
+				{
+					assert(stackSize < MaxDepth);
+					stack[stackSize++] = { farChild, tFar };
+				}
+				nodeIndex = nearChild;
+				continue;
+			}
+		}
+
+		// Pop the next node still in front of the closest hit
+		while (stackSize > 0 && stack[stackSize - 1].tEntry >= tMax)
+		{
+			--stackSize;
+		}
+		if (stackSize == 0)
+			break;
+		nodeIndex = stack[--stackSize].nodeIndex;
+	}
+	return found;
+}
+
+bool TriangleBVH::Occluded(const BVHRay& ray) const
+{
+	if (m_nodes.empty())
+	{
+		return false;
+	}
+
+	const XMFLOAT3 invDir = InverseDirection(ray.direction);
+	uint32_t stack[MaxDepth];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		const TriangleBVHNode& node = m_nodes[stack[--stackSize]];
+		if (IntersectBVHNode(ray, invDir, node, ray.tMax) == FLT_MAX)
+			continue;
+
+		if (node.IsLeaf())
+		{
+			for (uint32_t i = node.leftFirst; i < node.leftFirst + node.numTriangles; ++i)
+			{
+				float t, u, v;
+				bool backFace;
+				if (IntersectTriangle(ray, m_triangles[i], ray.tMax, t, u, v, backFace))
+					return true;
+			}
+			continue;
+		}
+
+		assert(stackSize + 2 <= MaxDepth);
+		stack[stackSize++] = node.leftFirst + 1;
+		stack[stackSize++] = node.leftFirst;
+	}
+	return false;
+}
+
+//
+// Benchmark
+//
+void MakeBenchmarkMesh(uint32_t numTriangles, std::vector<XMFLOAT3>& outPositions, std::vector<uint32_t>& outIndices)
+{
+	outPositions.clear();
+	outIndices.clear();
+
+	// Half terrain, a grid of quads over [-side, side]
+	std::mt19937 rng(1234);
+	const uint32_t gridSize = std::max(1u, static_cast<uint32_t>(sqrtf(numTriangles / 4.f)));
+	const float side = 100.f;
+	for (uint32_t z = 0; z <= gridSize; ++z)
+	{
+		for (uint32_t x = 0; x <= gridSize; ++x)
+		{
+			const float px = side * (2.f * x / gridSize - 1.f);
+			const float pz = side * (2.f * z / gridSize - 1.f);
+			outPositions.push_back(XMFLOAT3(px, 4.f * sinf(px * 0.07f) * cosf(pz * 0.05f), pz));
+		}
+	}
+	for (uint32_t z = 0; z < gridSize; ++z)
+	{
+		for (uint32_t x = 0; x < gridSize; ++x)
+		{
+			const uint32_t i = z * (gridSize + 1) + x;
+			outIndices.insert(outIndices.end(), { i, i + gridSize + 1, i + 1, i + 1, i + gridSize + 1, i + gridSize + 2 });
+		}
+	}
+
+	// Rest scattered above it, clustered like foliage
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+	std::vector<XMFLOAT3> clusters(std::max(1u, numTriangles / 2048));
+	for (XMFLOAT3& cluster : clusters)
+	{
+		cluster = XMFLOAT3(side * (2.f * unit(rng) - 1.f), 2.f + 20.f * unit(rng), side * (2.f * unit(rng) - 1.f));
+	}
+	while (outIndices.size() / 3 < numTriangles)
+	{
+		const XMFLOAT3& cluster = clusters[rng() % clusters.size()];
+		const XMFLOAT3 center(cluster.x + 8.f * (unit(rng) - 0.5f), cluster.y + 8.f * (unit(rng) - 0.5f), cluster.z + 8.f * (unit(rng) - 0.5f));
+		const uint32_t base = static_cast<uint32_t>(outPositions.size());
+		for (int v = 0; v < 3; ++v)
+		{
+			outPositions.push_back(XMFLOAT3(center.x + 0.6f * (unit(rng) - 0.5f), center.y + 0.6f * (unit(rng) - 0.5f), center.z + 0.6f * (unit(rng) - 0.5f)));
+			outIndices.push_back(base + v);
+		}
+	}
+	outIndices.resize(static_cast<size_t>(numTriangles) * 3);
+}
+
+// Rays from above the terrain in every direction, fixed seed
+static void MakeBenchmarkRays(std::vector<BVHRay>& outRays)
+{
+	std::mt19937 rng(4321);
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+	outRays.resize(1 << 20);
+	for (BVHRay& ray : outRays)
+	{
+		ray.origin = XMFLOAT3(180.f * (unit(rng) - 0.5f), 5.f + 20.f * unit(rng), 180.f * (unit(rng) - 0.5f));
+		const float z = 2.f * unit(rng) - 1.f;
+		const float phi = XM_2PI * unit(rng);
+		const float r = sqrtf(std::max(0.f, 1.f - z * z));
+		ray.direction = XMFLOAT3(r * cosf(phi), z, r * sinf(phi));
+	}
+}
+
+// Closest hits across the job system, best of a few runs in ms
+static double TraceBenchmarkRays(JobSystem& jobs, const TriangleBVH& bvh, const std::vector<BVHRay>& rays, std::vector<BVHHit>& outHits)
+{
+	const uint32_t numRays = static_cast<uint32_t>(rays.size());
+	outHits.resize(numRays);
+	return BestOfMs([&]
+	{
+		jobs.ParallelFor(numRays, 1024, [&](uint32_t begin, uint32_t end, uint32_t)
+		{
+			for (uint32_t i = begin; i < end; ++i)
+			{
+				outHits[i] = BVHHit();
+				bvh.Intersect(rays[i], outHits[i]);
+			}
+		});
+	});
+}
+
+void RunTriangleBVHBenchmark(JobSystem& jobs, uint32_t numTriangles, TriangleBVHBenchmarkResult& outResult)
+{
+	outResult = {};
+	outResult.numTriangles = numTriangles;
+	outResult.numThreads = jobs.NumThreads();
+
+	std::vector<XMFLOAT3> positions;
+	std::vector<uint32_t> indices;
+	MakeBenchmarkMesh(numTriangles, positions, indices);
+	TriangleMesh mesh;
+	mesh.positions = positions.data();
+	mesh.indices = indices.data();
+	mesh.numTriangles = numTriangles;
+
+	// Same tree at any thread count
+	TriangleBVH serialBVH;
+	{
+		JobSystem serialJobs;
+		JobSystemInit serialInit;
+		serialInit.numThreads = 1;
+		serialJobs.Initialize(serialInit);
+		auto start = TimerClock::now();
+		serialBVH.BuildSAH(serialJobs, mesh);
+		outResult.serialBuildMs = ElapsedMs(start);
+		serialJobs.Shutdown();
+	}
+
+	TriangleBVH bvh;
+	outResult.parallelBuildMs = BestOfMs([&] { bvh.BuildSAH(jobs, mesh); });
+	assert(bvh.NumNodes() == serialBVH.NumNodes() && bvh.Stats().sahCost == serialBVH.Stats().sahCost);
+	outResult.numNodes = bvh.NumNodes();
+	outResult.maxDepth = bvh.Stats().maxDepth;
+	outResult.sahCost = bvh.Stats().sahCost;
+
+	std::vector<BVHRay> rays;
+	std::vector<BVHHit> hits;
+	MakeBenchmarkRays(rays);
+	const uint32_t numRays = static_cast<uint32_t>(rays.size());
+	outResult.numRays = numRays;
+	outResult.traceMs = TraceBenchmarkRays(jobs, bvh, rays, hits);
+	outResult.raysPerSecond = (outResult.traceMs > 0.0) ? numRays / (outResult.traceMs * 1e-3) : 0.0;
+	for (const BVHHit& hit : hits)
+	{
+		outResult.numHits += hit.IsHit() ? 1 : 0;
+	}
+
+	// Brute force, same triangle test so the distances match exactly
+	const uint32_t numChecked = 64;
+	for (uint32_t r = 0; r < numChecked; ++r)
+	{
+		const BVHRay& ray = rays[r * (numRays / numChecked)];
+		BVHHit reference;
+		for (uint32_t i = 0; i < numTriangles; ++i)
+		{
+			const XMFLOAT3& v0 = positions[indices[i * 3 + 0]];
+			const TriangleBVH::Triangle triangle = { v0, Sub(positions[indices[i * 3 + 1]], v0), Sub(positions[indices[i * 3 + 2]], v0) };
+			float t, u, v;
+			bool backFace;
+			if (IntersectTriangle(ray, triangle, reference.t, t, u, v, backFace))
+			{
+				reference.t = t;
+				reference.triangle = i;
+			}
+		}
+
+		const BVHHit& hit = hits[r * (numRays / numChecked)];
+		const bool occluded = bvh.Occluded(ray);
+		if (hit.t != reference.t || occluded != reference.IsHit())
+		{
+			++outResult.numMismatches;
+		}
+	}
+	assert(outResult.numMismatches == 0);
+}
+
+void RunBVHBuilderBenchmark(JobSystem& jobs, uint32_t numTriangles, BVHBuilderBenchmarkResult& outResult)
+{
+	outResult = {};
+	outResult.numTriangles = numTriangles;
+	outResult.numThreads = jobs.NumThreads();
+
+	std::vector<XMFLOAT3> positions;
+	std::vector<uint32_t> indices;
+	MakeBenchmarkMesh(numTriangles, positions, indices);
+	TriangleMesh mesh;
+	mesh.positions = positions.data();
+	mesh.indices = indices.data();
+	mesh.numTriangles = numTriangles;
+
+	TriangleBVH sahBVH, lbvh;
+	outResult.sahBuildMs = BestOfMs([&] { sahBVH.BuildSAH(jobs, mesh); });
+	outResult.lbvhBuildMs = BestOfMs([&] { lbvh.BuildLBVH(jobs, mesh); });
+	const double millions = std::max(numTriangles, 1u) * 1e-6;
+	outResult.sahMsPerMillion = outResult.sahBuildMs / millions;
+	outResult.lbvhMsPerMillion = outResult.lbvhBuildMs / millions;
+	outResult.sahCost = sahBVH.Stats().sahCost;
+	outResult.lbvhCost = lbvh.Stats().sahCost;
+
+	std::vector<BVHRay> rays;
+	std::vector<BVHHit> sahHits, lbvhHits;
+	MakeBenchmarkRays(rays);
+	const double sahTraceMs = TraceBenchmarkRays(jobs, sahBVH, rays, sahHits);
+	const double lbvhTraceMs = TraceBenchmarkRays(jobs, lbvh, rays, lbvhHits);
+	outResult.sahRaysPerSecond = (sahTraceMs > 0.0) ? rays.size() / (sahTraceMs * 1e-3) : 0.0;
+	outResult.lbvhRaysPerSecond = (lbvhTraceMs > 0.0) ? rays.size() / (lbvhTraceMs * 1e-3) : 0.0;
+
+	// Same triangle test on both, only the distance has to match (ties may pick another triangle)
+	for (size_t i = 0; i < rays.size(); ++i)
+	{
+		if (sahHits[i].t != lbvhHits[i].t)
+		{
+			++outResult.numMismatches;
+		}
+	}
+	assert(outResult.numMismatches == 0);
+
+	// Foliage triangles scatter out of their clusters, each along its own direction. Terrain vertices come
+	// first, see MakeBenchmarkMesh
+	const uint32_t gridSize = std::max(1u, static_cast<uint32_t>(sqrtf(numTriangles / 4.f)));
+	const uint32_t numTerrainVertices = (gridSize + 1) * (gridSize + 1);
+	std::vector<XMFLOAT3> animated = positions;
+	mesh.positions = animated.data();
+	lbvh.BuildLBVH(jobs, mesh);
+	outResult.numFrames = 16;
+	uint32_t numRefits = 0;
+	for (uint32_t frame = 1; frame <= outResult.numFrames; ++frame)
+	{
+		const float drift = 0.5f * frame;
+		jobs.ParallelFor(static_cast<uint32_t>(positions.size()), 8192, [&](uint32_t begin, uint32_t end, uint32_t)
+		{
+			for (uint32_t i = std::max(begin, numTerrainVertices); i < end; ++i)
+			{
+				const uint32_t triangle = (i - numTerrainVertices) / 3;
+				const float angle = (triangle * 2654435761u) * (XM_2PI / 4294967296.f);
+				const XMFLOAT3& p = positions[i];
+				animated[i] = XMFLOAT3(p.x + drift * cosf(angle), p.y, p.z + drift * sinf(angle));
+			}
+		});
+
+		const float builtCost = lbvh.Stats().builtSahCost;
+		if (lbvh.Update(jobs, mesh))
+		{
+			++outResult.numRebuilds;
+		}
+		else
+		{
+			outResult.refitMs += lbvh.Stats().refitMs;
+			outResult.maxCostRatio = std::max(outResult.maxCostRatio, lbvh.Stats().sahCost / builtCost);
+			++numRefits;
+		}
+	}
+	outResult.refitMs = numRefits ? outResult.refitMs / numRefits : 0.0;
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <float.h>
+#include <stdint.h>
+#include <vector>
+#include <DirectXMath.h>
+#include "JobSystem.h"
+
+// Bounding volume hierarchy over the triangles of one mesh for CPU ray queries (no D3D dependency)
+// Two builders emit the same nodes, traversal is shared:
+// - Binned SAH, ranges above ParallelBuildThreshold triangles are binned across the job system,
+//   the subtrees below it are built in parallel. Best trace performance, static geometry.
+// - LBVH, triangles sorted along a 30 bit Morton curve and split at the highest differing bit.
+//   Several times faster to build, for deforming geometry rebuilt at runtime.
+// Nodes are 32 bytes and siblings are adjacent, triangles are copied in leaf order so traversal
+// doesn't read the mesh. Children are always stored after their parent.
+
+// Indices are relative to positions, the stride lets MeshVertex arrays be used directly
+struct TriangleMesh
+{
+	const void* positions = nullptr;
+	uint32_t positionStride = sizeof(DirectX::XMFLOAT3);
+	const uint32_t* indices = nullptr;
+	uint32_t numTriangles = 0;
+
+	const DirectX::XMFLOAT3& Vertex(uint32_t index) const
+	{
+		return *reinterpret_cast<const DirectX::XMFLOAT3*>(static_cast<const uint8_t*>(positions) + static_cast<size_t>(index) * positionStride);
+	}
+};
+
+struct TriangleBVHNode
+{
+	DirectX::XMFLOAT3 boundsMin;
+	uint32_t leftFirst = 0;		// Inner: left child, right is leftFirst + 1. Leaf: first triangle
+	DirectX::XMFLOAT3 boundsMax;
+	uint32_t numTriangles = 0;	// 0 for inner nodes
+
+	bool IsLeaf() const { return numTriangles > 0; }
+};
+static_assert(sizeof(TriangleBVHNode) == 32, "TriangleBVHNode is two 16 byte halves");
+
+struct BVHRay
+{
+	DirectX::XMFLOAT3 origin;
+	float tMin = 0.f;
+	DirectX::XMFLOAT3 direction;	// Not normalized, t is in its units
+	float tMax = FLT_MAX;
+};
+
+struct BVHHit
+{
+	float t = FLT_MAX;
+	float u = 0.f;				// Barycentrics of vertex 1 and 2
+	float v = 0.f;
+	uint32_t triangle = ~0u;	// In the mesh
+	bool backFace = false;		// Clockwise seen from the ray origin
+	uint32_t instance = ~0u;	// Set by TopLevelBVH
+
+	bool IsHit() const { return triangle != ~0u; }
+};
+
+// Entry distance of the node's box in [ray.tMin, tMax], FLT_MAX when missed. invDir is 1 / ray.direction
+float IntersectBVHNode(const BVHRay& ray, const DirectX::XMFLOAT3& invDir, const TriangleBVHNode& node, float tMax);
+
+enum class TriangleBVHBuilder
+{
+	SAH,
+	LBVH,
+};
+
+struct TriangleBVHStats
+{
+	uint32_t numNodes = 0;
+	uint32_t numLeaves = 0;
+	uint32_t maxDepth = 0;
+	double buildMs = 0.0;
+	double refitMs = 0.0;		// Last Refit or Update that didn't rebuild
+	float sahCost = 0.f;		// Current, grows with refits
+	float builtSahCost = 0.f;	// Right after the last build
+};
+
+class TriangleBVH
+{
+public:
+	static const uint32_t NumBins = 16;
+	static const uint32_t MaxLeafSize = 8;
+	static const uint32_t MaxDepth = 64;					// Traversal stack, nodes this deep split at the median
+	static const uint32_t ParallelBuildThreshold = 16384;	// Triangles
+	static const uint32_t LBVHLeafSize = 4;
+
+	void BuildSAH(JobSystem& jobs, const TriangleMesh& mesh);
+	void BuildLBVH(JobSystem& jobs, const TriangleMesh& mesh);
+	void Build(JobSystem& jobs, const TriangleMesh& mesh, TriangleBVHBuilder builder);
+	void Clear();
+
+	// Vertices moved, same triangles. Topology is kept, quality degrades with large deformation
+	void Refit(JobSystem& jobs, const TriangleMesh& mesh);
+
+	// Refit, rebuilt with the last builder once the SAH cost exceeds rebuildCostRatio times the
+	// cost after the last build. True when rebuilt
+	bool Update(JobSystem& jobs, const TriangleMesh& mesh, float rebuildCostRatio = 1.5f);
+
+	// Closest hit in [ray.tMin, min(ray.tMax, hit.t)), true when hit was updated
+	bool Intersect(const BVHRay& ray, BVHHit& hit) const;
+
+	// Any hit in [ray.tMin, ray.tMax), for shadow and visibility rays
+	bool Occluded(const BVHRay& ray) const;
+
+	// Expected cost of a ray through the root, traversal step and triangle test cost 1 each
+	float ComputeSAHCost() const;
+
+	bool IsEmpty() const { return m_nodes.empty(); }
+	uint32_t NumNodes() const { return static_cast<uint32_t>(m_nodes.size()); }
+	uint32_t NumTriangles() const { return static_cast<uint32_t>(m_triIndices.size()); }
+	const std::vector<TriangleBVHNode>& Nodes() const { return m_nodes; }
+	const std::vector<uint32_t>& TriangleIndices() const { return m_triIndices; }	// Mesh triangle of every leaf slot
+	const TriangleBVHStats& Stats() const { return m_stats; }
+
+	// Leaf order triangle, v0 and edges to v1 and v2
+	struct Triangle
+	{
+		DirectX::XMFLOAT3 v0;
+		DirectX::XMFLOAT3 e1;
+		DirectX::XMFLOAT3 e2;
+	};
+	const std::vector<Triangle>& Triangles() const { return m_triangles; }
+
+private:
+	void GatherTriangles(JobSystem& jobs, const TriangleMesh& mesh);
+	void RefitNodes(JobSystem& jobs, const TriangleMesh& mesh);
+	void UpdateStats();
+
+	std::vector<TriangleBVHNode> m_nodes;
+	std::vector<Triangle> m_triangles;
+	std::vector<uint32_t> m_triIndices;		// Mesh triangle of every leaf slot
+	TriangleBVHStats m_stats;
+	TriangleBVHBuilder m_builder = TriangleBVHBuilder::SAH;
+};
+
+// Synthetic mesh, a rolling terrain under randomly scattered small triangles, fixed seed
+void MakeBenchmarkMesh(uint32_t numTriangles, std::vector<DirectX::XMFLOAT3>& outPositions, std::vector<uint32_t>& outIndices);
+
+struct TriangleBVHBenchmarkResult
+{
+	uint32_t numTriangles = 0;
+	uint32_t numThreads = 0;
+	uint32_t numNodes = 0;
+	uint32_t maxDepth = 0;
+	double serialBuildMs = 0.0;		// One thread
+	double parallelBuildMs = 0.0;
+	float sahCost = 0.f;
+	uint32_t numRays = 0;
+	uint32_t numHits = 0;
+	double traceMs = 0.0;			// Closest hit, across the job system
+	double raysPerSecond = 0.0;
+	uint32_t numMismatches = 0;		// Closest hits against brute force on a subset of rays
+};
+
+// Build both ways (same tree), then random rays through the scene
+void RunTriangleBVHBenchmark(JobSystem& jobs, uint32_t numTriangles, TriangleBVHBenchmarkResult& outResult);
+
+struct BVHBuilderBenchmarkResult
+{
+	uint32_t numTriangles = 0;
+	uint32_t numThreads = 0;
+	double sahBuildMs = 0.0;
+	double lbvhBuildMs = 0.0;
+	double sahMsPerMillion = 0.0;	// Build time per million triangles
+	double lbvhMsPerMillion = 0.0;
+	float sahCost = 0.f;
+	float lbvhCost = 0.f;
+	double sahRaysPerSecond = 0.0;	// Same rays as RunTriangleBVHBenchmark
+	double lbvhRaysPerSecond = 0.0;
+	uint32_t numMismatches = 0;		// LBVH closest hits against SAH
+
+	// Foliage drifting apart over frames, LBVH updated with the default ratio
+	uint32_t numFrames = 0;
+	uint32_t numRebuilds = 0;
+	double refitMs = 0.0;			// Average of frames that refit
+	float maxCostRatio = 0.f;		// Refit SAH cost over built
+};
+
+// SAH against LBVH on the benchmark mesh, then refit against rebuild on a deforming copy
+void RunBVHBuilderBenchmark(JobSystem& jobs, uint32_t numTriangles, BVHBuilderBenchmarkResult& outResult);
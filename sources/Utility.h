@@ -1,30 +1,69 @@
 #pragma once
 
-#include "PCH.h"
+// No D3D dependency, the headless tools and CPU modules use it too
+#include <float.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
 
 #define SizeOfInUint32(obj) ((sizeof(obj) - 1) / sizeof(uint32_t) + 1)
 
-inline void CheckHRESULT(HRESULT hr = S_OK)
+inline uint64_t AlignTo(uint64_t num, uint64_t alignment)
+{
+    return ((num + alignment - 1) / alignment) * alignment;
+}
+
+// 64 bit content hash (8 bytes per step, murmur finalizer), not cryptographic
+inline uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 0xcbf29ce484222325ull)
 {
-    if (FAILED(hr))
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint64_t hash = seed ^ (size * 0x9e3779b97f4a7c15ull);
+
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(uint64_t));
+        word *= 0x9e3779b97f4a7c15ull;
+        word ^= word >> 32;
+        hash = (hash ^ word) * 0x100000001b3ull;
+    }
+    for (; i < size; ++i)
     {
-        std::string fullMessage = "(HRESULT: 0x" + std::to_string(hr) + ")";
-        assert(false && fullMessage.c_str());
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
     }
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
 }
 
-inline std::string WStringToString(const std::wstring& wstr)
+// Wall clock timing of stats and benchmarks
+typedef std::chrono::high_resolution_clock TimerClock;
+
+inline double ElapsedMs(TimerClock::time_point start)
 {
-    int size_needed = WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), static_cast<int>(wstr.size()), nullptr, 0, nullptr, nullptr);
-    std::string str(size_needed, 0);
-    WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), static_cast<int>(wstr.size()), &str[0], size_needed, nullptr, nullptr);
-    return str;
+    return std::chrono::duration<double, std::milli>(TimerClock::now() - start).count();
 }
 
-inline uint64_t AlignTo(uint64_t num, uint64_t alignment)
+// Shortest of a few runs, the first run warms caches
+template <typename Func>
+inline double BestOfMs(Func&& func, int numRuns = 3)
 {
-    return ((num + alignment - 1) / alignment) * alignment;
+    double bestMs = DBL_MAX;
+    for (int run = 0; run < numRuns; ++run)
+    {
+        const TimerClock::time_point start = TimerClock::now();
+        func();
+        bestMs = std::min(bestMs, ElapsedMs(start));
+    }
+    return bestMs;
 }
+
 //void LogError(const char* message, HRESULT hr = S_OK)
 //{
 //    std::string errorMsg = message;
@@ -0,0 +1,464 @@
+#include "VirtualTexture.h"
+#include "Utility.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <fstream>
+#include <math.h>
+#include <random>
+
+static const uint32_t FeedbackTraceMagic = 0x42465456;	// "VTFB"
+
+void VirtualTextureCache::Initialize(const VirtualTextureCacheInit& init)
+{
+	// Slot coordinates are stored in 8 bits in the page table
+	assert(init.numSlotsX > 0 && init.numSlotsX <= 256);
+	assert(init.numSlotsY > 0 && init.numSlotsY <= 256);
+
+	m_init = init;
+	m_stats = {};
+	m_textures.clear();
+	m_entries.clear();
+	m_frameIndex = 0;
+
+	// All slots start free at the head of the LRU list
+	m_slots.assign(init.numSlotsX * init.numSlotsY, Slot());
+	m_lruHead = VirtualInvalidPage;
+	m_lruTail = VirtualInvalidPage;
+	for (uint32_t slot = 0; slot < m_slots.size(); ++slot)
+	{
+		PushBack(slot);
+	}
+}
+
+void VirtualTextureCache::Shutdown()
+{
+	m_textures.clear();
+	m_entries.clear();
+	m_slots.clear();
+	m_lruHead = VirtualInvalidPage;
+	m_lruTail = VirtualInvalidPage;
+}
+
+uint32_t VirtualTextureCache::AddTexture(const VirtualTextureDesc& desc)
+{
+	assert(m_textures.size() <= VT_TEXTURE_MASK);
+
+	TextureInfo tex;
+	tex.pagesX = std::max((desc.width + VirtualPageSize - 1) / VirtualPageSize, 1u);
+	tex.pagesY = std::max((desc.height + VirtualPageSize - 1) / VirtualPageSize, 1u);
+	assert(tex.pagesX <= VT_PAGE_MASK + 1 && tex.pagesY <= VT_PAGE_MASK + 1);
+
+	// Page level mips only, the tail below one page lives in the last mip
+	tex.numMips = 1;
+	while ((std::max(tex.pagesX, tex.pagesY) >> tex.numMips) > 0)
+	{
+		++tex.numMips;
+	}
+
+	tex.firstEntry = static_cast<uint32_t>(m_entries.size());
+	uint32_t numEntries = 0;
+	for (uint32_t mip = 0; mip < tex.numMips; ++mip)
+	{
+		tex.mipOffsets.push_back(numEntries);
+		numEntries += std::max(tex.pagesX >> mip, 1u) * std::max(tex.pagesY >> mip, 1u);
+	}
+	m_entries.resize(m_entries.size() + numEntries, -1);
+
+	m_textures.push_back(std::move(tex));
+	return static_cast<uint32_t>(m_textures.size() - 1);
+}
+
+uint32_t VirtualTextureCache::PagesX(uint32_t textureId, uint32_t mip) const
+{
+	return std::max(m_textures[textureId].pagesX >> mip, 1u);
+}
+
+uint32_t VirtualTextureCache::PagesY(uint32_t textureId, uint32_t mip) const
+{
+	return std::max(m_textures[textureId].pagesY >> mip, 1u);
+}
+
+uint32_t VirtualTextureCache::EntryIndex(uint32_t pageId) const
+{
+	const uint32_t textureId = PageTexture(pageId);
+	const uint32_t mip = PageMip(pageId);
+	const TextureInfo& tex = m_textures[textureId];
+	return tex.firstEntry + tex.mipOffsets[mip] + PageY(pageId) * PagesX(textureId, mip) + PageX(pageId);
+}
+
+int32_t VirtualTextureCache::FindSlot(uint32_t pageId) const
+{
+	return m_entries[EntryIndex(pageId)];
+}
+
+//
+// LRU list
+//
+void VirtualTextureCache::Unlink(uint32_t slot)
+{
+	Slot& s = m_slots[slot];
+	if (s.prev != VirtualInvalidPage)
+		m_slots[s.prev].next = s.next;
+	else
+		m_lruHead = s.next;
+
+	if (s.next != VirtualInvalidPage)
+		m_slots[s.next].prev = s.prev;
+	else
+		m_lruTail = s.prev;
+
+	s.prev = VirtualInvalidPage;
+	s.next = VirtualInvalidPage;
+}
+
+void VirtualTextureCache::PushBack(uint32_t slot)
+{
+	Slot& s = m_slots[slot];
+	s.prev = m_lruTail;
+	s.next = VirtualInvalidPage;
+	if (m_lruTail != VirtualInvalidPage)
+		m_slots[m_lruTail].next = slot;
+	else
+		m_lruHead = slot;
+	m_lruTail = slot;
+}
+
+void VirtualTextureCache::Touch(uint32_t slot)
+{
+	m_slots[slot].lastUsedFrame = m_frameIndex;
+	Unlink(slot);
+	PushBack(slot);
+}
+
+//
+// Feedback analysis
+//
+void VirtualTextureCache::AnalyzeFeedback(const uint32_t* feedback, size_t count, VirtualTextureUpdate& outUpdate)
+{
+	auto start = TimerClock::now();
+
+	++m_frameIndex;
+	m_stats = {};
+	outUpdate.loads.clear();
+	outUpdate.evictions.clear();
+	outUpdate.dirtyTextures.clear();
+
+	// Drop invalid and out of range entries (cleared buffer, stale ids)
+	m_requests.clear();
+	for (size_t i = 0; i < count; ++i)
+	{
+		const uint32_t pageId = feedback[i];
+		if (pageId == VirtualInvalidPage)
+			continue;
+
+		const uint32_t textureId = PageTexture(pageId);
+		if (textureId >= m_textures.size())
+			continue;
+
+		const uint32_t mip = PageMip(pageId);
+		if (mip >= m_textures[textureId].numMips ||
+			PageX(pageId) >= PagesX(textureId, mip) ||
+			PageY(pageId) >= PagesY(textureId, mip))
+			continue;
+
+		m_requests.push_back(pageId);
+	}
+	m_stats.numFeedback = static_cast<uint32_t>(m_requests.size());
+
+	// Collapse duplicates before adding ancestors, feedback is highly coherent
+	std::sort(m_requests.begin(), m_requests.end());
+	m_requests.erase(std::unique(m_requests.begin(), m_requests.end()), m_requests.end());
+
+	// Coarser ancestors are the fallback while finer pages stream in
+	const size_t numRequested = m_requests.size();
+	for (size_t i = 0; i < numRequested; ++i)
+	{
+		const uint32_t pageId = m_requests[i];
+		const uint32_t textureId = PageTexture(pageId);
+		uint32_t x = PageX(pageId);
+		uint32_t y = PageY(pageId);
+		for (uint32_t mip = PageMip(pageId) + 1; mip < m_textures[textureId].numMips; ++mip)
+		{
+			x = std::min(x >> 1, PagesX(textureId, mip) - 1);
+			y = std::min(y >> 1, PagesY(textureId, mip) - 1);
+			m_requests.push_back(PackPageId(textureId, mip, x, y));
+		}
+	}
+	std::sort(m_requests.begin(), m_requests.end());
+
+	// Touch resident pages, gather missing with how often they were asked for
+	m_missing.clear();
+	for (size_t i = 0; i < m_requests.size(); )
+	{
+		const uint32_t pageId = m_requests[i];
+		size_t end = i + 1;
+		while (end < m_requests.size() && m_requests[end] == pageId)
+		{
+			++end;
+		}
+
+		const int32_t slot = m_entries[EntryIndex(pageId)];
+		if (slot >= 0)
+		{
+			Touch(static_cast<uint32_t>(slot));
+			++m_stats.numResident;
+		}
+		else
+		{
+			m_missing.push_back({ pageId, static_cast<uint32_t>(end - i) });
+		}
+		++m_stats.numUnique;
+		i = end;
+	}
+	m_stats.numMissing = static_cast<uint32_t>(m_missing.size());
+
+	// Coarse mips first so every request has a fallback, then most requested
+	std::sort(m_missing.begin(), m_missing.end(), [](const auto& a, const auto& b)
+	{
+		if (PageMip(a.first) != PageMip(b.first))
+			return PageMip(a.first) > PageMip(b.first);
+		if (a.second != b.second)
+			return a.second > b.second;
+		return a.first < b.first;
+	});
+
+	for (const auto& missing : m_missing)
+	{
+		if (outUpdate.loads.size() >= m_init.maxLoadsPerFrame)
+			break;
+
+		// Least recently used slot, stop if every slot is needed this frame
+		const uint32_t slot = m_lruHead;
+		if (slot == VirtualInvalidPage || m_slots[slot].lastUsedFrame == m_frameIndex)
+			break;
+
+		Slot& s = m_slots[slot];
+		if (s.pageId != VirtualInvalidPage)
+		{
+			m_entries[EntryIndex(s.pageId)] = -1;
+			outUpdate.evictions.push_back(s.pageId);
+			outUpdate.dirtyTextures.push_back(PageTexture(s.pageId));
+		}
+
+		s.pageId = missing.first;
+		m_entries[EntryIndex(missing.first)] = static_cast<int32_t>(slot);
+		Touch(slot);
+
+		outUpdate.loads.push_back({ missing.first, slot });
+		outUpdate.dirtyTextures.push_back(PageTexture(missing.first));
+	}
+
+	std::sort(outUpdate.dirtyTextures.begin(), outUpdate.dirtyTextures.end());
+	outUpdate.dirtyTextures.erase(
+		std::unique(outUpdate.dirtyTextures.begin(), outUpdate.dirtyTextures.end()),
+		outUpdate.dirtyTextures.end());
+
+	m_stats.numLoads = static_cast<uint32_t>(outUpdate.loads.size());
+	m_stats.numEvictions = static_cast<uint32_t>(outUpdate.evictions.size());
+
+	m_stats.analyzeMs = ElapsedMs(start);
+}
+
+void VirtualTextureCache::BuildPageTable(uint32_t textureId, uint32_t mip, std::vector<uint32_t>& outTexels) const
+{
+	const TextureInfo& tex = m_textures[textureId];
+	const uint32_t pagesX = PagesX(textureId, mip);
+	const uint32_t pagesY = PagesY(textureId, mip);
+	outTexels.assign(pagesX * pagesY, 0);
+
+	for (uint32_t y = 0; y < pagesY; ++y)
+	{
+		for (uint32_t x = 0; x < pagesX; ++x)
+		{
+			// Walk up until a resident ancestor is found
+			uint32_t px = x, py = y;
+			for (uint32_t m = mip; m < tex.numMips; ++m)
+			{
+				if (m > mip)
+				{
+					px = std::min(px >> 1, PagesX(textureId, m) - 1);
+					py = std::min(py >> 1, PagesY(textureId, m) - 1);
+				}
+
+				const int32_t slot = m_entries[tex.firstEntry + tex.mipOffsets[m] + py * PagesX(textureId, m) + px];
+				if (slot >= 0)
+				{
+					const uint32_t slotX = static_cast<uint32_t>(slot) % m_init.numSlotsX;
+					const uint32_t slotY = static_cast<uint32_t>(slot) / m_init.numSlotsX;
+					outTexels[y * pagesX + x] = slotX | (slotY << 8) | (m << 16) | (0xFFu << 24);
+					break;
+				}
+			}
+		}
+	}
+}
+
+//
+// Feedback trace
+//
+bool SaveFeedbackTrace(const std::string& filePath, const std::vector<std::vector<uint32_t>>& frames)
+{
+	std::ofstream file(filePath, std::ios::binary);
+	if (!file)
+		return false;
+
+	const uint32_t header[2] = { FeedbackTraceMagic, static_cast<uint32_t>(frames.size()) };
+	file.write(reinterpret_cast<const char*>(header), sizeof(header));
+	for (const std::vector<uint32_t>& frame : frames)
+	{
+		const uint32_t count = static_cast<uint32_t>(frame.size());
+		file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+		file.write(reinterpret_cast<const char*>(frame.data()), count * sizeof(uint32_t));
+	}
+	return file.good();
+}
+
+bool LoadFeedbackTrace(const std::string& filePath, std::vector<std::vector<uint32_t>>& outFrames)
+{
+	outFrames.clear();
+
+	std::ifstream file(filePath, std::ios::binary);
+	if (!file)
+		return false;
+
+	uint32_t header[2] = {};
+	file.read(reinterpret_cast<char*>(header), sizeof(header));
+	if (!file || header[0] != FeedbackTraceMagic)
+		return false;
+
+	outFrames.resize(header[1]);
+	for (std::vector<uint32_t>& frame : outFrames)
+	{
+		uint32_t count = 0;
+		file.read(reinterpret_cast<char*>(&count), sizeof(count));
+		if (!file)
+			return false;
+
+		frame.resize(count);
+		file.read(reinterpret_cast<char*>(frame.data()), count * sizeof(uint32_t));
+		if (!file)
+			return false;
+	}
+	return true;
+}
+
+//
+// Synthetic trace and benchmark
+//
+void MakeFeedbackTrace(const FeedbackTraceDesc& desc, std::vector<std::vector<uint32_t>>& outFrames)
+{
+	const uint32_t pages = std::max((desc.textureSize + VirtualPageSize - 1) / VirtualPageSize, 1u);
+	uint32_t numMips = 1;
+	while ((pages >> numMips) > 0)
+	{
+		++numMips;
+	}
+
+	// Ground tiles are 256 units, camera 20 units above it with a 60 degree vertical fov
+	const float tileSize = 256.f;
+	const float texelsPerUnit = desc.textureSize / tileSize;
+	const float worldX = desc.numTexturesX * tileSize;
+	const float worldY = desc.numTexturesY * tileSize;
+	const float cameraHeight = 20.f;
+	const float fovY = 3.14159265f / 3;
+	const float fovX = fovY * desc.width / desc.height;
+	const float pitch = 0.35f;		// Down from the horizon
+	const float pixelAngle = fovY / (desc.height * 16);	// Full resolution pixel
+
+	std::mt19937 rng(desc.seed);
+	std::uniform_real_distribution<float> jitter(-0.5f, 0.5f);
+
+	outFrames.resize(desc.numFrames);
+	for (uint32_t frame = 0; frame < desc.numFrames; ++frame)
+	{
+		// Arc over the world at about a unit per frame, looking along the path
+		const float t = 0.004f * frame;
+		const float cameraX = worldX * (0.5f + 0.3f * cosf(t));
+		const float cameraY = worldY * (0.5f + 0.3f * sinf(t));
+		const float yaw = t + 1.5707963f;
+
+		std::vector<uint32_t>& feedback = outFrames[frame];
+		feedback.assign(static_cast<size_t>(desc.width) * desc.height, VirtualInvalidPage);
+		for (uint32_t y = 0; y < desc.height; ++y)
+		{
+			for (uint32_t x = 0; x < desc.width; ++x)
+			{
+				// Feedback is written by a random pixel of its block
+				const float u = (x + 0.5f + jitter(rng)) / desc.width;
+				const float v = (y + 0.5f + jitter(rng)) / desc.height;
+				const float down = pitch + (v - 0.5f) * fovY;
+				if (down <= 0.01f)
+					continue;
+
+				const float distance = cameraHeight / tanf(down);
+				const float side = (u - 0.5f) * 2.f * tanf(fovX * 0.5f) * distance;
+				const float px = cameraX + cosf(yaw) * distance - sinf(yaw) * side;
+				const float py = cameraY + sinf(yaw) * distance + cosf(yaw) * side;
+				if (px < 0.f || py < 0.f || px >= worldX || py >= worldY)
+					continue;
+
+				// Footprint grows with distance and with grazing angle
+				const float footprint = distance / cosf(down) * pixelAngle / sinf(down) * texelsPerUnit;
+				const uint32_t mip = std::min(static_cast<uint32_t>(std::max(log2f(std::max(footprint, 1.f)), 0.f)), numMips - 1);
+
+				const uint32_t tileX = static_cast<uint32_t>(px / tileSize);
+				const uint32_t tileY = static_cast<uint32_t>(py / tileSize);
+				const float tileU = px / tileSize - tileX;
+				const float tileV = py / tileSize - tileY;
+				const uint32_t mipPages = std::max(pages >> mip, 1u);
+				const uint32_t pageX = std::min(static_cast<uint32_t>(tileU * mipPages), mipPages - 1);
+				const uint32_t pageY = std::min(static_cast<uint32_t>(tileV * mipPages), mipPages - 1);
+				feedback[static_cast<size_t>(y) * desc.width + x] = PackPageId(tileY * desc.numTexturesX + tileX, mip, pageX, pageY);
+			}
+		}
+	}
+}
+
+void RunVirtualTextureBenchmark(const FeedbackTraceDesc& desc, const VirtualTextureCacheInit& init, VirtualTextureBenchmarkResult& outResult)
+{
+	outResult = {};
+
+	std::vector<std::vector<uint32_t>> frames;
+	MakeFeedbackTrace(desc, frames);
+
+	VirtualTextureCache cache;
+	cache.Initialize(init);
+	for (uint32_t i = 0; i < desc.numTexturesX * desc.numTexturesY; ++i)
+	{
+		cache.AddTexture({ desc.textureSize, desc.textureSize });
+	}
+
+	VirtualTextureUpdate update;
+	std::vector<uint32_t> texels;
+	uint64_t numUnique = 0, numResident = 0;
+	for (const std::vector<uint32_t>& feedback : frames)
+	{
+		cache.AnalyzeFeedback(feedback.data(), feedback.size(), update);
+
+		auto start = TimerClock::now();
+		for (uint32_t textureId : update.dirtyTextures)
+		{
+			cache.BuildPageTable(textureId, 0, texels);
+		}
+		outResult.pageTableMs += ElapsedMs(start);
+
+		const VirtualTextureStats& stats = cache.Stats();
+		outResult.analyzeMs += stats.analyzeMs;
+		outResult.maxAnalyzeMs = std::max(outResult.maxAnalyzeMs, stats.analyzeMs);
+		outResult.numLoads += stats.numLoads;
+		outResult.numEvictions += stats.numEvictions;
+		numUnique += stats.numUnique;
+		numResident += stats.numResident;
+	}
+	cache.Shutdown();
+
+	outResult.numFrames = static_cast<uint32_t>(frames.size());
+	outResult.feedbackSize = desc.width * desc.height;
+	if (!frames.empty())
+	{
+		outResult.analyzeMs /= frames.size();
+		outResult.pageTableMs /= frames.size();
+	}
+	outResult.hitRate = numUnique ? static_cast<double>(numResident) / numUnique : 1.0;
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "../shaders/HLSLCompatible.h"
+
+// Sparse virtual texturing, CPU side (no D3D dependency)
+// Virtual textures are split into VT_PAGE_SIZE pages per mip, a fixed grid of physical slots caches pages.
+// AnalyzeFeedback takes the downsampled feedback buffer (packed page ids, layout in HLSLCompatible.h),
+// keeps requested pages and their coarser ancestors resident, and decides loads / LRU evictions.
+// BuildPageTable writes the indirection texels virtualtexture.hlsli reads.
+// VirtualTexturing.h drives it from the G-buffer feedback, VirtualTextureTests replays recorded traces.
+
+static const uint32_t VirtualPageSize = VT_PAGE_SIZE;
+static const uint32_t VirtualInvalidPage = VT_INVALID_PAGE;
+
+inline uint32_t PackPageId(uint32_t textureId, uint32_t mip, uint32_t pageX, uint32_t pageY)
+{
+	return ((textureId & VT_TEXTURE_MASK) << VT_TEXTURE_SHIFT) | ((mip & VT_MIP_MASK) << VT_MIP_SHIFT) |
+		((pageX & VT_PAGE_MASK) << VT_PAGE_X_SHIFT) | (pageY & VT_PAGE_MASK);
+}
+
+inline uint32_t PageTexture(uint32_t pageId) { return (pageId >> VT_TEXTURE_SHIFT) & VT_TEXTURE_MASK; }
+inline uint32_t PageMip(uint32_t pageId) { return (pageId >> VT_MIP_SHIFT) & VT_MIP_MASK; }
+inline uint32_t PageX(uint32_t pageId) { return (pageId >> VT_PAGE_X_SHIFT) & VT_PAGE_MASK; }
+inline uint32_t PageY(uint32_t pageId) { return pageId & VT_PAGE_MASK; }
+
+struct VirtualTextureCacheInit
+{
+	uint32_t numSlotsX = 32;			// Physical cache size in pages
+	uint32_t numSlotsY = 32;
+	uint32_t maxLoadsPerFrame = 32;
+};
+
+struct VirtualTextureDesc
+{
+	uint32_t width = 0;		// Virtual size in texels, rounded up to whole pages
+	uint32_t height = 0;
+};
+
+struct VirtualPageLoad
+{
+	uint32_t pageId = VirtualInvalidPage;
+	uint32_t slot = 0;		// slot x = slot % numSlotsX, slot y = slot / numSlotsX
+};
+
+// Work for the owner: evicted pages are already removed, loads must be copied into their slot
+struct VirtualTextureUpdate
+{
+	std::vector<VirtualPageLoad> loads;
+	std::vector<uint32_t> evictions;
+	std::vector<uint32_t> dirtyTextures;	// Page table must be rebuilt
+};
+
+struct VirtualTextureStats
+{
+	uint32_t numFeedback = 0;		// Valid entries in feedback buffer
+	uint32_t numUnique = 0;			// Unique pages incl. ancestors
+	uint32_t numResident = 0;		// Cache hits
+	uint32_t numMissing = 0;
+	uint32_t numLoads = 0;
+	uint32_t numEvictions = 0;
+	double analyzeMs = 0.0;
+};
+
+class VirtualTextureCache
+{
+public:
+	void Initialize(const VirtualTextureCacheInit& init);
+	void Shutdown();
+
+	// Returns texture id used in feedback
+	uint32_t AddTexture(const VirtualTextureDesc& desc);
+
+	void AnalyzeFeedback(const uint32_t* feedback, size_t count, VirtualTextureUpdate& outUpdate);
+
+	// RGBA8 per page (slot x, slot y, resident mip, valid), fallback to closest resident ancestor
+	void BuildPageTable(uint32_t textureId, uint32_t mip, std::vector<uint32_t>& outTexels) const;
+
+	uint32_t NumTextures() const { return static_cast<uint32_t>(m_textures.size()); }
+	uint32_t NumMips(uint32_t textureId) const { return m_textures[textureId].numMips; }
+	uint32_t PagesX(uint32_t textureId, uint32_t mip) const;
+	uint32_t PagesY(uint32_t textureId, uint32_t mip) const;
+	uint32_t NumSlots() const { return static_cast<uint32_t>(m_slots.size()); }
+
+	// Slot holding page, -1 if not resident
+	int32_t FindSlot(uint32_t pageId) const;
+
+	const VirtualTextureStats& Stats() const { return m_stats; }
+
+private:
+	struct Slot
+	{
+		uint32_t pageId = VirtualInvalidPage;
+		uint64_t lastUsedFrame = 0;
+		uint32_t prev = VirtualInvalidPage;	// LRU list, head is least recently used
+		uint32_t next = VirtualInvalidPage;
+	};
+
+	struct TextureInfo
+	{
+		uint32_t pagesX = 1;	// mip 0
+		uint32_t pagesY = 1;
+		uint32_t numMips = 1;
+		uint32_t firstEntry = 0;
+		std::vector<uint32_t> mipOffsets;
+	};
+
+	uint32_t EntryIndex(uint32_t pageId) const;
+	void Touch(uint32_t slot);
+	void Unlink(uint32_t slot);
+	void PushBack(uint32_t slot);
+
+	VirtualTextureCacheInit m_init;
+	VirtualTextureStats m_stats;
+
+	std::vector<TextureInfo> m_textures;
+	std::vector<int32_t> m_entries;	// Slot per page, all textures and mips
+	std::vector<Slot> m_slots;
+	uint32_t m_lruHead = VirtualInvalidPage;
+	uint32_t m_lruTail = VirtualInvalidPage;
+	uint64_t m_frameIndex = 0;
+
+	// Scratch, reused across frames
+	std::vector<uint32_t> m_requests;
+	std::vector<std::pair<uint32_t, uint32_t>> m_missing;	// page id, request count
+};
+
+// Recorded feedback, one buffer per frame, replayed headless through AnalyzeFeedback
+bool SaveFeedbackTrace(const std::string& filePath, const std::vector<std::vector<uint32_t>>& frames);
+bool LoadFeedbackTrace(const std::string& filePath, std::vector<std::vector<uint32_t>>& outFrames);
+
+// Synthetic feedback of a camera flying over a ground plane tiled with square virtual textures,
+// invalid entries above the horizon. Fixed seed, same desc always gives the same frames
+struct FeedbackTraceDesc
+{
+	uint32_t numTexturesX = 4;		// Tiles, texture id is y * numTexturesX + x
+	uint32_t numTexturesY = 4;
+	uint32_t textureSize = 16384;	// Texels per side
+	uint32_t width = 120;			// Feedback buffer, 1080p / 16
+	uint32_t height = 68;
+	uint32_t numFrames = 300;
+	uint32_t seed = 1;
+};
+
+void MakeFeedbackTrace(const FeedbackTraceDesc& desc, std::vector<std::vector<uint32_t>>& outFrames);
+
+struct VirtualTextureBenchmarkResult
+{
+	uint32_t numFrames = 0;
+	uint32_t feedbackSize = 0;		// Entries per frame
+	uint64_t numLoads = 0;
+	uint64_t numEvictions = 0;
+	double hitRate = 0.0;			// Resident / unique pages, summed over frames
+	double analyzeMs = 0.0;			// Per frame average
+	double maxAnalyzeMs = 0.0;
+	double pageTableMs = 0.0;		// Per frame average, mip 0 table of every dirty texture
+};
+
+// Replays MakeFeedbackTrace(desc) through a fresh cache
+void RunVirtualTextureBenchmark(const FeedbackTraceDesc& desc, const VirtualTextureCacheInit& init, VirtualTextureBenchmarkResult& outResult);
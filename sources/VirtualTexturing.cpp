@@ -0,0 +1,360 @@
+#include "VirtualTexturing.h"
+#include "Utility.h"
+#include "DX12.h"
+#include "Helper.h"
+
+#include <assert.h>
+
+using Microsoft::WRL::ComPtr;
+
+static const uint32_t SlotSize = VT_PAGE_SIZE + 2 * VT_PAGE_BORDER;
+static const uint32_t TexelBytes = 4;	// R8G8B8A8
+
+void VirtualTexturing::Initialize(const VirtualTexturingInit& init)
+{
+	m_init = init;
+	m_cache.Initialize(init.cache);
+
+	// Bound by the G-buffer pass even without virtual textures
+	StructuredBufferInit sbi;
+	sbi.cpuAccessible = true;
+	sbi.stride = sizeof(VirtualTextureInfo);
+	sbi.numElements = std::max(init.maxTextures, 1u);
+	sbi.name = L"VirtualTextureInfo";
+	m_infoBuffer.Initialize(sbi);
+
+	m_pageRowPitch = static_cast<uint32_t>(AlignTo(SlotSize * TexelBytes, D3D12_TEXTURE_DATA_PITCH_ALIGNMENT));
+	m_feedbackPending = false;
+	m_recording = false;
+}
+
+void VirtualTexturing::Shutdown()
+{
+	for (VirtualTexture& texture : m_textures)
+	{
+		texture.pageTable.Shutdown();
+	}
+	m_textures.clear();
+	m_cache.Shutdown();
+	m_infoBuffer.Shutdown();
+
+	if (m_physicalCache)
+	{
+		srvDescriptorHeap.Free(m_physicalSRV.descriptorIndex);
+		m_physicalCache = nullptr;
+	}
+	m_pageUpload.Shutdown();
+
+	if (m_feedback)
+	{
+		srvDescriptorHeap.Free(m_feedbackUAV.descriptorIndex);
+		m_feedback = nullptr;
+	}
+	m_clearUpload.Shutdown();
+	m_feedbackReadback = nullptr;
+	m_feedbackData = nullptr;
+	m_feedbackPending = false;
+	m_recording = false;
+}
+
+bool VirtualTexturing::CanVirtualize(uint32_t width, uint32_t height, uint32_t numMips, DXGI_FORMAT format)
+{
+	if (format != DXGI_FORMAT_R8G8B8A8_UNORM || width != height || (width & (width - 1)) != 0 ||
+		width < 2 * VT_PAGE_SIZE || width / VT_PAGE_SIZE > VT_PAGE_MASK + 1)
+	{
+		return false;
+	}
+
+	// Source levels down to the one page mip
+	uint32_t pageMips = 1;
+	while ((width / VT_PAGE_SIZE) >> pageMips)
+	{
+		++pageMips;
+	}
+	return numMips >= pageMips;
+}
+
+uint32_t VirtualTexturing::AddTexture(const VirtualTextureSource& source)
+{
+	assert(m_textures.size() < m_init.maxTextures);
+	assert(source.mips != nullptr);
+
+	// Physical cache and page staging, only when a texture is virtual
+	if (!m_physicalCache)
+	{
+		D3D12_RESOURCE_DESC cacheDesc = CD3DX12_RESOURCE_DESC::Tex2D(
+			DXGI_FORMAT_R8G8B8A8_UNORM,
+			m_init.cache.numSlotsX * SlotSize,
+			m_init.cache.numSlotsY * SlotSize,
+			1, 1);
+
+		CheckHRESULT(d3dDevice->CreateCommittedResource(
+			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+			D3D12_HEAP_FLAG_NONE,
+			&cacheDesc,
+			D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
+			nullptr,
+			IID_PPV_ARGS(&m_physicalCache)));
+		m_physicalCache->SetName(L"VirtualTexturePhysicalCache");
+
+		D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+		srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+		srvDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+		srvDesc.Texture2D.MipLevels = 1;
+		m_physicalSRV = srvDescriptorHeap.Allocate();
+		d3dDevice->CreateShaderResourceView(m_physicalCache.Get(), &srvDesc, m_physicalSRV.cpuHandle);
+
+		const uint64_t pageBytes = AlignTo(static_cast<uint64_t>(m_pageRowPitch) * SlotSize, D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT);
+		m_pageUpload.Initialize(pageBytes * m_init.cache.maxLoadsPerFrame, 1, true, false, nullptr,
+			D3D12_RESOURCE_STATE_GENERIC_READ, L"VirtualTexturePageUpload");
+	}
+
+	VirtualTextureDesc desc;
+	desc.width = source.size;
+	desc.height = source.size;
+	const uint32_t textureId = m_cache.AddTexture(desc);
+	assert(textureId == m_textures.size());
+
+	// Nothing is resident yet, every texel is invalid
+	VirtualTexture texture;
+	texture.source = source;
+	const uint32_t numMips = m_cache.NumMips(textureId);
+	texture.texels.resize(numMips);
+	texture.texelData.resize(numMips);
+	for (uint32_t mip = 0; mip < numMips; ++mip)
+	{
+		m_cache.BuildPageTable(textureId, mip, texture.texels[mip]);
+		texture.texelData[mip].pData = texture.texels[mip].data();
+		texture.texelData[mip].RowPitch = m_cache.PagesX(textureId, mip) * TexelBytes;
+		texture.texelData[mip].SlicePitch = texture.texelData[mip].RowPitch * m_cache.PagesY(textureId, mip);
+	}
+
+	TextureInit ti;
+	ti.width = m_cache.PagesX(textureId, 0);
+	ti.height = m_cache.PagesY(textureId, 0);
+	ti.numMips = numMips;
+	ti.format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	ti.mipData = texture.texelData.data();
+	texture.pageTable.Initialize(ti);
+	texture.pageTable.resource->SetName(L"VirtualTexturePageTable");
+
+	VirtualTextureInfo& info = reinterpret_cast<VirtualTextureInfo*>(m_infoBuffer.internalBuffer.cpuAddress)[textureId];
+	info.textureId = textureId;
+	info.pageTableIndex = texture.pageTable.SRV;
+	info.physicalIndex = m_physicalSRV.descriptorIndex;
+	info.numMips = numMips;
+	info.sizeInPages = XMFLOAT2(static_cast<float>(ti.width), static_cast<float>(ti.height));
+	info.physicalSlots = XMFLOAT2(static_cast<float>(m_init.cache.numSlotsX), static_cast<float>(m_init.cache.numSlotsY));
+
+	m_textures.push_back(std::move(texture));
+	return textureId;
+}
+
+void VirtualTexturing::SetScreenSize(uint32_t width, uint32_t height)
+{
+	const uint32_t feedbackWidth = (width + VT_FEEDBACK_SCALE - 1) / VT_FEEDBACK_SCALE;
+	const uint32_t feedbackHeight = (height + VT_FEEDBACK_SCALE - 1) / VT_FEEDBACK_SCALE;
+	if (m_feedback && feedbackWidth == m_feedbackWidth && feedbackHeight == m_feedbackHeight)
+	{
+		return;
+	}
+
+	if (m_feedback)
+	{
+		srvDescriptorHeap.Free(m_feedbackUAV.descriptorIndex);
+	}
+	m_feedbackWidth = feedbackWidth;
+	m_feedbackHeight = feedbackHeight;
+	m_feedbackPending = false;
+	m_recording = false;
+
+	D3D12_RESOURCE_DESC feedbackDesc = CD3DX12_RESOURCE_DESC::Tex2D(
+		DXGI_FORMAT_R32_UINT, feedbackWidth, feedbackHeight, 1, 1, 1, 0,
+		D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+
+	CheckHRESULT(d3dDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&feedbackDesc,
+		D3D12_RESOURCE_STATE_COPY_DEST,
+		nullptr,
+		IID_PPV_ARGS(&m_feedback)));
+	m_feedback->SetName(L"VirtualTextureFeedback");
+	m_feedbackState = D3D12_RESOURCE_STATE_COPY_DEST;
+
+	D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+	uavDesc.Format = DXGI_FORMAT_R32_UINT;
+	uavDesc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D;
+	m_feedbackUAV = srvDescriptorHeap.Allocate();
+	d3dDevice->CreateUnorderedAccessView(m_feedback.Get(), nullptr, &uavDesc, m_feedbackUAV.cpuHandle);
+
+	// Clear source and readback share the footprint
+	UINT64 feedbackBytes = 0;
+	d3dDevice->GetCopyableFootprints(&feedbackDesc, 0, 1, 0, &m_feedbackFootprint, nullptr, nullptr, &feedbackBytes);
+
+	std::vector<uint8_t> invalidPages(feedbackBytes, 0xFF);
+	m_clearUpload.Initialize(feedbackBytes, 1, true, false, invalidPages.data(),
+		D3D12_RESOURCE_STATE_GENERIC_READ, L"VirtualTextureFeedbackClear");
+
+	m_feedbackData = static_cast<const uint8_t*>(CreateReadbackBuffer(
+		m_feedbackReadback,
+		feedbackBytes,
+		L"VirtualTextureFeedbackReadback"));
+}
+
+// Page texels and the border from its neighbours, the texture wraps
+void VirtualTexturing::CopyPage(const VirtualPageLoad& load, uint8_t* dst, uint32_t dstRowPitch) const
+{
+	const uint32_t mip = PageMip(load.pageId);
+	const D3D12_SUBRESOURCE_DATA& level = m_textures[PageTexture(load.pageId)].source.mips[mip];
+	const int32_t mipSize = static_cast<int32_t>(m_textures[PageTexture(load.pageId)].source.size >> mip);
+	const int32_t originX = static_cast<int32_t>(PageX(load.pageId) * VT_PAGE_SIZE) - VT_PAGE_BORDER;
+	const int32_t originY = static_cast<int32_t>(PageY(load.pageId) * VT_PAGE_SIZE) - VT_PAGE_BORDER;
+
+	for (uint32_t y = 0; y < SlotSize; ++y)
+	{
+		const int32_t srcY = (originY + static_cast<int32_t>(y) + mipSize) % mipSize;
+		const uint8_t* srcRow = static_cast<const uint8_t*>(level.pData) + static_cast<size_t>(srcY) * level.RowPitch;
+		uint8_t* dstRow = dst + static_cast<size_t>(y) * dstRowPitch;
+		for (uint32_t x = 0; x < SlotSize; ++x)
+		{
+			const int32_t srcX = (originX + static_cast<int32_t>(x) + mipSize) % mipSize;
+			memcpy(dstRow + x * TexelBytes, srcRow + srcX * TexelBytes, TexelBytes);
+		}
+	}
+}
+
+void VirtualTexturing::Update()
+{
+	if (m_textures.empty())
+	{
+		return;
+	}
+	assert(m_feedback && !m_recording);
+
+	// Page staging, page table uploads and the readback are reused in place
+	assert(gpuIdle);
+
+	m_update.loads.clear();
+	m_update.dirtyTextures.clear();
+	if (m_feedbackPending)
+	{
+		m_feedbackScratch.resize(static_cast<size_t>(m_feedbackWidth) * m_feedbackHeight);
+		for (uint32_t y = 0; y < m_feedbackHeight; ++y)
+		{
+			memcpy(
+				&m_feedbackScratch[static_cast<size_t>(y) * m_feedbackWidth],
+				m_feedbackData + m_feedbackFootprint.Offset + static_cast<size_t>(y) * m_feedbackFootprint.Footprint.RowPitch,
+				m_feedbackWidth * sizeof(uint32_t));
+		}
+		m_cache.AnalyzeFeedback(m_feedbackScratch.data(), m_feedbackScratch.size(), m_update);
+		m_feedbackPending = false;
+	}
+
+	if (!m_update.loads.empty())
+	{
+		D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(
+			m_physicalCache.Get(),
+			D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
+			D3D12_RESOURCE_STATE_COPY_DEST);
+		commandList->ResourceBarrier(1, &barrier);
+
+		const uint64_t pageBytes = AlignTo(static_cast<uint64_t>(m_pageRowPitch) * SlotSize, D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT);
+		for (size_t i = 0; i < m_update.loads.size(); ++i)
+		{
+			const VirtualPageLoad& load = m_update.loads[i];
+			CopyPage(load, m_pageUpload.cpuAddress + i * pageBytes, m_pageRowPitch);
+
+			D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint = {};
+			footprint.Offset = i * pageBytes;
+			footprint.Footprint = CD3DX12_SUBRESOURCE_FOOTPRINT(DXGI_FORMAT_R8G8B8A8_UNORM, SlotSize, SlotSize, 1, m_pageRowPitch);
+
+			CD3DX12_TEXTURE_COPY_LOCATION dst(m_physicalCache.Get(), 0);
+			CD3DX12_TEXTURE_COPY_LOCATION src(m_pageUpload.resource.Get(), footprint);
+			commandList->CopyTextureRegion(
+				&dst,
+				(load.slot % m_init.cache.numSlotsX) * SlotSize,
+				(load.slot / m_init.cache.numSlotsX) * SlotSize,
+				0, &src, nullptr);
+		}
+
+		barrier = CD3DX12_RESOURCE_BARRIER::Transition(
+			m_physicalCache.Get(),
+			D3D12_RESOURCE_STATE_COPY_DEST,
+			D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+		commandList->ResourceBarrier(1, &barrier);
+	}
+
+	// Every mip of a dirty texture, evicted pages fall back to their ancestors
+	for (uint32_t textureId : m_update.dirtyTextures)
+	{
+		VirtualTexture& texture = m_textures[textureId];
+		for (uint32_t mip = 0; mip < texture.texels.size(); ++mip)
+		{
+			m_cache.BuildPageTable(textureId, mip, texture.texels[mip]);
+			texture.texelData[mip].pData = texture.texels[mip].data();
+		}
+
+		ID3D12Resource* pageTable = texture.pageTable.resource.Get();
+		D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(
+			pageTable,
+			D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
+			D3D12_RESOURCE_STATE_COPY_DEST);
+		commandList->ResourceBarrier(1, &barrier);
+
+		UpdateSubresources(commandList.Get(), pageTable, texture.pageTable.upload.Get(), 0, 0,
+			static_cast<UINT>(texture.texelData.size()), texture.texelData.data());
+
+		barrier = CD3DX12_RESOURCE_BARRIER::Transition(
+			pageTable,
+			D3D12_RESOURCE_STATE_COPY_DEST,
+			D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+		commandList->ResourceBarrier(1, &barrier);
+	}
+
+	// Blocks without a virtual texture keep VT_INVALID_PAGE
+	if (m_feedbackState != D3D12_RESOURCE_STATE_COPY_DEST)
+	{
+		D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(
+			m_feedback.Get(),
+			m_feedbackState,
+			D3D12_RESOURCE_STATE_COPY_DEST);
+		commandList->ResourceBarrier(1, &barrier);
+	}
+
+	CD3DX12_TEXTURE_COPY_LOCATION dst(m_feedback.Get(), 0);
+	CD3DX12_TEXTURE_COPY_LOCATION src(m_clearUpload.resource.Get(), m_feedbackFootprint);
+	commandList->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+
+	D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(
+		m_feedback.Get(),
+		D3D12_RESOURCE_STATE_COPY_DEST,
+		D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	commandList->ResourceBarrier(1, &barrier);
+
+	m_feedbackState = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
+	m_recording = true;
+}
+
+void VirtualTexturing::EndFrame()
+{
+	if (!m_recording)
+	{
+		return;
+	}
+
+	D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(
+		m_feedback.Get(),
+		D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+		D3D12_RESOURCE_STATE_COPY_SOURCE);
+	commandList->ResourceBarrier(1, &barrier);
+
+	CD3DX12_TEXTURE_COPY_LOCATION dst(m_feedbackReadback.Get(), m_feedbackFootprint);
+	CD3DX12_TEXTURE_COPY_LOCATION src(m_feedback.Get(), 0);
+	commandList->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+
+	m_feedbackState = D3D12_RESOURCE_STATE_COPY_SOURCE;
+	m_recording = false;
+	m_feedbackPending = true;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "PCH.h"
+#include "GraphicsTypes.h"
+#include "VirtualTexture.h"
+
+// Virtual texturing on the GPU (virtualtexture.hlsli), VirtualTexture.h is the cache and feedback analysis
+// The G-buffer pass samples virtual textures through their page table and writes one page request
+// per VT_FEEDBACK_SCALE pixel block. Update analyzes the feedback of the last completed frame,
+// copies loaded pages from the CPU mip chain into the physical cache and rewrites dirty page tables.
+
+struct VirtualTexturingInit
+{
+	uint32_t maxTextures = 0;
+	VirtualTextureCacheInit cache = { 16, 16, 32 };		// 2176 x 2176 RGBA8 physical cache
+};
+
+// Source pages, must outlive the virtual texture (TextureResource::mips)
+struct VirtualTextureSource
+{
+	uint32_t size = 0;		// Square, see CanVirtualize
+	const D3D12_SUBRESOURCE_DATA* mips = nullptr;	// R8G8B8A8, every level down to one page
+};
+
+class VirtualTexturing
+{
+public:
+	void Initialize(const VirtualTexturingInit& init);
+	void Shutdown();
+
+	// Page level mips need a power of two square of at least two pages, one page per side at the last mip
+	static bool CanVirtualize(uint32_t width, uint32_t height, uint32_t numMips, DXGI_FORMAT format);
+
+	// Returns the VirtualTextureInfo index, MaterialData::albedoVirtualTexture
+	uint32_t AddTexture(const VirtualTextureSource& source);
+
+	// Feedback texture of the render target, call again when it's resized
+	void SetScreenSize(uint32_t width, uint32_t height);
+
+	// Last frame's feedback is analyzed, pages and page tables are copied and the feedback is cleared
+	// Call after the command list is reset, before the G-buffer pass
+	void Update();
+
+	// After the G-buffer pass, copies the feedback for the next Update
+	void EndFrame();
+
+	uint32_t NumTextures() const { return static_cast<uint32_t>(m_textures.size()); }
+	uint64_t InfoBuffer() const { return m_infoBuffer.internalBuffer.gpuAddress; }
+	D3D12_GPU_DESCRIPTOR_HANDLE FeedbackUAV() const { return m_feedbackUAV.gpuHandle; }
+	const VirtualTextureStats& Stats() const { return m_cache.Stats(); }
+
+private:
+	struct VirtualTexture
+	{
+		VirtualTextureSource source;
+		Texture pageTable;	// Keeps its upload buffer, rewritten in place
+		std::vector<std::vector<uint32_t>> texels;		// Per mip
+		std::vector<D3D12_SUBRESOURCE_DATA> texelData;
+	};
+
+	void CopyPage(const VirtualPageLoad& load, uint8_t* dst, uint32_t dstRowPitch) const;
+
+	VirtualTexturingInit m_init;
+	VirtualTextureCache m_cache;
+	VirtualTextureUpdate m_update;
+	std::vector<VirtualTexture> m_textures;
+	StructuredBuffer m_infoBuffer;	// Upload heap, VirtualTextureInfo per texture
+
+	// Slots of VT_PAGE_SIZE + 2 * VT_PAGE_BORDER texels, the border is copied from neighbour pages
+	Microsoft::WRL::ComPtr<ID3D12Resource> m_physicalCache;
+	DescriptorAlloc m_physicalSRV;
+	Buffer m_pageUpload;		// maxLoadsPerFrame slots
+	uint32_t m_pageRowPitch = 0;
+
+	// R32_UINT page ids, cleared to VT_INVALID_PAGE by a copy from m_clearUpload
+	Microsoft::WRL::ComPtr<ID3D12Resource> m_feedback;
+	DescriptorAlloc m_feedbackUAV;
+	Buffer m_clearUpload;
+	Microsoft::WRL::ComPtr<ID3D12Resource> m_feedbackReadback;
+	D3D12_PLACED_SUBRESOURCE_FOOTPRINT m_feedbackFootprint = {};
+	const uint8_t* m_feedbackData = nullptr;
+	std::vector<uint32_t> m_feedbackScratch;
+	uint32_t m_feedbackWidth = 0;
+	uint32_t m_feedbackHeight = 0;
+	D3D12_RESOURCE_STATES m_feedbackState = D3D12_RESOURCE_STATE_COPY_DEST;
+	bool m_recording = false;		// Update cleared the feedback, EndFrame copies it
+	bool m_feedbackPending = false;
+};
@@ -0,0 +1,726 @@
+#include "WideBVH.h"
+#include "Culling.h"
+#include "Utility.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+#include <random>
+#include <string.h>
+#include <immintrin.h>
+
+using namespace DirectX;
+
+namespace
+{
+	// Dequantized boxes are conservative, slab distances are not, rounding is covered by a relative margin
+	const float FarScale = 1.f + 8.f * FLT_EPSILON;
+
+	// Per ray constants of the slab and watertight triangle tests
+	struct WideRay
+	{
+		float origin[3];
+		float invDir[3];	// Zero components replaced by a tiny value, no 0 * inf in the slab test
+		float tMin;
+		int kx, ky, kz;		// kz is the dominant axis
+		float shearX, shearY, shearZ;
+	};
+
+	struct StackEntry
+	{
+		uint32_t child;
+		uint32_t numTriangles;	// 0 for nodes
+		float tEntry;
+	};
+}
+
+static float HalfArea(const TriangleBVHNode& node)
+{
+	const float dx = node.boundsMax.x - node.boundsMin.x;
+	const float dy = node.boundsMax.y - node.boundsMin.y;
+	const float dz = node.boundsMax.z - node.boundsMin.z;
+	return dx * dy + dy * dz + dz * dx;
+}
+
+static float ExponentScale(int8_t exponent)
+{
+	const uint32_t bits = static_cast<uint32_t>(exponent + 127) << 23;
+	float scale;
+	memcpy(&scale, &bits, sizeof(scale));
+	return scale;
+}
+
+//
+// Build
+//
+
+// Smallest power of two step covering the extent in 255 steps, exact so quantization error only
+// comes from the floor and ceil
+static int8_t QuantizationExponent(float origin, float boundsMax)
+{
+	const float extent = boundsMax - origin;
+	int exponent = -126;
+	if (extent > 0.f)
+	{
+		frexpf(extent / 255.f, &exponent);
+		exponent = std::max(exponent, -126);
+	}
+	while (exponent < 127 && origin + 255.f * ExponentScale(static_cast<int8_t>(exponent)) < boundsMax)
+	{
+		++exponent;
+	}
+	return static_cast<int8_t>(exponent);
+}
+
+template<uint32_t Width>
+static void QuantizeChildren(WideBVHNode<Width>& node, const TriangleBVHNode* const* children, uint32_t numChildren)
+{
+	XMFLOAT3 boundsMin(FLT_MAX, FLT_MAX, FLT_MAX);
+	XMFLOAT3 boundsMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (uint32_t i = 0; i < numChildren; ++i)
+	{
+		boundsMin = XMFLOAT3(std::min(boundsMin.x, children[i]->boundsMin.x), std::min(boundsMin.y, children[i]->boundsMin.y), std::min(boundsMin.z, children[i]->boundsMin.z));
+		boundsMax = XMFLOAT3(std::max(boundsMax.x, children[i]->boundsMax.x), std::max(boundsMax.y, children[i]->boundsMax.y), std::max(boundsMax.z, children[i]->boundsMax.z));
+	}
+
+	node.origin = boundsMin;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const float origin = (&boundsMin.x)[axis];
+		node.exponent[axis] = QuantizationExponent(origin, (&boundsMax.x)[axis]);
+		const float scale = ExponentScale(node.exponent[axis]);
+		for (uint32_t i = 0; i < numChildren; ++i)
+		{
+			const float childMin = (&children[i]->boundsMin.x)[axis];
+			const float childMax = (&children[i]->boundsMax.x)[axis];
+			int qMin = std::min(std::max(static_cast<int>(floorf((childMin - origin) / scale)), 0), 255);
+			int qMax = std::min(std::max(static_cast<int>(ceilf((childMax - origin) / scale)), 0), 255);
+			while (qMin > 0 && origin + qMin * scale > childMin)
+			{
+				--qMin;
+			}
+			while (qMax < 255 && origin + qMax * scale < childMax)
+			{
+				++qMax;
+			}
+			node.childMin[axis][i] = static_cast<uint8_t>(qMin);
+			node.childMax[axis][i] = static_cast<uint8_t>(qMax);
+		}
+	}
+}
+
+// Every wide node opens the binary children with the largest area until Width are reached, leaves
+// keep their binary triangle range. Children are stored after their parent
+template<uint32_t NodeWidth>
+void WideBVH::Collapse(const TriangleBVH& bvh, std::vector<WideBVHNode<NodeWidth>>& nodes)
+{
+	const std::vector<TriangleBVHNode>& binaryNodes = bvh.Nodes();
+	nodes.clear();
+	nodes.reserve(binaryNodes.size() / 2 + 1);
+	nodes.emplace_back();
+
+	std::vector<std::pair<uint32_t, uint32_t>> stack = { { 0u, 0u } };	// Wide node, binary node
+	while (!stack.empty())
+	{
+		const uint32_t wideIndex = stack.back().first;
+		const uint32_t binaryIndex = stack.back().second;
+		stack.pop_back();
+
+		// A binary leaf only becomes a node at the root
+		uint32_t children[NodeWidth];
+		uint32_t numChildren = 0;
+		const TriangleBVHNode& binaryNode = binaryNodes[binaryIndex];
+		if (binaryNode.IsLeaf())
+		{
+			children[numChildren++] = binaryIndex;
+		}
+		else
+		{
+			children[numChildren++] = binaryNode.leftFirst;
+			children[numChildren++] = binaryNode.leftFirst + 1;
+		}
+		while (numChildren < NodeWidth)
+		{
+			int largest = -1;
+			float largestArea = -1.f;
+			for (uint32_t i = 0; i < numChildren; ++i)
+			{
+				const TriangleBVHNode& child = binaryNodes[children[i]];
+				if (!child.IsLeaf() && HalfArea(child) > largestArea)
+				{
+					largest = static_cast<int>(i);
+					largestArea = HalfArea(child);
+				}
+			}
+			if (largest < 0)
+				break;
+
+			const uint32_t opened = children[largest];
+			children[largest] = binaryNodes[opened].leftFirst;
+			children[numChildren++] = binaryNodes[opened].leftFirst + 1;
+		}
+
+		WideBVHNode<NodeWidth> node = {};
+		const TriangleBVHNode* childNodes[NodeWidth];
+		for (uint32_t i = 0; i < numChildren; ++i)
+		{
+			childNodes[i] = &binaryNodes[children[i]];
+		}
+		QuantizeChildren(node, childNodes, numChildren);
+		node.numChildren = static_cast<uint8_t>(numChildren);
+		for (uint32_t i = 0; i < numChildren; ++i)
+		{
+			const TriangleBVHNode& child = *childNodes[i];
+			if (child.IsLeaf())
+			{
+				assert(child.numTriangles <= 0xFF);
+				node.child[i] = child.leftFirst;
+				node.numTriangles[i] = static_cast<uint8_t>(child.numTriangles);
+				++m_stats.numLeaves;
+				continue;
+			}
+			node.child[i] = static_cast<uint32_t>(nodes.size());
+			nodes.emplace_back();
+			stack.push_back({ node.child[i], children[i] });
+		}
+		nodes[wideIndex] = node;
+	}
+}
+
+void WideBVH::Clear()
+{
+	m_nodes4.clear();
+	m_nodes8.clear();
+	m_triangles.clear();
+	m_triIndices.clear();
+	m_width = 0;
+	m_numNodes = 0;
+	m_stats = {};
+}
+
+void WideBVH::Build(const TriangleBVH& bvh, const TriangleMesh& mesh, uint32_t width)
+{
+	assert(width == 4 || width == 8);
+	auto start = TimerClock::now();
+	Clear();
+	if (bvh.IsEmpty())
+	{
+		return;
+	}
+
+	m_width = width;
+	if (width == 8)
+	{
+		Collapse(bvh, m_nodes8);
+		m_numNodes = static_cast<uint32_t>(m_nodes8.size());
+		m_stats.nodeBytes = m_nodes8.size() * sizeof(WideBVHNode<8>);
+	}
+	else
+	{
+		Collapse(bvh, m_nodes4);
+		m_numNodes = static_cast<uint32_t>(m_nodes4.size());
+		m_stats.nodeBytes = m_nodes4.size() * sizeof(WideBVHNode<4>);
+	}
+
+	// Same leaf order as the binary tree
+	m_triIndices = bvh.TriangleIndices();
+	m_triangles.resize(m_triIndices.size());
+	for (size_t i = 0; i < m_triIndices.size(); ++i)
+	{
+		const uint32_t triangle = m_triIndices[i];
+		m_triangles[i] = { mesh.Vertex(mesh.indices[triangle * 3 + 0]), mesh.Vertex(mesh.indices[triangle * 3 + 1]), mesh.Vertex(mesh.indices[triangle * 3 + 2]) };
+	}
+
+	m_stats.width = width;
+	m_stats.numNodes = m_numNodes;
+	m_stats.averageChildren = static_cast<float>(m_numNodes - 1 + m_stats.numLeaves) / m_numNodes;
+	m_stats.buildMs = ElapsedMs(start);
+}
+
+//
+// Traversal
+//
+static WideRay MakeWideRay(const BVHRay& bvhRay)
+{
+	WideRay ray;
+	const float* direction = &bvhRay.direction.x;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		ray.origin[axis] = (&bvhRay.origin.x)[axis];
+		ray.invDir[axis] = 1.f / ((fabsf(direction[axis]) < 1e-20f) ? copysignf(1e-20f, direction[axis]) : direction[axis]);
+	}
+	ray.tMin = bvhRay.tMin;
+
+	// Largest axis becomes z, x and y swapped on negative z to keep the winding
+	ray.kz = (fabsf(direction[0]) > fabsf(direction[1])) ? ((fabsf(direction[0]) > fabsf(direction[2])) ? 0 : 2) : ((fabsf(direction[1]) > fabsf(direction[2])) ? 1 : 2);
+	ray.kx = (ray.kz + 1) % 3;
+	ray.ky = (ray.kx + 1) % 3;
+	if (direction[ray.kz] < 0.f)
+	{
+		std::swap(ray.kx, ray.ky);
+	}
+	ray.shearX = direction[ray.kx] / direction[ray.kz];
+	ray.shearY = direction[ray.ky] / direction[ray.kz];
+	ray.shearZ = 1.f / direction[ray.kz];
+	return ray;
+}
+
+// Woop, Benthin and Wald, "Watertight Ray/Triangle Intersection". Edge functions fall back to
+// double when exactly zero, so a ray through a shared edge or vertex hits exactly one side
+static bool IntersectTriangleWatertight(const WideRay& ray, const WideBVH::Triangle& triangle, float tMin, float tMax, float& t, float& u, float& v, bool& backFace)
+{
+	const float* p0 = &triangle.v0.x;
+	const float* p1 = &triangle.v1.x;
+	const float* p2 = &triangle.v2.x;
+	const float a[3] = { p0[0] - ray.origin[0], p0[1] - ray.origin[1], p0[2] - ray.origin[2] };
+	const float b[3] = { p1[0] - ray.origin[0], p1[1] - ray.origin[1], p1[2] - ray.origin[2] };
+	const float c[3] = { p2[0] - ray.origin[0], p2[1] - ray.origin[1], p2[2] - ray.origin[2] };
+
+	const float ax = a[ray.kx] - ray.shearX * a[ray.kz], ay = a[ray.ky] - ray.shearY * a[ray.kz];
+	const float bx = b[ray.kx] - ray.shearX * b[ray.kz], by = b[ray.ky] - ray.shearY * b[ray.kz];
+	const float cx = c[ray.kx] - ray.shearX * c[ray.kz], cy = c[ray.ky] - ray.shearY * c[ray.kz];
+
+	float edgeU = cx * by - cy * bx;
+	float edgeV = ax * cy - ay * cx;
+	float edgeW = bx * ay - by * ax;
+	if (edgeU == 0.f || edgeV == 0.f || edgeW == 0.f)
+	{
+		edgeU = static_cast<float>(static_cast<double>(cx) * by - static_cast<double>(cy) * bx);
+		edgeV = static_cast<float>(static_cast<double>(ax) * cy - static_cast<double>(ay) * cx);
+		edgeW = static_cast<float>(static_cast<double>(bx) * ay - static_cast<double>(by) * ax);
+	}
+	if ((edgeU < 0.f || edgeV < 0.f || edgeW < 0.f) && (edgeU > 0.f || edgeV > 0.f || edgeW > 0.f))
+		return false;
+
+	const float det = edgeU + edgeV + edgeW;
+	if (det == 0.f)
+		return false;
+
+	const float az = ray.shearZ * a[ray.kz];
+	const float bz = ray.shearZ * b[ray.kz];
+	const float cz = ray.shearZ * c[ray.kz];
+	const float invDet = 1.f / det;
+	t = (edgeU * az + edgeV * bz + edgeW * cz) * invDet;
+	if (!(t >= tMin && t < tMax))
+		return false;
+
+	u = edgeV * invDet;
+	v = edgeW * invDet;
+	backFace = det < 0.f;
+	return true;
+}
+
+// Child tests, mask of hit children and their entry distances. All three do the same operations
+// in the same order (no FMA) so they agree exactly
+template<uint32_t Width>
+static uint32_t ChildHitsScalar(const WideBVHNode<Width>& node, const WideRay& ray, float tMax, float* tNear)
+{
+	float scale[3], offset[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		scale[axis] = ExponentScale(node.exponent[axis]) * ray.invDir[axis];
+		offset[axis] = ((&node.origin.x)[axis] - ray.origin[axis]) * ray.invDir[axis];
+	}
+
+	uint32_t mask = 0;
+	for (uint32_t i = 0; i < node.numChildren; ++i)
+	{
+		float tEntry = ray.tMin, tExit = tMax;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			const float t0 = node.childMin[axis][i] * scale[axis] + offset[axis];
+			const float t1 = node.childMax[axis][i] * scale[axis] + offset[axis];
+			tEntry = std::max(tEntry, std::min(t0, t1));
+			tExit = std::min(tExit, std::max(t0, t1));
+		}
+		tNear[i] = tEntry;
+		mask |= (tEntry <= tExit * FarScale) ? (1u << i) : 0u;
+	}
+	return mask;
+}
+
+static __m128 LoadQuantized4(const uint8_t* quantized)
+{
+	int32_t packed;
+	memcpy(&packed, quantized, sizeof(packed));
+	const __m128i zero = _mm_setzero_si128();
+	__m128i wide = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+	wide = _mm_unpacklo_epi16(wide, zero);
+	return _mm_cvtepi32_ps(wide);
+}
+
+static uint32_t ChildHitsSSE(const WideBVHNode<4>& node, const WideRay& ray, float tMax, float* tNear)
+{
+	__m128 tEntry = _mm_set1_ps(ray.tMin);
+	__m128 tExit = _mm_set1_ps(tMax);
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const __m128 scale = _mm_set1_ps(ExponentScale(node.exponent[axis]) * ray.invDir[axis]);
+		const __m128 offset = _mm_set1_ps(((&node.origin.x)[axis] - ray.origin[axis]) * ray.invDir[axis]);
+		const __m128 t0 = _mm_add_ps(_mm_mul_ps(LoadQuantized4(node.childMin[axis]), scale), offset);
+		const __m128 t1 = _mm_add_ps(_mm_mul_ps(LoadQuantized4(node.childMax[axis]), scale), offset);
+		tEntry = _mm_max_ps(tEntry, _mm_min_ps(t0, t1));
+		tExit = _mm_min_ps(tExit, _mm_max_ps(t0, t1));
+	}
+	_mm_storeu_ps(tNear, tEntry);
+	const uint32_t mask = static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(tEntry, _mm_mul_ps(tExit, _mm_set1_ps(FarScale)))));
+	return mask & ((1u << node.numChildren) - 1);
+}
+
+TARGET_AVX2 static uint32_t ChildHitsAVX2(const WideBVHNode<8>& node, const WideRay& ray, float tMax, float* tNear)
+{
+	__m256 tEntry = _mm256_set1_ps(ray.tMin);
+	__m256 tExit = _mm256_set1_ps(tMax);
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const __m256 scale = _mm256_set1_ps(ExponentScale(node.exponent[axis]) * ray.invDir[axis]);
+		const __m256 offset = _mm256_set1_ps(((&node.origin.x)[axis] - ray.origin[axis]) * ray.invDir[axis]);
+		const __m256 qMin = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(node.childMin[axis]))));
+		const __m256 qMax = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(node.childMax[axis]))));
+		const __m256 t0 = _mm256_add_ps(_mm256_mul_ps(qMin, scale), offset);
+		const __m256 t1 = _mm256_add_ps(_mm256_mul_ps(qMax, scale), offset);
+		tEntry = _mm256_max_ps(tEntry, _mm256_min_ps(t0, t1));
+		tExit = _mm256_min_ps(tExit, _mm256_max_ps(t0, t1));
+	}
+	_mm256_storeu_ps(tNear, tEntry);
+	const uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(tEntry, _mm256_mul_ps(tExit, _mm256_set1_ps(FarScale)), _CMP_LE_OQ)));
+	return mask & ((1u << node.numChildren) - 1);
+}
+
+template<uint32_t Width, uint32_t (*ChildHits)(const WideBVHNode<Width>&, const WideRay&, float, float*)>
+static bool IntersectWide(const WideBVHNode<Width>* nodes, const WideBVH::Triangle* triangles, const uint32_t* triIndices, const BVHRay& bvhRay, BVHHit& hit)
+{
+	const WideRay ray = MakeWideRay(bvhRay);
+	float tMax = std::min(bvhRay.tMax, hit.t);
+
+	// Every level adds at most Width - 1 entries
+	StackEntry stack[TriangleBVH::MaxDepth * Width];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = { 0, 0, ray.tMin };
+	bool found = false;
+	while (stackSize > 0)
+	{
+		const StackEntry entry = stack[--stackSize];
+		if (entry.tEntry >= tMax)
+			continue;
+
+		if (entry.numTriangles > 0)
+		{
+			for (uint32_t i = entry.child; i < entry.child + entry.numTriangles; ++i)
+			{
+				float t, u, v;
+				bool backFace;
+				if (IntersectTriangleWatertight(ray, triangles[i], ray.tMin, tMax, t, u, v, backFace))
+				{
+					tMax = t;
+					hit.t = t;
+					hit.u = u;
+					hit.v = v;
+					hit.triangle = triIndices[i];
+					hit.backFace = backFace;
+					found = true;
+				}
+			}
+			continue;
+		}
+
+		const WideBVHNode<Width>& node = nodes[entry.child];
+		float tNear[Width];
+		const uint32_t mask = ChildHits(node, ray, tMax, tNear);
+
+		// Farthest pushed first so the nearest is popped next
+		uint32_t order[Width];
+		uint32_t numHits = 0;
+		for (uint32_t i = 0; i < Width; ++i)
+		{
+			if (!((mask >> i) & 1))
+				continue;
+			uint32_t slot = numHits++;
+			while (slot > 0 && tNear[order[slot - 1]] < tNear[i])
+			{
+				order[slot] = order[slot - 1];
+				--slot;
+			}
+			order[slot] = i;
+		}
+		assert(stackSize + numHits <= TriangleBVH::MaxDepth * Width);
+		for (uint32_t h = 0; h < numHits; ++h)
+		{
+			const uint32_t i = order[h];
+			stack[stackSize++] = { node.child[i], node.numTriangles[i], tNear[i] };
+		}
+	}
+	return found;
+}
+
+template<uint32_t Width, uint32_t (*ChildHits)(const WideBVHNode<Width>&, const WideRay&, float, float*)>
+static bool OccludedWide(const WideBVHNode<Width>* nodes, const WideBVH::Triangle* triangles, const BVHRay& bvhRay)
+{
+	const WideRay ray = MakeWideRay(bvhRay);
+	StackEntry stack[TriangleBVH::MaxDepth * Width];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = { 0, 0, ray.tMin };
+	while (stackSize > 0)
+	{
+		const StackEntry entry = stack[--stackSize];
+		if (entry.numTriangles > 0)
+		{
+			for (uint32_t i = entry.child; i < entry.child + entry.numTriangles; ++i)
+			{
+				float t, u, v;
+				bool backFace;
+				if (IntersectTriangleWatertight(ray, triangles[i], ray.tMin, bvhRay.tMax, t, u, v, backFace))
+					return true;
+			}
+			continue;
+		}
+
+		const WideBVHNode<Width>& node = nodes[entry.child];
+		float tNear[Width];
+		const uint32_t mask = ChildHits(node, ray, bvhRay.tMax, tNear);
+		assert(stackSize + Width <= TriangleBVH::MaxDepth * Width);
+		for (uint32_t i = 0; i < Width; ++i)
+		{
+			if ((mask >> i) & 1)
+				stack[stackSize++] = { node.child[i], node.numTriangles[i], tNear[i] };
+		}
+	}
+	return false;
+}
+
+TARGET_AVX2_FLATTEN static bool IntersectAVX2(const WideBVHNode<8>* nodes, const WideBVH::Triangle* triangles, const uint32_t* triIndices, const BVHRay& ray, BVHHit& hit)
+{
+	return IntersectWide<8, ChildHitsAVX2>(nodes, triangles, triIndices, ray, hit);
+}
+
+TARGET_AVX2_FLATTEN static bool OccludedAVX2(const WideBVHNode<8>* nodes, const WideBVH::Triangle* triangles, const BVHRay& ray)
+{
+	return OccludedWide<8, ChildHitsAVX2>(nodes, triangles, ray);
+}
+
+bool WideBVH::Intersect(const BVHRay& ray, BVHHit& hit, bool useSimd) const
+{
+	if (m_numNodes == 0)
+	{
+		return false;
+	}
+
+	if (m_width == 4)
+	{
+		return useSimd ?
+			IntersectWide<4, ChildHitsSSE>(m_nodes4.data(), m_triangles.data(), m_triIndices.data(), ray, hit) :
+			IntersectWide<4, ChildHitsScalar<4>>(m_nodes4.data(), m_triangles.data(), m_triIndices.data(), ray, hit);
+	}
+	return (useSimd && CpuSupportsAVX2()) ?
+		IntersectAVX2(m_nodes8.data(), m_triangles.data(), m_triIndices.data(), ray, hit) :
+		IntersectWide<8, ChildHitsScalar<8>>(m_nodes8.data(), m_triangles.data(), m_triIndices.data(), ray, hit);
+}
+
+bool WideBVH::Occluded(const BVHRay& ray, bool useSimd) const
+{
+	if (m_numNodes == 0)
+	{
+		return false;
+	}
+
+	if (m_width == 4)
+	{
+		return useSimd ?
+			OccludedWide<4, ChildHitsSSE>(m_nodes4.data(), m_triangles.data(), ray) :
+			OccludedWide<4, ChildHitsScalar<4>>(m_nodes4.data(), m_triangles.data(), ray);
+	}
+	return (useSimd && CpuSupportsAVX2()) ?
+		OccludedAVX2(m_nodes8.data(), m_triangles.data(), ray) :
+		OccludedWide<8, ChildHitsScalar<8>>(m_nodes8.data(), m_triangles.data(), ray);
+}
+
+//
+// Benchmark
+//
+void MakeViewBenchmarkRays(JobSystem& jobs, const TriangleBVH& bvh, const TriangleMesh& mesh, const RayBenchmarkView& view, std::vector<BVHRay> outRays[RayBenchmarkKind_Count])
+{
+	// Pixel centers in 4x4 tiles so consecutive rays are coherent, any depth between the planes
+	// gives the direction
+	const uint32_t numPixels = view.width * view.height;
+	std::vector<uint32_t> pixels;
+	pixels.reserve(numPixels);
+	for (uint32_t tileY = 0; tileY < view.height; tileY += 4)
+	{
+		for (uint32_t tileX = 0; tileX < view.width; tileX += 4)
+		{
+			for (uint32_t y = tileY; y < std::min(tileY + 4, view.height); ++y)
+			{
+				for (uint32_t x = tileX; x < std::min(tileX + 4, view.width); ++x)
+				{
+					pixels.push_back(y * view.width + x);
+				}
+			}
+		}
+	}
+
+	for (uint32_t kind = 0; kind < RayBenchmarkKind_Count; ++kind)
+	{
+		outRays[kind].clear();
+	}
+	outRays[RayBenchmarkKind_Primary].resize(numPixels);
+	const XMFLOAT4X4& m = view.invViewProj;
+	for (uint32_t i = 0; i < numPixels; ++i)
+	{
+		const float x = ((pixels[i] % view.width) + 0.5f) / view.width * 2.f - 1.f;
+		const float y = 1.f - ((pixels[i] / view.width) + 0.5f) / view.height * 2.f;
+		const float z = 0.5f;
+		const float w = x * m.m[0][3] + y * m.m[1][3] + z * m.m[2][3] + m.m[3][3];
+		const XMFLOAT3 target(
+			(x * m.m[0][0] + y * m.m[1][0] + z * m.m[2][0] + m.m[3][0]) / w,
+			(x * m.m[0][1] + y * m.m[1][1] + z * m.m[2][1] + m.m[3][1]) / w,
+			(x * m.m[0][2] + y * m.m[1][2] + z * m.m[2][2] + m.m[3][2]) / w);
+		XMFLOAT3 direction(target.x - view.cameraPosition.x, target.y - view.cameraPosition.y, target.z - view.cameraPosition.z);
+		const float invLength = 1.f / sqrtf(direction.x * direction.x + direction.y * direction.y + direction.z * direction.z);
+		BVHRay& ray = outRays[RayBenchmarkKind_Primary][i];
+		ray.origin = view.cameraPosition;
+		ray.direction = XMFLOAT3(direction.x * invLength, direction.y * invLength, direction.z * invLength);
+	}
+
+	std::vector<BVHHit> primaryHits(numPixels);
+	jobs.ParallelFor(numPixels, 1024, [&](uint32_t begin, uint32_t end, uint32_t)
+	{
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			bvh.Intersect(outRays[RayBenchmarkKind_Primary][i], primaryHits[i]);
+		}
+	});
+
+	// Secondary rays leave primary hits along the geometric normal facing the camera, the offset
+	// is relative to the scene size. Shadow rays only from surfaces facing the light
+	const TriangleBVHNode& root = bvh.Nodes()[0];
+	const XMFLOAT3 sceneSize(root.boundsMax.x - root.boundsMin.x, root.boundsMax.y - root.boundsMin.y, root.boundsMax.z - root.boundsMin.z);
+	const float offset = 1e-5f * sqrtf(sceneSize.x * sceneSize.x + sceneSize.y * sceneSize.y + sceneSize.z * sceneSize.z);
+	const XMFLOAT3 toLight(-view.lightDirection.x, -view.lightDirection.y, -view.lightDirection.z);
+	std::mt19937 rng(9876);
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+	for (uint32_t i = 0; i < numPixels; ++i)
+	{
+		const BVHHit& hit = primaryHits[i];
+		if (!hit.IsHit())
+			continue;
+
+		const BVHRay& primary = outRays[RayBenchmarkKind_Primary][i];
+		const XMFLOAT3& v0 = mesh.Vertex(mesh.indices[hit.triangle * 3 + 0]);
+		const XMFLOAT3& v1 = mesh.Vertex(mesh.indices[hit.triangle * 3 + 1]);
+		const XMFLOAT3& v2 = mesh.Vertex(mesh.indices[hit.triangle * 3 + 2]);
+		const XMFLOAT3 e1(v1.x - v0.x, v1.y - v0.y, v1.z - v0.z);
+		const XMFLOAT3 e2(v2.x - v0.x, v2.y - v0.y, v2.z - v0.z);
+		XMFLOAT3 normal(e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x);
+		const float normalLength = sqrtf(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+		if (!(normalLength > 0.f))
+			continue;
+		const float facing = (normal.x * primary.direction.x + normal.y * primary.direction.y + normal.z * primary.direction.z) > 0.f ? -1.f : 1.f;
+		normal = XMFLOAT3(normal.x * facing / normalLength, normal.y * facing / normalLength, normal.z * facing / normalLength);
+
+		BVHRay secondary;
+		secondary.origin = XMFLOAT3(
+			primary.origin.x + primary.direction.x * hit.t + normal.x * offset,
+			primary.origin.y + primary.direction.y * hit.t + normal.y * offset,
+			primary.origin.z + primary.direction.z * hit.t + normal.z * offset);
+		if (normal.x * toLight.x + normal.y * toLight.y + normal.z * toLight.z > 0.f)
+		{
+			secondary.direction = toLight;
+			outRays[RayBenchmarkKind_Shadow].push_back(secondary);
+		}
+
+		// Cosine distributed around the normal
+		const float r = sqrtf(unit(rng));
+		const float phi = XM_2PI * unit(rng);
+		const XMFLOAT3 tangent = (fabsf(normal.x) > 0.9f) ? XMFLOAT3(0.f, 1.f, 0.f) : XMFLOAT3(1.f, 0.f, 0.f);
+		XMFLOAT3 bitangent(normal.y * tangent.z - normal.z * tangent.y, normal.z * tangent.x - normal.x * tangent.z, normal.x * tangent.y - normal.y * tangent.x);
+		const float bitangentLength = sqrtf(bitangent.x * bitangent.x + bitangent.y * bitangent.y + bitangent.z * bitangent.z);
+		bitangent = XMFLOAT3(bitangent.x / bitangentLength, bitangent.y / bitangentLength, bitangent.z / bitangentLength);
+		const XMFLOAT3 binormal(normal.y * bitangent.z - normal.z * bitangent.y, normal.z * bitangent.x - normal.x * bitangent.z, normal.x * bitangent.y - normal.y * bitangent.x);
+		const float a = r * cosf(phi), b = r * sinf(phi), c = sqrtf(std::max(0.f, 1.f - r * r));
+		secondary.direction = XMFLOAT3(
+			bitangent.x * a + binormal.x * b + normal.x * c,
+			bitangent.y * a + binormal.y * b + normal.y * c,
+			bitangent.z * a + binormal.z * b + normal.z * c);
+		outRays[RayBenchmarkKind_Incoherent].push_back(secondary);
+	}
+}
+
+void RunWideBVHBenchmark(JobSystem& jobs, const TriangleMesh& mesh, const RayBenchmarkView& view, WideBVHBenchmarkResult& outResult)
+{
+	outResult = {};
+	outResult.numTriangles = mesh.numTriangles;
+	outResult.numThreads = jobs.NumThreads();
+	outResult.simd8 = CpuSupportsAVX2();
+
+	TriangleBVH binary;
+	auto start = TimerClock::now();
+	binary.BuildSAH(jobs, mesh);
+	outResult.binaryBuildMs = ElapsedMs(start);
+	if (binary.IsEmpty())
+	{
+		return;
+	}
+
+	WideBVH wide[2];
+	for (uint32_t w = 0; w < 2; ++w)
+	{
+		wide[w].Build(binary, mesh, w == 0 ? 4 : 8);
+		outResult.collapseMs[w] = wide[w].Stats().buildMs;
+		outResult.nodeBytes[w + 1] = wide[w].Stats().nodeBytes;
+	}
+	outResult.nodeBytes[0] = binary.NumNodes() * sizeof(TriangleBVHNode);
+
+	std::vector<BVHRay> rays[RayBenchmarkKind_Count];
+	MakeViewBenchmarkRays(jobs, binary, mesh, view, rays);
+
+	// Closest hits of the binary tree are the reference, shadow rays store 0 or 1 in t
+	std::vector<BVHHit> reference[RayBenchmarkKind_Count];
+	std::vector<BVHHit> hits;
+	for (uint32_t structure = 0; structure < 3; ++structure)
+	{
+		for (uint32_t kind = 0; kind < RayBenchmarkKind_Count; ++kind)
+		{
+			const std::vector<BVHRay>& kindRays = rays[kind];
+			const uint32_t numRays = static_cast<uint32_t>(kindRays.size());
+			outResult.numRays[kind] = numRays;
+			hits.assign(numRays, BVHHit());
+
+			const double bestMs = BestOfMs([&]
+			{
+				jobs.ParallelFor(numRays, 1024, [&](uint32_t begin, uint32_t end, uint32_t)
+				{
+					for (uint32_t i = begin; i < end; ++i)
+					{
+						if (kind == RayBenchmarkKind_Shadow)
+						{
+							const bool occluded = (structure == 0) ? binary.Occluded(kindRays[i]) : wide[structure - 1].Occluded(kindRays[i]);
+							hits[i].t = occluded ? 1.f : 0.f;
+							continue;
+						}
+						hits[i] = BVHHit();
+						if (structure == 0)
+							binary.Intersect(kindRays[i], hits[i]);
+						else
+							wide[structure - 1].Intersect(kindRays[i], hits[i]);
+					}
+				});
+			});
+			outResult.raysPerSecond[structure][kind] = (bestMs > 0.0) ? numRays / (bestMs * 1e-3) : 0.0;
+
+			if (structure == 0)
+			{
+				reference[kind] = hits;
+				continue;
+			}
+
+			// Watertight and Moller-Trumbore may disagree on rays through edges
+			for (uint32_t i = 0; i < numRays; ++i)
+			{
+				const BVHHit& expected = reference[kind][i];
+				const bool sameHit = (hits[i].IsHit() == expected.IsHit()) &&
+					(!expected.IsHit() || fabsf(hits[i].t - expected.t) <= 1e-4f * std::max(1.f, expected.t));
+				outResult.numMismatches += (kind == RayBenchmarkKind_Shadow ? hits[i].t == expected.t : sameHit) ? 0 : 1;
+			}
+		}
+	}
+}
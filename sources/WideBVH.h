@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <DirectXMath.h>
+#include "TriangleBVH.h"
+
+// 4 or 8 wide BVH collapsed from a binary TriangleBVH, for CPU ray queries
+// Child boxes are quantized to 8 bits per plane relative to the node box, so a 4 wide node is one
+// cache line and an 8 wide node two. Traversal tests every child of a node at once (SSE for 4 wide,
+// AVX2 for 8 wide, scalar otherwise) and visits hit children nearest first. Leaves use the
+// watertight ray triangle test (Woop et al.), no gaps along shared edges.
+
+// Child box = origin + [childMin, childMax] * 2^exponent, per axis, conservative
+template<uint32_t Width>
+struct alignas(64) WideBVHNode
+{
+	DirectX::XMFLOAT3 origin;
+	int8_t exponent[3];
+	uint8_t numChildren;			// Children are packed first
+	uint8_t childMin[3][Width];		// Axis major, Width lanes load at once
+	uint8_t childMax[3][Width];
+	uint32_t child[Width];			// Inner: node index. Leaf: first triangle
+	uint8_t numTriangles[Width];	// 0 for inner children
+};
+static_assert(sizeof(WideBVHNode<4>) == 64, "4 wide node is one cache line");
+static_assert(sizeof(WideBVHNode<8>) == 128, "8 wide node is two cache lines");
+
+struct WideBVHStats
+{
+	uint32_t width = 0;
+	uint32_t numNodes = 0;
+	uint32_t numLeaves = 0;
+	float averageChildren = 0.f;	// Per node, Width when fully collapsed
+	uint64_t nodeBytes = 0;
+	double buildMs = 0.0;			// Collapse and quantization only
+};
+
+class WideBVH
+{
+public:
+	// Width is 4 or 8, mesh is the one bvh was built from
+	void Build(const TriangleBVH& bvh, const TriangleMesh& mesh, uint32_t width);
+	void Clear();
+
+	// Same contract as TriangleBVH. useSimd false forces the scalar child test (same results)
+	bool Intersect(const BVHRay& ray, BVHHit& hit, bool useSimd = true) const;
+	bool Occluded(const BVHRay& ray, bool useSimd = true) const;
+
+	bool IsEmpty() const { return m_numNodes == 0; }
+	uint32_t Width() const { return m_width; }
+	const WideBVHStats& Stats() const { return m_stats; }
+
+	// Leaf order, vertices so the watertight test sees exactly the mesh positions
+	struct Triangle
+	{
+		DirectX::XMFLOAT3 v0;
+		DirectX::XMFLOAT3 v1;
+		DirectX::XMFLOAT3 v2;
+	};
+
+private:
+	template<uint32_t NodeWidth>
+	void Collapse(const TriangleBVH& bvh, std::vector<WideBVHNode<NodeWidth>>& nodes);
+
+	std::vector<WideBVHNode<4>> m_nodes4;
+	std::vector<WideBVHNode<8>> m_nodes8;
+	std::vector<Triangle> m_triangles;
+	std::vector<uint32_t> m_triIndices;		// Mesh triangle of every leaf slot
+	uint32_t m_width = 0;
+	uint32_t m_numNodes = 0;
+	WideBVHStats m_stats;
+};
+
+// Camera and light of the scene to trace, invViewProj maps NDC to world (row vectors)
+struct RayBenchmarkView
+{
+	DirectX::XMFLOAT4X4 invViewProj;
+	DirectX::XMFLOAT3 cameraPosition;
+	DirectX::XMFLOAT3 lightDirection;	// Direction the light travels
+	uint32_t width = 1280;
+	uint32_t height = 720;
+};
+
+enum RayBenchmarkKind
+{
+	RayBenchmarkKind_Primary,		// Closest hit, one ray per pixel
+	RayBenchmarkKind_Shadow,		// Any hit toward the light from primary hits
+	RayBenchmarkKind_Incoherent,	// Closest hit, random hemisphere directions from primary hits
+	RayBenchmarkKind_Count,
+};
+
+// Primary rays in 4x4 pixel tiles, then shadow and incoherent rays leaving the primary hits in the
+// same order (fixed seed). bvh is built over mesh
+void MakeViewBenchmarkRays(JobSystem& jobs, const TriangleBVH& bvh, const TriangleMesh& mesh, const RayBenchmarkView& view, std::vector<BVHRay> outRays[RayBenchmarkKind_Count]);
+
+struct WideBVHBenchmarkResult
+{
+	uint32_t numTriangles = 0;
+	uint32_t numThreads = 0;
+	bool simd8 = false;				// AVX2 available, 8 wide is scalar otherwise
+	double binaryBuildMs = 0.0;		// SAH
+	double collapseMs[2] = {};		// 4 wide, 8 wide
+	uint64_t nodeBytes[3] = {};		// Binary, 4 wide, 8 wide
+	uint32_t numRays[RayBenchmarkKind_Count] = {};
+	double raysPerSecond[3][RayBenchmarkKind_Count] = {};	// Binary, 4 wide, 8 wide
+	uint32_t numMismatches = 0;		// Wide against binary, hit or miss and distance within tolerance
+};
+
+// Builds the three BVHs over the mesh (world space scene) and traces each ray kind through them
+void RunWideBVHBenchmark(JobSystem& jobs, const TriangleMesh& mesh, const RayBenchmarkView& view, WideBVHBenchmarkResult& outResult);
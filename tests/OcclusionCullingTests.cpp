@@ -0,0 +1,282 @@
+// Software occlusion culling tests, headless, returns non-zero on a failure
+// Camera at the origin looking down +z. Hand built occluders check coverage, cracks and clipping at
+// the near plane and guard band, then random scenes check that a box is only reported occluded when
+// every pixel center ray reaching it hits an occluder first, and that the thread count doesn't
+// change the depth buffer.
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "OcclusionCulling.h"
+#include "TestCheck.h"
+
+using namespace DirectX;
+
+static const float FovY = XM_PI / 3;
+static const float NearZ = 0.1f;
+static const float FarZ = 1000.f;
+
+// Positions and indices stay alive until RasterizeOccluders
+struct OccluderMesh
+{
+	std::vector<XMFLOAT3> positions;
+	std::vector<uint32_t> indices;
+
+	void AddQuad(const XMFLOAT3& a, const XMFLOAT3& b, const XMFLOAT3& c, const XMFLOAT3& d)
+	{
+		const uint32_t base = static_cast<uint32_t>(positions.size());
+		positions.insert(positions.end(), { a, b, c, d });
+		indices.insert(indices.end(), { base, base + 1, base + 2, base, base + 2, base + 3 });
+	}
+};
+
+static void Rasterize(OcclusionCuller& culler, JobSystem& jobs, const OccluderMesh& mesh)
+{
+	const float aspect = static_cast<float>(culler.Width()) / culler.Height();
+	culler.BeginFrame(XMMatrixPerspectiveFovLH(FovY, aspect, NearZ, FarZ));
+	culler.AddOccluder(mesh.positions.data(), sizeof(XMFLOAT3), mesh.indices.data(), static_cast<uint32_t>(mesh.indices.size()), XMMatrixIdentity());
+	culler.RasterizeOccluders(jobs);
+}
+
+// D3D depth of a view space z
+static float ProjectDepth(float z)
+{
+	return (z - NearZ) * FarZ / ((FarZ - NearZ) * z);
+}
+
+// View space ray through the center of pixel (x, y), z component 1
+static XMFLOAT3 PixelRay(const OcclusionCuller& culler, uint32_t x, uint32_t y)
+{
+	const float tanY = tanf(FovY * 0.5f);
+	const float tanX = tanY * culler.Width() / culler.Height();
+	return XMFLOAT3(
+		((x + 0.5f) / culler.Width() * 2.f - 1.f) * tanX,
+		(1.f - (y + 0.5f) / culler.Height() * 2.f) * tanY,
+		1.f);
+}
+
+static float Dot(const XMFLOAT3& a, const XMFLOAT3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+static XMFLOAT3 Sub(const XMFLOAT3& a, const XMFLOAT3& b) { return XMFLOAT3(a.x - b.x, a.y - b.y, a.z - b.z); }
+static XMFLOAT3 Cross(const XMFLOAT3& a, const XMFLOAT3& b) { return XMFLOAT3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x); }
+
+// Ray from the origin, closest hit t or FLT_MAX
+static float RayHitsTriangle(const XMFLOAT3& direction, const XMFLOAT3& v0, const XMFLOAT3& v1, const XMFLOAT3& v2)
+{
+	const XMFLOAT3 e1 = Sub(v1, v0), e2 = Sub(v2, v0);
+	const XMFLOAT3 p = Cross(direction, e2);
+	const float det = Dot(e1, p);
+	if (fabsf(det) < 1e-12f)
+		return FLT_MAX;
+	const float invDet = 1.f / det;
+	const XMFLOAT3 s(-v0.x, -v0.y, -v0.z);
+	const float u = Dot(s, p) * invDet;
+	if (u < 0.f || u > 1.f)
+		return FLT_MAX;
+	const XMFLOAT3 q = Cross(s, e1);
+	const float v = Dot(direction, q) * invDet;
+	if (v < 0.f || u + v > 1.f)
+		return FLT_MAX;
+	const float t = Dot(e2, q) * invDet;
+	return (t > 0.f) ? t : FLT_MAX;
+}
+
+// Entry t of a ray from the origin, FLT_MAX when it misses
+static float RayEntersBox(const XMFLOAT3& direction, const XMFLOAT3& center, const XMFLOAT3& extents)
+{
+	const float o[3] = { -center.x, -center.y, -center.z };
+	const float d[3] = { direction.x, direction.y, direction.z };
+	const float e[3] = { extents.x, extents.y, extents.z };
+	float tMin = 0.f, tMax = FLT_MAX;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (fabsf(d[axis]) < 1e-12f)
+		{
+			if (fabsf(o[axis]) > e[axis])
+				return FLT_MAX;
+			continue;
+		}
+		float t0 = (-e[axis] - o[axis]) / d[axis];
+		float t1 = (e[axis] - o[axis]) / d[axis];
+		if (t0 > t1)
+			std::swap(t0, t1);
+		tMin = std::max(tMin, t0);
+		tMax = std::min(tMax, t1);
+		if (tMin > tMax)
+			return FLT_MAX;
+	}
+	return tMin;
+}
+
+static void TestWall(OcclusionCuller& culler, JobSystem& jobs)
+{
+	// Wall past every screen edge, every pixel gets its depth
+	OccluderMesh mesh;
+	mesh.AddQuad(XMFLOAT3(-100.f, -100.f, 10.f), XMFLOAT3(-100.f, 100.f, 10.f), XMFLOAT3(100.f, 100.f, 10.f), XMFLOAT3(100.f, -100.f, 10.f));
+	Rasterize(culler, jobs, mesh);
+
+	const float wallDepth = ProjectDepth(10.f);
+	bool covered = true;
+	for (float depth : culler.Depth())
+	{
+		covered &= fabsf(depth - wallDepth) < 1e-5f;
+	}
+	Check(covered, "wall covers every pixel at its depth");
+	Check(!culler.IsVisible(XMFLOAT3(0.f, 0.f, 20.f), XMFLOAT3(1.f, 1.f, 1.f)), "box behind the wall is occluded");
+	Check(culler.IsVisible(XMFLOAT3(0.f, 0.f, 5.f), XMFLOAT3(1.f, 1.f, 1.f)), "box in front of the wall is visible");
+	Check(culler.IsVisible(XMFLOAT3(0.f, 0.f, 10.f), XMFLOAT3(1.f, 1.f, 1.f)), "box through the wall is visible");
+	Check(culler.IsVisible(XMFLOAT3(0.f, 0.f, 0.f), XMFLOAT3(1.f, 1.f, 1.f)), "box around the camera is visible");
+}
+
+static void TestSharedEdge(OcclusionCuller& culler, JobSystem& jobs)
+{
+	// Two triangles of a quad, pixel centers inside are covered once, no crack along the diagonal
+	OccluderMesh mesh;
+	mesh.AddQuad(XMFLOAT3(-3.1f, -1.7f, 10.f), XMFLOAT3(-3.1f, 2.3f, 10.f), XMFLOAT3(2.9f, 2.3f, 10.f), XMFLOAT3(2.9f, -1.7f, 10.f));
+	Rasterize(culler, jobs, mesh);
+
+	uint32_t numMissing = 0, numOutside = 0;
+	for (uint32_t y = 0; y < culler.Height(); ++y)
+	{
+		for (uint32_t x = 0; x < culler.Width(); ++x)
+		{
+			const XMFLOAT3 ray = PixelRay(culler, x, y);
+			const float px = ray.x * 10.f, py = ray.y * 10.f;
+			const bool inside = px > -3.1f + 1e-3f && px < 2.9f - 1e-3f && py > -1.7f + 1e-3f && py < 2.3f - 1e-3f;
+			const bool outside = px < -3.1f - 1e-3f || px > 2.9f + 1e-3f || py < -1.7f - 1e-3f || py > 2.3f + 1e-3f;
+			const bool written = culler.Depth()[y * culler.Width() + x] < 1.f;
+			numMissing += (inside && !written) ? 1 : 0;
+			numOutside += (outside && written) ? 1 : 0;
+		}
+	}
+	Check(numMissing == 0, "quad covers every pixel center inside it");
+	Check(numOutside == 0, "quad covers no pixel center outside it");
+}
+
+static void TestGuardBand(OcclusionCuller& culler, JobSystem& jobs)
+{
+	// Floor from behind the camera to past the far plane and far beyond both sides, its vertices
+	// project millions of screens away. Every pixel center below the horizon hits it
+	OccluderMesh mesh;
+	mesh.AddQuad(XMFLOAT3(-1e6f, -1.f, -50.f), XMFLOAT3(-1e6f, -1.f, 2000.f), XMFLOAT3(1e6f, -1.f, 2000.f), XMFLOAT3(1e6f, -1.f, -50.f));
+	Rasterize(culler, jobs, mesh);
+	Check(culler.Stats().numRasterTriangles > 0, "floor crossing the near plane and guard band is rasterized");
+
+	uint32_t numMissing = 0, numOutside = 0;
+	for (uint32_t y = 0; y < culler.Height(); ++y)
+	{
+		for (uint32_t x = 0; x < culler.Width(); ++x)
+		{
+			// Hit distance along z, the far plane cuts the floor
+			const XMFLOAT3 ray = PixelRay(culler, x, y);
+			const bool written = culler.Depth()[y * culler.Width() + x] < 1.f;
+			const bool below = ray.y < 0.f && -1.f / ray.y < FarZ * 0.99f;
+			const bool above = ray.y > 0.f;
+			numMissing += (below && !written) ? 1 : 0;
+			numOutside += (above && written) ? 1 : 0;
+		}
+	}
+	Check(numMissing == 0, "floor covers every pixel below the horizon");
+	Check(numOutside == 0, "floor covers no pixel above the horizon");
+	Check(!culler.IsVisible(XMFLOAT3(0.f, -5.f, 20.f), XMFLOAT3(1.f, 1.f, 1.f)), "box under the floor is occluded");
+	Check(culler.IsVisible(XMFLOAT3(0.f, 0.f, 20.f), XMFLOAT3(1.f, 0.5f, 1.f)), "box on the floor is visible");
+}
+
+static void TestRandomScenes(JobSystem& jobs, JobSystem& serialJobs)
+{
+	OcclusionCullingInit init;
+	OcclusionCuller culler;
+	culler.Initialize(init);
+	OcclusionCuller serialCuller;
+	serialCuller.Initialize(init);
+
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+	const uint32_t numScenes = 16;
+	const uint32_t numQuads = 24;
+	const uint32_t numBoxes = 512;
+	uint32_t numOccluded = 0, numFalseOccluded = 0, numDepthMismatches = 0;
+	for (uint32_t scene = 0; scene < numScenes; ++scene)
+	{
+		// Quads facing the camera at random tilts, some crossing the screen edges
+		OccluderMesh mesh;
+		for (uint32_t i = 0; i < numQuads; ++i)
+		{
+			const float z = 5.f + 30.f * unit(rng);
+			const XMFLOAT3 center((unit(rng) * 2.f - 1.f) * z, (unit(rng) * 2.f - 1.f) * z * 0.6f, z);
+			const float sx = 1.f + 6.f * unit(rng), sy = 1.f + 6.f * unit(rng);
+			const float tilt = (unit(rng) * 2.f - 1.f) * 0.8f * sx;
+			mesh.AddQuad(
+				XMFLOAT3(center.x - sx, center.y - sy, center.z - tilt), XMFLOAT3(center.x - sx, center.y + sy, center.z - tilt),
+				XMFLOAT3(center.x + sx, center.y + sy, center.z + tilt), XMFLOAT3(center.x + sx, center.y - sy, center.z + tilt));
+		}
+		Rasterize(culler, jobs, mesh);
+		Rasterize(serialCuller, serialJobs, mesh);
+		numDepthMismatches += (memcmp(culler.Depth().data(), serialCuller.Depth().data(), culler.Depth().size() * sizeof(float)) == 0) ? 0 : 1;
+
+		for (uint32_t i = 0; i < numBoxes; ++i)
+		{
+			const float z = 8.f + 60.f * unit(rng);
+			const XMFLOAT3 center((unit(rng) * 2.f - 1.f) * z * 0.8f, (unit(rng) * 2.f - 1.f) * z * 0.5f, z);
+			const XMFLOAT3 extents(0.2f + 2.f * unit(rng), 0.2f + 2.f * unit(rng), 0.2f + 2.f * unit(rng));
+			if (culler.IsVisible(center, extents))
+				continue;
+			++numOccluded;
+
+			// Every pixel center ray that reaches the box must hit an occluder first
+			bool visible = false;
+			for (uint32_t y = 0; y < culler.Height() && !visible; ++y)
+			{
+				for (uint32_t x = 0; x < culler.Width() && !visible; ++x)
+				{
+					const XMFLOAT3 ray = PixelRay(culler, x, y);
+					const float tBox = RayEntersBox(ray, center, extents);
+					if (tBox == FLT_MAX || tBox > FarZ)
+						continue;
+
+					float tOccluder = FLT_MAX;
+					for (size_t t = 0; t < mesh.indices.size(); t += 3)
+					{
+						tOccluder = std::min(tOccluder, RayHitsTriangle(ray,
+							mesh.positions[mesh.indices[t]], mesh.positions[mesh.indices[t + 1]], mesh.positions[mesh.indices[t + 2]]));
+					}
+					visible = std::max(tBox, NearZ) < tOccluder;
+				}
+			}
+			numFalseOccluded += visible ? 1 : 0;
+		}
+	}
+
+	printf("Occlusion culling: %u scenes, %u occluded boxes, %u false occluded, %u depth buffers differ across thread counts\n",
+		numScenes, numOccluded, numFalseOccluded, numDepthMismatches);
+	Check(numOccluded > 0, "random scenes occlude some boxes");
+	Check(numFalseOccluded == 0, "no box with a visible pixel is occluded");
+	Check(numDepthMismatches == 0, "depth buffer doesn't depend on the thread count");
+	culler.Shutdown();
+	serialCuller.Shutdown();
+}
+
+int main()
+{
+	testName = "Occlusion culling";
+	JobSystem jobs;
+	jobs.Initialize(JobSystemInit{ 4 });
+	JobSystem serialJobs;
+	serialJobs.Initialize(JobSystemInit{ 1 });
+
+	OcclusionCuller culler;
+	culler.Initialize(OcclusionCullingInit());
+	TestWall(culler, jobs);
+	TestSharedEdge(culler, jobs);
+	TestGuardBand(culler, jobs);
+	culler.Shutdown();
+	TestRandomScenes(jobs, serialJobs);
+
+	serialJobs.Shutdown();
+	jobs.Shutdown();
+	return TestSummary();
+}
@@ -0,0 +1,89 @@
+// Potentially visible set tests, headless, returns non-zero when a check fails
+// A wall between two rooms hides the far side only when it is opaque, transparent (alpha tested)
+// geometry is seen but never occludes.
+
+#include <stdio.h>
+#include <vector>
+
+#include "Pvs.h"
+#include "TestCheck.h"
+
+using namespace DirectX;
+
+// Square at x, size 2 * halfSize around the x axis, front face toward +x or -x
+static void AddSquare(PvsScene& scene, float x, float halfSize, bool facingPositiveX)
+{
+	const uint32_t instance = scene.numInstances++;
+	const uint32_t first = static_cast<uint32_t>(scene.positions.size());
+	scene.positions.push_back(XMFLOAT3(x, -halfSize, -halfSize));
+	scene.positions.push_back(XMFLOAT3(x, halfSize, -halfSize));
+	scene.positions.push_back(XMFLOAT3(x, halfSize, halfSize));
+	scene.positions.push_back(XMFLOAT3(x, -halfSize, halfSize));
+	const uint32_t quad[6] = { 0, 1, 2, 0, 2, 3 };
+	for (int i = 0; i < 6; ++i)
+	{
+		// Counter clockwise seen from +x, reversed faces -x
+		scene.indices.push_back(first + (facingPositiveX ? quad[i] : quad[5 - i]));
+	}
+	scene.triangleInstances.resize(scene.indices.size() / 3, instance);
+}
+
+// Instance 0 back wall at -4 facing +x, 1 the wall at 0 and 2 the far wall at 4 facing -x
+static void BuildRooms(PvsScene& scene, bool transparentWall)
+{
+	scene = PvsScene();
+	AddSquare(scene, -4.f, 4.f, true);
+	AddSquare(scene, 0.f, 4.f, false);
+	AddSquare(scene, 4.f, 4.f, false);
+	if (transparentWall)
+	{
+		scene.instanceTransparent = { 0, 1, 0 };
+	}
+}
+
+static bool IsVisible(const PvsData& pvs, const XMFLOAT3& position, uint32_t instance)
+{
+	const uint32_t* set = pvs.CellSet(pvs.FindCell(position));
+	return set && (set[instance / 32] & (1u << (instance % 32))) != 0;
+}
+
+static void TestWall(JobSystem& jobs, bool transparentWall)
+{
+	PvsBakeSettings settings;
+	settings.cellSize = 1.f;
+	settings.dilation = 0;
+	PvsScene scene;
+	BuildRooms(scene, transparentWall);
+	PvsData pvs;
+	PvsBakeStats stats;
+	BakePvs(jobs, scene, settings, pvs, stats);
+
+	const XMFLOAT3 nearSide(-3.5f, 0.5f, 0.5f);
+	const XMFLOAT3 farSide(2.5f, 0.5f, 0.5f);
+	Check(pvs.CellSet(pvs.FindCell(nearSide)) != nullptr, "near side navigable");
+	Check(IsVisible(pvs, nearSide, 0), "back wall seen");
+	Check(IsVisible(pvs, nearSide, 1), "wall seen");
+	if (transparentWall)
+	{
+		Check(IsVisible(pvs, nearSide, 2), "far wall seen through the transparent wall");
+		Check(pvs.CellSet(pvs.FindCell(farSide)) != nullptr, "transparent back faces don't make cells solid");
+		Check(IsVisible(pvs, farSide, 0), "back wall seen from the far side");
+	}
+	else
+	{
+		Check(!IsVisible(pvs, nearSide, 2), "far wall hidden by the opaque wall");
+	}
+}
+
+int main()
+{
+	testName = "PVS";
+	JobSystem jobs;
+	jobs.Initialize(JobSystemInit{ 4 });
+
+	TestWall(jobs, false);
+	TestWall(jobs, true);
+
+	jobs.Shutdown();
+	return TestSummary();
+}
@@ -0,0 +1,205 @@
+// Shadow caster culling tests, headless, returns non-zero when a case fails or a caster is missed
+// Hand built cases, then random scenes seen from the origin looking down +z: receiver points inside
+// the view are traced toward the light and every box a ray hits must be kept.
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "ShadowCulling.h"
+#include "TestCheck.h"
+#include "Utility.h"
+
+using namespace DirectX;
+
+struct ShadowCullingTestResult
+{
+	// Random scenes, receiver points inside the view traced toward the light
+	uint32_t numScenes = 0;
+	uint32_t numRays = 0;
+	uint32_t numMissedCasters = 0;	// A ray hit a culled instance, must be 0
+	uint64_t numInstances = 0;		// Summed over scenes
+	uint64_t numFrustumVisible = 0;
+	uint64_t numCasters = 0;
+	uint64_t numHitCasters = 0;		// Hit by at least one ray
+	double cullMs = 0.0;			// Summed CullShadowCasters time
+};
+
+static bool RayHitsBox(const XMFLOAT3& origin, const XMFLOAT3& direction, const XMFLOAT3& center, const XMFLOAT3& extents)
+{
+	const float o[3] = { origin.x - center.x, origin.y - center.y, origin.z - center.z };
+	const float d[3] = { direction.x, direction.y, direction.z };
+	const float e[3] = { extents.x, extents.y, extents.z };
+	float tMin = 0.f, tMax = FLT_MAX;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (fabsf(d[axis]) < 1e-12f)
+		{
+			if (fabsf(o[axis]) > e[axis])
+				return false;
+			continue;
+		}
+		float t0 = (-e[axis] - o[axis]) / d[axis];
+		float t1 = (e[axis] - o[axis]) / d[axis];
+		if (t0 > t1)
+			std::swap(t0, t1);
+		tMin = std::max(tMin, t0);
+		tMax = std::min(tMax, t1);
+		if (tMin > tMax)
+			return false;
+	}
+	return true;
+}
+
+static void RunShadowCullingTests(ShadowCullingTestResult& outResult)
+{
+	outResult = {};
+
+	// Camera at origin looking down +z
+	const float fovY = XM_PI / 3, aspect = 16.f / 9.f, nearZ = 0.1f, farZ = 100.f;
+	BoundingFrustum frustum(XMMatrixPerspectiveFovLH(fovY, aspect, nearZ, farZ));
+	FrustumPlanes viewPlanes;
+	GetFrustumPlanes(frustum, viewPlanes);
+
+	// Hand built cases, unit boxes
+	struct Case
+	{
+		const char* name;
+		XMFLOAT3 center;
+		XMFLOAT3 light;
+		XMFLOAT3 sceneMin, sceneMax;
+		bool caster;
+	};
+	const XMFLOAT3 sceneMin(-200.f, -200.f, -200.f), sceneMax(200.f, 200.f, 200.f);
+	const Case cases[] =
+	{
+		{ "inside view", XMFLOAT3(0.f, 0.f, 20.f), XMFLOAT3(0.f, -1.f, 0.f), sceneMin, sceneMax, true },
+		{ "above view, light down", XMFLOAT3(0.f, 50.f, 20.f), XMFLOAT3(0.f, -1.f, 0.f), sceneMin, sceneMax, true },
+		{ "below view, light down", XMFLOAT3(0.f, -50.f, 20.f), XMFLOAT3(0.f, -1.f, 0.f), sceneMin, sceneMax, false },
+		{ "behind camera, light forward", XMFLOAT3(0.f, 0.f, -20.f), XMFLOAT3(0.f, 0.f, 1.f), sceneMin, sceneMax, true },
+		{ "behind camera, light backward", XMFLOAT3(0.f, 0.f, -20.f), XMFLOAT3(0.f, 0.f, -1.f), sceneMin, sceneMax, false },
+		{ "right of view, light left", XMFLOAT3(100.f, 0.f, 20.f), XMFLOAT3(-1.f, 0.f, 0.f), sceneMin, sceneMax, true },
+		{ "right of view, no light", XMFLOAT3(100.f, 0.f, 20.f), XMFLOAT3(0.f, 0.f, 0.f), sceneMin, sceneMax, false },
+		{ "above view, scene floor above view", XMFLOAT3(0.f, 50.f, 20.f), XMFLOAT3(0.f, -1.f, 0.f), XMFLOAT3(-200.f, 40.f, -200.f), XMFLOAT3(200.f, 60.f, 200.f), false },
+		{ "past far plane, light backward", XMFLOAT3(0.f, 0.f, 150.f), XMFLOAT3(0.f, 0.f, -1.f), sceneMin, sceneMax, true },
+	};
+	for (const Case& test : cases)
+	{
+		const BoundingBox scene(
+			XMFLOAT3((test.sceneMin.x + test.sceneMax.x) * 0.5f, (test.sceneMin.y + test.sceneMax.y) * 0.5f, (test.sceneMin.z + test.sceneMax.z) * 0.5f),
+			XMFLOAT3((test.sceneMax.x - test.sceneMin.x) * 0.5f, (test.sceneMax.y - test.sceneMin.y) * 0.5f, (test.sceneMax.z - test.sceneMin.z) * 0.5f));
+		ShadowCasterVolume volume;
+		BuildShadowCasterVolume(viewPlanes, scene, test.light, volume);
+		const bool caster = !IsShadowCasterOutside(volume, test.center, XMFLOAT3(1.f, 1.f, 1.f));
+		Check(caster == test.caster, test.name);
+	}
+
+	// Random scenes, every box a ray from a visible receiver hits on its way to the light must be kept
+	const uint32_t numScenes = 8;
+	const uint32_t numBoxes = 4096;
+	const uint32_t numRays = 512;
+	const float tanY = tanf(fovY * 0.5f), tanX = tanY * aspect;
+
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+	std::uniform_real_distribution<float> position(-150.f, 150.f);
+	std::uniform_real_distribution<float> extent(0.5f, 4.f);
+
+	BoundsSoA bounds;
+	bounds.Resize(numBoxes);
+	std::vector<uint32_t> casterIndices(numBoxes);
+	std::vector<uint8_t> isCaster(numBoxes);
+	std::vector<uint8_t> isHit(numBoxes);
+	std::vector<uint32_t> visibleIndices(bounds.centerX.size());
+	for (uint32_t scene = 0; scene < numScenes; ++scene)
+	{
+		for (uint32_t i = 0; i < numBoxes; ++i)
+		{
+			bounds.Set(i, BoundingBox(XMFLOAT3(position(rng), position(rng), position(rng)), XMFLOAT3(extent(rng), extent(rng), extent(rng))));
+		}
+
+		// Light from above at any azimuth, last scene straight down
+		const float azimuth = unit(rng) * XM_2PI;
+		const float elevation = (scene + 1 == numScenes) ? XM_PIDIV2 : XM_PI * (0.05f + 0.4f * unit(rng));
+		const XMFLOAT3 light(-cosf(elevation) * cosf(azimuth), -sinf(elevation), -cosf(elevation) * sinf(azimuth));
+
+		const BoundingBox sceneBounds = ComputeSceneBounds(bounds);
+		ShadowCasterVolume volume;
+		BuildShadowCasterVolume(viewPlanes, sceneBounds, light, volume);
+
+		const auto start = TimerClock::now();
+		const uint32_t numCasters = CullShadowCasters(bounds, volume, casterIndices.data());
+		outResult.cullMs += ElapsedMs(start);
+
+		std::fill(isCaster.begin(), isCaster.end(), 0);
+		std::fill(isHit.begin(), isHit.end(), 0);
+		for (uint32_t i = 0; i < numCasters; ++i)
+		{
+			isCaster[casterIndices[i]] = 1;
+		}
+
+		// Receivers just inside the frustum, the far corners lie outside the scene
+		const XMFLOAT3 toLight(-volume.direction.x, -volume.direction.y, -volume.direction.z);
+		const XMFLOAT3 sceneMinBound(sceneBounds.Center.x - sceneBounds.Extents.x, sceneBounds.Center.y - sceneBounds.Extents.y, sceneBounds.Center.z - sceneBounds.Extents.z);
+		const XMFLOAT3 sceneMaxBound(sceneBounds.Center.x + sceneBounds.Extents.x, sceneBounds.Center.y + sceneBounds.Extents.y, sceneBounds.Center.z + sceneBounds.Extents.z);
+		uint32_t ray = 0;
+		while (ray < numRays)
+		{
+			const float z = nearZ + (farZ - nearZ) * (0.001f + 0.998f * unit(rng));
+			const XMFLOAT3 receiver(
+				(unit(rng) * 2.f - 1.f) * 0.999f * tanX * z,
+				(unit(rng) * 2.f - 1.f) * 0.999f * tanY * z,
+				z);
+			if (receiver.x < sceneMinBound.x || receiver.y < sceneMinBound.y || receiver.z < sceneMinBound.z ||
+				receiver.x > sceneMaxBound.x || receiver.y > sceneMaxBound.y || receiver.z > sceneMaxBound.z)
+				continue;
+
+			for (uint32_t i = 0; i < numBoxes; ++i)
+			{
+				const XMFLOAT3 center(bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]);
+				const XMFLOAT3 extents(bounds.extentX[i], bounds.extentY[i], bounds.extentZ[i]);
+				if (RayHitsBox(receiver, toLight, center, extents))
+				{
+					if (!isCaster[i] && !isHit[i])
+					{
+						printf("Shadow culling: scene %u culled box %u that shadows (%.2f, %.2f, %.2f)\n", scene, i, receiver.x, receiver.y, receiver.z);
+						++outResult.numMissedCasters;
+					}
+					isHit[i] = 1;
+				}
+			}
+			++ray;
+		}
+
+		uint32_t numHit = 0;
+		for (uint32_t i = 0; i < numBoxes; ++i)
+		{
+			numHit += (isHit[i] && isCaster[i]) ? 1 : 0;
+		}
+
+		++outResult.numScenes;
+		outResult.numRays += numRays;
+		outResult.numInstances += numBoxes;
+		outResult.numFrustumVisible += CullFrustumScalar(bounds, viewPlanes, visibleIndices.data());
+		outResult.numCasters += numCasters;
+		outResult.numHitCasters += numHit;
+	}
+
+}
+
+int main()
+{
+	testName = "Shadow culling";
+	ShadowCullingTestResult result;
+	RunShadowCullingTests(result);
+	Check(result.numMissedCasters == 0, "no ray hits a culled caster");
+	printf("Shadow culling: %u scenes, %u rays, %u missed casters, "
+		"casters %llu / %llu (frustum visible %llu, shadowing %llu), cull %.3f ms\n",
+		result.numScenes, result.numRays, result.numMissedCasters,
+		static_cast<unsigned long long>(result.numCasters), static_cast<unsigned long long>(result.numInstances),
+		static_cast<unsigned long long>(result.numFrustumVisible), static_cast<unsigned long long>(result.numHitCasters), result.cullMs);
+	return TestSummary();
+}
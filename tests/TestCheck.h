@@ -0,0 +1,28 @@
+#pragma once
+
+// Check bookkeeping of the headless ctest executables
+// main sets testName, Check prints every failure, main returns TestSummary()
+
+#include <stdint.h>
+#include <stdio.h>
+
+inline const char* testName = "Test";
+inline uint32_t numChecks = 0;
+inline uint32_t numFailures = 0;
+
+inline void Check(bool condition, const char* name)
+{
+	++numChecks;
+	if (!condition)
+	{
+		printf("%s: '%s' failed\n", testName, name);
+		++numFailures;
+	}
+}
+
+// Prints the totals, non-zero exit code when a check failed
+inline int TestSummary()
+{
+	printf("%s: %u / %u checks failed\n", testName, numFailures, numChecks);
+	return (numFailures == 0) ? 0 : 1;
+}
@@ -0,0 +1,279 @@
+// Texture streaming policy tests, headless, returns non-zero on a failure
+// Deterministic simulation of TextureStreamer: square RGBA8 textures, a fixed seed picks the visible
+// set and requested mips every frame. Checks the budget, the per frame upload limits (only mips above
+// the old top are uploaded, the rest is copied on the GPU), convergence, LRU eviction and that the
+// same request sequence gives the same changes.
+
+#include <stdio.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "TextureStreaming.h"
+#include "TestCheck.h"
+
+// Mip byte sizes of a square RGBA8 texture, tail is the 16x16 level (or the last one)
+struct TestTexture
+{
+	std::vector<uint64_t> mipBytes;
+	uint32_t tailMip = 0;
+
+	explicit TestTexture(uint32_t size)
+	{
+		for (uint32_t s = size; s > 0; s >>= 1)
+		{
+			if (s >= 16)
+				tailMip = static_cast<uint32_t>(mipBytes.size());
+			mipBytes.push_back(uint64_t(s) * s * 4);
+		}
+	}
+
+	// Bytes uploaded when the top goes from fromMip to toMip, 0 when evicting
+	uint64_t UploadBytes(uint32_t fromMip, uint32_t toMip) const
+	{
+		uint64_t bytes = 0;
+		for (uint32_t m = toMip; m < fromMip; ++m)
+			bytes += mipBytes[m];
+		return bytes;
+	}
+};
+
+static void AddTextures(TextureStreamer& streamer, const std::vector<TestTexture>& textures)
+{
+	for (const TestTexture& texture : textures)
+	{
+		StreamingTextureDesc desc;
+		desc.numMips = static_cast<uint32_t>(texture.mipBytes.size());
+		desc.tailMip = texture.tailMip;
+		desc.initialMip = texture.tailMip;
+		desc.mipBytes = texture.mipBytes.data();
+		streamer.AddTexture(desc);
+	}
+}
+
+static std::vector<TestTexture> MakeTextures(uint32_t count, uint32_t seed)
+{
+	std::mt19937 rng(seed);
+	std::vector<TestTexture> textures;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		textures.emplace_back(64u << (rng() % 6));
+	}
+	return textures;
+}
+
+static void TestInitialState()
+{
+	const std::vector<TestTexture> textures = MakeTextures(8, 1);
+	TextureStreamer streamer;
+	streamer.Initialize(TextureStreamingInit());
+	AddTextures(streamer, textures);
+
+	bool atTail = true;
+	for (uint32_t i = 0; i < textures.size(); ++i)
+	{
+		const TestTexture& texture = textures[i];
+		atTail = atTail && streamer.ResidentMip(i) == texture.tailMip &&
+			streamer.ResidentBytes(i) == texture.UploadBytes(static_cast<uint32_t>(texture.mipBytes.size()), texture.tailMip);
+	}
+	Check(atTail, "initial mip is the tail");
+
+	// Nothing requested, nothing to do
+	std::vector<StreamingChange> changes;
+	streamer.BeginFrame();
+	streamer.Update(changes);
+	Check(changes.empty() && streamer.Stats().mipsLoaded == 0, "idle update");
+	streamer.Shutdown();
+}
+
+static void TestConvergence()
+{
+	const std::vector<TestTexture> textures = MakeTextures(16, 2);
+	TextureStreamer streamer;
+	TextureStreamingInit init;
+	init.budgetBytes = 1ull << 30;
+	init.maxUploadsPerFrame = 4;
+	streamer.Initialize(init);
+	AddTextures(streamer, textures);
+
+	std::vector<StreamingChange> changes;
+	uint32_t frames = 0;
+	for (; frames < 1000; ++frames)
+	{
+		streamer.BeginFrame();
+		for (uint32_t i = 0; i < textures.size(); ++i)
+			streamer.RequestMip(i, 0.f);
+		streamer.Update(changes);
+		if (streamer.Stats().numPending == 0)
+			break;
+	}
+
+	bool allTop = true;
+	for (uint32_t i = 0; i < textures.size(); ++i)
+		allTop = allTop && streamer.ResidentMip(i) == 0;
+	Check(frames < 1000 && allTop, "converges to requested mips");
+
+	// Stable once converged
+	streamer.BeginFrame();
+	for (uint32_t i = 0; i < textures.size(); ++i)
+		streamer.RequestMip(i, 0.f);
+	streamer.Update(changes);
+	Check(changes.empty(), "no changes after convergence");
+
+	// Mip bias lowers the detail, over resident textures are trimmed only under budget pressure
+	streamer.SetBudget(streamer.Stats().residentBytes / 2);
+	for (uint32_t frame = 0; frame < 100; ++frame)
+	{
+		streamer.BeginFrame();
+		for (uint32_t i = 0; i < textures.size(); ++i)
+			streamer.RequestMip(i, 2.f);
+		streamer.Update(changes);
+	}
+	bool atRequest = true;
+	for (uint32_t i = 0; i < textures.size(); ++i)
+		atRequest = atRequest && streamer.DesiredMip(i) == std::min(2u, textures[i].tailMip);
+	Check(atRequest, "desired mip follows the request");
+	Check(streamer.Stats().residentBytes <= streamer.Budget(), "budget after shrink");
+	streamer.Shutdown();
+}
+
+static void TestLruEviction()
+{
+	// Two 1024 textures, budget holds one full chain plus the other's tail
+	std::vector<TestTexture> textures = { TestTexture(1024), TestTexture(1024) };
+	const uint64_t chainBytes = textures[0].UploadBytes(static_cast<uint32_t>(textures[0].mipBytes.size()), 0);
+	const uint64_t tailBytes = textures[0].UploadBytes(static_cast<uint32_t>(textures[0].mipBytes.size()), textures[0].tailMip);
+
+	TextureStreamer streamer;
+	TextureStreamingInit init;
+	init.budgetBytes = chainBytes + tailBytes;
+	init.maxUploadsPerFrame = 64;
+	init.maxUploadBytesPerFrame = ~0ull;
+	streamer.Initialize(init);
+	AddTextures(streamer, textures);
+
+	std::vector<StreamingChange> changes;
+	streamer.BeginFrame();
+	streamer.RequestMip(0, 0.f);
+	streamer.Update(changes);
+	Check(streamer.ResidentMip(0) == 0, "first texture fully resident");
+
+	// First one goes out of view, second one takes its memory
+	streamer.BeginFrame();
+	streamer.RequestMip(1, 0.f);
+	streamer.Update(changes);
+	Check(streamer.ResidentMip(1) == 0, "second texture fully resident");
+	Check(streamer.ResidentMip(0) == textures[0].tailMip, "unused texture evicted to the tail");
+	Check(streamer.Stats().residentBytes == init.budgetBytes, "exact budget");
+
+	bool evictionReported = false;
+	for (const StreamingChange& change : changes)
+		evictionReported = evictionReported || (change.textureIndex == 0 && change.fromMip == 0 && change.toMip == textures[0].tailMip);
+	Check(evictionReported, "eviction reported as a change");
+
+	// Both visible, the one used most recently keeps its memory
+	streamer.BeginFrame();
+	streamer.RequestMip(0, 0.f);
+	streamer.RequestMip(1, 0.f);
+	streamer.Update(changes);
+	Check(streamer.ResidentMip(1) == 0 && streamer.Stats().numPending == 1, "visible textures are not evicted");
+	streamer.Shutdown();
+}
+
+// Random visible sets, returns every change for the determinism check
+static std::vector<StreamingChange> RunRandomSimulation(uint32_t seed, bool check)
+{
+	const std::vector<TestTexture> textures = MakeTextures(64, seed);
+	uint64_t minBytes = 0;
+	for (const TestTexture& texture : textures)
+		minBytes += texture.UploadBytes(static_cast<uint32_t>(texture.mipBytes.size()), texture.tailMip);
+
+	TextureStreamer streamer;
+	TextureStreamingInit init;
+	init.budgetBytes = minBytes + 8ull * 1024 * 1024;
+	init.maxUploadsPerFrame = 8;
+	init.maxUploadBytesPerFrame = 2ull * 1024 * 1024;
+	streamer.Initialize(init);
+	AddTextures(streamer, textures);
+
+	std::mt19937 rng(seed);
+	std::vector<StreamingChange> changes, allChanges;
+	bool withinBudget = true, withinUploads = true, withinBytes = true, consistent = true, tailResident = true;
+	for (uint32_t frame = 0; frame < 500; ++frame)
+	{
+		// Camera moves every 50 frames, a different third of the textures is visible
+		std::mt19937 viewRng(seed * 1000 + frame / 50);
+		streamer.BeginFrame();
+		for (uint32_t i = 0; i < textures.size(); ++i)
+		{
+			if (viewRng() % 3 == 0)
+				streamer.RequestMip(i, static_cast<float>(rng() % 400) / 100.f);
+		}
+		if (frame == 250)
+			streamer.SetBudget(minBytes + 2ull * 1024 * 1024);
+
+		std::vector<uint32_t> before(textures.size());
+		for (uint32_t i = 0; i < textures.size(); ++i)
+			before[i] = streamer.ResidentMip(i);
+
+		streamer.Update(changes);
+		allChanges.insert(allChanges.end(), changes.begin(), changes.end());
+
+		const TextureStreamingStats& stats = streamer.Stats();
+		uint64_t residentBytes = 0, uploadBytes = 0;
+		for (uint32_t i = 0; i < textures.size(); ++i)
+		{
+			residentBytes += streamer.ResidentBytes(i);
+			tailResident = tailResident && streamer.ResidentMip(i) <= textures[i].tailMip;
+		}
+		for (const StreamingChange& change : changes)
+		{
+			consistent = consistent && change.fromMip == before[change.textureIndex] &&
+				change.toMip == streamer.ResidentMip(change.textureIndex) && change.fromMip != change.toMip;
+
+			// Only the new levels are uploaded, the owner copies the resident ones
+			const TestTexture& texture = textures[change.textureIndex];
+			uploadBytes += texture.UploadBytes(change.fromMip, change.toMip);
+		}
+
+		withinBudget = withinBudget && residentBytes == stats.residentBytes && residentBytes <= streamer.Budget();
+		withinUploads = withinUploads && stats.mipsLoaded <= init.maxUploadsPerFrame;
+		withinBytes = withinBytes && (uploadBytes <= init.maxUploadBytesPerFrame || stats.mipsLoaded == 1);
+	}
+
+	if (check)
+	{
+		Check(withinBudget, "resident bytes within budget");
+		Check(withinUploads, "uploads per frame");
+		Check(withinBytes, "upload bytes per frame");
+		Check(consistent, "changes match resident mips");
+		Check(tailResident, "tail always resident");
+		Check(!allChanges.empty(), "simulation streams");
+	}
+	streamer.Shutdown();
+	return allChanges;
+}
+
+static void TestDeterminism()
+{
+	const std::vector<StreamingChange> a = RunRandomSimulation(7, true);
+	const std::vector<StreamingChange> b = RunRandomSimulation(7, false);
+	bool same = a.size() == b.size();
+	for (size_t i = 0; same && i < a.size(); ++i)
+		same = a[i].textureIndex == b[i].textureIndex && a[i].fromMip == b[i].fromMip && a[i].toMip == b[i].toMip;
+	Check(same, "same requests give the same changes");
+
+	for (uint32_t seed = 100; seed < 110; ++seed)
+		RunRandomSimulation(seed, true);
+}
+
+int main()
+{
+	testName = "Texture streaming";
+	TestInitialState();
+	TestConvergence();
+	TestLruEviction();
+	TestDeterminism();
+
+	return TestSummary();
+}
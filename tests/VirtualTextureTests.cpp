@@ -0,0 +1,265 @@
+// Virtual texture cache tests, headless, returns non-zero on a failure
+// Hand built feedback checks the page id layout, fallback to coarser ancestors, invalid entries and
+// a full cache. Then a synthetic flight (MakeFeedbackTrace) is saved, loaded back and replayed: loads
+// and evictions must match a shadow copy of the cache, pages needed this frame are never evicted,
+// the replay is deterministic and a still camera ends with every request resident.
+
+#include <stdio.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "VirtualTexture.h"
+#include "TestCheck.h"
+
+// Page table texel fields, see BuildPageTable
+static bool TexelValid(uint32_t texel) { return (texel >> 24) != 0; }
+static uint32_t TexelMip(uint32_t texel) { return (texel >> 16) & 0xFF; }
+static uint32_t TexelSlot(uint32_t texel, uint32_t numSlotsX) { return (texel & 0xFF) + ((texel >> 8) & 0xFF) * numSlotsX; }
+
+static void TestPageId()
+{
+	const uint32_t pageId = PackPageId(VT_TEXTURE_MASK, VT_MIP_MASK, VT_PAGE_MASK, VT_PAGE_MASK - 1);
+	Check(PageTexture(pageId) == VT_TEXTURE_MASK && PageMip(pageId) == VT_MIP_MASK &&
+		PageX(pageId) == VT_PAGE_MASK && PageY(pageId) == VT_PAGE_MASK - 1, "page id round trip");
+	Check(pageId != VirtualInvalidPage, "page id is not the invalid id");
+	Check(PackPageId(3, 2, 5, 7) == ((3u << 22) | (2u << 18) | (5u << 9) | 7u), "page id layout");
+}
+
+static void TestFallback()
+{
+	// 1024 texels, 8x8 pages at mip 0, 4 mips
+	VirtualTextureCacheInit init;
+	init.numSlotsX = 4;
+	init.numSlotsY = 4;
+	VirtualTextureCache cache;
+	cache.Initialize(init);
+	const uint32_t textureId = cache.AddTexture({ 1024, 1024 });
+	Check(cache.NumMips(textureId) == 4 && cache.PagesX(textureId, 0) == 8 && cache.PagesY(textureId, 3) == 1, "page counts");
+
+	// Page and its three ancestors, coarsest loaded first
+	const uint32_t page = PackPageId(textureId, 0, 5, 2);
+	VirtualTextureUpdate update;
+	cache.AnalyzeFeedback(&page, 1, update);
+	Check(update.loads.size() == 4 && update.evictions.empty(), "page and ancestors loaded");
+	Check(!update.loads.empty() && PageMip(update.loads.front().pageId) == 3 && update.loads.back().pageId == page, "coarse mips first");
+	Check(update.dirtyTextures.size() == 1 && update.dirtyTextures[0] == textureId, "dirty texture");
+	Check(cache.FindSlot(PackPageId(textureId, 1, 2, 1)) >= 0 && cache.FindSlot(PackPageId(textureId, 2, 1, 0)) >= 0, "ancestors resident");
+
+	// Requested texel points at its slot, the others at the closest resident ancestor
+	std::vector<uint32_t> texels;
+	cache.BuildPageTable(textureId, 0, texels);
+	Check(texels.size() == 64, "page table size");
+	const uint32_t texel = texels[2 * 8 + 5];
+	Check(TexelValid(texel) && TexelMip(texel) == 0 && static_cast<int32_t>(TexelSlot(texel, init.numSlotsX)) == cache.FindSlot(page), "requested texel");
+	Check(TexelValid(texels[3 * 8 + 4]) && TexelMip(texels[3 * 8 + 4]) == 1, "sibling falls back to mip 1");
+	Check(TexelValid(texels[7 * 8 + 0]) && TexelMip(texels[7 * 8 + 0]) == 3, "far page falls back to mip 3");
+
+	// Same feedback again is all hits
+	cache.AnalyzeFeedback(&page, 1, update);
+	Check(update.loads.empty() && cache.Stats().numResident == 4 && cache.Stats().numMissing == 0, "second frame hits");
+	cache.Shutdown();
+}
+
+static void TestInvalidFeedback()
+{
+	VirtualTextureCache cache;
+	cache.Initialize(VirtualTextureCacheInit());
+	const uint32_t textureId = cache.AddTexture({ 512, 256 });
+
+	const uint32_t feedback[] =
+	{
+		VirtualInvalidPage,
+		PackPageId(textureId + 1, 0, 0, 0),	// Unknown texture
+		PackPageId(textureId, 5, 0, 0),		// Mip past the last one
+		PackPageId(textureId, 0, 4, 0),		// Page outside the texture
+		PackPageId(textureId, 0, 3, 1),
+	};
+	VirtualTextureUpdate update;
+	cache.AnalyzeFeedback(feedback, sizeof(feedback) / sizeof(feedback[0]), update);
+	Check(cache.Stats().numFeedback == 1, "invalid entries dropped");
+	Check(update.loads.size() == 3, "valid entry and ancestors loaded");
+	cache.Shutdown();
+}
+
+static void TestFullCache()
+{
+	// 4 slots, every mip 0 page of a 4x4 texture asked for
+	VirtualTextureCacheInit init;
+	init.numSlotsX = 2;
+	init.numSlotsY = 2;
+	VirtualTextureCache cache;
+	cache.Initialize(init);
+	const uint32_t textureId = cache.AddTexture({ 512, 512 });
+
+	std::vector<uint32_t> feedback;
+	for (uint32_t y = 0; y < 4; ++y)
+		for (uint32_t x = 0; x < 4; ++x)
+			feedback.push_back(PackPageId(textureId, 0, x, y));
+
+	VirtualTextureUpdate update;
+	cache.AnalyzeFeedback(feedback.data(), feedback.size(), update);
+	Check(update.loads.size() == 4 && update.evictions.empty(), "loads stop when the cache is full");
+	Check(PageMip(update.loads[0].pageId) == 2, "fallback loaded before detail");
+
+	// Needed pages stay, the next frame can't make progress without evicting them
+	cache.AnalyzeFeedback(feedback.data(), feedback.size(), update);
+	Check(update.loads.empty() && update.evictions.empty(), "pages needed this frame are not evicted");
+	cache.Shutdown();
+}
+
+struct ReplayResult
+{
+	std::vector<VirtualPageLoad> loads;
+	bool consistent = true;			// Loads and evictions match the shadow cache
+	bool neededKept = true;			// No eviction of a page needed this frame
+	bool withinLimits = true;
+	bool pageTableValid = true;		// Every request has a resident texel after the loads
+};
+
+static void Replay(const FeedbackTraceDesc& desc, const std::vector<std::vector<uint32_t>>& frames, const VirtualTextureCacheInit& init, bool checkConvergence, ReplayResult& outResult)
+{
+	VirtualTextureCache cache;
+	cache.Initialize(init);
+	for (uint32_t i = 0; i < desc.numTexturesX * desc.numTexturesY; ++i)
+		cache.AddTexture({ desc.textureSize, desc.textureSize });
+
+	std::map<uint32_t, uint32_t> shadow;	// Page id to slot
+	VirtualTextureUpdate update;
+	for (const std::vector<uint32_t>& feedback : frames)
+	{
+		cache.AnalyzeFeedback(feedback.data(), feedback.size(), update);
+		outResult.loads.insert(outResult.loads.end(), update.loads.begin(), update.loads.end());
+		outResult.withinLimits = outResult.withinLimits && update.loads.size() <= init.maxLoadsPerFrame;
+
+		// Requests and their ancestors
+		std::set<uint32_t> needed;
+		for (uint32_t pageId : feedback)
+		{
+			if (pageId == VirtualInvalidPage)
+				continue;
+			const uint32_t textureId = PageTexture(pageId);
+			uint32_t x = PageX(pageId), y = PageY(pageId);
+			needed.insert(pageId);
+			for (uint32_t mip = PageMip(pageId) + 1; mip < cache.NumMips(textureId); ++mip)
+			{
+				x = std::min(x >> 1, cache.PagesX(textureId, mip) - 1);
+				y = std::min(y >> 1, cache.PagesY(textureId, mip) - 1);
+				needed.insert(PackPageId(textureId, mip, x, y));
+			}
+		}
+
+		for (uint32_t pageId : update.evictions)
+		{
+			outResult.neededKept = outResult.neededKept && needed.count(pageId) == 0;
+			outResult.consistent = outResult.consistent && shadow.erase(pageId) == 1 && cache.FindSlot(pageId) < 0;
+		}
+		for (const VirtualPageLoad& load : update.loads)
+		{
+			outResult.consistent = outResult.consistent && load.slot < cache.NumSlots() && shadow.count(load.pageId) == 0;
+			shadow[load.pageId] = load.slot;
+		}
+		outResult.consistent = outResult.consistent && shadow.size() <= cache.NumSlots();
+		for (const auto& entry : shadow)
+		{
+			outResult.consistent = outResult.consistent && cache.FindSlot(entry.first) == static_cast<int32_t>(entry.second);
+		}
+
+		// Every request resolves to itself or an ancestor, tables built once per texture and mip
+		std::map<uint32_t, std::vector<uint32_t>> pageTables;
+		for (uint32_t pageId : feedback)
+		{
+			if (pageId == VirtualInvalidPage)
+				continue;
+			const uint32_t textureId = PageTexture(pageId);
+			const uint32_t mip = PageMip(pageId);
+			std::vector<uint32_t>& texels = pageTables[(textureId << VT_MIP_SHIFT) | mip];
+			if (texels.empty())
+				cache.BuildPageTable(textureId, mip, texels);
+
+			const uint32_t texel = texels[PageY(pageId) * cache.PagesX(textureId, mip) + PageX(pageId)];
+			outResult.pageTableValid = outResult.pageTableValid && TexelValid(texel) && TexelMip(texel) >= mip;
+			if (TexelValid(texel) && TexelMip(texel) == mip)
+				outResult.pageTableValid = outResult.pageTableValid && static_cast<int32_t>(TexelSlot(texel, init.numSlotsX)) == cache.FindSlot(pageId);
+		}
+	}
+
+	if (!checkConvergence)
+	{
+		cache.Shutdown();
+		return;
+	}
+
+	// Camera stops, the working set fits so every request ends up resident at its own mip
+	const std::vector<uint32_t>& last = frames.back();
+	for (uint32_t frame = 0; frame < 64; ++frame)
+	{
+		cache.AnalyzeFeedback(last.data(), last.size(), update);
+	}
+	Check(cache.Stats().numMissing == 0 && update.loads.empty(), "still camera converges");
+	bool allResident = true;
+	for (uint32_t pageId : last)
+	{
+		allResident = allResident && (pageId == VirtualInvalidPage || cache.FindSlot(pageId) >= 0);
+	}
+	Check(allResident, "still camera requests resident");
+	cache.Shutdown();
+}
+
+static void TestTraceReplay()
+{
+	FeedbackTraceDesc desc;
+	desc.numFrames = 120;
+	std::vector<std::vector<uint32_t>> frames;
+	MakeFeedbackTrace(desc, frames);
+
+	size_t numValid = 0;
+	for (const std::vector<uint32_t>& frame : frames)
+		numValid += std::count_if(frame.begin(), frame.end(), [](uint32_t pageId) { return pageId != VirtualInvalidPage; });
+	Check(frames.size() == desc.numFrames && numValid > 0 && numValid < frames.size() * desc.width * desc.height, "trace has ground and sky");
+
+	const char* tracePath = "VirtualTextureTests.trace";
+	std::vector<std::vector<uint32_t>> loaded;
+	Check(SaveFeedbackTrace(tracePath, frames) && LoadFeedbackTrace(tracePath, loaded) && loaded == frames, "trace save and load");
+	remove(tracePath);
+
+	VirtualTextureCacheInit init;
+	init.numSlotsX = 32;
+	init.numSlotsY = 32;
+	init.maxLoadsPerFrame = 32;
+	ReplayResult a, b;
+	Replay(desc, loaded, init, true, a);
+	Replay(desc, frames, init, false, b);
+	Check(a.consistent, "loads and evictions match the cache");
+	Check(a.neededKept, "needed pages never evicted");
+	Check(a.withinLimits, "loads per frame");
+	Check(a.pageTableValid, "page table resolves requests");
+
+	bool same = a.loads.size() == b.loads.size();
+	for (size_t i = 0; same && i < a.loads.size(); ++i)
+		same = a.loads[i].pageId == b.loads[i].pageId && a.loads[i].slot == b.loads[i].slot;
+	Check(same, "replay is deterministic");
+
+	// Small cache under pressure keeps the invariants, fallback may be missing while it thrashes
+	init.numSlotsX = 8;
+	init.numSlotsY = 8;
+	desc.numFrames = 40;
+	desc.seed = 2;
+	MakeFeedbackTrace(desc, frames);
+	ReplayResult small;
+	Replay(desc, frames, init, false, small);
+	Check(small.consistent && small.neededKept && small.withinLimits, "small cache invariants");
+}
+
+int main()
+{
+	testName = "Virtual texture";
+	TestPageId();
+	TestFallback();
+	TestInvalidFeedback();
+	TestFullCache();
+	TestTraceReplay();
+
+	return TestSummary();
+}
@@ -0,0 +1,392 @@
+// CPU benchmarks of the renderer's D3D free modules, headless (no window, no GPU)
+// CpuBenchmarks [name ...] [-threads=0] [-scene=content/Sponza/Sponza.gltf]
+// Runs the named benchmarks, every one when none is given. Synthetic scenes with fixed seeds, each
+// benchmark checks its fast path against its reference (asserts, so build with them on to verify).
+// The wide BVH and ray packet benchmarks trace the glTF scene, the synthetic terrain when it doesn't load.
+
+#include <float.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "DrawSort.h"
+#include "GltfScene.h"
+#include "HiZ.h"
+#include "IndirectDraw.h"
+#include "InstanceBVH.h"
+#include "JobSystem.h"
+#include "MultiViewCulling.h"
+#include "RayPacket.h"
+#include "RenderList.h"
+#include "TopLevelBVH.h"
+#include "TriangleBVH.h"
+#include "VirtualTexture.h"
+#include "WideBVH.h"
+
+using namespace DirectX;
+
+struct Benchmark
+{
+	const char* name;
+	const char* description;
+	void (*run)();
+};
+
+static void BenchmarkHiZ()
+{
+	// CPU reference alone, synthetic depth at 1080p
+	HiZBenchmarkResult result;
+	RunHiZBenchmark(1920, 1080, 100000, result);
+	printf("HiZ %ux%u, %u tests: build %.3f ms, test %.3f ms, per pixel %.3f ms, occluded %u, false occluded %u, false visible %u\n",
+		result.width, result.height, result.numTests, result.buildMs, result.testMs, result.bruteForceMs,
+		result.numOccluded, result.numFalseOccluded, result.numFalseVisible);
+}
+
+static void BenchmarkCulling()
+{
+	// Synthetic scaling test, linear vs BVH
+	for (uint32_t numInstances : { 10000u, 100000u, 1000000u })
+	{
+		CullingBenchmarkResult result;
+		RunCullingBenchmark(numInstances, result);
+		printf("Culling %u instances (%u visible): scalar %.3f ms, simd %.3f ms, bvh %.3f ms (build %.1f ms, refit %.3f ms)\n",
+			result.numInstances, result.numVisible, result.linearScalarMs, result.linearSimdMs,
+			result.bvhCullMs, result.bvhBuildMs, result.bvhRefitMs);
+	}
+}
+
+static void BenchmarkMultiView()
+{
+	// One pass over the bounds for every view against a CullFrustum pass per view
+	for (uint32_t numViews : { 4u, 8u, 16u })
+	{
+		MultiViewBenchmarkResult result;
+		RunMultiViewBenchmark(1000000, numViews, result);
+		printf("Multi view culling %u instances, %u views (%llu visible): separate %.3f ms, scalar %.3f ms, simd %.3f ms, %.2fx\n",
+			result.numInstances, result.numViews, static_cast<unsigned long long>(result.numVisible), result.separateMs,
+			result.multiViewScalarMs, result.multiViewSimdMs, result.speedup);
+	}
+}
+
+static void BenchmarkRenderList()
+{
+	// Serial loop against the job system at growing thread counts
+	std::vector<RenderListBenchmarkResult> results;
+	RunRenderListBenchmark(100000, results);
+	for (const RenderListBenchmarkResult& result : results)
+	{
+		printf("Render list %u instances (%u visible), %u threads, %u chunks: serial %.3f ms, parallel %.3f ms, %.2fx\n",
+			result.numInstances, result.numVisible, result.numThreads, result.numChunks,
+			result.serialMs, result.parallelMs, result.speedup);
+	}
+}
+
+static void BenchmarkIndirect()
+{
+	// CPU argument generation alone, the fallback of indirect draws
+	for (uint32_t numRecords : { 10000u, 100000u, 1000000u })
+	{
+		IndirectBenchmarkResult result;
+		RunIndirectBenchmark(jobSystem, numRecords, result);
+		printf("Indirect arguments %u records (%u draws), %u threads: serial %.3f ms, parallel %.3f ms, %.1f M args/s\n",
+			result.numRecords, result.numDraws, result.numThreads, result.serialMs, result.parallelMs, result.argsPerSecond / 1e6);
+	}
+}
+
+static void BenchmarkDrawSort()
+{
+	for (uint32_t numDraws : { 10000u, 100000u, 1000000u })
+	{
+		DrawSortBenchmarkResult result;
+		RunDrawSortBenchmark(jobSystem, numDraws, 256, result);
+		printf("Draw sort %u draws: radix %.3f ms, std::stable_sort %.3f ms, emit %.3f ms, %.1f M draws/s, "
+			"PSO changes %u -> %u, material changes %u -> %u\n",
+			result.numDraws, result.radixMs, result.stdSortMs, result.emitMs, result.drawsPerSecond / 1e6,
+			result.unsorted.psoChanges, result.sorted.psoChanges,
+			result.unsorted.materialChanges, result.sorted.materialChanges);
+	}
+}
+
+static void BenchmarkTriangleBVH()
+{
+	// Synthetic meshes, 1M+ triangles is the target size
+	for (uint32_t numTriangles : { 100000u, 1000000u, 4000000u })
+	{
+		TriangleBVHBenchmarkResult result;
+		RunTriangleBVHBenchmark(jobSystem, numTriangles, result);
+		printf("Triangle BVH %u triangles, %u threads: build %.1f ms (1 thread %.1f ms), %u nodes, depth %u, SAH cost %.2f, "
+			"%u rays %.1f ms, %.2f M rays/s, mismatches %u\n",
+			result.numTriangles, result.numThreads, result.parallelBuildMs, result.serialBuildMs, result.numNodes, result.maxDepth,
+			result.sahCost, result.numRays, result.traceMs, result.raysPerSecond / 1e6, result.numMismatches);
+	}
+}
+
+static void BenchmarkBVHBuilders()
+{
+	// Binned SAH against LBVH, then LBVH refit or rebuild on deforming foliage
+	for (uint32_t numTriangles : { 100000u, 1000000u, 4000000u })
+	{
+		BVHBuilderBenchmarkResult result;
+		RunBVHBuilderBenchmark(jobSystem, numTriangles, result);
+		printf("BVH builders %u triangles, %u threads: SAH %.1f ms (%.0f ms/M tris), LBVH %.1f ms (%.0f ms/M tris), "
+			"SAH cost %.2f vs %.2f, %.2f vs %.2f M rays/s, mismatches %u\n",
+			result.numTriangles, result.numThreads, result.sahBuildMs, result.sahMsPerMillion, result.lbvhBuildMs, result.lbvhMsPerMillion,
+			result.sahCost, result.lbvhCost, result.sahRaysPerSecond / 1e6, result.lbvhRaysPerSecond / 1e6, result.numMismatches);
+		printf("  deforming: %u frames, %u rebuilds, refit %.2f ms, max cost ratio %.2f\n",
+			result.numFrames, result.numRebuilds, result.refitMs, result.maxCostRatio);
+	}
+}
+
+static void BenchmarkTopLevelBVH()
+{
+	// Instanced scene against the same triangles flattened into one BVH
+	for (uint32_t numInstances : { 100u, 400u })
+	{
+		TopLevelBVHBenchmarkResult result;
+		RunTopLevelBVHBenchmark(jobSystem, numInstances, result);
+		printf("Top level BVH %u instances (%llu triangles, %u in BLAS), %u threads: build %.3f ms, refit %.3f ms, "
+			"flattened build %.1f ms, SAH cost %.2f -> %.2f, %.2f vs %.2f M rays/s flattened, mismatches %u\n",
+			result.numInstances, static_cast<unsigned long long>(result.numTriangles), result.numBlasTriangles, result.numThreads,
+			result.buildMs, result.refitMs, result.flattenedBuildMs, result.builtSahCost, result.refitSahCost,
+			result.instancedRaysPerSecond / 1e6, result.flattenedRaysPerSecond / 1e6, result.numMismatches);
+	}
+}
+
+static std::string scenePath = "content/Sponza/Sponza.gltf";
+
+// World space triangles traced by the ray benchmarks, loaded once
+struct RayBenchmarkScene
+{
+	std::string name;
+	std::vector<XMFLOAT3> positions;
+	std::vector<uint32_t> indices;
+	RayBenchmarkView view;
+	TriangleMesh mesh;
+};
+
+static bool SkipImageData(tinygltf::Image*, const int, std::string*, std::string*, int, int, const unsigned char*, int, void*)
+{
+	return true;
+}
+
+// Triangle lists of every mesh node. Default view of ReferenceRenderer, the center from the front a little above
+static bool LoadRayBenchmarkScene(const std::string& filePath, RayBenchmarkScene& scene)
+{
+	tinygltf::Model model;
+	if (!LoadGltfFile(filePath, SkipImageData, nullptr, model))
+		return false;
+
+	std::vector<std::vector<GltfPrimitive>> meshes(model.meshes.size());
+	for (size_t mesh = 0; mesh < model.meshes.size(); ++mesh)
+	{
+		meshes[mesh].resize(model.meshes[mesh].primitives.size());
+		for (size_t primitive = 0; primitive < meshes[mesh].size(); ++primitive)
+		{
+			LoadGltfPrimitive(model, model.meshes[mesh].primitives[primitive], meshes[mesh][primitive]);
+		}
+	}
+
+	XMVECTOR boundsMin = XMVectorReplicate(FLT_MAX);
+	XMVECTOR boundsMax = XMVectorReplicate(-FLT_MAX);
+	std::vector<GltfMeshNode> meshNodes;
+	GetGltfMeshNodes(model, meshNodes);
+	for (const GltfMeshNode& meshNode : meshNodes)
+	{
+		const XMMATRIX transform = XMLoadFloat4x4(&meshNode.transform);
+		for (const GltfPrimitive& primitive : meshes[meshNode.meshIndex])
+		{
+			if (!primitive.isTriangleList)
+				continue;
+
+			const uint32_t firstVertex = static_cast<uint32_t>(scene.positions.size());
+			for (const MeshVertex& vertex : primitive.vertices)
+			{
+				const XMVECTOR world = XMVector3TransformCoord(XMLoadFloat3(&vertex.Position), transform);
+				boundsMin = XMVectorMin(boundsMin, world);
+				boundsMax = XMVectorMax(boundsMax, world);
+				XMFLOAT3 position;
+				XMStoreFloat3(&position, world);
+				scene.positions.push_back(position);
+			}
+			for (uint32_t index : primitive.indices)
+			{
+				scene.indices.push_back(firstVertex + index);
+			}
+		}
+	}
+	if (scene.indices.empty())
+		return false;
+
+	const XMVECTOR extents = (boundsMax - boundsMin) * 0.5f;
+	const XMVECTOR target = boundsMin + extents;
+	const float radius = std::max(XMVectorGetX(XMVector3Length(extents)), 1e-3f);
+	const XMVECTOR eye = target + XMVectorSet(0.f, 0.5f, -1.8f, 0.f) * radius;
+	const XMMATRIX view = XMMatrixLookAtLH(eye, target, XMVectorSet(0.f, 1.f, 0.f, 0.f));
+	const XMMATRIX proj = XMMatrixPerspectiveFovLH(XM_PI / 3, static_cast<float>(scene.view.width) / scene.view.height, radius * 1e-3f, radius * 10.f);
+	XMStoreFloat4x4(&scene.view.invViewProj, XMMatrixInverse(nullptr, view * proj));
+	XMStoreFloat3(&scene.view.cameraPosition, eye);
+	scene.name = filePath;
+	return true;
+}
+
+// 1M triangle benchmark terrain seen from above its edge
+static void MakeTerrainBenchmarkScene(RayBenchmarkScene& scene)
+{
+	MakeBenchmarkMesh(1000000, scene.positions, scene.indices);
+	const XMVECTOR eye = XMVectorSet(0.f, 30.f, -120.f, 1.f);
+	const XMMATRIX view = XMMatrixLookAtLH(eye, XMVectorSet(0.f, 0.f, 0.f, 1.f), XMVectorSet(0.f, 1.f, 0.f, 0.f));
+	const XMMATRIX proj = XMMatrixPerspectiveFovLH(XM_PI / 3, static_cast<float>(scene.view.width) / scene.view.height, 0.1f, 1000.f);
+	XMStoreFloat4x4(&scene.view.invViewProj, XMMatrixInverse(nullptr, view * proj));
+	XMStoreFloat3(&scene.view.cameraPosition, eye);
+	scene.name = "synthetic terrain";
+}
+
+// Loaded on first use, the sun is low in front of the camera in both scenes
+static const RayBenchmarkScene& GetRayBenchmarkScene()
+{
+	static RayBenchmarkScene scene;
+	if (scene.name.empty())
+	{
+		if (!LoadRayBenchmarkScene(scenePath, scene))
+		{
+			printf("Can't load %s, tracing the synthetic terrain\n", scenePath.c_str());
+			scene = RayBenchmarkScene();
+			MakeTerrainBenchmarkScene(scene);
+		}
+		XMStoreFloat3(&scene.view.lightDirection, XMVector3Normalize(XMVectorSet(0.3f, -0.5f, -0.8f, 0.f)));
+		scene.mesh.positions = scene.positions.data();
+		scene.mesh.positionStride = sizeof(XMFLOAT3);
+		scene.mesh.indices = scene.indices.data();
+		scene.mesh.numTriangles = static_cast<uint32_t>(scene.indices.size() / 3);
+	}
+	return scene;
+}
+
+static void BenchmarkWideBVH()
+{
+	const RayBenchmarkScene& scene = GetRayBenchmarkScene();
+	WideBVHBenchmarkResult result;
+	RunWideBVHBenchmark(jobSystem, scene.mesh, scene.view, result);
+
+	const char* names[] = { "binary", "4 wide", "8 wide" };
+	printf("Wide BVH %s, %u triangles, %u threads, AVX2 %d: SAH build %.1f ms, collapse %.1f / %.1f ms, nodes %llu / %llu / %llu bytes, mismatches %u\n",
+		scene.name.c_str(), result.numTriangles, result.numThreads, result.simd8 ? 1 : 0, result.binaryBuildMs,
+		result.collapseMs[0], result.collapseMs[1], static_cast<unsigned long long>(result.nodeBytes[0]),
+		static_cast<unsigned long long>(result.nodeBytes[1]), static_cast<unsigned long long>(result.nodeBytes[2]), result.numMismatches);
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		printf("  %s: primary %.2f, shadow %.2f, incoherent %.2f M rays/s\n", names[i],
+			result.raysPerSecond[i][RayBenchmarkKind_Primary] / 1e6, result.raysPerSecond[i][RayBenchmarkKind_Shadow] / 1e6,
+			result.raysPerSecond[i][RayBenchmarkKind_Incoherent] / 1e6);
+	}
+}
+
+static void BenchmarkRayPackets()
+{
+	// Same mesh and rays as the wide BVH, single rays against packets of 8 and 16 and sorted streams
+	const RayBenchmarkScene& scene = GetRayBenchmarkScene();
+	RayPacketBenchmarkResult result;
+	RunRayPacketBenchmark(jobSystem, scene.mesh, scene.view, result);
+
+	const char* names[] = { "single", "packet 8", "packet 16", "stream" };
+	printf("Ray packets %s, %u triangles, %u threads: %u primary, %u shadow, %u incoherent rays, stream sort %.1f / %.1f / %.1f ms, mismatches %u\n",
+		scene.name.c_str(), result.numTriangles, result.numThreads, result.numRays[RayBenchmarkKind_Primary],
+		result.numRays[RayBenchmarkKind_Shadow], result.numRays[RayBenchmarkKind_Incoherent],
+		result.streamSortMs[RayBenchmarkKind_Primary], result.streamSortMs[RayBenchmarkKind_Shadow],
+		result.streamSortMs[RayBenchmarkKind_Incoherent], result.numMismatches);
+	for (uint32_t i = 0; i < RayPacketMode_Count; ++i)
+	{
+		printf("  %s: primary %.2f, shadow %.2f, incoherent %.2f M rays/s\n", names[i],
+			result.raysPerSecond[i][RayBenchmarkKind_Primary] / 1e6, result.raysPerSecond[i][RayBenchmarkKind_Shadow] / 1e6,
+			result.raysPerSecond[i][RayBenchmarkKind_Incoherent] / 1e6);
+	}
+}
+
+static void BenchmarkVirtualTexture()
+{
+	// Synthetic flight over 16 virtual textures of 16k, 1080p feedback at 1/16
+	for (uint32_t numSlots : { 16u, 32u, 64u })
+	{
+		FeedbackTraceDesc desc;
+		VirtualTextureCacheInit init;
+		init.numSlotsX = numSlots;
+		init.numSlotsY = numSlots;
+		VirtualTextureBenchmarkResult result;
+		RunVirtualTextureBenchmark(desc, init, result);
+		printf("Virtual texture %u frames, %u feedback entries, %ux%u slots: analyze %.3f ms (max %.3f), page tables %.3f ms, hit rate %.1f%%, %llu loads, %llu evictions\n",
+			result.numFrames, result.feedbackSize, numSlots, numSlots, result.analyzeMs, result.maxAnalyzeMs, result.pageTableMs,
+			result.hitRate * 100.0, static_cast<unsigned long long>(result.numLoads), static_cast<unsigned long long>(result.numEvictions));
+	}
+}
+
+static const Benchmark benchmarks[] =
+{
+	{ "hiz", "HiZ pyramid build and box tests against per pixel tests", BenchmarkHiZ },
+	{ "culling", "frustum culling, scalar and AVX2 linear against the instance BVH", BenchmarkCulling },
+	{ "multiview", "every view in one pass against a pass per view", BenchmarkMultiView },
+	{ "renderlist", "frustum cull and extract, serial against parallel", BenchmarkRenderList },
+	{ "indirect", "indirect draw arguments, serial against parallel", BenchmarkIndirect },
+	{ "drawsort", "draw packet radix sort against std::stable_sort", BenchmarkDrawSort },
+	{ "trianglebvh", "binned SAH build and closest hit rays", BenchmarkTriangleBVH },
+	{ "bvhbuilders", "binned SAH against LBVH, refit of a deforming mesh", BenchmarkBVHBuilders },
+	{ "toplevelbvh", "instanced scene against the flattened triangles", BenchmarkTopLevelBVH },
+	{ "widebvh", "binary, 4 and 8 wide BVH on primary, shadow and incoherent rays of the scene", BenchmarkWideBVH },
+	{ "raypackets", "single rays against packets and sorted streams of the scene", BenchmarkRayPackets },
+	{ "virtualtexture", "feedback analysis and page tables of a replayed flight", BenchmarkVirtualTexture },
+};
+
+int main(int argc, char** argv)
+{
+	JobSystemInit jobInit;
+	std::vector<const Benchmark*> selected;
+	bool valid = true;
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string token = argv[i];
+		if (token.find("-threads=") == 0)
+		{
+			jobInit.numThreads = static_cast<uint32_t>(std::stoul(token.substr(9)));
+			continue;
+		}
+		if (token.find("-scene=") == 0)
+		{
+			scenePath = token.substr(7);
+			continue;
+		}
+
+		const Benchmark* found = nullptr;
+		for (const Benchmark& benchmark : benchmarks)
+		{
+			found = (token == benchmark.name) ? &benchmark : found;
+		}
+		valid &= (found != nullptr);
+		selected.push_back(found);
+	}
+
+	if (!valid)
+	{
+		printf("Usage: CpuBenchmarks [name ...] [-threads=0] [-scene=content/Sponza/Sponza.gltf]\n");
+		for (const Benchmark& benchmark : benchmarks)
+		{
+			printf("    %-15s %s\n", benchmark.name, benchmark.description);
+		}
+		return 1;
+	}
+	if (selected.empty())
+	{
+		for (const Benchmark& benchmark : benchmarks)
+		{
+			selected.push_back(&benchmark);
+		}
+	}
+
+	jobSystem.Initialize(jobInit);
+	for (const Benchmark* benchmark : selected)
+	{
+		benchmark->run();
+	}
+	jobSystem.Shutdown();
+	return 0;
+}
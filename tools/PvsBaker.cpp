@@ -0,0 +1,120 @@
+// Offline potentially visible set baker, headless (no D3D, no window)
+// PvsBaker <model.gltf|glb> [-cell=2] [-samples=8] [-rays=256] [-dilation=1] [-threads=0] [-out=model.pvs]
+// Instances are numbered like Model::BuildInstances, nodes with a mesh in scene order then primitives
+
+#include <stdio.h>
+#include <filesystem>
+#include <string>
+#include "GltfScene.h"
+#include "Pvs.h"
+
+using namespace DirectX;
+
+// Textures aren't read, alpha tested and blended materials don't occlude at all
+static bool SkipImageData(tinygltf::Image*, const int, std::string*, std::string*, int, int, const unsigned char*, int, void*)
+{
+	return true;
+}
+
+// World space triangles, one instance per primitive of every mesh node. Instances with a transparent
+// material are flagged, rays see them and continue
+static void BuildPvsScene(const tinygltf::Model& model, PvsScene& scene)
+{
+	std::vector<std::vector<GltfPrimitive>> meshes(model.meshes.size());
+	for (size_t mesh = 0; mesh < model.meshes.size(); ++mesh)
+	{
+		meshes[mesh].resize(model.meshes[mesh].primitives.size());
+		for (size_t primitive = 0; primitive < meshes[mesh].size(); ++primitive)
+		{
+			LoadGltfPrimitive(model, model.meshes[mesh].primitives[primitive], meshes[mesh][primitive]);
+		}
+	}
+
+	std::vector<GltfMeshNode> meshNodes;
+	GetGltfMeshNodes(model, meshNodes);
+	for (const GltfMeshNode& meshNode : meshNodes)
+	{
+		const XMMATRIX transform = XMLoadFloat4x4(&meshNode.transform);
+		for (const GltfPrimitive& primitive : meshes[meshNode.meshIndex])
+		{
+			const uint32_t instance = scene.numInstances++;
+			scene.instanceTransparent.push_back(IsGltfMaterialTransparent(model, primitive.materialIndex) ? 1 : 0);
+			if (!primitive.isTriangleList)
+				continue;
+
+			const uint32_t firstVertex = static_cast<uint32_t>(scene.positions.size());
+			for (const MeshVertex& vertex : primitive.vertices)
+			{
+				XMFLOAT3 world;
+				XMStoreFloat3(&world, XMVector3Transform(XMLoadFloat3(&vertex.Position), transform));
+				scene.positions.push_back(world);
+			}
+			for (uint32_t index : primitive.indices)
+			{
+				scene.indices.push_back(firstVertex + index);
+			}
+			scene.triangleInstances.resize(scene.indices.size() / 3, instance);
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::string modelPath;
+	std::string outPath;
+	PvsBakeSettings settings;
+	JobSystemInit jobInit;
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string token = argv[i];
+		if (token.find("-cell=") == 0)
+			settings.cellSize = std::stof(token.substr(6));
+		else if (token.find("-samples=") == 0)
+			settings.samplesPerCell = static_cast<uint32_t>(std::stoul(token.substr(9)));
+		else if (token.find("-rays=") == 0)
+			settings.raysPerSample = static_cast<uint32_t>(std::stoul(token.substr(6)));
+		else if (token.find("-dilation=") == 0)
+			settings.dilation = static_cast<uint32_t>(std::stoul(token.substr(10)));
+		else if (token.find("-threads=") == 0)
+			jobInit.numThreads = static_cast<uint32_t>(std::stoul(token.substr(9)));
+		else if (token.find("-out=") == 0)
+			outPath = token.substr(5);
+		else
+			modelPath = token;
+	}
+
+	if (modelPath.empty() || settings.cellSize <= 0.f || settings.samplesPerCell == 0 || settings.raysPerSample == 0)
+	{
+		printf("Usage: PvsBaker <model.gltf|glb> [-cell=2] [-samples=8] [-rays=256] [-dilation=1] [-threads=0] [-out=model.pvs]\n");
+		return 1;
+	}
+	if (outPath.empty())
+	{
+		outPath = std::filesystem::u8path(modelPath).replace_extension(".pvs").u8string();
+	}
+
+	tinygltf::Model model;
+	if (!LoadGltfFile(modelPath, SkipImageData, nullptr, model)) { return 1; }
+
+	PvsScene scene;
+	BuildPvsScene(model, scene);
+	printf("Scene: %u instances, %zu triangles\n", scene.numInstances, scene.triangleInstances.size());
+
+	jobSystem.Initialize(jobInit);
+	PvsData pvs;
+	PvsBakeStats stats;
+	BakePvs(jobSystem, scene, settings, pvs, stats);
+	jobSystem.Shutdown();
+
+	printf("Cells %u (%u x %u x %u, size %.2f), navigable %u, sets %u, %.1f visible per cell\n",
+		stats.numCells, pvs.dims[0], pvs.dims[1], pvs.dims[2], pvs.cellSize, stats.numNavigable, stats.numSets, stats.averageVisible);
+	printf("Rays %llu, grid cells %u, %.1f ms, %.1f KB\n",
+		static_cast<unsigned long long>(stats.numRays), stats.numGridCells, stats.bakeMs, stats.fileBytes / 1024.0);
+
+	if (!pvs.Save(outPath))
+	{
+		return 1;
+	}
+	printf("Saved %s\n", outPath.c_str());
+	return 0;
+}
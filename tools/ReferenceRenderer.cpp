@@ -0,0 +1,357 @@
+// Reference path traced image of a glTF scene, headless (no D3D, no window)
+// ReferenceRenderer <model.gltf|glb> [-width=1280] [-height=720] [-spp=64] [-bounces=8] [-tile=16] [-threads=0]
+//     [-camera=x,y,z] [-target=x,y,z] [-fov=60] [-sun=azimuth,elevation] [-sunradius=0.27] [-intensity=3] [-ambient=0.5]
+//     [-exposure=1] [-seed=0] [-nee=1] [-rr=3] [-mode=megakernel|wavefront] [-wave=131072] [-compare] [-scaling]
+//     [-convergence=1024] [-out=model]
+// Writes <out>.hdr (linear radiance) and <out>.png (exposed sRGB). The sun follows the application's
+// azimuth and elevation, the camera frames the scene bounds unless given.
+// -compare renders with both modes (same image) and prints their throughput
+// -scaling renders the same image on 1, 2, 4 ... hardware threads and prints samples/s per thread count
+// -convergence renders a reference at the given spp, then RMSE and time of BSDF sampling only and of
+// next event estimation at 1, 2, 4 ... -spp, and saves the reference
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include "GltfScene.h"
+#include "PathTracer.h"
+#include "stb_image_write.h"	// Implementation in GltfScene.cpp
+
+using namespace DirectX;
+
+// Undecodable images (DDS, KTX2 without fallback) are left empty, materials use their factors
+static bool LoadImageData(tinygltf::Image* image, const int imageIndex, std::string* err, std::string* warn, int reqWidth, int reqHeight,
+	const unsigned char* bytes, int size, void* userData)
+{
+	std::string decodeError;
+	if (!tinygltf::LoadImageData(image, imageIndex, &decodeError, warn, reqWidth, reqHeight, bytes, size, userData))
+	{
+		printf("Warning: image %d not decoded, %s\n", imageIndex, decodeError.c_str());
+		image->image.clear();
+	}
+	return true;
+}
+
+// One instance per primitive of every mesh node. firstMesh maps glTF meshes to scene meshes
+static void AddInstances(const tinygltf::Model& model, const std::vector<uint32_t>& firstMesh, PathTracerScene& scene,
+	XMFLOAT3& boundsMin, XMFLOAT3& boundsMax)
+{
+	std::vector<GltfMeshNode> meshNodes;
+	GetGltfMeshNodes(model, meshNodes);
+	for (const GltfMeshNode& meshNode : meshNodes)
+	{
+		const XMMATRIX transform = XMLoadFloat4x4(&meshNode.transform);
+		for (uint32_t primitive = 0; primitive < model.meshes[meshNode.meshIndex].primitives.size(); ++primitive)
+		{
+			BVHInstance instance;
+			XMStoreFloat3x4(&instance.transform, transform);
+			instance.instanceID = firstMesh[meshNode.meshIndex] + primitive;
+			instance.instanceMask = 0xFF;
+			scene.instances.push_back(instance);
+
+			for (const MeshVertex& vertex : scene.meshes[instance.instanceID].vertices)
+			{
+				const XMVECTOR world = XMVector3TransformCoord(XMLoadFloat3(&vertex.Position), transform);
+				XMStoreFloat3(&boundsMin, XMVectorMin(XMLoadFloat3(&boundsMin), world));
+				XMStoreFloat3(&boundsMax, XMVectorMax(XMLoadFloat3(&boundsMax), world));
+			}
+		}
+	}
+}
+
+// 1 to 4 channels of 8 or 16 bits to RGBA8, grey is replicated
+static void ConvertImage(const tinygltf::Image& image, PathTracerImage& outImage)
+{
+	if (image.image.empty() || image.width <= 0 || image.height <= 0 || image.component < 1 || image.component > 4)
+	{
+		return;
+	}
+
+	outImage.width = static_cast<uint32_t>(image.width);
+	outImage.height = static_cast<uint32_t>(image.height);
+	outImage.texels.resize(static_cast<size_t>(outImage.width) * outImage.height * 4);
+	const size_t bytesPerChannel = (image.bits == 16) ? 2 : 1;
+	for (size_t i = 0; i < static_cast<size_t>(outImage.width) * outImage.height; ++i)
+	{
+		for (int c = 0; c < 4; ++c)
+		{
+			int channel = c;
+			if (image.component < 3)
+				channel = (c < 3) ? 0 : ((image.component == 2) ? 1 : -1);
+			else if (c == 3 && image.component == 3)
+				channel = -1;
+
+			uint8_t value = 255;
+			if (channel >= 0)
+			{
+				const unsigned char* source = &image.image[(i * image.component + channel) * bytesPerChannel];
+				value = (bytesPerChannel == 2) ? static_cast<uint8_t>(reinterpret_cast<const uint16_t*>(source)[0] >> 8) : source[0];
+			}
+			outImage.texels[i * 4 + c] = value;
+		}
+	}
+}
+
+static void PrintStats(const PathTracerSettings& settings, const PathTracerStats& stats)
+{
+	printf("%s %u x %u, %u spp, %u bounces: %.1f ms on %u threads, %.0f samples/s, %.2f Mrays/s\n",
+		(settings.mode == PathTracerMode_Wavefront) ? "Wavefront" : "Megakernel", settings.width, settings.height, settings.samplesPerPixel,
+		settings.maxBounces, stats.renderMs, stats.numThreads, stats.samplesPerSecond, stats.raysPerSecond / 1e6);
+	if (settings.mode == PathTracerMode_Wavefront)
+	{
+		printf("    %u waves, generate %.1f ms, extend %.1f ms, sort %.1f ms, shade %.1f ms, connect %.1f ms\n",
+			stats.numWaves, stats.generateMs, stats.extendMs, stats.sortMs, stats.shadeMs, stats.connectMs);
+	}
+	else
+	{
+		printf("    %u of %u tiles stolen\n", stats.numStolenTiles, stats.numTiles);
+	}
+}
+
+static bool ParseFloat3(const std::string& text, XMFLOAT3& out)
+{
+	return sscanf(text.c_str(), "%f,%f,%f", &out.x, &out.y, &out.z) == 3;
+}
+
+int main(int argc, char** argv)
+{
+	std::string modelPath;
+	std::string outPath;
+	PathTracerSettings settings;
+	settings.samplesPerPixel = 64;
+	JobSystemInit jobInit;
+	XMFLOAT3 camera, target;
+	bool hasCamera = false, hasTarget = false, compare = false, scaling = false;
+	uint32_t convergenceSamples = 0;
+	float fov = 60.f;
+	float azimuth = XM_PI, elevation = -1.f, sunRadius = 0.27f;
+	float intensity = 3.f, ambient = 0.5f, exposure = 1.f;
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string token = argv[i];
+		if (token.find("-width=") == 0)
+			settings.width = static_cast<uint32_t>(std::stoul(token.substr(7)));
+		else if (token.find("-height=") == 0)
+			settings.height = static_cast<uint32_t>(std::stoul(token.substr(8)));
+		else if (token.find("-spp=") == 0)
+			settings.samplesPerPixel = static_cast<uint32_t>(std::stoul(token.substr(5)));
+		else if (token.find("-bounces=") == 0)
+			settings.maxBounces = static_cast<uint32_t>(std::stoul(token.substr(9)));
+		else if (token.find("-tile=") == 0)
+			settings.tileSize = static_cast<uint32_t>(std::stoul(token.substr(6)));
+		else if (token.find("-seed=") == 0)
+			settings.seed = static_cast<uint32_t>(std::stoul(token.substr(6)));
+		else if (token.find("-threads=") == 0)
+			jobInit.numThreads = static_cast<uint32_t>(std::stoul(token.substr(9)));
+		else if (token.find("-camera=") == 0)
+			hasCamera = ParseFloat3(token.substr(8), camera);
+		else if (token.find("-target=") == 0)
+			hasTarget = ParseFloat3(token.substr(8), target);
+		else if (token.find("-fov=") == 0)
+			fov = std::stof(token.substr(5));
+		else if (token.find("-sun=") == 0)
+			sscanf(token.substr(5).c_str(), "%f,%f", &azimuth, &elevation);
+		else if (token.find("-sunradius=") == 0)
+			sunRadius = std::stof(token.substr(11));
+		else if (token.find("-intensity=") == 0)
+			intensity = std::stof(token.substr(11));
+		else if (token.find("-ambient=") == 0)
+			ambient = std::stof(token.substr(9));
+		else if (token.find("-exposure=") == 0)
+			exposure = std::stof(token.substr(10));
+		else if (token.find("-nee=") == 0)
+			settings.nextEventEstimation = std::stoul(token.substr(5)) != 0;
+		else if (token.find("-rr=") == 0)
+			settings.russianRouletteBounce = static_cast<uint32_t>(std::stoul(token.substr(4)));
+		else if (token == "-mode=wavefront")
+			settings.mode = PathTracerMode_Wavefront;
+		else if (token == "-mode=megakernel")
+			settings.mode = PathTracerMode_Megakernel;
+		else if (token.find("-wave=") == 0)
+			settings.wavefrontPaths = static_cast<uint32_t>(std::stoul(token.substr(6)));
+		else if (token == "-compare")
+			compare = true;
+		else if (token == "-scaling")
+			scaling = true;
+		else if (token.find("-convergence=") == 0)
+			convergenceSamples = static_cast<uint32_t>(std::stoul(token.substr(13)));
+		else if (token.find("-out=") == 0)
+			outPath = token.substr(5);
+		else
+			modelPath = token;
+	}
+
+	if (modelPath.empty() || settings.width == 0 || settings.height == 0 || settings.samplesPerPixel == 0 || fov <= 0.f || fov >= 180.f || sunRadius < 0.f)
+	{
+		printf("Usage: ReferenceRenderer <model.gltf|glb> [-width=1280] [-height=720] [-spp=64] [-bounces=8] [-tile=16] [-threads=0]\n"
+			"    [-camera=x,y,z] [-target=x,y,z] [-fov=60] [-sun=azimuth,elevation] [-sunradius=0.27] [-intensity=3] [-ambient=0.5]\n"
+			"    [-exposure=1] [-seed=0] [-nee=1] [-rr=3] [-mode=megakernel|wavefront] [-wave=131072] [-compare] [-scaling]\n"
+			"    [-convergence=1024] [-out=model]\n");
+		return 1;
+	}
+	if (outPath.empty())
+	{
+		outPath = std::filesystem::u8path(modelPath).replace_extension("").u8string();
+	}
+
+	tinygltf::Model model;
+	if (!LoadGltfFile(modelPath, LoadImageData, nullptr, model)) { return 1; }
+
+	// Texture indices stay glTF textures
+	PathTracerScene scene;
+	for (const tinygltf::Material& mat : model.materials)
+	{
+		MaterialData material;
+		LoadGltfMaterial(mat, material);
+		scene.materials.push_back(material);
+	}
+	for (const tinygltf::Texture& texture : model.textures)
+	{
+		scene.textures.push_back(texture.source);
+	}
+	scene.images.resize(model.images.size());
+	for (size_t i = 0; i < model.images.size(); ++i)
+	{
+		ConvertImage(model.images[i], scene.images[i]);
+	}
+
+	std::vector<uint32_t> firstMesh;
+	for (const tinygltf::Mesh& mesh : model.meshes)
+	{
+		firstMesh.push_back(static_cast<uint32_t>(scene.meshes.size()));
+		for (const tinygltf::Primitive& primitive : mesh.primitives)
+		{
+			// Other modes and primitives without positions stay empty, instance numbering is kept
+			GltfPrimitive gltfPrimitive;
+			LoadGltfPrimitive(model, primitive, gltfPrimitive);
+
+			scene.meshes.emplace_back();
+			PathTracerMesh& sceneMesh = scene.meshes.back();
+			sceneMesh.materialIndex = primitive.material;
+			if (gltfPrimitive.isTriangleList)
+			{
+				sceneMesh.vertices = std::move(gltfPrimitive.vertices);
+				sceneMesh.indices = std::move(gltfPrimitive.indices);
+				sceneMesh.hasTangent = gltfPrimitive.hasTangent;
+				sceneMesh.hasVertexColor = gltfPrimitive.hasVertexColor;
+			}
+		}
+	}
+
+	XMFLOAT3 boundsMin(FLT_MAX, FLT_MAX, FLT_MAX), boundsMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	AddInstances(model, firstMesh, scene, boundsMin, boundsMax);
+
+	scene.light.direction = XMFLOAT3(cosf(elevation) * cosf(azimuth), sinf(elevation), cosf(elevation) * sinf(azimuth));
+	scene.light.intensity = intensity;
+	scene.light.color = XMVectorSet(1.f, 1.f, 1.f, 1.f);
+	scene.light.ambient = XMVectorSet(ambient, ambient, ambient, 1.f);
+	scene.sunAngularRadius = XMConvertToRadians(sunRadius);
+
+	jobSystem.Initialize(jobInit);
+	scene.Build(jobSystem);
+	size_t numTriangles = 0;
+	for (const PathTracerMesh& mesh : scene.meshes)
+	{
+		numTriangles += mesh.indices.size() / 3;
+	}
+	printf("Scene: %zu meshes, %zu instances, %zu triangles, %zu images, %zu emissive triangles\n", scene.meshes.size(), scene.instances.size(),
+		numTriangles, scene.images.size(), scene.emitters.size());
+
+	// Default view looks at the center from the front, a little above
+	const bool hasBounds = boundsMin.x <= boundsMax.x;
+	const XMVECTOR extents = hasBounds ? (XMLoadFloat3(&boundsMax) - XMLoadFloat3(&boundsMin)) * 0.5f : XMVectorZero();
+	const float radius = std::max(XMVectorGetX(XMVector3Length(extents)), 1e-3f);
+	if (!hasTarget)
+	{
+		XMStoreFloat3(&target, hasBounds ? XMLoadFloat3(&boundsMin) + extents : XMVectorZero());
+	}
+	if (!hasCamera)
+	{
+		XMStoreFloat3(&camera, XMLoadFloat3(&target) + XMVectorSet(0.f, 0.5f, -1.8f, 0.f) * radius);
+	}
+	const XMMATRIX view = XMMatrixLookAtLH(XMLoadFloat3(&camera), XMLoadFloat3(&target), XMVectorSet(0.f, 1.f, 0.f, 0.f));
+	const XMMATRIX proj = XMMatrixPerspectiveFovLH(XMConvertToRadians(fov), static_cast<float>(settings.width) / settings.height, radius * 1e-3f, radius * 10.f);
+	XMStoreFloat4x4(&settings.invViewProj, XMMatrixInverse(nullptr, XMMatrixMultiply(view, proj)));
+	settings.cameraPosition = camera;
+
+	std::vector<float> rgb;
+	PathTracerStats stats;
+	if (convergenceSamples > 0)
+	{
+		PathTracerConvergenceResult result;
+		RunPathTracerConvergence(jobSystem, scene, settings, convergenceSamples, settings.samplesPerPixel, result);
+		printf("Reference %u spp: %.1f ms\n", result.referenceSamples, result.referenceMs);
+		printf("    Spp  BSDF RMSE  BSDF ms  NEE RMSE  NEE ms\n");
+		for (size_t i = 0; i < result.nextEvent.size(); ++i)
+		{
+			const PathTracerConvergencePoint& bsdf = result.bsdfSampling[i];
+			const PathTracerConvergencePoint& nee = result.nextEvent[i];
+			printf("%7u  %9.4f  %7.1f  %8.4f  %6.1f\n", nee.samplesPerPixel, bsdf.rmse, bsdf.renderMs, nee.rmse, nee.renderMs);
+		}
+		printf("Next event estimation reaches the same RMSE %.1fx faster\n", result.speedup);
+
+		rgb = std::move(result.referenceRgb);
+	}
+	else if (scaling)
+	{
+		// Separate pools, the shared one keeps its size. Same image every time
+		const uint32_t maxThreads = std::max(std::thread::hardware_concurrency(), 1u);
+		double baseSamplesPerSecond = 0.0;
+		printf("Threads  Samples/s  Mrays/s  Speedup  Efficiency  Stolen tiles\n");
+		for (uint32_t numThreads = 1; ; numThreads = std::min(numThreads * 2, maxThreads))
+		{
+			JobSystem jobs;
+			jobs.Initialize(JobSystemInit{ numThreads });
+			RenderPathTraced(jobs, scene, settings, rgb, stats);
+			jobs.Shutdown();
+
+			if (numThreads == 1)
+				baseSamplesPerSecond = stats.samplesPerSecond;
+			const double speedup = stats.samplesPerSecond / baseSamplesPerSecond;
+			printf("%7u  %9.0f  %7.2f  %6.2fx  %9.0f%%  %u/%u\n", numThreads, stats.samplesPerSecond, stats.raysPerSecond / 1e6,
+				speedup, 100.0 * speedup / numThreads, stats.numStolenTiles, stats.numTiles);
+			if (numThreads == maxThreads)
+				break;
+		}
+	}
+	else if (compare)
+	{
+		std::vector<float> megakernelRgb;
+		PathTracerStats megakernelStats;
+		settings.mode = PathTracerMode_Megakernel;
+		RenderPathTraced(jobSystem, scene, settings, megakernelRgb, megakernelStats);
+		PrintStats(settings, megakernelStats);
+		settings.mode = PathTracerMode_Wavefront;
+		RenderPathTraced(jobSystem, scene, settings, rgb, stats);
+		PrintStats(settings, stats);
+
+		float maxDifference = 0.f;
+		for (size_t i = 0; i < rgb.size(); ++i)
+		{
+			maxDifference = std::max(maxDifference, fabsf(rgb[i] - megakernelRgb[i]));
+		}
+		printf("Wavefront %.2fx megakernel samples/s, largest radiance difference %g\n", stats.samplesPerSecond / megakernelStats.samplesPerSecond, maxDifference);
+	}
+	else
+	{
+		RenderPathTraced(jobSystem, scene, settings, rgb, stats);
+		PrintStats(settings, stats);
+	}
+	jobSystem.Shutdown();
+
+	std::vector<uint8_t> rgba;
+	EncodePathTracedImage(rgb, exposure, rgba);
+	const std::string hdrPath = outPath + ".hdr";
+	const std::string pngPath = outPath + ".png";
+	if (!stbi_write_hdr(hdrPath.c_str(), settings.width, settings.height, 3, rgb.data()) ||
+		!stbi_write_png(pngPath.c_str(), settings.width, settings.height, 4, rgba.data(), settings.width * 4))
+	{
+		printf("Error: can't write %s\n", outPath.c_str());
+		return 1;
+	}
+	printf("Saved %s and %s\n", hdrPath.c_str(), pngPath.c_str());
+	return 0;
+}